@@ -56,10 +56,15 @@ LOCAL_SRC_FILES := \
 	bluez/src/shared/mgmt.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/idmap.c \
 	bluez/src/shared/ringbuf.c \
 	bluez/src/shared/hfp.c \
 	bluez/src/shared/gatt-db.c \
+	bluez/src/shared/handle-alloc.c \
+	bluez/src/shared/gatt-server.c \
 	bluez/src/shared/io-glib.c \
+	bluez/src/shared/timeout-glib.c \
+	bluez/src/shared/att.c \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/uhid.c \
 	bluez/src/sdpd-database.c \
@@ -278,12 +283,20 @@ LOCAL_SRC_FILES := \
 	bluez/monitor/ll.c \
 	bluez/monitor/hwdb.c \
 	bluez/monitor/keys.c \
+	bluez/monitor/filter.c \
 	bluez/monitor/ellisys.c \
 	bluez/monitor/analyze.c \
+	bluez/monitor/stats.c \
 	bluez/src/shared/util.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/ringbuf.c \
 	bluez/src/shared/crypto.c \
 	bluez/src/shared/btsnoop.c \
+	bluez/src/shared/pcap.c \
+	bluez/src/shared/io-mainloop.c \
+	bluez/src/shared/timeout-mainloop.c \
+	bluez/src/shared/idmap.c \
+	bluez/src/shared/att.c \
 	bluez/lib/hci.c \
 	bluez/lib/bluetooth.c \
 
@@ -462,6 +475,7 @@ LOCAL_SRC_FILES := \
 	bluez/src/shared/io-mainloop.c \
 	bluez/src/shared/mgmt.c \
 	bluez/src/shared/queue.c \
+	bluez/src/shared/idmap.c \
 	bluez/src/shared/util.c \
 	bluez/src/uuid-helper.c \
 
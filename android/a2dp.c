@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <glib.h>
 
 #include "btio/btio.h"
@@ -1459,6 +1460,25 @@ static void bt_audio_close(const void *buf, uint16_t len)
 							AUDIO_STATUS_SUCCESS);
 }
 
+/*
+ * Number of media packets the HAL may hand to the socket in one go. Bursts
+ * are kept to a quarter of the send buffer so that a single late batch
+ * doesn't fill it up.
+ */
+static uint8_t stream_batch_size(int fd, uint16_t omtu)
+{
+	socklen_t len;
+	int sndbuf;
+
+	len = sizeof(sndbuf);
+	if (!omtu || getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0)
+		return 1;
+
+	sndbuf /= 4 * omtu;
+
+	return MAX(1, MIN(sndbuf, AUDIO_MAX_BATCH));
+}
+
 static void bt_stream_open(const void *buf, uint16_t len)
 {
 	const struct audio_cmd_open_stream *cmd = buf;
@@ -1493,6 +1513,7 @@ static void bt_stream_open(const void *buf, uint16_t len)
 	rsp = g_malloc0(len);
 	rsp->id = setup->endpoint->id;
 	rsp->mtu = omtu;
+	rsp->batch = stream_batch_size(fd, omtu);
 	rsp->preset->len = setup->preset->len;
 	memcpy(rsp->preset->data, setup->preset->data, setup->preset->len);
 
@@ -60,9 +60,12 @@ struct audio_cmd_open_stream {
 	uint8_t id;
 } __attribute__((packed));
 
+#define AUDIO_MAX_BATCH			8
+
 struct audio_rsp_open_stream {
 	uint16_t id;
 	uint16_t mtu;
+	uint8_t batch;
 	struct audio_preset preset[0];
 } __attribute__((packed));
 
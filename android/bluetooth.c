@@ -96,6 +96,9 @@
 #define DEVICES_FILE ANDROID_STORAGEDIR"/devices"
 #define CACHE_FILE ANDROID_STORAGEDIR"/cache"
 
+/* Delay before a modified storage file is written back */
+#define STORAGE_SYNC_DELAY 2
+
 #define DEVICE_ID_SOURCE	0x0002	/* USB */
 #define DEVICE_ID_VENDOR	0x1d6b	/* Linux Foundation */
 #define DEVICE_ID_PRODUCT	0x0247	/* BlueZ for Android */
@@ -228,6 +231,88 @@ static bool kernel_conn_control = false;
 
 static struct queue *unpaired_cb_list = NULL;
 
+/*
+ * Storage files are loaded once and kept in memory. Changes only mark the
+ * file dirty, it is written out as a whole shortly after so that bursts of
+ * updates, e.g. while bonding, end up in a single atomic rewrite.
+ */
+struct storage {
+	const char *path;
+	GKeyFile *key_file;
+	bool exists;
+	guint sync_id;
+};
+
+static struct storage settings_storage = { .path = SETTINGS_FILE };
+static struct storage devices_storage = { .path = DEVICES_FILE };
+static struct storage cache_storage = { .path = CACHE_FILE };
+
+static GKeyFile *storage_get(struct storage *storage, bool create)
+{
+	if (!storage->key_file) {
+		storage->key_file = g_key_file_new();
+		storage->exists = g_key_file_load_from_file(storage->key_file,
+							storage->path, 0, NULL);
+	}
+
+	if (!storage->exists && !create)
+		return NULL;
+
+	return storage->key_file;
+}
+
+static void storage_sync(struct storage *storage)
+{
+	gsize length = 0;
+	char *data;
+
+	if (!storage->sync_id)
+		return;
+
+	g_source_remove(storage->sync_id);
+	storage->sync_id = 0;
+
+	data = g_key_file_to_data(storage->key_file, &length, NULL);
+
+	/* Written to a temporary file which then replaces the old one */
+	if (!g_file_set_contents(storage->path, data, length, NULL))
+		error("Failed to write %s", storage->path);
+
+	g_free(data);
+}
+
+static gboolean storage_sync_cb(gpointer user_data)
+{
+	struct storage *storage = user_data;
+
+	storage_sync(storage);
+
+	return FALSE;
+}
+
+static void storage_mark_dirty(struct storage *storage)
+{
+	storage->exists = true;
+
+	if (storage->sync_id)
+		return;
+
+	storage->sync_id = g_timeout_add_seconds(STORAGE_SYNC_DELAY,
+						storage_sync_cb, storage);
+}
+
+static void storage_cleanup(struct storage *storage)
+{
+	storage_sync(storage);
+
+	if (storage->key_file) {
+		g_key_file_free(storage->key_file);
+		storage->key_file = NULL;
+	}
+
+	storage->exists = false;
+}
+
 static void get_device_android_addr(struct device *dev, uint8_t *addr)
 {
 	/*
@@ -250,13 +335,9 @@ static void mgmt_debug(const char *str, void *user_data)
 static void store_adapter_config(void)
 {
 	GKeyFile *key_file;
-	gsize length = 0;
 	char addr[18];
-	char *data;
-
-	key_file = g_key_file_new();
 
-	g_key_file_load_from_file(key_file, SETTINGS_FILE, 0, NULL);
+	key_file = storage_get(&settings_storage, true);
 
 	ba2str(&adapter.bdaddr, addr);
 
@@ -265,12 +346,7 @@ static void store_adapter_config(void)
 	g_key_file_set_integer(key_file, "General", "DiscoverableTimeout",
 						adapter.discoverable_timeout);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-
-	g_file_set_contents(SETTINGS_FILE, data, length, NULL);
-
-	g_free(data);
-	g_key_file_free(key_file);
+	storage_mark_dirty(&settings_storage);
 }
 
 static void load_adapter_config(void)
@@ -279,14 +355,13 @@ static void load_adapter_config(void)
 	GKeyFile *key_file;
 	char *str;
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, SETTINGS_FILE, 0, NULL);
+	key_file = storage_get(&settings_storage, false);
+	if (!key_file)
+		return;
 
 	str = g_key_file_get_string(key_file, "General", "Address", NULL);
-	if (!str) {
-		g_key_file_free(key_file);
+	if (!str)
 		return;
-	}
 
 	str2ba(str, &adapter.bdaddr);
 	g_free(str);
@@ -299,22 +374,17 @@ static void load_adapter_config(void)
 		adapter.discoverable_timeout = DEFAULT_DISCOVERABLE_TIMEOUT;
 		g_clear_error(&gerr);
 	}
-
-	g_key_file_free(key_file);
 }
 
-static void store_device_info(struct device *dev, const char *path)
+static void store_device_info(struct device *dev, struct storage *storage)
 {
 	GKeyFile *key_file;
 	char addr[18];
-	gsize length = 0;
 	char **uuids = NULL;
-	char *str;
 
 	ba2str(&dev->bdaddr, addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, path, 0, NULL);
+	key_file = storage_get(storage, true);
 
 	g_key_file_set_boolean(key_file, addr, "BREDR", dev->bredr);
 
@@ -365,33 +435,26 @@ static void store_device_info(struct device *dev, const char *path)
 		g_key_file_remove_key(key_file, addr, "Services", NULL);
 	}
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(path, str, length, NULL);
-	g_free(str);
+	storage_mark_dirty(storage);
 
-	g_key_file_free(key_file);
 	g_strfreev(uuids);
 }
 
-static void remove_device_info(struct device *dev, const char *path)
+static void remove_device_info(struct device *dev, struct storage *storage)
 {
 	GKeyFile *key_file;
-	gsize length = 0;
 	char addr[18];
-	char *str;
 
 	ba2str(&dev->bdaddr, addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, path, 0, NULL);
-
-	g_key_file_remove_group(key_file, addr, NULL);
+	key_file = storage_get(storage, false);
+	if (!key_file)
+		return;
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(path, str, length, NULL);
-	g_free(str);
+	if (!g_key_file_remove_group(key_file, addr, NULL))
+		return;
 
-	g_key_file_free(key_file);
+	storage_mark_dirty(storage);
 }
 
 static int device_match(gconstpointer a, gconstpointer b)
@@ -450,12 +513,12 @@ static void cache_device(struct device *new_dev)
 	dev = l->data;
 
 	cached_devices = g_slist_remove(cached_devices, dev);
-	remove_device_info(dev, CACHE_FILE);
+	remove_device_info(dev, &cache_storage);
 	free_device(dev);
 
 cache:
 	cached_devices = g_slist_prepend(cached_devices, new_dev);
-	store_device_info(new_dev, CACHE_FILE);
+	store_device_info(new_dev, &cache_storage);
 }
 
 static struct device *create_device(const bdaddr_t *bdaddr, uint8_t bdaddr_type)
@@ -695,20 +758,15 @@ void bt_store_gatt_ccc(const bdaddr_t *dst, uint16_t value)
 {
 	struct device *dev;
 	GKeyFile *key_file;
-	gsize length = 0;
 	char addr[18];
-	char *data;
 
 	dev = find_device(dst);
 	if (!dev)
 		return;
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL)) {
-		g_key_file_free(key_file);
+	key_file = storage_get(&devices_storage, false);
+	if (!key_file)
 		return;
-	}
 
 	ba2str(&dev->bdaddr, addr);
 
@@ -716,11 +774,7 @@ void bt_store_gatt_ccc(const bdaddr_t *dst, uint16_t value)
 
 	g_key_file_set_integer(key_file, addr, "GattCCC", value);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(DEVICES_FILE, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_mark_dirty(&devices_storage);
 
 	dev->gatt_ccc = value;
 }
@@ -741,17 +795,12 @@ static void store_link_key(const bdaddr_t *dst, const uint8_t *key,
 {
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
 	char addr[18];
-	char *data;
 	int i;
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL)) {
-		g_key_file_free(key_file);
+	key_file = storage_get(&devices_storage, false);
+	if (!key_file)
 		return;
-	}
 
 	ba2str(dst, addr);
 
@@ -764,11 +813,7 @@ static void store_link_key(const bdaddr_t *dst, const uint8_t *key,
 	g_key_file_set_integer(key_file, addr, "LinkKeyType", type);
 	g_key_file_set_integer(key_file, addr, "LinkKeyPinLength", pin_length);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(DEVICES_FILE, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_mark_dirty(&devices_storage);
 }
 
 static void send_bond_state_change(struct device *dev, uint8_t status,
@@ -802,11 +847,11 @@ static void update_bredr_state(struct device *dev, bool pairing, bool paired,
 	if (paired && !dev->le_paired && !dev->bredr_paired) {
 		cached_devices = g_slist_remove(cached_devices, dev);
 		bonded_devices = g_slist_prepend(bonded_devices, dev);
-		remove_device_info(dev, CACHE_FILE);
-		store_device_info(dev, DEVICES_FILE);
+		remove_device_info(dev, &cache_storage);
+		store_device_info(dev, &devices_storage);
 	} else if (!paired && !dev->le_paired) {
 		bonded_devices = g_slist_remove(bonded_devices, dev);
-		remove_device_info(dev, DEVICES_FILE);
+		remove_device_info(dev, &devices_storage);
 		cache_device(dev);
 	}
 
@@ -839,11 +884,11 @@ static void update_le_state(struct device *dev, bool pairing, bool paired,
 	if (paired && !dev->bredr_paired && !dev->le_paired) {
 		cached_devices = g_slist_remove(cached_devices, dev);
 		bonded_devices = g_slist_prepend(bonded_devices, dev);
-		remove_device_info(dev, CACHE_FILE);
-		store_device_info(dev, DEVICES_FILE);
+		remove_device_info(dev, &cache_storage);
+		store_device_info(dev, &devices_storage);
 	} else if (!paired && !dev->bredr_paired) {
 		bonded_devices = g_slist_remove(bonded_devices, dev);
-		remove_device_info(dev, DEVICES_FILE);
+		remove_device_info(dev, &devices_storage);
 		dev->valid_local_csrk = false;
 		dev->valid_remote_csrk = false;
 		dev->local_sign_cnt = 0;
@@ -956,9 +1001,9 @@ static void set_device_uuids(struct device *dev, GSList *uuids)
 	dev->uuids = uuids;
 
 	if (dev->le_paired || dev->bredr_paired)
-		store_device_info(dev, DEVICES_FILE);
+		store_device_info(dev, &devices_storage);
 	else
-		store_device_info(dev, CACHE_FILE);
+		store_device_info(dev, &cache_storage);
 
 	send_device_uuids_notif(dev);
 }
@@ -1908,12 +1953,25 @@ static void update_found_device(const bdaddr_t *bdaddr, uint8_t bdaddr_type,
 					int8_t rssi, bool confirm,
 					const uint8_t *data, uint8_t data_len)
 {
+	char name[MGMT_MAX_NAME_LENGTH + 1];
 	struct eir_data eir;
+	struct eir_iter iter;
+	struct eir_field field;
 	struct device *dev;
 
 	memset(&eir, 0, sizeof(eir));
 
-	eir_parse(&eir, data, data_len);
+	/* Only flags, class and name are used, the name lives on the stack */
+	eir_iter_init(&iter, data, data_len);
+
+	while (eir_iter_next(&iter, &field)) {
+		if (field.type == EIR_NAME_SHORT ||
+					field.type == EIR_NAME_COMPLETE) {
+			eir_field_get_name(&field, name, sizeof(name));
+			eir.name = name;
+		} else
+			eir_parse_field(&eir, &field);
+	}
 
 	dev = get_device(bdaddr, bdaddr_type);
 
@@ -1931,8 +1989,6 @@ static void update_found_device(const bdaddr_t *bdaddr, uint8_t bdaddr_type,
 	else
 		update_device(dev, rssi, &eir, bdaddr_type);
 
-	eir_data_free(&eir);
-
 	/* Notify Gatt if its registered for LE events */
 	if (bdaddr_type != BDADDR_BREDR && gatt_device_found_cb) {
 		bool discoverable;
@@ -2203,16 +2259,12 @@ static void store_ltk(const bdaddr_t *dst, uint8_t bdaddr_type, bool master,
 	const char *key_s, *keytype_s, *encsize_s, *ediv_s, *rand_s;
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
 	char addr[18];
-	char *data;
 	int i;
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL)) {
-		g_key_file_free(key_file);
+	key_file = storage_get(&devices_storage, false);
+	if (!key_file)
 		return;
-	}
 
 	ba2str(dst, addr);
 
@@ -2235,11 +2287,7 @@ static void store_ltk(const bdaddr_t *dst, uint8_t bdaddr_type, bool master,
 
 	g_key_file_set_uint64(key_file, addr, rand_s, rand);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(DEVICES_FILE, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_mark_dirty(&devices_storage);
 }
 
 static void new_long_term_key_event(uint16_t index, uint16_t length,
@@ -2287,16 +2335,12 @@ static void store_csrk(struct device *dev)
 	char key_str[33];
 	char addr[18];
 	int i;
-	gsize length = 0;
-	char *data;
 
 	ba2str(&dev->bdaddr, addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL)) {
-		g_key_file_free(key_file);
+	key_file = storage_get(&devices_storage, false);
+	if (!key_file)
 		return;
-	}
 
 	if (dev->valid_local_csrk) {
 		for (i = 0; i < 16; i++)
@@ -2314,11 +2358,7 @@ static void store_csrk(struct device *dev)
 		g_key_file_set_string(key_file, addr, "RemoteCSRK", key_str);
 	}
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(DEVICES_FILE, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_mark_dirty(&devices_storage);
 }
 
 static void new_csrk_callback(uint16_t index, uint16_t length,
@@ -2367,27 +2407,19 @@ static void store_irk(struct device *dev, const uint8_t *val)
 	char key_str[33];
 	char addr[18];
 	int i;
-	gsize length = 0;
-	char *data;
 
 	ba2str(&dev->bdaddr, addr);
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL)) {
-		g_key_file_free(key_file);
+	key_file = storage_get(&devices_storage, false);
+	if (!key_file)
 		return;
-	}
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", val[i]);
 
 	g_key_file_set_string(key_file, addr, "IdentityResolvingKey", key_str);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(DEVICES_FILE, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_mark_dirty(&devices_storage);
 }
 
 static void new_irk_callback(uint16_t index, uint16_t length,
@@ -2426,7 +2458,7 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 				return;
 
 			/* don't leave garbage in cache file */
-			remove_device_info(dev, CACHE_FILE);
+			remove_device_info(dev, &cache_storage);
 
 			/*
 			 * RPA resolution is transparent for Android Framework
@@ -3168,9 +3200,7 @@ static void load_devices_cache(void)
 	gsize len = 0;
 	unsigned int i;
 
-	key_file = g_key_file_new();
-
-	g_key_file_load_from_file(key_file, CACHE_FILE, 0, NULL);
+	key_file = storage_get(&cache_storage, true);
 
 	devs = g_key_file_get_groups(key_file, &len);
 
@@ -3184,7 +3214,6 @@ static void load_devices_cache(void)
 	cached_devices = g_slist_sort(cached_devices, device_timestamp_cmp);
 
 	g_strfreev(devs);
-	g_key_file_free(key_file);
 }
 
 static void load_devices_info(bt_bluetooth_ready cb)
@@ -3197,9 +3226,7 @@ static void load_devices_info(bt_bluetooth_ready cb)
 	GSList *ltks = NULL;
 	GSList *irks = NULL;
 
-	key_file = g_key_file_new();
-
-	g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL);
+	key_file = storage_get(&devices_storage, true);
 
 	devs = g_key_file_get_groups(key_file, &len);
 
@@ -3248,7 +3275,6 @@ static void load_devices_info(bt_bluetooth_ready cb)
 	g_slist_free_full(keys, g_free);
 
 	g_strfreev(devs);
-	g_key_file_free(key_file);
 }
 
 static void set_adapter_class(void)
@@ -3653,6 +3679,10 @@ bool bt_bluetooth_stop(bt_bluetooth_stopped cb)
 
 void bt_bluetooth_cleanup(void)
 {
+	storage_cleanup(&settings_storage);
+	storage_cleanup(&devices_storage);
+	storage_cleanup(&cache_storage);
+
 	g_free(adapter.name);
 	adapter.name = NULL;
 
@@ -4129,15 +4159,11 @@ static void store_sign_counter(struct device *dev, enum bt_csrk_type type)
 	GKeyFile *key_file;
 	bool local = (type == LOCAL_CSRK);
 
-	gsize length = 0;
 	char addr[18];
-	char *data;
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file, DEVICES_FILE, 0, NULL)) {
-		g_key_file_free(key_file);
+	key_file = storage_get(&devices_storage, false);
+	if (!key_file)
 		return;
-	}
 
 	ba2str(&dev->bdaddr, addr);
 
@@ -4146,11 +4172,7 @@ static void store_sign_counter(struct device *dev, enum bt_csrk_type type)
 
 	g_key_file_set_integer(key_file, addr, sign_cnt_s, sign_cnt);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(DEVICES_FILE, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_mark_dirty(&devices_storage);
 }
 
 void bt_update_sign_counter(const bdaddr_t *addr, enum bt_csrk_type type)
@@ -4908,9 +4930,9 @@ static uint8_t set_device_friendly_name(struct device *dev, const uint8_t *val,
 	dev->friendly_name = g_strndup((const char *) val, len);
 
 	if (dev->bredr_paired || dev->le_paired)
-		store_device_info(dev, DEVICES_FILE);
+		store_device_info(dev, &devices_storage);
 	else
-		store_device_info(dev, CACHE_FILE);
+		store_device_info(dev, &cache_storage);
 
 	return HAL_STATUS_SUCCESS;
 }
@@ -42,6 +42,9 @@
 
 #define DEFAULT_SNOOP_FILE "/sdcard/btsnoop_hci.log"
 
+#define SNOOP_BUFFER_SIZE	(16 * 1024)
+#define SNOOP_FLUSH_INTERVAL	1000
+
 static struct btsnoop *snoop = NULL;
 static uint8_t monitor_buf[BTSNOOP_MAX_PACKET_SIZE];
 static int monitor_fd = -1;
@@ -149,6 +152,8 @@ static int open_monitor(const char *path)
 	if (!snoop)
 		return -1;
 
+	btsnoop_set_buffer(snoop, SNOOP_BUFFER_SIZE, SNOOP_FLUSH_INTERVAL);
+
 	monitor_fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
 	if (monitor_fd < 0)
 		goto failed;
@@ -40,6 +40,7 @@
 #include "bluetooth.h"
 #include "gatt.h"
 #include "src/log.h"
+#include "src/eir.h"
 #include "hal-msg.h"
 #include "utils.h"
 #include "src/shared/util.h"
@@ -53,6 +54,9 @@
 /* set according to Android bt_gatt_client.h */
 #define GATT_MAX_ATTR_LEN 600
 
+/* Longest AD payload in a legacy advertising report */
+#define SCAN_FILTER_MAX_LEN 31
+
 #define GATT_SUCCESS	0x00000000
 #define GATT_FAILURE	0x00000101
 
@@ -156,7 +160,9 @@ struct gatt_device {
 	GAttrib *attrib;
 	GIOChannel *att_io;
 	struct queue *services;
+	GHashTable *services_by_start;	/* Primary services by start handle */
 	bool partial_srvc_search;
+	struct queue *srvc_search_waiters;	/* Conn ids of a full search */
 
 	guint watch_id;
 	guint server_id;
@@ -185,15 +191,45 @@ struct service_sdp {
 	uint32_t sdp_handle;
 };
 
+struct scan_filter {
+	uint8_t type;
+	bdaddr_t bdaddr;
+	bt_uuid_t uuid;
+	uint8_t len;
+	uint8_t data[SCAN_FILTER_MAX_LEN];
+};
+
+struct scan_report {
+	bdaddr_t bdaddr;
+	int32_t rssi;
+	uint16_t len;
+	uint8_t data[0];
+};
+
 static struct ipc *hal_ipc = NULL;
 static bdaddr_t adapter_addr;
 static bool scanning = false;
+
+static struct queue *scan_filters = NULL;
+static struct queue *scan_batch = NULL;
+static uint16_t scan_batch_timeout = 0;
+static uint8_t scan_batch_max = 0;
+static guint scan_batch_id = 0;
 static unsigned int advertising_cnt = 0;
 
 static struct queue *gatt_apps = NULL;
 static struct queue *gatt_devices = NULL;
 static struct queue *app_connections = NULL;
 
+/*
+ * Lookup indexes for the queues above. The queues own the entries and keep
+ * their order, the tables only mirror them.
+ */
+static GHashTable *apps_by_id = NULL;
+static GHashTable *devices_by_addr = NULL;
+static GHashTable *conns_by_id = NULL;
+static GHashTable *conns_by_pair = NULL;	/* Keyed by (device, app) */
+
 static struct queue *services_sdp = NULL;
 
 static struct queue *listen_apps = NULL;
@@ -332,17 +368,9 @@ static bool match_app_by_uuid(const void *data, const void *user_data)
 	return !memcmp(exp_uuid, client->uuid, sizeof(client->uuid));
 }
 
-static bool match_app_by_id(const void *data, const void *user_data)
-{
-	int32_t exp_id = PTR_TO_INT(user_data);
-	const struct gatt_app *client = data;
-
-	return client->id == exp_id;
-}
-
 static struct gatt_app *find_app_by_id(int32_t id)
 {
-	return queue_find(gatt_apps, match_app_by_id, INT_TO_PTR(id));
+	return g_hash_table_lookup(apps_by_id, INT_TO_PTR(id));
 }
 
 static bool match_by_value(const void *data, const void *user_data)
@@ -350,14 +378,6 @@ static bool match_by_value(const void *data, const void *user_data)
 	return data == user_data;
 }
 
-static bool match_device_by_bdaddr(const void *data, const void *user_data)
-{
-	const struct gatt_device *dev = data;
-	const bdaddr_t *addr = user_data;
-
-	return !bacmp(&dev->bdaddr, addr);
-}
-
 static bool match_device_by_state(const void *data, const void *user_data)
 {
 	const struct gatt_device *dev = data;
@@ -379,29 +399,50 @@ static bool match_pending_device(const void *data, const void *user_data)
 	return false;
 }
 
-static bool match_connection_by_id(const void *data, const void *user_data)
+static guint bdaddr_hash(gconstpointer key)
 {
-	const struct app_connection *conn = data;
-	const int32_t id = PTR_TO_INT(user_data);
+	const bdaddr_t *bdaddr = key;
 
-	return conn->id == id;
+	return bdaddr->b[0] | bdaddr->b[1] << 8 | bdaddr->b[2] << 16 |
+			(bdaddr->b[3] ^ bdaddr->b[4] ^ bdaddr->b[5]) << 24;
 }
 
-static bool match_connection_by_device_and_app(const void *data,
-							const void *user_data)
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
 {
-	const struct app_connection *conn = data;
-	const struct app_connection *match = user_data;
+	return bacmp(a, b) == 0;
+}
+
+static guint connection_pair_hash(gconstpointer key)
+{
+	const struct app_connection *conn = key;
+
+	return g_direct_hash(conn->device) ^ g_direct_hash(conn->app);
+}
+
+static gboolean connection_pair_equal(gconstpointer a, gconstpointer b)
+{
+	const struct app_connection *conn = a;
+	const struct app_connection *match = b;
 
 	return conn->device == match->device && conn->app == match->app;
 }
 
+static struct app_connection *find_connection(struct gatt_device *device,
+							struct gatt_app *app)
+{
+	struct app_connection match;
+
+	match.device = device;
+	match.app = app;
+
+	return g_hash_table_lookup(conns_by_pair, &match);
+}
+
 static struct app_connection *find_connection_by_id(int32_t conn_id)
 {
 	struct app_connection *conn;
 
-	conn = queue_find(app_connections, match_connection_by_id,
-							INT_TO_PTR(conn_id));
+	conn = g_hash_table_lookup(conns_by_id, INT_TO_PTR(conn_id));
 	if (conn && conn->device->state == DEVICE_CONNECTED)
 		return conn;
 
@@ -426,7 +467,7 @@ static bool match_connection_by_app(const void *data, const void *user_data)
 
 static struct gatt_device *find_device_by_addr(const bdaddr_t *addr)
 {
-	return queue_find(gatt_devices, match_device_by_bdaddr, addr);
+	return g_hash_table_lookup(devices_by_addr, addr);
 }
 
 static struct gatt_device *find_pending_device(void)
@@ -469,12 +510,34 @@ static bool match_srvc_by_bt_uuid(const void *data, const void *user_data)
 	return !bt_uuid_cmp(exp_uuid, &service->id.uuid);
 }
 
-static bool match_srvc_by_range(const void *data, const void *user_data)
+static struct service *find_srvc_by_range(struct gatt_device *dev,
+						const struct att_range *range)
 {
-	const struct service *srvc = data;
-	const struct att_range *range = user_data;
+	struct service *srvc;
+
+	srvc = g_hash_table_lookup(dev->services_by_start,
+						UINT_TO_PTR(range->start));
+	if (srvc && srvc->prim.range.end == range->end)
+		return srvc;
 
-	return !memcmp(&srvc->prim.range, range, sizeof(srvc->prim.range));
+	return NULL;
+}
+
+static bool add_primary_service(struct gatt_device *dev, struct service *srvc)
+{
+	if (!queue_push_tail(dev->services, srvc))
+		return false;
+
+	g_hash_table_insert(dev->services_by_start,
+				UINT_TO_PTR(srvc->prim.range.start), srvc);
+
+	return true;
+}
+
+static void clear_services(struct gatt_device *dev)
+{
+	g_hash_table_remove_all(dev->services_by_start);
+	queue_remove_all(dev->services, NULL, NULL, destroy_service);
 }
 
 static bool match_char_by_higher_inst_id(const void *data,
@@ -621,6 +684,9 @@ static void connection_cleanup(struct gatt_device *device)
 		g_attrib_unref(attrib);
 	}
 
+	/* A full service search still running was cancelled with the link */
+	queue_remove_all(device->srvc_search_waiters, NULL, NULL, NULL);
+
 	/*
 	 * If device was in connection_pending or connectable state we
 	 * search device list if we should stop the scan.
@@ -633,7 +699,7 @@ static void connection_cleanup(struct gatt_device *device)
 
 	/* If device is not bonded service cache should be refreshed */
 	if (!bt_device_is_bonded(&device->bdaddr))
-		queue_remove_all(device->services, NULL, NULL, destroy_service);
+		clear_services(device);
 
 	device_set_state(device, DEVICE_DISCONNECTED);
 
@@ -704,7 +770,11 @@ static void destroy_device(void *data)
 	if (!dev)
 		return;
 
+	if (dev->services_by_start)
+		g_hash_table_destroy(dev->services_by_start);
+
 	queue_destroy(dev->services, destroy_service);
+	queue_destroy(dev->srvc_search_waiters, NULL);
 	queue_destroy(dev->pending_requests, destroy_pending_request);
 	queue_destroy(dev->autoconnect_apps, NULL);
 
@@ -751,6 +821,15 @@ static struct gatt_device *create_device(const bdaddr_t *addr)
 		return NULL;
 	}
 
+	dev->services_by_start = g_hash_table_new(NULL, NULL);
+
+	dev->srvc_search_waiters = queue_new();
+	if (!dev->srvc_search_waiters) {
+		error("gatt: Failed to allocate memory for client");
+		destroy_device(dev);
+		return NULL;
+	}
+
 	dev->autoconnect_apps = queue_new();
 	if (!dev->autoconnect_apps) {
 		error("gatt: Failed to allocate memory for client");
@@ -771,6 +850,8 @@ static struct gatt_device *create_device(const bdaddr_t *addr)
 		return NULL;
 	}
 
+	g_hash_table_insert(devices_by_addr, &dev->bdaddr, dev);
+
 	return device_ref(dev);
 }
 
@@ -886,6 +967,11 @@ static void destroy_connection(void *data)
 	if (conn->timeout_id > 0)
 		g_source_remove(conn->timeout_id);
 
+	g_hash_table_remove(conns_by_id, INT_TO_PTR(conn->id));
+
+	if (g_hash_table_lookup(conns_by_pair, conn) == conn)
+		g_hash_table_remove(conns_by_pair, conn);
+
 	if (!queue_find(gatt_devices, match_by_value, conn->device))
 		goto cleanup;
 
@@ -1060,6 +1146,9 @@ static struct app_connection *create_connection(struct gatt_device *device,
 	new_conn->device = device_ref(device);
 	new_conn->device->conn_cnt++;
 
+	g_hash_table_insert(conns_by_id, INT_TO_PTR(new_conn->id), new_conn);
+	g_hash_table_insert(conns_by_pair, new_conn, new_conn);
+
 	return new_conn;
 }
 
@@ -1180,7 +1269,7 @@ static void discover_srvc_by_uuid_cb(uint8_t status, GSList *ranges,
 			goto reply;
 		}
 
-		if (!queue_push_tail(dev->services, s)) {
+		if (!add_primary_service(dev, s)) {
 			error("gatt: Cannot push primary service to the list");
 			destroy_service(s);
 			gatt_status = GATT_FAILURE;
@@ -1234,15 +1323,14 @@ static void discover_srvc_all_cb(uint8_t status, GSList *services,
 		struct gatt_primary *prim = l->data;
 		struct service *p;
 
-		if (queue_find(dev->services, match_srvc_by_range,
-								&prim->range))
+		if (find_srvc_by_range(dev, &prim->range))
 			continue;
 
 		p = create_service(instance_id++, true, prim->uuid, prim);
 		if (!p)
 			continue;
 
-		if (!queue_push_tail(dev->services, p)) {
+		if (!add_primary_service(dev, p)) {
 			error("gatt: Cannot push primary service to the list");
 			free(p);
 			continue;
@@ -1252,19 +1340,29 @@ static void discover_srvc_all_cb(uint8_t status, GSList *services,
 			prim->range.start, prim->range.end, prim->uuid);
 	}
 
-	/*
-	 * Send all found services notifications - first cache,
-	 * then send notifies
-	 */
-	queue_foreach(dev->services, send_client_primary_notify,
-						INT_TO_PTR(cb_data->conn->id));
-
 	/* Full search service scanning was performed */
 	dev->partial_srvc_search = false;
 	gatt_status = GATT_SUCCESS;
 
 reply:
-	send_client_search_complete_notify(gatt_status, cb_data->conn->id);
+	/*
+	 * Every app that asked for a full search while this one was running
+	 * gets the result - first cache, then send notifies
+	 */
+	while (!queue_isempty(dev->srvc_search_waiters)) {
+		int32_t conn_id;
+
+		conn_id = PTR_TO_INT(queue_pop_head(dev->srvc_search_waiters));
+		if (!find_connection_by_id(conn_id))
+			continue;
+
+		if (gatt_status == GATT_SUCCESS)
+			queue_foreach(dev->services, send_client_primary_notify,
+							INT_TO_PTR(conn_id));
+
+		send_client_search_complete_notify(gatt_status, conn_id);
+	}
+
 	free(cb_data);
 }
 
@@ -1348,10 +1446,31 @@ static guint search_dev_for_srvc(struct app_connection *conn, bt_uuid_t *uuid)
 					discover_srvc_by_uuid_cb, cb_data);
 	}
 
+	if (conn->app) {
+		struct gatt_device *dev = conn->device;
+		bool running = !queue_isempty(dev->srvc_search_waiters);
+		guint id;
 
-	if (conn->app)
-		return gatt_discover_primary(conn->device->attrib, NULL,
+		/* Join a full search already running for another app */
+		if (!queue_push_tail(dev->srvc_search_waiters,
+							INT_TO_PTR(conn->id))) {
+			free(cb_data);
+			return 0;
+		}
+
+		if (running) {
+			free(cb_data);
+			return 1;
+		}
+
+		id = gatt_discover_primary(dev->attrib, NULL,
 						discover_srvc_all_cb, cb_data);
+		if (!id)
+			queue_remove_all(dev->srvc_search_waiters, NULL, NULL,
+									NULL);
+
+		return id;
+	}
 
 	return gatt_discover_primary(conn->device->attrib, NULL,
 						discover_primary_cb, cb_data);
@@ -1373,7 +1492,6 @@ static void send_app_connect_notifications(void *data, void *user_data)
 
 static struct app_connection *find_conn(const bdaddr_t *addr, int32_t app_id)
 {
-	struct app_connection conn_match;
 	struct gatt_device *dev = NULL;
 	struct gatt_app *app;
 
@@ -1391,11 +1509,7 @@ static struct app_connection *find_conn(const bdaddr_t *addr, int32_t app_id)
 		return NULL;
 	}
 
-	conn_match.device = dev;
-	conn_match.app = app;
-
-	return queue_find(app_connections, match_connection_by_device_and_app,
-								&conn_match);
+	return find_connection(dev, app);
 }
 
 static void create_app_connection(void *data, void *user_data)
@@ -1593,21 +1707,168 @@ static void bt_le_discovery_stop_cb(void)
 		bt_le_discovery_start();
 }
 
-static void le_device_found_handler(const bdaddr_t *addr, uint8_t addr_type,
-						int rssi, uint16_t eir_len,
-						const void *eir,
-						bool discoverable, bool bonded)
+static bool match_scan_filter(const void *data, const void *user_data)
+{
+	const struct scan_filter *filter = data;
+	const struct scan_report *report = user_data;
+	struct eir_iter iter;
+	struct eir_field field;
+	unsigned int i, count;
+	bt_uuid_t uuid;
+
+	if (filter->type == HAL_GATT_SCAN_FILTER_ADDR)
+		return !bacmp(&filter->bdaddr, &report->bdaddr);
+
+	eir_iter_init(&iter, report->data, report->len);
+
+	while (eir_iter_next(&iter, &field)) {
+		switch (field.type) {
+		case EIR_UUID16_SOME:
+		case EIR_UUID16_ALL:
+		case EIR_UUID32_SOME:
+		case EIR_UUID32_ALL:
+		case EIR_UUID128_SOME:
+		case EIR_UUID128_ALL:
+			if (filter->type != HAL_GATT_SCAN_FILTER_UUID)
+				break;
+
+			count = eir_field_uuid_count(&field);
+
+			for (i = 0; i < count; i++) {
+				if (!eir_field_get_uuid(&field, i, &uuid))
+					break;
+
+				if (!bt_uuid_cmp(&uuid, &filter->uuid))
+					return true;
+			}
+			break;
+		case EIR_MANUFACTURER_DATA:
+			if (filter->type != HAL_GATT_SCAN_FILTER_MANUF)
+				break;
+
+			if (field.len >= filter->len &&
+				!memcmp(field.data, filter->data, filter->len))
+				return true;
+			break;
+		}
+	}
+
+	return false;
+}
+
+static bool match_report_by_addr(const void *data, const void *user_data)
+{
+	const struct scan_report *report = data;
+
+	return !bacmp(&report->bdaddr, user_data);
+}
+
+static void send_scan_batch(void)
+{
+	uint8_t buf[IPC_MTU];
+	struct hal_ev_gatt_client_scan_results *ev = (void *) buf;
+	struct hal_ev_gatt_client_scan_result *result;
+	struct scan_report *report;
+	size_t size = sizeof(*ev);
+
+	ev->num = 0;
+
+	while ((report = queue_pop_head(scan_batch))) {
+		if (size + sizeof(*result) + report->len > sizeof(buf)) {
+			ipc_send_notif(hal_ipc, HAL_SERVICE_ID_GATT,
+					HAL_EV_GATT_CLIENT_SCAN_RESULTS,
+					size, buf);
+			size = sizeof(*ev);
+			ev->num = 0;
+		}
+
+		result = (void *) (buf + size);
+		bdaddr2android(&report->bdaddr, result->bda);
+		result->rssi = report->rssi;
+		result->len = report->len;
+		memcpy(result->adv_data, report->data, report->len);
+
+		size += sizeof(*result) + report->len;
+		ev->num++;
+
+		free(report);
+	}
+
+	if (ev->num)
+		ipc_send_notif(hal_ipc, HAL_SERVICE_ID_GATT,
+					HAL_EV_GATT_CLIENT_SCAN_RESULTS,
+					size, buf);
+}
+
+static gboolean scan_batch_timeout_cb(gpointer user_data)
+{
+	scan_batch_id = 0;
+
+	send_scan_batch();
+
+	return FALSE;
+}
+
+static void flush_scan_batch(void)
+{
+	if (scan_batch_id > 0) {
+		g_source_remove(scan_batch_id);
+		scan_batch_id = 0;
+	}
+
+	send_scan_batch();
+}
+
+static void queue_scan_report(struct scan_report *report)
+{
+	/* Only the latest report of an address is kept in a batch */
+	free(queue_remove_if(scan_batch, match_report_by_addr,
+							&report->bdaddr));
+
+	if (!queue_push_tail(scan_batch, report)) {
+		free(report);
+		return;
+	}
+
+	if (queue_length(scan_batch) >= scan_batch_max) {
+		flush_scan_batch();
+		return;
+	}
+
+	if (!scan_batch_id)
+		scan_batch_id = g_timeout_add(scan_batch_timeout,
+						scan_batch_timeout_cb, NULL);
+}
+
+static void report_scan_result(const bdaddr_t *addr, int rssi,
+					uint16_t eir_len, const void *eir)
 {
 	uint8_t buf[IPC_MTU];
 	struct hal_ev_gatt_client_scan_result *ev = (void *) buf;
-	struct gatt_device *dev;
-	char bda[18];
+	struct scan_report *report;
 
-	if (!scanning || (!discoverable && !bonded))
-		goto connect;
+	if (eir_len > sizeof(buf) - sizeof(*ev))
+		eir_len = sizeof(buf) - sizeof(*ev);
 
-	ba2str(addr, bda);
-	DBG("LE Device found: %s, rssi: %d, adv_data: %d", bda, rssi, !!eir);
+	report = malloc(sizeof(*report) + eir_len);
+	if (!report)
+		return;
+
+	bacpy(&report->bdaddr, addr);
+	report->rssi = rssi;
+	report->len = eir_len;
+	memcpy(report->data, eir, eir_len);
+
+	if (!queue_isempty(scan_filters) &&
+			!queue_find(scan_filters, match_scan_filter, report)) {
+		free(report);
+		return;
+	}
+
+	if (scan_batch_timeout) {
+		queue_scan_report(report);
+		return;
+	}
 
 	bdaddr2android(addr, ev->bda);
 	ev->rssi = rssi;
@@ -1619,6 +1880,25 @@ static void le_device_found_handler(const bdaddr_t *addr, uint8_t addr_type,
 						HAL_EV_GATT_CLIENT_SCAN_RESULT,
 						sizeof(*ev) + ev->len, ev);
 
+	free(report);
+}
+
+static void le_device_found_handler(const bdaddr_t *addr, uint8_t addr_type,
+						int rssi, uint16_t eir_len,
+						const void *eir,
+						bool discoverable, bool bonded)
+{
+	struct gatt_device *dev;
+	char bda[18];
+
+	if (!scanning || (!discoverable && !bonded))
+		goto connect;
+
+	ba2str(addr, bda);
+	DBG("LE Device found: %s, rssi: %d, adv_data: %d", bda, rssi, !!eir);
+
+	report_scan_result(addr, rssi, eir_len, eir);
+
 connect:
 	/* We use auto connect feature from kernel if possible */
 	if (bt_kernel_conn_control())
@@ -1685,10 +1965,13 @@ static struct gatt_app *register_app(const uint8_t *uuid, gatt_type_t type)
 	if ((app->type == GATT_SERVER) &&
 			!queue_push_tail(listen_apps, INT_TO_PTR(app->id))) {
 		error("gatt: Cannot push server on the list");
+		queue_remove(gatt_apps, app);
 		destroy_gatt_app(app);
 		return NULL;
 	}
 
+	g_hash_table_insert(apps_by_id, INT_TO_PTR(app->id), app);
+
 	return app;
 }
 
@@ -1744,6 +2027,8 @@ static void handle_client_scan(const void *buf, uint16_t len)
 			scanning = false;
 		}
 
+		flush_scan_batch();
+
 		status = HAL_STATUS_SUCCESS;
 		goto reply;
 	}
@@ -1899,13 +2184,16 @@ static uint8_t unregister_app(int client_if)
 	 */
 	queue_foreach(gatt_devices, clear_autoconnect_devices, INT_TO_PTR(client_if));
 
-	cl = queue_remove_if(gatt_apps, match_app_by_id, INT_TO_PTR(client_if));
+	cl = find_app_by_id(client_if);
 	if (!cl) {
 		error("gatt: client_if=%d not found", client_if);
 
 		return HAL_STATUS_FAILED;
 	}
 
+	g_hash_table_remove(apps_by_id, INT_TO_PTR(client_if));
+	queue_remove(gatt_apps, cl);
+
 	/* Destroy app connections with proper notifications for this app. */
 	app_disconnect_devices(cl);
 	destroy_gatt_app(cl);
@@ -2011,7 +2299,6 @@ reply:
 
 static uint8_t handle_connect(int32_t app_id, const bdaddr_t *addr)
 {
-	struct app_connection conn_match;
 	struct app_connection *conn;
 	struct gatt_device *device;
 	struct gatt_app *app;
@@ -2029,11 +2316,7 @@ static uint8_t handle_connect(int32_t app_id, const bdaddr_t *addr)
 			return HAL_STATUS_FAILED;
 	}
 
-	conn_match.device = device;
-	conn_match.app = app;
-
-	conn = queue_find(app_connections, match_connection_by_device_and_app,
-								&conn_match);
+	conn = find_connection(device, app);
 	if (!conn) {
 		conn = create_connection(device, app);
 		if (!conn)
@@ -2200,7 +2483,7 @@ static void handle_client_refresh(const void *buf, uint16_t len)
 		goto done;
 	}
 
-	queue_remove_all(dev->services, NULL, NULL, destroy_service);
+	clear_services(dev);
 
 	status = HAL_STATUS_SUCCESS;
 
@@ -4093,8 +4376,7 @@ static void handle_client_test_command(const void *buf, uint16_t len)
 		status = handle_connect(test_client_if, &bdaddr);
 		break;
 	case GATT_CLIENT_TEST_CMD_DISCONNECT:
-		app = queue_find(gatt_apps, match_app_by_id,
-						INT_TO_PTR(test_client_if));
+		app = find_app_by_id(test_client_if);
 		if (app)
 			app_disconnect_devices(app);
 
@@ -5421,6 +5703,126 @@ reply:
 			HAL_OP_GATT_SERVER_SEND_RESPONSE, status);
 }
 
+static bool parse_scan_filter(const struct hal_gatt_scan_filter *hf,
+						struct scan_filter *filter)
+{
+	uint128_t u128;
+	int i;
+
+	memset(filter, 0, sizeof(*filter));
+	filter->type = hf->type;
+
+	switch (hf->type) {
+	case HAL_GATT_SCAN_FILTER_ADDR:
+		if (hf->len != 6)
+			return false;
+
+		android2bdaddr(hf->data, &filter->bdaddr);
+		return true;
+	case HAL_GATT_SCAN_FILTER_UUID:
+		switch (hf->len) {
+		case 2:
+			bt_uuid16_create(&filter->uuid, get_le16(hf->data));
+			return true;
+		case 4:
+			bt_uuid32_create(&filter->uuid, get_le32(hf->data));
+			return true;
+		case 16:
+			for (i = 0; i < 16; i++)
+				u128.data[i] = hf->data[15 - i];
+
+			bt_uuid128_create(&filter->uuid, u128);
+			return true;
+		}
+
+		return false;
+	case HAL_GATT_SCAN_FILTER_MANUF:
+		if (!hf->len || hf->len > SCAN_FILTER_MAX_LEN)
+			return false;
+
+		filter->len = hf->len;
+		memcpy(filter->data, hf->data, hf->len);
+		return true;
+	}
+
+	return false;
+}
+
+static void handle_client_set_scan_params(const void *buf, uint16_t len)
+{
+	const struct hal_cmd_gatt_client_set_scan_params *cmd = buf;
+	const uint8_t *ptr = cmd->filters;
+	struct queue *filters;
+	uint16_t left = len - sizeof(*cmd);
+	uint8_t status;
+	int i;
+
+	DBG("timeout %u ms max %u filters %u", cmd->batch_timeout,
+					cmd->batch_max, cmd->num_filters);
+
+	filters = queue_new();
+	if (!filters) {
+		status = HAL_STATUS_NOMEM;
+		goto reply;
+	}
+
+	for (i = 0; i < cmd->num_filters; i++) {
+		const struct hal_gatt_scan_filter *hf = (const void *) ptr;
+		struct scan_filter *filter;
+
+		if (left < sizeof(*hf) || left < sizeof(*hf) + hf->len) {
+			error("gatt: Invalid set scan params size (%u bytes), "
+							"terminating", len);
+			queue_destroy(filters, free);
+			raise(SIGTERM);
+			return;
+		}
+
+		filter = new0(struct scan_filter, 1);
+		if (!filter) {
+			queue_destroy(filters, free);
+			status = HAL_STATUS_NOMEM;
+			goto reply;
+		}
+
+		if (!parse_scan_filter(hf, filter) ||
+					!queue_push_tail(filters, filter)) {
+			error("gatt: Invalid scan filter type %u len %u",
+							hf->type, hf->len);
+			free(filter);
+			queue_destroy(filters, free);
+			status = HAL_STATUS_INVALID;
+			goto reply;
+		}
+
+		ptr += sizeof(*hf) + hf->len;
+		left -= sizeof(*hf) + hf->len;
+	}
+
+	if (left) {
+		error("gatt: Invalid set scan params size (%u bytes), "
+							"terminating", len);
+		queue_destroy(filters, free);
+		raise(SIGTERM);
+		return;
+	}
+
+	/* Reports batched under the old parameters are sent as they are */
+	flush_scan_batch();
+
+	queue_destroy(scan_filters, free);
+	scan_filters = filters;
+
+	scan_batch_timeout = cmd->batch_timeout;
+	scan_batch_max = cmd->batch_max ? cmd->batch_max : UINT8_MAX;
+
+	status = HAL_STATUS_SUCCESS;
+
+reply:
+	ipc_send_rsp(hal_ipc, HAL_SERVICE_ID_GATT,
+				HAL_OP_GATT_CLIENT_SET_SCAN_PARAMS, status);
+}
+
 static const struct ipc_handler cmd_handlers[] = {
 	/* HAL_OP_GATT_CLIENT_REGISTER */
 	{ handle_client_register, false,
@@ -5527,6 +5929,9 @@ static const struct ipc_handler cmd_handlers[] = {
 	/* HAL_OP_GATT_SERVER_SEND_RESPONSE */
 	{ handle_server_send_response, true,
 		sizeof(struct hal_cmd_gatt_server_send_response) },
+	/* HAL_OP_GATT_CLIENT_SET_SCAN_PARAMS */
+	{ handle_client_set_scan_params, true,
+		sizeof(struct hal_cmd_gatt_client_set_scan_params) },
 };
 
 static uint8_t read_by_group_type(const uint8_t *cmd, uint16_t cmd_len,
@@ -6626,10 +7031,34 @@ static void gatt_unpaired_cb(const bdaddr_t *addr, uint8_t type)
 	ba2str(addr, address);
 	DBG("Unpaired device %s", address);
 
+	g_hash_table_remove(devices_by_addr, &dev->bdaddr);
 	queue_remove(gatt_devices, dev);
 	destroy_device(dev);
 }
 
+static void destroy_indexes(void)
+{
+	if (apps_by_id) {
+		g_hash_table_destroy(apps_by_id);
+		apps_by_id = NULL;
+	}
+
+	if (devices_by_addr) {
+		g_hash_table_destroy(devices_by_addr);
+		devices_by_addr = NULL;
+	}
+
+	if (conns_by_id) {
+		g_hash_table_destroy(conns_by_id);
+		conns_by_id = NULL;
+	}
+
+	if (conns_by_pair) {
+		g_hash_table_destroy(conns_by_pair);
+		conns_by_pair = NULL;
+	}
+}
+
 bool bt_gatt_register(struct ipc *ipc, const bdaddr_t *addr)
 {
 	DBG("");
@@ -6653,10 +7082,19 @@ bool bt_gatt_register(struct ipc *ipc, const bdaddr_t *addr)
 	app_connections = queue_new();
 	listen_apps = queue_new();
 	services_sdp = queue_new();
+	scan_filters = queue_new();
+	scan_batch = queue_new();
 	gatt_db = gatt_db_new();
 
+	apps_by_id = g_hash_table_new(NULL, NULL);
+	devices_by_addr = g_hash_table_new(bdaddr_hash, bdaddr_equal);
+	conns_by_id = g_hash_table_new(NULL, NULL);
+	conns_by_pair = g_hash_table_new(connection_pair_hash,
+							connection_pair_equal);
+
 	if (!gatt_devices || !gatt_apps || !listen_apps || !app_connections ||
-						!services_sdp || !gatt_db) {
+				!services_sdp || !scan_filters || !scan_batch ||
+				!gatt_db) {
 		error("gatt: Failed to allocate memory for queues");
 		goto failed;
 	}
@@ -6683,6 +7121,8 @@ bool bt_gatt_register(struct ipc *ipc, const bdaddr_t *addr)
 	return true;
 
 failed:
+	destroy_indexes();
+
 	queue_destroy(gatt_apps, NULL);
 	gatt_apps = NULL;
 
@@ -6698,6 +7138,12 @@ failed:
 	queue_destroy(services_sdp, NULL);
 	services_sdp = NULL;
 
+	queue_destroy(scan_filters, NULL);
+	scan_filters = NULL;
+
+	queue_destroy(scan_batch, NULL);
+	scan_batch = NULL;
+
 	gatt_db_destroy(gatt_db);
 	gatt_db = NULL;
 
@@ -6733,9 +7179,25 @@ void bt_gatt_unregister(void)
 	queue_destroy(gatt_devices, destroy_device);
 	gatt_devices = NULL;
 
+	destroy_indexes();
+
 	queue_destroy(services_sdp, free_service_sdp_record);
 	services_sdp = NULL;
 
+	if (scan_batch_id > 0) {
+		g_source_remove(scan_batch_id);
+		scan_batch_id = 0;
+	}
+
+	queue_destroy(scan_batch, free);
+	scan_batch = NULL;
+
+	queue_destroy(scan_filters, free);
+	scan_filters = NULL;
+
+	scan_batch_timeout = 0;
+	scan_batch_max = 0;
+
 	queue_destroy(listen_apps, NULL);
 	listen_apps = NULL;
 
@@ -6806,7 +7268,6 @@ bool bt_gatt_connect_app(unsigned int id, const bdaddr_t *addr)
 
 bool bt_gatt_disconnect_app(unsigned int id, const bdaddr_t *addr)
 {
-	struct app_connection match;
 	struct app_connection *conn;
 	struct gatt_device *device;
 	struct gatt_app *app;
@@ -6819,11 +7280,7 @@ bool bt_gatt_disconnect_app(unsigned int id, const bdaddr_t *addr)
 	if (!device)
 		return false;
 
-	match.device = device;
-	match.app = app;
-
-	conn = queue_find(app_connections, match_connection_by_device_and_app,
-									&match);
+	conn = find_connection(device, app);
 	if (!conn)
 		return false;
 
@@ -15,12 +15,18 @@
  *
  */
 
+/* sendmmsg() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -44,6 +50,11 @@
 
 #define MAX_DELAY	100000 /* 100ms */
 
+#define QOS_QUEUE_PACKETS	4
+#define QOS_WRITE_LATENCY	20000 /* 20ms */
+#define QOS_CONGESTED_PACKETS	3
+#define QOS_RECOVERY_TIME	5000000 /* 5s */
+
 static const uint8_t a2dp_src_uuid[] = {
 		0x00, 0x00, 0x11, 0x0a, 0x00, 0x00, 0x10, 0x00,
 		0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb };
@@ -114,14 +125,37 @@ struct audio_endpoint {
 	void *codec_data;
 	int fd;
 
+	/* Room for up to batch media packets, mp_size bytes apart */
 	struct media_packet *mp;
 	size_t mp_data_len;
+	size_t mp_size;
+	uint8_t batch;
+	uint8_t mp_count;
+	size_t mp_len[AUDIO_MAX_BATCH];
 
 	uint16_t seq;
 	uint32_t samples;
 	struct timespec start;
+	struct timespec mp_sched;
 
 	bool resync;
+
+	int sndbuf;
+	unsigned int congested;
+	struct timespec last_qos;
+
+	struct {
+		unsigned long packets;
+		unsigned long batches;
+		unsigned long bytes;
+		unsigned long dropped;
+		unsigned long resyncs;
+		unsigned long decreased;
+		unsigned long increased;
+		unsigned int queued_max;
+		uint64_t latency_max;
+		uint64_t latency_total;
+	} stats;
 };
 
 static struct audio_endpoint audio_endpoints[MAX_AUDIO_ENDPOINTS];
@@ -340,7 +374,8 @@ static int ipc_close_cmd(uint8_t endpoint_id)
 	return result;
 }
 
-static int ipc_open_stream_cmd(uint8_t *endpoint_id, uint16_t *mtu, int *fd,
+static int ipc_open_stream_cmd(uint8_t *endpoint_id, uint16_t *mtu,
+						uint8_t *batch, int *fd,
 						struct audio_preset **caps)
 {
 	char buf[BLUEZ_AUDIO_MTU];
@@ -364,6 +399,7 @@ static int ipc_open_stream_cmd(uint8_t *endpoint_id, uint16_t *mtu, int *fd,
 					rsp->preset[0].len;
 		*endpoint_id = rsp->id;
 		*mtu = rsp->mtu;
+		*batch = rsp->batch;
 		*caps = malloc(buf_len);
 		memcpy(*caps, &rsp->preset, buf_len);
 	} else {
@@ -474,6 +510,12 @@ static void unregister_endpoints(void)
 	}
 }
 
+static struct media_packet *get_packet(struct audio_endpoint *ep,
+							unsigned int index)
+{
+	return (void *) ((uint8_t *) ep->mp + index * ep->mp_size);
+}
+
 static bool open_endpoint(struct audio_endpoint **epp,
 						struct audio_input_config *cfg)
 {
@@ -482,6 +524,8 @@ static bool open_endpoint(struct audio_endpoint **epp,
 	const struct audio_codec *codec;
 	uint16_t mtu;
 	uint16_t payload_len;
+	uint8_t batch;
+	socklen_t len;
 	int fd;
 	size_t i;
 	uint8_t ep_id = 0;
@@ -489,11 +533,11 @@ static bool open_endpoint(struct audio_endpoint **epp,
 	if (ep)
 		ep_id = ep->id;
 
-	if (ipc_open_stream_cmd(&ep_id, &mtu, &fd, &preset) !=
+	if (ipc_open_stream_cmd(&ep_id, &mtu, &batch, &fd, &preset) !=
 							AUDIO_STATUS_SUCCESS)
 		return false;
 
-	DBG("ep_id=%d mtu=%u", ep_id, mtu);
+	DBG("ep_id=%d mtu=%u batch=%u", ep_id, mtu, batch);
 
 	for (i = 0; i < MAX_AUDIO_ENDPOINTS; i++)
 		if (audio_endpoints[i].id == ep_id) {
@@ -514,17 +558,32 @@ static bool open_endpoint(struct audio_endpoint **epp,
 
 	ep->fd = fd;
 
+	/*
+	 * Bluetooth sockets report free space in the send buffer for
+	 * TIOCOUTQ, so the buffer size is needed to get the queue depth.
+	 */
+	len = sizeof(ep->sndbuf);
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &ep->sndbuf, &len) < 0)
+		ep->sndbuf = 0;
+
 	codec = ep->codec;
 	codec->init(preset, payload_len, &ep->codec_data);
 	codec->get_config(ep->codec_data, cfg);
 
-	ep->mp = calloc(mtu, 1);
+	ep->batch = batch ? batch : 1;
+	if (ep->batch > AUDIO_MAX_BATCH)
+		ep->batch = AUDIO_MAX_BATCH;
+
+	ep->mp_size = mtu;
+	ep->mp_count = 0;
+
+	ep->mp = calloc(ep->batch, mtu);
 	if (!ep->mp)
 		goto failed;
 
-	if (ep->codec->use_rtp) {
+	for (i = 0; ep->codec->use_rtp && i < ep->batch; i++) {
 		struct media_packet_rtp *mp_rtp =
-					(struct media_packet_rtp *) ep->mp;
+				(struct media_packet_rtp *) get_packet(ep, i);
 		mp_rtp->hdr.v = 2;
 		mp_rtp->hdr.pt = 0x60;
 		mp_rtp->hdr.ssrc = htonl(1);
@@ -564,6 +623,11 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 
 	ep->samples = 0;
 	ep->resync = false;
+	ep->mp_count = 0;
+
+	ep->congested = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ep->last_qos);
+	memset(&ep->stats, 0, sizeof(ep->stats));
 
 	ep->codec->update_qos(ep->codec_data, QOS_POLICY_DEFAULT);
 
@@ -616,22 +680,40 @@ static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
 	return true;
 }
 
-static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
+/*
+ * Hands all pending media packets to the socket with one sendmmsg() call,
+ * each of them still goes out as its own L2CAP frame. Returns the number of
+ * packets sent or -1 on error.
+ */
+static int write_to_endpoint(struct audio_endpoint *ep)
 {
-	struct media_packet *mp = (struct media_packet *) ep->mp;
+	struct mmsghdr msgs[AUDIO_MAX_BATCH];
+	struct iovec iov[AUDIO_MAX_BATCH];
+	unsigned int i, sent = 0;
 	int ret;
 
-	while (true) {
-		ret = write(ep->fd, mp, bytes);
+	memset(msgs, 0, sizeof(msgs));
 
-		if (ret >= 0)
-			break;
+	for (i = 0; i < ep->mp_count; i++) {
+		iov[i].iov_base = get_packet(ep, i);
+		iov[i].iov_len = ep->mp_len[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < ep->mp_count) {
+		ret = sendmmsg(ep->fd, msgs + sent, ep->mp_count - sent, 0);
+
+		if (ret > 0) {
+			sent += ret;
+			continue;
+		}
 
 		/*
 		 * this should not happen so let's issue warning, but do not
-		 * fail, we can try to write next packet
+		 * fail, we can try to write next packets
 		 */
-		if (errno == EAGAIN) {
+		if (ret == 0 || errno == EAGAIN) {
 			ret = errno;
 			warn("write failed (%d)", ret);
 			break;
@@ -640,10 +722,106 @@ static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
 		if (errno != EINTR) {
 			ret = errno;
 			error("write failed (%d)", ret);
-			return false;
+			return -1;
 		}
 	}
 
+	return sent;
+}
+
+static void update_qos(struct audio_endpoint *ep, struct timespec *now,
+							uint64_t latency)
+{
+	size_t pkt_len = ep->mp_data_len;
+	size_t max_queued;
+	unsigned int queued = 0;
+	int space;
+
+	if (ep->codec->use_rtp)
+		pkt_len += sizeof(struct rtp_header);
+
+	/* A batch that was just written is expected to sit in the queue */
+	max_queued = (QOS_QUEUE_PACKETS + ep->batch - 1) * pkt_len;
+
+	if (ep->sndbuf > 0 && ioctl(ep->fd, TIOCOUTQ, &space) == 0 &&
+					space >= 0 && space < ep->sndbuf)
+		queued = ep->sndbuf - space;
+
+	if (queued > ep->stats.queued_max)
+		ep->stats.queued_max = queued;
+
+	/*
+	 * Step the quality down when the controller keeps falling behind,
+	 * i.e. several packets are sitting in the socket or writes stall,
+	 * and step it back up once the link was clear for a while.
+	 */
+	if (queued > max_queued || latency > QOS_WRITE_LATENCY) {
+		if (++ep->congested < QOS_CONGESTED_PACKETS)
+			return;
+
+		ep->congested = 0;
+		memcpy(&ep->last_qos, now, sizeof(ep->last_qos));
+
+		if (ep->codec->update_qos(ep->codec_data, QOS_POLICY_DECREASE))
+			ep->stats.decreased++;
+
+		return;
+	}
+
+	ep->congested = 0;
+
+	if (timespec_diff_us(now, &ep->last_qos) < QOS_RECOVERY_TIME)
+		return;
+
+	memcpy(&ep->last_qos, now, sizeof(ep->last_qos));
+
+	if (ep->codec->update_qos(ep->codec_data, QOS_POLICY_INCREASE))
+		ep->stats.increased++;
+}
+
+static bool flush_endpoint(struct audio_endpoint *ep)
+{
+	struct timespec done;
+	uint64_t latency;
+	bool do_write = false;
+	int sent = 0;
+	int i;
+
+	if (!ep->mp_count)
+		return true;
+
+	/* wait some time for socket to be ready for write,
+	 * but we'll just skip writing data if timeout occurs
+	 */
+	if (!wait_for_endpoint(ep, &do_write))
+		return false;
+
+	if (do_write) {
+		sent = write_to_endpoint(ep);
+		if (sent < 0)
+			return false;
+	}
+
+	for (i = 0; i < sent; i++)
+		ep->stats.bytes += ep->mp_len[i];
+
+	ep->stats.packets += sent;
+	ep->stats.dropped += ep->mp_count - sent;
+	if (sent > 0)
+		ep->stats.batches++;
+
+	/* measured from the scheduled write point of the first packet */
+	clock_gettime(CLOCK_MONOTONIC, &done);
+	latency = timespec_diff_us(&done, &ep->mp_sched);
+
+	if (latency > ep->stats.latency_max)
+		ep->stats.latency_max = latency;
+	ep->stats.latency_total += latency * ep->mp_count;
+
+	ep->mp_count = 0;
+
+	update_qos(ep, &done, latency);
+
 	return true;
 }
 
@@ -651,19 +829,18 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 								size_t bytes)
 {
 	struct audio_endpoint *ep = out->ep;
-	struct media_packet *mp = (struct media_packet *) ep->mp;
-	struct media_packet_rtp *mp_rtp = (struct media_packet_rtp *) ep->mp;
 	size_t free_space = ep->mp_data_len;
 	size_t consumed = 0;
 
 	while (consumed < bytes) {
+		struct media_packet *mp = get_packet(ep, ep->mp_count);
+		struct media_packet_rtp *mp_rtp = (struct media_packet_rtp *) mp;
 		size_t written = 0;
 		ssize_t read;
 		uint32_t samples;
 		int ret;
 		struct timespec current;
 		uint64_t audio_sent, audio_passed;
-		bool do_write = false;
 
 		/*
 		 * prepare media packet in advance so we don't waste time after
@@ -683,7 +860,14 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		 * data and continue
 		 */
 		if (read <= 0)
-			return true;
+			return flush_endpoint(ep);
+
+		/*
+		 * Only the first packet of a batch is paced, the following
+		 * ones are encoded right away and sent together with it.
+		 */
+		if (ep->mp_count)
+			goto queue;
 
 		/* calculate where are we and where we should be */
 		clock_gettime(CLOCK_MONOTONIC, &current);
@@ -692,22 +876,22 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		audio_sent = ep->samples * 1000000ll / out->cfg.rate;
 		audio_passed = timespec_diff_us(&current, &ep->start);
 
+		memcpy(&ep->mp_sched, &current, sizeof(ep->mp_sched));
+
 		/*
 		 * if we're ahead of stream then wait for next write point,
 		 * if we're lagging more than 100ms then stop writing and just
 		 * skip data until we're back in sync
 		 */
 		if (audio_sent > audio_passed) {
-			struct timespec anchor;
-
 			ep->resync = false;
 
-			timespec_add(&ep->start, audio_sent, &anchor);
+			timespec_add(&ep->start, audio_sent, &ep->mp_sched);
 
 			while (true) {
 				ret = clock_nanosleep(CLOCK_MONOTONIC,
-							TIMER_ABSTIME, &anchor,
-							NULL);
+							TIMER_ABSTIME,
+							&ep->mp_sched, NULL);
 
 				if (!ret)
 					break;
@@ -724,31 +908,33 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 			if (diff > MAX_DELAY) {
 				warn("lag is %jums, resyncing", diff / 1000);
 
-				ep->codec->update_qos(ep->codec_data,
-							QOS_POLICY_DECREASE);
+				if (ep->codec->update_qos(ep->codec_data,
+							QOS_POLICY_DECREASE))
+					ep->stats.decreased++;
+
+				memcpy(&ep->last_qos, &current,
+							sizeof(ep->last_qos));
+				ep->stats.resyncs++;
 				ep->resync = true;
 			}
 		}
 
+queue:
 		/* we send data only in case codec encoded some data, i.e. some
 		 * codecs do internal buffering and output data only if full
 		 * frame can be encoded
 		 * in resync mode we'll just drop mediapackets
 		 */
 		if (written > 0 && !ep->resync) {
-			/* wait some time for socket to be ready for write,
-			 * but we'll just skip writing data if timeout occurs
-			 */
-			if (!wait_for_endpoint(ep, &do_write))
-				return false;
+			if (ep->codec->use_rtp)
+				written += sizeof(struct rtp_header);
 
-			if (do_write) {
-				if (ep->codec->use_rtp)
-					written += sizeof(struct rtp_header);
+			ep->mp_len[ep->mp_count++] = written;
 
-				if (!write_to_endpoint(ep, written))
-					return false;
-			}
+			if (ep->mp_count == ep->batch && !flush_endpoint(ep))
+				return false;
+		} else if (written > 0) {
+			ep->stats.dropped++;
 		}
 
 		/*
@@ -761,7 +947,8 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		consumed += read;
 	}
 
-	return true;
+	/* Don't hold encoded packets back until the next write */
+	return flush_endpoint(ep);
 }
 
 static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
@@ -902,8 +1089,33 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
+	struct audio_endpoint *ep = out->ep;
+	unsigned long writes;
+
 	DBG("");
-	return -ENOSYS;
+
+	if (!ep)
+		return 0;
+
+	writes = ep->stats.packets + ep->stats.dropped;
+
+	dprintf(fd, "A2DP endpoint %u\n", ep->id);
+	dprintf(fd, "  packets: %lu (%lu bytes), dropped: %lu\n",
+				ep->stats.packets, ep->stats.bytes,
+				ep->stats.dropped);
+	dprintf(fd, "  batches: %lu, max %u packets\n",
+				ep->stats.batches, ep->batch);
+	dprintf(fd, "  resyncs: %lu, quality decreased: %lu, "
+				"increased: %lu\n", ep->stats.resyncs,
+				ep->stats.decreased, ep->stats.increased);
+	dprintf(fd, "  write latency: avg %juus, max %juus\n",
+				writes ? ep->stats.latency_total / writes : 0,
+				ep->stats.latency_max);
+	dprintf(fd, "  socket queue: max %u of %d bytes\n",
+				ep->stats.queued_max, ep->sndbuf);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -15,10 +15,14 @@
  *
  */
 
+#include <stdio.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include <cutils/properties.h>
+
 #include "hal-log.h"
 #include "hal.h"
 #include "hal-msg.h"
@@ -26,6 +30,9 @@
 #include "hal-ipc.h"
 #include "hal-utils.h"
 
+#define SCAN_BATCH_PROPERTY_NAME "persist.sys.bluetooth.scanbatch"
+#define SCAN_FILTER_PROPERTY_NAME "persist.sys.bluetooth.scanfilter"
+
 static const btgatt_callbacks_t *cbs = NULL;
 
 static bool interface_ready(void)
@@ -72,16 +79,10 @@ static void handle_register_client(void *buf, uint16_t len, int fd)
 						(bt_uuid_t *) ev->app_uuid);
 }
 
-static void handle_scan_result(void *buf, uint16_t len, int fd)
+static void send_scan_result(struct hal_ev_gatt_client_scan_result *ev)
 {
-	struct hal_ev_gatt_client_scan_result *ev = buf;
 	uint8_t ad[62];
 
-	if (len != sizeof(*ev) + ev->len ) {
-		error("gatt: invalid scan result event, aborting");
-		exit(EXIT_FAILURE);
-	}
-
 	/* Java assumes that passed data has 62 bytes */
 	memset(ad, 0, sizeof(ad));
 	memcpy(ad, ev->adv_data, ev->len > sizeof(ad) ? sizeof(ad) : ev->len);
@@ -91,6 +92,46 @@ static void handle_scan_result(void *buf, uint16_t len, int fd)
 									ad);
 }
 
+static void handle_scan_result(void *buf, uint16_t len, int fd)
+{
+	struct hal_ev_gatt_client_scan_result *ev = buf;
+
+	if (len != sizeof(*ev) + ev->len ) {
+		error("gatt: invalid scan result event, aborting");
+		exit(EXIT_FAILURE);
+	}
+
+	send_scan_result(ev);
+}
+
+static void handle_scan_results(void *buf, uint16_t len, int fd)
+{
+	struct hal_ev_gatt_client_scan_results *ev = buf;
+	uint8_t *ptr = ev->results;
+	uint16_t left = len - sizeof(*ev);
+	int i;
+
+	for (i = 0; i < ev->num; i++) {
+		struct hal_ev_gatt_client_scan_result *result = (void *) ptr;
+
+		if (left < sizeof(*result) ||
+					left < sizeof(*result) + result->len) {
+			error("gatt: invalid scan results event, aborting");
+			exit(EXIT_FAILURE);
+		}
+
+		send_scan_result(result);
+
+		ptr += sizeof(*result) + result->len;
+		left -= sizeof(*result) + result->len;
+	}
+
+	if (left) {
+		error("gatt: invalid scan results event, aborting");
+		exit(EXIT_FAILURE);
+	}
+}
+
 static void handle_connect(void *buf, uint16_t len, int fd)
 {
 	struct hal_ev_gatt_client_connect *ev = buf;
@@ -565,6 +606,9 @@ static const struct hal_ipc_handler ev_handlers[] = {
 	/* HAL_EV_GATT_SERVER_RSP_CONFIRMATION */
 	{ handle_response_confirmation, false,
 		sizeof(struct hal_ev_gatt_server_rsp_confirmation) },
+	/* HAL_EV_GATT_CLIENT_SCAN_RESULTS */
+	{ handle_scan_results, true,
+		sizeof(struct hal_ev_gatt_client_scan_results) },
 };
 
 /* Client API */
@@ -609,7 +653,7 @@ static bt_status_t scan(int client_if, bool start)
 					sizeof(cmd), &cmd, NULL, NULL, NULL);
 }
 
-static bt_status_t connect(int client_if, const bt_bdaddr_t *bd_addr,
+static bt_status_t client_connect(int client_if, const bt_bdaddr_t *bd_addr,
 								bool is_direct)
 {
 	struct hal_cmd_gatt_client_connect cmd;
@@ -643,7 +687,7 @@ static bt_status_t disconnect(int client_if, const bt_bdaddr_t *bd_addr,
 					sizeof(cmd), &cmd, NULL, NULL, NULL);
 }
 
-static bt_status_t listen(int client_if, bool start)
+static bt_status_t client_listen(int client_if, bool start)
 {
 	struct hal_cmd_gatt_client_listen cmd;
 
@@ -1313,6 +1357,128 @@ static bt_status_t send_response(int conn_id, int trans_id, int status,
 					cmd_len, cmd, NULL, NULL, NULL);
 }
 
+static int parse_hex(const char *str, size_t str_len, uint8_t *buf,
+								size_t size)
+{
+	size_t i, len = 0;
+
+	for (i = 0; i < str_len; i++) {
+		if (str[i] == '-' || str[i] == ':')
+			continue;
+
+		if (len == size || i + 1 >= str_len ||
+				!isxdigit(str[i]) || !isxdigit(str[i + 1]) ||
+				sscanf(&str[i], "%2hhx", &buf[len]) != 1)
+			return -1;
+
+		len++;
+		i++;
+	}
+
+	return len;
+}
+
+static uint8_t *add_scan_filter(const char *str, size_t str_len, uint8_t *ptr,
+							const uint8_t *end)
+{
+	struct hal_gatt_scan_filter *filter = (void *) ptr;
+	uint8_t data[31];
+	int len, i;
+
+	if (end - ptr < (int) (sizeof(*filter) + sizeof(data)))
+		return NULL;
+
+	if (str_len > 5 && !strncmp(str, "addr=", 5)) {
+		filter->type = HAL_GATT_SCAN_FILTER_ADDR;
+		len = parse_hex(str + 5, str_len - 5, data, sizeof(data));
+		if (len != 6)
+			return NULL;
+
+		/* Addresses are written MSB first, HAL order is the same */
+		memcpy(filter->data, data, len);
+	} else if (str_len > 5 && !strncmp(str, "uuid=", 5)) {
+		filter->type = HAL_GATT_SCAN_FILTER_UUID;
+		len = parse_hex(str + 5, str_len - 5, data, sizeof(data));
+		if (len != 2 && len != 4 && len != 16)
+			return NULL;
+
+		/* UUIDs are written MSB first, advertising data is LSB first */
+		for (i = 0; i < len; i++)
+			filter->data[i] = data[len - 1 - i];
+	} else if (str_len > 4 && !strncmp(str, "mfr=", 4)) {
+		filter->type = HAL_GATT_SCAN_FILTER_MANUF;
+		len = parse_hex(str + 4, str_len - 4, data, sizeof(data));
+		if (len <= 0)
+			return NULL;
+
+		memcpy(filter->data, data, len);
+	} else {
+		return NULL;
+	}
+
+	filter->len = len;
+
+	return ptr + sizeof(*filter) + len;
+}
+
+/*
+ * Scan batching and filtering are not part of the Android GATT HAL, they are
+ * configured from properties:
+ *
+ * persist.sys.bluetooth.scanbatch=<timeout ms>[,<max reports>]
+ * persist.sys.bluetooth.scanfilter=<filter>[ <filter>...]
+ *
+ * where filter is addr=XX:XX:XX:XX:XX:XX, uuid=<16, 32 or 128 bit UUID>
+ * or mfr=<hex manufacturer data, starting with the company ID as sent>.
+ */
+static void set_scan_params(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+	uint8_t buf[IPC_MTU];
+	struct hal_cmd_gatt_client_set_scan_params *cmd = (void *) buf;
+	uint8_t *ptr = cmd->filters;
+	unsigned int timeout = 0, max = 0;
+	char *str;
+
+	memset(buf, 0, sizeof(buf));
+
+	if (property_get(SCAN_BATCH_PROPERTY_NAME, value, "") > 0 &&
+				sscanf(value, "%u,%u", &timeout, &max) >= 1) {
+		cmd->batch_timeout = timeout > UINT16_MAX ? UINT16_MAX :
+									timeout;
+		cmd->batch_max = max > UINT8_MAX ? UINT8_MAX : max;
+	}
+
+	if (property_get(SCAN_FILTER_PROPERTY_NAME, value, "") > 0) {
+		for (str = value; *str; str += strcspn(str, " ")) {
+			size_t str_len;
+			uint8_t *next;
+
+			str += strspn(str, " ");
+			str_len = strcspn(str, " ");
+			if (!str_len)
+				break;
+
+			next = add_scan_filter(str, str_len, ptr,
+							buf + sizeof(buf));
+			if (!next) {
+				error("gatt: invalid scan filter: %.*s",
+							(int) str_len, str);
+				continue;
+			}
+
+			ptr = next;
+			cmd->num_filters++;
+		}
+	}
+
+	if (!cmd->batch_timeout && !cmd->num_filters)
+		return;
+
+	hal_ipc_cmd(HAL_SERVICE_ID_GATT, HAL_OP_GATT_CLIENT_SET_SCAN_PARAMS,
+					ptr - buf, buf, NULL, NULL, NULL);
+}
+
 static bt_status_t init(const btgatt_callbacks_t *callbacks)
 {
 	struct hal_cmd_register_module cmd;
@@ -1337,8 +1503,11 @@ static bt_status_t init(const btgatt_callbacks_t *callbacks)
 	if (ret != BT_STATUS_SUCCESS) {
 		cbs = NULL;
 		hal_ipc_unregister(HAL_SERVICE_ID_GATT);
+		return ret;
 	}
 
+	set_scan_params();
+
 	return ret;
 }
 
@@ -1365,9 +1534,9 @@ static btgatt_client_interface_t client_iface = {
 	.register_client = register_client,
 	.unregister_client = unregister_client,
 	.scan = scan,
-	.connect = connect,
+	.connect = client_connect,
 	.disconnect = disconnect,
-	.listen = listen,
+	.listen = client_listen,
 	.refresh = refresh,
 	.search_service = search_service,
 	.get_included_service = get_included_service,
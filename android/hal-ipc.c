@@ -127,6 +127,36 @@ static bool handle_msg(void *buf, ssize_t len, int fd)
 	return true;
 }
 
+/* daemon may pack several notifications into single packet */
+static bool handle_notif(void *buf, ssize_t len, int fd)
+{
+	uint8_t *ptr = buf;
+
+	while (len > 0) {
+		struct ipc_hdr *msg = (struct ipc_hdr *) ptr;
+		ssize_t msg_len;
+
+		if (len < (ssize_t) sizeof(*msg)) {
+			error("IPC: message too small (%zd bytes)", len);
+			return false;
+		}
+
+		msg_len = sizeof(*msg) + msg->len;
+		if (msg_len > len) {
+			error("IPC: message malformed (%zd bytes)", len);
+			return false;
+		}
+
+		if (!handle_msg(ptr, msg_len, fd))
+			return false;
+
+		ptr += msg_len;
+		len -= msg_len;
+	}
+
+	return true;
+}
+
 static void *notification_handler(void *data)
 {
 	struct msghdr msg;
@@ -185,7 +215,7 @@ static void *notification_handler(void *data)
 			}
 		}
 
-		if (!handle_msg(buf, ret, fd))
+		if (!handle_notif(buf, ret, fd))
 			goto failed;
 	}
 
@@ -975,6 +975,24 @@ struct hal_cmd_gatt_server_send_response {
 	uint8_t data[0];
 } __attribute__((packed));
 
+#define HAL_GATT_SCAN_FILTER_ADDR	0x01
+#define HAL_GATT_SCAN_FILTER_UUID	0x02
+#define HAL_GATT_SCAN_FILTER_MANUF	0x03
+
+struct hal_gatt_scan_filter {
+	uint8_t type;
+	uint8_t len;
+	uint8_t data[0];
+} __attribute__((packed));
+
+#define HAL_OP_GATT_CLIENT_SET_SCAN_PARAMS	0x24
+struct hal_cmd_gatt_client_set_scan_params {
+	uint16_t batch_timeout;
+	uint8_t batch_max;
+	uint8_t num_filters;
+	uint8_t filters[0];
+} __attribute__((packed));
+
 /* Notifications and confirmations */
 
 #define HAL_POWER_OFF			0x00
@@ -1607,6 +1625,12 @@ struct hal_ev_gatt_server_rsp_confirmation {
 	int32_t handle;
 } __attribute__((packed));
 
+#define HAL_EV_GATT_CLIENT_SCAN_RESULTS		0xa0
+struct hal_ev_gatt_client_scan_results {
+	uint8_t num;
+	uint8_t results[0];
+} __attribute__((packed));
+
 #define HAL_GATT_PERMISSION_READ			0x0001
 #define HAL_GATT_PERMISSION_READ_ENCRYPTED		0x0002
 #define HAL_GATT_PERMISSION_READ_ENCRYPTED_MITM		0x0004
@@ -15,6 +15,11 @@
  *
  */
 
+/* sendmmsg(), recvmmsg() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
@@ -44,6 +49,8 @@
 
 #define SOCKET_POLL_TIMEOUT_MS		500
 
+#define SCO_MAX_BATCH			4
+
 static int listen_sk = -1;
 static int ipc_sk = -1;
 
@@ -79,6 +86,13 @@ struct sco_stream_out {
 	struct resampler_itfe *resampler;
 	int16_t *resample_buf;
 	uint32_t resample_frame_num;
+
+	struct {
+		unsigned long packets;
+		unsigned long batches;
+		unsigned long underruns;
+		uint64_t ahead_max;
+	} stats;
 };
 
 static void sco_close_socket(void)
@@ -101,6 +115,14 @@ struct sco_stream_in {
 	struct resampler_itfe *resampler;
 	int16_t *resample_buf;
 	uint32_t resample_frame_num;
+
+	uint32_t frames_lost;		/* Since last get_input_frames_lost */
+
+	struct {
+		unsigned long packets;
+		unsigned long batches;
+		unsigned long timeouts;
+	} stats;
 };
 
 struct sco_dev {
@@ -117,12 +139,7 @@ struct sco_dev {
 static size_t get_resample_frame_num(uint32_t sco_rate, uint32_t rate,
 						size_t frame_num, bool output)
 {
-	size_t resample_frames_num = frame_num * sco_rate / rate + output;
-
-	DBG("resampler: sco_rate %d frame_num %zd rate %d resample frames %zd",
-				sco_rate, frame_num, rate, resample_frames_num);
-
-	return resample_frames_num;
+	return frame_num * sco_rate / rate + output;
 }
 
 /* SCO IPC functions */
@@ -333,21 +350,102 @@ static uint64_t timespec_diff_us(struct timespec *a, struct timespec *b)
 	return res.tv_sec * 1000000ll + res.tv_nsec / 1000ll;
 }
 
+/*
+ * Keeps the stream in pace with the SCO link so audio does not pile up in
+ * the socket, restarting the clock when the writer fell too far behind.
+ */
+static void pace_stream(struct sco_stream_out *out)
+{
+	struct timespec now;
+	uint64_t audio_sent_us, audio_passed_us;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	/* Mark start of the stream */
+	if (!out->samples)
+		memcpy(&out->start, &now, sizeof(out->start));
+
+	audio_sent_us = out->samples * 1000000ll / AUDIO_STREAM_SCO_RATE;
+	audio_passed_us = timespec_diff_us(&now, &out->start);
+
+	if (audio_sent_us > audio_passed_us &&
+			audio_sent_us - audio_passed_us > out->stats.ahead_max)
+		out->stats.ahead_max = audio_sent_us - audio_passed_us;
+
+	if ((int) (audio_sent_us - audio_passed_us) > 1500) {
+		struct timespec timeout = {0,
+					(audio_sent_us -
+					audio_passed_us) * 1000};
+
+		nanosleep(&timeout, NULL);
+	} else if ((int)(audio_passed_us - audio_sent_us) > 50000) {
+		DBG("Resync");
+		out->stats.underruns++;
+		out->samples = 0;
+		memcpy(&out->start, &now, sizeof(out->start));
+	}
+}
+
+/*
+ * Hands up to SCO_MAX_BATCH packets to the socket with one sendmmsg() call,
+ * each of them still goes out as its own SCO packet. Returns the number of
+ * packets sent or -1 on error.
+ */
+static int send_packets(struct mmsghdr *msgs, unsigned int count)
+{
+	unsigned int sent = 0;
+	int ret;
+
+	while (sent < count) {
+		ret = sendmmsg(sco_fd, msgs + sent, count - sent, 0);
+		if (ret > 0) {
+			sent += ret;
+			continue;
+		}
+
+		if (ret == 0 || errno == EAGAIN) {
+			ret = errno;
+			warn("write failed (%d)", ret);
+			break;
+		}
+
+		if (errno != EINTR) {
+			ret = errno;
+			error("write failed (%d) fd %d", ret, sco_fd);
+			return -1;
+		}
+	}
+
+	return sent;
+}
+
 static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 								size_t bytes)
 {
+	struct mmsghdr msgs[SCO_MAX_BATCH];
+	struct iovec iov[SCO_MAX_BATCH];
 	struct pollfd pfd;
-	size_t len, written = 0;
-	int ret;
-	uint8_t *p;
-	uint64_t audio_sent_us, audio_passed_us;
+	size_t len, offset, written = 0;
+	unsigned int count;
+	int i, sent;
 
 	pfd.fd = sco_fd;
 	pfd.events = POLLOUT | POLLHUP | POLLNVAL;
 
-	while (bytes > written) {
-		struct timespec now;
+	/* Complete the packet left over by the previous write first */
+	if (out->cache_len) {
+		len = sco_mtu - out->cache_len;
+		if (len > bytes)
+			len = bytes;
+
+		memcpy(out->cache + out->cache_len, buffer, len);
+		out->cache_len += len;
+		written = len;
+
+		if (out->cache_len < sco_mtu)
+			return true;
+	}
 
+	while (out->cache_len || bytes - written >= sco_mtu) {
 		/* poll for sending */
 		if (poll(&pfd, 1, SOCKET_POLL_TIMEOUT_MS) == 0) {
 			DBG("timeout fd %d", sco_fd);
@@ -359,77 +457,52 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 			return false;
 		}
 
-		len = bytes - written > sco_mtu ? sco_mtu : bytes - written;
-
-		clock_gettime(CLOCK_REALTIME, &now);
-		/* Mark start of the stream */
-		if (!out->samples)
-			memcpy(&out->start, &now, sizeof(out->start));
-
-		audio_sent_us = out->samples * 1000000ll / AUDIO_STREAM_SCO_RATE;
-		audio_passed_us = timespec_diff_us(&now, &out->start);
-		if ((int) (audio_sent_us - audio_passed_us) > 1500) {
-			struct timespec timeout = {0,
-						(audio_sent_us -
-						audio_passed_us) * 1000};
-			DBG("Sleeping for %d ms",
-					(int) (audio_sent_us - audio_passed_us));
-			nanosleep(&timeout, NULL);
-		} else if ((int)(audio_passed_us - audio_sent_us) > 50000) {
-			DBG("\n\nResync\n\n");
-			out->samples = 0;
-			memcpy(&out->start, &now, sizeof(out->start));
-		}
+		pace_stream(out);
+
+		memset(msgs, 0, sizeof(msgs));
+		count = 0;
 
 		if (out->cache_len) {
-			DBG("First packet cache_len %zd", out->cache_len);
-			memcpy(out->cache + out->cache_len, buffer,
-						sco_mtu - out->cache_len);
-			p = out->cache;
-		} else {
-			if (bytes - written >= sco_mtu)
-				p = (void *) buffer + written;
-			else {
-				memcpy(out->cache, buffer + written,
-							bytes - written);
-				out->cache_len = bytes - written;
-				DBG("Last packet, cache %zd bytes",
-							bytes - written);
-				written += bytes - written;
-				continue;
-			}
+			iov[count].iov_base = out->cache;
+			iov[count].iov_len = sco_mtu;
+			count++;
 		}
 
-		ret = write(sco_fd, p, len);
-		if (ret > 0) {
-			if (out->cache_len) {
-				written = sco_mtu - out->cache_len;
-				out->cache_len = 0;
-			} else
-				written += ret;
-
-			out->samples += ret / 2;
-
-			DBG("written %d samples %zd total %zd bytes",
-					ret, out->samples, written);
-			continue;
+		for (offset = written; count < SCO_MAX_BATCH &&
+					bytes - offset >= sco_mtu;
+					offset += sco_mtu) {
+			iov[count].iov_base = (void *) buffer + offset;
+			iov[count].iov_len = sco_mtu;
+			count++;
 		}
 
-		if (errno == EAGAIN) {
-			ret = errno;
-			warn("write failed (%d)", ret);
-			continue;
+		for (i = 0; i < (int) count; i++) {
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
 		}
 
-		if (errno != EINTR) {
-			ret = errno;
-			error("write failed (%d) fd %d bytes %zd", ret, sco_fd,
-									bytes);
+		sent = send_packets(msgs, count);
+		if (sent < 0)
 			return false;
+
+		for (i = 0; i < sent; i++) {
+			if (iov[i].iov_base == out->cache)
+				out->cache_len = 0;
+			else
+				written += sco_mtu;
 		}
+
+		out->samples += sent * sco_mtu / 2;
+		out->stats.packets += sent;
+		if (sent > 0)
+			out->stats.batches++;
 	}
 
-	DBG("written %zd bytes", bytes);
+	/* Less than a packet left, send it along with the next write */
+	if (bytes > written) {
+		memcpy(out->cache, buffer + written, bytes - written);
+		out->cache_len = bytes - written;
+	}
 
 	return true;
 }
@@ -443,8 +516,6 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 	void *send_buf = out->downmix_buf;
 	size_t total;
 
-	DBG("write to fd %d bytes %zu", sco_fd, bytes);
-
 	if (ipc_get_sco_fd() != SCO_STATUS_SUCCESS)
 		return -1;
 
@@ -473,15 +544,10 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 		}
 
 		send_buf = out->resample_buf;
-
-		DBG("Resampled: frame_num %zd, output_frame_num %zd",
-						frame_num, output_frame_num);
 	}
 
 	total = output_frame_num * sizeof(int16_t) * 1;
 
-	DBG("total %zd", total);
-
 	if (!write_data(out, send_buf, total))
 		return -1;
 
@@ -553,9 +619,18 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct sco_stream_out *out = (struct sco_stream_out *) stream;
+
 	DBG("");
 
-	return -ENOSYS;
+	dprintf(fd, "SCO output stream\n");
+	dprintf(fd, "  packets: %lu in %lu batches, mtu %u\n",
+				out->stats.packets, out->stats.batches,
+				sco_mtu);
+	dprintf(fd, "  underruns: %lu, max ahead %juus\n",
+				out->stats.underruns, out->stats.ahead_max);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -900,9 +975,17 @@ static int in_standby(struct audio_stream *stream)
 
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+	struct sco_stream_in *in = (struct sco_stream_in *) stream;
+
 	DBG("");
 
-	return -ENOSYS;
+	dprintf(fd, "SCO input stream\n");
+	dprintf(fd, "  packets: %lu in %lu batches, mtu %u\n",
+				in->stats.packets, in->stats.batches, sco_mtu);
+	dprintf(fd, "  timeouts: %lu, frames lost: %u\n",
+				in->stats.timeouts, in->frames_lost);
+
+	return 0;
 }
 
 static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -943,10 +1026,53 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
 	return -ENOSYS;
 }
 
+/*
+ * Takes every packet already queued on the socket, up to SCO_MAX_BATCH, with
+ * a single recvmmsg() call and packs them back to back in the buffer.
+ */
+static int recv_packets(struct sco_stream_in *in, char *buffer, size_t bytes)
+{
+	struct mmsghdr msgs[SCO_MAX_BATCH];
+	struct iovec iov[SCO_MAX_BATCH];
+	size_t len, offset = 0;
+	unsigned int count;
+	int i, ret;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (count = 0; count < SCO_MAX_BATCH && offset < bytes; count++) {
+		len = bytes - offset > sco_mtu ? sco_mtu : bytes - offset;
+
+		iov[count].iov_base = buffer + offset;
+		iov[count].iov_len = len;
+		msgs[count].msg_hdr.msg_iov = &iov[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+
+		offset += len;
+	}
+
+	ret = recvmmsg(sco_fd, msgs, count, MSG_DONTWAIT, NULL);
+	if (ret <= 0)
+		return -1;
+
+	/* Close the gaps left by packets shorter than the MTU */
+	for (offset = 0, i = 0; i < ret; i++) {
+		if (buffer + offset != iov[i].iov_base)
+			memmove(buffer + offset, iov[i].iov_base,
+							msgs[i].msg_len);
+		offset += msgs[i].msg_len;
+	}
+
+	in->stats.packets += ret;
+	in->stats.batches++;
+
+	return offset;
+}
+
 static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 {
 	struct pollfd pfd;
-	size_t len, read_bytes = 0;
+	size_t read_bytes = 0;
 
 	pfd.fd = sco_fd;
 	pfd.events = POLLIN | POLLHUP | POLLNVAL;
@@ -957,6 +1083,7 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 		/* poll for reading */
 		if (poll(&pfd, 1, SOCKET_POLL_TIMEOUT_MS) == 0) {
 			DBG("timeout fd %d", sco_fd);
+			in->stats.timeouts++;
 			return false;
 		}
 
@@ -965,17 +1092,14 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 			return false;
 		}
 
-		len = bytes - read_bytes > sco_mtu ? sco_mtu :
-							bytes - read_bytes;
-
-		ret = read(sco_fd, buffer + read_bytes, len);
+		ret = recv_packets(in, buffer + read_bytes,
+							bytes - read_bytes);
 		if (ret > 0) {
 			read_bytes += ret;
-			DBG("read %d total %zd", ret, read_bytes);
 			continue;
 		}
 
-		if (errno == EAGAIN) {
+		if (ret == 0 || errno == EAGAIN) {
 			ret = errno;
 			warn("read failed (%d)", ret);
 			continue;
@@ -989,8 +1113,6 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 		}
 	}
 
-	DBG("read %zd bytes", read_bytes);
-
 	return true;
 }
 
@@ -1005,8 +1127,6 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 	size_t total = bytes;
 	int ret;
 
-	DBG("Read from fd %d bytes %zu", sco_fd, bytes);
-
 	if (ipc_get_sco_fd() != SCO_STATUS_SUCCESS)
 		return -1;
 
@@ -1030,8 +1150,10 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 		total = input_frame_num * sizeof(int16_t) * 1;
 	}
 
-	if(!read_data(in, read_buf, total))
+	if (!read_data(in, read_buf, total)) {
+		in->frames_lost += frame_num;
 		return -1;
+	}
 
 	if (in->resampler) {
 		ret = in->resampler->resample_from_input(in->resampler,
@@ -1045,9 +1167,6 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 					strerror(ret));
 			return -1;
 		}
-
-		DBG("resampler: remain %zd output %zd frames", input_frame_num,
-								frame_num);
 	}
 
 	return bytes;
@@ -1055,9 +1174,12 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-	DBG("");
+	struct sco_stream_in *in = (struct sco_stream_in *) stream;
+	uint32_t lost = in->frames_lost;
 
-	return -ENOSYS;
+	in->frames_lost = 0;
+
+	return lost;
 }
 
 static int sco_open_input_stream(struct audio_hw_device *dev,
@@ -40,11 +40,19 @@
 #include "ipc.h"
 #include "src/log.h"
 
+#define IPC_NOTIF_BACKLOG	64
+
 struct service_handler {
 	const struct ipc_handler *handler;
 	uint8_t size;
 };
 
+struct notif_pdu {
+	int fd;
+	size_t len;
+	uint8_t data[0];
+};
+
 struct ipc {
 	struct service_handler *services;
 	int service_max;
@@ -59,12 +67,43 @@ struct ipc {
 	GIOChannel *notif_io;
 	guint notif_watch;
 
+	uint8_t notif_buf[IPC_MTU];
+	size_t notif_len;
+	guint notif_flush;
+
+	GQueue *notif_backlog;
+	guint notif_out_watch;
+
 	ipc_disconnect_cb disconnect_cb;
 	void *disconnect_cb_data;
 };
 
+static void notif_pdu_free(gpointer data)
+{
+	struct notif_pdu *pdu = data;
+
+	if (pdu->fd >= 0)
+		close(pdu->fd);
+
+	g_free(pdu);
+}
+
 static void ipc_disconnect(struct ipc *ipc, bool in_cleanup)
 {
+	if (ipc->notif_flush) {
+		g_source_remove(ipc->notif_flush);
+		ipc->notif_flush = 0;
+	}
+
+	if (ipc->notif_out_watch) {
+		g_source_remove(ipc->notif_out_watch);
+		ipc->notif_out_watch = 0;
+	}
+
+	g_queue_foreach(ipc->notif_backlog, (GFunc) notif_pdu_free, NULL);
+	g_queue_clear(ipc->notif_backlog);
+	ipc->notif_len = 0;
+
 	if (ipc->cmd_watch) {
 		g_source_remove(ipc->cmd_watch);
 		ipc->cmd_watch = 0;
@@ -307,9 +346,11 @@ struct ipc *ipc_init(const char *path, size_t size, int max_service_id,
 	ipc->size = size;
 
 	ipc->notifications = notifications;
+	ipc->notif_backlog = g_queue_new();
 
 	ipc->cmd_io = ipc_connect(path, size, cmd_connect_cb, ipc);
 	if (!ipc->cmd_io) {
+		g_queue_free(ipc->notif_backlog);
 		g_free(ipc->services);
 		g_free(ipc);
 		return NULL;
@@ -325,35 +366,22 @@ void ipc_cleanup(struct ipc *ipc)
 {
 	ipc_disconnect(ipc, true);
 
+	g_queue_free(ipc->notif_backlog);
 	g_free(ipc->services);
 	g_free(ipc);
 }
 
-static void ipc_send(int sk, uint8_t service_id, uint8_t opcode, uint16_t len,
-							void *param, int fd)
+static ssize_t ipc_sendv(int sk, struct iovec *iv, int iovcnt, int fd)
 {
 	struct msghdr msg;
-	struct iovec iv[2];
-	struct ipc_hdr m;
 	char cmsgbuf[CMSG_SPACE(sizeof(int))];
 	struct cmsghdr *cmsg;
 
 	memset(&msg, 0, sizeof(msg));
-	memset(&m, 0, sizeof(m));
 	memset(cmsgbuf, 0, sizeof(cmsgbuf));
 
-	m.service_id = service_id;
-	m.opcode = opcode;
-	m.len = len;
-
-	iv[0].iov_base = &m;
-	iv[0].iov_len = sizeof(m);
-
-	iv[1].iov_base = param;
-	iv[1].iov_len = len;
-
 	msg.msg_iov = iv;
-	msg.msg_iovlen = 2;
+	msg.msg_iovlen = iovcnt;
 
 	if (fd >= 0) {
 		msg.msg_control = cmsgbuf;
@@ -368,7 +396,28 @@ static void ipc_send(int sk, uint8_t service_id, uint8_t opcode, uint16_t len,
 		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
 	}
 
-	if (sendmsg(sk, &msg, 0) < 0) {
+	return sendmsg(sk, &msg, MSG_DONTWAIT);
+}
+
+static void ipc_send(int sk, uint8_t service_id, uint8_t opcode, uint16_t len,
+							void *param, int fd)
+{
+	struct iovec iv[2];
+	struct ipc_hdr m;
+
+	memset(&m, 0, sizeof(m));
+
+	m.service_id = service_id;
+	m.opcode = opcode;
+	m.len = len;
+
+	iv[0].iov_base = &m;
+	iv[0].iov_len = sizeof(m);
+
+	iv[1].iov_base = param;
+	iv[1].iov_len = len;
+
+	if (ipc_sendv(sk, iv, 2, fd) < 0) {
 		error("IPC send failed :%s", strerror(errno));
 
 		/* TODO disconnect IPC here when this function becomes static */
@@ -376,12 +425,138 @@ static void ipc_send(int sk, uint8_t service_id, uint8_t opcode, uint16_t len,
 	}
 }
 
+static gboolean notif_out_cb(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct ipc *ipc = user_data;
+	struct notif_pdu *pdu;
+	struct iovec iv;
+	int sk;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		ipc->notif_out_watch = 0;
+		return FALSE;
+	}
+
+	sk = g_io_channel_unix_get_fd(io);
+
+	while ((pdu = g_queue_peek_head(ipc->notif_backlog))) {
+		iv.iov_base = pdu->data;
+		iv.iov_len = pdu->len;
+
+		if (ipc_sendv(sk, &iv, 1, pdu->fd) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return TRUE;
+
+			error("IPC send failed :%s", strerror(errno));
+			raise(SIGTERM);
+			break;
+		}
+
+		notif_pdu_free(g_queue_pop_head(ipc->notif_backlog));
+	}
+
+	ipc->notif_out_watch = 0;
+
+	return FALSE;
+}
+
+static void notif_sendv(struct ipc *ipc, struct iovec *iv, int iovcnt,
+									int fd)
+{
+	struct notif_pdu *pdu;
+	GIOCondition cond;
+	size_t len = 0;
+	uint8_t *ptr;
+	int i, sk;
+
+	sk = g_io_channel_unix_get_fd(ipc->notif_io);
+
+	/* keep ordering, new PDUs go behind anything still queued */
+	if (g_queue_is_empty(ipc->notif_backlog)) {
+		if (ipc_sendv(sk, iv, iovcnt, fd) >= 0)
+			return;
+
+		if (errno != EAGAIN && errno != EINTR) {
+			error("IPC send failed :%s", strerror(errno));
+			raise(SIGTERM);
+			return;
+		}
+	}
+
+	/*
+	 * HAL is not keeping up, hold on to a bounded number of PDUs and
+	 * give up on it only once that is exceeded as well.
+	 */
+	if (g_queue_get_length(ipc->notif_backlog) >= IPC_NOTIF_BACKLOG) {
+		error("IPC notification backlog full");
+		raise(SIGTERM);
+		return;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		len += iv[i].iov_len;
+
+	pdu = g_malloc(sizeof(*pdu) + len);
+	pdu->fd = fd >= 0 ? dup(fd) : -1;
+	pdu->len = len;
+
+	for (i = 0, ptr = pdu->data; i < iovcnt; i++) {
+		memcpy(ptr, iv[i].iov_base, iv[i].iov_len);
+		ptr += iv[i].iov_len;
+	}
+
+	g_queue_push_tail(ipc->notif_backlog, pdu);
+
+	if (ipc->notif_out_watch)
+		return;
+
+	cond = G_IO_OUT | G_IO_ERR | G_IO_HUP | G_IO_NVAL;
+	ipc->notif_out_watch = g_io_add_watch(ipc->notif_io, cond,
+							notif_out_cb, ipc);
+}
+
+static void notif_flush(struct ipc *ipc)
+{
+	struct iovec iv;
+
+	if (ipc->notif_flush) {
+		g_source_remove(ipc->notif_flush);
+		ipc->notif_flush = 0;
+	}
+
+	if (!ipc->notif_len)
+		return;
+
+	iv.iov_base = ipc->notif_buf;
+	iv.iov_len = ipc->notif_len;
+
+	ipc->notif_len = 0;
+
+	notif_sendv(ipc, &iv, 1, -1);
+}
+
+static gboolean notif_flush_cb(gpointer user_data)
+{
+	struct ipc *ipc = user_data;
+
+	ipc->notif_flush = 0;
+
+	notif_flush(ipc);
+
+	return FALSE;
+}
+
 void ipc_send_rsp(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 								uint8_t status)
 {
 	struct ipc_status s;
 	int sk;
 
+	/* notifications queued so far must not be overtaken by response */
+	if (ipc->notif_io)
+		notif_flush(ipc);
+
 	sk = g_io_channel_unix_get_fd(ipc->cmd_io);
 
 	if (status == IPC_STATUS_SUCCESS) {
@@ -397,6 +572,9 @@ void ipc_send_rsp(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 void ipc_send_rsp_full(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd)
 {
+	if (ipc->notif_io)
+		notif_flush(ipc);
+
 	ipc_send(g_io_channel_unix_get_fd(ipc->cmd_io), service_id, opcode, len,
 								param, fd);
 }
@@ -410,11 +588,49 @@ void ipc_send_notif(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 void ipc_send_notif_with_fd(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd)
 {
+	struct ipc_hdr m;
+	struct iovec iv[2];
+
 	if (!ipc || !ipc->notif_io)
 		return;
 
-	ipc_send(g_io_channel_unix_get_fd(ipc->notif_io), service_id, opcode,
-								len, param, fd);
+	memset(&m, 0, sizeof(m));
+
+	m.service_id = service_id;
+	m.opcode = opcode;
+	m.len = len;
+
+	/*
+	 * Notifications are packed back to back into single packet and sent
+	 * once mainloop goes idle or packet is full. PDUs carrying file
+	 * descriptor or not fitting into packet are sent on their own.
+	 */
+	if (fd < 0 && sizeof(m) + len <= sizeof(ipc->notif_buf)) {
+		if (ipc->notif_len + sizeof(m) + len > sizeof(ipc->notif_buf))
+			notif_flush(ipc);
+
+		memcpy(ipc->notif_buf + ipc->notif_len, &m, sizeof(m));
+		ipc->notif_len += sizeof(m);
+
+		if (len)
+			memcpy(ipc->notif_buf + ipc->notif_len, param, len);
+		ipc->notif_len += len;
+
+		if (!ipc->notif_flush)
+			ipc->notif_flush = g_idle_add(notif_flush_cb, ipc);
+
+		return;
+	}
+
+	notif_flush(ipc);
+
+	iv[0].iov_base = &m;
+	iv[0].iov_len = sizeof(m);
+
+	iv[1].iov_base = param;
+	iv[1].iov_len = len;
+
+	notif_sendv(ipc, iv, 2, fd);
 }
 
 void ipc_register(struct ipc *ipc, uint8_t service,
@@ -514,6 +514,44 @@ static gboolean wait_response_timer(gpointer data)
 	return FALSE;
 }
 
+static void setup_start(struct mcap_mdl *mdl, gboolean reconnect)
+{
+	mdl->setup_start = g_get_monotonic_time();
+	mdl->setup_reconn = reconnect;
+}
+
+static void setup_done(struct mcap_mdl *mdl)
+{
+	struct mcap_setup_stats *stats;
+	gint64 delta;
+
+	if (!mdl->setup_start)
+		return;
+
+	delta = g_get_monotonic_time() - mdl->setup_start;
+	mdl->setup_start = 0;
+
+	if (mdl->setup_reconn)
+		stats = &mdl->mcl->reconn_stats;
+	else
+		stats = &mdl->mcl->create_stats;
+
+	if (!stats->count || delta < stats->min)
+		stats->min = delta;
+	if (delta > stats->max)
+		stats->max = delta;
+
+	stats->total += delta;
+	stats->count++;
+
+	DBG("MDL %u %s in %" G_GINT64_FORMAT " us (%u setups, avg %"
+			G_GINT64_FORMAT " min %" G_GINT64_FORMAT " max %"
+			G_GINT64_FORMAT " us)", mdl->mdlid,
+			mdl->setup_reconn ? "reconnected" : "created", delta,
+			stats->count, stats->total / stats->count,
+			stats->min, stats->max);
+}
+
 gboolean mcap_create_mdl(struct mcap_mcl *mcl,
 				uint8_t mdepid,
 				uint8_t conf,
@@ -557,6 +595,7 @@ gboolean mcap_create_mdl(struct mcap_mcl *mcl,
 
 	mcl->state = MCL_ACTIVE;
 	mcl->priv_data = con;
+	setup_start(mdl, FALSE);
 
 	mcl->mdls = g_slist_insert_sorted(mcl->mdls, mcap_mdl_ref(mdl),
 								compare_mdl);
@@ -597,6 +636,7 @@ gboolean mcap_reconnect_mdl(struct mcap_mdl *mdl,
 
 	mcl->state = MCL_ACTIVE;
 	mcl->priv_data = con;
+	setup_start(mdl, TRUE);
 
 	mcl->tid = g_timeout_add_seconds(RESPONSE_TIMER, wait_response_timer,
 									mcl);
@@ -1116,6 +1156,7 @@ static void process_md_create_mdl_req(struct mcap_mcl *mcl, void *cmd,
 
 	mdl->mdep_id = mdep_id;
 	mdl->state = MDL_WAITING;
+	setup_start(mdl, FALSE);
 
 	mcl->state = MCL_PENDING;
 	mcap_send_cmd(mcl, MCAP_MD_CREATE_MDL_RSP, MCAP_SUCCESS, mdl_id,
@@ -1167,6 +1208,7 @@ static void process_md_reconnect_mdl_req(struct mcap_mcl *mcl, void *cmd,
 		shutdown_mdl(mdl);
 
 	mdl->state = MDL_WAITING;
+	setup_start(mdl, TRUE);
 	mcl->state = MCL_PENDING;
 	mcap_send_cmd(mcl, MCAP_MD_RECONNECT_MDL_RSP, MCAP_SUCCESS, mdl_id,
 								NULL, 0);
@@ -1697,6 +1739,7 @@ static void mcap_connect_mdl_cb(GIOChannel *chan, GError *conn_err,
 	if (conn_err) {
 		DBG("ERROR: mdl connect callback");
 		mdl->state = MDL_CLOSED;
+		mdl->setup_start = 0;
 		g_io_channel_unref(mdl->dc);
 		mdl->dc = NULL;
 		cb(mdl, conn_err, user_data);
@@ -1704,6 +1747,7 @@ static void mcap_connect_mdl_cb(GIOChannel *chan, GError *conn_err,
 	}
 
 	mdl->state = MDL_CONNECTED;
+	setup_done(mdl);
 	mdl->wid = g_io_add_watch_full(mdl->dc, G_PRIORITY_DEFAULT,
 					G_IO_ERR | G_IO_HUP | G_IO_NVAL,
 					(GIOFunc) mdl_event_cb,
@@ -1856,6 +1900,7 @@ static void set_mdl_properties(GIOChannel *chan, struct mcap_mdl *mdl)
 	struct mcap_mcl *mcl = mdl->mcl;
 
 	mdl->state = MDL_CONNECTED;
+	setup_done(mdl);
 	mdl->dc = g_io_channel_ref(chan);
 	mdl->wid = g_io_add_watch_full(mdl->dc, G_PRIORITY_DEFAULT,
 					G_IO_ERR | G_IO_HUP | G_IO_NVAL,
@@ -211,6 +211,14 @@ typedef enum {
 
 struct mcap_csp;
 struct mcap_mdl_op_cb;
+
+/* Time from sending a create or reconnect request to data channel up */
+struct mcap_setup_stats {
+	unsigned int	count;
+	gint64		total;
+	gint64		min;
+	gint64		max;
+};
 struct mcap_instance;
 struct mcap_mcl;
 struct mcap_mdl;
@@ -307,6 +315,8 @@ struct mcap_mcl {
 	uint8_t			ctrl;		/* MCL control flag */
 	uint16_t		next_mdl;	/* id used to create next MDL */
 	struct mcap_csp		*csp;		/* CSP control structure */
+	struct mcap_setup_stats	create_stats;	/* Data channel setup times */
+	struct mcap_setup_stats	reconn_stats;	/* ... after a reconnect */
 };
 
 struct mcap_mdl {
@@ -317,6 +327,8 @@ struct mcap_mdl {
 	uint8_t			mdep_id;	/* MCAP Data End Point */
 	MDLState		state;		/* MDL state */
 	int			ref;		/* References counter */
+	gint64			setup_start;	/* Setup request time, 0 if none */
+	gboolean		setup_reconn;	/* Setup is a reconnection */
 };
 
 struct sync_info_ind_data {
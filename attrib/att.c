@@ -130,6 +130,33 @@ struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len)
 	return list;
 }
 
+static bool data_iter_init(struct att_data_iter *iter, const uint8_t *data,
+						uint16_t num, uint16_t len)
+{
+	if (iter == NULL)
+		return false;
+
+	iter->data = data;
+	iter->num = num;
+	iter->len = len;
+	iter->pos = 0;
+
+	return true;
+}
+
+const uint8_t *att_data_iter_next(struct att_data_iter *iter)
+{
+	const uint8_t *data;
+
+	if (iter->pos >= iter->num)
+		return NULL;
+
+	data = iter->data + iter->pos * iter->len;
+	iter->pos++;
+
+	return data;
+}
+
 static void get_uuid(uint8_t type, const void *val, bt_uuid_t *uuid)
 {
 	if (type == BT_UUID16)
@@ -227,15 +254,13 @@ uint16_t enc_read_by_grp_resp(struct att_data_list *list, uint8_t *pdu,
 	return w;
 }
 
-struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len)
+bool dec_read_by_grp_resp(const uint8_t *pdu, size_t len,
+						struct att_data_iter *iter)
 {
-	struct att_data_list *list;
-	const uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
+	uint16_t elen;
 
 	if (pdu[0] != ATT_OP_READ_BY_GROUP_RESP)
-		return NULL;
+		return false;
 
 	/* PDU must contain at least:
 	 * - Attribute Opcode (1 octet)
@@ -245,30 +270,18 @@ struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len)
 	 *   - End Group Handle (2 octets)
 	 *   - Attribute Value (at least 1 octet) */
 	if (len < 7)
-		return NULL;
+		return false;
 
 	elen = pdu[1];
 	/* Minimum Attribute Data List size */
 	if (elen < 5)
-		return NULL;
+		return false;
 
 	/* Reject incomplete Attribute Data List */
 	if ((len - 2) % elen)
-		return NULL;
-
-	num = (len - 2) / elen;
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
-
-	ptr = &pdu[2];
+		return false;
 
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
-
-	return list;
+	return data_iter_init(iter, &pdu[2], (len - 2) / elen, elen);
 }
 
 uint16_t enc_find_by_type_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
@@ -472,15 +485,13 @@ uint16_t enc_read_by_type_resp(struct att_data_list *list, uint8_t *pdu,
 	return w;
 }
 
-struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len)
+bool dec_read_by_type_resp(const uint8_t *pdu, size_t len,
+						struct att_data_iter *iter)
 {
-	struct att_data_list *list;
-	const uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
+	uint16_t elen;
 
 	if (pdu[0] != ATT_OP_READ_BY_TYPE_RESP)
-		return NULL;
+		return false;
 
 	/* PDU must contain at least:
 	 * - Attribute Opcode (1 octet)
@@ -489,30 +500,18 @@ struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len)
 	 *   - Attribute Handle (2 octets)
 	 *   - Attribute Value (at least 1 octet) */
 	if (len < 5)
-		return NULL;
+		return false;
 
 	elen = pdu[1];
 	/* Minimum Attribute Data List size */
 	if (elen < 3)
-		return NULL;
+		return false;
 
 	/* Reject incomplete Attribute Data List */
 	if ((len - 2) % elen)
-		return NULL;
-
-	num = (len - 2) / elen;
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
-
-	ptr = &pdu[2];
+		return false;
 
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
-
-	return list;
+	return data_iter_init(iter, &pdu[2], (len - 2) / elen, elen);
 }
 
 uint16_t enc_write_cmd(uint16_t handle, const uint8_t *value, size_t vlen,
@@ -901,44 +900,30 @@ uint16_t enc_find_info_resp(uint8_t format, struct att_data_list *list,
 	return w;
 }
 
-struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
-							uint8_t *format)
+bool dec_find_info_resp(const uint8_t *pdu, size_t len, uint8_t *format,
+						struct att_data_iter *iter)
 {
-	struct att_data_list *list;
-	uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
+	uint16_t elen;
 
 	if (pdu == NULL)
-		return 0;
+		return false;
 
 	if (format == NULL)
-		return 0;
+		return false;
 
-	if (pdu[0] != ATT_OP_FIND_INFO_RESP)
-		return 0;
+	if (len < 2 || pdu[0] != ATT_OP_FIND_INFO_RESP)
+		return false;
 
 	*format = pdu[1];
-	elen = sizeof(pdu[0]) + sizeof(*format);
-	if (*format == 0x01)
+	elen = sizeof(uint16_t);
+	if (*format == ATT_FIND_INFO_RESP_FMT_16BIT)
 		elen += 2;
-	else if (*format == 0x02)
+	else if (*format == ATT_FIND_INFO_RESP_FMT_128BIT)
 		elen += 16;
+	else
+		return false;
 
-	num = (len - 2) / elen;
-
-	ptr = (void *) &pdu[2];
-
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
-
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
-
-	return list;
+	return data_iter_init(iter, &pdu[2], (len - 2) / elen, elen);
 }
 
 uint16_t enc_notification(uint16_t handle, uint8_t *value, size_t vlen,
@@ -270,8 +270,9 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 							gpointer user_data)
 {
 	struct discover_primary *dp = user_data;
-	struct att_data_list *list;
-	unsigned int i, err;
+	struct att_data_iter iter;
+	const uint8_t *data;
+	unsigned int err;
 	uint16_t start, end;
 	uint8_t type;
 
@@ -280,24 +281,22 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		goto done;
 	}
 
-	list = dec_read_by_grp_resp(ipdu, iplen);
-	if (list == NULL) {
+	if (!dec_read_by_grp_resp(ipdu, iplen, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len == 6)
+	if (iter.len == 6)
 		type = BT_UUID16;
-	else if (list->len == 20)
+	else if (iter.len == 20)
 		type = BT_UUID128;
 	else {
-		att_data_list_free(list);
 		err = ATT_ECODE_INVALID_PDU;
 		goto done;
 	}
 
-	for (i = 0, end = 0; i < list->num; i++) {
-		const uint8_t *data = list->data[i];
+	end = 0;
+	while ((data = att_data_iter_next(&iter))) {
 		struct gatt_primary *primary;
 		bt_uuid_t uuid128;
 
@@ -308,7 +307,6 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 
 		primary = g_try_new0(struct gatt_primary, 1);
 		if (!primary) {
-			att_data_list_free(list);
 			err = ATT_ECODE_INSUFF_RESOURCES;
 			goto done;
 		}
@@ -318,7 +316,6 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		dp->primaries = g_slist_append(dp->primaries, primary);
 	}
 
-	att_data_list_free(list);
 	err = 0;
 
 	if (end != 0xffff) {
@@ -469,8 +466,8 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 	struct included_discovery *isd = user_data;
 	uint16_t last_handle = isd->end_handle;
 	unsigned int err = status;
-	struct att_data_list *list;
-	int i;
+	struct att_data_iter iter;
+	const uint8_t *data;
 
 	if (err == ATT_ECODE_ATTR_NOT_FOUND)
 		err = 0;
@@ -478,26 +475,24 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 	if (status)
 		goto done;
 
-	list = dec_read_by_type_resp(pdu, len);
-	if (list == NULL) {
+	if (!dec_read_by_type_resp(pdu, len, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len != 6 && list->len != 8) {
+	if (iter.len != 6 && iter.len != 8) {
 		err = ATT_ECODE_IO;
-		att_data_list_free(list);
 		goto done;
 	}
 
-	for (i = 0; i < list->num; i++) {
+	while ((data = att_data_iter_next(&iter))) {
 		struct gatt_included *incl;
 
-		incl = included_from_buf(list->data[i], list->len);
+		incl = included_from_buf(data, iter.len);
 		last_handle = incl->handle;
 
 		/* 128 bit UUID, needs resolving */
-		if (list->len == 6) {
+		if (iter.len == 6) {
 			resolve_included_uuid(isd, incl);
 			continue;
 		}
@@ -505,8 +500,6 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 		isd->includes = g_slist_append(isd->includes, incl);
 	}
 
-	att_data_list_free(list);
-
 	if (last_handle < isd->end_handle)
 		find_included(isd, last_handle + 1);
 
@@ -533,8 +526,9 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 							gpointer user_data)
 {
 	struct discover_char *dc = user_data;
-	struct att_data_list *list;
-	unsigned int i, err = ATT_ECODE_ATTR_NOT_FOUND;
+	struct att_data_iter iter;
+	const uint8_t *value;
+	unsigned int err = ATT_ECODE_ATTR_NOT_FOUND;
 	uint16_t last = 0;
 	uint8_t type;
 
@@ -543,19 +537,17 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		goto done;
 	}
 
-	list = dec_read_by_type_resp(ipdu, iplen);
-	if (list == NULL) {
+	if (!dec_read_by_type_resp(ipdu, iplen, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len == 7)
+	if (iter.len == 7)
 		type = BT_UUID16;
 	else
 		type = BT_UUID128;
 
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value = list->data[i];
+	while ((value = att_data_iter_next(&iter))) {
 		struct gatt_char *chars;
 		bt_uuid_t uuid128;
 
@@ -568,7 +560,6 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 
 		chars = g_try_new0(struct gatt_char, 1);
 		if (!chars) {
-			att_data_list_free(list);
 			err = ATT_ECODE_INSUFF_RESOURCES;
 			goto done;
 		}
@@ -581,8 +572,6 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 									chars);
 	}
 
-	att_data_list_free(list);
-
 	if (last != 0 && (last + 1 < dc->end)) {
 		bt_uuid_t uuid;
 		guint16 oplen;
@@ -661,6 +650,7 @@ struct read_long_data {
 	gpointer user_data;
 	guint8 *buffer;
 	guint16 size;
+	GDestroyNotify notify;
 	guint16 handle;
 	guint id;
 	int ref;
@@ -673,6 +663,9 @@ static void read_long_destroy(gpointer user_data)
 	if (__sync_sub_and_fetch(&long_read->ref, 1) > 0)
 		return;
 
+	if (long_read->notify)
+		long_read->notify(long_read->user_data);
+
 	if (long_read->buffer != NULL)
 		g_free(long_read->buffer);
 
@@ -762,13 +755,13 @@ done:
 	long_read->func(status, rpdu, rlen, long_read->user_data);
 }
 
-guint gatt_read_char(GAttrib *attrib, uint16_t handle, GAttribResultFunc func,
-							gpointer user_data)
+static guint read_char(GAttrib *attrib, guint id, uint16_t handle,
+				GAttribResultFunc func, gpointer user_data,
+				GDestroyNotify notify)
 {
 	uint8_t *buf;
 	size_t buflen;
 	guint16 plen;
-	guint id;
 	struct read_long_data *long_read;
 
 	long_read = g_try_new0(struct read_long_data, 1);
@@ -783,18 +776,146 @@ guint gatt_read_char(GAttrib *attrib, uint16_t handle, GAttribResultFunc func,
 
 	buf = g_attrib_get_buffer(attrib, &buflen);
 	plen = enc_read_req(handle, buf, buflen);
-	id = g_attrib_send(attrib, 0, buf, plen, read_char_helper,
+	id = g_attrib_send(attrib, id, buf, plen, read_char_helper,
 						long_read, read_long_destroy);
 	if (id == 0)
 		g_free(long_read);
 	else {
 		__sync_fetch_and_add(&long_read->ref, 1);
+		long_read->notify = notify;
 		long_read->id = id;
 	}
 
 	return id;
 }
 
+guint gatt_read_char(GAttrib *attrib, uint16_t handle, GAttribResultFunc func,
+							gpointer user_data)
+{
+	return read_char(attrib, 0, handle, func, user_data, NULL);
+}
+
+struct read_multi_data;
+
+struct read_multi_entry {
+	struct read_multi_data *multi;
+	uint16_t handle;
+	GAttribResultFunc func;
+	guint8 status;
+	guint8 *pdu;
+	guint16 plen;
+};
+
+struct read_multi_data {
+	struct read_multi_entry *entries;
+	unsigned int num;
+	unsigned int pending;
+	GDestroyNotify notify;
+	gpointer user_data;
+	int ref;
+};
+
+static void read_multi_unref(gpointer user_data)
+{
+	struct read_multi_entry *entry = user_data;
+	struct read_multi_data *multi = entry->multi;
+	unsigned int i;
+
+	if (__sync_sub_and_fetch(&multi->ref, 1) > 0)
+		return;
+
+	if (multi->notify)
+		multi->notify(multi->user_data);
+
+	for (i = 0; i < multi->num; i++)
+		g_free(multi->entries[i].pdu);
+
+	g_free(multi->entries);
+	g_free(multi);
+}
+
+static void read_multi_complete(struct read_multi_data *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->num; i++) {
+		struct read_multi_entry *entry = &multi->entries[i];
+
+		entry->func(entry->status, entry->pdu, entry->plen,
+							multi->user_data);
+	}
+}
+
+static void read_multi_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct read_multi_entry *entry = user_data;
+	struct read_multi_data *multi = entry->multi;
+
+	entry->status = status;
+
+	if (status == 0) {
+		entry->pdu = g_memdup(pdu, plen);
+		entry->plen = plen;
+	}
+
+	if (--multi->pending == 0)
+		read_multi_complete(multi);
+}
+
+guint gatt_read_chars_multi(GAttrib *attrib, const struct gatt_read_req *reqs,
+				unsigned int num, GDestroyNotify notify,
+				gpointer user_data)
+{
+	struct read_multi_data *multi;
+	unsigned int i;
+	guint id = 0;
+
+	if (num == 0)
+		return 0;
+
+	multi = g_new0(struct read_multi_data, 1);
+	multi->entries = g_new0(struct read_multi_entry, num);
+	multi->num = num;
+	multi->pending = num;
+	multi->user_data = user_data;
+
+	/*
+	 * All reads go out back to back under one id, so that the whole
+	 * batch can be cancelled at once. Results are only handed out
+	 * once the last one is in, in the order they were requested.
+	 */
+	for (i = 0; i < num; i++) {
+		struct read_multi_entry *entry = &multi->entries[i];
+		guint entry_id;
+
+		entry->multi = multi;
+		entry->handle = reqs[i].handle;
+		entry->func = reqs[i].func;
+
+		entry_id = read_char(attrib, id, entry->handle, read_multi_cb,
+						entry, read_multi_unref);
+		if (entry_id == 0) {
+			entry->status = ATT_ECODE_IO;
+			multi->pending--;
+			continue;
+		}
+
+		id = entry_id;
+		__sync_fetch_and_add(&multi->ref, 1);
+	}
+
+	if (id == 0) {
+		g_free(multi->entries);
+		g_free(multi);
+		return 0;
+	}
+
+	multi->notify = notify;
+
+	return id;
+}
+
 struct write_long_data {
 	GAttrib *attrib;
 	GAttribResultFunc func;
@@ -944,8 +1065,9 @@ static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
 					guint16 iplen, gpointer user_data)
 {
 	struct discover_desc *dd = user_data;
-	struct att_data_list *list;
-	unsigned int i, err = ATT_ECODE_ATTR_NOT_FOUND;
+	struct att_data_iter iter;
+	const uint8_t *value;
+	unsigned int err = ATT_ECODE_ATTR_NOT_FOUND;
 	guint8 format;
 	uint16_t last = 0xffff;
 	uint8_t type;
@@ -956,8 +1078,7 @@ static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
 		goto done;
 	}
 
-	list = dec_find_info_resp(ipdu, iplen, &format);
-	if (!list) {
+	if (!dec_find_info_resp(ipdu, iplen, &format, &iter)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
@@ -967,8 +1088,7 @@ static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
 	else
 		type = BT_UUID128;
 
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value = list->data[i];
+	while ((value = att_data_iter_next(&iter))) {
 		struct gatt_desc *desc;
 		bt_uuid_t uuid128;
 
@@ -985,7 +1105,6 @@ static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
 
 		desc = g_try_new0(struct gatt_desc, 1);
 		if (!desc) {
-			att_data_list_free(list);
 			err = ATT_ECODE_INSUFF_RESOURCES;
 			goto done;
 		}
@@ -1002,8 +1121,6 @@ static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
 			break;
 	}
 
-	att_data_list_free(list);
-
 	if (last < dd->end && !uuid_found) {
 		guint16 oplen;
 		size_t buflen;
@@ -86,6 +86,15 @@ guint gatt_discover_char(GAttrib *attrib, uint16_t start, uint16_t end,
 guint gatt_read_char(GAttrib *attrib, uint16_t handle, GAttribResultFunc func,
 							gpointer user_data);
 
+struct gatt_read_req {
+	uint16_t handle;
+	GAttribResultFunc func;
+};
+
+guint gatt_read_chars_multi(GAttrib *attrib, const struct gatt_read_req *reqs,
+				unsigned int num, GDestroyNotify notify,
+				gpointer user_data);
+
 guint gatt_write_char(GAttrib *attrib, uint16_t handle, const uint8_t *value,
 					size_t vlen, GAttribResultFunc func,
 					gpointer user_data);
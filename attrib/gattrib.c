@@ -38,115 +38,56 @@
 #include "btio/btio.h"
 #include "lib/uuid.h"
 #include "src/shared/util.h"
+#include "src/shared/att-types.h"
+#include "src/shared/att.h"
 #include "src/log.h"
 #include "attrib/att.h"
 #include "attrib/gattrib.h"
 
-#define GATT_TIMEOUT 30
-
 struct _GAttrib {
 	GIOChannel *io;
 	int refs;
+	struct bt_att *att;
 	uint8_t *buf;
 	size_t buflen;
-	guint read_watch;
-	guint write_watch;
-	guint timeout_watch;
-	GQueue *requests;
-	GQueue *responses;
+	uint8_t *rx_buf;
+	GSList *commands;
 	GSList *events;
+	GHashTable *routes;		/* Events by opcode and value handle */
+	unsigned int route_notify_id;
+	unsigned int route_ind_id;
+	unsigned int routing;
+	GSList *route_garbage;
 	guint next_cmd_id;
+	guint next_evt_id;
+	unsigned int timeout_id;
 	GDestroyNotify destroy;
 	gpointer destroy_user_data;
 	bool stale;
 };
 
 struct command {
+	GAttrib *attrib;
 	guint id;
-	guint8 opcode;
-	guint8 *pdu;
-	guint16 len;
-	guint8 expected;
-	bool sent;
+	unsigned int att_id;
+	bool done;
 	GAttribResultFunc func;
 	gpointer user_data;
 	GDestroyNotify notify;
 };
 
 struct event {
+	GAttrib *attrib;
 	guint id;
-	guint8 expected;
+	unsigned int att_id;
+	guint8 opcode;
 	guint16 handle;
+	bool routed;
 	GAttribNotifyFunc func;
 	gpointer user_data;
 	GDestroyNotify notify;
 };
 
-static guint8 opcode2expected(guint8 opcode)
-{
-	switch (opcode) {
-	case ATT_OP_MTU_REQ:
-		return ATT_OP_MTU_RESP;
-
-	case ATT_OP_FIND_INFO_REQ:
-		return ATT_OP_FIND_INFO_RESP;
-
-	case ATT_OP_FIND_BY_TYPE_REQ:
-		return ATT_OP_FIND_BY_TYPE_RESP;
-
-	case ATT_OP_READ_BY_TYPE_REQ:
-		return ATT_OP_READ_BY_TYPE_RESP;
-
-	case ATT_OP_READ_REQ:
-		return ATT_OP_READ_RESP;
-
-	case ATT_OP_READ_BLOB_REQ:
-		return ATT_OP_READ_BLOB_RESP;
-
-	case ATT_OP_READ_MULTI_REQ:
-		return ATT_OP_READ_MULTI_RESP;
-
-	case ATT_OP_READ_BY_GROUP_REQ:
-		return ATT_OP_READ_BY_GROUP_RESP;
-
-	case ATT_OP_WRITE_REQ:
-		return ATT_OP_WRITE_RESP;
-
-	case ATT_OP_PREP_WRITE_REQ:
-		return ATT_OP_PREP_WRITE_RESP;
-
-	case ATT_OP_EXEC_WRITE_REQ:
-		return ATT_OP_EXEC_WRITE_RESP;
-
-	case ATT_OP_HANDLE_IND:
-		return ATT_OP_HANDLE_CNF;
-	}
-
-	return 0;
-}
-
-static bool is_response(guint8 opcode)
-{
-	switch (opcode) {
-	case ATT_OP_ERROR:
-	case ATT_OP_MTU_RESP:
-	case ATT_OP_FIND_INFO_RESP:
-	case ATT_OP_FIND_BY_TYPE_RESP:
-	case ATT_OP_READ_BY_TYPE_RESP:
-	case ATT_OP_READ_RESP:
-	case ATT_OP_READ_BLOB_RESP:
-	case ATT_OP_READ_MULTI_RESP:
-	case ATT_OP_READ_BY_GROUP_RESP:
-	case ATT_OP_WRITE_RESP:
-	case ATT_OP_PREP_WRITE_RESP:
-	case ATT_OP_EXEC_WRITE_RESP:
-	case ATT_OP_HANDLE_CNF:
-		return true;
-	}
-
-	return false;
-}
-
 GAttrib *g_attrib_ref(GAttrib *attrib)
 {
 	int refs;
@@ -161,59 +102,31 @@ GAttrib *g_attrib_ref(GAttrib *attrib)
 	return attrib;
 }
 
-static void command_destroy(struct command *cmd)
-{
-	if (cmd->notify)
-		cmd->notify(cmd->user_data);
-
-	g_free(cmd->pdu);
-	g_free(cmd);
-}
-
-static void event_destroy(struct event *evt)
-{
-	if (evt->notify)
-		evt->notify(evt->user_data);
-
-	g_free(evt);
-}
-
 static void attrib_destroy(GAttrib *attrib)
 {
-	GSList *l;
-	struct command *c;
-
-	while ((c = g_queue_pop_head(attrib->requests)))
-		command_destroy(c);
-
-	while ((c = g_queue_pop_head(attrib->responses)))
-		command_destroy(c);
-
-	g_queue_free(attrib->requests);
-	attrib->requests = NULL;
-
-	g_queue_free(attrib->responses);
-	attrib->responses = NULL;
-
-	for (l = attrib->events; l; l = l->next)
-		event_destroy(l->data);
-
-	g_slist_free(attrib->events);
-	attrib->events = NULL;
+	/*
+	 * Others may still hold a reference to the bt_att, so release
+	 * everything that points back to us. Requests still in flight are
+	 * dropped without a result.
+	 */
+	bt_att_set_timeout_cb(attrib->att, NULL, NULL, NULL);
+	g_attrib_cancel_all(attrib);
+	g_attrib_unregister_all(attrib);
 
-	if (attrib->timeout_watch > 0)
-		g_source_remove(attrib->timeout_watch);
+	if (attrib->route_notify_id)
+		bt_att_unregister(attrib->att, attrib->route_notify_id);
 
-	if (attrib->write_watch > 0)
-		g_source_remove(attrib->write_watch);
+	if (attrib->route_ind_id)
+		bt_att_unregister(attrib->att, attrib->route_ind_id);
 
-	if (attrib->read_watch > 0)
-		g_source_remove(attrib->read_watch);
+	g_hash_table_destroy(attrib->routes);
+	bt_att_unref(attrib->att);
 
 	if (attrib->io)
 		g_io_channel_unref(attrib->io);
 
 	g_free(attrib->buf);
+	g_free(attrib->rx_buf);
 
 	if (attrib->destroy)
 		attrib->destroy(attrib->destroy_user_data);
@@ -246,6 +159,14 @@ GIOChannel *g_attrib_get_channel(GAttrib *attrib)
 	return attrib->io;
 }
 
+struct bt_att *g_attrib_get_att(GAttrib *attrib)
+{
+	if (!attrib)
+		return NULL;
+
+	return attrib->att;
+}
+
 gboolean g_attrib_set_destroy_function(GAttrib *attrib,
 		GDestroyNotify destroy, gpointer user_data)
 {
@@ -258,219 +179,246 @@ gboolean g_attrib_set_destroy_function(GAttrib *attrib,
 	return TRUE;
 }
 
-static gboolean disconnect_timeout(gpointer data)
+/*
+ * bt_att hands out PDUs without their opcode while GAttrib users expect
+ * the complete PDU, so rebuild it in a buffer owned by the GAttrib.
+ */
+static const guint8 *full_pdu(GAttrib *attrib, uint8_t opcode,
+					const void *pdu, uint16_t len)
 {
-	struct _GAttrib *attrib = data;
-	struct command *c;
+	attrib->rx_buf[0] = opcode;
 
-	g_attrib_ref(attrib);
+	if (len)
+		memcpy(attrib->rx_buf + 1, pdu, len);
 
-	c = g_queue_pop_head(attrib->requests);
-	if (c == NULL)
-		goto done;
+	return attrib->rx_buf;
+}
 
-	if (c->func)
-		c->func(ATT_ECODE_TIMEOUT, NULL, 0, c->user_data);
+static void command_result(uint8_t opcode, const void *pdu, uint16_t len,
+							void *user_data)
+{
+	struct command *cmd = user_data;
+	const guint8 *buf;
+	guint8 status = 0;
 
-	command_destroy(c);
+	cmd->done = true;
 
-	while ((c = g_queue_pop_head(attrib->requests))) {
-		if (c->func)
-			c->func(ATT_ECODE_ABORTED, NULL, 0, c->user_data);
-		command_destroy(c);
-	}
+	if (!cmd->func)
+		return;
 
-done:
-	attrib->stale = true;
+	if (opcode == BT_ATT_OP_ERROR_RSP) {
+		/* A NULL PDU means the response did not match the request */
+		if (!pdu || len < 4) {
+			cmd->func(ATT_ECODE_IO, NULL, 0, cmd->user_data);
+			return;
+		}
 
-	g_attrib_unref(attrib);
+		status = ((const uint8_t *) pdu)[3];
+	}
+
+	buf = full_pdu(cmd->attrib, opcode, pdu, len);
 
-	return FALSE;
+	cmd->func(status, buf, len + 1, cmd->user_data);
 }
 
-static gboolean can_write_data(GIOChannel *io, GIOCondition cond,
-								gpointer data)
+static void abort_commands(GAttrib *attrib)
 {
-	struct _GAttrib *attrib = data;
-	struct command *cmd;
-	GError *gerr = NULL;
-	gsize len;
-	GIOStatus iostat;
-	GQueue *queue;
+	GSList *l, *next;
 
-	if (attrib->stale)
-		return FALSE;
+	for (l = attrib->commands; l; l = next) {
+		struct command *cmd = l->data;
 
-	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
-		return FALSE;
+		/* Cancelling frees the node we are standing on */
+		next = l->next;
 
-	queue = attrib->responses;
-	cmd = g_queue_peek_head(queue);
-	if (cmd == NULL) {
-		queue = attrib->requests;
-		cmd = g_queue_peek_head(queue);
+		bt_att_cancel(attrib->att, cmd->att_id);
 	}
-	if (cmd == NULL)
-		return FALSE;
+}
+
+static void command_destroy(void *user_data)
+{
+	struct command *cmd = user_data;
+	GAttrib *attrib = cmd->attrib;
+	bool timed_out = attrib->timeout_id &&
+					attrib->timeout_id == cmd->att_id;
+
+	attrib->commands = g_slist_remove(attrib->commands, cmd);
 
 	/*
-	 * Verify that we didn't already send this command. This can only
-	 * happen with elementes from attrib->requests.
+	 * Requests that never got an answer report why: the one that hit
+	 * the ATT timeout, the ones aborted behind it, or a lost link.
 	 */
-	if (cmd->sent)
-		return FALSE;
+	if (!cmd->done && cmd->func) {
+		guint8 status;
 
-	iostat = g_io_channel_write_chars(io, (char *) cmd->pdu, cmd->len,
-								&len, &gerr);
-	if (iostat != G_IO_STATUS_NORMAL) {
-		if (gerr) {
-			error("%s", gerr->message);
-			g_error_free(gerr);
-		}
+		if (timed_out)
+			status = ATT_ECODE_TIMEOUT;
+		else if (attrib->stale)
+			status = ATT_ECODE_ABORTED;
+		else
+			status = ATT_ECODE_IO;
 
-		return FALSE;
+		cmd->func(status, NULL, 0, cmd->user_data);
 	}
 
-	if (cmd->expected == 0) {
-		g_queue_pop_head(queue);
-		command_destroy(cmd);
-
-		return TRUE;
-	}
+	if (cmd->notify)
+		cmd->notify(cmd->user_data);
 
-	cmd->sent = true;
+	g_free(cmd);
 
-	if (attrib->timeout_watch == 0)
-		attrib->timeout_watch = g_timeout_add_seconds(GATT_TIMEOUT,
-						disconnect_timeout, attrib);
+	if (timed_out) {
+		attrib->timeout_id = 0;
 
-	return FALSE;
+		g_attrib_ref(attrib);
+		abort_commands(attrib);
+		g_attrib_unref(attrib);
+	}
 }
 
-static void destroy_sender(gpointer data)
+static void attrib_timeout(unsigned int id, uint8_t opcode, void *user_data)
 {
-	struct _GAttrib *attrib = data;
+	GAttrib *attrib = user_data;
 
-	attrib->write_watch = 0;
-	g_attrib_unref(attrib);
+	attrib->timeout_id = id;
+	attrib->stale = true;
 }
 
-static void wake_up_sender(struct _GAttrib *attrib)
+static void event_notify(uint8_t opcode, const void *pdu, uint16_t len,
+							void *user_data)
 {
-	if (attrib->write_watch > 0)
+	struct event *evt = user_data;
+	const guint8 *buf;
+
+	if (evt->handle != GATTRIB_ALL_HANDLES &&
+				(len < 2 || get_le16(pdu) != evt->handle))
 		return;
 
-	attrib = g_attrib_ref(attrib);
-	attrib->write_watch = g_io_add_watch_full(attrib->io,
-				G_PRIORITY_DEFAULT, G_IO_OUT,
-				can_write_data, attrib, destroy_sender);
+	buf = full_pdu(evt->attrib, opcode, pdu, len);
+
+	evt->func(buf, len + 1, evt->user_data);
 }
 
-static bool match_event(struct event *evt, const uint8_t *pdu, gsize len)
-{
-	guint16 handle;
+/*
+ * Notifications and indications for a given value handle are routed
+ * through a single bt_att handler per opcode and a table indexed by
+ * handle, so dispatching does not depend on how many profiles watch
+ * other handles of the same device.
+ */
+#define ROUTE_KEY(opcode, handle) \
+		GUINT_TO_POINTER(((opcode) << 16) | (handle))
 
-	if (evt->expected == GATTRIB_ALL_EVENTS)
-		return true;
+static void route_event(uint8_t opcode, const void *pdu, uint16_t len,
+							void *user_data)
+{
+	GAttrib *attrib = user_data;
+	GSList *events, *l;
+	const guint8 *buf;
 
-	if (!is_response(pdu[0]) && evt->expected == GATTRIB_ALL_REQS)
-		return true;
+	if (len < 2)
+		return;
 
-	if (evt->expected == pdu[0] && evt->handle == GATTRIB_ALL_HANDLES)
-		return true;
+	events = g_hash_table_lookup(attrib->routes,
+					ROUTE_KEY(opcode, get_le16(pdu)));
+	if (!events)
+		return;
 
-	if (len < 3)
-		return false;
+	/* Handlers may register or unregister events while we dispatch */
+	events = g_slist_copy(events);
 
-	handle = get_le16(&pdu[1]);
+	g_attrib_ref(attrib);
+	attrib->routing++;
 
-	if (evt->expected == pdu[0] && evt->handle == handle)
-		return true;
+	buf = full_pdu(attrib, opcode, pdu, len);
 
-	return false;
-}
+	for (l = events; l; l = l->next) {
+		struct event *evt = l->data;
 
-static gboolean received_data(GIOChannel *io, GIOCondition cond, gpointer data)
-{
-	struct _GAttrib *attrib = data;
-	struct command *cmd = NULL;
-	GSList *l;
-	uint8_t buf[512], status;
-	gsize len;
-	GIOStatus iostat;
+		/* Unregistered by one of the previous handlers */
+		if (!evt->func)
+			continue;
 
-	if (attrib->stale)
-		return FALSE;
+		evt->func(buf, len + 1, evt->user_data);
+	}
 
-	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
-		struct command *c;
+	g_slist_free(events);
 
-		while ((c = g_queue_pop_head(attrib->requests))) {
-			if (c->func)
-				c->func(ATT_ECODE_IO, NULL, 0, c->user_data);
-			command_destroy(c);
-		}
+	if (--attrib->routing == 0) {
+		g_slist_free_full(attrib->route_garbage, g_free);
+		attrib->route_garbage = NULL;
+	}
 
-		attrib->read_watch = 0;
+	g_attrib_unref(attrib);
+}
 
-		return FALSE;
-	}
+static bool route_add(GAttrib *attrib, struct event *evt)
+{
+	unsigned int *route_id;
+	gpointer key;
+	GSList *events;
 
-	memset(buf, 0, sizeof(buf));
+	if (evt->opcode == ATT_OP_HANDLE_NOTIFY)
+		route_id = &attrib->route_notify_id;
+	else
+		route_id = &attrib->route_ind_id;
 
-	iostat = g_io_channel_read_chars(io, (char *) buf, sizeof(buf),
-								&len, NULL);
-	if (iostat != G_IO_STATUS_NORMAL) {
-		status = ATT_ECODE_IO;
-		goto done;
+	if (!*route_id) {
+		*route_id = bt_att_register(attrib->att, evt->opcode,
+						route_event, attrib, NULL);
+		if (!*route_id)
+			return false;
 	}
 
-	for (l = attrib->events; l; l = l->next) {
-		struct event *evt = l->data;
+	key = ROUTE_KEY(evt->opcode, evt->handle);
+	events = g_hash_table_lookup(attrib->routes, key);
+	events = g_slist_append(events, evt);
+	g_hash_table_replace(attrib->routes, key, events);
 
-		if (match_event(evt, buf, len))
-			evt->func(buf, len, evt->user_data);
-	}
+	return true;
+}
 
-	if (!is_response(buf[0]))
-		return TRUE;
+static void route_remove(GAttrib *attrib, struct event *evt)
+{
+	gpointer key;
+	GSList *events;
 
-	if (attrib->timeout_watch > 0) {
-		g_source_remove(attrib->timeout_watch);
-		attrib->timeout_watch = 0;
-	}
+	key = ROUTE_KEY(evt->opcode, evt->handle);
+	events = g_hash_table_lookup(attrib->routes, key);
+	events = g_slist_remove(events, evt);
 
-	cmd = g_queue_pop_head(attrib->requests);
-	if (cmd == NULL) {
-		/* Keep the watch if we have events to report */
-		return attrib->events != NULL;
-	}
+	if (events)
+		g_hash_table_replace(attrib->routes, key, events);
+	else
+		g_hash_table_remove(attrib->routes, key);
 
-	if (buf[0] == ATT_OP_ERROR) {
-		status = buf[4];
-		goto done;
-	}
+	evt->func = NULL;
 
-	if (cmd->expected != buf[0]) {
-		status = ATT_ECODE_IO;
-		goto done;
-	}
+	if (evt->notify)
+		evt->notify(evt->user_data);
 
-	status = 0;
+	/* route_event() may still be walking a copy of the list */
+	if (attrib->routing)
+		attrib->route_garbage = g_slist_prepend(attrib->route_garbage,
+									evt);
+	else
+		g_free(evt);
+}
 
-done:
-	if (!g_queue_is_empty(attrib->requests) ||
-					!g_queue_is_empty(attrib->responses))
-		wake_up_sender(attrib);
+static void route_list_free(gpointer data)
+{
+	g_slist_free(data);
+}
 
-	if (cmd) {
-		if (cmd->func)
-			cmd->func(status, buf, len, cmd->user_data);
+static void event_destroy(void *user_data)
+{
+	struct event *evt = user_data;
+	GAttrib *attrib = evt->attrib;
 
-		command_destroy(cmd);
-	}
+	attrib->events = g_slist_remove(attrib->events, evt);
 
-	return TRUE;
+	if (evt->notify)
+		evt->notify(evt->user_data);
+
+	g_free(evt);
 }
 
 GAttrib *g_attrib_new(GIOChannel *io)
@@ -498,163 +446,141 @@ GAttrib *g_attrib_new(GIOChannel *io)
 
 	att_mtu = (cid == ATT_CID) ? ATT_DEFAULT_LE_MTU : imtu;
 
+	attrib->att = bt_att_new(g_io_channel_unix_get_fd(io));
+	if (!attrib->att)
+		goto fail;
+
+	if (!bt_att_set_mtu(attrib->att, att_mtu))
+		goto fail;
+
+	bt_att_set_timeout_cb(attrib->att, attrib_timeout, attrib, NULL);
+
 	attrib->buf = g_malloc0(att_mtu);
 	attrib->buflen = att_mtu;
+	attrib->rx_buf = g_malloc0(att_mtu);
 
-	attrib->io = g_io_channel_ref(io);
-	attrib->requests = g_queue_new();
-	attrib->responses = g_queue_new();
+	attrib->routes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, route_list_free);
 
-	attrib->read_watch = g_io_add_watch(attrib->io,
-			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-			received_data, attrib);
+	attrib->io = g_io_channel_ref(io);
 
 	return g_attrib_ref(attrib);
+
+fail:
+	bt_att_unref(attrib->att);
+	g_free(attrib);
+
+	return NULL;
+}
+
+static bool expects_response(uint8_t opcode)
+{
+	switch (bt_att_opcode_info[opcode].type) {
+	case BT_ATT_OP_TYPE_REQ:
+	case BT_ATT_OP_TYPE_IND:
+		return true;
+	}
+
+	return false;
 }
 
 guint g_attrib_send(GAttrib *attrib, guint id, const guint8 *pdu, guint16 len,
 			GAttribResultFunc func, gpointer user_data,
 			GDestroyNotify notify)
 {
-	struct command *c;
-	GQueue *queue;
+	struct command *cmd;
+	bt_att_response_func_t result = NULL;
 	uint8_t opcode;
 
-	if (attrib->stale)
+	if (attrib->stale || !pdu || !len)
 		return 0;
 
-	c = g_try_new0(struct command, 1);
-	if (c == NULL)
+	cmd = g_try_new0(struct command, 1);
+	if (cmd == NULL)
 		return 0;
 
 	opcode = pdu[0];
 
-	c->opcode = opcode;
-	c->expected = opcode2expected(opcode);
-	c->pdu = g_malloc(len);
-	memcpy(c->pdu, pdu, len);
-	c->len = len;
-	c->func = func;
-	c->user_data = user_data;
-	c->notify = notify;
-
-	if (is_response(opcode))
-		queue = attrib->responses;
-	else
-		queue = attrib->requests;
+	cmd->attrib = attrib;
+	cmd->id = id ? id : ++attrib->next_cmd_id;
+	cmd->user_data = user_data;
+	cmd->notify = notify;
 
-	if (id) {
-		c->id = id;
-		if (!is_response(opcode))
-			g_queue_push_head(queue, c);
-		else
-			/* Don't re-order responses even if an ID is given */
-			g_queue_push_tail(queue, c);
-	} else {
-		c->id = ++attrib->next_cmd_id;
-		g_queue_push_tail(queue, c);
+	/* Results only exist for PDUs the peer has to answer */
+	if (expects_response(opcode)) {
+		cmd->func = func;
+		result = command_result;
 	}
 
-	/*
-	 * If a command was added to the queue and it was empty before, wake up
-	 * the sender. If the sender was already woken up by the second queue,
-	 * wake_up_sender will just return.
-	 */
-	if (g_queue_get_length(queue) == 1)
-		wake_up_sender(attrib);
+	cmd->att_id = bt_att_send(attrib->att, opcode, pdu + 1, len - 1,
+					result, cmd, command_destroy);
+	if (!cmd->att_id) {
+		g_free(cmd);
+		return 0;
+	}
 
-	return c->id;
-}
+	attrib->commands = g_slist_prepend(attrib->commands, cmd);
 
-static int command_cmp_by_id(gconstpointer a, gconstpointer b)
-{
-	const struct command *cmd = a;
-	guint id = GPOINTER_TO_UINT(b);
+	/*
+	 * A caller reusing an id continues an earlier operation (e.g. the
+	 * next part of a long read), so let it overtake fresh requests.
+	 */
+	if (id && result)
+		bt_att_set_priority(attrib->att, cmd->att_id,
+						BT_ATT_PRIORITY_HIGH);
 
-	return cmd->id - id;
+	return cmd->id;
 }
 
 gboolean g_attrib_cancel(GAttrib *attrib, guint id)
 {
-	GList *l = NULL;
-	struct command *cmd;
-	GQueue *queue;
+	GSList *l, *next;
+	gboolean found = FALSE;
 
 	if (attrib == NULL)
 		return FALSE;
 
-	queue = attrib->requests;
-	if (queue)
-		l = g_queue_find_custom(queue, GUINT_TO_POINTER(id),
-					command_cmp_by_id);
-	if (l == NULL) {
-		queue = attrib->responses;
-		if (!queue)
-			return FALSE;
-		l = g_queue_find_custom(queue, GUINT_TO_POINTER(id),
-					command_cmp_by_id);
-	}
+	/* Every command sharing the id belongs to the same operation */
+	for (l = attrib->commands; l; l = next) {
+		struct command *cmd = l->data;
 
-	if (l == NULL)
-		return FALSE;
+		next = l->next;
 
-	cmd = l->data;
+		if (cmd->id != id)
+			continue;
 
-	if (cmd == g_queue_peek_head(queue) && cmd->sent)
 		cmd->func = NULL;
-	else {
-		g_queue_remove(queue, cmd);
-		command_destroy(cmd);
+		found = bt_att_cancel(attrib->att, cmd->att_id) || found;
 	}
 
-	return TRUE;
+	return found;
 }
 
-static gboolean cancel_all_per_queue(GQueue *queue)
+gboolean g_attrib_cancel_all(GAttrib *attrib)
 {
-	struct command *c, *head = NULL;
-	gboolean first = TRUE;
+	GSList *l;
 
-	if (queue == NULL)
+	if (attrib == NULL)
 		return FALSE;
 
-	while ((c = g_queue_pop_head(queue))) {
-		if (first && c->sent) {
-			/* If the command was sent ignore its callback ... */
-			c->func = NULL;
-			head = c;
-			continue;
-		}
+	for (l = attrib->commands; l; l = l->next) {
+		struct command *cmd = l->data;
 
-		first = FALSE;
-		command_destroy(c);
+		cmd->func = NULL;
 	}
 
-	if (head) {
-		/* ... and put it back in the queue */
-		g_queue_push_head(queue, head);
-	}
+	abort_commands(attrib);
 
 	return TRUE;
 }
 
-gboolean g_attrib_cancel_all(GAttrib *attrib)
+gboolean g_attrib_set_debug(GAttrib *attrib,
+		GAttribDebugFunc func, gpointer user_data)
 {
-	gboolean ret;
-
 	if (attrib == NULL)
 		return FALSE;
 
-	ret = cancel_all_per_queue(attrib->requests);
-	ret = cancel_all_per_queue(attrib->responses) && ret;
-
-	return ret;
-}
-
-gboolean g_attrib_set_debug(GAttrib *attrib,
-		GAttribDebugFunc func, gpointer user_data)
-{
-	return TRUE;
+	return bt_att_set_debug(attrib->att, func, user_data, NULL);
 }
 
 uint8_t *g_attrib_get_buffer(GAttrib *attrib, size_t *len)
@@ -669,10 +595,14 @@ uint8_t *g_attrib_get_buffer(GAttrib *attrib, size_t *len)
 
 gboolean g_attrib_set_mtu(GAttrib *attrib, int mtu)
 {
-	if (mtu < ATT_DEFAULT_LE_MTU)
+	if (mtu < ATT_DEFAULT_LE_MTU || mtu > UINT16_MAX)
+		return FALSE;
+
+	if (!bt_att_set_mtu(attrib->att, mtu))
 		return FALSE;
 
 	attrib->buf = g_realloc(attrib->buf, mtu);
+	attrib->rx_buf = g_realloc(attrib->rx_buf, mtu);
 
 	attrib->buflen = mtu;
 
@@ -683,31 +613,50 @@ guint g_attrib_register(GAttrib *attrib, guint8 opcode, guint16 handle,
 				GAttribNotifyFunc func, gpointer user_data,
 				GDestroyNotify notify)
 {
-	static guint next_evt_id = 0;
 	struct event *event;
 
 	event = g_try_new0(struct event, 1);
 	if (event == NULL)
 		return 0;
 
-	event->expected = opcode;
+	/* bt_att never reports responses as events, and its wildcard only
+	 * covers requests and commands, not notifications or indications.
+	 */
+	if (opcode == GATTRIB_ALL_EVENTS || opcode == GATTRIB_ALL_REQS)
+		opcode = BT_ATT_ALL_REQUESTS;
+
+	event->attrib = attrib;
+	event->opcode = opcode;
 	event->handle = handle;
 	event->func = func;
 	event->user_data = user_data;
-	event->notify = notify;
-	event->id = ++next_evt_id;
 
-	attrib->events = g_slist_append(attrib->events, event);
+	event->routed = handle != GATTRIB_ALL_HANDLES &&
+					(opcode == ATT_OP_HANDLE_NOTIFY ||
+					opcode == ATT_OP_HANDLE_IND);
 
-	return event->id;
-}
+	if (event->routed) {
+		if (!route_add(attrib, event)) {
+			g_free(event);
+			return 0;
+		}
+	} else {
+		event->att_id = bt_att_register(attrib->att, opcode,
+						event_notify, event,
+						event_destroy);
+		if (!event->att_id) {
+			g_free(event);
+			return 0;
+		}
+	}
 
-static int event_cmp_by_id(gconstpointer a, gconstpointer b)
-{
-	const struct event *evt = a;
-	guint id = GPOINTER_TO_UINT(b);
+	/* Only owned by bt_att once registered */
+	event->notify = notify;
+	event->id = ++attrib->next_evt_id;
 
-	return evt->id - id;
+	attrib->events = g_slist_prepend(attrib->events, event);
+
+	return event->id;
 }
 
 gboolean g_attrib_is_encrypted(GAttrib *attrib)
@@ -722,6 +671,14 @@ gboolean g_attrib_is_encrypted(GAttrib *attrib)
 	return sec_level > BT_IO_SEC_LOW;
 }
 
+static int event_cmp_by_id(gconstpointer a, gconstpointer b)
+{
+	const struct event *evt = a;
+	guint id = GPOINTER_TO_UINT(b);
+
+	return evt->id - id;
+}
+
 gboolean g_attrib_unregister(GAttrib *attrib, guint id)
 {
 	struct event *evt;
@@ -739,34 +696,31 @@ gboolean g_attrib_unregister(GAttrib *attrib, guint id)
 
 	evt = l->data;
 
-	attrib->events = g_slist_remove(attrib->events, evt);
-
-	if (evt->notify)
-		evt->notify(evt->user_data);
+	/*
+	 * Unlink right away, from within a handler bt_att only releases
+	 * the event once dispatching is over.
+	 */
+	attrib->events = g_slist_delete_link(attrib->events, l);
 
-	g_free(evt);
+	if (evt->routed) {
+		route_remove(attrib, evt);
+		return TRUE;
+	}
 
-	return TRUE;
+	return bt_att_unregister(attrib->att, evt->att_id);
 }
 
 gboolean g_attrib_unregister_all(GAttrib *attrib)
 {
-	GSList *l;
+	struct event *evt;
 
 	if (attrib->events == NULL)
 		return FALSE;
 
-	for (l = attrib->events; l; l = l->next) {
-		struct event *evt = l->data;
-
-		if (evt->notify)
-			evt->notify(evt->user_data);
-
-		g_free(evt);
+	while (attrib->events) {
+		evt = attrib->events->data;
+		g_attrib_unregister(attrib, evt->id);
 	}
 
-	g_slist_free(attrib->events);
-	attrib->events = NULL;
-
 	return TRUE;
 }
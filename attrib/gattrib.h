@@ -35,6 +35,8 @@ extern "C" {
 struct _GAttrib;
 typedef struct _GAttrib GAttrib;
 
+struct bt_att;
+
 typedef void (*GAttribResultFunc) (guint8 status, const guint8 *pdu,
 					guint16 len, gpointer user_data);
 typedef void (*GAttribDisconnectFunc)(gpointer user_data);
@@ -47,6 +49,7 @@ GAttrib *g_attrib_ref(GAttrib *attrib);
 void g_attrib_unref(GAttrib *attrib);
 
 GIOChannel *g_attrib_get_channel(GAttrib *attrib);
+struct bt_att *g_attrib_get_att(GAttrib *attrib);
 
 gboolean g_attrib_set_destroy_function(GAttrib *attrib,
 		GDestroyNotify destroy, gpointer user_data);
@@ -28,7 +28,10 @@
 
 #include <errno.h>
 #include <glib.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -36,6 +39,7 @@
 #include <bluetooth/hci_lib.h>
 
 #include "src/shared/util.h"
+#include "src/shared/att.h"
 #include "lib/uuid.h"
 #include "att.h"
 #include "btio/btio.h"
@@ -62,23 +66,115 @@ static gboolean opt_char_desc = FALSE;
 static gboolean opt_char_write = FALSE;
 static gboolean opt_char_write_req = FALSE;
 static gboolean opt_interactive = FALSE;
+static char *opt_write_stream = NULL;
+static char *opt_listen_binary = NULL;
 static GMainLoop *event_loop;
 static gboolean got_error = FALSE;
 static GSourceFunc operation;
 
+/* Write Commands queued in bt_att before the stream waits for room */
+#define STREAM_HIGH_WATERMARK	32
+#define STREAM_LOW_WATERMARK	8
+
 struct characteristic_data {
 	GAttrib *attrib;
 	uint16_t start;
 	uint16_t end;
 };
 
-static void events_handler(const uint8_t *pdu, uint16_t len, gpointer user_data)
+struct stream_data {
+	GAttrib *attrib;
+	gchar *contents;
+	gsize len;
+	gsize offset;
+	unsigned int pdus;
+	gint64 start;
+};
+
+struct listen_data {
+	GAttrib *attrib;
+	FILE *file;
+	uint64_t bytes;
+	unsigned int count;
+	unsigned int last_count;
+	gint64 start;
+};
+
+static void print_throughput(const char *what, uint64_t bytes,
+					unsigned int pdus, gint64 start)
+{
+	double secs = (g_get_monotonic_time() - start) / 1000000.0;
+
+	if (secs <= 0)
+		secs = 1e-6;
+
+	g_print("%s %" PRIu64 " bytes in %u PDUs, %.2f s, %.1f kB/s\n",
+				what, bytes, pdus, secs, bytes / secs / 1000);
+}
+
+static void send_confirmation(GAttrib *attrib)
 {
-	GAttrib *attrib = user_data;
 	uint8_t *opdu;
-	uint16_t handle, i, olen = 0;
+	uint16_t olen;
 	size_t plen;
 
+	opdu = g_attrib_get_buffer(attrib, &plen);
+	olen = enc_confirmation(opdu, plen);
+
+	if (olen > 0)
+		g_attrib_send(attrib, 0, opdu, olen, NULL, NULL, NULL);
+}
+
+static void binary_events_handler(const uint8_t *pdu, uint16_t len,
+							gpointer user_data)
+{
+	struct listen_data *listen = user_data;
+	uint8_t hdr[4];
+
+	if (len < 3)
+		return;
+
+	/* Records are the handle and value length, both le16, then value */
+	memcpy(hdr, &pdu[1], 2);
+	put_le16(len - 3, &hdr[2]);
+
+	if (fwrite(hdr, sizeof(hdr), 1, listen->file) != 1 ||
+			fwrite(&pdu[3], 1, len - 3, listen->file) != len - 3U) {
+		g_printerr("Failed to write %s: %s\n", opt_listen_binary,
+							strerror(errno));
+		got_error = TRUE;
+		g_main_loop_quit(event_loop);
+		return;
+	}
+
+	listen->bytes += len - 3;
+	listen->count++;
+
+	if (pdu[0] == ATT_OP_HANDLE_IND)
+		send_confirmation(listen->attrib);
+}
+
+static gboolean listen_binary_report(gpointer user_data)
+{
+	struct listen_data *listen = user_data;
+
+	if (listen->count == listen->last_count)
+		return TRUE;
+
+	listen->last_count = listen->count;
+
+	fflush(listen->file);
+	print_throughput("Received", listen->bytes, listen->count,
+								listen->start);
+
+	return TRUE;
+}
+
+static void events_handler(const uint8_t *pdu, uint16_t len, gpointer user_data)
+{
+	GAttrib *attrib = user_data;
+	uint16_t handle, i;
+
 	handle = get_le16(&pdu[1]);
 
 	switch (pdu[0]) {
@@ -98,20 +194,46 @@ static void events_handler(const uint8_t *pdu, uint16_t len, gpointer user_data)
 
 	g_print("\n");
 
-	if (pdu[0] == ATT_OP_HANDLE_NOTIFY)
-		return;
+	if (pdu[0] == ATT_OP_HANDLE_IND)
+		send_confirmation(attrib);
+}
 
-	opdu = g_attrib_get_buffer(attrib, &plen);
-	olen = enc_confirmation(opdu, plen);
+static gboolean listen_binary_start(GAttrib *attrib)
+{
+	struct listen_data *listen;
+	FILE *file;
 
-	if (olen > 0)
-		g_attrib_send(attrib, 0, opdu, olen, NULL, NULL, NULL);
+	file = fopen(opt_listen_binary, "wb");
+	if (file == NULL) {
+		g_printerr("Unable to open %s: %s\n", opt_listen_binary,
+							strerror(errno));
+		got_error = TRUE;
+		g_main_loop_quit(event_loop);
+		return FALSE;
+	}
+
+	listen = g_new0(struct listen_data, 1);
+	listen->attrib = attrib;
+	listen->file = file;
+	listen->start = g_get_monotonic_time();
+
+	g_attrib_register(attrib, ATT_OP_HANDLE_NOTIFY, GATTRIB_ALL_HANDLES,
+					binary_events_handler, listen, NULL);
+	g_attrib_register(attrib, ATT_OP_HANDLE_IND, GATTRIB_ALL_HANDLES,
+					binary_events_handler, listen, NULL);
+
+	g_timeout_add_seconds(1, listen_binary_report, listen);
+
+	return FALSE;
 }
 
 static gboolean listen_start(gpointer user_data)
 {
 	GAttrib *attrib = user_data;
 
+	if (opt_listen_binary)
+		return listen_binary_start(attrib);
+
 	g_attrib_register(attrib, ATT_OP_HANDLE_NOTIFY, GATTRIB_ALL_HANDLES,
 						events_handler, attrib, NULL);
 	g_attrib_register(attrib, ATT_OP_HANDLE_IND, GATTRIB_ALL_HANDLES,
@@ -120,6 +242,11 @@ static gboolean listen_start(gpointer user_data)
 	return FALSE;
 }
 
+static gboolean listen_only(gpointer user_data)
+{
+	return FALSE;
+}
+
 static void connect_cb(GIOChannel *io, GError *err, gpointer user_data)
 {
 	GAttrib *attrib;
@@ -255,8 +382,8 @@ done:
 static void char_read_by_uuid_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data)
 {
-	struct att_data_list *list;
-	int i;
+	struct att_data_iter iter;
+	const uint8_t *value;
 
 	if (status != 0) {
 		g_printerr("Read characteristics by UUID failed: %s\n",
@@ -264,23 +391,19 @@ static void char_read_by_uuid_cb(guint8 status, const guint8 *pdu,
 		goto done;
 	}
 
-	list = dec_read_by_type_resp(pdu, plen);
-	if (list == NULL)
+	if (!dec_read_by_type_resp(pdu, plen, &iter))
 		goto done;
 
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value = list->data[i];
+	while ((value = att_data_iter_next(&iter))) {
 		int j;
 
 		g_print("handle: 0x%04x \t value: ", get_le16(value));
 		value += 2;
-		for (j = 0; j < list->len - 2; j++, value++)
+		for (j = 0; j < iter.len - 2; j++, value++)
 			g_print("%02x ", *value);
 		g_print("\n");
 	}
 
-	att_data_list_free(list);
-
 done:
 	g_main_loop_quit(event_loop);
 }
@@ -348,6 +471,102 @@ error:
 	return FALSE;
 }
 
+static void stream_done(void *user_data)
+{
+	struct stream_data *stream = user_data;
+
+	print_throughput("Sent", stream->len, stream->pdus, stream->start);
+
+	if (!opt_listen)
+		g_main_loop_quit(event_loop);
+}
+
+static void stream_writable(void *user_data)
+{
+	struct stream_data *stream = user_data;
+	struct bt_att *att = g_attrib_get_att(stream->attrib);
+	uint16_t mtu = bt_att_get_mtu(att);
+	uint8_t pdu[mtu];
+
+	while (stream->offset < stream->len) {
+		gsize chunk = MIN(stream->len - stream->offset, mtu - 3U);
+		bool last = stream->offset + chunk == stream->len;
+
+		put_le16(opt_handle, pdu);
+		memcpy(&pdu[2], &stream->contents[stream->offset], chunk);
+
+		/* When throttled, bt_att calls back once there is room */
+		if (!bt_att_send(att, BT_ATT_OP_WRITE_CMD, pdu, chunk + 2,
+					NULL, last ? stream : NULL,
+					last ? stream_done : NULL))
+			return;
+
+		stream->offset += chunk;
+		stream->pdus++;
+	}
+}
+
+static void stream_disconnected(void *user_data)
+{
+	struct stream_data *stream = user_data;
+
+	if (stream->offset < stream->len) {
+		g_printerr("Disconnected after %" G_GSIZE_FORMAT " of %"
+				G_GSIZE_FORMAT " bytes\n", stream->offset,
+				stream->len);
+		got_error = TRUE;
+	}
+
+	g_main_loop_quit(event_loop);
+}
+
+static gboolean characteristics_write_stream(gpointer user_data)
+{
+	GAttrib *attrib = user_data;
+	struct bt_att *att = g_attrib_get_att(attrib);
+	struct stream_data *stream;
+	GError *gerr = NULL;
+
+	if (opt_handle <= 0) {
+		g_printerr("A valid handle is required\n");
+		goto error;
+	}
+
+	stream = g_new0(struct stream_data, 1);
+	stream->attrib = attrib;
+
+	if (!g_file_get_contents(opt_write_stream, &stream->contents,
+						&stream->len, &gerr)) {
+		g_printerr("%s\n", gerr->message);
+		g_error_free(gerr);
+		g_free(stream);
+		goto error;
+	}
+
+	if (stream->len == 0) {
+		g_printerr("Nothing to write, %s is empty\n",
+							opt_write_stream);
+		g_free(stream->contents);
+		g_free(stream);
+		goto error;
+	}
+
+	bt_att_set_write_watermark(att, STREAM_HIGH_WATERMARK,
+					STREAM_LOW_WATERMARK, stream_writable,
+					stream, NULL);
+	bt_att_register_disconnect(att, stream_disconnected, stream, NULL);
+
+	stream->start = g_get_monotonic_time();
+	stream_writable(stream);
+
+	return FALSE;
+
+error:
+	got_error = TRUE;
+	g_main_loop_quit(event_loop);
+	return FALSE;
+}
+
 static void char_write_req_cb(guint8 status, const guint8 *pdu, guint16 plen,
 							gpointer user_data)
 {
@@ -480,10 +699,17 @@ static GOptionEntry gatt_options[] = {
 		NULL },
 	{ "char-write-req", 0, 0, G_OPTION_ARG_NONE, &opt_char_write_req,
 		"Characteristics Value Write (Write Request)", NULL },
+	{ "char-write-stream", 0, 0, G_OPTION_ARG_FILENAME,
+		&opt_write_stream,
+		"Stream a file to a characteristic with Write Commands",
+		"FILE" },
 	{ "char-desc", 0, 0, G_OPTION_ARG_NONE, &opt_char_desc,
 		"Characteristics Descriptor Discovery", NULL },
 	{ "listen", 0, 0, G_OPTION_ARG_NONE, &opt_listen,
 		"Listen for notifications and indications", NULL },
+	{ "listen-binary", 0, 0, G_OPTION_ARG_FILENAME, &opt_listen_binary,
+		"Log notification and indication values to a binary file",
+		"FILE" },
 	{ "interactive", 'I', G_OPTION_FLAG_IN_MAIN, G_OPTION_ARG_NONE,
 		&opt_interactive, "Use interactive mode", NULL },
 	{ NULL },
@@ -551,6 +777,9 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
+	if (opt_listen_binary)
+		opt_listen = TRUE;
+
 	if (opt_primary)
 		operation = primary;
 	else if (opt_characteristics)
@@ -561,8 +790,12 @@ int main(int argc, char *argv[])
 		operation = characteristics_write;
 	else if (opt_char_write_req)
 		operation = characteristics_write_req;
+	else if (opt_write_stream)
+		operation = characteristics_write_stream;
 	else if (opt_char_desc)
 		operation = characteristics_desc;
+	else if (opt_listen_binary)
+		operation = listen_only;
 	else {
 		char *help = g_option_context_get_help(context, TRUE, NULL);
 		g_print("%s\n", help);
@@ -598,6 +831,8 @@ done:
 	g_free(opt_dst);
 	g_free(opt_uuid);
 	g_free(opt_sec_level);
+	g_free(opt_write_stream);
+	g_free(opt_listen_binary);
 
 	if (got_error)
 		exit(EXIT_FAILURE);
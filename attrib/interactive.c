@@ -318,8 +318,8 @@ static void char_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 static void char_read_by_uuid_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data)
 {
-	struct att_data_list *list;
-	int i;
+	struct att_data_iter iter;
+	const uint8_t *value;
 	GString *s;
 
 	if (status != 0) {
@@ -328,25 +328,21 @@ static void char_read_by_uuid_cb(guint8 status, const guint8 *pdu,
 		return;
 	}
 
-	list = dec_read_by_type_resp(pdu, plen);
-	if (list == NULL)
+	if (!dec_read_by_type_resp(pdu, plen, &iter))
 		return;
 
 	s = g_string_new(NULL);
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value = list->data[i];
+	while ((value = att_data_iter_next(&iter))) {
 		int j;
 
 		g_string_printf(s, "handle: 0x%04x \t value: ",
 							get_le16(value));
 		value += 2;
-		for (j = 0; j < list->len - 2; j++, value++)
+		for (j = 0; j < iter.len - 2; j++, value++)
 			g_string_append_printf(s, "%02x ", *value);
 
 		rl_printf("%s\n", s->str);
 	}
-
-	att_data_list_free(list);
 	g_string_free(s, TRUE);
 }
 
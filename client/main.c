@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <sys/signalfd.h>
@@ -47,6 +48,9 @@
 #define COLORED_CHG	COLOR_YELLOW "CHG" COLOR_OFF
 #define COLORED_DEL	COLOR_RED "DEL" COLOR_OFF
 
+/* Device events printed per second before further ones are aggregated */
+#define EVENT_RATE_LIMIT	20
+
 #define PROMPT_ON	COLOR_BLUE "[bluetooth]" COLOR_OFF "# "
 #define PROMPT_OFF	"[bluetooth]# "
 
@@ -59,6 +63,16 @@ static char *auto_register_agent = NULL;
 static GDBusProxy *default_ctrl;
 static GList *ctrl_list;
 static GList *dev_list;
+static GHashTable *dev_index;
+
+/* Scoped event output, an empty set lets everything through */
+static GHashTable *filter_devices;
+static GHashTable *filter_props;
+
+static unsigned int event_count;
+static unsigned int event_suppressed;
+static GHashTable *event_summary;
+static guint event_timer;
 
 static guint input = 0;
 
@@ -78,6 +92,121 @@ static void proxy_leak(gpointer data)
 	printf("Leaking proxy %p\n", data);
 }
 
+static const char *proxy_address(GDBusProxy *proxy)
+{
+	DBusMessageIter iter;
+	const char *address;
+
+	if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
+		return NULL;
+
+	dbus_message_iter_get_basic(&iter, &address);
+
+	return address;
+}
+
+static void dev_list_add(GDBusProxy *proxy)
+{
+	const char *address = proxy_address(proxy);
+
+	dev_list = g_list_prepend(dev_list, proxy);
+
+	if (address)
+		g_hash_table_replace(dev_index, g_strdup(address), proxy);
+}
+
+static void dev_list_remove(GDBusProxy *proxy)
+{
+	const char *address = proxy_address(proxy);
+
+	dev_list = g_list_remove(dev_list, proxy);
+
+	if (address && g_hash_table_lookup(dev_index, address) == proxy)
+		g_hash_table_remove(dev_index, address);
+}
+
+static void dev_list_clear(void)
+{
+	g_list_free(dev_list);
+	dev_list = NULL;
+
+	g_hash_table_remove_all(dev_index);
+}
+
+static GDBusProxy *find_device(const char *address)
+{
+	return g_hash_table_lookup(dev_index, address);
+}
+
+static gboolean event_flush(gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *str;
+
+	event_timer = 0;
+	event_count = 0;
+
+	if (!event_suppressed)
+		return FALSE;
+
+	str = g_string_new(NULL);
+
+	g_hash_table_iter_init(&iter, event_summary);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_string_append_printf(str, " %s %u", (char *) key,
+						GPOINTER_TO_UINT(value));
+
+	rl_printf("[" COLORED_CHG "] %u device events aggregated:%s\n",
+						event_suppressed, str->str);
+
+	g_string_free(str, TRUE);
+	g_hash_table_remove_all(event_summary);
+	event_suppressed = 0;
+
+	return FALSE;
+}
+
+/*
+ * Device events beyond EVENT_RATE_LIMIT per second are only counted per
+ * kind and summarized once the second is over, so that discovery in a
+ * crowded area does not flood the terminal.
+ */
+static gboolean event_allowed(const char *kind)
+{
+	unsigned int count;
+
+	if (!event_timer)
+		event_timer = g_timeout_add_seconds(1, event_flush, NULL);
+
+	if (++event_count <= EVENT_RATE_LIMIT)
+		return TRUE;
+
+	count = GPOINTER_TO_UINT(g_hash_table_lookup(event_summary, kind));
+	g_hash_table_insert(event_summary, g_strdup(kind),
+						GUINT_TO_POINTER(count + 1));
+	event_suppressed++;
+
+	return FALSE;
+}
+
+static gboolean event_filtered(GDBusProxy *proxy, const char *name)
+{
+	const char *address;
+
+	if (g_hash_table_size(filter_devices) > 0) {
+		address = proxy_address(proxy);
+		if (!address || !g_hash_table_lookup(filter_devices, address))
+			return TRUE;
+	}
+
+	if (name && g_hash_table_size(filter_props) > 0 &&
+				!g_hash_table_lookup(filter_props, name))
+		return TRUE;
+
+	return FALSE;
+}
+
 static void connect_handler(DBusConnection *connection, void *user_data)
 {
 	rl_set_prompt(PROMPT_ON);
@@ -98,8 +227,7 @@ static void disconnect_handler(DBusConnection *connection, void *user_data)
 
 	default_ctrl = NULL;
 
-	g_list_free(dev_list);
-	dev_list = NULL;
+	dev_list_clear();
 }
 
 static void print_adapter(GDBusProxy *proxy, const char *description)
@@ -292,9 +420,11 @@ static void proxy_added(GDBusProxy *proxy, void *user_data)
 
 	if (!strcmp(interface, "org.bluez.Device1")) {
 		if (device_is_child(proxy, default_ctrl) == TRUE) {
-			dev_list = g_list_append(dev_list, proxy);
+			dev_list_add(proxy);
 
-			print_device(proxy, COLORED_NEW);
+			if (!event_filtered(proxy, NULL) &&
+						event_allowed("new"))
+				print_device(proxy, COLORED_NEW);
 		}
 	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
 		ctrl_list = g_list_append(ctrl_list, proxy);
@@ -322,9 +452,11 @@ static void proxy_removed(GDBusProxy *proxy, void *user_data)
 
 	if (!strcmp(interface, "org.bluez.Device1")) {
 		if (device_is_child(proxy, default_ctrl) == TRUE) {
-			dev_list = g_list_remove(dev_list, proxy);
+			dev_list_remove(proxy);
 
-			print_device(proxy, COLORED_DEL);
+			if (!event_filtered(proxy, NULL) &&
+						event_allowed("del"))
+				print_device(proxy, COLORED_DEL);
 		}
 	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
 		ctrl_list = g_list_remove(ctrl_list, proxy);
@@ -334,8 +466,7 @@ static void proxy_removed(GDBusProxy *proxy, void *user_data)
 		if (default_ctrl == proxy) {
 			default_ctrl = NULL;
 
-			g_list_free(dev_list);
-			dev_list = NULL;
+			dev_list_clear();
 		}
 	} else if (!strcmp(interface, "org.bluez.AgentManager1")) {
 		if (agent_manager == proxy) {
@@ -358,6 +489,9 @@ static void property_changed(GDBusProxy *proxy, const char *name,
 			DBusMessageIter addr_iter;
 			char *str;
 
+			if (event_filtered(proxy, name) || !event_allowed(name))
+				return;
+
 			if (g_dbus_proxy_get_property(proxy, "Address",
 							&addr_iter) == TRUE) {
 				const char *address;
@@ -550,25 +684,141 @@ static void cmd_select(const char *arg)
 	default_ctrl = proxy;
 	print_adapter(proxy, NULL);
 
-	g_list_free(dev_list);
-	dev_list = NULL;
+	dev_list_clear();
+}
+
+static int device_cmp(gconstpointer a, gconstpointer b)
+{
+	const char *addr_a = proxy_address((GDBusProxy *) a);
+	const char *addr_b = proxy_address((GDBusProxy *) b);
+
+	return g_strcmp0(addr_a, addr_b);
+}
+
+static gboolean device_matches(GDBusProxy *proxy, const char *pattern)
+{
+	DBusMessageIter iter;
+	const char *str;
+
+	if (!pattern || !strlen(pattern))
+		return TRUE;
+
+	str = proxy_address(proxy);
+	if (str && strcasestr(str, pattern))
+		return TRUE;
+
+	if (g_dbus_proxy_get_property(proxy, "Alias", &iter) == FALSE)
+		return FALSE;
+
+	dbus_message_iter_get_basic(&iter, &str);
+
+	return strcasestr(str, pattern) != NULL;
+}
+
+static GList *sorted_devices(void)
+{
+	return g_list_sort(g_list_copy(dev_list), device_cmp);
 }
 
 static void cmd_devices(const char *arg)
 {
-	GList *list;
+	GList *sorted, *list;
+
+	sorted = sorted_devices();
 
-	for (list = g_list_first(dev_list); list; list = g_list_next(list)) {
+	for (list = sorted; list; list = g_list_next(list)) {
 		GDBusProxy *proxy = list->data;
-		print_device(proxy, NULL);
+
+		if (device_matches(proxy, arg))
+			print_device(proxy, NULL);
+	}
+
+	g_list_free(sorted);
+}
+
+static gboolean is_address(const char *str)
+{
+	int i;
+
+	if (strlen(str) != 17)
+		return FALSE;
+
+	for (i = 0; i < 17; i++) {
+		if (i % 3 == 2) {
+			if (str[i] != ':')
+				return FALSE;
+		} else if (!g_ascii_isxdigit(str[i]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void print_filter(const char *label, GHashTable *table)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (g_hash_table_size(table) == 0) {
+		rl_printf("%s: all\n", label);
+		return;
 	}
+
+	rl_printf("%s:\n", label);
+
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		rl_printf("\t%s\n", (char *) key);
+}
+
+static void cmd_filter_events(const char *arg)
+{
+	char **tokens;
+	int i;
+
+	if (!arg || !strlen(arg)) {
+		print_filter("Devices", filter_devices);
+		print_filter("Properties", filter_props);
+		return;
+	}
+
+	if (!strcmp(arg, "clear")) {
+		g_hash_table_remove_all(filter_devices);
+		g_hash_table_remove_all(filter_props);
+		rl_printf("Event filter cleared\n");
+		return;
+	}
+
+	tokens = g_strsplit(arg, " ", -1);
+
+	for (i = 0; tokens[i]; i++) {
+		char *key;
+
+		if (!strlen(tokens[i]))
+			continue;
+
+		if (is_address(tokens[i])) {
+			key = g_ascii_strup(tokens[i], -1);
+			g_hash_table_replace(filter_devices, key, key);
+		} else {
+			key = g_strdup(tokens[i]);
+			g_hash_table_replace(filter_props, key, key);
+		}
+	}
+
+	g_strfreev(tokens);
+
+	print_filter("Devices", filter_devices);
+	print_filter("Properties", filter_props);
 }
 
 static void cmd_paired_devices(const char *arg)
 {
-	GList *list;
+	GList *sorted, *list;
+
+	sorted = sorted_devices();
 
-	for (list = g_list_first(dev_list); list; list = g_list_next(list)) {
+	for (list = sorted; list; list = g_list_next(list)) {
 		GDBusProxy *proxy = list->data;
 		DBusMessageIter iter;
 		dbus_bool_t paired;
@@ -582,6 +832,8 @@ static void cmd_paired_devices(const char *arg)
 
 		print_device(proxy, NULL);
 	}
+
+	g_list_free(sorted);
 }
 
 static void generic_callback(const DBusError *error, void *user_data)
@@ -783,7 +1035,7 @@ static void cmd_info(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -833,7 +1085,7 @@ static void cmd_pair(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -859,7 +1111,7 @@ static void cmd_trust(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -888,7 +1140,7 @@ static void cmd_untrust(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -917,7 +1169,7 @@ static void cmd_block(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -946,7 +1198,7 @@ static void cmd_unblock(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -999,7 +1251,7 @@ static void cmd_remove(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -1041,7 +1293,7 @@ static void cmd_connect(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -1080,7 +1332,7 @@ static void cmd_disconn(const char *arg)
 		return;
 	}
 
-	proxy = find_proxy_by_address(dev_list, arg);
+	proxy = find_device(arg);
 	if (!proxy) {
 		rl_printf("Device %s not available\n", arg);
 		return;
@@ -1179,7 +1431,8 @@ static const struct {
 							ctrl_generator },
 	{ "select",       "<ctrl>",   cmd_select, "Select default controller",
 							ctrl_generator },
-	{ "devices",      NULL,       cmd_devices, "List available devices" },
+	{ "devices",      "[pattern]", cmd_devices,
+				"List available devices, sorted by address" },
 	{ "paired-devices", NULL,     cmd_paired_devices,
 					"List paired devices"},
 	{ "system-alias", "<name>",   cmd_system_alias },
@@ -1195,6 +1448,8 @@ static const struct {
 	{ "default-agent",NULL,       cmd_default_agent,
 				"Set agent as the default one" },
 	{ "scan",         "<on/off>", cmd_scan, "Scan for devices" },
+	{ "filter-events", "[clear/dev/property ...]", cmd_filter_events,
+			"Only print events of the given devices/properties" },
 	{ "info",         "<dev>",    cmd_info, "Device information",
 							dev_generator },
 	{ "pair",         "<dev>",    cmd_pair, "Pair with device",
@@ -1522,6 +1777,15 @@ int main(int argc, char *argv[])
 	signal = setup_signalfd();
 	client = g_dbus_client_new(dbus_conn, "org.bluez", "/org/bluez");
 
+	dev_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+									NULL);
+	filter_devices = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+	filter_props = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+	event_summary = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+
 	g_dbus_client_set_connect_watch(client, connect_handler, NULL);
 	g_dbus_client_set_disconnect_watch(client, disconnect_handler, NULL);
 	g_dbus_client_set_signal_watch(client, message_handler, NULL);
@@ -1548,6 +1812,14 @@ int main(int argc, char *argv[])
 	g_list_free_full(ctrl_list, proxy_leak);
 	g_list_free_full(dev_list, proxy_leak);
 
+	if (event_timer)
+		g_source_remove(event_timer);
+
+	g_hash_table_destroy(event_summary);
+	g_hash_table_destroy(filter_props);
+	g_hash_table_destroy(filter_devices);
+	g_hash_table_destroy(dev_index);
+
 	g_free(auto_register_agent);
 
 	return 0;
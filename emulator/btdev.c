@@ -145,7 +145,7 @@ struct inquiry_data {
 
 #define DEFAULT_INQUIRY_INTERVAL 100 /* 100 miliseconds */
 
-#define MAX_BTDEV_ENTRIES 16
+#define MAX_BTDEV_ENTRIES 512
 
 static const uint8_t LINK_KEY_NONE[16] = { 0 };
 static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
@@ -153,6 +153,9 @@ static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
 
 static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
 
+/* One past the highest used slot, bounds every scan of btdev_list */
+static int btdev_entries = 0;
+
 static int get_hook_index(struct btdev *btdev, enum btdev_hook_type type,
 								uint16_t opcode)
 {
@@ -193,6 +196,9 @@ static inline int add_btdev(struct btdev *btdev)
 		}
 	}
 
+	if (index >= btdev_entries)
+		btdev_entries = index + 1;
+
 	return index;
 }
 
@@ -200,7 +206,7 @@ static inline int del_btdev(struct btdev *btdev)
 {
 	int i, index = -1;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_entries; i++) {
 		if (btdev_list[i] == btdev) {
 			index = i;
 			btdev_list[index] = NULL;
@@ -208,6 +214,9 @@ static inline int del_btdev(struct btdev *btdev)
 		}
 	}
 
+	while (btdev_entries > 0 && !btdev_list[btdev_entries - 1])
+		btdev_entries--;
+
 	return index;
 }
 
@@ -215,7 +224,7 @@ static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 {
 	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_entries; i++) {
 		if (btdev_list[i] && !memcmp(btdev_list[i]->bdaddr, bdaddr, 6))
 			return btdev_list[i];
 	}
@@ -228,7 +237,7 @@ static inline struct btdev *find_btdev_by_bdaddr_type(const uint8_t *bdaddr,
 {
 	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_entries; i++) {
 		int cmp;
 
 		if (!btdev_list[i])
@@ -633,19 +642,15 @@ static void send_packet(struct btdev *btdev, const void *data, uint16_t len)
 static void send_event(struct btdev *btdev, uint8_t event,
 						const void *data, uint8_t len)
 {
+	uint8_t pkt_data[1 + sizeof(struct bt_hci_evt_hdr) + UINT8_MAX];
 	struct bt_hci_evt_hdr *hdr;
 	uint16_t pkt_len;
-	void *pkt_data;
 
 	pkt_len = 1 + sizeof(*hdr) + len;
 
-	pkt_data = malloc(pkt_len);
-	if (!pkt_data)
-		return;
-
-	((uint8_t *) pkt_data)[0] = BT_H4_EVT_PKT;
+	pkt_data[0] = BT_H4_EVT_PKT;
 
-	hdr = pkt_data + 1;
+	hdr = (void *) (pkt_data + 1);
 	hdr->evt = event;
 	hdr->plen = len;
 
@@ -654,31 +659,27 @@ static void send_event(struct btdev *btdev, uint8_t event,
 
 	if (run_hooks(btdev, BTDEV_HOOK_POST_EVT, event, pkt_data, pkt_len))
 		send_packet(btdev, pkt_data, pkt_len);
-
-	free(pkt_data);
 }
 
 static void cmd_complete(struct btdev *btdev, uint16_t opcode,
 						const void *data, uint8_t len)
 {
+	uint8_t pkt_data[1 + sizeof(struct bt_hci_evt_hdr) +
+				sizeof(struct bt_hci_evt_cmd_complete) +
+				UINT8_MAX];
 	struct bt_hci_evt_hdr *hdr;
 	struct bt_hci_evt_cmd_complete *cc;
 	uint16_t pkt_len;
-	void *pkt_data;
 
 	pkt_len = 1 + sizeof(*hdr) + sizeof(*cc) + len;
 
-	pkt_data = malloc(pkt_len);
-	if (!pkt_data)
-		return;
-
-	((uint8_t *) pkt_data)[0] = BT_H4_EVT_PKT;
+	pkt_data[0] = BT_H4_EVT_PKT;
 
-	hdr = pkt_data + 1;
+	hdr = (void *) (pkt_data + 1);
 	hdr->evt = BT_HCI_EVT_CMD_COMPLETE;
 	hdr->plen = sizeof(*cc) + len;
 
-	cc = pkt_data + 1 + sizeof(*hdr);
+	cc = (void *) (pkt_data + 1 + sizeof(*hdr));
 	cc->ncmd = 0x01;
 	cc->opcode = cpu_to_le16(opcode);
 
@@ -687,38 +688,31 @@ static void cmd_complete(struct btdev *btdev, uint16_t opcode,
 
 	if (run_hooks(btdev, BTDEV_HOOK_POST_CMD, opcode, pkt_data, pkt_len))
 		send_packet(btdev, pkt_data, pkt_len);
-
-	free(pkt_data);
 }
 
 static void cmd_status(struct btdev *btdev, uint8_t status, uint16_t opcode)
 {
+	uint8_t pkt_data[1 + sizeof(struct bt_hci_evt_hdr) +
+				sizeof(struct bt_hci_evt_cmd_status)];
 	struct bt_hci_evt_hdr *hdr;
 	struct bt_hci_evt_cmd_status *cs;
 	uint16_t pkt_len;
-	void *pkt_data;
 
 	pkt_len = 1 + sizeof(*hdr) + sizeof(*cs);
 
-	pkt_data = malloc(pkt_len);
-	if (!pkt_data)
-		return;
-
-	((uint8_t *) pkt_data)[0] = BT_H4_EVT_PKT;
+	pkt_data[0] = BT_H4_EVT_PKT;
 
-	hdr = pkt_data + 1;
+	hdr = (void *) (pkt_data + 1);
 	hdr->evt = BT_HCI_EVT_CMD_STATUS;
 	hdr->plen = sizeof(*cs);
 
-	cs = pkt_data + 1 + sizeof(*hdr);
+	cs = (void *) (pkt_data + 1 + sizeof(*hdr));
 	cs->status = status;
 	cs->ncmd = 0x01;
 	cs->opcode = cpu_to_le16(opcode);
 
 	if (run_hooks(btdev, BTDEV_HOOK_POST_CMD, opcode, pkt_data, pkt_len))
 		send_packet(btdev, pkt_data, pkt_len);
-
-	free(pkt_data);
 }
 
 static void num_completed_packets(struct btdev *btdev)
@@ -747,7 +741,7 @@ static bool inquiry_callback(void *user_data)
 	if (data->iter == MAX_BTDEV_ENTRIES)
 		return true;
 
-	for (i = data->iter; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = data->iter; i < btdev_entries; i++) {
 		/*Lets sent 10 inquiry results at once */
 		if (sent + 10 == data->sent_count)
 			break;
@@ -807,7 +801,7 @@ static bool inquiry_callback(void *user_data)
 			data->sent_count++;
 		}
 	}
-	data->iter = i;
+	data->iter = i < btdev_entries ? i : MAX_BTDEV_ENTRIES;
 
 	/* Check if we sent already required amount of responses*/
 	if (data->num_resp && data->sent_count == data->num_resp)
@@ -1655,7 +1649,7 @@ static void le_set_adv_enable_complete(struct btdev *btdev)
 
 	report_type = get_adv_report_type(btdev->le_adv_type);
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_entries; i++) {
 		if (!btdev_list[i] || btdev_list[i] == btdev)
 			continue;
 
@@ -1680,7 +1674,7 @@ static void le_set_scan_enable_complete(struct btdev *btdev)
 {
 	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_entries; i++) {
 		uint8_t report_type;
 
 		if (!btdev_list[i] || btdev_list[i] == btdev)
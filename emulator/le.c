@@ -26,10 +26,13 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -45,6 +48,20 @@
 
 #define WHITE_LIST_SIZE  16
 
+/* Granularity of the simulated advertising scheduler */
+#define ADV_SIM_TICK	10
+
+/* Largest LE Meta Event parameter area */
+#define MAX_META_LEN	255
+
+struct sim_adv {
+	uint8_t  addr[6];
+	uint64_t next_event;		/* ms, monotonic */
+	int8_t   rssi;
+	uint16_t counter;		/* Bumped on payload churn */
+	uint16_t reported;		/* Counter last reported + 1 */
+};
+
 struct bt_le {
 	volatile int ref_count;
 	int vhci_fd;
@@ -76,8 +93,23 @@ struct bt_le {
 	uint8_t  le_scan_rsp_data[31];
 	uint8_t  le_adv_enable;
 
+	uint8_t  le_scan_type;
+	uint16_t le_scan_interval;
+	uint16_t le_scan_window;
+	uint8_t  le_scan_own_addr_type;
+	uint8_t  le_scan_filter_policy;
+	uint8_t  le_scan_enable;
+	uint8_t  le_scan_filter_dup;
+
 	uint8_t  le_white_list_size;
 	uint8_t  le_states[8];
+
+	struct bt_le_adv_sim sim;
+	struct sim_adv *sim_adv;
+	uint32_t sim_seed;
+	int sim_timeout;
+	unsigned int sim_reports;
+	unsigned int sim_events;
 };
 
 static void reset_defaults(struct bt_le *hci)
@@ -116,8 +148,8 @@ static void reset_defaults(struct bt_le *hci)
 	hci->commands[25] |= 0x80;	/* LE Set Advertising Data */
 	hci->commands[26] |= 0x01;	/* LE Set Scan Response Data */
 	hci->commands[26] |= 0x02;	/* LE Set Advertise Enable */
-	//hci->commands[26] |= 0x04;	/* LE Set Scan Parameters */
-	//hci->commands[26] |= 0x08;	/* LE Set Scan Enable */
+	hci->commands[26] |= 0x04;	/* LE Set Scan Parameters */
+	hci->commands[26] |= 0x08;	/* LE Set Scan Enable */
 	//hci->commands[26] |= 0x10;	/* LE Create Connection */
 	//hci->commands[26] |= 0x20;	/* LE Create Connection Cancel */
 	hci->commands[26] |= 0x40;	/* LE Read White List Size */
@@ -185,6 +217,14 @@ static void reset_defaults(struct bt_le *hci)
 
 	hci->le_adv_enable = 0x00;
 
+	hci->le_scan_type = 0x00;
+	hci->le_scan_interval = 0x0010;
+	hci->le_scan_window = 0x0010;
+	hci->le_scan_own_addr_type = 0x00;
+	hci->le_scan_filter_policy = 0x00;
+	hci->le_scan_enable = 0x00;
+	hci->le_scan_filter_dup = 0x00;
+
 	hci->le_white_list_size = WHITE_LIST_SIZE;
 
 	memset(hci->le_states, 0, sizeof(hci->le_states));
@@ -268,10 +308,13 @@ static void cmd_set_event_mask(struct bt_le *hci,
 	cmd_complete(hci, BT_HCI_CMD_SET_EVENT_MASK, &status, sizeof(status));
 }
 
+static void sim_stop(struct bt_le *hci);
+
 static void cmd_reset(struct bt_le *hci, const void *data, uint8_t size)
 {
 	uint8_t status;
 
+	sim_stop(hci);
 	reset_defaults(hci);
 
 	status = BT_HCI_ERR_SUCCESS;
@@ -578,6 +621,309 @@ static void cmd_le_set_adv_enable(struct bt_le *hci,
 						&status, sizeof(status));
 }
 
+static uint32_t sim_random(struct bt_le *hci)
+{
+	uint32_t x = hci->sim_seed;
+
+	/* xorshift32, plenty for picking intervals and RSSI values */
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	hci->sim_seed = x;
+
+	return x;
+}
+
+static uint64_t sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void sim_schedule(struct bt_le *hci, struct sim_adv *adv,
+							uint64_t now)
+{
+	/* advInterval plus the 0 to 10 ms pseudo random advDelay */
+	adv->next_event = now + hci->sim.interval + sim_random(hci) % 11;
+}
+
+static uint8_t sim_adv_data(struct bt_le *hci, const struct sim_adv *adv,
+							uint8_t *data)
+{
+	uint8_t len = 0;
+
+	data[len++] = 0x02;		/* Flags */
+	data[len++] = 0x01;
+	data[len++] = 0x06;
+
+	data[len++] = 0x05;		/* Manufacturer Specific Data */
+	data[len++] = 0xff;
+	put_le16(hci->manufacturer, data + len);
+	len += 2;
+	put_le16(adv->counter, data + len);
+	len += 2;
+
+	return len;
+}
+
+static uint8_t sim_scan_rsp_data(const struct sim_adv *adv, uint8_t *data)
+{
+	int len;
+
+	len = sprintf((char *) data + 2, "sim-%02x%02x", adv->addr[1],
+								adv->addr[0]);
+	data[0] = len + 1;
+	data[1] = 0x09;			/* Complete Local Name */
+
+	return len + 2;
+}
+
+/* Append one report, returns false if the event has no room left */
+static bool sim_add_report(uint8_t *buf, uint8_t *len, uint8_t type,
+				const struct sim_adv *adv, int8_t rssi,
+				const uint8_t *data, uint8_t data_len)
+{
+	uint8_t *ptr;
+
+	if (*len + 10 + data_len > MAX_META_LEN)
+		return false;
+
+	ptr = buf + *len;
+	ptr[0] = type;
+	ptr[1] = 0x01;			/* Random address */
+	memcpy(ptr + 2, adv->addr, 6);
+	ptr[8] = data_len;
+	memcpy(ptr + 9, data, data_len);
+	ptr[9 + data_len] = rssi;
+
+	*len += 10 + data_len;
+	buf[1]++;
+
+	return true;
+}
+
+static void sim_flush(struct bt_le *hci, uint8_t *buf, uint8_t *len)
+{
+	if (!buf[1])
+		return;
+
+	send_event(hci, BT_HCI_EVT_LE_META_EVENT, buf, *len);
+
+	hci->sim_reports += buf[1];
+	hci->sim_events++;
+
+	buf[1] = 0;
+	*len = 2;
+}
+
+static void sim_report(struct bt_le *hci, uint8_t *buf, uint8_t *len,
+				uint8_t type, const struct sim_adv *adv,
+				int8_t rssi, const uint8_t *data,
+				uint8_t data_len)
+{
+	if (sim_add_report(buf, len, type, adv, rssi, data, data_len))
+		return;
+
+	sim_flush(hci, buf, len);
+	sim_add_report(buf, len, type, adv, rssi, data, data_len);
+}
+
+/*
+ * Run every advertising event that is due and hand the reports the
+ * scanner would have picked up to the host, packing as many as fit into
+ * each LE Advertising Report event like real controllers do.
+ */
+static void sim_timeout_callback(int id, void *user_data)
+{
+	struct bt_le *hci = user_data;
+	uint8_t buf[MAX_META_LEN], len = 2;
+	uint8_t data[31], data_len;
+	uint64_t now = sim_now();
+	unsigned int i, duty;
+
+	buf[0] = BT_HCI_EVT_LE_ADV_REPORT;
+	buf[1] = 0;
+
+	/* Share of the advertising events falling into the scan window */
+	duty = hci->le_scan_window * 100 / hci->le_scan_interval;
+
+	for (i = 0; i < hci->sim.count; i++) {
+		struct sim_adv *adv = &hci->sim_adv[i];
+		int8_t rssi;
+
+		if (adv->next_event > now)
+			continue;
+
+		sim_schedule(hci, adv, now);
+
+		if (hci->sim.churn && sim_random(hci) % 100 < hci->sim.churn)
+			adv->counter++;
+
+		if (sim_random(hci) % 100 >= duty)
+			continue;
+
+		if (hci->le_scan_filter_dup &&
+					adv->reported == adv->counter + 1)
+			continue;
+
+		adv->reported = adv->counter + 1;
+
+		rssi = adv->rssi;
+		if (hci->sim.rssi_jitter)
+			rssi += (int) (sim_random(hci) %
+					(2 * hci->sim.rssi_jitter + 1)) -
+							hci->sim.rssi_jitter;
+
+		data_len = sim_adv_data(hci, adv, data);
+		sim_report(hci, buf, &len, 0x00, adv, rssi, data, data_len);
+
+		if (hci->le_scan_type != 0x01)
+			continue;
+
+		data_len = sim_scan_rsp_data(adv, data);
+		sim_report(hci, buf, &len, 0x04, adv, rssi, data, data_len);
+	}
+
+	sim_flush(hci, buf, &len);
+
+	mainloop_modify_timeout(id, ADV_SIM_TICK);
+}
+
+static void sim_start(struct bt_le *hci)
+{
+	uint64_t now = sim_now();
+	unsigned int i;
+
+	if (!hci->sim.count || hci->sim_timeout > 0)
+		return;
+
+	for (i = 0; i < hci->sim.count; i++) {
+		struct sim_adv *adv = &hci->sim_adv[i];
+
+		/* Spread the first events over one interval */
+		adv->next_event = now + sim_random(hci) %
+						(hci->sim.interval + 1);
+		adv->reported = 0;
+	}
+
+	hci->sim_reports = 0;
+	hci->sim_events = 0;
+
+	hci->sim_timeout = mainloop_add_timeout(ADV_SIM_TICK,
+					sim_timeout_callback, hci, NULL);
+}
+
+static void sim_stop(struct bt_le *hci)
+{
+	if (hci->sim_timeout <= 0)
+		return;
+
+	mainloop_remove_timeout(hci->sim_timeout);
+	hci->sim_timeout = 0;
+
+	printf("Simulated %u advertising reports in %u events\n",
+					hci->sim_reports, hci->sim_events);
+}
+
+static void cmd_le_set_scan_parameters(struct bt_le *hci,
+						const void *data, uint8_t size)
+{
+	const struct bt_hci_cmd_le_set_scan_parameters *cmd = data;
+	uint16_t interval, window;
+	uint8_t status;
+
+	if (hci->le_scan_enable == 0x01) {
+		cmd_status(hci, BT_HCI_ERR_COMMAND_DISALLOWED,
+					BT_HCI_CMD_LE_SET_SCAN_PARAMETERS);
+		return;
+	}
+
+	interval = le16_to_cpu(cmd->interval);
+	window = le16_to_cpu(cmd->window);
+
+	/* Valid range for scan type is 0x00 to 0x01 */
+	if (cmd->type > 0x01) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_PARAMETERS);
+		return;
+	}
+
+	/* Range for scan interval and window is 0x0004 to 0x4000 */
+	if (interval < 0x0004 || interval > 0x4000 ||
+				window < 0x0004 || window > 0x4000) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_PARAMETERS);
+		return;
+	}
+
+	/* Scan window shall be less or equal to scan interval */
+	if (window > interval) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_PARAMETERS);
+		return;
+	}
+
+	/* Valid range for own address type is 0x00 to 0x01 */
+	if (cmd->own_addr_type > 0x01) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_PARAMETERS);
+		return;
+	}
+
+	/* Valid range for scanning filter policy is 0x00 to 0x01 */
+	if (cmd->filter_policy > 0x01) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_PARAMETERS);
+		return;
+	}
+
+	hci->le_scan_type = cmd->type;
+	hci->le_scan_interval = interval;
+	hci->le_scan_window = window;
+	hci->le_scan_own_addr_type = cmd->own_addr_type;
+	hci->le_scan_filter_policy = cmd->filter_policy;
+
+	status = BT_HCI_ERR_SUCCESS;
+	cmd_complete(hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
+						&status, sizeof(status));
+}
+
+static void cmd_le_set_scan_enable(struct bt_le *hci,
+						const void *data, uint8_t size)
+{
+	const struct bt_hci_cmd_le_set_scan_enable *cmd = data;
+	uint8_t status;
+
+	/* Valid range for scan enable is 0x00 to 0x01 */
+	if (cmd->enable > 0x01) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_ENABLE);
+		return;
+	}
+
+	/* Valid range for filter duplicates is 0x00 to 0x01 */
+	if (cmd->filter_dup > 0x01) {
+		cmd_status(hci, BT_HCI_ERR_INVALID_PARAMETERS,
+					BT_HCI_CMD_LE_SET_SCAN_ENABLE);
+		return;
+	}
+
+	hci->le_scan_enable = cmd->enable;
+	hci->le_scan_filter_dup = cmd->filter_dup;
+
+	status = BT_HCI_ERR_SUCCESS;
+	cmd_complete(hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
+						&status, sizeof(status));
+
+	if (hci->le_scan_enable)
+		sim_start(hci);
+	else
+		sim_stop(hci);
+}
+
 static void cmd_le_read_white_list_size(struct bt_le *hci,
 						const void *data, uint8_t size)
 {
@@ -677,6 +1023,10 @@ static const struct {
 				cmd_le_set_scan_rsp_data, 32, true },
 	{ BT_HCI_CMD_LE_SET_ADV_ENABLE,
 				cmd_le_set_adv_enable, 1, true },
+	{ BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
+				cmd_le_set_scan_parameters, 7, true },
+	{ BT_HCI_CMD_LE_SET_SCAN_ENABLE,
+				cmd_le_set_scan_enable, 2, true },
 
 	{ BT_HCI_CMD_LE_READ_WHITE_LIST_SIZE,
 				cmd_le_read_white_list_size, 0, true },
@@ -799,6 +1149,9 @@ void bt_le_unref(struct bt_le *hci)
 	if (__sync_sub_and_fetch(&hci->ref_count, 1))
 		return;
 
+	sim_stop(hci);
+	free(hci->sim_adv);
+
 	bt_crypto_unref(hci->crypto);
 
 	mainloop_remove_fd(hci->vhci_fd);
@@ -807,3 +1160,46 @@ void bt_le_unref(struct bt_le *hci)
 
 	free(hci);
 }
+
+/*
+ * Populate the air around this controller with virtual advertisers. Once
+ * the host enables scanning their advertising events are turned into
+ * LE Advertising Reports, subject to the scan window, duplicate filter
+ * and active scanning settings the host chose.
+ */
+bool bt_le_set_adv_sim(struct bt_le *hci, const struct bt_le_adv_sim *sim)
+{
+	struct sim_adv *adv;
+	unsigned int i;
+
+	if (!hci || !sim || sim->rssi_min > sim->rssi_max || sim->churn > 100)
+		return false;
+
+	if (hci->le_scan_enable)
+		return false;
+
+	adv = calloc(sim->count ? sim->count : 1, sizeof(*adv));
+	if (!adv)
+		return false;
+
+	free(hci->sim_adv);
+	hci->sim_adv = adv;
+	hci->sim = *sim;
+
+	if (hci->sim.interval < 20)
+		hci->sim.interval = 20;
+
+	hci->sim_seed = (uint32_t) sim_now() | 1;
+
+	for (i = 0; i < sim->count; i++) {
+		/* Static random addresses, two most significant bits set */
+		put_le32(i, adv[i].addr);
+		adv[i].addr[4] = hci->bdaddr[0];
+		adv[i].addr[5] = 0xc0 | (sim_random(hci) & 0x3f);
+
+		adv[i].rssi = sim->rssi_min + (int) (sim_random(hci) %
+					(sim->rssi_max - sim->rssi_min + 1));
+	}
+
+	return true;
+}
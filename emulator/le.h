@@ -23,10 +23,22 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct bt_le;
 
+struct bt_le_adv_sim {
+	unsigned int count;		/* Number of virtual advertisers */
+	unsigned int interval;		/* Advertising interval in ms */
+	unsigned int churn;		/* Percent of events changing data */
+	int8_t rssi_min;		/* Per advertiser RSSI range */
+	int8_t rssi_max;
+	uint8_t rssi_jitter;		/* Per report RSSI variation */
+};
+
 struct bt_le *bt_le_new(void);
 
 struct bt_le *bt_le_ref(struct bt_le *le);
 void bt_le_unref(struct bt_le *le);
+
+bool bt_le_set_adv_sim(struct bt_le *le, const struct bt_le_adv_sim *sim);
@@ -60,6 +60,9 @@ static void usage(void)
 		"\t-L                    Create LE only controller\n"
 		"\t-B                    Create BR/EDR only controller\n"
 		"\t-A                    Create AMP controller\n"
+		"\t-a, --advertisers <num> Simulated LE advertisers (-U)\n"
+		"\t-i, --adv-interval <ms> Simulated advertising interval\n"
+		"\t-c, --adv-churn <pct>   Simulated advertising data churn\n"
 		"\t-h, --help            Show help options\n");
 }
 
@@ -72,6 +75,9 @@ static const struct option main_options[] = {
 	{ "amp",     no_argument,       NULL, 'A' },
 	{ "letest",  optional_argument, NULL, 'U' },
 	{ "amptest", optional_argument, NULL, 'T' },
+	{ "advertisers",  required_argument, NULL, 'a' },
+	{ "adv-interval", required_argument, NULL, 'i' },
+	{ "adv-churn",    required_argument, NULL, 'c' },
 	{ "version", no_argument,	NULL, 'v' },
 	{ "help",    no_argument,	NULL, 'h' },
 	{ }
@@ -90,6 +96,14 @@ int main(int argc, char *argv[])
 	int amptest_count = 0;
 	int vhci_count = 0;
 	enum vhci_type vhci_type = VHCI_TYPE_BREDRLE;
+	struct bt_le_adv_sim adv_sim = {
+		.count = 0,
+		.interval = 100,
+		.churn = 0,
+		.rssi_min = -90,
+		.rssi_max = -40,
+		.rssi_jitter = 4,
+	};
 	sigset_t mask;
 	int i;
 
@@ -98,7 +112,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "Ssl::LBAUTvh",
+		opt = getopt_long(argc, argv, "Ssl::LBAUTa:i:c:vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -137,6 +151,15 @@ int main(int argc, char *argv[])
 			else
 				amptest_count = 1;
 			break;
+		case 'a':
+			adv_sim.count = atoi(optarg);
+			break;
+		case 'i':
+			adv_sim.interval = atoi(optarg);
+			break;
+		case 'c':
+			adv_sim.churn = atoi(optarg);
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -170,6 +193,11 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "Failed to create LE controller\n");
 			return EXIT_FAILURE;
 		}
+
+		if (adv_sim.count > 0 && !bt_le_set_adv_sim(le, &adv_sim)) {
+			fprintf(stderr, "Failed to set up advertisers\n");
+			return EXIT_FAILURE;
+		}
 	}
 
 	for (i = 0; i < amptest_count; i++) {
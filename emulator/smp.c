@@ -44,6 +44,14 @@
 
 #define SMP_CID 0x0006
 
+/*
+ * All emulated hosts share one crypto context, so a test that brings up
+ * hundreds of peers keeps using the same few keyed operation sockets
+ * instead of opening a set of AF_ALG sockets for every host.
+ */
+static struct bt_crypto *smp_crypto;
+static unsigned int smp_crypto_users;
+
 struct smp {
 	struct bthost *bthost;
 	struct smp_conn *conn;
@@ -270,12 +278,17 @@ void *smp_start(struct bthost *bthost)
 
 	memset(smp, 0, sizeof(*smp));
 
-	smp->crypto = bt_crypto_new();
+	if (!smp_crypto)
+		smp_crypto = bt_crypto_new();
+
+	smp->crypto = bt_crypto_ref(smp_crypto);
 	if (!smp->crypto) {
 		free(smp);
 		return NULL;
 	}
 
+	smp_crypto_users++;
+
 	smp->bthost = bthost;
 
 	return smp;
@@ -287,5 +300,10 @@ void smp_stop(void *smp_data)
 
 	bt_crypto_unref(smp->crypto);
 
+	if (!--smp_crypto_users) {
+		bt_crypto_unref(smp_crypto);
+		smp_crypto = NULL;
+	}
+
 	free(smp);
 }
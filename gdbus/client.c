@@ -81,6 +81,7 @@ struct prop_entry {
 	char *name;
 	int type;
 	DBusMessage *msg;
+	DBusMessageIter iter;
 };
 
 static void modify_match_reply(DBusPendingCall *call, void *user_data)
@@ -123,6 +124,21 @@ static gboolean modify_match(DBusConnection *conn, const char *member,
 	return TRUE;
 }
 
+static gboolean iter_append_fixed_array(DBusMessageIter *base,
+						DBusMessageIter *iter)
+{
+	int type = dbus_message_iter_get_arg_type(iter);
+	const void *value;
+	int len;
+
+	if (!dbus_type_is_fixed(type) || type == DBUS_TYPE_UNIX_FD)
+		return FALSE;
+
+	dbus_message_iter_get_fixed_array(iter, &value, &len);
+
+	return dbus_message_iter_append_fixed_array(base, type, &value, len);
+}
+
 static void iter_append_iter(DBusMessageIter *base, DBusMessageIter *iter)
 {
 	int type;
@@ -155,6 +171,13 @@ static void iter_append_iter(DBusMessageIter *base, DBusMessageIter *iter)
 		if (sig != NULL)
 			dbus_free(sig);
 
+		/* Arrays of fixed size values are copied in one go */
+		if (type == DBUS_TYPE_ARRAY &&
+				iter_append_fixed_array(&base_sub, &iter_sub)) {
+			dbus_message_iter_close_container(base, &base_sub);
+			return;
+		}
+
 		while (dbus_message_iter_get_arg_type(&iter_sub) !=
 							DBUS_TYPE_INVALID) {
 			iter_append_iter(&base_sub, &iter_sub);
@@ -165,11 +188,28 @@ static void iter_append_iter(DBusMessageIter *base, DBusMessageIter *iter)
 	}
 }
 
-static void prop_entry_update(struct prop_entry *prop, DBusMessageIter *iter)
+/*
+ * Values from small messages, like PropertiesChanged signals, are kept by
+ * referencing the message they arrived in. Only values that are part of
+ * larger messages get copied, so those do not stay around as a whole.
+ */
+static void prop_entry_update(struct prop_entry *prop, DBusMessage *src,
+						DBusMessageIter *iter)
 {
 	DBusMessage *msg;
 	DBusMessageIter base;
 
+	if (src != NULL) {
+		dbus_message_ref(src);
+
+		if (prop->msg != NULL)
+			dbus_message_unref(prop->msg);
+
+		prop->msg = src;
+		prop->iter = *iter;
+		return;
+	}
+
 	msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
 	if (msg == NULL)
 		return;
@@ -180,11 +220,11 @@ static void prop_entry_update(struct prop_entry *prop, DBusMessageIter *iter)
 	if (prop->msg != NULL)
 		dbus_message_unref(prop->msg);
 
-	prop->msg = dbus_message_copy(msg);
-	dbus_message_unref(msg);
+	prop->msg = msg;
+	dbus_message_iter_init(msg, &prop->iter);
 }
 
-static struct prop_entry *prop_entry_new(const char *name,
+static struct prop_entry *prop_entry_new(const char *name, DBusMessage *src,
 						DBusMessageIter *iter)
 {
 	struct prop_entry *prop;
@@ -196,7 +236,7 @@ static struct prop_entry *prop_entry_new(const char *name,
 	prop->name = g_strdup(name);
 	prop->type = dbus_message_iter_get_arg_type(iter);
 
-	prop_entry_update(prop, iter);
+	prop_entry_update(prop, src, iter);
 
 	return prop;
 }
@@ -214,7 +254,8 @@ static void prop_entry_free(gpointer data)
 }
 
 static void add_property(GDBusProxy *proxy, const char *name,
-				DBusMessageIter *iter, gboolean send_changed)
+				DBusMessage *src, DBusMessageIter *iter,
+				gboolean send_changed)
 {
 	GDBusClient *client = proxy->client;
 	DBusMessageIter value;
@@ -227,11 +268,11 @@ static void add_property(GDBusProxy *proxy, const char *name,
 
 	prop = g_hash_table_lookup(proxy->prop_list, name);
 	if (prop != NULL) {
-		prop_entry_update(prop, &value);
+		prop_entry_update(prop, src, &value);
 		goto done;
 	}
 
-	prop = prop_entry_new(name, &value);
+	prop = prop_entry_new(name, src, &value);
 	if (prop == NULL)
 		return;
 
@@ -249,8 +290,8 @@ done:
 							client->user_data);
 }
 
-static void update_properties(GDBusProxy *proxy, DBusMessageIter *iter,
-							gboolean send_changed)
+static void update_properties(GDBusProxy *proxy, DBusMessage *src,
+				DBusMessageIter *iter, gboolean send_changed)
 {
 	DBusMessageIter dict;
 
@@ -271,7 +312,7 @@ static void update_properties(GDBusProxy *proxy, DBusMessageIter *iter,
 		dbus_message_iter_get_basic(&entry, &name);
 		dbus_message_iter_next(&entry);
 
-		add_property(proxy, name, &entry, send_changed);
+		add_property(proxy, name, src, &entry, send_changed);
 
 		dbus_message_iter_next(&dict);
 	}
@@ -294,7 +335,7 @@ static void get_all_properties_reply(DBusPendingCall *call, void *user_data)
 
 	dbus_message_iter_init(reply, &iter);
 
-	update_properties(proxy, &iter, FALSE);
+	update_properties(proxy, NULL, &iter, FALSE);
 
 done:
 	if (g_list_find(client->proxy_list, proxy) == NULL) {
@@ -373,7 +414,7 @@ static gboolean properties_changed(DBusConnection *conn, DBusMessage *msg,
 	dbus_message_iter_get_basic(&iter, &interface);
 	dbus_message_iter_next(&iter);
 
-	update_properties(proxy, &iter, TRUE);
+	update_properties(proxy, msg, &iter, TRUE);
 
 	dbus_message_iter_next(&iter);
 
@@ -547,8 +588,7 @@ gboolean g_dbus_proxy_get_property(GDBusProxy *proxy, const char *name,
 	if (prop->msg == NULL)
 		return FALSE;
 
-	if (dbus_message_iter_init(prop->msg, iter) == FALSE)
-		return FALSE;
+	*iter = prop->iter;
 
 	return TRUE;
 }
@@ -579,7 +619,7 @@ static void refresh_property_reply(DBusPendingCall *call, void *user_data)
 
 		dbus_message_iter_init(reply, &iter);
 
-		add_property(data->proxy, data->name, &iter, TRUE);
+		add_property(data->proxy, data->name, reply, &iter, TRUE);
 	} else
 		dbus_error_free(&error);
 
@@ -938,7 +978,7 @@ static void parse_properties(GDBusClient *client, const char *path,
 
 	proxy = proxy_lookup(client, path, interface);
 	if (proxy) {
-		update_properties(proxy, iter, FALSE);
+		update_properties(proxy, NULL, iter, FALSE);
 		return;
 	}
 
@@ -946,7 +986,7 @@ static void parse_properties(GDBusClient *client, const char *path,
 	if (proxy == NULL)
 		return;
 
-	update_properties(proxy, iter, FALSE);
+	update_properties(proxy, NULL, iter, FALSE);
 
 	if (client->proxy_added)
 		client->proxy_added(proxy, client->user_data);
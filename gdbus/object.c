@@ -33,12 +33,22 @@
 
 #include "gdbus.h"
 
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#else
+#define DTRACE_PROBE2(provider, name, a, b)
+#define DTRACE_PROBE3(provider, name, a, b, c)
+#endif
+
 #define info(fmt...)
 #define error(fmt...)
 #define debug(fmt...)
 
 #define DBUS_INTERFACE_OBJECT_MANAGER "org.freedesktop.DBus.ObjectManager"
 
+#define PENDING_BATCH_SIZE 64
+#define PROPERTY_THROTTLE_INTERVAL 1000
+
 #ifndef DBUS_ERROR_UNKNOWN_PROPERTY
 #define DBUS_ERROR_UNKNOWN_PROPERTY "org.freedesktop.DBus.Error.UnknownProperty"
 #endif
@@ -55,22 +65,39 @@ struct generic_data {
 	GSList *objects;
 	GSList *added;
 	GSList *removed;
-	guint process_id;
+	GList *pending_link;
 	gboolean pending_prop;
 	char *introspect;
 	struct generic_data *parent;
 };
 
+struct dispatch_table {
+	unsigned int refcount;
+	const void *table;
+	GHashTable *names;
+};
+
 struct interface_data {
 	char *name;
 	const GDBusMethodTable *methods;
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
+	struct dispatch_table *method_table;
+	struct dispatch_table *property_table;
 	GSList *pending_prop;
+	GSList *throttled;
 	void *user_data;
 	GDBusDestroyFunction destroy;
 };
 
+struct property_throttle {
+	struct generic_data *data;
+	struct interface_data *iface;
+	const GDBusPropertyTable *property;
+	gint64 last;
+	guint timeout;
+};
+
 struct security_data {
 	GDBusPendingReply pending;
 	DBusMessage *message;
@@ -86,9 +113,12 @@ struct property_data {
 
 static int global_flags = 0;
 static struct generic_data *root;
-static GSList *pending = NULL;
+static GHashTable *method_tables = NULL;
+static GHashTable *property_tables = NULL;
+static GQueue pending = G_QUEUE_INIT;
+static guint pending_id = 0;
 
-static gboolean process_changes(gpointer user_data);
+static void process_changes(struct generic_data *data);
 static void process_properties_from_interface(struct generic_data *data,
 						struct interface_data *iface);
 static void process_property_changes(struct generic_data *data);
@@ -256,8 +286,15 @@ static DBusHandlerResult process_message(DBusConnection *connection,
 {
 	DBusMessage *reply;
 
+	DTRACE_PROBE2(bluez, dbus_method_entry,
+			dbus_message_get_interface(message), method->name);
+
 	reply = method->function(connection, message, iface_user_data);
 
+	DTRACE_PROBE3(bluez, dbus_method_return,
+			dbus_message_get_interface(message), method->name,
+			reply != NULL);
+
 	if (method->flags & G_DBUS_METHOD_FLAG_NOREPLY) {
 		if (reply != NULL)
 			dbus_message_unref(reply);
@@ -611,6 +648,93 @@ static struct interface_data *find_interface(GSList *interfaces,
 	return NULL;
 }
 
+static GHashTable *method_names_new(const void *table)
+{
+	const GDBusMethodTable *method;
+	GHashTable *names;
+
+	names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	/* Map each name to its first entry, lookups continue from there */
+	for (method = table; method && method->name && method->function;
+								method++) {
+		if (g_hash_table_lookup(names, method->name) == NULL)
+			g_hash_table_insert(names, (char *) method->name,
+							(gpointer) method);
+	}
+
+	return names;
+}
+
+static GHashTable *property_names_new(const void *table)
+{
+	const GDBusPropertyTable *property;
+	GHashTable *names;
+
+	names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (property = table; property && property->name; property++) {
+		if (g_hash_table_lookup(names, property->name) == NULL)
+			g_hash_table_insert(names, (char *) property->name,
+							(gpointer) property);
+	}
+
+	return names;
+}
+
+/*
+ * Method and property tables are static and shared by all objects that
+ * implement the same interface, so their name lookup tables are built
+ * once per table and reference counted.
+ */
+static struct dispatch_table *dispatch_table_ref(GHashTable **tables,
+					const void *table,
+					GHashTable *(*names_new)(const void *))
+{
+	struct dispatch_table *dispatch;
+
+	if (table == NULL)
+		return NULL;
+
+	if (*tables == NULL)
+		*tables = g_hash_table_new(NULL, NULL);
+
+	dispatch = g_hash_table_lookup(*tables, table);
+	if (dispatch == NULL) {
+		dispatch = g_new0(struct dispatch_table, 1);
+		dispatch->table = table;
+		dispatch->names = names_new(table);
+		g_hash_table_insert(*tables, (gpointer) table, dispatch);
+	}
+
+	dispatch->refcount++;
+
+	return dispatch;
+}
+
+static void dispatch_table_unref(GHashTable *tables,
+					struct dispatch_table *dispatch)
+{
+	if (dispatch == NULL)
+		return;
+
+	if (--dispatch->refcount > 0)
+		return;
+
+	g_hash_table_remove(tables, dispatch->table);
+	g_hash_table_destroy(dispatch->names);
+	g_free(dispatch);
+}
+
+static const void *dispatch_table_lookup(struct dispatch_table *dispatch,
+							const char *name)
+{
+	if (dispatch == NULL || name == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(dispatch->names, name);
+}
+
 static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 							DBusMessage *message)
 {
@@ -632,14 +756,51 @@ static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 	return TRUE;
 }
 
+static gboolean process_pending(gpointer user_data)
+{
+	int i;
+
+	/*
+	 * Objects are handled in bounded batches to keep the main loop
+	 * responsive when a large number of them changed at once.
+	 */
+	for (i = 0; i < PENDING_BATCH_SIZE; i++) {
+		struct generic_data *data = g_queue_peek_head(&pending);
+
+		if (data == NULL)
+			break;
+
+		process_changes(data);
+	}
+
+	if (!g_queue_is_empty(&pending))
+		return TRUE;
+
+	pending_id = 0;
+
+	return FALSE;
+}
+
 static void add_pending(struct generic_data *data)
 {
-	if (data->process_id > 0)
+	if (data->pending_link != NULL)
 		return;
 
-	data->process_id = g_idle_add(process_changes, data);
+	g_queue_push_tail(&pending, data);
+	data->pending_link = pending.tail;
 
-	pending = g_slist_append(pending, data);
+	if (pending_id == 0)
+		pending_id = g_idle_add(process_pending, NULL);
+}
+
+static void property_throttle_free(gpointer user_data)
+{
+	struct property_throttle *throttle = user_data;
+
+	if (throttle->timeout > 0)
+		g_source_remove(throttle->timeout);
+
+	g_free(throttle);
 }
 
 static gboolean remove_interface(struct generic_data *data, const char *name)
@@ -654,6 +815,12 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 
 	data->interfaces = g_slist_remove(data->interfaces, iface);
 
+	g_slist_free_full(iface->throttled, property_throttle_free);
+	iface->throttled = NULL;
+
+	dispatch_table_unref(method_tables, iface->method_table);
+	dispatch_table_unref(property_tables, iface->property_table);
+
 	if (iface->destroy) {
 		iface->destroy(iface->user_data);
 		iface->user_data = NULL;
@@ -734,23 +901,20 @@ done:
 	return data;
 }
 
-static inline const GDBusPropertyTable *find_property(const GDBusPropertyTable *properties,
-							const char *name)
+static inline const GDBusPropertyTable *find_property(
+						struct interface_data *iface,
+						const char *name)
 {
 	const GDBusPropertyTable *p;
 
-	for (p = properties; p && p->name; p++) {
-		if (strcmp(name, p->name) != 0)
-			continue;
-
-		if (check_experimental(p->flags,
-					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL))
-			break;
+	p = dispatch_table_lookup(iface->property_table, name);
+	if (p == NULL)
+		return NULL;
 
-		return p;
-	}
+	if (check_experimental(p->flags, G_DBUS_PROPERTY_FLAG_EXPERIMENTAL))
+		return NULL;
 
-	return NULL;
+	return p;
 }
 
 static DBusMessage *properties_get(DBusConnection *connection,
@@ -774,7 +938,7 @@ static DBusMessage *properties_get(DBusConnection *connection,
 		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
 				"No such interface '%s'", interface);
 
-	property = find_property(iface->properties, name);
+	property = find_property(iface, name);
 	if (property == NULL)
 		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
 				"No such property '%s'", name);
@@ -880,7 +1044,7 @@ static DBusMessage *properties_set(DBusConnection *connection,
 		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
 					"No such interface '%s'", interface);
 
-	property = find_property(iface->properties, name);
+	property = find_property(iface, name);
 	if (property == NULL)
 		return g_dbus_create_error(message,
 						DBUS_ERROR_UNKNOWN_PROPERTY,
@@ -982,18 +1146,15 @@ static void emit_interfaces_removed(struct generic_data *data)
 
 static void remove_pending(struct generic_data *data)
 {
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
-	}
+	if (data->pending_link == NULL)
+		return;
 
-	pending = g_slist_remove(pending, data);
+	g_queue_delete_link(&pending, data->pending_link);
+	data->pending_link = NULL;
 }
 
-static gboolean process_changes(gpointer user_data)
+static void process_changes(struct generic_data *data)
 {
-	struct generic_data *data = user_data;
-
 	remove_pending(data);
 
 	if (data->added != NULL)
@@ -1005,10 +1166,6 @@ static gboolean process_changes(gpointer user_data)
 
 	if (data->removed != NULL)
 		emit_interfaces_removed(data);
-
-	data->process_id = 0;
-
-	return FALSE;
 }
 
 static void generic_unregister(DBusConnection *connection, void *user_data)
@@ -1019,11 +1176,8 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	if (parent != NULL)
 		parent->objects = g_slist_remove(parent->objects, data);
 
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
+	if (data->pending_link != NULL)
 		process_changes(data);
-	}
 
 	g_slist_foreach(data->objects, reset_parent, data->parent);
 	g_slist_free(data->objects);
@@ -1040,7 +1194,7 @@ static DBusHandlerResult generic_message(DBusConnection *connection,
 	struct generic_data *data = user_data;
 	struct interface_data *iface;
 	const GDBusMethodTable *method;
-	const char *interface;
+	const char *interface, *member;
 
 	interface = dbus_message_get_interface(message);
 
@@ -1048,11 +1202,15 @@ static DBusHandlerResult generic_message(DBusConnection *connection,
 	if (iface == NULL)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (method = iface->methods; method &&
-			method->name && method->function; method++) {
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	member = dbus_message_get_member(message);
+
+	method = dispatch_table_lookup(iface->method_table, member);
 
-		if (dbus_message_is_method_call(message, iface->name,
-							method->name) == FALSE)
+	for (; method && method->name && method->function; method++) {
+		if (strcmp(method->name, member) != 0)
 			continue;
 
 		if (check_experimental(method->flags,
@@ -1211,6 +1369,10 @@ done:
 	iface->methods = methods;
 	iface->signals = signals;
 	iface->properties = properties;
+	iface->method_table = dispatch_table_ref(&method_tables, methods,
+							method_names_new);
+	iface->property_table = dispatch_table_ref(&property_tables,
+						properties, property_names_new);
 	iface->user_data = user_data;
 	iface->destroy = destroy;
 
@@ -1465,9 +1627,9 @@ DBusMessage *g_dbus_create_reply(DBusMessage *message, int type, ...)
 
 static void g_dbus_flush(DBusConnection *connection)
 {
-	GSList *l;
+	GList *l;
 
-	for (l = pending; l;) {
+	for (l = pending.head; l;) {
 		struct generic_data *data = l->data;
 
 		l = l->next;
@@ -1492,6 +1654,8 @@ gboolean g_dbus_send_message(DBusConnection *connection, DBusMessage *message)
 
 		if (!check_signal(connection, path, interface, name, &args))
 			goto out;
+
+		DTRACE_PROBE3(bluez, dbus_signal, path, interface, name);
 	}
 
 	/* Flush pending signal to guarantee message order */
@@ -1720,6 +1884,82 @@ static void process_property_changes(struct generic_data *data)
 	}
 }
 
+static void queue_property_changed(struct generic_data *data,
+					struct interface_data *iface,
+					const GDBusPropertyTable *property)
+{
+	if (g_slist_find(iface->pending_prop, (void *) property) != NULL)
+		return;
+
+	data->pending_prop = TRUE;
+	iface->pending_prop = g_slist_prepend(iface->pending_prop,
+						(void *) property);
+
+	add_pending(data);
+}
+
+static gboolean property_throttle_timeout(gpointer user_data)
+{
+	struct property_throttle *throttle = user_data;
+
+	throttle->timeout = 0;
+	throttle->last = g_get_monotonic_time();
+
+	queue_property_changed(throttle->data, throttle->iface,
+							throttle->property);
+
+	return FALSE;
+}
+
+/*
+ * Throttled properties are signalled at most once per interval. Changes
+ * within the interval are held back and sent together at its end. The
+ * value is read at that point, so the most recent one is what clients get.
+ */
+static gboolean throttle_property(struct generic_data *data,
+					struct interface_data *iface,
+					const GDBusPropertyTable *property)
+{
+	struct property_throttle *throttle = NULL;
+	gint64 now, elapsed;
+	GSList *l;
+
+	for (l = iface->throttled; l; l = l->next) {
+		struct property_throttle *t = l->data;
+
+		if (t->property == property) {
+			throttle = t;
+			break;
+		}
+	}
+
+	now = g_get_monotonic_time();
+
+	if (throttle == NULL) {
+		throttle = g_new0(struct property_throttle, 1);
+		throttle->data = data;
+		throttle->iface = iface;
+		throttle->property = property;
+		throttle->last = now;
+		iface->throttled = g_slist_prepend(iface->throttled, throttle);
+		return FALSE;
+	}
+
+	if (throttle->timeout > 0)
+		return TRUE;
+
+	elapsed = (now - throttle->last) / 1000;
+	if (elapsed >= PROPERTY_THROTTLE_INTERVAL) {
+		throttle->last = now;
+		return FALSE;
+	}
+
+	throttle->timeout = g_timeout_add(PROPERTY_THROTTLE_INTERVAL - elapsed,
+					property_throttle_timeout, throttle);
+
+	return TRUE;
+}
+
 void g_dbus_emit_property_changed(DBusConnection *connection,
 				const char *path, const char *interface,
 				const char *name)
@@ -1746,21 +1986,18 @@ void g_dbus_emit_property_changed(DBusConnection *connection,
 	if (root && g_slist_find(data->added, iface))
 		return;
 
-	property = find_property(iface->properties, name);
+	property = find_property(iface, name);
 	if (property == NULL) {
 		error("Could not find property %s in %p", name,
 							iface->properties);
 		return;
 	}
 
-	if (g_slist_find(iface->pending_prop, (void *) property) != NULL)
+	if (property->flags & G_DBUS_PROPERTY_FLAG_THROTTLED &&
+				throttle_property(data, iface, property))
 		return;
 
-	data->pending_prop = TRUE;
-	iface->pending_prop = g_slist_prepend(iface->pending_prop,
-						(void *) property);
-
-	add_pending(data);
+	queue_property_changed(data, iface, property);
 }
 
 gboolean g_dbus_get_properties(DBusConnection *connection, const char *path,
@@ -43,6 +43,15 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 static guint listener_id = 0;
 static GSList *listeners = NULL;
 
+/*
+ * Listeners are also indexed by signal member, with the ones matching any
+ * member kept apart, and by well-known sender name so that dispatching a
+ * signal and looking up a cached owner don't walk every listener.
+ */
+static GHashTable *member_index = NULL;
+static GSList *any_member = NULL;
+static GHashTable *name_index = NULL;
+
 struct service_data {
 	DBusConnection *conn;
 	DBusPendingCall *call;
@@ -119,6 +128,68 @@ static struct filter_data *filter_data_find_match(DBusConnection *connection,
 	return NULL;
 }
 
+static void index_add(GHashTable *index, const char *key,
+						struct filter_data *data)
+{
+	GSList *list = g_hash_table_lookup(index, key);
+
+	list = g_slist_append(list, data);
+	g_hash_table_insert(index, g_strdup(key), list);
+}
+
+static void index_remove(GHashTable *index, const char *key,
+						struct filter_data *data)
+{
+	GSList *list = g_hash_table_lookup(index, key);
+
+	list = g_slist_remove(list, data);
+	if (list)
+		g_hash_table_insert(index, g_strdup(key), list);
+	else
+		g_hash_table_remove(index, key);
+}
+
+static void listener_add(struct filter_data *data)
+{
+	if (member_index == NULL) {
+		member_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+		name_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+	}
+
+	listeners = g_slist_append(listeners, data);
+
+	if (data->member)
+		index_add(member_index, data->member, data);
+	else
+		any_member = g_slist_append(any_member, data);
+
+	if (data->name)
+		index_add(name_index, data->name, data);
+}
+
+static void listener_remove(struct filter_data *data)
+{
+	listeners = g_slist_remove(listeners, data);
+
+	if (data->member)
+		index_remove(member_index, data->member, data);
+	else
+		any_member = g_slist_remove(any_member, data);
+
+	if (data->name)
+		index_remove(name_index, data->name, data);
+
+	if (listeners != NULL)
+		return;
+
+	g_hash_table_destroy(member_index);
+	member_index = NULL;
+	g_hash_table_destroy(name_index);
+	name_index = NULL;
+}
+
 static struct filter_data *filter_data_find(DBusConnection *connection)
 {
 	GSList *current;
@@ -252,7 +323,7 @@ proceed:
 		return NULL;
 	}
 
-	listeners = g_slist_append(listeners, data);
+	listener_add(data);
 
 	return data;
 }
@@ -389,7 +460,7 @@ static gboolean filter_data_remove_callback(struct filter_data *data,
 	if (data->registered && !remove_match(data))
 		return FALSE;
 
-	listeners = g_slist_remove(listeners, data);
+	listener_remove(data);
 	filter_data_free(data);
 
 	return TRUE;
@@ -428,11 +499,12 @@ static void update_name_cache(const char *name, const char *owner)
 {
 	GSList *l;
 
-	for (l = listeners; l != NULL; l = l->next) {
-		struct filter_data *data = l->data;
+	if (name_index == NULL)
+		return;
 
-		if (g_strcmp0(data->name, name) != 0)
-			continue;
+	for (l = g_hash_table_lookup(name_index, name); l != NULL;
+								l = l->next) {
+		struct filter_data *data = l->data;
 
 		g_free(data->owner);
 		data->owner = g_strdup(owner);
@@ -443,16 +515,14 @@ static const char *check_name_cache(const char *name)
 {
 	GSList *l;
 
-	for (l = listeners; l != NULL; l = l->next) {
-		struct filter_data *data = l->data;
-
-		if (g_strcmp0(data->name, name) != 0)
-			continue;
+	if (name_index == NULL)
+		return NULL;
 
-		return data->owner;
-	}
+	l = g_hash_table_lookup(name_index, name);
+	if (l == NULL)
+		return NULL;
 
-	return NULL;
+	return ((struct filter_data *) l->data)->owner;
 }
 
 static DBusHandlerResult service_filter(DBusConnection *connection,
@@ -506,48 +576,69 @@ static DBusHandlerResult service_filter(DBusConnection *connection,
 }
 
 
-static DBusHandlerResult message_filter(DBusConnection *connection,
-					DBusMessage *message, void *user_data)
+static gboolean filter_data_match(struct filter_data *data,
+					DBusConnection *connection,
+					const char *sender, const char *path,
+					const char *iface, const char *member,
+					const char *arg)
 {
-	struct filter_data *data;
-	const char *sender, *path, *iface, *member, *arg = NULL;
-	GSList *current, *delete_listener = NULL;
+	if (connection != data->connection)
+		return FALSE;
 
-	/* Only filter signals */
-	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
-		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	if (data->owner && g_str_equal(sender, data->owner) == FALSE)
+		return FALSE;
 
-	sender = dbus_message_get_sender(message);
-	path = dbus_message_get_path(message);
-	iface = dbus_message_get_interface(message);
-	member = dbus_message_get_member(message);
-	dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &arg, DBUS_TYPE_INVALID);
+	if (data->path && g_str_equal(path, data->path) == FALSE)
+		return FALSE;
 
-	/* Sender is always the owner */
-	if (sender == NULL)
-		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	if (data->interface && g_str_equal(iface, data->interface) == FALSE)
+		return FALSE;
 
-	for (current = listeners; current != NULL; current = current->next) {
-		data = current->data;
+	if (data->member && g_str_equal(member, data->member) == FALSE)
+		return FALSE;
 
-		if (connection != data->connection)
-			continue;
+	if (data->argument && g_str_equal(arg, data->argument) == FALSE)
+		return FALSE;
 
-		if (data->owner && g_str_equal(sender, data->owner) == FALSE)
-			continue;
+	return TRUE;
+}
 
-		if (data->path && g_str_equal(path, data->path) == FALSE)
-			continue;
+static GSList *filter_data_collect(GSList *matches, GSList *list,
+					DBusConnection *connection,
+					const char *sender, const char *path,
+					const char *iface, const char *member,
+					const char *arg)
+{
+	for (; list != NULL; list = list->next) {
+		struct filter_data *data = list->data;
 
-		if (data->interface && g_str_equal(iface,
-						data->interface) == FALSE)
-			continue;
+		if (filter_data_match(data, connection, sender, path, iface,
+								member, arg))
+			matches = g_slist_prepend(matches, data);
+	}
 
-		if (data->member && g_str_equal(member, data->member) == FALSE)
-			continue;
+	return matches;
+}
 
-		if (data->argument && g_str_equal(arg,
-						data->argument) == FALSE)
+static GSList *filter_data_dispatch(GSList *delete_listener, GSList *matches,
+					gboolean any, DBusConnection *connection,
+					DBusMessage *message, const char *member)
+{
+	GSList *current;
+
+	for (current = matches; current != NULL; current = current->next) {
+		struct filter_data *data = current->data;
+		GSList *list;
+
+		/* Check if a previous handler removed this listener */
+		if (any)
+			list = any_member;
+		else if (member_index)
+			list = g_hash_table_lookup(member_index, member);
+		else
+			list = NULL;
+
+		if (!g_slist_find(list, data))
 			continue;
 
 		if (data->handle_func) {
@@ -562,24 +653,66 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 
 		if (!data->callbacks)
 			delete_listener = g_slist_prepend(delete_listener,
-								current);
+									data);
 	}
 
-	if (delete_listener == NULL)
+	return delete_listener;
+}
+
+static DBusHandlerResult message_filter(DBusConnection *connection,
+					DBusMessage *message, void *user_data)
+{
+	struct filter_data *data;
+	const char *sender, *path, *iface, *member, *arg = NULL;
+	GSList *current, *matches, *any_matches, *delete_listener = NULL;
+
+	/* Only filter signals */
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	sender = dbus_message_get_sender(message);
+	path = dbus_message_get_path(message);
+	iface = dbus_message_get_interface(message);
+	member = dbus_message_get_member(message);
+	dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &arg, DBUS_TYPE_INVALID);
+
+	/* Sender is always the owner */
+	if (sender == NULL || member_index == NULL)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (current = delete_listener; current != NULL;
-					current = delete_listener->next) {
-		GSList *l = current->data;
+	/*
+	 * Only listeners for this member, and those for any member, can
+	 * match. Collect them first since handlers may change the index.
+	 */
+	matches = NULL;
+	if (member)
+		matches = filter_data_collect(NULL,
+				g_hash_table_lookup(member_index, member),
+				connection, sender, path, iface, member, arg);
+	matches = g_slist_reverse(matches);
+
+	any_matches = filter_data_collect(NULL, any_member, connection,
+					sender, path, iface, member, arg);
+	any_matches = g_slist_reverse(any_matches);
+
+	delete_listener = filter_data_dispatch(delete_listener, matches, FALSE,
+						connection, message, member);
+	delete_listener = filter_data_dispatch(delete_listener, any_matches,
+					TRUE, connection, message, member);
+
+	g_slist_free(matches);
+	g_slist_free(any_matches);
 
-		data = l->data;
+	for (current = delete_listener; current != NULL;
+						current = current->next) {
+		data = current->data;
 
-		/* Has any other callback added callbacks back to this data? */
-		if (data->callbacks != NULL)
+		/* Has it been freed or had callbacks added back since? */
+		if (!g_slist_find(listeners, data) || data->callbacks != NULL)
 			continue;
 
 		remove_match(data);
-		listeners = g_slist_delete_link(listeners, l);
+		listener_remove(data);
 
 		filter_data_free(data);
 	}
@@ -811,7 +944,7 @@ void g_dbus_remove_all_watches(DBusConnection *connection)
 	struct filter_data *data;
 
 	while ((data = filter_data_find(connection))) {
-		listeners = g_slist_remove(listeners, data);
+		listener_remove(data);
 		filter_data_call_and_free(data);
 	}
 }
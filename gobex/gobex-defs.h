@@ -23,6 +23,7 @@
 #ifndef __GOBEX_DEFS_H
 #define __GOBEX_DEFS_H
 
+#include <sys/types.h>
 #include <glib.h>
 
 typedef enum {
@@ -46,6 +47,9 @@ typedef enum {
 typedef gssize (*GObexDataProducer) (void *buf, gsize len, gpointer user_data);
 typedef gboolean (*GObexDataConsumer) (const void *buf, gsize len,
 							gpointer user_data);
+/* Returns how many bytes, at most len, to send from fd starting at offset */
+typedef gssize (*GObexFdProducer) (gsize len, int *fd, off_t *offset,
+							gpointer user_data);
 
 #define G_OBEX_ERROR g_obex_error_quark()
 GQuark g_obex_error_quark(void);
@@ -306,6 +306,93 @@ void g_obex_header_free(GObexHeader *header)
 	g_free(header);
 }
 
+void g_obex_header_iter_init(GObexHeaderIter *iter, const void *data,
+								gsize len)
+{
+	iter->data = data;
+	iter->len = len;
+}
+
+/*
+ * Returns the next header without decoding it: unicode values are left as
+ * UTF-16BE without the terminating NUL and uint32 values in network order.
+ * FALSE with err unset means the end of the buffer was reached.
+ */
+gboolean g_obex_header_iter_next(GObexHeaderIter *iter, guint8 *id,
+					const guint8 **val, gsize *val_len,
+					GError **err)
+{
+	const guint8 *ptr = iter->data;
+	guint16 hdr_len;
+
+	if (iter->len == 0)
+		return FALSE;
+
+	if (iter->len < 2) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_PARSE_ERROR,
+						"Too short header in packet");
+		return FALSE;
+	}
+
+	*id = ptr[0];
+
+	switch (G_OBEX_HDR_ENC(*id)) {
+	case G_OBEX_HDR_ENC_UNICODE:
+	case G_OBEX_HDR_ENC_BYTES:
+		if (iter->len < 3)
+			goto short_header;
+
+		get_bytes(&hdr_len, ptr + 1, sizeof(hdr_len));
+		hdr_len = g_ntohs(hdr_len);
+		if (hdr_len > iter->len || hdr_len < 3)
+			goto invalid_length;
+
+		*val = ptr + 3;
+		*val_len = hdr_len - 3;
+
+		if (G_OBEX_HDR_ENC(*id) != G_OBEX_HDR_ENC_UNICODE ||
+								hdr_len == 3)
+			break;
+
+		if (hdr_len < 5)
+			goto invalid_length;
+
+		*val_len -= 2;
+		break;
+	case G_OBEX_HDR_ENC_UINT8:
+		hdr_len = 2;
+		*val = ptr + 1;
+		*val_len = 1;
+		break;
+	case G_OBEX_HDR_ENC_UINT32:
+		if (iter->len < 5)
+			goto short_header;
+
+		hdr_len = 5;
+		*val = ptr + 1;
+		*val_len = 4;
+		break;
+	default:
+		g_assert_not_reached();
+	}
+
+	iter->data += hdr_len;
+	iter->len -= hdr_len;
+
+	return TRUE;
+
+short_header:
+	g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_PARSE_ERROR,
+				"Not enough data for header (0x%02x)", *id);
+	return FALSE;
+
+invalid_length:
+	g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_PARSE_ERROR,
+				"Invalid header (0x%02x) length (%u)",
+				*id, hdr_len);
+	return FALSE;
+}
+
 gboolean g_obex_header_get_unicode(GObexHeader *header, const char **str)
 {
 	g_obex_debug(G_OBEX_DEBUG_HEADER, "header 0x%02x",
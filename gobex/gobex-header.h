@@ -74,6 +74,12 @@
 
 typedef struct _GObexHeader GObexHeader;
 
+/* Walks encoded headers in place, values point into the iterated buffer */
+typedef struct _GObexHeaderIter {
+	const guint8 *data;
+	gsize len;
+} GObexHeaderIter;
+
 gboolean g_obex_header_get_unicode(GObexHeader *header, const char **str);
 gboolean g_obex_header_get_bytes(GObexHeader *header, const guint8 **val,
 								gsize *len);
@@ -100,4 +106,10 @@ GObexHeader *g_obex_header_decode(const void *data, gsize len,
 				GError **err);
 void g_obex_header_free(GObexHeader *header);
 
+void g_obex_header_iter_init(GObexHeaderIter *iter, const void *data,
+								gsize len);
+gboolean g_obex_header_iter_next(GObexHeaderIter *iter, guint8 *id,
+					const guint8 **val, gsize *val_len,
+					GError **err);
+
 #endif /* __GOBEX_HEADER_H */
@@ -48,16 +48,28 @@ struct _GObexPacket {
 	gsize hlen;		/* Length of all encoded headers */
 	GSList *headers;
 
+	/* Received headers left in the G_OBEX_DATA_REF buffer; headers then
+	 * only caches the ones looked up so far */
+	const guint8 *hdr_ref;
+
 	GObexDataProducer get_body;
+	GObexFdProducer get_body_fd;
 	gpointer get_body_data;
+
+	/* Body left out of the encoded buffer by a fd producer */
+	int body_fd;
+	off_t body_offset;
+	gsize body_len;
 };
 
-GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id)
+static gboolean parse_headers(GObexPacket *pkt, const void *data, gsize len,
+						GObexDataPolicy data_policy,
+						GError **err);
+
+static GObexHeader *find_header(GObexPacket *pkt, guint8 id)
 {
 	GSList *l;
 
-	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
-
 	for (l = pkt->headers; l != NULL; l = g_slist_next(l)) {
 		GObexHeader *hdr = l->data;
 
@@ -68,6 +80,78 @@ GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id)
 	return NULL;
 }
 
+static const guint8 *find_header_ref(GObexPacket *pkt, guint8 id,
+					const guint8 **val, gsize *val_len,
+					gsize *hdr_len)
+{
+	GObexHeaderIter iter;
+	const guint8 *start;
+	guint8 hdr_id;
+
+	g_obex_header_iter_init(&iter, pkt->hdr_ref, pkt->hlen);
+
+	for (start = iter.data; g_obex_header_iter_next(&iter, &hdr_id, val,
+						val_len, NULL); start = iter.data) {
+		if (hdr_id != id)
+			continue;
+
+		if (hdr_len)
+			*hdr_len = iter.data - start;
+
+		return start;
+	}
+
+	return NULL;
+}
+
+/* Turns the referenced headers into a full header list before the packet
+ * gets modified or re-encoded */
+static gboolean load_headers(GObexPacket *pkt)
+{
+	const guint8 *buf = pkt->hdr_ref;
+	gsize len = pkt->hlen;
+
+	if (buf == NULL)
+		return TRUE;
+
+	g_slist_foreach(pkt->headers, (GFunc) g_obex_header_free, NULL);
+	g_slist_free(pkt->headers);
+	pkt->headers = NULL;
+	pkt->hdr_ref = NULL;
+	pkt->hlen = 0;
+
+	return parse_headers(pkt, buf, len, G_OBEX_DATA_REF, NULL);
+}
+
+GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id)
+{
+	GObexHeader *hdr;
+	const guint8 *start, *val;
+	gsize val_len, hdr_len, parsed;
+	GError *err = NULL;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	hdr = find_header(pkt, id);
+	if (hdr != NULL || pkt->hdr_ref == NULL)
+		return hdr;
+
+	start = find_header_ref(pkt, id, &val, &val_len, &hdr_len);
+	if (start == NULL)
+		return NULL;
+
+	hdr = g_obex_header_decode(start, hdr_len, G_OBEX_DATA_REF, &parsed,
+									&err);
+	if (hdr == NULL) {
+		g_error_free(err);
+		return NULL;
+	}
+
+	pkt->headers = g_slist_append(pkt->headers, hdr);
+
+	return hdr;
+}
+
 GObexHeader *g_obex_packet_get_body(GObexPacket *pkt)
 {
 	GObexHeader *body;
@@ -81,6 +165,35 @@ GObexHeader *g_obex_packet_get_body(GObexPacket *pkt)
 	return g_obex_packet_get_header(pkt, G_OBEX_HDR_BODY_END);
 }
 
+gboolean g_obex_packet_get_bytes(GObexPacket *pkt, guint8 id,
+					const guint8 **val, gsize *len)
+{
+	GObexHeader *hdr;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	/* Byte sequences need no conversion, hand out the received data */
+	if (pkt->hdr_ref != NULL && (id & 0xc0) == 0x40)
+		return find_header_ref(pkt, id, val, len, NULL) != NULL;
+
+	hdr = g_obex_packet_get_header(pkt, id);
+	if (hdr == NULL)
+		return FALSE;
+
+	return g_obex_header_get_bytes(hdr, val, len);
+}
+
+gboolean g_obex_packet_get_body_bytes(GObexPacket *pkt, const guint8 **val,
+								gsize *len)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (g_obex_packet_get_bytes(pkt, G_OBEX_HDR_BODY, val, len))
+		return TRUE;
+
+	return g_obex_packet_get_bytes(pkt, G_OBEX_HDR_BODY_END, val, len);
+}
+
 guint8 g_obex_packet_get_operation(GObexPacket *pkt, gboolean *final)
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
@@ -95,6 +208,9 @@ gboolean g_obex_packet_prepend_header(GObexPacket *pkt, GObexHeader *header)
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
+	if (!load_headers(pkt))
+		return FALSE;
+
 	pkt->headers = g_slist_prepend(pkt->headers, header);
 	pkt->hlen += g_obex_header_get_length(header);
 
@@ -105,6 +221,9 @@ gboolean g_obex_packet_add_header(GObexPacket *pkt, GObexHeader *header)
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
+	if (!load_headers(pkt))
+		return FALSE;
+
 	pkt->headers = g_slist_append(pkt->headers, header);
 	pkt->hlen += g_obex_header_get_length(header);
 
@@ -116,7 +235,7 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
-	if (pkt->get_body != NULL)
+	if (pkt->get_body != NULL || pkt->get_body_fd != NULL)
 		return FALSE;
 
 	pkt->get_body = func;
@@ -125,6 +244,31 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 	return TRUE;
 }
 
+gboolean g_obex_packet_add_body_fd(GObexPacket *pkt, GObexFdProducer func,
+							gpointer user_data)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->get_body != NULL || pkt->get_body_fd != NULL)
+		return FALSE;
+
+	pkt->get_body_fd = func;
+	pkt->get_body_data = user_data;
+
+	return TRUE;
+}
+
+gsize g_obex_packet_get_body_fd(GObexPacket *pkt, int *fd, off_t *offset)
+{
+	if (pkt->body_len == 0)
+		return 0;
+
+	*fd = pkt->body_fd;
+	*offset = pkt->body_offset;
+
+	return pkt->body_len;
+}
+
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str)
 {
@@ -305,6 +449,36 @@ static gboolean parse_headers(GObexPacket *pkt, const void *data, gsize len,
 	return TRUE;
 }
 
+/* Validates the headers without decoding them, see g_obex_packet_get_header */
+static gboolean check_headers(GObexPacket *pkt, const void *data, gsize len,
+								GError **err)
+{
+	GObexHeaderIter iter;
+	const guint8 *val;
+	gsize val_len;
+	guint8 id;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	g_obex_header_iter_init(&iter, data, len);
+
+	while (g_obex_header_iter_next(&iter, &id, &val, &val_len, err))
+		;
+
+	if (err != NULL && *err != NULL) {
+		g_obex_debug(G_OBEX_DEBUG_ERROR, "%s", (*err)->message);
+		return FALSE;
+	}
+
+	if (iter.len > 0)
+		return FALSE;
+
+	pkt->hdr_ref = data;
+	pkt->hlen = len;
+
+	return TRUE;
+}
+
 static const guint8 *get_bytes(void *to, const guint8 *from, gsize count)
 {
 	memcpy(to, from, count);
@@ -368,6 +542,13 @@ GObexPacket *g_obex_packet_decode(const void *data, gsize len,
 	buf += header_offset;
 
 headers:
+	if (data_policy == G_OBEX_DATA_REF) {
+		if (!check_headers(pkt, buf, len - (3 + header_offset), err))
+			goto failed;
+
+		return pkt;
+	}
+
 	if (!parse_headers(pkt, buf, len - (3 + header_offset),
 							data_policy, err))
 		goto failed;
@@ -379,9 +560,21 @@ failed:
 	return NULL;
 }
 
-static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+static void encode_body_header(guint8 *buf, gssize len)
 {
 	guint16 u16;
+
+	if (len > 0)
+		buf[0] = G_OBEX_HDR_BODY;
+	else
+		buf[0] = G_OBEX_HDR_BODY_END;
+
+	u16 = g_htons(len + 3);
+	memcpy(&buf[1], &u16, sizeof(u16));
+}
+
+static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+{
 	gssize ret;
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
@@ -393,17 +586,37 @@ static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
 	if (ret < 0)
 		return ret;
 
-	if (ret > 0)
-		buf[0] = G_OBEX_HDR_BODY;
-	else
-		buf[0] = G_OBEX_HDR_BODY_END;
+	encode_body_header(buf, ret);
 
-	u16 = g_htons(ret + 3);
-	memcpy(&buf[1], &u16, sizeof(u16));
+	return ret;
+}
+
+static gssize get_body_fd(GObexPacket *pkt, guint8 *buf, gsize len)
+{
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (len < 3)
+		return -ENOBUFS;
+
+	ret = pkt->get_body_fd(len - 3, &pkt->body_fd, &pkt->body_offset,
+							pkt->get_body_data);
+	if (ret < 0)
+		return ret;
+
+	pkt->body_len = ret;
+
+	encode_body_header(buf, ret);
 
 	return ret;
 }
 
+/*
+ * With a fd producer only the headers are encoded in buf and the return
+ * value doesn't include the body, which the caller must send from the
+ * fd returned by g_obex_packet_get_body_fd() right after buf.
+ */
 gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 {
 	gssize ret;
@@ -413,6 +626,9 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
+	if (!load_headers(pkt))
+		return -EBADMSG;
+
 	if (3 + pkt->data_len + pkt->hlen > len)
 		return -ENOBUFS;
 
@@ -453,6 +669,20 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 		}
 
 		count += ret + 3;
+	} else if (pkt->get_body_fd) {
+		ret = get_body_fd(pkt, buf + count, len - count);
+		if (ret < 0)
+			return ret;
+		if (ret == 0) {
+			if (pkt->opcode == G_OBEX_RSP_CONTINUE)
+				buf[0] = G_OBEX_RSP_SUCCESS;
+			buf[0] |= FINAL_BIT;
+		}
+
+		u16 = g_htons(count + 3 + ret);
+		memcpy(&buf[1], &u16, sizeof(u16));
+
+		return count + 3;
 	}
 
 	u16 = g_htons(count);
@@ -83,11 +83,18 @@ typedef struct _GObexPacket GObexPacket;
 
 GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id);
 GObexHeader *g_obex_packet_get_body(GObexPacket *pkt);
+gboolean g_obex_packet_get_bytes(GObexPacket *pkt, guint8 id,
+					const guint8 **val, gsize *len);
+gboolean g_obex_packet_get_body_bytes(GObexPacket *pkt, const guint8 **val,
+								gsize *len);
 guint8 g_obex_packet_get_operation(GObexPacket *pkt, gboolean *final);
 gboolean g_obex_packet_prepend_header(GObexPacket *pkt, GObexHeader *header);
 gboolean g_obex_packet_add_header(GObexPacket *pkt, GObexHeader *header);
 gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 							gpointer user_data);
+gboolean g_obex_packet_add_body_fd(GObexPacket *pkt, GObexFdProducer func,
+							gpointer user_data);
+gsize g_obex_packet_get_body_fd(GObexPacket *pkt, int *fd, off_t *offset);
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str);
 gboolean g_obex_packet_add_bytes(GObexPacket *pkt, guint8 id,
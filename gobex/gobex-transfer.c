@@ -50,6 +50,7 @@ struct transfer {
 	guint abort_id;
 
 	GObexDataProducer data_producer;
+	GObexFdProducer fd_producer;
 	GObexDataConsumer data_consumer;
 	GObexFunc complete_func;
 
@@ -125,15 +126,23 @@ static void transfer_abort_response(GObex *obex, GError *err, GObexPacket *rsp,
 	g_error_free(err);
 }
 
+static gssize put_get_data(void *buf, gsize len, gpointer user_data);
+static gssize put_get_fd(gsize len, int *fd, off_t *offset,
+							gpointer user_data);
 
-static gssize put_get_data(void *buf, gsize len, gpointer user_data)
+static void transfer_add_body(struct transfer *transfer, GObexPacket *req)
+{
+	if (transfer->fd_producer)
+		g_obex_packet_add_body_fd(req, put_get_fd, transfer);
+	else
+		g_obex_packet_add_body(req, put_get_data, transfer);
+}
+
+static gssize put_get_next(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req;
 	GError *err = NULL;
-	gssize ret;
 
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret == 0 || ret == -EAGAIN)
 		return ret;
 
@@ -145,7 +154,7 @@ static gssize put_get_data(void *buf, gsize len, gpointer user_data)
 		/* Generate next packet */
 		req = g_obex_packet_new(transfer->opcode, FALSE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(req, put_get_data, transfer);
+		transfer_add_body(transfer, req);
 		transfer->req_id = g_obex_send_req(transfer->obex, req, -1,
 						transfer_response, transfer,
 						&err);
@@ -163,19 +172,35 @@ done:
 	return ret;
 }
 
+static gssize put_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->data_producer(buf, len, transfer->user_data);
+
+	return put_get_next(transfer, ret);
+}
+
+static gssize put_get_fd(gsize len, int *fd, off_t *offset,
+							gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	ret = transfer->fd_producer(len, fd, offset, transfer->user_data);
+
+	return put_get_next(transfer, ret);
+}
+
 static gboolean handle_get_body(struct transfer *transfer, GObexPacket *rsp,
 								GError **err)
 {
-	GObexHeader *body = g_obex_packet_get_body(rsp);
 	gboolean ret;
 	const guint8 *buf;
 	gsize len;
 
-	if (body == NULL)
-		return TRUE;
-
-	g_obex_header_get_bytes(body, &buf, &len);
-	if (len == 0)
+	if (!g_obex_packet_get_body_bytes(rsp, &buf, &len) || len == 0)
 		return TRUE;
 
 	ret = transfer->data_consumer(buf, len, transfer->user_data);
@@ -225,7 +250,7 @@ static void transfer_response(GObex *obex, GError *err, GObexPacket *rsp,
 	if (transfer->opcode == G_OBEX_OP_PUT) {
 		req = g_obex_packet_new(transfer->opcode, FALSE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(req, put_get_data, transfer);
+		transfer_add_body(transfer, req);
 	} else if (!g_obex_srm_active(transfer->obex)) {
 		req = g_obex_packet_new(transfer->opcode, TRUE,
 							G_OBEX_HDR_INVALID);
@@ -294,6 +319,34 @@ guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
 	return transfer->id;
 }
 
+guint g_obex_put_req_pkt_fd(GObex *obex, GObexPacket *req,
+			GObexFdProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	if (g_obex_packet_get_operation(req, NULL) != G_OBEX_OP_PUT)
+		return 0;
+
+	transfer = transfer_new(obex, G_OBEX_OP_PUT, complete_func, user_data);
+	transfer->fd_producer = data_func;
+
+	g_obex_packet_add_body_fd(req, put_get_fd, transfer);
+
+	transfer->req_id = g_obex_send_req(obex, req, FIRST_PACKET_TIMEOUT,
+					transfer_response, transfer, err);
+	if (transfer->req_id == 0) {
+		transfer_free(transfer);
+		return 0;
+	}
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	return transfer->id;
+}
+
 guint g_obex_put_req(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint8 first_hdr_id, ...)
@@ -331,7 +384,6 @@ static void transfer_abort_req(GObex *obex, GObexPacket *req, gpointer user_data
 
 static guint8 put_get_bytes(struct transfer *transfer, GObexPacket *req)
 {
-	GObexHeader *body;
 	gboolean final;
 	guint8 rsp;
 	const guint8 *buf;
@@ -345,12 +397,7 @@ static guint8 put_get_bytes(struct transfer *transfer, GObexPacket *req)
 	else
 		rsp = G_OBEX_RSP_CONTINUE;
 
-	body = g_obex_packet_get_body(req);
-	if (body == NULL)
-		return rsp;
-
-	g_obex_header_get_bytes(body, &buf, &len);
-	if (len == 0)
+	if (!g_obex_packet_get_body_bytes(req, &buf, &len) || len == 0)
 		return rsp;
 
 	if (transfer->data_consumer(buf, len, transfer->user_data) == FALSE)
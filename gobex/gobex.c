@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include "gobex.h"
 #include "gobex-debug.h"
@@ -35,6 +37,9 @@
 #define G_OBEX_MINIMUM_MTU	255
 #define G_OBEX_MAXIMUM_MTU	65535
 
+/* Maximum number of SRM packets encoded or written ahead at once */
+#define G_OBEX_TX_RING_MAX	8
+
 #define G_OBEX_DEFAULT_TIMEOUT	10
 #define G_OBEX_ABORT_TIMEOUT	5
 
@@ -77,6 +82,12 @@ struct _GObex {
 	guint8 *tx_buf;
 	size_t tx_data;
 	size_t tx_sent;
+	guint tx_ring;
+
+	/* Packet body still to be sent from a file after tx_buf */
+	int tx_fd;
+	off_t tx_fd_offset;
+	size_t tx_fd_len;
 
 	gboolean suspended;
 	gboolean use_srm;
@@ -267,15 +278,78 @@ static gboolean req_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static gboolean load_body(GObex *obex, size_t len, GError **err)
+{
+	ssize_t ret;
+
+	ret = pread(obex->tx_fd, &obex->tx_buf[obex->tx_sent + obex->tx_data],
+						len, obex->tx_fd_offset);
+	if (ret <= 0) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+					"Unable to read body: %s",
+					ret < 0 ? strerror(errno) : "EOF");
+		return FALSE;
+	}
+
+	obex->tx_fd_offset += ret;
+	obex->tx_fd_len -= ret;
+	obex->tx_data += ret;
+
+	return TRUE;
+}
+
+static gboolean write_body(GObex *obex, GError **err)
+{
+	ssize_t ret;
+	int sk;
+
+	sk = g_io_channel_unix_get_fd(obex->io);
+
+	ret = sendfile(sk, obex->tx_fd, &obex->tx_fd_offset, obex->tx_fd_len);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+
+		if (errno != EINVAL && errno != ENOSYS) {
+			g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+					"sendfile: %s", strerror(errno));
+			return FALSE;
+		}
+
+		/* The fd can't be sent directly, fall back to a copy */
+		obex->tx_sent = 0;
+		return load_body(obex, MIN(obex->tx_fd_len, obex->tx_mtu), err);
+	}
+
+	if (ret == 0) {
+		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_FAILED,
+						"Unable to read body: EOF");
+		return FALSE;
+	}
+
+	g_obex_debug(G_OBEX_DEBUG_DATA, "< %zd body bytes from fd %d", ret,
+								obex->tx_fd);
+
+	obex->tx_fd_len -= ret;
+
+	return TRUE;
+}
+
 static gboolean write_stream(GObex *obex, GError **err)
 {
 	GIOStatus status;
 	gsize bytes_written;
 	char *buf;
 
+	if (obex->tx_data == 0)
+		return write_body(obex, err);
+
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
+	if (status == G_IO_STATUS_AGAIN)
+		return TRUE;
+
 	if (status != G_IO_STATUS_NORMAL)
 		return FALSE;
 
@@ -296,6 +370,9 @@ static gboolean write_packet(GObex *obex, GError **err)
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
+	if (status == G_IO_STATUS_AGAIN)
+		return TRUE;
+
 	if (status != G_IO_STATUS_NORMAL)
 		return FALSE;
 
@@ -428,64 +505,157 @@ static void setup_srm(GObex *obex, GObexPacket *pkt, gboolean outgoing)
 		check_srm_final(obex, op);
 }
 
-static gboolean write_data(GIOChannel *io, GIOCondition cond,
-							gpointer user_data)
+static void setup_tx_ring(GObex *obex)
 {
-	GObex *obex = user_data;
+	int sk, sndbuf;
+	socklen_t len = sizeof(sndbuf);
 
-	if (cond & G_IO_NVAL)
-		return FALSE;
+	obex->tx_ring = 1;
 
-	if (cond & (G_IO_HUP | G_IO_ERR))
-		goto stop_tx;
+	/* Size the ring so it doesn't outgrow the socket send buffer */
+	sk = g_io_channel_unix_get_fd(obex->io);
+	if (getsockopt(sk, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0)
+		obex->tx_ring = CLAMP(sndbuf / obex->tx_mtu, 1,
+							G_OBEX_TX_RING_MAX);
 
-	if (obex->tx_data == 0) {
-		struct pending_pkt *p = g_queue_pop_head(obex->tx_queue);
-		ssize_t len;
+	if (obex->write == write_stream)
+		obex->tx_buf = g_realloc(obex->tx_buf,
+					obex->tx_mtu * obex->tx_ring);
+	else
+		obex->tx_buf = g_realloc(obex->tx_buf, obex->tx_mtu);
+}
 
-		if (p == NULL)
-			goto stop_tx;
+enum {
+	TX_READY,
+	TX_DROPPED,
+	TX_STOP,
+};
 
-		setup_srm(obex, p->pkt, TRUE);
+static int encode_packet(GObex *obex, gboolean ahead)
+{
+	struct pending_pkt *p = g_queue_pop_head(obex->tx_queue);
+	guint8 *buf;
+	ssize_t len;
 
-		if (g_obex_srm_enabled(obex))
-			goto encode;
+	if (p == NULL)
+		return TX_STOP;
 
-		/* Can't send a request while there's a pending one */
-		if (obex->pending_req && p->id > 0) {
-			g_queue_push_head(obex->tx_queue, p);
-			goto stop_tx;
-		}
+	setup_srm(obex, p->pkt, TRUE);
+
+	if (g_obex_srm_enabled(obex))
+		goto encode;
+
+	/* Can't send a request while there's a pending one */
+	if (obex->pending_req && p->id > 0) {
+		g_queue_push_head(obex->tx_queue, p);
+		return TX_STOP;
+	}
 
 encode:
-		len = g_obex_packet_encode(p->pkt, obex->tx_buf, obex->tx_mtu);
-		if (len == -EAGAIN) {
-			g_queue_push_head(obex->tx_queue, p);
+	buf = &obex->tx_buf[obex->tx_sent + obex->tx_data];
+
+	len = g_obex_packet_encode(p->pkt, buf, obex->tx_mtu);
+	if (len == -EAGAIN) {
+		g_queue_push_head(obex->tx_queue, p);
+		/* Let the data already encoded go out before suspending */
+		if (!ahead)
 			g_obex_suspend(obex);
-			goto stop_tx;
-		}
+		return TX_STOP;
+	}
 
-		if (len < 0) {
-			pending_pkt_free(p);
-			goto done;
-		}
+	if (len < 0) {
+		pending_pkt_free(p);
+		return TX_DROPPED;
+	}
 
-		if (p->id > 0) {
-			if (obex->pending_req != NULL)
-				pending_pkt_free(obex->pending_req);
-			obex->pending_req = p;
-			p->timeout_id = g_timeout_add_seconds(p->timeout,
+	obex->tx_data += len;
+	obex->tx_fd_len = g_obex_packet_get_body_fd(p->pkt, &obex->tx_fd,
+							&obex->tx_fd_offset);
+
+	/* Packet based transports need the whole packet in one write */
+	while (obex->tx_fd_len > 0 && obex->write == write_packet) {
+		if (load_body(obex, obex->tx_fd_len, NULL))
+			continue;
+
+		obex->tx_data -= len;
+		obex->tx_fd_len = 0;
+		pending_pkt_free(p);
+		return TX_DROPPED;
+	}
+
+	if (p->id > 0) {
+		if (obex->pending_req != NULL)
+			pending_pkt_free(obex->pending_req);
+		obex->pending_req = p;
+		p->timeout_id = g_timeout_add_seconds(p->timeout,
 							req_timeout, obex);
-		} else {
-			/* During packet encode final bit can be set */
-			if (obex->tx_buf[0] & FINAL_BIT)
-				check_srm_final(obex,
-						obex->tx_buf[0] & ~FINAL_BIT);
-			pending_pkt_free(p);
-		}
+	} else {
+		/* During packet encode final bit can be set */
+		if (buf[0] & FINAL_BIT)
+			check_srm_final(obex, buf[0] & ~FINAL_BIT);
+		pending_pkt_free(p);
+	}
+
+	return TX_READY;
+}
+
+static gboolean tx_ring_ready(GObex *obex, guint count)
+{
+	if (count >= obex->tx_ring)
+		return FALSE;
+
+	/* Without SRM every packet waits for its response */
+	if (!g_obex_srm_enabled(obex))
+		return FALSE;
+
+	return !g_queue_is_empty(obex->tx_queue);
+}
+
+static void encode_ahead(GObex *obex)
+{
+	guint count;
+
+	/*
+	 * With SRM no response is expected in between packets so stream
+	 * transports encode the following ones right after the first and
+	 * flush them all with a single write.
+	 */
+	for (count = 1; tx_ring_ready(obex, count); count++) {
+		if (obex->tx_fd_len > 0)
+			break;
+
+		if (encode_packet(obex, TRUE) == TX_STOP)
+			break;
+	}
+}
+
+static gboolean write_data(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	GObex *obex = user_data;
+	guint count = 0;
 
-		obex->tx_data = len;
+	if (cond & G_IO_NVAL)
+		return FALSE;
+
+	if (cond & (G_IO_HUP | G_IO_ERR))
+		goto stop_tx;
+
+next:
+	if (obex->tx_data == 0 && obex->tx_fd_len == 0) {
 		obex->tx_sent = 0;
+
+		switch (encode_packet(obex, count > 0)) {
+		case TX_STOP:
+			if (count > 0)
+				goto done;
+			goto stop_tx;
+		case TX_DROPPED:
+			goto done;
+		}
+
+		if (obex->write == write_stream)
+			encode_ahead(obex);
 	}
 
 	if (obex->suspended) {
@@ -496,13 +666,20 @@ encode:
 	if (!obex->write(obex, NULL))
 		goto stop_tx;
 
+	/* Packets can't be merged, so write several per wakeup instead */
+	if (obex->write == write_packet && obex->tx_data == 0 &&
+						tx_ring_ready(obex, ++count))
+		goto next;
+
 done:
-	if (obex->tx_data > 0 || g_queue_get_length(obex->tx_queue) > 0)
+	if (obex->tx_data > 0 || obex->tx_fd_len > 0 ||
+				g_queue_get_length(obex->tx_queue) > 0)
 		return TRUE;
 
 stop_tx:
 	obex->rx_last_op = G_OBEX_OP_NONE;
 	obex->tx_data = 0;
+	obex->tx_fd_len = 0;
 	obex->write_source = 0;
 	return FALSE;
 }
@@ -1052,7 +1229,7 @@ static void parse_connect_data(GObex *obex, GObexPacket *pkt)
 	obex->tx_mtu = g_ntohs(u16);
 	if (obex->io_tx_mtu > 0 && obex->tx_mtu > obex->io_tx_mtu)
 		obex->tx_mtu = obex->io_tx_mtu;
-	obex->tx_buf = g_realloc(obex->tx_buf, obex->tx_mtu);
+	setup_tx_ring(obex);
 
 	hdr = g_obex_packet_get_header(pkt, G_OBEX_HDR_CONNECTION);
 	if (hdr)
@@ -1469,7 +1646,6 @@ GObex *g_obex_new(GIOChannel *io, GObexTransportType transport_type,
 
 	obex->tx_queue = g_queue_new();
 	obex->rx_buf = g_malloc(obex->rx_mtu);
-	obex->tx_buf = g_malloc(obex->tx_mtu);
 
 	switch (transport_type) {
 	case G_OBEX_TRANSPORT_STREAM:
@@ -1486,6 +1662,8 @@ GObex *g_obex_new(GIOChannel *io, GObexTransportType transport_type,
 		return NULL;
 	}
 
+	setup_tx_ring(obex);
+
 	g_io_channel_set_encoding(io, NULL, NULL);
 	g_io_channel_set_buffered(io, FALSE);
 	cond = G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL;
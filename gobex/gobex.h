@@ -107,6 +107,9 @@ guint g_obex_put_req(GObex *obex, GObexDataProducer data_func,
 guint g_obex_put_req_pkt(GObex *obex, GObexPacket *req,
 			GObexDataProducer data_func, GObexFunc complete_func,
 			gpointer user_data, GError **err);
+guint g_obex_put_req_pkt_fd(GObex *obex, GObexPacket *req,
+			GObexFdProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err);
 
 guint g_obex_get_req(GObex *obex, GObexDataConsumer data_func,
 			GObexFunc complete_func, gpointer user_data,
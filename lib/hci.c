@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <sys/param.h>
 #include <sys/uio.h>
@@ -1242,6 +1243,254 @@ done:
 	return 0;
 }
 
+struct batch_state {
+	uint16_t opcode;
+	uint8_t stage;
+};
+
+#define BATCH_PENDING	0
+#define BATCH_STATUS	1
+#define BATCH_DONE	2
+
+static int batch_find(struct hci_request *r, struct batch_state *s,
+					int count, uint8_t evt, const void *ptr,
+					int len)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (s[i].stage == BATCH_DONE || r[i].event != evt)
+			continue;
+
+		/* LE subevents share the numbering space, don't match
+		 * their payload against BR/EDR event layouts */
+		if (!ptr)
+			return i;
+
+		switch (evt) {
+		case EVT_REMOTE_NAME_REQ_COMPLETE:
+			if (len < 7 || bacmp(ptr + 1, r[i].cparam))
+				continue;
+			break;
+		case EVT_READ_REMOTE_FEATURES_COMPLETE:
+		case EVT_READ_REMOTE_VERSION_COMPLETE:
+		case EVT_READ_REMOTE_EXT_FEATURES_COMPLETE:
+		case EVT_READ_CLOCK_OFFSET_COMPLETE:
+			/* Status followed by the connection handle, which
+			 * is also the first command parameter */
+			if (len < 3 || r[i].clen < 2 ||
+					memcmp(ptr + 1, r[i].cparam, 2))
+				continue;
+			break;
+		}
+
+		return i;
+	}
+
+	return -1;
+}
+
+static void batch_complete(struct hci_request *r, struct batch_state *s,
+					const void *ptr, int len, int *done)
+{
+	if (len < 0)
+		len = 0;
+
+	r->rlen = MIN(len, r->rlen);
+	memcpy(r->rparam, ptr, r->rlen);
+	s->stage = BATCH_DONE;
+	(*done)++;
+}
+
+static void batch_fail(struct hci_request *r, struct batch_state *s,
+								int *done)
+{
+	r->rlen = 0;
+	s->stage = BATCH_DONE;
+	(*done)++;
+}
+
+static long batch_elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000 +
+				(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Issue several requests at once and collect their results as the events
+ * arrive, instead of waiting for each one in turn as hci_send_req does.
+ * The kernel queues the commands and paces them against the controller's
+ * command credits, so long running operations like remote name requests
+ * overlap in the air. Completion events are matched back to their request
+ * by bdaddr or connection handle where the event carries one, otherwise in
+ * submission order.
+ *
+ * The timeout covers the whole batch. Requests that fail or are still
+ * outstanding when it expires have their rlen set to 0. Returns the number
+ * of requests that completed successfully, or -1 on socket errors.
+ */
+int hci_send_req_batch(int dd, struct hci_request *r, int count, int to)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE], *ptr;
+	struct batch_state *s;
+	struct hci_filter nf, of;
+	struct timespec start;
+	socklen_t olen;
+	hci_event_hdr *hdr;
+	int i, err, done = 0, ok = 0;
+
+	if (count <= 0)
+		return 0;
+
+	s = calloc(count, sizeof(*s));
+	if (!s)
+		return -1;
+
+	olen = sizeof(of);
+	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &of, &olen) < 0) {
+		free(s);
+		return -1;
+	}
+
+	/* No opcode filter here since several commands are in flight */
+	hci_filter_clear(&nf);
+	hci_filter_set_ptype(HCI_EVENT_PKT,  &nf);
+	hci_filter_set_event(EVT_CMD_STATUS, &nf);
+	hci_filter_set_event(EVT_CMD_COMPLETE, &nf);
+	hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+	for (i = 0; i < count; i++)
+		hci_filter_set_event(r[i].event, &nf);
+	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0)
+		goto failed;
+
+	for (i = 0; i < count; i++) {
+		s[i].opcode = htobs(cmd_opcode_pack(r[i].ogf, r[i].ocf));
+
+		if (hci_send_cmd(dd, r[i].ogf, r[i].ocf, r[i].clen,
+							r[i].cparam) < 0)
+			batch_fail(&r[i], &s[i], &done);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (done < count) {
+		evt_cmd_complete *cc;
+		evt_cmd_status *cs;
+		evt_le_meta_event *me;
+		int len;
+
+		if (to) {
+			struct pollfd p;
+			long left;
+			int n;
+
+			left = to - batch_elapsed(&start);
+			if (left <= 0)
+				break;
+
+			p.fd = dd; p.events = POLLIN;
+			while ((n = poll(&p, 1, left)) < 0) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				goto failed;
+			}
+
+			if (!n)
+				break;
+		}
+
+		while ((len = read(dd, buf, sizeof(buf))) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			goto failed;
+		}
+
+		hdr = (void *) (buf + 1);
+		ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
+		len -= (1 + HCI_EVENT_HDR_SIZE);
+
+		switch (hdr->evt) {
+		case EVT_CMD_STATUS:
+			cs = (void *) ptr;
+
+			for (i = 0; i < count; i++) {
+				if (s[i].stage == BATCH_PENDING &&
+						s[i].opcode == cs->opcode)
+					break;
+			}
+
+			if (i == count)
+				continue;
+
+			if (r[i].event == EVT_CMD_STATUS)
+				batch_complete(&r[i], &s[i], ptr, len, &done);
+			else if (cs->status)
+				batch_fail(&r[i], &s[i], &done);
+			else
+				s[i].stage = BATCH_STATUS;
+
+			break;
+
+		case EVT_CMD_COMPLETE:
+			cc = (void *) ptr;
+
+			for (i = 0; i < count; i++) {
+				if (s[i].stage == BATCH_PENDING &&
+						s[i].opcode == cc->opcode)
+					break;
+			}
+
+			if (i == count)
+				continue;
+
+			batch_complete(&r[i], &s[i], ptr + EVT_CMD_COMPLETE_SIZE,
+					len - EVT_CMD_COMPLETE_SIZE, &done);
+			break;
+
+		case EVT_LE_META_EVENT:
+			me = (void *) ptr;
+
+			i = batch_find(r, s, count, me->subevent, NULL, 0);
+			if (i < 0)
+				continue;
+
+			batch_complete(&r[i], &s[i], me->data, len - 1, &done);
+			break;
+
+		default:
+			i = batch_find(r, s, count, hdr->evt, ptr, len);
+			if (i < 0)
+				continue;
+
+			batch_complete(&r[i], &s[i], ptr, len, &done);
+			break;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (s[i].stage != BATCH_DONE)
+			batch_fail(&r[i], &s[i], &done);
+		else if (r[i].rlen > 0)
+			ok++;
+	}
+
+	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+	free(s);
+
+	return ok;
+
+failed:
+	err = errno;
+	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+	free(s);
+	errno = err;
+	return -1;
+}
+
 int hci_create_connection(int dd, const bdaddr_t *bdaddr, uint16_t ptype,
 				uint16_t clkoffset, uint8_t rswitch,
 				uint16_t *handle, int to)
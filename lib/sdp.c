@@ -1458,6 +1458,279 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 	return rec;
 }
 
+/*
+ * Size of the encoded data element at buf, header included, or 0 if it
+ * is malformed or does not fit in bufsize. Nothing is allocated.
+ */
+static int sdp_element_size(const uint8_t *buf, int bufsize)
+{
+	int hdr, len;
+
+	if (bufsize < (int) sizeof(uint8_t))
+		return 0;
+
+	hdr = sizeof(uint8_t);
+
+	switch (buf[0]) {
+	case SDP_DATA_NIL:
+		len = 0;
+		break;
+	case SDP_UINT8:
+	case SDP_INT8:
+	case SDP_BOOL:
+		len = sizeof(uint8_t);
+		break;
+	case SDP_UINT16:
+	case SDP_INT16:
+	case SDP_UUID16:
+		len = sizeof(uint16_t);
+		break;
+	case SDP_UINT32:
+	case SDP_INT32:
+	case SDP_UUID32:
+		len = sizeof(uint32_t);
+		break;
+	case SDP_UINT64:
+	case SDP_INT64:
+		len = sizeof(uint64_t);
+		break;
+	case SDP_UINT128:
+	case SDP_INT128:
+	case SDP_UUID128:
+		len = sizeof(uint128_t);
+		break;
+	default:
+		hdr = sdp_get_data_type_size(buf[0]);
+		if (hdr == sizeof(uint8_t) || bufsize < hdr)
+			return 0;
+
+		if (hdr == sizeof(uint8_t) + sizeof(uint8_t))
+			len = buf[1];
+		else if (hdr == sizeof(uint8_t) + sizeof(uint16_t))
+			len = bt_get_be16(buf + 1);
+		else
+			len = bt_get_be32(buf + 1);
+		break;
+	}
+
+	if (len < 0 || len > bufsize - hdr)
+		return 0;
+
+	return hdr + len;
+}
+
+/*
+ * Return the body of the sequence or alternative at buf and its length,
+ * or NULL if buf does not hold a well formed one.
+ */
+static const uint8_t *pdu_seq_body(const uint8_t *buf, int bufsize, int *len)
+{
+	int size = sdp_element_size(buf, bufsize);
+	int hdr;
+
+	if (!size || !(SDP_IS_SEQ(buf[0]) || SDP_IS_ALT(buf[0])))
+		return NULL;
+
+	hdr = sdp_get_data_type_size(buf[0]);
+	*len = size - hdr;
+
+	return buf + hdr;
+}
+
+/*
+ * Locate attribute attr inside an encoded service record (as passed to
+ * sdp_extract_pdu) without extracting it. Returns a pointer to the
+ * attribute value data element and its encoded size, or NULL if the
+ * attribute is not present.
+ */
+const uint8_t *sdp_pdu_get_attr(const uint8_t *buf, int bufsize,
+						uint16_t attr, int *size)
+{
+	const uint8_t *p;
+	int len;
+
+	p = pdu_seq_body(buf, bufsize, &len);
+	if (!p)
+		return NULL;
+
+	while (len >= (int) (sizeof(uint8_t) + sizeof(uint16_t))) {
+		uint16_t id;
+		int n;
+
+		if (p[0] != SDP_UINT16)
+			return NULL;
+
+		id = bt_get_be16(p + 1);
+		p += sizeof(uint8_t) + sizeof(uint16_t);
+		len -= sizeof(uint8_t) + sizeof(uint16_t);
+
+		n = sdp_element_size(p, len);
+		if (!n)
+			return NULL;
+
+		if (id == attr) {
+			*size = n;
+			return p;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return NULL;
+}
+
+static int pdu_find_port(const uint8_t *p, int len, int proto)
+{
+	uuid_t uuid;
+	int scanned = 0;
+
+	if (sdp_uuid_extract(p, len, &uuid, &scanned) < 0)
+		return 0;
+
+	if (sdp_uuid_to_proto(&uuid) != proto)
+		return 0;
+
+	p += scanned;
+	len -= scanned;
+
+	if (!sdp_element_size(p, len))
+		return 0;
+
+	switch (p[0]) {
+	case SDP_UINT8:
+		return p[1];
+	case SDP_UINT16:
+		return bt_get_be16(p + 1);
+	}
+
+	return 0;
+}
+
+static int pdu_proto_port(const uint8_t *p, int len, int proto, int depth)
+{
+	while (len > 0) {
+		const uint8_t *desc;
+		int n, desclen, port;
+
+		n = sdp_element_size(p, len);
+		if (!n)
+			return 0;
+
+		desc = pdu_seq_body(p, n, &desclen);
+		if (desc && desclen > 0) {
+			/* Alternatives wrap one descriptor list each */
+			if (SDP_IS_ALT(p[0]) && depth == 0)
+				port = pdu_proto_port(desc, desclen, proto, 1);
+			else if (SDP_IS_SEQ(desc[0]) && depth == 1)
+				port = pdu_proto_port(desc, desclen, proto, 2);
+			else
+				port = pdu_find_port(desc, desclen, proto);
+
+			if (port)
+				return port;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Raw record counterpart of sdp_get_access_protos() followed by
+ * sdp_get_proto_port(), for callers that only need the port.
+ */
+int sdp_pdu_get_proto_port(const uint8_t *buf, int bufsize, int proto)
+{
+	const uint8_t *p;
+	int size = 0, len;
+
+	if (proto != L2CAP_UUID && proto != RFCOMM_UUID) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	p = sdp_pdu_get_attr(buf, bufsize, SDP_ATTR_PROTO_DESC_LIST, &size);
+	if (!p)
+		return 0;
+
+	if (SDP_IS_ALT(p[0]))
+		return pdu_proto_port(p, size, proto, 0);
+
+	p = pdu_seq_body(p, size, &len);
+	if (!p)
+		return 0;
+
+	return pdu_proto_port(p, len, proto, 2);
+}
+
+/*
+ * Return the version of profile from the BluetoothProfileDescriptorList
+ * of an encoded record, or -1 with errno set to ENODATA if the record
+ * does not list it.
+ */
+int sdp_pdu_get_profile_version(const uint8_t *buf, int bufsize,
+							uint16_t profile)
+{
+	const uint8_t *p;
+	int size = 0, len;
+
+	p = sdp_pdu_get_attr(buf, bufsize, SDP_ATTR_PFILE_DESC_LIST, &size);
+	if (p)
+		p = pdu_seq_body(p, size, &len);
+
+	while (p && len > 0) {
+		const uint8_t *desc = p;
+		int n, desclen, scanned = 0;
+		uuid_t uuid;
+
+		n = sdp_element_size(p, len);
+		if (!n)
+			break;
+
+		p += n;
+		len -= n;
+
+		/* Same workaround as sdp_get_profile_descs() for records
+		 * listing bare UUID/version pairs */
+		if (SDP_IS_UUID(desc[0])) {
+			desclen = n;
+			if (len > 0 && p[0] == SDP_UINT16) {
+				n = sdp_element_size(p, len);
+				if (!n)
+					break;
+				desclen += n;
+				p += n;
+				len -= n;
+			}
+		} else {
+			desc = pdu_seq_body(desc, n, &desclen);
+			if (!desc)
+				break;
+		}
+
+		if (sdp_uuid_extract(desc, desclen, &uuid, &scanned) < 0)
+			break;
+
+		if (sdp_uuid_to_proto(&uuid) != profile)
+			continue;
+
+		desc += scanned;
+		desclen -= scanned;
+
+		if (desclen < 1 + (int) sizeof(uint16_t) ||
+						desc[0] != SDP_UINT16)
+			return 0x100;
+
+		return bt_get_be16(desc + 1);
+	}
+
+	errno = ENODATA;
+	return -1;
+}
+
 static void sdp_copy_pattern(void *value, void *udata)
 {
 	uuid_t *uuid = value;
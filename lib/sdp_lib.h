@@ -601,6 +601,16 @@ int sdp_set_supp_feat(sdp_record_t *rec, const sdp_list_t *sf);
 int sdp_get_supp_feat(const sdp_record_t *rec, sdp_list_t **seqp);
 
 sdp_record_t *sdp_extract_pdu(const uint8_t *pdata, int bufsize, int *scanned);
+
+/*
+ * Allocation free lookups on an encoded service record, for callers
+ * that only need a few values and not the whole sdp_record_t
+ */
+const uint8_t *sdp_pdu_get_attr(const uint8_t *buf, int bufsize,
+						uint16_t attr, int *size);
+int sdp_pdu_get_proto_port(const uint8_t *buf, int bufsize, int proto);
+int sdp_pdu_get_profile_version(const uint8_t *buf, int bufsize,
+							uint16_t profile);
 sdp_record_t *sdp_copy_record(sdp_record_t *rec);
 
 void sdp_data_print(sdp_data_t *data);
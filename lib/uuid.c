@@ -28,6 +28,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 
 #include "uuid.h"
@@ -121,9 +122,48 @@ int bt_uuid128_create(bt_uuid_t *btuuid, uint128_t value)
 	return 0;
 }
 
+/*
+ * Get the 32-bit value of a UUID derived from the Bluetooth base UUID,
+ * which is what its leading four bytes hold in the 128-bit form.
+ */
+static bool bt_uuid_get_value(const bt_uuid_t *uuid, uint32_t *value)
+{
+	const uint8_t *data;
+
+	switch (uuid->type) {
+	case BT_UUID16:
+		*value = uuid->value.u16;
+		return true;
+	case BT_UUID32:
+		*value = uuid->value.u32;
+		return true;
+	case BT_UUID128:
+		data = uuid->value.u128.data;
+
+		if (memcmp(&data[4], &bluetooth_base_uuid.data[4], 12))
+			return false;
+
+		*value = data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+		return true;
+	default:
+		return false;
+	}
+}
+
 int bt_uuid_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
 {
 	bt_uuid_t u1, u2;
+	uint32_t v1, v2;
+
+	if (uuid1->type == BT_UUID128 && uuid2->type == BT_UUID128)
+		return bt_uuid128_cmp(uuid1, uuid2);
+
+	/*
+	 * Two UUIDs on the base only differ in the leading big-endian
+	 * bytes, so comparing the values gives the same ordering.
+	 */
+	if (bt_uuid_get_value(uuid1, &v1) && bt_uuid_get_value(uuid2, &v2))
+		return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
 
 	bt_uuid_to_uuid128(uuid1, &u1);
 	bt_uuid_to_uuid128(uuid2, &u2);
@@ -131,6 +171,33 @@ int bt_uuid_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
 	return bt_uuid128_cmp(&u1, &u2);
 }
 
+/*
+ * Hash a UUID so that equal UUIDs of different widths hash alike.
+ */
+unsigned int bt_uuid_hash(const bt_uuid_t *uuid)
+{
+	const uint8_t *data;
+	unsigned int hash;
+	uint32_t value;
+	int i;
+
+	if (bt_uuid_get_value(uuid, &value))
+		return value;
+
+	if (uuid->type != BT_UUID128)
+		return 0;
+
+	data = uuid->value.u128.data;
+	hash = 2166136261u;
+
+	for (i = 0; i < 16; i++) {
+		hash ^= data[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
 /*
  * convert the UUID to string, copying a maximum of n characters.
  */
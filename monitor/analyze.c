@@ -27,7 +27,9 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
@@ -35,6 +37,18 @@
 #include "monitor/bt.h"
 #include "analyze.h"
 
+/* Controller buffer credits shared by all connections of one type */
+struct acl_pool {
+	uint16_t max_pkt;
+	unsigned int pending;
+	bool stalled;
+	uint16_t stall_handle;
+	struct timeval stall_start;
+	unsigned long num_stalls;
+	unsigned long long stall_time;
+	unsigned long stall_max;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -45,10 +59,192 @@ struct hci_dev {
 	unsigned long num_evt;
 	unsigned long num_acl;
 	unsigned long num_sco;
+	struct queue *cmd_list;
+	struct queue *cmd_stats;
+	struct queue *conn_list;
+	struct acl_pool acl_pool;
+	struct acl_pool le_pool;
+};
+
+struct hci_cmd {
+	uint16_t opcode;
+	struct timeval tv;
+};
+
+#define LATENCY_BUCKETS 5
+
+static const unsigned long latency_bucket[LATENCY_BUCKETS - 1] = {
+	1000, 10000, 100000, 1000000
+};
+
+struct cmd_stat {
+	uint16_t opcode;
+	unsigned long num;
+	unsigned long long total;
+	unsigned long min;
+	unsigned long max;
+	unsigned long hist[LATENCY_BUCKETS];
+};
+
+struct l2cap_chan {
+	uint16_t cid;
+	unsigned long long rx_bytes;
+	unsigned long long tx_bytes;
+};
+
+struct acl_rate {
+	unsigned long long rx_bytes;
+	unsigned long long tx_bytes;
+};
+
+struct hci_conn {
+	uint16_t handle;
+	bool le;
+	struct timeval first;
+	struct timeval last;
+	unsigned long rx_num;
+	unsigned long tx_num;
+	unsigned long long rx_bytes;
+	unsigned long long tx_bytes;
+	uint16_t last_cid[2];
+	struct queue *chan_list;
+	uint8_t att_opcode;
+	struct timeval att_tv;
+	unsigned long num_att;
+	unsigned long long att_rtt;
+	unsigned long att_rtt_max;
+	struct queue *tx_queue;
+	unsigned int tx_pending;
+	unsigned int tx_pending_max;
+	unsigned long num_completed;
+	unsigned long long completed_time;
+	unsigned long completed_max;
+	unsigned long num_stalls;
+	unsigned long long stall_time;
+	struct acl_rate *rate;
+	unsigned long rate_len;
 };
 
 static struct queue *dev_list;
 
+static unsigned long tv_diff(const struct timeval *a, const struct timeval *b)
+{
+	struct timeval res;
+
+	timersub(a, b, &res);
+
+	if (res.tv_sec < 0)
+		return 0;
+
+	return res.tv_sec * 1000000ul + res.tv_usec;
+}
+
+static void chan_destroy(void *data)
+{
+	struct l2cap_chan *chan = data;
+
+	printf("    L2CAP CID 0x%4.4x: %llu RX bytes, %llu TX bytes\n",
+				chan->cid, chan->rx_bytes, chan->tx_bytes);
+
+	free(chan);
+}
+
+static void print_rate(struct hci_conn *conn)
+{
+	unsigned long long rx_peak = 0, tx_peak = 0;
+	unsigned long i;
+
+	for (i = 0; i < conn->rate_len; i++) {
+		if (conn->rate[i].rx_bytes > rx_peak)
+			rx_peak = conn->rate[i].rx_bytes;
+		if (conn->rate[i].tx_bytes > tx_peak)
+			tx_peak = conn->rate[i].tx_bytes;
+	}
+
+	printf("    %llu RX bytes/s, %llu TX bytes/s peak\n", rx_peak, tx_peak);
+
+	for (i = 0; i < conn->rate_len; i++)
+		printf("      %5lu s: %llu RX bytes, %llu TX bytes\n", i,
+					conn->rate[i].rx_bytes,
+					conn->rate[i].tx_bytes);
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+	unsigned long duration;
+
+	duration = tv_diff(&conn->last, &conn->first);
+
+	printf("  Connection handle %u\n", conn->handle);
+	printf("    %lu RX packets, %llu bytes\n", conn->rx_num,
+							conn->rx_bytes);
+	printf("    %lu TX packets, %llu bytes\n", conn->tx_num,
+							conn->tx_bytes);
+
+	if (duration)
+		printf("    %llu RX bytes/s, %llu TX bytes/s over %lu msec\n",
+				conn->rx_bytes * 1000000ull / duration,
+				conn->tx_bytes * 1000000ull / duration,
+				duration / 1000);
+
+	if (conn->rate_len > 1)
+		print_rate(conn);
+
+	if (conn->num_completed)
+		printf("    %lu completed packets, %llu usec average, "
+				"%lu usec max, %u max outstanding\n",
+				conn->num_completed,
+				conn->completed_time / conn->num_completed,
+				conn->completed_max, conn->tx_pending_max);
+
+	if (conn->num_stalls)
+		printf("    %lu credit stalls, %llu usec total\n",
+				conn->num_stalls, conn->stall_time);
+
+	if (conn->num_att)
+		printf("    %lu ATT transactions, %llu usec average, "
+				"%lu usec max\n", conn->num_att,
+				conn->att_rtt / conn->num_att,
+				conn->att_rtt_max);
+
+	queue_destroy(conn->chan_list, chan_destroy);
+	queue_destroy(conn->tx_queue, free);
+
+	free(conn->rate);
+	free(conn);
+}
+
+static void cmd_stat_destroy(void *data)
+{
+	struct cmd_stat *stat = data;
+
+	printf("  Command 0x%4.4x: %lu responses, %lu/%llu/%lu usec "
+				"min/avg/max\n", stat->opcode, stat->num,
+				stat->min, stat->total / stat->num, stat->max);
+	printf("    %lu <1 msec, %lu <10 msec, %lu <100 msec, "
+				"%lu <1 sec, %lu >=1 sec\n",
+				stat->hist[0], stat->hist[1], stat->hist[2],
+				stat->hist[3], stat->hist[4]);
+
+	free(stat);
+}
+
+static void print_pool(const char *name, struct acl_pool *pool)
+{
+	if (!pool->max_pkt)
+		return;
+
+	printf("  %s buffers: %u packets, %lu credit stalls",
+					name, pool->max_pkt, pool->num_stalls);
+
+	if (pool->num_stalls)
+		printf(", %llu usec total, %lu usec max", pool->stall_time,
+							pool->stall_max);
+
+	printf("\n");
+}
+
 static void dev_destroy(void *data)
 {
 	struct hci_dev *dev = data;
@@ -74,6 +270,14 @@ static void dev_destroy(void *data)
 	printf("  %lu events\n", dev->num_evt);
 	printf("  %lu ACL packets\n", dev->num_acl);
 	printf("  %lu SCO packets\n", dev->num_sco);
+
+	print_pool("ACL", &dev->acl_pool);
+	print_pool("LE", &dev->le_pool);
+
+	queue_destroy(dev->cmd_stats, cmd_stat_destroy);
+	queue_destroy(dev->conn_list, conn_destroy);
+	queue_destroy(dev->cmd_list, free);
+
 	printf("\n");
 
 	free(dev);
@@ -90,6 +294,18 @@ static struct hci_dev *dev_alloc(uint16_t index)
 	}
 
 	dev->index = index;
+	dev->cmd_list = queue_new();
+	dev->cmd_stats = queue_new();
+	dev->conn_list = queue_new();
+
+	if (!dev->cmd_list || !dev->cmd_stats || !dev->conn_list) {
+		fprintf(stderr, "Failed to allocate device lists\n");
+		queue_destroy(dev->cmd_list, NULL);
+		queue_destroy(dev->cmd_stats, NULL);
+		queue_destroy(dev->conn_list, NULL);
+		free(dev);
+		return NULL;
+	}
 
 	return dev;
 }
@@ -120,6 +336,69 @@ static struct hci_dev *dev_lookup(uint16_t index)
 	return dev;
 }
 
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct hci_conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return conn->handle == handle;
+}
+
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle)
+{
+	struct hci_conn *conn;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+	if (conn)
+		return conn;
+
+	conn = new0(struct hci_conn, 1);
+	if (!conn)
+		return NULL;
+
+	conn->handle = handle;
+	conn->chan_list = queue_new();
+	conn->tx_queue = queue_new();
+	if (!conn->chan_list || !conn->tx_queue) {
+		queue_destroy(conn->chan_list, NULL);
+		queue_destroy(conn->tx_queue, NULL);
+		free(conn);
+		return NULL;
+	}
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
+static bool chan_match_cid(const void *a, const void *b)
+{
+	const struct l2cap_chan *chan = a;
+	uint16_t cid = PTR_TO_UINT(b);
+
+	return chan->cid == cid;
+}
+
+static struct l2cap_chan *chan_lookup(struct hci_conn *conn, uint16_t cid)
+{
+	struct l2cap_chan *chan;
+
+	chan = queue_find(conn->chan_list, chan_match_cid, UINT_TO_PTR(cid));
+	if (chan)
+		return chan;
+
+	chan = new0(struct l2cap_chan, 1);
+	if (!chan)
+		return NULL;
+
+	chan->cid = cid;
+
+	queue_push_tail(conn->chan_list, chan);
+
+	return chan;
+}
+
 static void new_index(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -155,6 +434,7 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 {
 	const struct bt_hci_cmd_hdr *hdr = data;
 	struct hci_dev *dev;
+	struct hci_cmd *cmd;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -164,6 +444,137 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_cmd++;
+
+	cmd = new0(struct hci_cmd, 1);
+	if (!cmd)
+		return;
+
+	cmd->opcode = le16_to_cpu(hdr->opcode);
+	cmd->tv = *tv;
+
+	queue_push_tail(dev->cmd_list, cmd);
+}
+
+static bool cmd_match_opcode(const void *a, const void *b)
+{
+	const struct hci_cmd *cmd = a;
+	uint16_t opcode = PTR_TO_UINT(b);
+
+	return cmd->opcode == opcode;
+}
+
+static bool stat_match_opcode(const void *a, const void *b)
+{
+	const struct cmd_stat *stat = a;
+	uint16_t opcode = PTR_TO_UINT(b);
+
+	return stat->opcode == opcode;
+}
+
+static void cmd_done(struct hci_dev *dev, struct timeval *tv,
+							uint16_t opcode)
+{
+	struct hci_cmd *cmd;
+	struct cmd_stat *stat;
+	unsigned long latency;
+	int i;
+
+	cmd = queue_remove_if(dev->cmd_list, cmd_match_opcode,
+						UINT_TO_PTR(opcode));
+	if (!cmd)
+		return;
+
+	latency = tv_diff(tv, &cmd->tv);
+	free(cmd);
+
+	stat = queue_find(dev->cmd_stats, stat_match_opcode,
+						UINT_TO_PTR(opcode));
+	if (!stat) {
+		stat = new0(struct cmd_stat, 1);
+		if (!stat)
+			return;
+
+		stat->opcode = opcode;
+		stat->min = latency;
+		queue_push_tail(dev->cmd_stats, stat);
+	}
+
+	stat->num++;
+	stat->total += latency;
+
+	if (latency < stat->min)
+		stat->min = latency;
+	if (latency > stat->max)
+		stat->max = latency;
+
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+		if (latency < latency_bucket[i])
+			break;
+	}
+
+	stat->hist[i]++;
+}
+
+static struct acl_pool *conn_pool(struct hci_dev *dev, struct hci_conn *conn)
+{
+	/* LE links share the ACL buffers if there is no LE buffer pool */
+	if (conn->le && dev->le_pool.max_pkt)
+		return &dev->le_pool;
+
+	return &dev->acl_pool;
+}
+
+static void pool_stall_end(struct hci_dev *dev, struct acl_pool *pool,
+							struct timeval *tv)
+{
+	struct hci_conn *conn;
+	unsigned long duration;
+
+	if (!pool->stalled)
+		return;
+
+	pool->stalled = false;
+
+	duration = tv_diff(tv, &pool->stall_start);
+
+	pool->stall_time += duration;
+	if (duration > pool->stall_max)
+		pool->stall_max = duration;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+					UINT_TO_PTR(pool->stall_handle));
+	if (conn)
+		conn->stall_time += duration;
+}
+
+static void conn_completed(struct hci_dev *dev, struct hci_conn *conn,
+					struct timeval *tv, unsigned int count)
+{
+	struct acl_pool *pool = conn_pool(dev, conn);
+
+	while (count--) {
+		struct timeval *sent;
+		unsigned long latency;
+
+		sent = queue_pop_head(conn->tx_queue);
+		if (!sent)
+			break;
+
+		latency = tv_diff(tv, sent);
+		free(sent);
+
+		conn->tx_pending--;
+		conn->num_completed++;
+		conn->completed_time += latency;
+		if (latency > conn->completed_max)
+			conn->completed_max = latency;
+
+		if (pool->pending)
+			pool->pending--;
+	}
+
+	if (pool->pending < pool->max_pkt)
+		pool_stall_end(dev, pool, tv);
 }
 
 static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
@@ -179,6 +590,28 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 	memcpy(dev->bdaddr, rsp->bdaddr, 6);
 }
 
+static void rsp_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->acl_pool.max_pkt = le16_to_cpu(rsp->acl_max_pkt);
+}
+
+static void rsp_le_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_le_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->le_pool.max_pkt = rsp->le_max_pkt;
+}
+
 static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
@@ -190,13 +623,102 @@ static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 
 	opcode = le16_to_cpu(evt->opcode);
 
+	cmd_done(dev, tv, opcode);
+
 	switch (opcode) {
 	case BT_HCI_CMD_READ_BD_ADDR:
 		rsp_read_bd_addr(dev, tv, data, size);
 		break;
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		rsp_read_buffer_size(dev, tv, data, size);
+		break;
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		rsp_le_read_buffer_size(dev, tv, data, size);
+		break;
 	}
 }
 
+static void evt_cmd_status(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_status *evt = data;
+
+	if (size < sizeof(*evt))
+		return;
+
+	cmd_done(dev, tv, le16_to_cpu(evt->opcode));
+}
+
+static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct hci_conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+				UINT_TO_PTR(le16_to_cpu(evt->handle)));
+	if (!conn)
+		return;
+
+	/* Outstanding packets are flushed and their credits returned */
+	conn_completed(dev, conn, tv, conn->tx_pending);
+	queue_remove(dev->conn_list, conn);
+
+	printf("Disconnect of handle %u on index %u\n", conn->handle,
+								dev->index);
+	conn_destroy(conn);
+	printf("\n");
+}
+
+static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *ptr = data;
+	uint8_t num_handles;
+
+	if (size < 1)
+		return;
+
+	num_handles = ptr[0];
+	ptr++;
+	size--;
+
+	while (num_handles-- && size >= 4) {
+		uint16_t handle = get_le16(ptr) & 0x0fff;
+		uint16_t count = get_le16(ptr + 2);
+		struct hci_conn *conn;
+
+		ptr += 4;
+		size -= 4;
+
+		conn = queue_find(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+		if (conn)
+			conn_completed(dev, conn, tv, count);
+	}
+}
+
+static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_complete *evt = data + 1;
+	struct hci_conn *conn;
+
+	if (size < 1 + sizeof(*evt))
+		return;
+
+	if (*((const uint8_t *) data) != BT_HCI_EVT_LE_CONN_COMPLETE ||
+								evt->status)
+		return;
+
+	conn = conn_lookup(dev, le16_to_cpu(evt->handle));
+	if (conn)
+		conn->le = true;
+}
+
 static void event_pkt(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -216,14 +738,137 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		evt_cmd_status(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		evt_num_completed_packets(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(dev, tv, data, size);
+		break;
+	}
+}
+
+static bool att_is_request(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x02:	/* Exchange MTU */
+	case 0x04:	/* Find Information */
+	case 0x06:	/* Find By Type Value */
+	case 0x08:	/* Read By Type */
+	case 0x0a:	/* Read */
+	case 0x0c:	/* Read Blob */
+	case 0x0e:	/* Read Multiple */
+	case 0x10:	/* Read By Group Type */
+	case 0x12:	/* Write */
+	case 0x16:	/* Prepare Write */
+	case 0x18:	/* Execute Write */
+		return true;
+	}
+
+	return false;
+}
+
+/* Round trip of ATT requests sent by the local host */
+static void att_pdu(struct hci_conn *conn, struct timeval *tv, bool out,
+					const uint8_t *data, uint16_t size)
+{
+	uint8_t opcode;
+
+	if (size < 1)
+		return;
+
+	opcode = data[0];
+
+	if (out) {
+		if (att_is_request(opcode)) {
+			conn->att_opcode = opcode;
+			conn->att_tv = *tv;
+		}
+		return;
+	}
+
+	if (!conn->att_opcode)
+		return;
+
+	if (opcode == conn->att_opcode + 1 || opcode == 0x01) {
+		unsigned long rtt = tv_diff(tv, &conn->att_tv);
+
+		conn->num_att++;
+		conn->att_rtt += rtt;
+		if (rtt > conn->att_rtt_max)
+			conn->att_rtt_max = rtt;
+
+		conn->att_opcode = 0;
 	}
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
+static struct acl_rate *conn_rate(struct hci_conn *conn, struct timeval *tv)
+{
+	unsigned long sec = tv_diff(tv, &conn->first) / 1000000;
+
+	if (sec >= conn->rate_len) {
+		struct acl_rate *rate;
+		unsigned long len = sec + 1;
+
+		rate = realloc(conn->rate, len * sizeof(*rate));
+		if (!rate)
+			return NULL;
+
+		memset(rate + conn->rate_len, 0,
+				(len - conn->rate_len) * sizeof(*rate));
+
+		conn->rate = rate;
+		conn->rate_len = len;
+	}
+
+	return &conn->rate[sec];
+}
+
+static void conn_sent(struct hci_dev *dev, struct hci_conn *conn,
+							struct timeval *tv)
+{
+	struct acl_pool *pool = conn_pool(dev, conn);
+	struct timeval *sent;
+
+	sent = new0(struct timeval, 1);
+	if (!sent)
+		return;
+
+	*sent = *tv;
+	queue_push_tail(conn->tx_queue, sent);
+
+	conn->tx_pending++;
+	if (conn->tx_pending > conn->tx_pending_max)
+		conn->tx_pending_max = conn->tx_pending;
+
+	pool->pending++;
+
+	/* The host has to wait for credits once the pool is exhausted */
+	if (pool->max_pkt && pool->pending >= pool->max_pkt &&
+							!pool->stalled) {
+		pool->stalled = true;
+		pool->stall_handle = conn->handle;
+		pool->stall_start = *tv;
+		pool->num_stalls++;
+		conn->num_stalls++;
+	}
+}
+
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
 	struct hci_dev *dev;
+	struct hci_conn *conn;
+	struct l2cap_chan *chan;
+	struct acl_rate *rate;
+	uint16_t handle, cid;
+	uint8_t flags;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -233,6 +878,64 @@ static void acl_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_acl++;
+
+	if (size > BTSNOOP_MAX_PACKET_SIZE)
+		return;
+
+	handle = le16_to_cpu(hdr->handle);
+	flags = handle >> 12;
+
+	conn = conn_lookup(dev, handle & 0x0fff);
+	if (!conn)
+		return;
+
+	if (!conn->rx_num && !conn->tx_num)
+		conn->first = *tv;
+	conn->last = *tv;
+
+	rate = conn_rate(conn, tv);
+
+	if (out) {
+		conn->tx_num++;
+		conn->tx_bytes += size;
+		if (rate)
+			rate->tx_bytes += size;
+		conn_sent(dev, conn, tv);
+	} else {
+		conn->rx_num++;
+		conn->rx_bytes += size;
+		if (rate)
+			rate->rx_bytes += size;
+	}
+
+	/* Continuation fragments belong to the last channel started */
+	if ((flags & 0x03) == 0x01) {
+		cid = conn->last_cid[out];
+	} else {
+		const struct bt_l2cap_hdr *l2cap = data;
+
+		if (size < sizeof(*l2cap))
+			return;
+
+		cid = le16_to_cpu(l2cap->cid);
+		conn->last_cid[out] = cid;
+
+		if (cid == 0x0004)
+			att_pdu(conn, tv, out, data + sizeof(*l2cap),
+						size - sizeof(*l2cap));
+	}
+
+	if (!cid)
+		return;
+
+	chan = chan_lookup(conn, cid);
+	if (!chan)
+		return;
+
+	if (out)
+		chan->tx_bytes += size;
+	else
+		chan->rx_bytes += size;
 }
 
 static void sco_pkt(struct timeval *tv, uint16_t index,
@@ -302,8 +1005,10 @@ void analyze_trace(const char *path)
 			event_pkt(&tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_ACL_TX_PKT:
+			acl_pkt(&tv, index, true, buf, pktlen);
+			break;
 		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
+			acl_pkt(&tv, index, false, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_SCO_TX_PKT:
 		case BTSNOOP_OPCODE_SCO_RX_PKT:
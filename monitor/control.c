@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -41,15 +42,20 @@
 #include "lib/mgmt.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/ringbuf.h"
 #include "src/shared/btsnoop.h"
+#include "src/shared/pcap.h"
 #include "mainloop.h"
 #include "display.h"
 #include "packet.h"
 #include "hcidump.h"
 #include "ellisys.h"
+#include "stats.h"
 #include "control.h"
 
 static struct btsnoop *btsnoop_file = NULL;
+static struct pcap *pcap_file = NULL;
 static bool hcidump_fallback = false;
 
 struct control_data {
@@ -751,6 +757,148 @@ void control_message(uint16_t opcode, const void *data, uint16_t size)
 	}
 }
 
+#define BROADCAST_BUFFER_SIZE	(256 * 1024)
+
+struct broadcast_hdr {
+	uint8_t		id[8];
+	uint32_t	version;
+	uint32_t	type;
+} __attribute__ ((packed));
+
+struct broadcast_pkt {
+	uint32_t	size;
+	uint32_t	len;
+	uint32_t	flags;
+	uint32_t	drops;
+	uint64_t	ts;
+} __attribute__ ((packed));
+
+struct broadcast_client {
+	int fd;
+	struct ringbuf *ringbuf;
+	uint32_t drops;
+	bool writing;
+};
+
+struct broadcast_index {
+	uint16_t index;
+	struct timeval tv;
+	struct btsnoop_opcode_new_index data;
+};
+
+static int broadcast_fd = -1;
+static struct queue *broadcast_clients = NULL;
+static struct queue *broadcast_indexes = NULL;
+
+struct broadcast_record {
+	struct broadcast_pkt pkt;
+	const void *data;
+	uint16_t size;
+};
+
+static void broadcast_queue(void *data, void *user_data)
+{
+	struct broadcast_client *client = data;
+	struct broadcast_record *rec = user_data;
+
+	/*
+	 * A consumer that cannot keep up loses whole records instead of
+	 * stalling the capture or the other consumers. The drop count is
+	 * carried in the next record that does make it into the buffer.
+	 */
+	if (ringbuf_avail(client->ringbuf) < sizeof(rec->pkt) + rec->size) {
+		client->drops++;
+		return;
+	}
+
+	rec->pkt.drops = htobe32(client->drops);
+
+	ringbuf_append(client->ringbuf, &rec->pkt, sizeof(rec->pkt));
+	ringbuf_append(client->ringbuf, rec->data, rec->size);
+
+	if (!client->writing) {
+		mainloop_modify_fd(client->fd, EPOLLIN | EPOLLOUT);
+		client->writing = true;
+	}
+}
+
+static void broadcast_record(struct broadcast_record *rec,
+				const struct timeval *tv, uint16_t index,
+				uint16_t opcode, const void *data,
+				uint16_t size)
+{
+	uint64_t ts;
+
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+
+	rec->pkt.size  = htobe32(size);
+	rec->pkt.len   = htobe32(size);
+	rec->pkt.flags = htobe32((index << 16) | opcode);
+	rec->pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
+	rec->data = data;
+	rec->size = size;
+}
+
+static bool match_index(const void *a, const void *b)
+{
+	const struct broadcast_index *entry = a;
+
+	return entry->index == PTR_TO_UINT(b);
+}
+
+static void broadcast_track_index(const struct timeval *tv, uint16_t index,
+					uint16_t opcode, const void *data,
+					uint16_t size)
+{
+	struct broadcast_index *entry;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		if (size < sizeof(entry->data))
+			return;
+
+		entry = queue_remove_if(broadcast_indexes, match_index,
+							UINT_TO_PTR(index));
+		if (!entry)
+			entry = new0(struct broadcast_index, 1);
+
+		entry->index = index;
+		entry->tv = *tv;
+		memcpy(&entry->data, data, sizeof(entry->data));
+		queue_push_tail(broadcast_indexes, entry);
+		break;
+	case BTSNOOP_OPCODE_DEL_INDEX:
+		entry = queue_remove_if(broadcast_indexes, match_index,
+							UINT_TO_PTR(index));
+		free(entry);
+		break;
+	}
+}
+
+static void broadcast_hci(const struct timeval *tv, uint16_t index,
+				uint16_t opcode, const void *data,
+				uint16_t size)
+{
+	struct broadcast_record rec;
+	struct timeval now;
+
+	if (broadcast_fd < 0)
+		return;
+
+	if (!tv) {
+		gettimeofday(&now, NULL);
+		tv = &now;
+	}
+
+	broadcast_track_index(tv, index, opcode, data, size);
+
+	if (queue_isempty(broadcast_clients))
+		return;
+
+	broadcast_record(&rec, tv, index, opcode, data, size);
+	queue_foreach(broadcast_clients, broadcast_queue, &rec);
+}
+
 static void data_callback(int fd, uint32_t events, void *user_data)
 {
 	struct control_data *data = user_data;
@@ -811,12 +959,23 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 		case HCI_CHANNEL_MONITOR:
 			btsnoop_write_hci(btsnoop_file, tv, index, opcode,
 							data->buf, pktlen);
+			pcap_write_hci(pcap_file, tv, index, opcode,
+							data->buf, pktlen);
+			broadcast_hci(tv, index, opcode, data->buf, pktlen);
 			ellisys_inject_hci(tv, index, opcode,
 							data->buf, pktlen);
-			packet_monitor(tv, index, opcode, data->buf, pktlen);
+
+			/* Statistics replace the full decode when enabled */
+			if (stats_active())
+				stats_hci(tv, index, opcode, data->buf, pktlen);
+			else
+				packet_monitor(tv, index, opcode,
+							data->buf, pktlen);
 			break;
 		}
 	}
+
+	ellisys_flush();
 }
 
 static int open_socket(uint16_t channel)
@@ -994,14 +1153,232 @@ void control_server(const char *path)
 	server_fd = fd;
 }
 
-bool control_writer(const char *path)
+static void broadcast_client_free(void *user_data)
 {
+	struct broadcast_client *client = user_data;
+
+	queue_remove(broadcast_clients, client);
+
+	printf("--- Broadcast client disconnected (%u dropped) ---\n",
+							client->drops);
+
+	ringbuf_free(client->ringbuf);
+	close(client->fd);
+	free(client);
+}
+
+static bool broadcast_send(struct broadcast_client *client)
+{
+	struct msghdr msg;
+	struct iovec iov[2];
+	size_t len;
+	ssize_t sent;
+
+	len = ringbuf_len(client->ringbuf);
+
+	iov[0].iov_base = ringbuf_peek(client->ringbuf, 0, &iov[0].iov_len);
+	iov[1].iov_base = ringbuf_peek(client->ringbuf, iov[0].iov_len, NULL);
+	iov[1].iov_len = len - iov[0].iov_len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	sent = sendmsg(client->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	ringbuf_drain(client->ringbuf, sent);
+
+	return true;
+}
+
+static void broadcast_client_callback(int fd, uint32_t events,
+							void *user_data)
+{
+	struct broadcast_client *client = user_data;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(client->fd);
+		return;
+	}
+
+	/* Consumers never send anything, so readable means they are gone */
+	if (events & EPOLLIN) {
+		unsigned char buf[64];
+		ssize_t len;
+
+		len = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len == 0 || (len < 0 && errno != EAGAIN)) {
+			mainloop_remove_fd(client->fd);
+			return;
+		}
+	}
+
+	if (!(events & EPOLLOUT))
+		return;
+
+	if (!broadcast_send(client)) {
+		mainloop_remove_fd(client->fd);
+		return;
+	}
+
+	if (!ringbuf_len(client->ringbuf)) {
+		mainloop_modify_fd(client->fd, EPOLLIN);
+		client->writing = false;
+	}
+}
+
+static void broadcast_replay(void *data, void *user_data)
+{
+	struct broadcast_index *entry = data;
+	struct broadcast_record rec;
+
+	broadcast_record(&rec, &entry->tv, entry->index,
+				BTSNOOP_OPCODE_NEW_INDEX, &entry->data,
+				sizeof(entry->data));
+	broadcast_queue(user_data, &rec);
+}
+
+static void broadcast_accept_callback(int fd, uint32_t events,
+							void *user_data)
+{
+	struct broadcast_client *client;
+	struct broadcast_hdr hdr;
+	int nfd;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(fd);
+		return;
+	}
+
+	nfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (nfd < 0) {
+		perror("Failed to accept broadcast socket");
+		return;
+	}
+
+	client = new0(struct broadcast_client, 1);
+	client->fd = nfd;
+	client->writing = true;
+
+	client->ringbuf = ringbuf_new(BROADCAST_BUFFER_SIZE);
+	if (!client->ringbuf) {
+		close(nfd);
+		free(client);
+		return;
+	}
+
+	memcpy(hdr.id, "btsnoop", sizeof(hdr.id));
+	hdr.version = htobe32(1);
+	hdr.type = htobe32(BTSNOOP_TYPE_MONITOR);
+
+	ringbuf_append(client->ringbuf, &hdr, sizeof(hdr));
+
+	/* Late joiners still need to learn about existing controllers */
+	queue_foreach(broadcast_indexes, broadcast_replay, client);
+
+	if (mainloop_add_fd(nfd, EPOLLIN | EPOLLOUT, broadcast_client_callback,
+					client, broadcast_client_free) < 0) {
+		ringbuf_free(client->ringbuf);
+		close(nfd);
+		free(client);
+		return;
+	}
+
+	queue_push_tail(broadcast_clients, client);
+
+	printf("--- New broadcast client ---\n");
+}
+
+bool control_broadcast(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (broadcast_fd >= 0)
+		return true;
+
+	unlink(path);
+
+	fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Failed to open broadcast socket");
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("Failed to bind broadcast socket");
+		close(fd);
+		return false;
+	}
+
+	if (listen(fd, 5) < 0) {
+		perror("Failed to listen broadcast socket");
+		close(fd);
+		return false;
+	}
+
+	if (mainloop_add_fd(fd, EPOLLIN, broadcast_accept_callback,
+						NULL, NULL) < 0) {
+		close(fd);
+		return false;
+	}
+
+	broadcast_clients = queue_new();
+	broadcast_indexes = queue_new();
+	broadcast_fd = fd;
+
+	return true;
+}
+
+#define WRITER_BUFFER_SIZE	(64 * 1024)
+#define WRITER_FLUSH_INTERVAL	1000
+
+bool control_writer(const char *path, bool index, unsigned int rotate_size,
+			unsigned int rotate_time, unsigned int rotate_files)
+{
+	char *idx_path;
+
 	btsnoop_file = btsnoop_create(path, BTSNOOP_TYPE_MONITOR);
+	if (!btsnoop_file)
+		return false;
+
+	btsnoop_set_buffer(btsnoop_file, WRITER_BUFFER_SIZE,
+						WRITER_FLUSH_INTERVAL);
+
+	if (rotate_size || rotate_time)
+		btsnoop_set_rotation(btsnoop_file,
+					(uint64_t) rotate_size * 1024 * 1024,
+					rotate_time, rotate_files);
 
-	return !!btsnoop_file;
+	if (!index)
+		return true;
+
+	if (asprintf(&idx_path, "%s.idx", path) < 0)
+		return true;
+
+	if (!btsnoop_create_index(btsnoop_file, idx_path))
+		fprintf(stderr, "Failed to create index '%s'\n", idx_path);
+
+	free(idx_path);
+
+	return true;
 }
 
-void control_reader(const char *path)
+bool control_pcap_writer(const char *path)
+{
+	pcap_file = pcap_create_ng(path);
+
+	return pcap_file != NULL;
+}
+
+void control_reader(const char *path, const struct timeval *from,
+						const struct timeval *to)
 {
 	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 	uint16_t pktlen;
@@ -1026,6 +1403,10 @@ void control_reader(const char *path)
 		break;
 	}
 
+	/* Without an index the packets before the window are skipped */
+	if (from)
+		btsnoop_seek(btsnoop_file, from);
+
 	open_pager();
 
 	switch (type) {
@@ -1042,9 +1423,19 @@ void control_reader(const char *path)
 			if (opcode == 0xffff)
 				continue;
 
+			if (from && timercmp(&tv, from, <))
+				continue;
+
+			if (to && timercmp(&tv, to, >))
+				break;
+
 			packet_monitor(&tv, index, opcode, buf, pktlen);
 			ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
+			pcap_write_hci(pcap_file, &tv, index, opcode,
+								buf, pktlen);
 		}
+
+		ellisys_flush();
 		break;
 
 	case BTSNOOP_TYPE_SIMULATOR:
@@ -1063,6 +1454,24 @@ void control_reader(const char *path)
 	close_pager();
 
 	btsnoop_unref(btsnoop_file);
+
+	pcap_unref(pcap_file);
+	pcap_file = NULL;
+}
+
+void control_cleanup(void)
+{
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+
+	pcap_unref(pcap_file);
+	pcap_file = NULL;
+
+	queue_destroy(broadcast_clients, NULL);
+	broadcast_clients = NULL;
+
+	queue_destroy(broadcast_indexes, free);
+	broadcast_indexes = NULL;
 }
 
 int control_tracing(void)
@@ -1080,7 +1489,8 @@ int control_tracing(void)
 		return 0;
 	}
 
-	open_channel(HCI_CHANNEL_CONTROL);
+	if (!stats_active())
+		open_channel(HCI_CHANNEL_CONTROL);
 
 	return 0;
 }
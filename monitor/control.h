@@ -23,10 +23,17 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
 
-bool control_writer(const char *path);
-void control_reader(const char *path);
+bool control_writer(const char *path, bool index, unsigned int rotate_size,
+			unsigned int rotate_time, unsigned int rotate_files);
+bool control_pcap_writer(const char *path);
+void control_reader(const char *path, const struct timeval *from,
+						const struct timeval *to);
 void control_server(const char *path);
+bool control_broadcast(const char *path);
+void control_cleanup(void);
 int control_tracing(void);
 
 void control_message(uint16_t opcode, const void *data, uint16_t size);
@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
@@ -41,16 +42,139 @@
 
 static pid_t pager_pid = 0;
 
+static bool json_mode = false;
+static bool json_open = false;
+static bool json_lines = false;
+
 bool use_color(void)
 {
 	static int cached_use_color = -1;
 
 	if (__builtin_expect(!!(cached_use_color < 0), 0))
-		cached_use_color = isatty(STDOUT_FILENO) > 0 || pager_pid > 0;
+		cached_use_color = !json_mode && (isatty(STDOUT_FILENO) > 0 ||
+							pager_pid > 0);
 
 	return cached_use_color;
 }
 
+void json_enable(void)
+{
+	json_mode = true;
+}
+
+bool use_json(void)
+{
+	return json_mode;
+}
+
+static void json_string(const char *str)
+{
+	putchar('"');
+
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		switch (c) {
+		case '"':
+		case '\\':
+			putchar('\\');
+			putchar(c);
+			break;
+		case '\n':
+			fputs("\\n", stdout);
+			break;
+		case '\t':
+			fputs("\\t", stdout);
+			break;
+		default:
+			if (c < 0x20)
+				printf("\\u%4.4x", c);
+			else
+				putchar(c);
+			break;
+		}
+	}
+
+	putchar('"');
+}
+
+/*
+ * Each packet becomes one JSON object per line, with the decoded output
+ * collected in its "lines" array indented relative to the packet header.
+ */
+void json_packet(struct timeval *tv, uint16_t index, char ident,
+			const char *label, const char *text, const char *extra)
+{
+	json_end();
+
+	printf("{\"index\":%u", index);
+
+	if (tv)
+		printf(",\"time\":%ld.%06ld", (long) tv->tv_sec,
+						(long) tv->tv_usec);
+
+	if (ident == '<')
+		fputs(",\"dir\":\"out\"", stdout);
+	else if (ident == '>')
+		fputs(",\"dir\":\"in\"", stdout);
+
+	fputs(",\"type\":", stdout);
+	json_string(label);
+
+	if (text) {
+		fputs(",\"name\":", stdout);
+		json_string(text);
+	}
+
+	if (extra) {
+		fputs(",\"info\":", stdout);
+		json_string(extra);
+	}
+
+	json_open = true;
+}
+
+void json_line(int indent, const char *fmt, ...)
+{
+	char line[1024];
+	va_list ap;
+	int n;
+
+	n = indent > 6 ? indent - 6 : 0;
+	memset(line, ' ', n);
+
+	va_start(ap, fmt);
+	vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+	va_end(ap);
+
+	if (!json_open) {
+		fputs("{\"lines\":[", stdout);
+		json_open = true;
+		json_lines = true;
+	} else if (!json_lines) {
+		fputs(",\"lines\":[", stdout);
+		json_lines = true;
+	} else {
+		putchar(',');
+	}
+
+	json_string(line);
+}
+
+void json_end(void)
+{
+	if (!json_open)
+		return;
+
+	if (json_lines)
+		putchar(']');
+
+	fputs("}\n", stdout);
+
+	json_open = false;
+	json_lines = false;
+}
+
 int num_columns(void)
 {
 	static int cached_num_columns = -1;
@@ -23,9 +23,19 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
 
 bool use_color(void);
 
+void json_enable(void);
+bool use_json(void);
+void json_packet(struct timeval *tv, uint16_t index, char ident,
+			const char *label, const char *text, const char *extra);
+void json_line(int indent, const char *fmt, ...)
+					__attribute__((format(printf, 2, 3)));
+void json_end(void);
+
 #define COLOR_OFF	"\x1B[0m"
 #define COLOR_BLACK	"\x1B[0;30m"
 #define COLOR_RED	"\x1B[0;31m"
@@ -44,6 +54,10 @@ bool use_color(void);
 
 #define print_indent(indent, color1, prefix, title, color2, fmt, args...) \
 do { \
+	if (use_json()) { \
+		json_line((indent), "%s%s" fmt, prefix, title, ## args); \
+		break; \
+	} \
 	printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
 		use_color() ? (color1) : "", prefix, title, \
 		use_color() ? (color2) : "", ## args, \
@@ -27,7 +27,10 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
@@ -40,13 +43,46 @@
 #include "src/shared/btsnoop.h"
 #include "ellisys.h"
 
+#define ELLISYS_BATCH		32
+#define ELLISYS_SNDBUF		(1024 * 1024)
+
+static const uint8_t ellisys_hdr[] = {
+	/* HCI Injection Service, Version 1 */
+	0x02, 0x00, 0x01,
+	/* DateTimeNs Object */
+	0x02, 0x00, 0x00, 0x00, 0x00,
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/* Bitrate Object, 12000000 bps */
+	0x80, 0x00, 0x1b, 0x37, 0x4b,
+	/* HCI Packet Type Object */
+	0x81, 0x00,
+	/* HCI Packet Data Object */
+	0x82
+};
+
+/*
+ * The injection protocol carries exactly one HCI packet per datagram,
+ * so instead of packing records together the datagrams are queued in
+ * preallocated buffers and handed to the kernel with a single call.
+ */
+struct ellisys_msg {
+	uint8_t hdr[sizeof(ellisys_hdr)];
+	uint8_t data[BTSNOOP_MAX_PACKET_SIZE];
+};
+
 static int ellisys_fd = -1;
 static uint16_t ellisys_index = 0xffff;
+static struct ellisys_msg *ellisys_msgs;
+static struct iovec ellisys_iov[ELLISYS_BATCH];
+static struct mmsghdr ellisys_mmsg[ELLISYS_BATCH];
+static unsigned int ellisys_count;
+static unsigned long ellisys_drops;
+static bool ellisys_failing;
 
 void ellisys_enable(const char *server, uint16_t port)
 {
 	struct sockaddr_in addr;
-	int fd;
+	int fd, i, opt = ELLISYS_SNDBUF;
 
 	if (ellisys_fd >= 0) {
 		fprintf(stderr, "Ellisys injection already enabled\n");
@@ -70,30 +106,86 @@ void ellisys_enable(const char *server, uint16_t port)
 		return;
 	}
 
+	/* Bursts of injection packets should not overrun the socket */
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt));
+
+	ellisys_msgs = calloc(ELLISYS_BATCH, sizeof(*ellisys_msgs));
+	if (!ellisys_msgs) {
+		close(fd);
+		return;
+	}
+
+	memset(ellisys_mmsg, 0, sizeof(ellisys_mmsg));
+
+	for (i = 0; i < ELLISYS_BATCH; i++) {
+		memcpy(ellisys_msgs[i].hdr, ellisys_hdr, sizeof(ellisys_hdr));
+
+		ellisys_iov[i].iov_base = &ellisys_msgs[i];
+		ellisys_mmsg[i].msg_hdr.msg_iov = &ellisys_iov[i];
+		ellisys_mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
 	ellisys_fd = fd;
 }
 
+void ellisys_flush(void)
+{
+	unsigned int sent = 0;
+	int err;
+
+	if (ellisys_fd < 0 || !ellisys_count)
+		return;
+
+	while (sent < ellisys_count) {
+		err = sendmmsg(ellisys_fd, ellisys_mmsg + sent,
+						ellisys_count - sent, 0);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		sent += err;
+	}
+
+	if (sent < ellisys_count) {
+		/* Only report the first batch of a lossy period */
+		if (!ellisys_failing)
+			perror("Failed to send Ellisys injection packets");
+
+		ellisys_drops += ellisys_count - sent;
+		ellisys_failing = true;
+	} else
+		ellisys_failing = false;
+
+	ellisys_count = 0;
+}
+
+void ellisys_cleanup(void)
+{
+	ellisys_flush();
+
+	if (ellisys_drops)
+		fprintf(stderr, "Ellisys injection dropped %lu packets\n",
+							ellisys_drops);
+
+	free(ellisys_msgs);
+	ellisys_msgs = NULL;
+
+	if (ellisys_fd >= 0) {
+		close(ellisys_fd);
+		ellisys_fd = -1;
+	}
+}
+
 void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
 {
-	uint8_t msg[] = {
-		/* HCI Injection Service, Version 1 */
-		0x02, 0x00, 0x01,
-		/* DateTimeNs Object */
-		0x02, 0x00, 0x00, 0x00, 0x00,
-					0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		/* Bitrate Object, 12000000 bps */
-		0x80, 0x00, 0x1b, 0x37, 0x4b,
-		/* HCI Packet Type Object */
-		0x81, 0x00,
-		/* HCI Packet Data Object */
-		0x82
-	};
+	struct ellisys_msg *ellisys;
+	uint8_t *msg;
 	long nsec;
 	time_t t;
 	struct tm tm;
-	struct iovec iov[2];
-	int iovcnt;
 
 	if (!tv)
 		return;
@@ -107,22 +199,11 @@ void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 	if (index != ellisys_index)
 		return;
 
-	t = tv->tv_sec;
-	localtime_r(&t, &tm);
+	if (size > sizeof(ellisys->data))
+		return;
 
-	nsec = ((tm.tm_sec + (tm.tm_min * 60) +
-			(tm.tm_hour * 3600)) * 1000000l + tv->tv_usec) * 1000l;
-
-	msg[4]  = (1900 + tm.tm_year) & 0xff;
-	msg[5]  = (1900 + tm.tm_year) >> 8;
-	msg[6]  = (tm.tm_mon + 1) & 0xff;
-	msg[7]  = tm.tm_mday & 0xff;
-	msg[8]  = (nsec & 0x0000000000ffl);
-	msg[9]  = (nsec & 0x00000000ff00l) >> 8;
-	msg[10] = (nsec & 0x000000ff0000l) >> 16;
-	msg[11] = (nsec & 0x0000ff000000l) >> 24;
-	msg[12] = (nsec & 0x00ff00000000l) >> 32;
-	msg[13] = (nsec & 0xff0000000000l) >> 40;
+	ellisys = &ellisys_msgs[ellisys_count];
+	msg = ellisys->hdr;
 
 	switch (opcode) {
 	case BTSNOOP_OPCODE_COMMAND_PKT:
@@ -147,16 +228,26 @@ void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 		return;
 	}
 
-	iov[0].iov_base = msg;
-	iov[0].iov_len  = sizeof(msg);
+	t = tv->tv_sec;
+	localtime_r(&t, &tm);
 
-	if (size > 0) {
-		iov[1].iov_base = (void *) data;
-		iov[1].iov_len  = size;
-		iovcnt = 2;
-	} else
-		iovcnt = 1;
+	nsec = ((tm.tm_sec + (tm.tm_min * 60) +
+			(tm.tm_hour * 3600)) * 1000000l + tv->tv_usec) * 1000l;
+
+	msg[4]  = (1900 + tm.tm_year) & 0xff;
+	msg[5]  = (1900 + tm.tm_year) >> 8;
+	msg[6]  = (tm.tm_mon + 1) & 0xff;
+	msg[7]  = tm.tm_mday & 0xff;
+	msg[8]  = (nsec & 0x0000000000ffl);
+	msg[9]  = (nsec & 0x00000000ff00l) >> 8;
+	msg[10] = (nsec & 0x000000ff0000l) >> 16;
+	msg[11] = (nsec & 0x0000ff000000l) >> 24;
+	msg[12] = (nsec & 0x00ff00000000l) >> 32;
+	msg[13] = (nsec & 0xff0000000000l) >> 40;
+
+	memcpy(ellisys->data, data, size);
+	ellisys_iov[ellisys_count].iov_len = sizeof(ellisys->hdr) + size;
 
-	if (writev(ellisys_fd, iov, iovcnt) < 0)
-		perror("Failed to send Ellisys injection packet");
+	if (++ellisys_count == ELLISYS_BATCH)
+		ellisys_flush();
 }
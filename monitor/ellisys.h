@@ -28,3 +28,5 @@ void ellisys_enable(const char *server, uint16_t port);
 
 void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size);
+void ellisys_flush(void);
+void ellisys_cleanup(void);
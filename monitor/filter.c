@@ -0,0 +1,882 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+#include "bt.h"
+#include "filter.h"
+
+/*
+ * Filter expressions are compiled into a postfix program that is run on
+ * a small stack of booleans for every packet:
+ *
+ *	expr := term [ ( "or" | "||" ) term ]...
+ *	term := unary [ ( "and" | "&&" ) unary ]...
+ *	unary := ( "not" | "!" ) unary | "(" expr ")" | primitive
+ *	primitive := "index" <num> | "type" ( "cmd" | "evt" | "acl" | "sco" ) |
+ *			"handle" <num> | "cid" <num> | "psm" <num> |
+ *			"att" <num> | "addr" <bdaddr>
+ *
+ * Connection handles, addresses and L2CAP channels are tracked from the
+ * traffic itself, so a filter on an address or PSM only matches once the
+ * connection or channel setup has been seen.
+ */
+
+enum filter_op {
+	OP_INDEX,
+	OP_TYPE,
+	OP_HANDLE,
+	OP_CID,
+	OP_PSM,
+	OP_ATT,
+	OP_ADDR,
+	OP_NOT,
+	OP_AND,
+	OP_OR,
+};
+
+enum filter_type {
+	TYPE_NONE,
+	TYPE_CMD,
+	TYPE_EVT,
+	TYPE_ACL,
+	TYPE_SCO,
+};
+
+struct filter_insn {
+	uint8_t op;
+	uint16_t val;
+	uint8_t addr[6];
+};
+
+struct filter_pkt {
+	uint16_t index;
+	uint8_t type;
+	int handle;
+	int cid;
+	int psm;
+	int att;
+	const uint8_t *addr;
+};
+
+struct filter_conn {
+	uint16_t index;
+	uint16_t handle;
+	uint8_t addr[6];
+	int last_cid[2];
+};
+
+struct filter_chan {
+	uint16_t index;
+	uint16_t handle;
+	uint16_t psm;
+	uint8_t ident;
+	bool out;
+	int tx_cid;
+	int rx_cid;
+};
+
+static const uint8_t empty_addr[6] = { 0x00, };
+
+static struct filter_insn *prog;
+static unsigned int prog_len;
+static bool *stack;
+
+static struct queue *conn_list;
+static struct queue *chan_list;
+
+static const char *token;
+static size_t token_len;
+static const char *expr_pos;
+
+static void next_token(void)
+{
+	while (isspace(*expr_pos))
+		expr_pos++;
+
+	token = expr_pos;
+
+	if (*expr_pos == '(' || *expr_pos == ')' || *expr_pos == '!') {
+		expr_pos++;
+	} else if (!strncmp(expr_pos, "&&", 2) ||
+					!strncmp(expr_pos, "||", 2)) {
+		expr_pos += 2;
+	} else {
+		while (*expr_pos && !isspace(*expr_pos) &&
+				!strchr("()!&|", *expr_pos))
+			expr_pos++;
+	}
+
+	token_len = expr_pos - token;
+}
+
+static bool token_is(const char *str)
+{
+	return token_len == strlen(str) && !strncmp(token, str, token_len);
+}
+
+static bool emit(uint8_t op, uint16_t val, const uint8_t *addr)
+{
+	struct filter_insn *insn;
+
+	insn = realloc(prog, (prog_len + 1) * sizeof(*insn));
+	if (!insn)
+		return false;
+
+	prog = insn;
+	insn = &prog[prog_len++];
+
+	memset(insn, 0, sizeof(*insn));
+	insn->op = op;
+	insn->val = val;
+	if (addr)
+		memcpy(insn->addr, addr, 6);
+
+	return true;
+}
+
+static bool parse_number(uint16_t *val)
+{
+	char str[16], *end;
+	unsigned long num;
+
+	if (!token_len || token_len >= sizeof(str))
+		return false;
+
+	memcpy(str, token, token_len);
+	str[token_len] = '\0';
+
+	num = strtoul(str, &end, 0);
+	if (*end || num > 0xffff)
+		return false;
+
+	*val = num;
+
+	return true;
+}
+
+static bool parse_addr(uint8_t addr[6])
+{
+	char str[18];
+	unsigned int b[6];
+	int i;
+
+	if (token_len != 17)
+		return false;
+
+	memcpy(str, token, token_len);
+	str[token_len] = '\0';
+
+	if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x", &b[5], &b[4], &b[3],
+						&b[2], &b[1], &b[0]) != 6)
+		return false;
+
+	for (i = 0; i < 6; i++)
+		addr[i] = b[i];
+
+	return true;
+}
+
+static const struct {
+	const char *str;
+	uint8_t op;
+} primitive_table[] = {
+	{ "index",	OP_INDEX	},
+	{ "type",	OP_TYPE		},
+	{ "handle",	OP_HANDLE	},
+	{ "cid",	OP_CID		},
+	{ "psm",	OP_PSM		},
+	{ "att",	OP_ATT		},
+	{ "addr",	OP_ADDR		},
+	{ }
+};
+
+static const struct {
+	const char *str;
+	uint8_t type;
+} type_table[] = {
+	{ "cmd",	TYPE_CMD	},
+	{ "evt",	TYPE_EVT	},
+	{ "acl",	TYPE_ACL	},
+	{ "sco",	TYPE_SCO	},
+	{ }
+};
+
+static bool parse_primitive(void)
+{
+	uint8_t addr[6];
+	uint16_t val;
+	uint8_t op;
+	int i;
+
+	for (i = 0; primitive_table[i].str; i++) {
+		if (token_is(primitive_table[i].str))
+			break;
+	}
+
+	if (!primitive_table[i].str)
+		return false;
+
+	op = primitive_table[i].op;
+
+	next_token();
+
+	switch (op) {
+	case OP_TYPE:
+		for (i = 0; type_table[i].str; i++) {
+			if (token_is(type_table[i].str))
+				break;
+		}
+
+		if (!type_table[i].str)
+			return false;
+
+		val = type_table[i].type;
+		break;
+	case OP_ADDR:
+		if (!parse_addr(addr))
+			return false;
+
+		next_token();
+
+		return emit(op, 0, addr);
+	default:
+		if (!parse_number(&val))
+			return false;
+		break;
+	}
+
+	next_token();
+
+	return emit(op, val, NULL);
+}
+
+static bool parse_or(void);
+
+static bool parse_unary(void)
+{
+	if (token_is("not") || token_is("!")) {
+		next_token();
+
+		if (!parse_unary())
+			return false;
+
+		return emit(OP_NOT, 0, NULL);
+	}
+
+	if (token_is("(")) {
+		next_token();
+
+		if (!parse_or() || !token_is(")"))
+			return false;
+
+		next_token();
+
+		return true;
+	}
+
+	return parse_primitive();
+}
+
+static bool parse_and(void)
+{
+	if (!parse_unary())
+		return false;
+
+	while (token_is("and") || token_is("&&")) {
+		next_token();
+
+		if (!parse_unary() || !emit(OP_AND, 0, NULL))
+			return false;
+	}
+
+	return true;
+}
+
+static bool parse_or(void)
+{
+	if (!parse_and())
+		return false;
+
+	while (token_is("or") || token_is("||")) {
+		next_token();
+
+		if (!parse_and() || !emit(OP_OR, 0, NULL))
+			return false;
+	}
+
+	return true;
+}
+
+bool filter_compile(const char *expr)
+{
+	filter_cleanup();
+
+	expr_pos = expr;
+	next_token();
+
+	if (!parse_or() || token_len) {
+		if (*token)
+			fprintf(stderr, "Invalid filter expression at \"%s\"\n",
+									token);
+		else
+			fprintf(stderr, "Incomplete filter expression\n");
+		goto failed;
+	}
+
+	stack = new0(bool, prog_len);
+	conn_list = queue_new();
+	chan_list = queue_new();
+
+	if (!stack || !conn_list || !chan_list) {
+		fprintf(stderr, "Failed to allocate filter\n");
+		goto failed;
+	}
+
+	return true;
+
+failed:
+	filter_cleanup();
+	return false;
+}
+
+void filter_cleanup(void)
+{
+	free(prog);
+	prog = NULL;
+	prog_len = 0;
+
+	free(stack);
+	stack = NULL;
+
+	queue_destroy(conn_list, free);
+	conn_list = NULL;
+
+	queue_destroy(chan_list, free);
+	chan_list = NULL;
+}
+
+static bool conn_match(const void *a, const void *b)
+{
+	const struct filter_conn *conn = a;
+	const struct filter_conn *match = b;
+
+	return conn->index == match->index && conn->handle == match->handle;
+}
+
+static struct filter_conn *conn_lookup(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct filter_conn match, *conn;
+
+	match.index = index;
+	match.handle = handle;
+
+	conn = queue_find(conn_list, conn_match, &match);
+	if (conn || !create)
+		return conn;
+
+	conn = new0(struct filter_conn, 1);
+	if (!conn)
+		return NULL;
+
+	conn->index = index;
+	conn->handle = handle;
+	conn->last_cid[0] = -1;
+	conn->last_cid[1] = -1;
+
+	queue_push_tail(conn_list, conn);
+
+	return conn;
+}
+
+static void conn_complete(uint16_t index, uint16_t handle,
+							const uint8_t *addr)
+{
+	struct filter_conn *conn;
+
+	conn = conn_lookup(index, handle, true);
+	if (conn)
+		memcpy(conn->addr, addr, 6);
+}
+
+static bool chan_match_handle(const void *a, const void *b)
+{
+	const struct filter_chan *chan = a;
+	const struct filter_conn *conn = b;
+
+	return chan->index == conn->index && chan->handle == conn->handle;
+}
+
+static void conn_remove(uint16_t index, uint16_t handle)
+{
+	struct filter_conn *conn;
+
+	conn = conn_lookup(index, handle, false);
+	if (!conn)
+		return;
+
+	queue_remove_all(chan_list, chan_match_handle, conn, free);
+	queue_remove(conn_list, conn);
+	free(conn);
+}
+
+static bool conn_match_index(const void *a, const void *b)
+{
+	const struct filter_conn *conn = a;
+
+	return conn->index == PTR_TO_UINT(b);
+}
+
+static bool chan_match_index(const void *a, const void *b)
+{
+	const struct filter_chan *chan = a;
+
+	return chan->index == PTR_TO_UINT(b);
+}
+
+static void index_remove(uint16_t index)
+{
+	queue_remove_all(chan_list, chan_match_index, UINT_TO_PTR(index),
+									free);
+	queue_remove_all(conn_list, conn_match_index, UINT_TO_PTR(index),
+									free);
+}
+
+static void evt_conn_complete(uint16_t index, const void *data,
+							uint16_t size)
+{
+	const struct bt_hci_evt_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_complete(index, le16_to_cpu(evt->handle), evt->bdaddr);
+}
+
+static void evt_disconnect_complete(uint16_t index, const void *data,
+							uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_remove(index, le16_to_cpu(evt->handle));
+}
+
+static void evt_le_meta_event(uint16_t index, const void *data,
+							uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_complete *evt = data + 1;
+	uint8_t subevent = *((const uint8_t *) data);
+
+	if (size < 1 + sizeof(*evt))
+		return;
+
+	if (subevent != BT_HCI_EVT_LE_CONN_COMPLETE || evt->status)
+		return;
+
+	conn_complete(index, le16_to_cpu(evt->handle), evt->peer_addr);
+}
+
+static void process_event(uint16_t index, const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_hdr *hdr = data;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+		evt_conn_complete(index, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(index, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(index, data, size);
+		break;
+	}
+}
+
+struct chan_match_data {
+	const struct filter_conn *conn;
+	bool out;
+	uint8_t ident;
+	int cid;
+};
+
+static bool chan_match_ident(const void *a, const void *b)
+{
+	const struct filter_chan *chan = a;
+	const struct chan_match_data *match = b;
+
+	if (chan->index != match->conn->index ||
+				chan->handle != match->conn->handle)
+		return false;
+
+	if (chan->tx_cid >= 0 && chan->rx_cid >= 0)
+		return false;
+
+	return chan->out != match->out && chan->ident == match->ident;
+}
+
+static bool chan_match_cid(const void *a, const void *b)
+{
+	const struct filter_chan *chan = a;
+	const struct chan_match_data *match = b;
+
+	if (chan->index != match->conn->index ||
+				chan->handle != match->conn->handle)
+		return false;
+
+	return match->out ? chan->tx_cid == match->cid :
+					chan->rx_cid == match->cid;
+}
+
+static void chan_request(const struct filter_conn *conn, bool out,
+				uint8_t ident, uint16_t psm, uint16_t scid)
+{
+	struct filter_chan *chan;
+
+	chan = new0(struct filter_chan, 1);
+	if (!chan)
+		return;
+
+	chan->index = conn->index;
+	chan->handle = conn->handle;
+	chan->psm = psm;
+	chan->ident = ident;
+	chan->out = out;
+
+	/* The source CID is where the requester receives its data */
+	if (out) {
+		chan->rx_cid = scid;
+		chan->tx_cid = -1;
+	} else {
+		chan->tx_cid = scid;
+		chan->rx_cid = -1;
+	}
+
+	queue_push_head(chan_list, chan);
+}
+
+static void chan_response(const struct filter_conn *conn, bool out,
+				uint8_t ident, uint16_t dcid, uint16_t result)
+{
+	struct chan_match_data match;
+	struct filter_chan *chan;
+
+	match.conn = conn;
+	match.out = out;
+	match.ident = ident;
+
+	chan = queue_find(chan_list, chan_match_ident, &match);
+	if (!chan)
+		return;
+
+	/* Pending results are followed by another response */
+	if (result == 0x0001)
+		return;
+
+	if (result) {
+		queue_remove(chan_list, chan);
+		free(chan);
+		return;
+	}
+
+	if (chan->out)
+		chan->tx_cid = dcid;
+	else
+		chan->rx_cid = dcid;
+}
+
+static void sig_conn_req(const struct filter_conn *conn, bool out,
+			uint8_t ident, const void *data, uint16_t size)
+{
+	const struct bt_l2cap_pdu_conn_req *pdu = data;
+
+	if (size < sizeof(*pdu))
+		return;
+
+	chan_request(conn, out, ident, le16_to_cpu(pdu->psm),
+						le16_to_cpu(pdu->scid));
+}
+
+static void sig_conn_rsp(const struct filter_conn *conn, bool out,
+			uint8_t ident, const void *data, uint16_t size)
+{
+	const struct bt_l2cap_pdu_conn_rsp *pdu = data;
+
+	if (size < sizeof(*pdu))
+		return;
+
+	chan_response(conn, out, ident, le16_to_cpu(pdu->dcid),
+						le16_to_cpu(pdu->result));
+}
+
+static void sig_le_conn_req(const struct filter_conn *conn, bool out,
+			uint8_t ident, const void *data, uint16_t size)
+{
+	const struct bt_l2cap_pdu_le_conn_req *pdu = data;
+
+	if (size < sizeof(*pdu))
+		return;
+
+	chan_request(conn, out, ident, le16_to_cpu(pdu->psm),
+						le16_to_cpu(pdu->scid));
+}
+
+static void sig_le_conn_rsp(const struct filter_conn *conn, bool out,
+			uint8_t ident, const void *data, uint16_t size)
+{
+	const struct bt_l2cap_pdu_le_conn_rsp *pdu = data;
+
+	if (size < sizeof(*pdu))
+		return;
+
+	/* LE results have no pending value */
+	chan_response(conn, out, ident, le16_to_cpu(pdu->dcid),
+					le16_to_cpu(pdu->result) ? 0xffff : 0);
+}
+
+static void sig_disconn_rsp(const struct filter_conn *conn, bool out,
+			uint8_t ident, const void *data, uint16_t size)
+{
+	const struct bt_l2cap_pdu_disconn_rsp *pdu = data;
+	struct chan_match_data match;
+
+	if (size < sizeof(*pdu))
+		return;
+
+	/* The destination CID belongs to the sender of the response */
+	match.conn = conn;
+	match.out = !out;
+	match.cid = le16_to_cpu(pdu->dcid);
+
+	queue_remove_all(chan_list, chan_match_cid, &match, free);
+}
+
+static void process_signaling(const struct filter_conn *conn, bool out,
+					const void *data, uint16_t size)
+{
+	while (size >= sizeof(struct bt_l2cap_hdr_sig)) {
+		const struct bt_l2cap_hdr_sig *hdr = data;
+		uint16_t len = le16_to_cpu(hdr->len);
+
+		data += sizeof(*hdr);
+		size -= sizeof(*hdr);
+
+		if (len > size)
+			return;
+
+		switch (hdr->code) {
+		case BT_L2CAP_PDU_CONN_REQ:
+			sig_conn_req(conn, out, hdr->ident, data, len);
+			break;
+		case BT_L2CAP_PDU_CONN_RSP:
+			sig_conn_rsp(conn, out, hdr->ident, data, len);
+			break;
+		case BT_L2CAP_PDU_LE_CONN_REQ:
+			sig_le_conn_req(conn, out, hdr->ident, data, len);
+			break;
+		case BT_L2CAP_PDU_LE_CONN_RSP:
+			sig_le_conn_rsp(conn, out, hdr->ident, data, len);
+			break;
+		case BT_L2CAP_PDU_DISCONN_RSP:
+			sig_disconn_rsp(conn, out, hdr->ident, data, len);
+			break;
+		}
+
+		data += len;
+		size -= len;
+	}
+}
+
+static void process_acl(struct filter_pkt *pkt, bool out,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	const struct bt_l2cap_hdr *l2cap;
+	struct filter_conn *conn;
+	struct filter_chan *chan;
+	struct chan_match_data match;
+	uint16_t handle;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	handle = le16_to_cpu(hdr->handle);
+	pkt->handle = handle & 0x0fff;
+
+	conn = conn_lookup(pkt->index, pkt->handle, true);
+	if (!conn)
+		return;
+
+	if (memcmp(conn->addr, empty_addr, 6))
+		pkt->addr = conn->addr;
+
+	/* Continuation fragments belong to the last channel started */
+	if (((handle >> 12) & 0x03) == 0x01) {
+		pkt->cid = conn->last_cid[out];
+	} else {
+		l2cap = data;
+		if (size < sizeof(*l2cap))
+			return;
+
+		data += sizeof(*l2cap);
+		size -= sizeof(*l2cap);
+
+		pkt->cid = le16_to_cpu(l2cap->cid);
+		conn->last_cid[out] = pkt->cid;
+
+		switch (pkt->cid) {
+		case 0x0001:
+		case 0x0005:
+			process_signaling(conn, out, data, size);
+			break;
+		case 0x0004:
+			if (size > 0)
+				pkt->att = *((const uint8_t *) data);
+			break;
+		}
+	}
+
+	if (pkt->cid < 0x0040)
+		return;
+
+	match.conn = conn;
+	match.out = out;
+	match.cid = pkt->cid;
+
+	chan = queue_find(chan_list, chan_match_cid, &match);
+	if (chan)
+		pkt->psm = chan->psm;
+}
+
+static bool run_insn(const struct filter_insn *insn,
+						const struct filter_pkt *pkt)
+{
+	switch (insn->op) {
+	case OP_INDEX:
+		return pkt->index == insn->val;
+	case OP_TYPE:
+		return pkt->type == insn->val;
+	case OP_HANDLE:
+		return pkt->handle == insn->val;
+	case OP_CID:
+		return pkt->cid == insn->val;
+	case OP_PSM:
+		return pkt->psm == insn->val;
+	case OP_ATT:
+		return pkt->att == insn->val;
+	case OP_ADDR:
+		return pkt->addr && !memcmp(pkt->addr, insn->addr, 6);
+	}
+
+	return false;
+}
+
+bool filter_match(uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	struct filter_pkt pkt;
+	unsigned int i, sp = 0;
+
+	if (!prog)
+		return true;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.index = index;
+	pkt.handle = -1;
+	pkt.cid = -1;
+	pkt.psm = -1;
+	pkt.att = -1;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		return true;
+	case BTSNOOP_OPCODE_DEL_INDEX:
+		index_remove(index);
+		return true;
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		pkt.type = TYPE_CMD;
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		pkt.type = TYPE_EVT;
+		process_event(index, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		pkt.type = TYPE_ACL;
+		process_acl(&pkt, opcode == BTSNOOP_OPCODE_ACL_TX_PKT,
+								data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		pkt.type = TYPE_SCO;
+		if (size >= 2)
+			pkt.handle = get_le16(data) & 0x0fff;
+		break;
+	}
+
+	for (i = 0; i < prog_len; i++) {
+		const struct filter_insn *insn = &prog[i];
+
+		switch (insn->op) {
+		case OP_NOT:
+			stack[sp - 1] = !stack[sp - 1];
+			break;
+		case OP_AND:
+			sp--;
+			stack[sp - 1] = stack[sp - 1] && stack[sp];
+			break;
+		case OP_OR:
+			sp--;
+			stack[sp - 1] = stack[sp - 1] || stack[sp];
+			break;
+		default:
+			stack[sp++] = run_insn(insn, &pkt);
+			break;
+		}
+	}
+
+	return stack[0];
+}
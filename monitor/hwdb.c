@@ -27,6 +27,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "hwdb.h"
@@ -34,23 +35,45 @@
 #ifdef HAVE_UDEV_HWDB_NEW
 #include <libudev.h>
 
+#define OUI_CACHE_SIZE	256
+
+/*
+ * The database is opened on first use and kept open. Captures print the
+ * same few addresses over and over, so company lookups, misses included,
+ * are cached by OUI.
+ */
+static struct udev *udev;
+static struct udev_hwdb *hwdb;
+
+static struct {
+	bool valid;
+	uint32_t oui;
+	char *company;
+} oui_cache[OUI_CACHE_SIZE];
+
+static struct udev_hwdb *get_hwdb(void)
+{
+	if (hwdb)
+		return hwdb;
+
+	if (!udev) {
+		udev = udev_new();
+		if (!udev)
+			return NULL;
+	}
+
+	hwdb = udev_hwdb_new(udev);
+
+	return hwdb;
+}
+
 bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
 	struct udev_list_entry *head, *entry;
-	bool result;
 
-	udev = udev_new();
-	if (!udev)
+	if (!get_hwdb())
 		return false;
 
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb) {
-		result = false;
-		goto done;
-	}
-
 	*vendor = NULL;
 	*model = NULL;
 
@@ -68,61 +91,56 @@ bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
 			*model = strdup(udev_list_entry_get_value(entry));
 	}
 
-	hwdb = udev_hwdb_unref(hwdb);
+	return true;
+}
 
-	result = true;
+static char *lookup_company(const char *modalias)
+{
+	struct udev_list_entry *head, *entry;
 
-done:
-	udev = udev_unref(udev);
+	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
 
-	return result;
+	udev_list_entry_foreach(entry, head) {
+		const char *name = udev_list_entry_get_name(entry);
+
+		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE"))
+			return strdup(udev_list_entry_get_value(entry));
+	}
+
+	return NULL;
 }
 
 bool hwdb_get_company(const uint8_t *bdaddr, char **company)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
-	struct udev_list_entry *head, *entry;
 	char modalias[11];
-	bool result;
+	uint32_t oui;
+	unsigned int slot;
 
 	if (!bdaddr[2] && !bdaddr[1] && !bdaddr[0])
 		return false;
 
-	sprintf(modalias, "OUI:%2.2X%2.2X%2.2X",
-				bdaddr[5], bdaddr[4], bdaddr[3]);
-
-	udev = udev_new();
-	if (!udev)
-		return false;
-
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb) {
-		result = false;
-		goto done;
-	}
+	oui = bdaddr[5] << 16 | bdaddr[4] << 8 | bdaddr[3];
+	slot = (bdaddr[5] ^ bdaddr[4] ^ bdaddr[3]) % OUI_CACHE_SIZE;
 
-	*company = NULL;
+	if (!oui_cache[slot].valid || oui_cache[slot].oui != oui) {
+		if (!get_hwdb())
+			return false;
 
-	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
+		sprintf(modalias, "OUI:%2.2X%2.2X%2.2X",
+					bdaddr[5], bdaddr[4], bdaddr[3]);
 
-	udev_list_entry_foreach(entry, head) {
-		const char *name = udev_list_entry_get_name(entry);
-
-		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE")) {
-			*company = strdup(udev_list_entry_get_value(entry));
-			break;
-		}
+		free(oui_cache[slot].company);
+		oui_cache[slot].company = lookup_company(modalias);
+		oui_cache[slot].oui = oui;
+		oui_cache[slot].valid = true;
 	}
 
-	hwdb = udev_hwdb_unref(hwdb);
-
-	result = true;
-
-done:
-	udev = udev_unref(udev);
+	if (oui_cache[slot].company)
+		*company = strdup(oui_cache[slot].company);
+	else
+		*company = NULL;
 
-	return result;
+	return true;
 }
 #else
 bool hwdb_get_vendor_model(const char *modalias, char **vendor, char **model)
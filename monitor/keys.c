@@ -47,6 +47,29 @@ struct irk_data {
 
 static struct queue *irk_list;
 
+struct resolve_data {
+	bool found;
+	uint8_t addr[6];
+	uint8_t ident[6];
+	uint8_t ident_type;
+};
+
+/*
+ * Traces tend to show the same private address in every advertising
+ * report until it rotates, so the outcome of resolving it against all
+ * known IRKs is remembered. A slot only matches its exact address, and
+ * a resolvable private address is never all zeros, so a cleared slot
+ * can not match anything. Stale addresses simply get replaced.
+ */
+#define RESOLVE_CACHE_SIZE 256
+
+static struct resolve_data resolve_cache[RESOLVE_CACHE_SIZE];
+
+static void resolve_cache_flush(void)
+{
+	memset(resolve_cache, 0, sizeof(resolve_cache));
+}
+
 void keys_setup(void)
 {
 	crypto = bt_crypto_new();
@@ -59,12 +82,16 @@ void keys_cleanup(void)
 	bt_crypto_unref(crypto);
 
 	queue_destroy(irk_list, free);
+
+	resolve_cache_flush();
 }
 
 void keys_update_identity_key(const uint8_t key[16])
 {
 	struct irk_data *irk;
 
+	resolve_cache_flush();
+
 	irk = queue_peek_tail(irk_list);
 	if (irk && !memcmp(irk->key, empty_key, 16)) {
 		memcpy(irk->key, key, 16);
@@ -83,6 +110,8 @@ void keys_update_identity_addr(const uint8_t addr[6], uint8_t addr_type)
 {
 	struct irk_data *irk;
 
+	resolve_cache_flush();
+
 	irk = queue_peek_tail(irk_list);
 	if (irk && !memcmp(irk->addr, empty_addr, 6)) {
 		memcpy(irk->addr, addr, 6);
@@ -99,13 +128,6 @@ void keys_update_identity_addr(const uint8_t addr[6], uint8_t addr_type)
 	}
 }
 
-struct resolve_data {
-	bool found;
-	uint8_t addr[6];
-	uint8_t ident[6];
-	uint8_t ident_type;
-};
-
 static void try_resolve_irk(void *data, void *user_data)
 {
 	struct irk_data *irk = data;
@@ -115,7 +137,12 @@ static void try_resolve_irk(void *data, void *user_data)
 	if (result->found)
 		return;
 
-	bt_crypto_ah(crypto, irk->key, result->addr + 3, local_hash);
+	/* Entries still waiting for their key can not match anything */
+	if (!memcmp(irk->key, empty_key, 16))
+		return;
+
+	if (!bt_crypto_ah(crypto, irk->key, result->addr + 3, local_hash))
+		return;
 
 	if (!memcmp(result->addr, local_hash, 3)) {
 		result->found = true;
@@ -127,16 +154,21 @@ static void try_resolve_irk(void *data, void *user_data)
 bool keys_resolve_identity(const uint8_t addr[6], uint8_t ident[6],
 							uint8_t *ident_type)
 {
-	struct resolve_data result;
+	struct resolve_data *result;
+
+	/* The hash and prand halves are both effectively random */
+	result = &resolve_cache[(addr[0] ^ addr[3]) % RESOLVE_CACHE_SIZE];
 
-	result.found = false;
-	memcpy(result.addr, addr, 6);
+	if (memcmp(result->addr, addr, 6)) {
+		result->found = false;
+		memcpy(result->addr, addr, 6);
 
-	queue_foreach(irk_list, try_resolve_irk, &result);
+		queue_foreach(irk_list, try_resolve_irk, result);
+	}
 
-	if (result.found) {
-		memcpy(ident, result.ident, 6);
-		*ident_type = result.ident_type;
+	if (result->found) {
+		memcpy(ident, result->ident, 6);
+		*ident_type = result->ident_type;
 		return true;
 	}
 
@@ -34,6 +34,8 @@
 #include <bluetooth/bluetooth.h>
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att-types.h"
 #include "bt.h"
 #include "packet.h"
 #include "display.h"
@@ -43,9 +45,8 @@
 #include "sdp.h"
 #include "avctp.h"
 
-#define MAX_CHAN 64
-
 struct chan_data {
+	uint16_t id;
 	uint16_t index;
 	uint16_t handle;
 	uint16_t scid;
@@ -55,222 +56,254 @@ struct chan_data {
 	uint8_t  mode;
 };
 
-static struct chan_data chan_list[MAX_CHAN];
+struct frag_data {
+	void *buf;
+	uint16_t size;
+	uint16_t pos;
+	uint16_t len;
+	uint16_t cid;
+};
 
-static void assign_scid(const struct l2cap_frame *frame,
-				uint16_t scid, uint16_t psm, uint8_t ctrlid)
+struct conn_data {
+	uint16_t index;
+	uint16_t handle;
+	struct queue *chan_list;
+	struct frag_data frag[2];
+};
+
+#define CONN_HASH_SIZE 64
+
+static struct queue *conn_hash[CONN_HASH_SIZE];
+static struct queue *amp_list;
+static uint16_t chan_id;
+
+static struct queue **conn_bucket(uint16_t index, uint16_t handle)
 {
-	int i, n = -1;
+	return &conn_hash[((index << 12) ^ handle) % CONN_HASH_SIZE];
+}
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000)
-			n = i;
+static bool match_conn(const void *a, const void *b)
+{
+	const struct conn_data *conn = a;
+	const struct conn_data *match = b;
 
-		if (chan_list[i].index != frame->index)
-			continue;
+	return conn->index == match->index && conn->handle == match->handle;
+}
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+static struct conn_data *get_conn(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct queue **bucket = conn_bucket(index, handle);
+	struct conn_data match, *conn;
 
-		if (frame->in) {
-			if (chan_list[i].dcid == scid) {
-				n = i;
-				break;
-			}
-		} else {
-			if (chan_list[i].scid == scid) {
-				n = i;
-				break;
-			}
-		}
+	match.index = index;
+	match.handle = handle;
+
+	conn = queue_find(*bucket, match_conn, &match);
+	if (conn || !create)
+		return conn;
+
+	if (!*bucket) {
+		*bucket = queue_new();
+		if (!*bucket)
+			return NULL;
 	}
 
-	if (n < 0)
-		return;
+	conn = new0(struct conn_data, 1);
+	if (!conn)
+		return NULL;
 
-	memset(&chan_list[n], 0, sizeof(chan_list[n]));
-	chan_list[n].index = frame->index;
-	chan_list[n].handle = frame->handle;
+	conn->chan_list = queue_new();
+	if (!conn->chan_list) {
+		free(conn);
+		return NULL;
+	}
 
-	if (frame->in)
-		chan_list[n].dcid = scid;
-	else
-		chan_list[n].scid = scid;
+	conn->index = index;
+	conn->handle = handle;
+
+	queue_push_tail(*bucket, conn);
 
-	chan_list[n].psm = psm;
-	chan_list[n].ctrlid = ctrlid;
-	chan_list[n].mode = 0;
+	return conn;
 }
 
-static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
-{
-	int i;
+struct chan_match {
+	uint16_t cid;
+	bool scid;
+};
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+static bool match_chan(const void *a, const void *b)
+{
+	const struct chan_data *chan = a;
+	const struct chan_match *match = b;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	if (match->scid)
+		return chan->scid == match->cid;
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		}
-	}
+	return chan->dcid == match->cid;
 }
 
-static void assign_dcid(const struct l2cap_frame *frame,
-					uint16_t dcid, uint16_t scid)
+static struct chan_data *find_chan(const struct l2cap_frame *frame,
+						uint16_t cid, bool scid)
 {
-	int i;
+	struct conn_data *conn;
+	struct chan_match match;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	conn = get_conn(frame->index, frame->handle, false);
+	if (!conn)
+		return NULL;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	match.cid = cid;
+	match.scid = scid;
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].dcid = dcid;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].scid = dcid;
-				break;
-			}
-		}
-	}
+	return queue_find(conn->chan_list, match_chan, &match);
 }
 
-static void assign_mode(const struct l2cap_frame *frame,
-					uint8_t mode, uint16_t dcid)
+static void chan_free(void *data)
 {
-	int i;
+	struct chan_data *chan = data;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	if (chan->ctrlid)
+		queue_remove(amp_list, chan);
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
-
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		}
-	}
+	free(chan);
 }
 
-static uint16_t get_psm(const struct l2cap_frame *frame)
+static void assign_scid(const struct l2cap_frame *frame,
+				uint16_t scid, uint16_t psm, uint8_t ctrlid)
 {
-	int i;
+	struct conn_data *conn;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	conn = get_conn(frame->index, frame->handle, true);
+	if (!conn)
+		return;
 
-		if (chan_list[i].handle != frame->handle &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+	chan = find_chan(frame, scid, !frame->in);
+	if (chan) {
+		if (chan->ctrlid)
+			queue_remove(amp_list, chan);
+	} else {
+		chan = new0(struct chan_data, 1);
+		if (!chan)
+			return;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return chan_list[i].psm;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return chan_list[i].psm;
-		}
+		queue_push_tail(conn->chan_list, chan);
 	}
 
-	return 0;
+	memset(chan, 0, sizeof(*chan));
+
+	if (!++chan_id)
+		chan_id++;
+
+	chan->id = chan_id;
+	chan->index = frame->index;
+	chan->handle = frame->handle;
+
+	if (frame->in)
+		chan->dcid = scid;
+	else
+		chan->scid = scid;
+
+	chan->psm = psm;
+	chan->ctrlid = ctrlid;
+	chan->mode = 0;
+
+	/* Channels moved to an AMP controller carry data on its index */
+	if (ctrlid) {
+		if (!amp_list)
+			amp_list = queue_new();
+
+		queue_push_tail(amp_list, chan);
+	}
 }
 
-static uint8_t get_mode(const struct l2cap_frame *frame)
+static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 {
-	int i;
+	struct conn_data *conn;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	chan = find_chan(frame, scid, frame->in);
+	if (!chan)
+		return;
 
-		if (chan_list[i].handle != frame->handle &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+	conn = get_conn(frame->index, frame->handle, false);
+	queue_remove(conn->chan_list, chan);
+	chan_free(chan);
+}
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return chan_list[i].mode;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return chan_list[i].mode;
-		}
-	}
+static void assign_dcid(const struct l2cap_frame *frame,
+					uint16_t dcid, uint16_t scid)
+{
+	struct chan_data *chan;
+
+	chan = find_chan(frame, scid, frame->in);
+	if (!chan)
+		return;
 
-	return 0;
+	if (frame->in)
+		chan->dcid = dcid;
+	else
+		chan->scid = dcid;
 }
 
-static uint16_t get_chan(const struct l2cap_frame *frame)
+static void assign_mode(const struct l2cap_frame *frame,
+					uint8_t mode, uint16_t dcid)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	chan = find_chan(frame, dcid, frame->in);
+	if (chan)
+		chan->mode = mode;
+}
 
-		if (chan_list[i].handle != frame->handle &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+static bool match_amp_chan(const void *a, const void *b)
+{
+	const struct chan_data *chan = a;
+	const struct l2cap_frame *frame = b;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return i;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return i;
-		}
-	}
+	if (chan->handle != frame->handle && chan->ctrlid != frame->index)
+		return false;
+
+	if (frame->in)
+		return chan->scid == frame->cid;
 
-	return 0;
+	return chan->dcid == frame->cid;
 }
 
-#define MAX_INDEX 16
+static const struct chan_data *get_chan_data(const struct l2cap_frame *frame)
+{
+	struct chan_data *chan;
 
-struct index_data {
-	void *frag_buf;
-	uint16_t frag_pos;
-	uint16_t frag_len;
-	uint16_t frag_cid;
-};
+	chan = find_chan(frame, frame->cid, frame->in);
+	if (chan)
+		return chan;
 
-static struct index_data index_list[MAX_INDEX][2];
+	return queue_find(amp_list, match_amp_chan, frame);
+}
 
-static void clear_fragment_buffer(uint16_t index, bool in)
+static void clear_fragment_buffer(struct frag_data *frag)
 {
-	free(index_list[index][in].frag_buf);
-	index_list[index][in].frag_buf = NULL;
-	index_list[index][in].frag_pos = 0;
-	index_list[index][in].frag_len = 0;
+	frag->pos = 0;
+	frag->len = 0;
+}
+
+void l2cap_disconnect(uint16_t index, uint16_t handle)
+{
+	struct queue **bucket = conn_bucket(index, handle);
+	struct conn_data match, *conn;
+
+	match.index = index;
+	match.handle = handle;
+
+	conn = queue_remove_if(*bucket, match_conn, &match);
+	if (!conn)
+		return;
+
+	queue_destroy(conn->chan_list, chan_free);
+	free(conn->frag[0].buf);
+	free(conn->frag[1].buf);
+	free(conn);
 }
 
 static void print_psm(uint16_t psm)
@@ -1117,15 +1150,20 @@ static void l2cap_frame_init(struct l2cap_frame *frame,
 				uint16_t index, bool in, uint16_t handle,
 				uint16_t cid, const void *data, uint16_t size)
 {
+	const struct chan_data *chan;
+
 	frame->index  = index;
 	frame->in     = in;
 	frame->handle = handle;
 	frame->cid    = cid;
 	frame->data   = data;
 	frame->size   = size;
-	frame->psm    = get_psm(frame);
-	frame->mode   = get_mode(frame);
-	frame->chan   = get_chan(frame);
+
+	chan = get_chan_data(frame);
+
+	frame->psm    = chan ? chan->psm : 0;
+	frame->mode   = chan ? chan->mode : 0;
+	frame->chan   = chan ? chan->id : 0;
 }
 
 static void bredr_sig_packet(uint16_t index, bool in, uint16_t handle,
@@ -2105,71 +2143,66 @@ struct att_opcode_data {
 	bool fixed;
 };
 
-static const struct att_opcode_data att_opcode_table[] = {
-	{ 0x01, "Error Response",
+static const struct att_opcode_data att_opcode_table[256] = {
+	[0x01] = { 0x01, "Error Response",
 			att_error_response, 4, true },
-	{ 0x02, "Exchange MTU Request",
+	[0x02] = { 0x02, "Exchange MTU Request",
 			att_exchange_mtu_req, 2, true },
-	{ 0x03, "Exchange MTU Response",
+	[0x03] = { 0x03, "Exchange MTU Response",
 			att_exchange_mtu_rsp, 2, true },
-	{ 0x04, "Find Information Request",
+	[0x04] = { 0x04, "Find Information Request",
 			att_find_info_req, 4, true },
-	{ 0x05, "Find Information Response",
+	[0x05] = { 0x05, "Find Information Response",
 			att_find_info_rsp, 5, false },
-	{ 0x06, "Find By Type Value Request",
+	[0x06] = { 0x06, "Find By Type Value Request",
 			att_find_by_type_val_req, 6, false },
-	{ 0x07, "Find By Type Value Response",
+	[0x07] = { 0x07, "Find By Type Value Response",
 			att_find_by_type_val_rsp, 4, false },
-	{ 0x08, "Read By Type Request",
+	[0x08] = { 0x08, "Read By Type Request",
 			att_read_type_req, 6, false },
-	{ 0x09, "Read By Type Response",
+	[0x09] = { 0x09, "Read By Type Response",
 			att_read_type_rsp, 3, false },
-	{ 0x0a, "Read Request",
+	[0x0a] = { 0x0a, "Read Request",
 			att_read_req, 2, true },
-	{ 0x0b, "Read Response",
+	[0x0b] = { 0x0b, "Read Response",
 			att_read_rsp, 0, false },
-	{ 0x0c, "Read Blob Request",
+	[0x0c] = { 0x0c, "Read Blob Request",
 			att_read_blob_req, 4, true },
-	{ 0x0d, "Read Blob Response",
+	[0x0d] = { 0x0d, "Read Blob Response",
 			att_read_blob_rsp, 0, false },
-	{ 0x0e, "Read Multiple Request",
+	[0x0e] = { 0x0e, "Read Multiple Request",
 			att_read_multiple_req, 4, false },
-	{ 0x0f, "Read Multiple Response"	},
-	{ 0x10, "Read By Group Type Request",
+	[0x0f] = { 0x0f, "Read Multiple Response"	},
+	[0x10] = { 0x10, "Read By Group Type Request",
 			att_read_group_type_req, 6, false },
-	{ 0x11, "Read By Group Type Response",
+	[0x11] = { 0x11, "Read By Group Type Response",
 			att_read_group_type_rsp, 4, false },
-	{ 0x12, "Write Request"	,
+	[0x12] = { 0x12, "Write Request"	,
 			att_write_req, 2, false	},
-	{ 0x13, "Write Response",
+	[0x13] = { 0x13, "Write Response",
 			att_write_rsp, 0, true	},
-	{ 0x16, "Prepare Write Request",
+	[0x16] = { 0x16, "Prepare Write Request",
 			att_prepare_write_req, 4, false },
-	{ 0x17, "Prepare Write Response",
+	[0x17] = { 0x17, "Prepare Write Response",
 			att_prepare_write_rsp, 4, false },
-	{ 0x18, "Execute Write Request",
+	[0x18] = { 0x18, "Execute Write Request",
 			att_execute_write_req, 1, true },
-	{ 0x19, "Execute Write Response"	},
-	{ 0x1b, "Handle Value Notification",
+	[0x19] = { 0x19, "Execute Write Response"	},
+	[0x1b] = { 0x1b, "Handle Value Notification",
 			att_handle_value_notify, 2, false },
-	{ 0x1d, "Handle Value Indication",
+	[0x1d] = { 0x1d, "Handle Value Indication",
 			att_handle_value_ind, 2, false },
-	{ 0x1e, "Handle Value Confirmation",
+	[0x1e] = { 0x1e, "Handle Value Confirmation",
 			att_handle_value_conf, 0, true },
-	{ 0x52, "Write Command",
+	[0x52] = { 0x52, "Write Command",
 			att_write_command, 2, false },
-	{ 0xd2, "Signed Write Command"		},
-	{ }
+	[0xd2] = { 0xd2, "Signed Write Command"		},
 };
 
 static const char *att_opcode_to_str(uint8_t opcode)
 {
-	int i;
-
-	for (i = 0; att_opcode_table[i].str; i++) {
-		if (att_opcode_table[i].opcode == opcode)
-			return att_opcode_table[i].str;
-	}
+	if (att_opcode_table[opcode].str)
+		return att_opcode_table[opcode].str;
 
 	return "Unknown";
 }
@@ -2181,7 +2214,6 @@ static void att_packet(uint16_t index, bool in, uint16_t handle,
 	uint8_t opcode = *((const uint8_t *) data);
 	const struct att_opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
-	int i;
 
 	if (size < 1) {
 		print_text(COLOR_ERROR, "malformed attribute packet");
@@ -2189,26 +2221,22 @@ static void att_packet(uint16_t index, bool in, uint16_t handle,
 		return;
 	}
 
-	for (i = 0; att_opcode_table[i].str; i++) {
-		if (att_opcode_table[i].opcode == opcode) {
-			opcode_data = &att_opcode_table[i];
-			break;
-		}
-	}
+	if (att_opcode_table[opcode].str)
+		opcode_data = &att_opcode_table[opcode];
 
-	if (opcode_data) {
-		if (opcode_data->func) {
-			if (in)
-				opcode_color = COLOR_MAGENTA;
-			else
-				opcode_color = COLOR_BLUE;
-		} else
-			opcode_color = COLOR_WHITE_BG;
-		opcode_str = opcode_data->str;
-	} else {
+	/* Any PDU the ATT layer knows is colored by direction */
+	if (bt_att_opcode_info[opcode].type != BT_ATT_OP_TYPE_UNKNOWN) {
+		if (in)
+			opcode_color = COLOR_MAGENTA;
+		else
+			opcode_color = COLOR_BLUE;
+	} else
 		opcode_color = COLOR_WHITE_BG;
+
+	if (opcode_data)
+		opcode_str = opcode_data->str;
+	else
 		opcode_str = "Unknown";
-	}
 
 	print_indent(6, opcode_color, "ATT: ", opcode_str, COLOR_OFF,
 				" (0x%2.2x) len %d", opcode, size - 1);
@@ -2662,21 +2690,26 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 					const void *data, uint16_t size)
 {
 	const struct bt_l2cap_hdr *hdr = data;
+	struct conn_data *conn;
+	struct frag_data *frag;
 	uint16_t len, cid;
 
-	if (index > MAX_INDEX - 1) {
-		print_text(COLOR_ERROR, "controller index too large");
+	conn = get_conn(index, handle, true);
+	if (!conn) {
+		print_text(COLOR_ERROR, "failed connection allocation");
 		packet_hexdump(data, size);
 		return;
 	}
 
+	frag = &conn->frag[in];
+
 	switch (flags) {
 	case 0x00:	/* start of a non-automatically-flushable PDU */
 	case 0x02:	/* start of an automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected start frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
@@ -2704,54 +2737,58 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 			return;
 		}
 
-		index_list[index][in].frag_buf = malloc(len);
-		if (!index_list[index][in].frag_buf) {
-			print_text(COLOR_ERROR, "failed buffer allocation");
-			packet_hexdump(data, size);
-			return;
+		if (len > frag->size) {
+			void *buf = realloc(frag->buf, len);
+
+			if (!buf) {
+				print_text(COLOR_ERROR,
+						"failed buffer allocation");
+				packet_hexdump(data, size);
+				return;
+			}
+
+			frag->buf = buf;
+			frag->size = len;
 		}
 
-		memcpy(index_list[index][in].frag_buf, data, size);
-		index_list[index][in].frag_pos = size;
-		index_list[index][in].frag_len = len - size;
-		index_list[index][in].frag_cid = cid;
+		memcpy(frag->buf, data, size);
+		frag->pos = size;
+		frag->len = len - size;
+		frag->cid = cid;
 		break;
 
 	case 0x01:	/* continuing fragment */
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			print_text(COLOR_ERROR, "unexpected continuation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		if (size > index_list[index][in].frag_len) {
+		if (size > frag->len) {
 			print_text(COLOR_ERROR, "fragment too long");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf +
-				index_list[index][in].frag_pos, data, size);
-		index_list[index][in].frag_pos += size;
-		index_list[index][in].frag_len -= size;
+		memcpy(frag->buf + frag->pos, data, size);
+		frag->pos += size;
+		frag->len -= size;
 
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			/* complete frame */
-			l2cap_frame(index, in, handle,
-					index_list[index][in].frag_cid,
-					index_list[index][in].frag_buf,
-					index_list[index][in].frag_pos);
-			clear_fragment_buffer(index, in);
+			l2cap_frame(index, in, handle, frag->cid,
+						frag->buf, frag->pos);
+			clear_fragment_buffer(frag);
 			return;
 		}
 		break;
 
 	case 0x03:	/* complete automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected complete frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
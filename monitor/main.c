@@ -30,15 +30,19 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <getopt.h>
 
 #include "mainloop.h"
+#include "display.h"
 #include "packet.h"
 #include "lmp.h"
 #include "keys.h"
 #include "analyze.h"
 #include "ellisys.h"
 #include "control.h"
+#include "filter.h"
+#include "stats.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -58,12 +62,23 @@ static void usage(void)
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-x, --write-index      Save seek index along with traces\n"
+		"\t-P, --pcapng <file>    Save traces in pcapng format\n"
+		"\t-Z, --rotate-size <mb> Start new trace file after size\n"
+		"\t-Y, --rotate-time <s>  Start new trace file after time\n"
+		"\t-N, --rotate-files <n> Number of trace files to keep\n"
+		"\t-F, --from <time>      Show traces starting from time\n"
+		"\t-U, --to <time>        Show traces up to time\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
+		"\t-B, --broadcast <path> Share live traces with clients\n"
 		"\t-i, --index <num>      Show only specified controller\n"
+		"\t-f, --filter <expr>    Show only packets matching filter\n"
 		"\t-t, --time             Show time instead of time offset\n"
 		"\t-T, --date             Show time and date information\n"
 		"\t-S, --sco              Dump SCO traffic\n"
+		"\t-j, --json             Show packets as JSON objects\n"
+		"\t-D, --stats            Show live statistics only\n"
 		"\t-E, --ellisys [ip]     Send Ellisys HCI Injection\n"
 		"\t-h, --help             Show help options\n");
 }
@@ -71,12 +86,23 @@ static void usage(void)
 static const struct option main_options[] = {
 	{ "read",    required_argument, NULL, 'r' },
 	{ "write",   required_argument, NULL, 'w' },
+	{ "write-index", no_argument,   NULL, 'x' },
+	{ "pcapng",  required_argument, NULL, 'P' },
+	{ "rotate-size", required_argument, NULL, 'Z' },
+	{ "rotate-time", required_argument, NULL, 'Y' },
+	{ "rotate-files", required_argument, NULL, 'N' },
+	{ "from",    required_argument, NULL, 'F' },
+	{ "to",      required_argument, NULL, 'U' },
 	{ "analyze", required_argument, NULL, 'a' },
 	{ "server",  required_argument, NULL, 's' },
+	{ "broadcast", required_argument, NULL, 'B' },
 	{ "index",   required_argument, NULL, 'i' },
+	{ "filter",  required_argument, NULL, 'f' },
 	{ "time",    no_argument,       NULL, 't' },
 	{ "date",    no_argument,       NULL, 'T' },
 	{ "sco",     no_argument,	NULL, 'S' },
+	{ "json",    no_argument,       NULL, 'j' },
+	{ "stats",   no_argument,       NULL, 'D' },
 	{ "ellisys", required_argument, NULL, 'E' },
 	{ "todo",    no_argument,       NULL, '#' },
 	{ "version", no_argument,       NULL, 'v' },
@@ -84,13 +110,42 @@ static const struct option main_options[] = {
 	{ }
 };
 
+/* Accepts seconds since the epoch or local "YYYY-MM-DD HH:MM:SS" */
+static bool parse_time(const char *str, struct timeval *tv)
+{
+	struct tm tm;
+	const char *end;
+	char *ptr;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_isdst = -1;
+
+	end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+	if (end && *end == '\0') {
+		tv->tv_sec = mktime(&tm);
+		tv->tv_usec = 0;
+		return tv->tv_sec != (time_t) -1;
+	}
+
+	tv->tv_sec = strtol(str, &ptr, 10);
+	tv->tv_usec = 0;
+
+	return ptr != str && *ptr == '\0';
+}
+
 int main(int argc, char *argv[])
 {
 	unsigned long filter_mask = 0;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	const char *pcap_path = NULL;
+	const char *broadcast_path = NULL;
 	const char *analyze_path = NULL;
 	const char *ellisys_server = NULL;
+	struct timeval from, to;
+	bool has_from = false, has_to = false, write_index = false;
+	bool stats = false;
+	unsigned int rotate_size = 0, rotate_time = 0, rotate_files = 8;
 	unsigned short ellisys_port = 0;
 	const char *str;
 	int exit_status;
@@ -103,8 +158,9 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "r:w:a:s:i:tTSE:vh",
-						main_options, NULL);
+		opt = getopt_long(argc, argv,
+					"r:w:xP:Z:Y:N:F:U:a:s:B:i:f:tTSjDE:vh",
+					main_options, NULL);
 		if (opt < 0)
 			break;
 
@@ -115,12 +171,48 @@ int main(int argc, char *argv[])
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'P':
+			pcap_path = optarg;
+			break;
+		case 'x':
+			write_index = true;
+			break;
+		case 'Z':
+			rotate_size = atoi(optarg);
+			break;
+		case 'Y':
+			rotate_time = atoi(optarg);
+			break;
+		case 'N':
+			rotate_files = atoi(optarg);
+			if (!rotate_files) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			if (!parse_time(optarg, &from)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			has_from = true;
+			break;
+		case 'U':
+			if (!parse_time(optarg, &to)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			has_to = true;
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
 		case 's':
 			control_server(optarg);
 			break;
+		case 'B':
+			broadcast_path = optarg;
+			break;
 		case 'i':
 			if (strlen(optarg) > 3 && !strncmp(optarg, "hci", 3))
 				str = optarg + 3;
@@ -132,6 +224,10 @@ int main(int argc, char *argv[])
 			}
 			packet_select_index(atoi(str));
 			break;
+		case 'f':
+			if (!filter_compile(optarg))
+				return EXIT_FAILURE;
+			break;
 		case 't':
 			filter_mask &= ~PACKET_FILTER_SHOW_TIME_OFFSET;
 			filter_mask |= PACKET_FILTER_SHOW_TIME;
@@ -144,6 +240,12 @@ int main(int argc, char *argv[])
 		case 'S':
 			filter_mask |= PACKET_FILTER_SHOW_SCO_DATA;
 			break;
+		case 'j':
+			json_enable();
+			break;
+		case 'D':
+			stats = true;
+			break;
 		case 'E':
 			ellisys_server = optarg;
 			ellisys_port = 24352;
@@ -173,13 +275,19 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (stats && (reader_path || analyze_path)) {
+		fprintf(stderr, "Statistics are only available when live\n");
+		return EXIT_FAILURE;
+	}
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
-	printf("Bluetooth monitor ver %s\n", VERSION);
+	if (!use_json())
+		printf("Bluetooth monitor ver %s\n", VERSION);
 
 	keys_setup();
 
@@ -190,15 +298,25 @@ int main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
+	if (pcap_path && !control_pcap_writer(pcap_path)) {
+		printf("Failed to open '%s'\n", pcap_path);
+		return EXIT_FAILURE;
+	}
+
 	if (reader_path) {
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
 
-		control_reader(reader_path);
+		control_reader(reader_path, has_from ? &from : NULL,
+						has_to ? &to : NULL);
+		json_end();
+		ellisys_cleanup();
+		filter_cleanup();
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, write_index,
+				rotate_size, rotate_time, rotate_files)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -206,11 +324,26 @@ int main(int argc, char *argv[])
 	if (ellisys_server)
 		ellisys_enable(ellisys_server, ellisys_port);
 
+	if (broadcast_path && !control_broadcast(broadcast_path)) {
+		printf("Failed to open '%s'\n", broadcast_path);
+		return EXIT_FAILURE;
+	}
+
+	if (stats && !stats_enable(1)) {
+		fprintf(stderr, "Failed to enable statistics\n");
+		return EXIT_FAILURE;
+	}
+
 	if (control_tracing() < 0)
 		return EXIT_FAILURE;
 
 	exit_status = mainloop_run();
 
+	json_end();
+	control_cleanup();
+	ellisys_cleanup();
+	stats_cleanup();
+	filter_cleanup();
 	keys_cleanup();
 
 	return exit_status;
@@ -30,8 +30,12 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
@@ -49,19 +53,60 @@ struct mainloop_data {
 	mainloop_event_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
+	struct mainloop_data *next_removed;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+/* Table indexed by fd, grown on demand */
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_list_size;
+static unsigned int mainloop_count;
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/*
+ * Entries removed while a batch of events is being dispatched are freed
+ * only after the batch, since later events may still point at them.
+ */
+static bool mainloop_dispatching;
+static struct mainloop_data *mainloop_removed;
+
+static struct epoll_event *epoll_events;
+static unsigned int epoll_events_size;
+
+#define TIMEOUT_WHEEL_BITS 6
+#define TIMEOUT_WHEEL_SIZE (1 << TIMEOUT_WHEEL_BITS)
+#define TIMEOUT_WHEEL_MASK (TIMEOUT_WHEEL_SIZE - 1)
+#define TIMEOUT_WHEEL_LEVELS 4
+#define TIMEOUT_WHEEL_RANGE \
+		(1ULL << (TIMEOUT_WHEEL_BITS * TIMEOUT_WHEEL_LEVELS))
+
+struct timeout_list {
+	struct timeout_list *next;
+	struct timeout_list *prev;
+};
 
 struct timeout_data {
-	int fd;
+	struct timeout_list list;
+	int id;
+	uint64_t expires;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+#define timeout_entry(ptr) \
+	((struct timeout_data *) ((char *) (ptr) - \
+				offsetof(struct timeout_data, list)))
+
+static int timeout_fd = -1;
+static struct timeout_list timeout_wheel[TIMEOUT_WHEEL_LEVELS]
+							[TIMEOUT_WHEEL_SIZE];
+static unsigned int timeout_pending;
+static uint64_t timeout_clk;
+static uint64_t timeout_armed;
+static struct timeout_data **timeout_table;
+static unsigned int timeout_table_size;
+static int *timeout_free_ids;
+static unsigned int timeout_num_free;
+
 struct signal_data {
 	int fd;
 	sigset_t mask;
@@ -74,13 +119,8 @@ static struct signal_data *signal_data;
 
 void mainloop_init(void)
 {
-	unsigned int i;
-
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
-
 	epoll_terminate = 0;
 }
 
@@ -129,19 +169,50 @@ int mainloop_run(void)
 	}
 
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
 		int n, nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		/* Collect events for up to all registered fds in one go */
+		if (epoll_events_size < mainloop_count ||
+						epoll_events_size == 0) {
+			unsigned int size = MAX_EPOLL_EVENTS;
+			struct epoll_event *events;
+
+			while (size < mainloop_count)
+				size *= 2;
+
+			events = realloc(epoll_events, size * sizeof(*events));
+			if (events) {
+				epoll_events = events;
+				epoll_events_size = size;
+			} else if (!epoll_events)
+				return 1;
+		}
+
+		nfds = epoll_wait(epoll_fd, epoll_events, epoll_events_size,
+									-1);
 		if (nfds < 0)
 			continue;
 
+		mainloop_dispatching = true;
+
 		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
+			struct mainloop_data *data = epoll_events[n].data.ptr;
 
-			data->callback(data->fd, events[n].events,
+			if (!data->callback)
+				continue;
+
+			data->callback(data->fd, epoll_events[n].events,
 							data->user_data);
 		}
+
+		mainloop_dispatching = false;
+
+		while (mainloop_removed) {
+			struct mainloop_data *data = mainloop_removed;
+
+			mainloop_removed = data->next_removed;
+			free(data);
+		}
 	}
 
 	if (signal_data) {
@@ -150,15 +221,19 @@ int mainloop_run(void)
 
 		if (signal_data->destroy)
 			signal_data->destroy(signal_data->user_data);
+
+		free(signal_data);
+		signal_data = NULL;
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	for (i = 0; i < mainloop_list_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
 
 		if (data) {
 			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+			mainloop_count--;
 
 			if (data->destroy)
 				data->destroy(data->user_data);
@@ -167,6 +242,14 @@ int mainloop_run(void)
 		}
 	}
 
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+
+	free(epoll_events);
+	epoll_events = NULL;
+	epoll_events_size = 0;
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
@@ -180,9 +263,27 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if ((unsigned int) fd >= mainloop_list_size) {
+		struct mainloop_data **list;
+		unsigned int size = 128;
+
+		while (size <= (unsigned int) fd)
+			size *= 2;
+
+		list = realloc(mainloop_list, size * sizeof(*list));
+		if (!list)
+			return -ENOMEM;
+
+		memset(list + mainloop_list_size, 0,
+				(size - mainloop_list_size) * sizeof(*list));
+
+		mainloop_list = list;
+		mainloop_list_size = size;
+	}
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -205,6 +306,7 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	}
 
 	mainloop_list[fd] = data;
+	mainloop_count++;
 
 	return 0;
 }
@@ -215,7 +317,7 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
 		return -EINVAL;
 
 	data = mainloop_list[fd];
@@ -240,7 +342,7 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
 		return -EINVAL;
 
 	data = mainloop_list[fd];
@@ -248,57 +350,362 @@ int mainloop_remove_fd(int fd)
 		return -ENXIO;
 
 	mainloop_list[fd] = NULL;
+	mainloop_count--;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
 	if (data->destroy)
 		data->destroy(data->user_data);
 
-	free(data);
+	if (mainloop_dispatching) {
+		data->callback = NULL;
+		data->next_removed = mainloop_removed;
+		mainloop_removed = data;
+	} else
+		free(data);
 
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+/*
+ * All timeouts share a single timerfd. They are kept in a hierarchical
+ * timer wheel with millisecond ticks: level 0 holds the timeouts due
+ * within the next TIMEOUT_WHEEL_SIZE ticks, each further level covers
+ * TIMEOUT_WHEEL_SIZE times the range of the previous one and is
+ * cascaded down as the clock reaches it. Timeouts beyond the range of
+ * the wheel are parked in its last slot and re-inserted when they come
+ * around.
+ */
+static void timeout_list_init(struct timeout_list *list)
 {
-	struct timeout_data *data = user_data;
+	list->next = list;
+	list->prev = list;
+}
 
-	close(data->fd);
-	data->fd = -1;
+static bool timeout_list_empty(const struct timeout_list *list)
+{
+	return list->next == list;
+}
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+static void timeout_list_add(struct timeout_list *head,
+						struct timeout_list *entry)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static void timeout_list_del(struct timeout_list *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static uint64_t timeout_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void timeout_insert(struct timeout_list *head,
+						struct timeout_data *data)
+{
+	timeout_list_add(head, &data->list);
+	timeout_pending++;
+}
+
+static void timeout_unlink(struct timeout_data *data)
+{
+	if (!data->list.next)
+		return;
+
+	timeout_list_del(&data->list);
+	timeout_pending--;
+}
+
+static void timeout_schedule(struct timeout_data *data)
+{
+	uint64_t expires = data->expires;
+	uint64_t delta;
+	unsigned int level, shift;
+
+	if (!timeout_pending)
+		timeout_clk = timeout_now();
+
+	if (expires < timeout_clk)
+		expires = timeout_clk;
+
+	delta = expires - timeout_clk;
+	if (delta > TIMEOUT_WHEEL_RANGE - 1) {
+		delta = TIMEOUT_WHEEL_RANGE - 1;
+		expires = timeout_clk + delta;
+	}
+
+	for (level = 0; level < TIMEOUT_WHEEL_LEVELS - 1; level++) {
+		if (delta < 1ULL << (TIMEOUT_WHEEL_BITS * (level + 1)))
+			break;
+	}
+
+	shift = TIMEOUT_WHEEL_BITS * level;
+
+	timeout_insert(&timeout_wheel[level][(expires >> shift) &
+						TIMEOUT_WHEEL_MASK], data);
+}
+
+static void timeout_arm(uint64_t expires)
+{
+	struct itimerspec itimer;
+
+	memset(&itimer, 0, sizeof(itimer));
+	itimer.it_value.tv_sec = expires / 1000;
+	itimer.it_value.tv_nsec = (expires % 1000) * 1000000;
+
+	timerfd_settime(timeout_fd, TFD_TIMER_ABSTIME, &itimer, NULL);
+	timeout_armed = expires;
+}
+
+/*
+ * Earliest tick at which the wheel needs attention: the first occupied
+ * level 0 slot, or the first cascade of an occupied upper level slot if
+ * that comes sooner.
+ */
+static uint64_t timeout_next(void)
+{
+	uint64_t next = 0;
+	unsigned int level, i;
+
+	if (!timeout_pending)
+		return 0;
+
+	for (level = 0; level < TIMEOUT_WHEEL_LEVELS; level++) {
+		unsigned int shift = TIMEOUT_WHEEL_BITS * level;
+		uint64_t block = timeout_clk >> shift;
+
+		/* The current upper level slot has been cascaded already */
+		if (level && (timeout_clk & ((1ULL << shift) - 1)))
+			block++;
+
+		for (i = 0; i < TIMEOUT_WHEEL_SIZE; i++, block++) {
+			unsigned int index = block & TIMEOUT_WHEEL_MASK;
+
+			if (timeout_list_empty(&timeout_wheel[level][index]))
+				continue;
+
+			if (!next || block << shift < next)
+				next = block << shift;
+
+			break;
+		}
+	}
+
+	return next;
+}
+
+static void timeout_cascade(unsigned int level, unsigned int index)
+{
+	struct timeout_list *slot = &timeout_wheel[level][index];
+
+	while (!timeout_list_empty(slot)) {
+		struct timeout_data *data;
+
+		data = timeout_entry(slot->next);
+		timeout_unlink(data);
+		timeout_schedule(data);
+	}
+}
+
+static void timeout_advance(uint64_t now)
+{
+	struct timeout_list expired;
+
+	timeout_list_init(&expired);
+
+	while (timeout_pending && timeout_clk <= now) {
+		unsigned int index = timeout_clk & TIMEOUT_WHEEL_MASK;
+		struct timeout_list *slot = &timeout_wheel[0][index];
+		unsigned int level;
+
+		for (level = 1; !index && level < TIMEOUT_WHEEL_LEVELS;
+								level++) {
+			index = (timeout_clk >> (TIMEOUT_WHEEL_BITS * level)) &
+							TIMEOUT_WHEEL_MASK;
+			timeout_cascade(level, index);
+		}
+
+		/* Expired entries stay counted as pending until dispatched */
+		while (!timeout_list_empty(slot)) {
+			struct timeout_list *entry = slot->next;
+
+			timeout_list_del(entry);
+			timeout_list_add(&expired, entry);
+		}
+
+		timeout_clk++;
+	}
+
+	if (timeout_clk <= now)
+		timeout_clk = now + 1;
+
+	while (!timeout_list_empty(&expired)) {
+		struct timeout_data *data = timeout_entry(expired.next);
+
+		timeout_unlink(data);
+
+		if (data->expires > now) {
+			timeout_schedule(data);
+			continue;
+		}
+
+		data->callback(data->id, data->user_data);
+	}
 }
 
 static void timeout_callback(int fd, uint32_t events, void *user_data)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
+	uint64_t expired, next;
 	ssize_t result;
 
 	if (events & (EPOLLERR | EPOLLHUP))
 		return;
 
-	result = read(data->fd, &expired, sizeof(expired));
+	result = read(fd, &expired, sizeof(expired));
 	if (result != sizeof(expired))
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	timeout_armed = 0;
+
+	timeout_advance(timeout_now());
+
+	/* Callbacks might have armed the timer for a later tick already */
+	next = timeout_next();
+	if (next && (!timeout_armed || next < timeout_armed))
+		timeout_arm(next);
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static void timeout_free(struct timeout_data *data)
 {
-	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	timeout_unlink(data);
 
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000;
+	timeout_table[data->id - 1] = NULL;
+	timeout_free_ids[timeout_num_free++] = data->id;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+}
+
+static void timeout_fd_destroy(void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < timeout_table_size; i++) {
+		if (timeout_table[i])
+			timeout_free(timeout_table[i]);
+	}
+
+	free(timeout_table);
+	free(timeout_free_ids);
+	timeout_table = NULL;
+	timeout_free_ids = NULL;
+	timeout_table_size = 0;
+	timeout_num_free = 0;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	close(timeout_fd);
+	timeout_fd = -1;
+	timeout_armed = 0;
+}
+
+static int timeout_setup(void)
+{
+	unsigned int i, j;
+
+	if (timeout_fd >= 0)
+		return 0;
+
+	timeout_fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timeout_fd < 0)
+		return -EIO;
+
+	if (mainloop_add_fd(timeout_fd, EPOLLIN, timeout_callback, NULL,
+						timeout_fd_destroy) < 0) {
+		close(timeout_fd);
+		timeout_fd = -1;
+		return -EIO;
+	}
+
+	for (i = 0; i < TIMEOUT_WHEEL_LEVELS; i++) {
+		for (j = 0; j < TIMEOUT_WHEEL_SIZE; j++)
+			timeout_list_init(&timeout_wheel[i][j]);
+	}
+
+	timeout_pending = 0;
+	timeout_armed = 0;
+
+	return 0;
+}
+
+static int timeout_alloc_id(struct timeout_data *data)
+{
+	unsigned int i;
+
+	if (!timeout_num_free) {
+		unsigned int size = timeout_table_size ?
+					timeout_table_size * 2 : 16;
+		struct timeout_data **table;
+		int *ids;
+
+		table = realloc(timeout_table, size * sizeof(*table));
+		if (!table)
+			return -ENOMEM;
+
+		timeout_table = table;
+
+		ids = realloc(timeout_free_ids, size * sizeof(*ids));
+		if (!ids)
+			return -ENOMEM;
+
+		timeout_free_ids = ids;
+
+		/* Hand out the lowest ids first */
+		for (i = size; i > timeout_table_size; i--) {
+			timeout_table[i - 1] = NULL;
+			timeout_free_ids[timeout_num_free++] = i;
+		}
+
+		timeout_table_size = size;
+	}
+
+	data->id = timeout_free_ids[--timeout_num_free];
+	timeout_table[data->id - 1] = data;
+
+	return data->id;
+}
+
+static struct timeout_data *timeout_lookup(int id)
+{
+	if (id < 1 || (unsigned int) id > timeout_table_size)
+		return NULL;
+
+	return timeout_table[id - 1];
+}
+
+static void timeout_start(struct timeout_data *data, unsigned int msec)
+{
+	timeout_unlink(data);
+
+	data->expires = timeout_now() + msec;
+	timeout_schedule(data);
+
+	if (!timeout_armed || data->expires < timeout_armed)
+		timeout_arm(data->expires);
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
@@ -309,6 +716,9 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	if (!callback)
 		return -EINVAL;
 
+	if (timeout_setup() < 0)
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -318,46 +728,42 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
+	if (timeout_alloc_id(data) < 0) {
 		free(data);
-		return -EIO;
-	}
-
-	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
+		return -ENOMEM;
 	}
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
+	if (msec > 0)
+		timeout_start(data, msec);
 
-	return data->fd;
+	return data->id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
-	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
+	data = timeout_lookup(id);
+	if (!data)
 		return -EIO;
 
+	if (msec > 0)
+		timeout_start(data, msec);
+
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	timeout_free(data);
+
+	return 0;
 }
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
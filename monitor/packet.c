@@ -48,6 +48,7 @@
 #include "ll.h"
 #include "hwdb.h"
 #include "keys.h"
+#include "filter.h"
 #include "uuid.h"
 #include "l2cap.h"
 #include "control.h"
@@ -168,6 +169,11 @@ static void print_packet(struct timeval *tv, uint16_t index, char ident,
 	char line[256], ts_str[64];
 	int n, ts_len = 0, ts_pos = 0, len = 0, pos = 0;
 
+	if (use_json()) {
+		json_packet(tv, index, ident, label, text, extra);
+		return;
+	}
+
 	if (filter_mask & PACKET_FILTER_SHOW_INDEX) {
 		if (use_color()) {
 			n = sprintf(ts_str + ts_pos, "%s", COLOR_INDEX_LABEL);
@@ -3379,6 +3385,8 @@ void packet_control(struct timeval *tv, uint16_t index, uint16_t opcode,
 		return;
 
 	control_message(opcode, data, size);
+
+	json_end();
 }
 
 static int addr2str(const uint8_t *addr, char *str)
@@ -3405,6 +3413,9 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 	if (index_filter && index_number != index)
 		return;
 
+	if (!filter_match(index, opcode, data, size))
+		return;
+
 	index_current = index;
 
 	if (tv && time_offset == ((time_t) -1))
@@ -3455,6 +3466,8 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 		packet_hexdump(data, size);
 		break;
 	}
+
+	json_end();
 }
 
 void packet_simulator(struct timeval *tv, uint16_t frequency,
@@ -6578,6 +6591,59 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
+/*
+ * Direct lookup tables indexed by opcode and event code, built on first
+ * use from the tables above so that decoding avoids a linear scan.
+ */
+static const struct opcode_data **opcode_lookup;
+static uint16_t opcode_lookup_max;
+static bool opcode_lookup_ready;
+
+static void build_opcode_lookup(void)
+{
+	int i;
+
+	opcode_lookup_ready = true;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].opcode > opcode_lookup_max)
+			opcode_lookup_max = opcode_table[i].opcode;
+	}
+
+	opcode_lookup = calloc(opcode_lookup_max + 1, sizeof(*opcode_lookup));
+	if (!opcode_lookup)
+		return;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		uint16_t opcode = opcode_table[i].opcode;
+
+		if (!opcode_lookup[opcode])
+			opcode_lookup[opcode] = &opcode_table[i];
+	}
+}
+
+static const struct opcode_data *find_opcode(uint16_t opcode)
+{
+	int i;
+
+	if (!opcode_lookup_ready)
+		build_opcode_lookup();
+
+	if (opcode_lookup) {
+		if (opcode > opcode_lookup_max)
+			return NULL;
+
+		return opcode_lookup[opcode];
+	}
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].opcode == opcode)
+			return &opcode_table[i];
+	}
+
+	return NULL;
+}
+
 static const char *get_supported_command(int bit)
 {
 	int i;
@@ -6644,8 +6710,10 @@ static void disconnect_complete_evt(const void *data, uint8_t size)
 	print_handle(evt->handle);
 	print_reason(evt->reason);
 
-	if (evt->status == 0x00)
+	if (evt->status == 0x00) {
 		release_handle(le16_to_cpu(evt->handle));
+		l2cap_disconnect(index_current, le16_to_cpu(evt->handle));
+	}
 }
 
 static void auth_complete_evt(const void *data, uint8_t size)
@@ -6734,14 +6802,8 @@ static void cmd_complete_evt(const void *data, uint8_t size)
 	uint16_t ocf = cmd_opcode_ocf(opcode);
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -6804,14 +6866,8 @@ static void cmd_status_evt(const void *data, uint8_t size)
 	uint16_t ocf = cmd_opcode_ocf(opcode);
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -7526,19 +7582,34 @@ static const struct subevent_data subevent_table[] = {
 	{ }
 };
 
+static const struct subevent_data *subevent_lookup[256];
+static bool subevent_lookup_ready;
+
+static const struct subevent_data *find_subevent(uint8_t subevent)
+{
+	int i;
+
+	if (subevent_lookup_ready)
+		return subevent_lookup[subevent];
+
+	for (i = 0; subevent_table[i].str; i++) {
+		if (!subevent_lookup[subevent_table[i].subevent])
+			subevent_lookup[subevent_table[i].subevent] =
+							&subevent_table[i];
+	}
+
+	subevent_lookup_ready = true;
+
+	return subevent_lookup[subevent];
+}
+
 static void le_meta_event_evt(const void *data, uint8_t size)
 {
 	uint8_t subevent = *((const uint8_t *) data);
 	const struct subevent_data *subevent_data = NULL;
 	const char *subevent_color, *subevent_str;
-	int i;
 
-	for (i = 0; subevent_table[i].str; i++) {
-		if (subevent_table[i].subevent == subevent) {
-			subevent_data = &subevent_table[i];
-			break;
-		}
-	}
+	subevent_data = find_subevent(subevent);
 
 	if (subevent_data) {
 		if (subevent_data->func)
@@ -7743,6 +7814,26 @@ static const struct event_data event_table[] = {
 	{ }
 };
 
+static const struct event_data *event_lookup[256];
+static bool event_lookup_ready;
+
+static const struct event_data *find_event(uint8_t event)
+{
+	int i;
+
+	if (event_lookup_ready)
+		return event_lookup[event];
+
+	for (i = 0; event_table[i].str; i++) {
+		if (!event_lookup[event_table[i].event])
+			event_lookup[event_table[i].event] = &event_table[i];
+	}
+
+	event_lookup_ready = true;
+
+	return event_lookup[event];
+}
+
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
@@ -7771,7 +7862,6 @@ void packet_hci_command(struct timeval *tv, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25];
-	int i;
 
 	if (size < HCI_COMMAND_HDR_SIZE) {
 		sprintf(extra_str, "(len %d)", size);
@@ -7784,12 +7874,7 @@ void packet_hci_command(struct timeval *tv, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -7848,7 +7933,6 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 	const struct event_data *event_data = NULL;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	if (size < HCI_EVENT_HDR_SIZE) {
 		sprintf(extra_str, "(len %d)", size);
@@ -7861,12 +7945,7 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
@@ -0,0 +1,672 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "lib/bluetooth.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+#include "monitor/bt.h"
+#include "mainloop.h"
+#include "stats.h"
+
+#define STATS_TOP_TALKERS	5
+
+enum {
+	STATS_CMD,
+	STATS_EVT,
+	STATS_ACL_TX,
+	STATS_ACL_RX,
+	STATS_SCO,
+	STATS_ADV,
+	STATS_MAX
+};
+
+struct stats_count {
+	unsigned long num;
+	unsigned long long bytes;
+};
+
+struct stats_dev {
+	uint16_t index;
+	uint8_t type;
+	uint8_t bdaddr[6];
+	struct stats_count total[STATS_MAX];
+	struct stats_count last[STATS_MAX];
+	struct queue *cmd_list;
+	struct queue *conn_list;
+};
+
+struct stats_cmd {
+	uint16_t opcode;
+	struct timeval tv;
+};
+
+/*
+ * Talkers are remote addresses seen either in advertising reports or
+ * as the peer of a connection. Entries without a connection are pruned
+ * once they have been quiet for a whole interval, so rotating random
+ * addresses do not make the list grow without bounds.
+ */
+struct stats_talker {
+	uint8_t bdaddr[6];
+	unsigned int conns;
+	struct stats_count total;
+	struct stats_count last;
+	unsigned long rate;
+	unsigned long byte_rate;
+};
+
+struct stats_conn {
+	uint16_t handle;
+	bool le;
+	struct stats_talker *talker;
+	struct stats_count total[2];
+	struct stats_count last[2];
+};
+
+static unsigned int stats_interval;
+static int stats_timeout = -1;
+static struct timeval stats_last;
+static struct queue *dev_list;
+static struct queue *talker_list;
+
+static void talker_put(struct stats_talker *talker)
+{
+	if (talker)
+		talker->conns--;
+}
+
+static void conn_destroy(void *data)
+{
+	struct stats_conn *conn = data;
+
+	talker_put(conn->talker);
+	free(conn);
+}
+
+static void dev_destroy(void *data)
+{
+	struct stats_dev *dev = data;
+
+	queue_destroy(dev->cmd_list, free);
+	queue_destroy(dev->conn_list, conn_destroy);
+	free(dev);
+}
+
+static bool dev_match_index(const void *a, const void *b)
+{
+	const struct stats_dev *dev = a;
+
+	return dev->index == PTR_TO_UINT(b);
+}
+
+static struct stats_dev *dev_lookup(uint16_t index)
+{
+	struct stats_dev *dev;
+
+	dev = queue_find(dev_list, dev_match_index, UINT_TO_PTR(index));
+	if (dev)
+		return dev;
+
+	dev = new0(struct stats_dev, 1);
+	if (!dev)
+		return NULL;
+
+	dev->index = index;
+	dev->cmd_list = queue_new();
+	dev->conn_list = queue_new();
+
+	queue_push_tail(dev_list, dev);
+
+	return dev;
+}
+
+static bool talker_match_bdaddr(const void *a, const void *b)
+{
+	const struct stats_talker *talker = a;
+
+	return !memcmp(talker->bdaddr, b, 6);
+}
+
+static struct stats_talker *talker_lookup(const uint8_t *bdaddr)
+{
+	struct stats_talker *talker;
+
+	talker = queue_find(talker_list, talker_match_bdaddr, bdaddr);
+	if (talker)
+		return talker;
+
+	talker = new0(struct stats_talker, 1);
+	if (!talker)
+		return NULL;
+
+	memcpy(talker->bdaddr, bdaddr, 6);
+	queue_push_tail(talker_list, talker);
+
+	return talker;
+}
+
+static void talker_count(struct stats_talker *talker, uint16_t size)
+{
+	if (!talker)
+		return;
+
+	talker->total.num++;
+	talker->total.bytes += size;
+}
+
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct stats_conn *conn = a;
+
+	return conn->handle == PTR_TO_UINT(b);
+}
+
+static void conn_add(struct stats_dev *dev, uint16_t handle,
+					const uint8_t *bdaddr, bool le)
+{
+	struct stats_conn *conn;
+
+	conn = queue_remove_if(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+	if (conn)
+		conn_destroy(conn);
+
+	conn = new0(struct stats_conn, 1);
+	if (!conn)
+		return;
+
+	conn->handle = handle;
+	conn->le = le;
+	conn->talker = talker_lookup(bdaddr);
+	if (conn->talker)
+		conn->talker->conns++;
+
+	queue_push_tail(dev->conn_list, conn);
+}
+
+static void new_index(uint16_t index, const void *data, uint16_t size)
+{
+	const struct btsnoop_opcode_new_index *ni = data;
+	struct stats_dev *dev;
+
+	if (size < sizeof(*ni))
+		return;
+
+	dev = dev_lookup(index);
+	if (!dev)
+		return;
+
+	dev->type = ni->type;
+	memcpy(dev->bdaddr, ni->bdaddr, 6);
+}
+
+static void del_index(uint16_t index)
+{
+	struct stats_dev *dev;
+
+	dev = queue_remove_if(dev_list, dev_match_index, UINT_TO_PTR(index));
+	if (dev)
+		dev_destroy(dev);
+}
+
+static void command_pkt(struct stats_dev *dev, const struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_cmd_hdr *hdr = data;
+	struct stats_cmd *cmd;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	cmd = new0(struct stats_cmd, 1);
+	if (!cmd)
+		return;
+
+	cmd->opcode = le16_to_cpu(hdr->opcode);
+	cmd->tv = *tv;
+
+	queue_push_tail(dev->cmd_list, cmd);
+}
+
+static bool cmd_match_opcode(const void *a, const void *b)
+{
+	const struct stats_cmd *cmd = a;
+
+	return cmd->opcode == PTR_TO_UINT(b);
+}
+
+static void cmd_done(struct stats_dev *dev, uint16_t opcode)
+{
+	struct stats_cmd *cmd;
+
+	cmd = queue_remove_if(dev->cmd_list, cmd_match_opcode,
+							UINT_TO_PTR(opcode));
+	free(cmd);
+}
+
+static void evt_le_meta_event(struct stats_dev *dev, const void *data,
+								uint16_t size)
+{
+	uint8_t subevent = *((const uint8_t *) data);
+	const struct bt_hci_evt_le_conn_complete *cc;
+	uint8_t num_reports;
+
+	data++;
+	size--;
+
+	switch (subevent) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+		cc = data;
+		if (size < sizeof(*cc) || cc->status)
+			return;
+
+		conn_add(dev, le16_to_cpu(cc->handle), cc->peer_addr, true);
+		break;
+	case BT_HCI_EVT_LE_ADV_REPORT:
+		if (size < 1)
+			return;
+
+		num_reports = *((const uint8_t *) data);
+		data++;
+		size--;
+
+		/*
+		 * Event type, address type, address and data length are
+		 * followed by the data itself and a trailing RSSI byte.
+		 */
+		while (num_reports--) {
+			const uint8_t *report = data;
+			uint16_t len;
+
+			if (size < 9)
+				return;
+
+			len = 9 + report[8] + 1;
+			if (size < len)
+				return;
+
+			dev->total[STATS_ADV].num++;
+			dev->total[STATS_ADV].bytes += report[8];
+			talker_count(talker_lookup(report + 2), report[8]);
+
+			data += len;
+			size -= len;
+		}
+		break;
+	}
+}
+
+static void event_pkt(struct stats_dev *dev, const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_hdr *hdr = data;
+	const struct bt_hci_evt_cmd_complete *ccmd;
+	const struct bt_hci_evt_cmd_status *cs;
+	const struct bt_hci_evt_conn_complete *cc;
+	const struct bt_hci_evt_disconnect_complete *dc;
+	struct stats_conn *conn;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CMD_COMPLETE:
+		ccmd = data;
+		if (size >= sizeof(*ccmd))
+			cmd_done(dev, le16_to_cpu(ccmd->opcode));
+		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		cs = data;
+		if (size >= sizeof(*cs))
+			cmd_done(dev, le16_to_cpu(cs->opcode));
+		break;
+	case BT_HCI_EVT_CONN_COMPLETE:
+		cc = data;
+		if (size >= sizeof(*cc) && !cc->status)
+			conn_add(dev, le16_to_cpu(cc->handle), cc->bdaddr,
+									false);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		dc = data;
+		if (size < sizeof(*dc) || dc->status)
+			break;
+
+		conn = queue_remove_if(dev->conn_list, conn_match_handle,
+					UINT_TO_PTR(le16_to_cpu(dc->handle)));
+		if (conn)
+			conn_destroy(conn);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (size >= 1)
+			evt_le_meta_event(dev, data, size);
+		break;
+	}
+}
+
+static void acl_pkt(struct stats_dev *dev, bool out, const void *data,
+								uint16_t size)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	struct stats_conn *conn;
+	uint16_t handle, dlen;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	handle = le16_to_cpu(hdr->handle) & 0x0fff;
+	dlen = le16_to_cpu(hdr->dlen);
+
+	dev->total[out ? STATS_ACL_TX : STATS_ACL_RX].bytes += dlen;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+	if (!conn)
+		return;
+
+	conn->total[out].num++;
+	conn->total[out].bytes += dlen;
+
+	talker_count(conn->talker, dlen);
+}
+
+void stats_hci(const struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	struct stats_dev *dev;
+	struct timeval now;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		new_index(index, data, size);
+		return;
+	case BTSNOOP_OPCODE_DEL_INDEX:
+		del_index(index);
+		return;
+	}
+
+	dev = dev_lookup(index);
+	if (!dev)
+		return;
+
+	if (!tv) {
+		gettimeofday(&now, NULL);
+		tv = &now;
+	}
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		dev->total[STATS_CMD].num++;
+		dev->total[STATS_CMD].bytes += size;
+		command_pkt(dev, tv, data, size);
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		dev->total[STATS_EVT].num++;
+		dev->total[STATS_EVT].bytes += size;
+		event_pkt(dev, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		dev->total[STATS_ACL_TX].num++;
+		acl_pkt(dev, true, data, size);
+		break;
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		dev->total[STATS_ACL_RX].num++;
+		acl_pkt(dev, false, data, size);
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		dev->total[STATS_SCO].num++;
+		dev->total[STATS_SCO].bytes += size;
+		break;
+	}
+}
+
+static unsigned long rate(unsigned long long delta, unsigned long elapsed)
+{
+	return delta * 1000000ull / elapsed;
+}
+
+static void print_count(const char *label, const struct stats_count *total,
+				struct stats_count *last, unsigned long elapsed)
+{
+	printf("    %-12s %8lu/s %10lu B/s %12lu total\n", label,
+			rate(total->num - last->num, elapsed),
+			rate(total->bytes - last->bytes, elapsed), total->num);
+
+	*last = *total;
+}
+
+static void print_conn(void *data, void *user_data)
+{
+	struct stats_conn *conn = data;
+	unsigned long elapsed = PTR_TO_UINT(user_data);
+	char addr[18] = "-";
+
+	if (conn->talker)
+		ba2str((bdaddr_t *) conn->talker->bdaddr, addr);
+
+	printf("    0x%4.4x %s %s  TX %5lu/s %7lu B/s  RX %5lu/s %7lu B/s\n",
+		conn->handle, addr, conn->le ? "LE" : "BR",
+		rate(conn->total[1].num - conn->last[1].num, elapsed),
+		rate(conn->total[1].bytes - conn->last[1].bytes, elapsed),
+		rate(conn->total[0].num - conn->last[0].num, elapsed),
+		rate(conn->total[0].bytes - conn->last[0].bytes, elapsed));
+
+	conn->last[0] = conn->total[0];
+	conn->last[1] = conn->total[1];
+}
+
+static void print_dev(void *data, void *user_data)
+{
+	static const char *labels[STATS_MAX] = {
+		"Commands", "Events", "ACL TX", "ACL RX", "SCO", "Adv reports"
+	};
+	struct stats_dev *dev = data;
+	unsigned long elapsed = PTR_TO_UINT(user_data);
+	struct stats_cmd *cmd;
+	struct timeval now;
+	char addr[18];
+	int i;
+
+	ba2str((bdaddr_t *) dev->bdaddr, addr);
+
+	printf("hci%u %s (%s)\n", dev->index, addr,
+				dev->type == 0x00 ? "Primary" : "AMP");
+
+	for (i = 0; i < STATS_MAX; i++)
+		print_count(labels[i], &dev->total[i], &dev->last[i],
+								elapsed);
+
+	cmd = queue_peek_head(dev->cmd_list);
+	if (cmd) {
+		struct timeval age;
+
+		gettimeofday(&now, NULL);
+		timersub(&now, &cmd->tv, &age);
+
+		printf("    Pending commands %u (oldest 0x%4.4x for %ld ms)\n",
+				queue_length(dev->cmd_list), cmd->opcode,
+				age.tv_sec * 1000 + age.tv_usec / 1000);
+	} else
+		printf("    Pending commands 0\n");
+
+	printf("    Connections %u\n", queue_length(dev->conn_list));
+	queue_foreach(dev->conn_list, print_conn, user_data);
+	printf("\n");
+}
+
+static bool talker_prune(const void *a, const void *b)
+{
+	const struct stats_talker *talker = a;
+
+	return !talker->conns && talker->total.num == talker->last.num;
+}
+
+struct talker_rank {
+	struct stats_talker *top[STATS_TOP_TALKERS];
+	unsigned int num;
+	unsigned long elapsed;
+};
+
+static void rank_talker(void *data, void *user_data)
+{
+	struct stats_talker *talker = data;
+	struct talker_rank *rank = user_data;
+	unsigned int i;
+
+	talker->rate = rate(talker->total.num - talker->last.num,
+							rank->elapsed);
+	talker->byte_rate = rate(talker->total.bytes - talker->last.bytes,
+							rank->elapsed);
+	talker->last = talker->total;
+
+	if (!talker->rate)
+		return;
+
+	for (i = rank->num; i > 0; i--) {
+		if (rank->top[i - 1]->rate >= talker->rate)
+			break;
+
+		if (i < STATS_TOP_TALKERS)
+			rank->top[i] = rank->top[i - 1];
+	}
+
+	if (i >= STATS_TOP_TALKERS)
+		return;
+
+	rank->top[i] = talker;
+
+	if (rank->num < STATS_TOP_TALKERS)
+		rank->num++;
+}
+
+static void print_talkers(unsigned long elapsed)
+{
+	struct talker_rank rank;
+	unsigned int i;
+
+	queue_remove_all(talker_list, talker_prune, NULL, free);
+
+	memset(&rank, 0, sizeof(rank));
+	rank.elapsed = elapsed;
+
+	queue_foreach(talker_list, rank_talker, &rank);
+
+	printf("Top talkers\n");
+
+	for (i = 0; i < rank.num; i++) {
+		char addr[18];
+
+		ba2str((bdaddr_t *) rank.top[i]->bdaddr, addr);
+		printf("    %s %8lu/s %10lu B/s\n", addr,
+				rank.top[i]->rate, rank.top[i]->byte_rate);
+	}
+}
+
+static void stats_refresh(int id, void *user_data)
+{
+	struct timeval now, diff;
+	unsigned long elapsed;
+	char str[64];
+	time_t t;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &stats_last, &diff);
+	stats_last = now;
+
+	elapsed = diff.tv_sec * 1000000ul + diff.tv_usec;
+	if (!elapsed)
+		elapsed = 1;
+
+	/* Redraw in place on a terminal, append otherwise */
+	if (isatty(STDOUT_FILENO))
+		printf("\x1b[H\x1b[J");
+	else
+		printf("\n");
+
+	t = now.tv_sec;
+	strftime(str, sizeof(str), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("Bluetooth monitor statistics - %s\n\n", str);
+
+	queue_foreach(dev_list, print_dev, UINT_TO_PTR(elapsed));
+	print_talkers(elapsed);
+
+	fflush(stdout);
+
+	mainloop_modify_timeout(id, stats_interval * 1000);
+}
+
+bool stats_enable(unsigned int interval)
+{
+	if (stats_timeout >= 0)
+		return true;
+
+	dev_list = queue_new();
+	talker_list = queue_new();
+
+	stats_interval = interval ? interval : 1;
+	gettimeofday(&stats_last, NULL);
+
+	stats_timeout = mainloop_add_timeout(stats_interval * 1000,
+						stats_refresh, NULL, NULL);
+	if (stats_timeout < 0) {
+		stats_cleanup();
+		return false;
+	}
+
+	return true;
+}
+
+bool stats_active(void)
+{
+	return stats_timeout >= 0;
+}
+
+void stats_cleanup(void)
+{
+	if (stats_timeout >= 0) {
+		mainloop_remove_timeout(stats_timeout);
+		stats_timeout = -1;
+	}
+
+	/* Connections still hold talker references, so drop them first */
+	queue_destroy(dev_list, dev_destroy);
+	dev_list = NULL;
+
+	queue_destroy(talker_list, free);
+	talker_list = NULL;
+}
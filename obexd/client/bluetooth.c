@@ -42,8 +42,8 @@
 #include "transport.h"
 #include "bluetooth.h"
 
-#define BT_RX_MTU 32767
-#define BT_TX_MTU 32767
+#define BT_RX_MTU 65535
+#define BT_TX_MTU 65535
 
 #define OBC_BT_ERROR obc_bt_error_quark()
 
@@ -52,6 +52,7 @@ struct bluetooth_session {
 	bdaddr_t src;
 	bdaddr_t dst;
 	uint16_t port;
+	uint16_t channel;
 	sdp_session_t *sdp;
 	sdp_record_t *sdp_record;
 	GIOChannel *io;
@@ -91,19 +92,6 @@ static void session_destroy(struct bluetooth_session *session)
 	g_free(session);
 }
 
-static void transport_callback(GIOChannel *io, GError *err, gpointer user_data)
-{
-	struct bluetooth_session *session = user_data;
-
-	DBG("");
-
-	if (session->func)
-		session->func(io, err, session->user_data);
-
-	if (err != NULL)
-		session_destroy(session);
-}
-
 static GIOChannel *transport_connect(const bdaddr_t *src, const bdaddr_t *dst,
 					uint16_t port, BtIOConnect function,
 					gpointer user_data)
@@ -142,6 +130,39 @@ static GIOChannel *transport_connect(const bdaddr_t *src, const bdaddr_t *dst,
 	return NULL;
 }
 
+static void transport_callback(GIOChannel *io, GError *err, gpointer user_data)
+{
+	struct bluetooth_session *session = user_data;
+
+	DBG("");
+
+	/* Only L2CAP failures are retried, GOEP 2.0 records also carry an
+	 * RFCOMM channel for GOEP 1.x peers */
+	if (err != NULL && session->port > 31 && session->channel > 0) {
+		DBG("PSM %u failed, falling back to RFCOMM channel %u",
+					session->port, session->channel);
+
+		g_io_channel_shutdown(session->io, TRUE, NULL);
+		g_io_channel_unref(session->io);
+
+		session->port = session->channel;
+		session->channel = 0;
+		session->io = transport_connect(&session->src, &session->dst,
+						session->port,
+						transport_callback, session);
+		if (session->io != NULL)
+			return;
+
+		io = NULL;
+	}
+
+	if (session->func)
+		session->func(io, err, session->user_data);
+
+	if (err != NULL)
+		session_destroy(session);
+}
+
 static void search_callback(uint8_t type, uint16_t status,
 			uint8_t *rsp, size_t size, void *user_data)
 {
@@ -162,45 +183,44 @@ static void search_callback(uint8_t type, uint16_t status,
 	rsp += scanned;
 	bytesleft -= scanned;
 	do {
-		sdp_record_t *rec;
-		sdp_list_t *protos;
-		sdp_data_t *data;
-		int recsize, ch = -1;
-
-		recsize = 0;
-		rec = sdp_extract_pdu(rsp, bytesleft, &recsize);
-		if (!rec)
+		const uint8_t *data;
+		int hdrsize, recsize = 0, datasize, ch, rfcomm;
+
+		hdrsize = sdp_extract_seqtype(rsp, bytesleft, &dataType,
+								&recsize);
+		if (!hdrsize)
 			break;
 
-		if (!recsize) {
-			sdp_record_free(rec);
+		recsize += hdrsize;
+		if (recsize > (int) bytesleft)
 			break;
-		}
 
-		if (!sdp_get_access_protos(rec, &protos)) {
-			ch = sdp_get_proto_port(protos, RFCOMM_UUID);
-			sdp_list_foreach(protos,
-					(sdp_list_func_t) sdp_list_free, NULL);
-			sdp_list_free(protos, NULL);
-			protos = NULL;
-		}
+		/* Look the ports up in the raw record and only extract the
+		 * one that is going to be used */
+		rfcomm = sdp_pdu_get_proto_port(rsp, recsize, RFCOMM_UUID);
+		ch = rfcomm;
 
-		data = sdp_data_get(rec, 0x0200);
+		data = sdp_pdu_get_attr(rsp, recsize, 0x0200, &datasize);
 		/* PSM must be odd and lsb of upper byte must be 0 */
-		if (data != NULL && (data->val.uint16 & 0x0101) == 0x0001)
-			ch = data->val.uint16;
+		if (data != NULL && data[0] == SDP_UINT16 &&
+				(bt_get_be16(data + 1) & 0x0101) == 0x0001)
+			ch = bt_get_be16(data + 1);
 
 		/* Cache the sdp record associated with the service that we
 		 * attempt to connect. This allows reading its application
 		 * specific service attributes. */
 		if (ch > 0) {
+			int extracted = 0;
+
+			session->sdp_record = sdp_extract_pdu(rsp, recsize,
+								&extracted);
 			port = ch;
-			session->sdp_record = rec;
+			/* Keep the RFCOMM channel in case L2CAP fails */
+			if (port > 31 && rfcomm > 0)
+				session->channel = rfcomm;
 			break;
 		}
 
-		sdp_record_free(rec);
-
 		scanned += recsize;
 		rsp += recsize;
 		bytesleft -= recsize;
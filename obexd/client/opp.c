@@ -82,6 +82,82 @@ fail:
 	return reply;
 }
 
+static DBusMessage *opp_send_files(DBusConnection *connection,
+					DBusMessage *message, void *user_data)
+{
+	struct opp_data *opp = user_data;
+	struct obc_transfer **transfers;
+	DBusMessageIter iter, array;
+	DBusMessage *reply;
+	char **files;
+	int i, n;
+	GError *err = NULL;
+
+	if (dbus_message_get_args(message, NULL,
+				DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &files, &n,
+				DBUS_TYPE_INVALID) == FALSE || n == 0)
+		return g_dbus_create_error(message,
+				ERROR_INTERFACE ".InvalidArguments", NULL);
+
+	transfers = g_new0(struct obc_transfer *, n);
+
+	/* Open every file first so a bad one doesn't leave half a batch */
+	for (i = 0; i < n; i++) {
+		char *basename = g_path_get_basename(files[i]);
+
+		transfers[i] = obc_transfer_put(NULL, basename, files[i], NULL,
+								0, &err);
+		g_free(basename);
+
+		if (transfers[i] == NULL)
+			goto fail;
+	}
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_TYPE_OBJECT_PATH_AS_STRING,
+					&array);
+
+	/* The whole batch is queued on the same session and connection */
+	for (i = 0; i < n; i++) {
+		const char *path;
+
+		if (!obc_session_queue(opp->session, transfers[i], NULL, NULL,
+								&err)) {
+			transfers[i] = NULL;
+			dbus_message_unref(reply);
+			goto fail;
+		}
+
+		path = obc_transfer_get_path(transfers[i]);
+		dbus_message_iter_append_basic(&array, DBUS_TYPE_OBJECT_PATH,
+								&path);
+	}
+
+	dbus_message_iter_close_container(&iter, &array);
+
+	g_free(transfers);
+	dbus_free_string_array(files);
+
+	return reply;
+
+fail:
+	/* Transfers already queued are owned by the session */
+	for (i = 0; i < n; i++) {
+		if (transfers[i] && obc_transfer_get_path(transfers[i]) == NULL)
+			obc_transfer_unregister(transfers[i]);
+	}
+
+	g_free(transfers);
+	dbus_free_string_array(files);
+
+	reply = g_dbus_create_error(message,
+				ERROR_INTERFACE ".Failed", "%s", err->message);
+	g_error_free(err);
+	return reply;
+}
+
 static DBusMessage *opp_pull_business_card(DBusConnection *connection,
 					DBusMessage *message, void *user_data)
 {
@@ -124,6 +200,10 @@ static const GDBusMethodTable opp_methods[] = {
 		GDBUS_ARGS({ "sourcefile", "s" }),
 		GDBUS_ARGS({ "transfer", "o" }, { "properties", "a{sv}" }),
 		opp_send_file) },
+	{ GDBUS_METHOD("SendFiles",
+		GDBUS_ARGS({ "sourcefiles", "as" }),
+		GDBUS_ARGS({ "transfers", "ao" }),
+		opp_send_files) },
 	{ GDBUS_METHOD("PullBusinessCard",
 		GDBUS_ARGS({ "targetfile", "s" }),
 		GDBUS_ARGS({ "transfer", "o" }, { "properties", "a{sv}" }),
@@ -57,6 +57,9 @@ enum {
 	OBEX_IO_BUSY,
 };
 
+/* Transfers allowed to run at the same time across all sessions */
+#define MAX_ACTIVE_TRANSFERS 4
+
 static guint64 counter = 0;
 
 struct callback_data {
@@ -78,6 +81,7 @@ struct pending_request {
 	session_callback_t func;
 	void *data;
 	destroy_t destroy;
+	gboolean active;
 };
 
 struct setpath_data {
@@ -115,7 +119,12 @@ struct obc_session {
 
 static GSList *sessions = NULL;
 
+/* Sessions waiting for a transfer slot, each holding a reference */
+static GQueue *waiting = NULL;
+static unsigned int active_transfers = 0;
+
 static void session_process_queue(struct obc_session *session);
+static gboolean session_process(gpointer data);
 static void session_terminate_transfer(struct obc_session *session,
 					struct obc_transfer *transfer,
 					GError *gerr);
@@ -175,8 +184,26 @@ static struct pending_request *pending_request_new(struct obc_session *session,
 	return p;
 }
 
+static void wake_waiting_sessions(void)
+{
+	struct obc_session *session;
+
+	/* Let every waiting session retry, idle ones just give up the slot */
+	while (waiting && (session = g_queue_pop_head(waiting))) {
+		if (session->process_id == 0)
+			session->process_id = g_idle_add(session_process,
+								session);
+		obc_session_unref(session);
+	}
+}
+
 static void pending_request_free(struct pending_request *p)
 {
+	if (p->active) {
+		active_transfers--;
+		wake_waiting_sessions();
+	}
+
 	if (p->req_id > 0)
 		g_obex_cancel_req(p->session->obex, p->req_id, TRUE);
 
@@ -364,7 +391,7 @@ static void transport_func(GIOChannel *io, GError *err, gpointer user_data)
 	else
 		type = G_OBEX_TRANSPORT_STREAM;
 
-	obex = g_obex_new(io, type, tx_mtu, rx_mtu);
+	obex = g_obex_new(io, type, rx_mtu, tx_mtu);
 	if (obex == NULL)
 		goto done;
 
@@ -781,9 +808,38 @@ static int session_process_transfer(struct pending_request *p, GError **err)
 
 	DBG("Tranfer(%p) started", p->transfer);
 	p->session->p = p;
+	p->active = TRUE;
+	active_transfers++;
+
 	return 0;
 }
 
+/*
+ * Sessions are reused across requests, but to avoid starving the link
+ * when pushing to many devices at once only a few transfers run at the
+ * same time. Sessions whose next request is a transfer wait for a slot.
+ */
+static gboolean session_wait_slot(struct obc_session *session)
+{
+	struct pending_request *p = g_queue_peek_head(session->queue);
+
+	if (p->process != session_process_transfer)
+		return FALSE;
+
+	if (active_transfers < MAX_ACTIVE_TRANSFERS)
+		return FALSE;
+
+	if (waiting == NULL)
+		waiting = g_queue_new();
+
+	if (g_queue_find(waiting, session) == NULL)
+		g_queue_push_tail(waiting, obc_session_ref(session));
+
+	DBG("%p waiting, %u transfers active", session, active_transfers);
+
+	return TRUE;
+}
+
 guint obc_session_queue(struct obc_session *session,
 				struct obc_transfer *transfer,
 				session_callback_t func, void *user_data,
@@ -824,9 +880,14 @@ static void session_process_queue(struct obc_session *session)
 
 	obc_session_ref(session);
 
-	while ((p = g_queue_pop_head(session->queue))) {
+	while (!g_queue_is_empty(session->queue)) {
 		GError *gerr = NULL;
 
+		if (session_wait_slot(session))
+			break;
+
+		p = g_queue_pop_head(session->queue);
+
 		if (p->process(p, &gerr) == 0)
 			break;
 
@@ -50,6 +50,9 @@
 
 #define FIRST_PACKET_TIMEOUT 60
 
+/* Smallest change of Transferred worth a signal, besides completion */
+#define PROGRESS_MIN_DELTA (16 * 1024)
+
 static guint64 counter = 0;
 
 struct transfer_callback {
@@ -721,12 +724,8 @@ static void get_xfer_progress_first(GObex *obex, GError *err, GObexPacket *rsp,
 			obc_transfer_set_apparam(transfer, apparam);
 	}
 
-	hdr = g_obex_packet_get_body(rsp);
-	if (hdr) {
-		g_obex_header_get_bytes(hdr, &buf, &len);
-		if (len != 0)
-			get_xfer_progress(buf, len, transfer);
-	}
+	if (g_obex_packet_get_body_bytes(rsp, &buf, &len) && len != 0)
+		get_xfer_progress(buf, len, transfer);
 
 	if (rspcode == G_OBEX_RSP_SUCCESS) {
 		transfer->req = 0;
@@ -761,6 +760,22 @@ static gssize put_xfer_progress(void *buf, gsize len, gpointer user_data)
 	return size;
 }
 
+static gssize put_xfer_fd(gsize len, int *fd, off_t *offset,
+							gpointer user_data)
+{
+	struct obc_transfer *transfer = user_data;
+	gssize size;
+
+	size = MIN((gint64) len, transfer->size - transfer->transferred);
+
+	*fd = transfer->fd;
+	*offset = transfer->transferred;
+
+	transfer->transferred += size;
+
+	return size;
+}
+
 gboolean obc_transfer_set_callback(struct obc_transfer *transfer,
 					transfer_callback_t func,
 					void *user_data)
@@ -786,6 +801,11 @@ static gboolean report_progress(gpointer data)
 	if (transfer->transferred == transfer->progress)
 		return TRUE;
 
+	/* Don't signal steps too small to matter on slow links */
+	if (transfer->transferred != transfer->size &&
+		transfer->transferred - transfer->progress < PROGRESS_MIN_DELTA)
+		return TRUE;
+
 	transfer->progress = transfer->transferred;
 
 	if (transfer->transferred == transfer->size) {
@@ -874,9 +894,15 @@ static gboolean transfer_start_put(struct obc_transfer *transfer, GError **err)
 		g_obex_packet_add_header(req, hdr);
 	}
 
-	transfer->xfer = g_obex_put_req_pkt(transfer->obex, req,
-					put_xfer_progress, xfer_complete,
-					transfer, err);
+	/* Known sizes let gobex send the file without copying it */
+	if (transfer->size < UINT32_MAX)
+		transfer->xfer = g_obex_put_req_pkt_fd(transfer->obex, req,
+						put_xfer_fd, xfer_complete,
+						transfer, err);
+	else
+		transfer->xfer = g_obex_put_req_pkt(transfer->obex, req,
+						put_xfer_progress, xfer_complete,
+						transfer, err);
 	if (transfer->xfer == 0)
 		return FALSE;
 
@@ -47,8 +47,8 @@
 #include "service.h"
 #include "log.h"
 
-#define BT_RX_MTU 32767
-#define BT_TX_MTU 32767
+#define BT_RX_MTU 65535
+#define BT_TX_MTU 65535
 
 struct bluetooth_profile {
 	struct obex_server *server;
@@ -193,6 +193,8 @@ static void *filesystem_open(const char *name, int oflag, mode_t mode,
 	if (oflag == O_RDONLY) {
 		if (size)
 			*size = stats.st_size;
+		/* Objects are read front to back, let the kernel read ahead */
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 		goto done;
 	}
 
@@ -267,31 +269,72 @@ static int filesystem_rename(const char *name, const char *destname)
 	return ret;
 }
 
-static int sendfile_async(int out_fd, int in_fd, off_t *offset, size_t count)
+#define COPY_CHUNK_SIZE (64 * 1024)
+
+struct file_copy {
+	void *in;
+	void *out;
+	off_t offset;
+	off_t size;
+	guint id;
+};
+
+static GSList *copies = NULL;
+
+static void file_copy_free(void *data)
 {
-	int pid;
+	struct file_copy *copy = data;
 
-	/* Run sendfile on child process */
-	pid = fork();
-	switch (pid) {
-		case 0:
-			break;
-		case -1:
-			error("fork() %s (%d)", strerror(errno), errno);
-			return -errno;
-		default:
-			DBG("child %d forked", pid);
-			return pid;
-	}
+	copies = g_slist_remove(copies, copy);
+
+	filesystem_close(copy->in);
+	filesystem_close(copy->out);
+	g_free(copy);
+}
+
+static gboolean file_copy_chunk(gpointer user_data)
+{
+	struct file_copy *copy = user_data;
+	ssize_t ret;
+
+	ret = sendfile(GPOINTER_TO_INT(copy->out), GPOINTER_TO_INT(copy->in),
+			&copy->offset, MIN(copy->size - copy->offset,
+							COPY_CHUNK_SIZE));
+	if (ret < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return TRUE;
 
-	/* At child */
-	if (sendfile(out_fd, in_fd, offset, count) < 0)
 		error("sendfile(): %s (%d)", strerror(errno), errno);
+		return FALSE;
+	}
+
+	if (ret > 0 && copy->offset < copy->size)
+		return TRUE;
 
-	close(in_fd);
-	close(out_fd);
+	DBG("copied %" PRId64 "/%" PRId64 " bytes", (int64_t) copy->offset,
+						(int64_t) copy->size);
 
-	exit(errno);
+	return FALSE;
+}
+
+/*
+ * Copies run in chunks from a low priority idle source so large files
+ * don't block the main loop or other sessions while they are copied.
+ */
+static int file_copy_start(void *in, void *out, off_t size)
+{
+	struct file_copy *copy;
+
+	copy = g_new0(struct file_copy, 1);
+	copy->in = in;
+	copy->out = out;
+	copy->size = size;
+	copy->id = g_idle_add_full(G_PRIORITY_LOW, file_copy_chunk, copy,
+							file_copy_free);
+
+	copies = g_slist_prepend(copies, copy);
+
+	return 0;
 }
 
 static int filesystem_copy(const char *name, const char *destname)
@@ -333,11 +376,7 @@ static int filesystem_copy(const char *name, const char *destname)
 		goto done;
 	}
 
-	ret = sendfile_async(out_fd, in_fd, NULL, st.st_size);
-	if (ret < 0)
-		goto done;
-
-	return 0;
+	return file_copy_start(in, out, st.st_size);
 
 done:
 	filesystem_close(in);
@@ -714,6 +753,12 @@ static int filesystem_init(void)
 
 static void filesystem_exit(void)
 {
+	while (copies != NULL) {
+		struct file_copy *copy = copies->data;
+
+		g_source_remove(copy->id);
+	}
+
 	obex_mime_type_driver_unregister(&folder);
 	obex_mime_type_driver_unregister(&capability);
 	obex_mime_type_driver_unregister(&file);
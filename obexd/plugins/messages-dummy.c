@@ -26,10 +26,13 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "log.h"
 
@@ -37,6 +40,9 @@
 
 static char *root_folder = NULL;
 
+/* Message indexes per absolute folder path, shared by all sessions */
+static GHashTable *indexes = NULL;
+
 struct session {
 	char *cwd;
 	char *cwd_absolute;
@@ -52,6 +58,33 @@ struct folder_listing_data {
 	void *user_data;
 };
 
+struct message_entry {
+	char *handle;
+	char datetime[16];
+	char size[21];
+};
+
+/*
+ * Every message is a regular file named after its handle. The index is
+ * only rebuilt when the folder changes so listings cost what the page
+ * costs, not what the folder holds.
+ */
+struct message_index {
+	struct timespec mtime;
+	GPtrArray *entries;
+};
+
+struct messages_listing_data {
+	struct session *session;
+	const char *name;
+	uint16_t max;
+	uint16_t offset;
+	char *period_begin;
+	char *period_end;
+	messages_get_messages_listing_cb callback;
+	void *user_data;
+};
+
 /* NOTE: Neither IrOBEX nor MAP specs says that folder listing needs to
  * be sorted (in IrOBEX examples it is not). However existing implementations
  * seem to follow the fig. 3-2 from MAP specification v1.0, and I've seen a
@@ -201,6 +234,194 @@ static gboolean get_folder_listing(void *d)
 	return FALSE;
 }
 
+static void message_entry_free(void *data)
+{
+	struct message_entry *entry = data;
+
+	g_free(entry->handle);
+	g_free(entry);
+}
+
+static void message_index_free(void *data)
+{
+	struct message_index *index = data;
+
+	g_ptr_array_free(index->entries, TRUE);
+	g_free(index);
+}
+
+static int message_entry_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct message_entry *e1 = *(struct message_entry **) a;
+	const struct message_entry *e2 = *(struct message_entry **) b;
+	int ret;
+
+	/* Newest first */
+	ret = strcmp(e2->datetime, e1->datetime);
+	if (ret != 0)
+		return ret;
+
+	return g_strcmp0(e1->handle, e2->handle);
+}
+
+static struct message_entry *message_entry_new(const char *name,
+							const struct stat *st)
+{
+	struct message_entry *entry;
+	struct tm tm;
+	char *end;
+
+	/* Handles are hexadecimal, anything else isn't a message */
+	strtoull(name, &end, 16);
+	if (name[0] == '\0' || *end != '\0')
+		return NULL;
+
+	entry = g_new0(struct message_entry, 1);
+	entry->handle = g_ascii_strup(name, -1);
+	localtime_r(&st->st_mtime, &tm);
+	strftime(entry->datetime, sizeof(entry->datetime), "%Y%m%dT%H%M%S",
+									&tm);
+	snprintf(entry->size, sizeof(entry->size), "%jd",
+						(intmax_t) st->st_size);
+
+	return entry;
+}
+
+static struct message_index *get_message_index(const char *path, int *err)
+{
+	struct message_index *index;
+	struct dirent *ep;
+	struct stat st;
+	DIR *dp;
+
+	if (stat(path, &st) < 0) {
+		*err = -errno;
+		return NULL;
+	}
+
+	index = g_hash_table_lookup(indexes, path);
+	if (index != NULL && index->mtime.tv_sec == st.st_mtim.tv_sec &&
+			index->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return index;
+
+	dp = opendir(path);
+	if (dp == NULL) {
+		*err = -errno;
+		DBG("opendir(): %d, %s", -*err, strerror(-*err));
+		return NULL;
+	}
+
+	index = g_new0(struct message_index, 1);
+	index->mtime = st.st_mtim;
+	index->entries = g_ptr_array_new_with_free_func(message_entry_free);
+
+	while ((ep = readdir(dp)) != NULL) {
+		struct message_entry *entry;
+		char *abs;
+
+		abs = g_build_filename(path, ep->d_name, NULL);
+
+		if (stat(abs, &st) == 0 && S_ISREG(st.st_mode)) {
+			entry = message_entry_new(ep->d_name, &st);
+			if (entry)
+				g_ptr_array_add(index->entries, entry);
+		}
+
+		g_free(abs);
+	}
+
+	closedir(dp);
+
+	g_ptr_array_sort(index->entries, message_entry_cmp);
+
+	DBG("%s: %u messages", path, index->entries->len);
+
+	g_hash_table_replace(indexes, g_strdup(path), index);
+
+	return index;
+}
+
+static gboolean message_matches(struct messages_listing_data *mld,
+					const struct message_entry *entry)
+{
+	if (mld->period_begin && strcmp(entry->datetime,
+						mld->period_begin) < 0)
+		return FALSE;
+
+	if (mld->period_end && strcmp(entry->datetime, mld->period_end) > 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void messages_listing_data_free(void *data)
+{
+	struct messages_listing_data *mld = data;
+
+	g_free(mld->period_begin);
+	g_free(mld->period_end);
+	g_free(mld);
+}
+
+static gboolean get_messages_listing(void *d)
+{
+	struct messages_listing_data *mld = d;
+	struct session *session = mld->session;
+	struct message_index *index;
+	struct messages_message msg;
+	uint16_t skipped, sent;
+	guint i, size;
+	char *path;
+	int err;
+
+	path = g_build_filename(session->cwd_absolute, mld->name, NULL);
+	index = get_message_index(path, &err);
+	g_free(path);
+
+	if (index == NULL) {
+		mld->callback(session, err, 0, FALSE, NULL, mld->user_data);
+		return FALSE;
+	}
+
+	if (mld->period_begin || mld->period_end) {
+		for (i = 0, size = 0; i < index->entries->len; i++)
+			if (message_matches(mld, index->entries->pdata[i]))
+				size++;
+	} else
+		size = index->entries->len;
+
+	for (i = 0, skipped = 0, sent = 0; i < index->entries->len &&
+						sent < mld->max; i++) {
+		struct message_entry *entry = index->entries->pdata[i];
+
+		if (!message_matches(mld, entry))
+			continue;
+
+		if (skipped < mld->offset) {
+			skipped++;
+			continue;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.mask = PMASK_DATETIME | PMASK_SIZE | PMASK_RECEPTION_STATUS |
+						PMASK_ATTACHMENT_SIZE;
+		msg.handle = entry->handle;
+		msg.datetime = entry->datetime;
+		msg.size = entry->size;
+		msg.reception_status = "complete";
+		msg.attachment_size = "0";
+
+		mld->callback(session, -EAGAIN, 0, FALSE, &msg,
+							mld->user_data);
+		sent++;
+	}
+
+	mld->callback(session, 0, MIN(size, G_MAXUINT16), FALSE, NULL,
+							mld->user_data);
+
+	return FALSE;
+}
+
 int messages_init(void)
 {
 	char *tmp;
@@ -208,6 +429,9 @@ int messages_init(void)
 	if (root_folder)
 		return 0;
 
+	indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+							message_index_free);
+
 	tmp = getenv("MAP_ROOT");
 	if (tmp) {
 		root_folder = g_strdup(tmp);
@@ -225,6 +449,9 @@ int messages_init(void)
 
 void messages_exit(void)
 {
+	g_hash_table_destroy(indexes);
+	indexes = NULL;
+
 	g_free(root_folder);
 	root_folder = NULL;
 }
@@ -329,14 +556,32 @@ int messages_get_folder_listing(void *s, const char *name, uint16_t max,
 	return 0;
 }
 
-int messages_get_messages_listing(void *session, const char *name,
+int messages_get_messages_listing(void *s, const char *name,
 				uint16_t max, uint16_t offset,
 				uint8_t subject_len,
 				const struct messages_filter *filter,
 				messages_get_messages_listing_cb callback,
 				void *user_data)
 {
-	return -ENOSYS;
+	struct session *session = s;
+	struct messages_listing_data *mld;
+
+	mld = g_new0(struct messages_listing_data, 1);
+	mld->session = session;
+	mld->name = name;
+	mld->max = max;
+	mld->offset = offset;
+	mld->period_begin = g_strdup(filter->period_begin);
+	mld->period_end = g_strdup(filter->period_end);
+	mld->callback = callback;
+	mld->user_data = user_data;
+
+	session->request = mld;
+
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, get_messages_listing,
+					mld, messages_listing_data_free);
+
+	return 0;
 }
 
 int messages_get_message(void *session, const char *handle,
@@ -222,7 +222,8 @@ int messages_get_folder_listing(void *session, const char *name, uint16_t max,
  * newmsg: Indicates presence of unread messages.
  *
  * Callback shall be called for every entry of the listing, giving message data
- * in 'message'.
+ * in 'message'. Backends apply filter, offset and max themselves so only the
+ * requested page is generated, 'size' counts all messages matching filter.
  */
 typedef void (*messages_get_messages_listing_cb)(void *session, int err,
 					uint16_t size, gboolean newmsg,
@@ -65,6 +65,9 @@
 #define PHONEBOOKSIZE_TAG	0X08
 #define NEWMISSEDCALLS_TAG	0X09
 
+/* Buffered vCard bytes below which the next part is fetched */
+#define PULL_PREFETCH_SIZE	(32 * 1024)
+
 struct cache {
 	gboolean valid;
 	uint32_t index;
@@ -83,12 +86,15 @@ struct pbap_session {
 	struct apparam_field *params;
 	char *folder;
 	uint32_t find_handle;
-	struct cache cache;
+	struct cache *cache;
+	GHashTable *caches;
 	struct pbap_object *obj;
 };
 
 struct pbap_object {
 	GString *buffer;
+	size_t offset;
+	gboolean pending;
 	GObexApparam *apparam;
 	gboolean firstpacket;
 	gboolean lastpart;
@@ -169,6 +175,61 @@ static void cache_clear(struct cache *cache)
 {
 	g_slist_free_full(cache->entries, cache_entry_free);
 	cache->entries = NULL;
+	cache->index = 0;
+	cache->valid = FALSE;
+}
+
+static void cache_free(void *data)
+{
+	struct cache *cache = data;
+
+	cache_clear(cache);
+	g_free(cache);
+}
+
+/*
+ * Listing caches are kept per folder for the whole session so moving
+ * between folders doesn't query the backend again.
+ */
+static struct cache *cache_get(struct pbap_session *pbap, const char *folder)
+{
+	struct cache *cache;
+
+	cache = g_hash_table_lookup(pbap->caches, folder);
+	if (cache == NULL) {
+		cache = g_new0(struct cache, 1);
+		g_hash_table_insert(pbap->caches, g_strdup(folder), cache);
+	}
+
+	pbap->cache = cache;
+
+	return cache;
+}
+
+static gboolean cache_is_call_history(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	const char *folder = key;
+
+	return !g_str_has_suffix(folder, "/pb");
+}
+
+static ssize_t object_read(struct pbap_object *obj, void *buf, size_t count)
+{
+	GString *buffer = obj->buffer;
+	size_t len;
+
+	len = MIN(buffer->len - obj->offset, count);
+	memcpy(buf, buffer->str + obj->offset, len);
+	obj->offset += len;
+
+	/* Fully consumed, start over instead of moving data around */
+	if (obj->offset == buffer->len) {
+		g_string_truncate(buffer, 0);
+		obj->offset = 0;
+	}
+
+	return len;
 }
 
 static void phonebook_size_result(const char *buffer, size_t bufsize,
@@ -218,6 +279,7 @@ static void query_result(const char *buffer, size_t bufsize, int vcards,
 	}
 
 	pbap->obj->lastpart = lastpart;
+	pbap->obj->pending = FALSE;
 
 	if (vcards < 0) {
 		obex_object_set_io_flags(pbap->obj, G_IO_ERR, -ENOENT);
@@ -226,9 +288,13 @@ static void query_result(const char *buffer, size_t bufsize, int vcards,
 
 	if (!pbap->obj->buffer)
 		pbap->obj->buffer = g_string_new_len(buffer, bufsize);
-	else
+	else {
+		/* Drop what was already sent once per part, not per read */
+		g_string_erase(pbap->obj->buffer, 0, pbap->obj->offset);
+		pbap->obj->offset = 0;
 		pbap->obj->buffer = g_string_append_len(pbap->obj->buffer,
 							buffer,	bufsize);
+	}
 
 	if (missed > 0)	{
 		DBG("missed %d", missed);
@@ -250,12 +316,12 @@ static void cache_entry_notify(const char *id, uint32_t handle,
 {
 	struct pbap_session *pbap = user_data;
 	struct cache_entry *entry = g_new0(struct cache_entry, 1);
-	struct cache *cache = &pbap->cache;
+	struct cache *cache = pbap->cache;
 
 	if (handle != PHONEBOOK_INVALID_HANDLE)
 		entry->handle = handle;
 	else
-		entry->handle = ++pbap->cache.index;
+		entry->handle = ++cache->index;
 
 	entry->id = g_strdup(id);
 	entry->name = g_strdup(name);
@@ -365,7 +431,7 @@ static int generate_response(void *user_data)
 
 	if (max == 0) {
 		/* Ignore all other parameter and return PhoneBookSize */
-		uint16_t size = g_slist_length(pbap->cache.entries);
+		uint16_t size = g_slist_length(pbap->cache->entries);
 
 		pbap->obj->apparam = g_obex_apparam_set_uint16(
 							pbap->obj->apparam,
@@ -379,7 +445,7 @@ static int generate_response(void *user_data)
 	 * Don't free the sorted list content: this list contains
 	 * only the reference for the "real" cache entry.
 	 */
-	sorted = sort_entries(pbap->cache.entries, pbap->params->order,
+	sorted = sort_entries(pbap->cache->entries, pbap->params->order,
 				pbap->params->searchattrib,
 				(const char *) pbap->params->searchval);
 
@@ -413,7 +479,7 @@ static void cache_ready_notify(void *user_data)
 	phonebook_req_finalize(pbap->obj->request);
 	pbap->obj->request = NULL;
 
-	pbap->cache.valid = TRUE;
+	pbap->cache->valid = TRUE;
 
 	generate_response(pbap);
 	obex_object_set_io_flags(pbap->obj, G_IO_IN, 0);
@@ -427,9 +493,9 @@ static void cache_entry_done(void *user_data)
 
 	DBG("");
 
-	pbap->cache.valid = TRUE;
+	pbap->cache->valid = TRUE;
 
-	id = cache_find(&pbap->cache, pbap->find_handle);
+	id = cache_find(pbap->cache, pbap->find_handle);
 	if (id == NULL) {
 		DBG("Entry %d not found on cache", pbap->find_handle);
 		obex_object_set_io_flags(pbap->obj, G_IO_ERR, -ENOENT);
@@ -484,6 +550,8 @@ static void *pbap_connect(struct obex_session *os, int *err)
 	pbap = g_new0(struct pbap_session, 1);
 	pbap->folder = g_strdup("/");
 	pbap->find_handle = PHONEBOOK_INVALID_HANDLE;
+	pbap->caches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+								cache_free);
 
 	if (err)
 		*err = 0;
@@ -584,11 +652,11 @@ static int pbap_setpath(struct obex_session *os, void *user_data)
 	pbap->folder = fullname;
 
 	/*
-	 * FIXME: Define a criteria to mark the cache as invalid
+	 * Phonebook listings stay cached, call history changes with every
+	 * call so it is fetched again once the client moves around.
 	 */
-	pbap->cache.valid = FALSE;
-	pbap->cache.index = 0;
-	cache_clear(&pbap->cache);
+	g_hash_table_foreach_remove(pbap->caches, cache_is_call_history, NULL);
+	pbap->cache = NULL;
 
 	return 0;
 }
@@ -607,7 +675,7 @@ static void pbap_disconnect(struct obex_session *os, void *user_data)
 		g_free(pbap->params);
 	}
 
-	cache_clear(&pbap->cache);
+	g_hash_table_destroy(pbap->caches);
 	g_free(pbap->folder);
 	g_free(pbap);
 }
@@ -722,7 +790,7 @@ static void *vobject_list_open(const char *name, int oflag, mode_t mode,
 	int ret;
 	void *request;
 
-	DBG("name %s context %p valid %d", name, context, pbap->cache.valid);
+	DBG("name %s context %p", name, context);
 
 	if (oflag != O_RDONLY) {
 		ret = -EPERM;
@@ -736,10 +804,12 @@ static void *vobject_list_open(const char *name, int oflag, mode_t mode,
 
 	/* PullvCardListing always get the contacts from the cache */
 
-	if (pbap->cache.valid) {
+	if (cache_get(pbap, name)->valid) {
 		obj = vobject_create(pbap, NULL);
 		ret = generate_response(pbap);
 	} else {
+		/* Drop leftovers of a build that got interrupted */
+		cache_clear(pbap->cache);
 		request = phonebook_create_cache(name, cache_entry_notify,
 					cache_ready_notify, pbap, &ret);
 		if (ret == 0)
@@ -772,7 +842,7 @@ static void *vobject_vcard_open(const char *name, int oflag, mode_t mode,
 	int ret;
 	void *request;
 
-	DBG("name %s context %p valid %d", name, context, pbap->cache.valid);
+	DBG("name %s context %p", name, context);
 
 	if (oflag != O_RDONLY) {
 		ret = -EPERM;
@@ -784,14 +854,15 @@ static void *vobject_vcard_open(const char *name, int oflag, mode_t mode,
 		goto fail;
 	}
 
-	if (pbap->cache.valid == FALSE) {
+	if (cache_get(pbap, pbap->folder)->valid == FALSE) {
 		pbap->find_handle = handle;
+		cache_clear(pbap->cache);
 		request = phonebook_create_cache(pbap->folder,
 			cache_entry_notify, cache_entry_done, pbap, &ret);
 		goto done;
 	}
 
-	id = cache_find(&pbap->cache, handle);
+	id = cache_find(pbap->cache, handle);
 	if (!id) {
 		ret = -ENOENT;
 		goto fail;
@@ -852,19 +923,28 @@ static ssize_t vobject_pull_read(void *object, void *buf, size_t count)
 		return -EAGAIN;
 	}
 
-	len = string_read(obj->buffer, buf, count);
-	if (len == 0 && !obj->lastpart) {
-		/* in case when buffer is empty and we know that more
-		 * data is still available in backend, requesting new
-		 * data part via phonebook_pull_read and returning
-		 * -EAGAIN to suspend request for now */
+	len = object_read(obj, buf, count);
+
+	/* Fetch the next part from the backend before the buffer runs dry
+	 * so the transfer doesn't stall waiting for it */
+	if (!obj->lastpart && !obj->pending &&
+			obj->buffer->len - obj->offset < PULL_PREFETCH_SIZE) {
+		obj->pending = TRUE;
+
 		ret = phonebook_pull_read(obj->request);
 		if (ret)
 			return -EPERM;
 
-		return -EAGAIN;
+		if (len == 0)
+			len = object_read(obj, buf, count);
 	}
 
+	/* in case when buffer is empty and we know that more data is still
+	 * available in backend, returning -EAGAIN to suspend request until
+	 * the part being fetched arrives */
+	if (len == 0 && !obj->lastpart)
+		return -EAGAIN;
+
 	return len;
 }
 
@@ -875,7 +955,7 @@ static ssize_t vobject_list_get_next_header(void *object, void *buf, size_t mtu,
 	struct pbap_session *pbap = obj->session;
 
 	/* Backend still busy reading contacts */
-	if (!pbap->cache.valid)
+	if (!pbap->cache->valid)
 		return -EAGAIN;
 
 	*hi = G_OBEX_HDR_APPARAM;
@@ -891,13 +971,13 @@ static ssize_t vobject_list_read(void *object, void *buf, size_t count)
 	struct pbap_object *obj = object;
 	struct pbap_session *pbap = obj->session;
 
-	DBG("valid %d maxlistcount %d", pbap->cache.valid,
+	DBG("valid %d maxlistcount %d", pbap->cache->valid,
 						pbap->params->maxlistcount);
 
 	if (pbap->params->maxlistcount == 0)
 		return -ENOSTR;
 
-	return string_read(obj->buffer, buf, count);
+	return object_read(obj, buf, count);
 }
 
 static ssize_t vobject_vcard_read(void *object, void *buf, size_t count)
@@ -909,7 +989,7 @@ static ssize_t vobject_vcard_read(void *object, void *buf, size_t count)
 	if (!obj->buffer)
 		return -EAGAIN;
 
-	return string_read(obj->buffer, buf, count);
+	return object_read(obj, buf, count);
 }
 
 static struct obex_mime_type_driver mime_pull = {
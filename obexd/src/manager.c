@@ -54,6 +54,10 @@
 
 #define TIMEOUT 60*1000 /* Timeout for user response (miliseconds) */
 
+/* Transferred is signalled at most this often and for at least this much */
+#define PROGRESS_INTERVAL	(500 * 1000) /* microseconds */
+#define PROGRESS_MIN_DELTA	(32 * 1024)
+
 struct agent {
 	char *bus_name;
 	char *path;
@@ -74,6 +78,8 @@ struct obex_transfer {
 	uint8_t status;
 	char *path;
 	struct obex_session *session;
+	int64_t progress;
+	gint64 progress_time;
 };
 
 static struct agent *agent = NULL;
@@ -551,11 +557,29 @@ static void emit_transfer_completed(struct obex_transfer *transfer,
 }
 
 static void emit_transfer_progress(struct obex_transfer *transfer,
-					uint32_t total, uint32_t transferred)
+					int64_t total, int64_t transferred)
 {
+	gint64 now;
+
 	if (transfer->path == NULL)
 		return;
 
+	if (transferred == transfer->progress)
+		return;
+
+	/* Progress comes per packet, only signal it at a bounded rate */
+	now = g_get_monotonic_time();
+	if (transferred != total) {
+		if (now - transfer->progress_time < PROGRESS_INTERVAL)
+			return;
+
+		if (transferred - transfer->progress < PROGRESS_MIN_DELTA)
+			return;
+	}
+
+	transfer->progress = transferred;
+	transfer->progress_time = now;
+
 	g_dbus_emit_property_changed(connection, transfer->path,
 					TRANSFER_INTERFACE, "Transferred");
 }
@@ -795,6 +819,13 @@ void manager_emit_transfer_completed(struct obex_transfer *transfer)
 	if (session == NULL || session->object == NULL)
 		return;
 
+	/* Flush progress that was held back by the rate limit */
+	if (transfer->path != NULL && transfer->progress != session->offset) {
+		transfer->progress = session->offset;
+		g_dbus_emit_property_changed(connection, transfer->path,
+					TRANSFER_INTERFACE, "Transferred");
+	}
+
 	emit_transfer_completed(transfer, !session->aborted);
 }
 
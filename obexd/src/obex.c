@@ -53,6 +53,9 @@
 #include "service.h"
 #include "transport.h"
 
+/* Bytes buffered before handing received data to synchronous drivers */
+#define WRITE_BEHIND_SIZE (64 * 1024)
+
 static GSList *sessions = NULL;
 
 typedef struct {
@@ -456,6 +459,13 @@ static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 		goto reset;
 	}
 
+	/* Write whatever write-behind still holds for unknown sizes */
+	if (os->pending > 0 && os->object && os->driver &&
+					os->driver->set_io_watch == NULL) {
+		if (driver_write(os) < 0)
+			goto reset;
+	}
+
 	if (os->object && os->driver && os->driver->flush) {
 		if (os->driver->flush(os->object) == -EAGAIN) {
 			g_obex_suspend(os->obex);
@@ -557,6 +567,25 @@ done:
 	return FALSE;
 }
 
+/*
+ * Drivers that complete writes synchronously get several packets per
+ * write call, the last chunk of an object of known size is always
+ * written right away so errors still make it into the final response.
+ */
+static gboolean write_behind_full(struct obex_session *os)
+{
+	if (os->driver->set_io_watch != NULL)
+		return TRUE;
+
+	if (os->pending >= WRITE_BEHIND_SIZE)
+		return TRUE;
+
+	if (os->size < 0)
+		return FALSE;
+
+	return os->offset + os->pending >= os->size;
+}
+
 static gboolean recv_data(const void *buf, gsize size, gpointer user_data)
 {
 	struct obex_session *os = user_data;
@@ -583,6 +612,9 @@ static gboolean recv_data(const void *buf, gsize size, gpointer user_data)
 		return TRUE;
 	}
 
+	if (!write_behind_full(os))
+		return TRUE;
+
 	ret = driver_write(os);
 	if (ret >= 0)
 		return TRUE;
@@ -852,6 +884,8 @@ done:
 static void cmd_put(GObex *obex, GObexPacket *req, gpointer user_data)
 {
 	struct obex_session *os = user_data;
+	const guint8 *body;
+	gsize body_len;
 	int err;
 
 	DBG("");
@@ -874,7 +908,7 @@ static void cmd_put(GObex *obex, GObexPacket *req, gpointer user_data)
 	os->cmd = G_OBEX_OP_PUT;
 
 	/* Set size to unknown if a body header exists */
-	if (g_obex_packet_get_body(req))
+	if (g_obex_packet_get_body_bytes(req, &body, &body_len))
 		os->size = OBJECT_SIZE_UNKNOWN;
 
 	parse_name(os, req);
@@ -33,6 +33,7 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/sdp.h>
 
+#include "lib/uuid.h"
 #include "src/plugin.h"
 #include "src/log.h"
 #include "src/dbus-common.h"
@@ -97,6 +98,15 @@ static DBusMessage *error_reply(DBusMessage *msg, int error)
 	return g_dbus_create_error(msg, name , "%s", strerror(error));
 }
 
+static void set_oob_prefetch(bool enable)
+{
+	struct btd_adapter *adapter;
+
+	adapter = btd_adapter_get_default();
+	if (adapter)
+		btd_adapter_set_oob_prefetch(adapter, enable);
+}
+
 static void register_agent(bool append_carrier);
 
 static void register_agent_cb(DBusPendingCall *call, void *user_data)
@@ -136,6 +146,8 @@ static void register_agent_cb(DBusPendingCall *call, void *user_data)
 	try_fallback = true;
 
 	info("Registered as neard handover agent");
+
+	set_oob_prefetch(true);
 }
 
 static void register_agent(bool append_carrier)
@@ -181,6 +193,8 @@ static void unregister_agent(void)
 	g_free(neard_service);
 	neard_service = NULL;
 
+	set_oob_prefetch(false);
+
 	message = dbus_message_new_method_call(NEARD_NAME, NEARD_PATH,
 			NEARD_MANAGER_INTERFACE, "UnregisterHandoverAgent");
 
@@ -749,6 +763,7 @@ static DBusMessage *request_oob(DBusConnection *conn, DBusMessage *msg,
 	struct oob_handler *handler;
 	struct oob_params remote;
 	struct btd_device *device;
+	uint8_t hash[16], randomizer[16];
 	int err;
 
 	if (neard_service == NULL ||
@@ -802,6 +817,10 @@ done:
 read_local:
 	free_oob_params(&remote);
 
+	/* Answer right away if data was prefetched in the background */
+	if (btd_adapter_take_local_oob_data(adapter, hash, randomizer))
+		return create_request_oob_reply(adapter, hash, randomizer, msg);
+
 	err = btd_adapter_read_local_oob_data(adapter);
 	if (err < 0)
 		return error_reply(msg, -err);
@@ -827,6 +846,8 @@ static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 	g_free(neard_service);
 	neard_service = NULL;
 
+	set_oob_prefetch(false);
+
 	g_dbus_unregister_interface(conn, AGENT_PATH, AGENT_INTERFACE);
 
 	return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
@@ -877,6 +898,8 @@ static void neard_vanished(DBusConnection *conn, void *user_data)
 		g_free(neard_service);
 		neard_service = NULL;
 
+		set_oob_prefetch(false);
+
 		g_dbus_unregister_interface(conn, AGENT_PATH, AGENT_INTERFACE);
 	}
 }
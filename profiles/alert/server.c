@@ -324,43 +324,12 @@ static void watcher_disconnect(DBusConnection *conn, void *user_data)
 
 static gboolean is_notifiable_device(struct btd_device *device, uint16_t ccc)
 {
-	char *filename;
-	GKeyFile *key_file;
-	char handle[6];
-	char *str;
 	uint16_t val;
-	gboolean result;
 
-	sprintf(handle, "%hu", ccc);
-
-	filename = btd_device_get_storage_path(device, "ccc");
-	if (!filename) {
-		warn("Unable to get ccc storage path for device");
+	if (attrib_read_ccc(device, ccc, &val) < 0)
 		return FALSE;
-	}
-
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-
-	str = g_key_file_get_string(key_file, handle, "Value", NULL);
-	if (!str) {
-		result = FALSE;
-		goto end;
-	}
-
-	val = strtol(str, NULL, 16);
-	if (!(val & 0x0001)) {
-		result = FALSE;
-		goto end;
-	}
-
-	result = TRUE;
-end:
-	g_free(str);
-	g_free(filename);
-	g_key_file_free(key_file);
 
-	return result;
+	return val & 0x0001 ? TRUE : FALSE;
 }
 
 static void destroy_notify_callback(guint8 status, const guint8 *pdu, guint16 len,
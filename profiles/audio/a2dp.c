@@ -2033,6 +2033,7 @@ static struct btd_profile a2dp_source_profile = {
 	.device_remove	= a2dp_source_remove,
 
 	.auto_connect	= true,
+	.serial_connect	= true,
 	.connect	= a2dp_source_connect,
 	.disconnect	= a2dp_source_disconnect,
 
@@ -2049,6 +2050,7 @@ static struct btd_profile a2dp_sink_profile = {
 	.device_remove	= a2dp_sink_remove,
 
 	.auto_connect	= true,
+	.serial_connect	= true,
 	.connect	= a2dp_sink_connect,
 	.disconnect	= a2dp_sink_disconnect,
 
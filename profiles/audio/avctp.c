@@ -62,6 +62,9 @@
  */
 #define AVC_PRESS_TIMEOUT	2
 
+#define AVCTP_TRANSACTIONS	16
+#define AVCTP_REQ_TIMEOUT	2
+
 #define QUIRK_NO_RELEASE 1 << 0
 
 /* Message types */
@@ -170,7 +173,7 @@ struct avctp_channel {
 	uint16_t omtu;
 	uint8_t *buffer;
 	GSList *handlers;
-	struct avctp_pending_req *p;
+	GSList *inflight;	/* sent, waiting for the first response */
 	GQueue *queue;
 	GSList *processed;
 	guint process_id;
@@ -182,6 +185,16 @@ struct key_pressed {
 	guint timer;
 };
 
+/* Time from reading a passthrough PDU to handing its keys to uinput */
+struct key_latency {
+	unsigned int count;
+	gint64 total;
+	gint64 min;
+	gint64 max;
+};
+
+#define KEY_LATENCY_REPORT	64
+
 struct avctp {
 	struct avctp_server *server;
 	struct btd_device *device;
@@ -202,6 +215,8 @@ struct avctp {
 
 	uint8_t key_quirks[256];
 	struct key_pressed key;
+	gint64 rx_time;
+	struct key_latency latency;
 	bool initiator;
 };
 
@@ -288,6 +303,9 @@ static struct {
 	{ NULL }
 };
 
+/* Direct lookup from the 7 bit AV/C operation id to key_map index + 1 */
+static uint8_t key_index[128];
+
 static GSList *callbacks = NULL;
 static GSList *servers = NULL;
 
@@ -297,36 +315,88 @@ static gboolean avctp_passthrough_rsp(struct avctp *session, uint8_t code,
 					uint8_t subunit, uint8_t *operands,
 					size_t operand_count, void *user_data);
 
-static int send_event(int fd, uint16_t type, uint16_t code, int32_t value)
+static void key_map_init(void)
+{
+	int i;
+
+	/* Walk backwards so the first entry wins for duplicate ids */
+	for (i = G_N_ELEMENTS(key_map) - 2; i >= 0; i--)
+		key_index[key_map[i].avc & 0x7F] = i + 1;
+}
+
+static int key_lookup(uint8_t op)
+{
+	return key_index[op & 0x7F] - 1;
+}
+
+/* Fills in a key event plus its sync report, two uinput_event slots */
+static int add_key(struct uinput_event *events, uint16_t key, int pressed)
 {
-	struct uinput_event event;
+	memset(events, 0, 2 * sizeof(*events));
 
-	memset(&event, 0, sizeof(event));
-	event.type	= type;
-	event.code	= code;
-	event.value	= value;
+	events[0].type = EV_KEY;
+	events[0].code = key;
+	events[0].value = pressed;
 
-	return write(fd, &event, sizeof(event));
+	events[1].type = EV_SYN;
+	events[1].code = SYN_REPORT;
+
+	return 2;
 }
 
-static void send_key(int fd, uint16_t key, int pressed)
+static void key_latency_update(struct avctp *session)
 {
-	if (fd < 0)
+	struct key_latency *lat = &session->latency;
+	gint64 delta;
+
+	delta = g_get_monotonic_time() - session->rx_time;
+
+	if (!lat->count || delta < lat->min)
+		lat->min = delta;
+	if (delta > lat->max)
+		lat->max = delta;
+
+	lat->total += delta;
+	lat->count++;
+
+	if (lat->count % KEY_LATENCY_REPORT == 0)
+		DBG("AV/C: %u keys, uinput latency min %" G_GINT64_FORMAT
+			" avg %" G_GINT64_FORMAT " max %" G_GINT64_FORMAT " us",
+			lat->count, lat->min, lat->total / lat->count,
+			lat->max);
+}
+
+/*
+ * All events for one PDU go out in a single write. Passing timed as
+ * true accounts the delay since the PDU was read from the socket.
+ */
+static void send_keys(struct avctp *session, struct uinput_event *events,
+						int count, bool timed)
+{
+	if (session->uinput < 0 || count == 0)
 		return;
 
-	send_event(fd, EV_KEY, key, pressed);
-	send_event(fd, EV_SYN, SYN_REPORT, 0);
+	if (write(session->uinput, events, count * sizeof(*events)) < 0) {
+		error("AVRCP: uinput write failed: %s (%d)", strerror(errno),
+									errno);
+		return;
+	}
+
+	if (timed)
+		key_latency_update(session);
 }
 
 static gboolean auto_release(gpointer user_data)
 {
 	struct avctp *session = user_data;
+	struct uinput_event events[2];
 
 	session->key.timer = 0;
 
 	DBG("AV/C: key press timeout");
 
-	send_key(session->uinput, session->key.op, 0);
+	send_keys(session, events, add_key(events, session->key.op, 0),
+									false);
 
 	return FALSE;
 }
@@ -337,8 +407,10 @@ static size_t handle_panel_passthrough(struct avctp *session,
 					size_t operand_count, void *user_data)
 {
 	struct avctp_passthrough_handler *handler = session->handler;
+	struct uinput_event events[4];
 	const char *status;
-	int pressed, i;
+	uint8_t key_quirks;
+	int pressed, i, n = 0;
 
 	if (*code != AVC_CTYPE_CONTROL || *subunit != AVC_SUBUNIT_PANEL) {
 		*code = AVC_CTYPE_REJECTED;
@@ -362,54 +434,47 @@ static size_t handle_panel_passthrough(struct avctp *session,
 			goto done;
 	}
 
-	for (i = 0; key_map[i].name != NULL; i++) {
-		uint8_t key_quirks;
-
-		if ((operands[0] & 0x7F) != key_map[i].avc)
-			continue;
-
-		DBG("AV/C: %s %s", key_map[i].name, status);
+	i = key_lookup(operands[0]);
+	if (i < 0) {
+		DBG("AV/C: unknown button 0x%02X %s",
+						operands[0] & 0x7F, status);
+		*code = AVC_CTYPE_NOT_IMPLEMENTED;
+		return operand_count;
+	}
 
-		key_quirks = session->key_quirks[key_map[i].avc];
+	DBG("AV/C: %s %s", key_map[i].name, status);
 
-		if (key_quirks & QUIRK_NO_RELEASE) {
-			if (!pressed) {
-				DBG("AV/C: Ignoring release");
-				break;
-			}
+	key_quirks = session->key_quirks[key_map[i].avc];
 
-			DBG("AV/C: treating key press as press + release");
-			send_key(session->uinput, key_map[i].uinput, 1);
-			send_key(session->uinput, key_map[i].uinput, 0);
-			break;
+	if (key_quirks & QUIRK_NO_RELEASE) {
+		if (!pressed) {
+			DBG("AV/C: Ignoring release");
+			goto done;
 		}
 
-		if (pressed) {
-			if (session->key.timer > 0) {
-				g_source_remove(session->key.timer);
-				send_key(session->uinput, session->key.op, 0);
-			}
+		DBG("AV/C: treating key press as press + release");
+		n += add_key(&events[n], key_map[i].uinput, 1);
+		n += add_key(&events[n], key_map[i].uinput, 0);
+		send_keys(session, events, n, true);
+		goto done;
+	}
 
-			session->key.op = key_map[i].uinput;
-			session->key.timer = g_timeout_add_seconds(
-							AVC_PRESS_TIMEOUT,
-							auto_release,
-							session);
-		} else if (session->key.timer > 0) {
+	if (pressed) {
+		if (session->key.timer > 0) {
 			g_source_remove(session->key.timer);
-			session->key.timer = 0;
+			n += add_key(&events[n], session->key.op, 0);
 		}
 
-		send_key(session->uinput, key_map[i].uinput, pressed);
-		break;
+		session->key.op = key_map[i].uinput;
+		session->key.timer = g_timeout_add_seconds(AVC_PRESS_TIMEOUT,
+							auto_release, session);
+	} else if (session->key.timer > 0) {
+		g_source_remove(session->key.timer);
+		session->key.timer = 0;
 	}
 
-	if (key_map[i].name == NULL) {
-		DBG("AV/C: unknown button 0x%02X %s",
-						operands[0] & 0x7F, status);
-		*code = AVC_CTYPE_NOT_IMPLEMENTED;
-		return operand_count;
-	}
+	n += add_key(&events[n], key_map[i].uinput, pressed);
+	send_keys(session, events, n, true);
 
 done:
 	*code = AVC_CTYPE_ACCEPTED;
@@ -499,8 +564,8 @@ static void avctp_channel_destroy(struct avctp_channel *chan)
 	if (chan->watch)
 		g_source_remove(chan->watch);
 
-	if (chan->p)
-		pending_destroy(chan->p, NULL);
+	g_slist_foreach(chan->inflight, pending_destroy, NULL);
+	g_slist_free(chan->inflight);
 
 	if (chan->process_id > 0)
 		g_source_remove(chan->process_id);
@@ -538,6 +603,13 @@ static void avctp_disconnected(struct avctp *session)
 	if (session->key.timer > 0)
 		g_source_remove(session->key.timer);
 
+	if (session->latency.count > 0)
+		DBG("AV/C: %u keys, uinput latency min %" G_GINT64_FORMAT
+			" avg %" G_GINT64_FORMAT " max %" G_GINT64_FORMAT " us",
+			session->latency.count, session->latency.min,
+			session->latency.total / session->latency.count,
+			session->latency.max);
+
 	if (session->uinput >= 0) {
 		char address[18];
 
@@ -710,21 +782,26 @@ done:
 	g_free(req);
 }
 
+static void schedule_queue(struct avctp_channel *chan)
+{
+	if (chan->process_id == 0 && !g_queue_is_empty(chan->queue))
+		chan->process_id = g_idle_add(process_queue, chan);
+}
+
 static gboolean req_timeout(gpointer user_data)
 {
-	struct avctp_channel *chan = user_data;
-	struct avctp_pending_req *p = chan->p;
+	struct avctp_pending_req *p = user_data;
+	struct avctp_channel *chan = p->chan;
 
 	DBG("transaction %u", p->transaction);
 
 	p->timeout = 0;
 	p->err = -ETIMEDOUT;
 
+	chan->inflight = g_slist_remove(chan->inflight, p);
 	pending_destroy(p, NULL);
-	chan->p = NULL;
 
-	if (chan->process_id == 0)
-		chan->process_id = g_idle_add(process_queue, chan);
+	schedule_queue(chan);
 
 	return FALSE;
 }
@@ -748,32 +825,73 @@ static int process_browsing(void *data)
 					req->operands, req->operand_count);
 }
 
+static bool transaction_in_use(GSList *list, uint8_t transaction)
+{
+	for (; list; list = list->next) {
+		struct avctp_pending_req *p = list->data;
+
+		if (p->transaction == transaction)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * A label stays taken while its request is in flight and, for requests
+ * expecting further responses like notification INTERIMs, until the
+ * final response arrives.
+ */
+static int transaction_alloc(struct avctp_channel *chan)
+{
+	int i;
+
+	for (i = 0; i < AVCTP_TRANSACTIONS; i++) {
+		uint8_t t = (chan->transaction + i) % AVCTP_TRANSACTIONS;
+
+		if (transaction_in_use(chan->inflight, t) ||
+				transaction_in_use(chan->processed, t))
+			continue;
+
+		chan->transaction = (t + 1) % AVCTP_TRANSACTIONS;
+
+		return t;
+	}
+
+	return -EBUSY;
+}
+
 static gboolean process_queue(void *user_data)
 {
 	struct avctp_channel *chan = user_data;
-	struct avctp_pending_req *p = chan->p;
+	struct avctp_pending_req *p;
+	int transaction;
 
 	chan->process_id = 0;
 
-	if (p != NULL)
-		return FALSE;
-
-	while ((p = g_queue_pop_head(chan->queue))) {
-
-		if (p->process(p->data) == 0)
+	/*
+	 * Keep as many requests outstanding as there are free transaction
+	 * labels, the queue is kicked again whenever one is released.
+	 */
+	while ((p = g_queue_peek_head(chan->queue))) {
+		transaction = transaction_alloc(chan);
+		if (transaction < 0)
 			break;
 
-		pending_destroy(p, NULL);
-	}
+		g_queue_pop_head(chan->queue);
+		p->transaction = transaction;
 
-	if (p == NULL)
-		return FALSE;
+		if (p->process(p->data) != 0) {
+			pending_destroy(p, NULL);
+			continue;
+		}
 
-	chan->p = p;
-	p->timeout = g_timeout_add_seconds(2, req_timeout, chan);
+		chan->inflight = g_slist_append(chan->inflight, p);
+		p->timeout = g_timeout_add_seconds(AVCTP_REQ_TIMEOUT,
+							req_timeout, p);
+	}
 
 	return FALSE;
-
 }
 
 static void control_response(struct avctp_channel *control,
@@ -782,11 +900,17 @@ static void control_response(struct avctp_channel *control,
 					uint8_t *operands,
 					size_t operand_count)
 {
-	struct avctp_pending_req *p = control->p;
+	struct avctp_pending_req *p;
 	struct avctp_control_req *req;
 	GSList *l;
 
-	if (p && p->transaction == avctp->transaction) {
+	for (l = control->inflight; l; l = l->next) {
+		p = l->data;
+
+		if (p->transaction != avctp->transaction)
+			continue;
+
+		control->inflight = g_slist_delete_link(control->inflight, l);
 		control->processed = g_slist_prepend(control->processed, p);
 
 		if (p->timeout > 0) {
@@ -794,11 +918,7 @@ static void control_response(struct avctp_channel *control,
 			p->timeout = 0;
 		}
 
-		control->p = NULL;
-
-		if (control->process_id == 0)
-			control->process_id = g_idle_add(process_queue,
-								control);
+		break;
 	}
 
 	for (l = control->processed; l; l = l->next) {
@@ -817,6 +937,9 @@ static void control_response(struct avctp_channel *control,
 		control->processed = g_slist_remove(control->processed, p);
 		pending_destroy(p, NULL);
 
+		/* The label is free again */
+		schedule_queue(control);
+
 		return;
 	}
 }
@@ -826,11 +949,17 @@ static void browsing_response(struct avctp_channel *browsing,
 					uint8_t *operands,
 					size_t operand_count)
 {
-	struct avctp_pending_req *p = browsing->p;
+	struct avctp_pending_req *p;
 	struct avctp_browsing_req *req;
 	GSList *l;
 
-	if (p && p->transaction == avctp->transaction) {
+	for (l = browsing->inflight; l; l = l->next) {
+		p = l->data;
+
+		if (p->transaction != avctp->transaction)
+			continue;
+
+		browsing->inflight = g_slist_delete_link(browsing->inflight, l);
 		browsing->processed = g_slist_prepend(browsing->processed, p);
 
 		if (p->timeout > 0) {
@@ -838,11 +967,7 @@ static void browsing_response(struct avctp_channel *browsing,
 			p->timeout = 0;
 		}
 
-		browsing->p = NULL;
-
-		if (browsing->process_id == 0)
-			browsing->process_id = g_idle_add(process_queue,
-								browsing);
+		break;
 	}
 
 	for (l = browsing->processed; l; l = l->next) {
@@ -859,6 +984,9 @@ static void browsing_response(struct avctp_channel *browsing,
 		browsing->processed = g_slist_remove(browsing->processed, p);
 		pending_destroy(p, NULL);
 
+		/* The label is free again */
+		schedule_queue(browsing);
+
 		return;
 	}
 }
@@ -952,6 +1080,8 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond, gpointer data)
 	if (ret <= 0)
 		goto failed;
 
+	session->rx_time = g_get_monotonic_time();
+
 	if (ret < AVCTP_HEADER_LENGTH) {
 		error("Too small AVCTP packet");
 		goto failed;
@@ -1453,6 +1583,8 @@ int avctp_register(struct btd_adapter *adapter, gboolean master)
 	struct avctp_server *server;
 	const bdaddr_t *src = btd_adapter_get_address(adapter);
 
+	key_map_init();
+
 	server = g_new0(struct avctp_server, 1);
 
 	server->control_io = avctp_server_socket(src, master, L2CAP_MODE_BASIC,
@@ -1509,38 +1641,14 @@ static struct avctp_pending_req *pending_create(struct avctp_channel *chan,
 						GDestroyNotify destroy)
 {
 	struct avctp_pending_req *p;
-	GSList *l, *tmp;
-
-	if (!chan->processed)
-		goto done;
 
-	tmp = g_slist_copy(chan->processed);
-
-	/* Find first unused transaction id */
-	for (l = tmp; l; l = g_slist_next(l)) {
-		struct avctp_pending_req *req = l->data;
-
-		if (req->transaction == chan->transaction) {
-			chan->transaction++;
-			chan->transaction %= 16;
-			tmp = g_slist_delete_link(tmp, l);
-			l = tmp;
-		}
-	}
-
-	g_slist_free(tmp);
-
-done:
+	/* The transaction label is assigned when the request is sent */
 	p = g_new0(struct avctp_pending_req, 1);
 	p->chan = chan;
-	p->transaction = chan->transaction;
 	p->process = process;
 	p->data = data;
 	p->destroy = destroy;
 
-	chan->transaction++;
-	chan->transaction %= 16;
-
 	return p;
 }
 
@@ -1613,14 +1721,9 @@ int avctp_send_browsing_req(struct avctp *session,
 
 static const char *op2str(uint8_t op)
 {
-	int i;
-
-	for (i = 0; key_map[i].name != NULL; i++) {
-		if ((op & 0x7F) == key_map[i].avc)
-			return key_map[i].name;
-	}
+	int i = key_lookup(op);
 
-	return "UNKNOWN";
+	return i < 0 ? "UNKNOWN" : key_map[i].name;
 }
 
 static int avctp_passthrough_press(struct avctp *session, uint8_t op)
@@ -88,6 +88,8 @@
 #define DISCONNECT_TIMEOUT 1
 #define START_TIMEOUT 1
 
+#define SEP_CACHE_MAX 8
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 struct avdtp_common_header {
@@ -326,6 +328,14 @@ struct avdtp_server {
 	GIOChannel *io;
 	GSList *seps;
 	GSList *sessions;
+	GSList *sep_cache; /* Most recently used first */
+};
+
+/* Remote SEPs kept after disconnection so that reconnecting to the same
+ * device can go straight to Set Configuration */
+struct sep_cache {
+	bdaddr_t dst;
+	GSList *seps;
 };
 
 struct avdtp_local_sep {
@@ -422,6 +432,9 @@ struct avdtp {
 
 	/* Attempt stream setup instead of disconnecting */
 	gboolean stream_setup;
+
+	/* Remote SEPs need to be discovered again before being trusted */
+	gboolean seps_stale;
 };
 
 static GSList *servers = NULL;
@@ -1098,6 +1111,77 @@ static void sep_free(gpointer data)
 	g_free(sep);
 }
 
+static void sep_cache_free(void *data)
+{
+	struct sep_cache *cache = data;
+
+	g_slist_free_full(cache->seps, sep_free);
+	g_free(cache);
+}
+
+static struct sep_cache *sep_cache_steal(struct avdtp_server *server,
+							const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = server->sep_cache; l != NULL; l = g_slist_next(l)) {
+		struct sep_cache *cache = l->data;
+
+		if (bacmp(&cache->dst, dst) == 0) {
+			server->sep_cache = g_slist_delete_link(
+						server->sep_cache, l);
+			return cache;
+		}
+	}
+
+	return NULL;
+}
+
+static void sep_cache_store(struct avdtp *session)
+{
+	struct avdtp_server *server = session->server;
+	const bdaddr_t *dst = device_get_address(session->device);
+	struct sep_cache *cache;
+	GSList *l, *seps = NULL;
+
+	for (l = session->seps; l != NULL; l = g_slist_next(l)) {
+		struct avdtp_remote_sep *sep = l->data;
+
+		/* Only SEPs whose capabilities are fully known are useful */
+		if (!sep->codec) {
+			sep_free(sep);
+			continue;
+		}
+
+		sep->stream = NULL;
+		seps = g_slist_append(seps, sep);
+	}
+
+	g_slist_free(session->seps);
+	session->seps = NULL;
+
+	cache = sep_cache_steal(server, dst);
+	if (cache)
+		sep_cache_free(cache);
+
+	if (!seps || session->seps_stale) {
+		g_slist_free_full(seps, sep_free);
+		return;
+	}
+
+	cache = g_new0(struct sep_cache, 1);
+	bacpy(&cache->dst, dst);
+	cache->seps = seps;
+
+	server->sep_cache = g_slist_prepend(server->sep_cache, cache);
+
+	if (g_slist_length(server->sep_cache) > SEP_CACHE_MAX) {
+		l = g_slist_last(server->sep_cache);
+		sep_cache_free(l->data);
+		server->sep_cache = g_slist_delete_link(server->sep_cache, l);
+	}
+}
+
 static void remove_disconnect_timer(struct avdtp *session)
 {
 	g_source_remove(session->dc_timer);
@@ -1131,7 +1215,8 @@ static void avdtp_free(void *data)
 
 	g_slist_free_full(session->req_queue, pending_req_free);
 	g_slist_free_full(session->prio_queue, pending_req_free);
-	g_slist_free_full(session->seps, sep_free);
+
+	sep_cache_store(session);
 
 	g_free(session->buf);
 
@@ -2308,6 +2393,7 @@ static struct avdtp *avdtp_get_internal(struct btd_device *device)
 {
 	struct avdtp_server *server;
 	struct avdtp *session;
+	struct sep_cache *cache;
 
 	server = find_server(servers, device_get_adapter(device));
 	if (server == NULL)
@@ -2327,6 +2413,15 @@ static struct avdtp *avdtp_get_internal(struct btd_device *device)
 
 	session->version = get_version(session);
 
+	cache = sep_cache_steal(server, device_get_address(device));
+	if (cache) {
+		DBG("Reusing %u cached remote SEPs",
+					g_slist_length(cache->seps));
+		session->seps = cache->seps;
+		cache->seps = NULL;
+		sep_cache_free(cache);
+	}
+
 	server->sessions = g_slist_append(server->sessions, session);
 
 	return session;
@@ -2753,6 +2848,8 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 	else
 		getcap_cmd = AVDTP_GET_CAPABILITIES;
 
+	session->seps_stale = FALSE;
+
 	sep_count = size / sizeof(struct seid_info);
 
 	for (i = 0; i < sep_count; i++) {
@@ -3095,6 +3192,8 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("SET_CONFIGURATION request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		/* The remote SEPs may have changed since they were cached */
+		session->seps_stale = TRUE;
 		if (sep && sep->cfm && sep->cfm->set_configuration)
 			sep->cfm->set_configuration(session, sep, stream,
 							&err, sep->user_data);
@@ -3314,7 +3413,7 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 
 	session->discover = g_new0(struct discover_callback, 1);
 
-	if (session->seps) {
+	if (session->seps && !session->seps_stale) {
 		session->discover->cb = cb;
 		session->discover->user_data = user_data;
 		session->discover->id = g_idle_add(process_discover, session);
@@ -3737,6 +3836,7 @@ struct avdtp_local_sep *avdtp_register_sep(struct btd_adapter *adapter,
 static void avdtp_server_destroy(struct avdtp_server *server)
 {
 	g_slist_free_full(server->sessions, avdtp_free);
+	g_slist_free_full(server->sep_cache, sep_cache_free);
 
 	servers = g_slist_remove(servers, server);
 
@@ -136,6 +136,13 @@
 
 #define AVRCP_BROWSING_TIMEOUT		1
 
+/* Playback interval, in seconds, requested for PLAYBACK_POS_CHANGED, the
+ * position is interpolated locally in between */
+#define AVRCP_POSITION_INTERVAL		30
+
+/* Tracks whose attributes are kept per player, indexed by UID */
+#define AVRCP_METADATA_CACHE_MAX	64
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 struct avrcp_header {
@@ -195,6 +202,12 @@ struct pending_list_items {
 	uint64_t total;
 };
 
+struct metadata_entry {
+	uint8_t count;
+	uint16_t len;
+	uint8_t data[0];
+};
+
 struct avrcp_player {
 	struct avrcp_server *server;
 	GSList *sessions;
@@ -206,6 +219,9 @@ struct avrcp_player {
 	uint8_t *features;
 	char *path;
 
+	GHashTable *metadata;		/* UID -> struct metadata_entry */
+	uint16_t metadata_counter;	/* UID counter the entries belong to */
+
 	struct pending_list_items *p;
 	char *change_path;
 
@@ -236,6 +252,7 @@ struct avrcp {
 	unsigned int browsing_id;
 	unsigned int browsing_timer;
 	uint16_t supported_events;
+	uint16_t remote_events;		/* Events supported by the remote TG */
 	uint16_t registered_events;
 	uint8_t transaction;
 	uint8_t transaction_events[AVRCP_EVENT_LAST + 1];
@@ -1843,6 +1860,15 @@ static void avrcp_get_play_status(struct avrcp *session)
 					session);
 }
 
+static void avrcp_update_play_status(struct avrcp *session)
+{
+	/* Position changes are notified by the TG, no need to ask for it */
+	if (session->remote_events & (1 << AVRCP_EVENT_PLAYBACK_POS_CHANGED))
+		return;
+
+	avrcp_get_play_status(session);
+}
+
 static const char *status_to_str(uint8_t status)
 {
 	switch (status) {
@@ -2037,14 +2063,26 @@ static gboolean avrcp_get_element_attributes_rsp(struct avctp *conn,
 
 	avrcp_parse_attribute_list(player, &pdu->params[1], count);
 
-	avrcp_get_play_status(session);
+	avrcp_update_play_status(session);
 
 	return FALSE;
 }
 
+static uint8_t put_media_attributes(uint8_t *buf)
+{
+	uint32_t attr;
+
+	/* Only request the attributes that metadata_to_str() knows about */
+	for (attr = 1; attr <= AVRCP_MEDIA_ATTRIBUTE_LAST; attr++)
+		put_be32(attr, &buf[(attr - 1) * sizeof(uint32_t)]);
+
+	return AVRCP_MEDIA_ATTRIBUTE_LAST;
+}
+
 static void avrcp_get_element_attributes(struct avrcp *session)
 {
-	uint8_t buf[AVRCP_HEADER_LENGTH + 9];
+	uint8_t buf[AVRCP_HEADER_LENGTH + 9 +
+			AVRCP_MEDIA_ATTRIBUTE_LAST * sizeof(uint32_t)];
 	struct avrcp_header *pdu = (void *) buf;
 	uint16_t length;
 
@@ -2052,7 +2090,8 @@ static void avrcp_get_element_attributes(struct avrcp *session)
 
 	set_company_id(pdu->company_id, IEEEID_BTSIG);
 	pdu->pdu_id = AVRCP_GET_ELEMENT_ATTRIBUTES;
-	pdu->params_len = htons(9);
+	pdu->params[8] = put_media_attributes(&pdu->params[9]);
+	pdu->params_len = htons(9 + pdu->params[8] * sizeof(uint32_t));
 	pdu->packet_type = AVRCP_PACKET_TYPE_SINGLE;
 
 	length = AVRCP_HEADER_LENGTH + ntohs(pdu->params_len);
@@ -2410,6 +2449,69 @@ static void avrcp_set_browsed_player(struct avrcp *session,
 				avrcp_set_browsed_player_rsp, session);
 }
 
+static void metadata_flush(struct avrcp_player *player)
+{
+	if (player->metadata)
+		g_hash_table_remove_all(player->metadata);
+}
+
+static void metadata_store(struct avrcp_player *player, uint64_t uid,
+					uint8_t count, const uint8_t *data,
+					uint16_t len)
+{
+	struct metadata_entry *entry;
+	uint64_t *key;
+
+	/* Zero and all ones do not identify a track */
+	if (uid == 0 || uid == UINT64_MAX)
+		return;
+
+	if (!player->metadata)
+		player->metadata = g_hash_table_new_full(g_int64_hash,
+							g_int64_equal,
+							g_free, g_free);
+
+	if (player->metadata_counter != player->uid_counter ||
+			g_hash_table_size(player->metadata) >=
+						AVRCP_METADATA_CACHE_MAX) {
+		g_hash_table_remove_all(player->metadata);
+		player->metadata_counter = player->uid_counter;
+	}
+
+	entry = g_malloc(sizeof(*entry) + len);
+	entry->count = count;
+	entry->len = len;
+	memcpy(entry->data, data, len);
+
+	key = g_new(uint64_t, 1);
+	*key = uid;
+
+	g_hash_table_replace(player->metadata, key, entry);
+}
+
+static bool metadata_restore(struct avrcp_player *player, uint64_t uid)
+{
+	struct metadata_entry *entry;
+
+	if (!player->metadata)
+		return false;
+
+	if (player->metadata_counter != player->uid_counter) {
+		metadata_flush(player);
+		return false;
+	}
+
+	entry = g_hash_table_lookup(player->metadata, &uid);
+	if (!entry)
+		return false;
+
+	DBG("Using cached attributes for uid %" PRIu64, uid);
+
+	avrcp_parse_attribute_list(player, entry->data, entry->count);
+
+	return true;
+}
+
 static gboolean avrcp_get_item_attributes_rsp(struct avctp *conn,
 						uint8_t *operands,
 						size_t operand_count,
@@ -2419,6 +2521,7 @@ static gboolean avrcp_get_item_attributes_rsp(struct avctp *conn,
 	struct avrcp_player *player = session->controller->player;
 	struct avrcp_browsing_header *pdu = (void *) operands;
 	uint8_t count;
+	size_t len;
 
 	if (pdu == NULL) {
 		avrcp_get_element_attributes(session);
@@ -2439,7 +2542,12 @@ static gboolean avrcp_get_item_attributes_rsp(struct avctp *conn,
 
 	avrcp_parse_attribute_list(player, &pdu->params[2], count);
 
-	avrcp_get_play_status(session);
+	len = AVRCP_BROWSING_HEADER_LENGTH + ntohs(pdu->param_len);
+	if (count > 0 && operand_count >= len)
+		metadata_store(player, player->uid, count, &pdu->params[2],
+						ntohs(pdu->param_len) - 2);
+
+	avrcp_update_play_status(session);
 
 	return FALSE;
 }
@@ -2447,8 +2555,10 @@ static gboolean avrcp_get_item_attributes_rsp(struct avctp *conn,
 static void avrcp_get_item_attributes(struct avrcp *session, uint64_t uid)
 {
 	struct avrcp_player *player = session->controller->player;
-	uint8_t buf[AVRCP_BROWSING_HEADER_LENGTH + 12];
+	uint8_t buf[AVRCP_BROWSING_HEADER_LENGTH + 12 +
+			AVRCP_MEDIA_ATTRIBUTE_LAST * sizeof(uint32_t)];
 	struct avrcp_browsing_header *pdu = (void *) buf;
+	uint16_t length;
 
 	memset(buf, 0, sizeof(buf));
 
@@ -2456,9 +2566,12 @@ static void avrcp_get_item_attributes(struct avrcp *session, uint64_t uid)
 	pdu->params[0] = 0x03;
 	put_be64(uid, &pdu->params[1]);
 	put_be16(player->uid_counter, &pdu->params[9]);
-	pdu->param_len = htons(12);
+	pdu->params[11] = put_media_attributes(&pdu->params[12]);
+	pdu->param_len = htons(12 + pdu->params[11] * sizeof(uint32_t));
 
-	avctp_send_browsing_req(session->conn, buf, sizeof(buf),
+	length = AVRCP_BROWSING_HEADER_LENGTH + ntohs(pdu->param_len);
+
+	avctp_send_browsing_req(session->conn, buf, length,
 				avrcp_get_item_attributes_rsp, session);
 }
 
@@ -2923,7 +3036,7 @@ avrcp_parse_media_player_item(struct avrcp *session, uint8_t *operands,
 
 	if (g_strcmp0(curval, strval) != 0) {
 		media_player_set_status(mp, strval);
-		avrcp_get_play_status(session);
+		avrcp_update_play_status(session);
 	}
 
 	avrcp_player_parse_features(player, &operands[8]);
@@ -2953,6 +3066,10 @@ static void player_destroy(gpointer data)
 	g_free(player->path);
 	g_free(player->change_path);
 	g_free(player->features);
+
+	if (player->metadata)
+		g_hash_table_destroy(player->metadata);
+
 	g_free(player);
 }
 
@@ -3070,7 +3187,16 @@ static void avrcp_status_changed(struct avrcp *session,
 		return;
 
 	media_player_set_status(mp, strval);
-	avrcp_get_play_status(session);
+	avrcp_update_play_status(session);
+}
+
+static void avrcp_playback_pos_changed(struct avrcp *session,
+						struct avrcp_header *pdu)
+{
+	struct avrcp_player *player = session->controller->player;
+
+	media_player_set_position(player->user_data,
+						get_be32(&pdu->params[1]));
 }
 
 static void avrcp_track_changed(struct avrcp *session,
@@ -3079,6 +3205,12 @@ static void avrcp_track_changed(struct avrcp *session,
 	if (session->browsing_id) {
 		struct avrcp_player *player = session->controller->player;
 		player->uid = get_be64(&pdu->params[1]);
+
+		if (metadata_restore(player, player->uid)) {
+			avrcp_update_play_status(session);
+			return;
+		}
+
 		avrcp_get_item_attributes(session, player->uid);
 	} else
 		avrcp_get_element_attributes(session);
@@ -3144,6 +3276,10 @@ static void avrcp_uids_changed(struct avrcp *session, struct avrcp_header *pdu)
 	struct avrcp_player *player = session->controller->player;
 
 	player->uid_counter = get_be16(&pdu->params[1]);
+
+	/* UIDs may now refer to different items even if the counter did not
+	 * change, e.g. for players that are not database aware */
+	metadata_flush(player);
 }
 
 static gboolean avrcp_handle_event(struct avctp *conn,
@@ -3177,6 +3313,9 @@ static gboolean avrcp_handle_event(struct avctp *conn,
 	case AVRCP_EVENT_TRACK_CHANGED:
 		avrcp_track_changed(session, pdu);
 		break;
+	case AVRCP_EVENT_PLAYBACK_POS_CHANGED:
+		avrcp_playback_pos_changed(session, pdu);
+		break;
 	case AVRCP_EVENT_SETTINGS_CHANGED:
 		avrcp_setting_changed(session, pdu);
 		break;
@@ -3210,6 +3349,9 @@ static void avrcp_register_notification(struct avrcp *session, uint8_t event)
 	pdu->params[0] = event;
 	pdu->params_len = htons(AVRCP_REGISTER_NOTIFICATION_PARAM_LENGTH);
 
+	if (event == AVRCP_EVENT_PLAYBACK_POS_CHANGED)
+		put_be32(AVRCP_POSITION_INTERVAL, &pdu->params[1]);
+
 	length = AVRCP_HEADER_LENGTH + ntohs(pdu->params_len);
 
 	avctp_send_vendordep_req(session->conn, AVC_CTYPE_NOTIFY,
@@ -3248,6 +3390,7 @@ static gboolean avrcp_get_capabilities_resp(struct avctp *conn,
 		switch (event) {
 		case AVRCP_EVENT_STATUS_CHANGED:
 		case AVRCP_EVENT_TRACK_CHANGED:
+		case AVRCP_EVENT_PLAYBACK_POS_CHANGED:
 		case AVRCP_EVENT_SETTINGS_CHANGED:
 		case AVRCP_EVENT_ADDRESSED_PLAYER_CHANGED:
 		case AVRCP_EVENT_UIDS_CHANGED:
@@ -3258,6 +3401,8 @@ static gboolean avrcp_get_capabilities_resp(struct avctp *conn,
 		}
 	}
 
+	session->remote_events = events;
+
 	if (!(events & (1 << AVRCP_EVENT_SETTINGS_CHANGED)))
 		avrcp_list_player_attributes(session);
 
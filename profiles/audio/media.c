@@ -43,6 +43,7 @@
 #include "src/uuid-helper.h"
 #include "src/log.h"
 #include "src/error.h"
+#include "src/memstat.h"
 
 #include "avdtp.h"
 #include "media.h"
@@ -55,6 +56,7 @@
 #define MEDIA_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
 
 #define REQUEST_TIMEOUT (3 * 1000)		/* 3 seconds */
+#define MAX_CACHED_CONFIGS 8
 
 struct media_adapter {
 	struct btd_adapter	*btd_adapter;
@@ -69,6 +71,18 @@ struct endpoint_request {
 	media_endpoint_cb_t	cb;
 	GDestroyNotify		destroy;
 	void			*user_data;
+	guint			cached_id;	/* Cached reply pending */
+	uint8_t			*config;	/* Cached configuration */
+	int			config_size;
+	uint8_t			*capabilities;	/* Capabilities selected from */
+	size_t			length;
+};
+
+struct cached_config {
+	uint8_t			*capabilities;	/* Remote capabilities */
+	size_t			length;
+	uint8_t			*config;	/* Configuration selected */
+	int			size;
 };
 
 struct media_endpoint {
@@ -79,6 +93,8 @@ struct media_endpoint {
 	uint8_t			codec;		/* Endpoint codec */
 	uint8_t			*capabilities;	/* Endpoint property capabilities */
 	size_t			size;		/* Endpoint capabilities size */
+	gboolean		cache_configs;	/* Reuse selected configurations */
+	GSList			*configs;	/* Selected configurations */
 	guint			hs_watch;
 	guint			ag_watch;
 	guint			watch;
@@ -111,6 +127,73 @@ struct media_player {
 
 static GSList *adapters = NULL;
 
+static void cached_config_free(void *data)
+{
+	struct cached_config *cached = data;
+
+	btd_mem_remove(BTD_MEM_MEDIA_CONFIG, 1, sizeof(*cached) +
+					cached->length + cached->size);
+
+	g_free(cached->capabilities);
+	g_free(cached->config);
+	g_free(cached);
+}
+
+static void media_endpoint_flush_configs(struct media_endpoint *endpoint)
+{
+	g_slist_free_full(endpoint->configs, cached_config_free);
+	endpoint->configs = NULL;
+}
+
+static struct cached_config *media_endpoint_find_config(
+					struct media_endpoint *endpoint,
+					const uint8_t *capabilities,
+					size_t length)
+{
+	GSList *l;
+
+	for (l = endpoint->configs; l; l = l->next) {
+		struct cached_config *cached = l->data;
+
+		if (cached->length == length &&
+				!memcmp(cached->capabilities, capabilities,
+								length))
+			return cached;
+	}
+
+	return NULL;
+}
+
+static void media_endpoint_cache_config(struct media_endpoint *endpoint,
+					const uint8_t *capabilities,
+					size_t length,
+					const uint8_t *config, int size)
+{
+	struct cached_config *cached;
+	GSList *last;
+
+	if (size <= 0 || media_endpoint_find_config(endpoint, capabilities,
+								length))
+		return;
+
+	cached = g_new0(struct cached_config, 1);
+	cached->capabilities = g_memdup(capabilities, length);
+	cached->length = length;
+	cached->config = g_memdup(config, size);
+	cached->size = size;
+
+	btd_mem_add(BTD_MEM_MEDIA_CONFIG, 1, sizeof(*cached) + length + size);
+
+	endpoint->configs = g_slist_prepend(endpoint->configs, cached);
+
+	if (g_slist_length(endpoint->configs) <= MAX_CACHED_CONFIGS)
+		return;
+
+	last = g_slist_last(endpoint->configs);
+	cached_config_free(last->data);
+	endpoint->configs = g_slist_delete_link(endpoint->configs, last);
+}
+
 static void endpoint_request_free(struct endpoint_request *request)
 {
 	if (request->call)
@@ -119,7 +202,11 @@ static void endpoint_request_free(struct endpoint_request *request)
 	if (request->destroy)
 		request->destroy(request->user_data);
 
-	dbus_message_unref(request->msg);
+	if (request->msg)
+		dbus_message_unref(request->msg);
+
+	g_free(request->config);
+	g_free(request->capabilities);
 	g_free(request);
 }
 
@@ -130,6 +217,9 @@ static void media_endpoint_cancel(struct endpoint_request *request)
 	if (request->call)
 		dbus_pending_call_cancel(request->call);
 
+	if (request->cached_id > 0)
+		g_source_remove(request->cached_id);
+
 	endpoint->requests = g_slist_remove(endpoint->requests, request);
 
 	if (request->cb)
@@ -149,6 +239,7 @@ static void media_endpoint_destroy(struct media_endpoint *endpoint)
 	DBG("sender=%s path=%s", endpoint->sender, endpoint->path);
 
 	media_endpoint_cancel_all(endpoint);
+	media_endpoint_flush_configs(endpoint);
 
 	g_slist_free_full(endpoint->transports,
 				(GDestroyNotify) media_transport_destroy);
@@ -293,6 +384,12 @@ static void endpoint_reply(DBusPendingCall *call, void *user_data)
 
 		dbus_message_iter_get_fixed_array(&array, &configuration, &size);
 
+		if (endpoint->cache_configs)
+			media_endpoint_cache_config(endpoint,
+						request->capabilities,
+						request->length,
+						configuration, size);
+
 		ret = configuration;
 		goto done;
 	} else  if (!dbus_message_get_args(reply, &err, DBUS_TYPE_INVALID)) {
@@ -352,6 +449,59 @@ static gboolean media_endpoint_async_call(DBusMessage *msg,
 	return TRUE;
 }
 
+static gboolean cached_reply(gpointer user_data)
+{
+	struct endpoint_request *request = user_data;
+	struct media_endpoint *endpoint = request->endpoint;
+
+	request->cached_id = 0;
+
+	if (request->cb)
+		request->cb(endpoint, request->config, request->config_size,
+							request->user_data);
+
+	endpoint->requests = g_slist_remove(endpoint->requests, request);
+	endpoint_request_free(request);
+
+	return FALSE;
+}
+
+/*
+ * Replies with the configuration the endpoint selected last time for the
+ * same remote capabilities. The reply is still asynchronous, as callers
+ * expect, just without the D-Bus round trip.
+ */
+static gboolean select_cached_configuration(struct media_endpoint *endpoint,
+						uint8_t *capabilities,
+						size_t length,
+						media_endpoint_cb_t cb,
+						void *user_data,
+						GDestroyNotify destroy)
+{
+	struct endpoint_request *request;
+	struct cached_config *cached;
+
+	cached = media_endpoint_find_config(endpoint, capabilities, length);
+	if (!cached)
+		return FALSE;
+
+	DBG("Reusing configuration: name = %s path = %s", endpoint->sender,
+								endpoint->path);
+
+	request = g_new0(struct endpoint_request, 1);
+	request->endpoint = endpoint;
+	request->cb = cb;
+	request->destroy = destroy;
+	request->user_data = user_data;
+	request->config = g_memdup(cached->config, cached->size);
+	request->config_size = cached->size;
+	request->cached_id = g_idle_add(cached_reply, request);
+
+	endpoint->requests = g_slist_append(endpoint->requests, request);
+
+	return TRUE;
+}
+
 static gboolean select_configuration(struct media_endpoint *endpoint,
 						uint8_t *capabilities,
 						size_t length,
@@ -359,8 +509,14 @@ static gboolean select_configuration(struct media_endpoint *endpoint,
 						void *user_data,
 						GDestroyNotify destroy)
 {
+	struct endpoint_request *request;
 	DBusMessage *msg;
 
+	if (endpoint->cache_configs && select_cached_configuration(endpoint,
+						capabilities, length, cb,
+						user_data, destroy))
+		return TRUE;
+
 	msg = dbus_message_new_method_call(endpoint->sender, endpoint->path,
 						MEDIA_ENDPOINT_INTERFACE,
 						"SelectConfiguration");
@@ -373,7 +529,15 @@ static gboolean select_configuration(struct media_endpoint *endpoint,
 					&capabilities, length,
 					DBUS_TYPE_INVALID);
 
-	return media_endpoint_async_call(msg, endpoint, cb, user_data, destroy);
+	if (!media_endpoint_async_call(msg, endpoint, cb, user_data, destroy))
+		return FALSE;
+
+	/* Keep what the selection was made from so the reply can be cached */
+	request = g_slist_last(endpoint->requests)->data;
+	request->capabilities = g_memdup(capabilities, length);
+	request->length = length;
+
+	return TRUE;
 }
 
 static int transport_device_cmp(gconstpointer data, gconstpointer user_data)
@@ -531,6 +695,13 @@ static void config_cb(struct media_endpoint *endpoint, void *ret, int size,
 {
 	struct a2dp_config_data *data = user_data;
 
+	/*
+	 * The endpoint rejecting a configuration means its preferences have
+	 * changed, ask it again next time.
+	 */
+	if (!ret)
+		media_endpoint_flush_configs(endpoint);
+
 	data->cb(data->setup, ret ? TRUE : FALSE);
 }
 
@@ -718,6 +889,7 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 						const char *path,
 						const char *uuid,
 						gboolean delay_reporting,
+						gboolean cache_configs,
 						uint8_t codec,
 						uint8_t *capabilities,
 						int size,
@@ -731,6 +903,7 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 	endpoint->path = g_strdup(path);
 	endpoint->uuid = g_strdup(uuid);
 	endpoint->codec = codec;
+	endpoint->cache_configs = cache_configs;
 
 	if (size > 0) {
 		endpoint->capabilities = g_new(uint8_t, size);
@@ -784,7 +957,8 @@ static struct media_endpoint *media_endpoint_create(struct media_adapter *adapte
 }
 
 static int parse_properties(DBusMessageIter *props, const char **uuid,
-				gboolean *delay_reporting, uint8_t *codec,
+				gboolean *delay_reporting,
+				gboolean *cache_configs, uint8_t *codec,
 				uint8_t **capabilities, int *size)
 {
 	gboolean has_uuid = FALSE;
@@ -816,6 +990,10 @@ static int parse_properties(DBusMessageIter *props, const char **uuid,
 			if (var != DBUS_TYPE_BOOLEAN)
 				return -EINVAL;
 			dbus_message_iter_get_basic(&value, delay_reporting);
+		} else if (strcasecmp(key, "CacheConfiguration") == 0) {
+			if (var != DBUS_TYPE_BOOLEAN)
+				return -EINVAL;
+			dbus_message_iter_get_basic(&value, cache_configs);
 		} else if (strcasecmp(key, "Capabilities") == 0) {
 			DBusMessageIter array;
 
@@ -840,6 +1018,7 @@ static DBusMessage *register_endpoint(DBusConnection *conn, DBusMessage *msg,
 	DBusMessageIter args, props;
 	const char *sender, *path, *uuid;
 	gboolean delay_reporting = FALSE;
+	gboolean cache_configs = TRUE;
 	uint8_t codec;
 	uint8_t *capabilities;
 	int size = 0;
@@ -859,12 +1038,13 @@ static DBusMessage *register_endpoint(DBusConnection *conn, DBusMessage *msg,
 	if (dbus_message_iter_get_arg_type(&props) != DBUS_TYPE_DICT_ENTRY)
 		return btd_error_invalid_args(msg);
 
-	if (parse_properties(&props, &uuid, &delay_reporting, &codec,
-						&capabilities, &size) < 0)
+	if (parse_properties(&props, &uuid, &delay_reporting, &cache_configs,
+					&codec, &capabilities, &size) < 0)
 		return btd_error_invalid_args(msg);
 
 	if (media_endpoint_create(adapter, sender, path, uuid, delay_reporting,
-				codec, capabilities, size, &err) == NULL) {
+					cache_configs, codec, capabilities,
+					size, &err) == NULL) {
 		if (err == -EPROTONOSUPPORT)
 			return btd_error_not_supported(msg);
 		else
@@ -48,6 +48,16 @@
 #define MEDIA_FOLDER_INTERFACE "org.bluez.MediaFolder1"
 #define MEDIA_ITEM_INTERFACE "org.bluez.MediaItem1"
 
+/* Difference, in milliseconds, between the interpolated and the reported
+ * position that is considered a jump */
+#define POSITION_DRIFT_MAX	1000
+
+/* Maximum number of items returned by a single ListItems call */
+#define MEDIA_FOLDER_WINDOW_MAX	256
+/* Maximum number of item objects kept per folder, least recently listed
+ * items are removed first */
+#define MEDIA_FOLDER_ITEMS_MAX	1024
+
 struct player_callback {
 	const struct media_player_callback *cbs;
 	void *user_data;
@@ -610,6 +620,54 @@ done:
 	folder->msg = NULL;
 }
 
+static void media_item_destroy(void *data);
+
+static void media_folder_touch_items(struct media_folder *folder,
+								GSList *items)
+{
+	GSList *reversed, *l;
+
+	/* Move the listed items to the front, in listing order, so they are
+	 * evicted last */
+	reversed = g_slist_reverse(g_slist_copy(items));
+
+	for (l = reversed; l; l = l->next) {
+		GSList *link = g_slist_find(folder->items, l->data);
+
+		if (!link)
+			continue;
+
+		folder->items = g_slist_remove_link(folder->items, link);
+		folder->items = g_slist_concat(link, folder->items);
+	}
+
+	g_slist_free(reversed);
+}
+
+static void media_folder_evict_items(struct media_player *mp,
+						struct media_folder *folder)
+{
+	const char *current = g_hash_table_lookup(mp->track, "Item");
+	GSList *l, *next;
+	unsigned int count = 0;
+
+	for (l = folder->items; l; l = next) {
+		struct media_item *item = l->data;
+
+		next = l->next;
+
+		if (++count <= MEDIA_FOLDER_ITEMS_MAX)
+			continue;
+
+		/* Never remove the item of the track being played */
+		if (g_strcmp0(item->path, current) == 0)
+			continue;
+
+		folder->items = g_slist_delete_link(folder->items, l);
+		media_item_destroy(item);
+	}
+}
+
 void media_player_list_complete(struct media_player *mp, GSList *items,
 								int err)
 {
@@ -643,10 +701,14 @@ void media_player_list_complete(struct media_player *mp, GSList *items,
 	g_slist_foreach(items, parse_folder_list, &array);
 	dbus_message_iter_close_container(&iter, &array);
 
+	media_folder_touch_items(folder, items);
+
 done:
 	g_dbus_send_message(btd_get_dbus_connection(), reply);
 	dbus_message_unref(folder->msg);
 	folder->msg = NULL;
+
+	media_folder_evict_items(mp, folder);
 }
 
 static struct media_item *
@@ -720,7 +782,8 @@ static const GDBusPropertyTable media_player_properties[] = {
 	{ "Name", "s", get_name, NULL, name_exists },
 	{ "Type", "s", get_type, NULL, type_exists },
 	{ "Subtype", "s", get_subtype, NULL, subtype_exists },
-	{ "Position", "u", get_position, NULL, NULL },
+	{ "Position", "u", get_position, NULL, NULL,
+					G_DBUS_PROPERTY_FLAG_THROTTLED },
 	{ "Status", "s", get_status, NULL, status_exists },
 	{ "Equalizer", "s", get_setting, set_setting, setting_exists },
 	{ "Repeat", "s", get_setting, set_setting, setting_exists },
@@ -817,6 +880,12 @@ static int parse_filters(struct media_player *player, DBusMessageIter *iter,
 	if (folder->number_of_items > 0 && *end > folder->number_of_items)
 		*end = folder->number_of_items;
 
+	if (*end < *start)
+		return -EINVAL;
+
+	if (*end - *start >= MEDIA_FOLDER_WINDOW_MAX)
+		*end = *start + MEDIA_FOLDER_WINDOW_MAX - 1;
+
 	return 0;
 }
 
@@ -1189,15 +1258,27 @@ void media_player_set_duration(struct media_player *mp, uint32_t duration)
 
 void media_player_set_position(struct media_player *mp, uint32_t position)
 {
+	uint32_t current;
+
 	DBG("%u", position);
 
 	/* Only update duration if track exists */
 	if (g_hash_table_size(mp->track) == 0)
 		return;
 
+	current = media_player_get_position(mp);
+
 	mp->position = position;
 	g_timer_start(mp->progress);
 
+	/*
+	 * Position is interpolated when read, so only signal it when it
+	 * jumps e.g. due to seeking, not when it just catches up.
+	 */
+	if (current != UINT32_MAX && position != UINT32_MAX &&
+			ABS((int64_t) position - current) <= POSITION_DRIFT_MAX)
+		return;
+
 	g_dbus_emit_property_changed(btd_get_dbus_connection(), mp->path,
 					MEDIA_PLAYER_INTERFACE, "Position");
 }
@@ -27,6 +27,9 @@
 #endif
 
 #include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 #include <gdbus/gdbus.h>
@@ -38,6 +41,7 @@
 
 #include "src/log.h"
 #include "src/error.h"
+#include "src/shared/trace.h"
 
 #include "avdtp.h"
 #include "media.h"
@@ -49,6 +53,9 @@
 
 #define MEDIA_TRANSPORT_INTERFACE "org.bluez.MediaTransport1"
 
+/* Interval, in seconds, at which an active transport socket is sampled */
+#define STATS_INTERVAL 1
+
 typedef enum {
 	TRANSPORT_STATE_IDLE,		/* Not acquired and suspended */
 	TRANSPORT_STATE_PENDING,	/* Playing but not acquired */
@@ -77,6 +84,17 @@ struct media_owner {
 	guint			watch;
 };
 
+struct transport_stats {
+	guint			timer;
+	int			sndbuf;
+	unsigned int		samples;
+	unsigned int		underruns;	/* Socket queue ran empty */
+	unsigned int		stalls;		/* Socket queue near full */
+	unsigned int		queued;		/* Last sampled queue depth */
+	unsigned int		queued_max;
+	unsigned long long	queued_sum;
+};
+
 struct a2dp_transport {
 	struct avdtp		*session;
 	uint16_t		delay;
@@ -94,6 +112,7 @@ struct media_transport {
 	uint16_t		imtu;		/* Transport input mtu */
 	uint16_t		omtu;		/* Transport output mtu */
 	transport_state_t	state;
+	struct transport_stats	stats;
 	guint			hs_watch;
 	guint			source_watch;
 	guint			sink_watch;
@@ -140,6 +159,79 @@ static gboolean state_in_use(transport_state_t state)
 	return FALSE;
 }
 
+static gboolean stats_sample(gpointer user_data)
+{
+	struct media_transport *transport = user_data;
+	struct transport_stats *stats = &transport->stats;
+	struct a2dp_transport *a2dp = transport->data;
+	int space;
+
+	/*
+	 * Bluetooth sockets report free space in the send buffer for
+	 * TIOCOUTQ, so the buffer size is needed to get the queue depth.
+	 */
+	if (stats->sndbuf <= 0 || ioctl(transport->fd, TIOCOUTQ, &space) < 0 ||
+					space < 0 || space > stats->sndbuf)
+		return TRUE;
+
+	stats->queued = stats->sndbuf - space;
+	stats->samples++;
+	stats->queued_sum += stats->queued;
+
+	if (stats->queued > stats->queued_max)
+		stats->queued_max = stats->queued;
+
+	if (stats->queued == 0)
+		stats->underruns++;
+	else if (stats->queued >= (unsigned int) stats->sndbuf / 4 * 3)
+		stats->stalls++;
+
+	DBG("%s queued %u bytes (%u packets) remote delay %u.%u ms",
+			transport->path, stats->queued,
+			transport->omtu ? stats->queued / transport->omtu : 0,
+			a2dp->delay / 10, a2dp->delay % 10);
+
+	return TRUE;
+}
+
+static void stats_start(struct media_transport *transport)
+{
+	struct transport_stats *stats = &transport->stats;
+	socklen_t len;
+
+	if (stats->timer || transport->fd < 0)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+
+	len = sizeof(stats->sndbuf);
+	if (getsockopt(transport->fd, SOL_SOCKET, SO_SNDBUF, &stats->sndbuf,
+								&len) < 0)
+		stats->sndbuf = 0;
+
+	stats->timer = g_timeout_add_seconds(STATS_INTERVAL, stats_sample,
+								transport);
+}
+
+static void stats_stop(struct media_transport *transport)
+{
+	struct transport_stats *stats = &transport->stats;
+
+	if (!stats->timer)
+		return;
+
+	g_source_remove(stats->timer);
+	stats->timer = 0;
+
+	if (!stats->samples)
+		return;
+
+	DBG("%s samples %u queued avg %llu max %u bytes underruns %u "
+			"stalls %u", transport->path, stats->samples,
+			stats->queued_sum / stats->samples, stats->queued_max,
+			stats->underruns, stats->stalls);
+}
+
 static void transport_set_state(struct media_transport *transport,
 							transport_state_t state)
 {
@@ -151,9 +243,16 @@ static void transport_set_state(struct media_transport *transport,
 
 	transport->state = state;
 
+	if (state == TRANSPORT_STATE_ACTIVE)
+		stats_start(transport);
+	else if (old_state == TRANSPORT_STATE_ACTIVE)
+		stats_stop(transport);
+
 	DBG("State changed %s: %s -> %s", transport->path, str_state[old_state],
 							str_state[state]);
 
+	BT_TRACE3(transport_state, transport->path, old_state, state);
+
 	str = state2str(state);
 
 	if (g_strcmp0(str, state2str(old_state)) != 0)
@@ -303,6 +402,8 @@ static void a2dp_resume_complete(struct avdtp *session,
 	if (ret == FALSE)
 		goto fail;
 
+	BT_TRACE3(transport_acquired, transport->path, imtu, omtu);
+
 	media_transport_set_fd(transport, fd, imtu, omtu);
 
 	ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
@@ -464,6 +565,8 @@ static DBusMessage *acquire(DBusConnection *conn, DBusMessage *msg,
 		return btd_error_not_authorized(msg);
 	}
 
+	BT_TRACE2(transport_acquire, transport->path, owner->name);
+
 	req = media_request_create(msg, id);
 	media_owner_add(owner, req);
 	media_transport_set_owner(transport, owner);
@@ -495,6 +598,8 @@ static DBusMessage *try_acquire(DBusConnection *conn, DBusMessage *msg,
 		return btd_error_not_authorized(msg);
 	}
 
+	BT_TRACE2(transport_acquire, transport->path, owner->name);
+
 	req = media_request_create(msg, id);
 	media_owner_add(owner, req);
 	media_transport_set_owner(transport, owner);
@@ -718,6 +823,8 @@ static void media_transport_free(void *data)
 	if (transport->owner)
 		media_transport_remove_owner(transport);
 
+	stats_stop(transport);
+
 	if (transport->destroy != NULL)
 		transport->destroy(transport->data);
 
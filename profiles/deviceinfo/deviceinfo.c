@@ -202,5 +202,12 @@ static void deviceinfo_exit(void)
 	btd_profile_unregister(&deviceinfo_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(deviceinfo, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-					deviceinfo_init, deviceinfo_exit)
+static const char * const deviceinfo_uuids[] = {
+	DEVICE_INFORMATION_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(deviceinfo, VERSION,
+					BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+					deviceinfo_init, deviceinfo_exit,
+					deviceinfo_uuids)
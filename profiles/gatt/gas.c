@@ -27,7 +27,6 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 
@@ -46,7 +45,7 @@
 #include "src/attio.h"
 #include "attrib/gatt.h"
 #include "src/log.h"
-#include "src/textfile.h"
+#include "src/worker.h"
 
 /* Generic Attribute/Access Service */
 struct gas {
@@ -95,19 +94,17 @@ static void write_ctp_handle(struct btd_device *device, uint16_t uuid,
 	}
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	snprintf(group, sizeof(group), "%hu", uuid);
 	snprintf(value, sizeof(value), "0x%4.4X", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 	g_free(filename);
 	g_key_file_free(key_file);
 }
@@ -129,7 +126,7 @@ static int read_ctp_handle(struct btd_device *device, uint16_t uuid,
 	snprintf(group, sizeof(group), "%hu", uuid);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	str = g_key_file_get_string(key_file, group, "Value", NULL);
 	if (str == NULL || sscanf(str, "%hx", value) != 1)
@@ -146,9 +143,9 @@ static void gap_appearance_cb(guint8 status, const guint8 *pdu, guint16 plen,
 							gpointer user_data)
 {
 	struct gas *gas = user_data;
-	struct att_data_list *list =  NULL;
+	struct att_data_iter iter;
+	const uint8_t *data;
 	uint16_t app;
-	uint8_t *atval;
 
 	if (status != 0) {
 		error("Read characteristics by UUID failed: %s",
@@ -156,24 +153,20 @@ static void gap_appearance_cb(guint8 status, const guint8 *pdu, guint16 plen,
 		return;
 	}
 
-	list = dec_read_by_type_resp(pdu, plen);
-	if (list == NULL)
+	if (!dec_read_by_type_resp(pdu, plen, &iter))
 		return;
 
-	if (list->len != 4) {
+	data = att_data_iter_next(&iter);
+	if (iter.len != 4 || data == NULL) {
 		error("GAP Appearance value: invalid data");
-		goto done;
+		return;
 	}
 
-	atval = list->data[0] + 2; /* skip handle value */
-	app = get_le16(atval);
+	app = get_le16(data + 2); /* skip handle value */
 
 	DBG("GAP Appearance: 0x%04x", app);
 
 	device_set_appearance(gas->device, app);
-
-done:
-	att_data_list_free(list);
 }
 
 static void indication_cb(const uint8_t *pdu, uint16_t len, gpointer user_data)
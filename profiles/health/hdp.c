@@ -486,6 +486,9 @@ static void hdp_mdl_reconn_cb(struct mcap_mdl *mdl, GError *err, gpointer data)
 		struct hdp_channel *chan = dc_data->hdp_chann;
 		GError *gerr = NULL;
 
+		/* The remote record may have changed, look it up again */
+		chan->dev->dcpsm = 0;
+
 		error("%s", err->message);
 		reply = g_dbus_create_error(dc_data->msg,
 					ERROR_INTERFACE ".HealthError",
@@ -95,6 +95,7 @@ struct hdp_device {
 	struct mcap_mcl		*mcl;		/* The mcap control channel */
 	gboolean		mcl_conn;	/* Mcl status */
 	gboolean		sdp_present;	/* Has an sdp record */
+	uint16_t		dcpsm;		/* Cached data channel PSM */
 	GSList			*channels;	/* Data Channel list */
 	struct hdp_channel	*ndc;		/* Data channel being negotiated */
 	struct hdp_channel	*fr;		/* First reliable data channel */
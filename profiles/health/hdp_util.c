@@ -81,6 +81,7 @@ struct get_dcpsm_data {
 	gpointer		data;
 	hdp_continue_dcpsm_f	func;
 	GDestroyNotify		destroy;
+	struct hdp_device	*dev;
 };
 
 static gboolean parse_dict_entry(struct dict_entry_func dict_context[],
@@ -1121,6 +1122,8 @@ static void get_dcpsm_cb(sdp_list_t *recs, int err, gpointer data)
 		goto fail;
 	}
 
+	dcpsm_data->dev->dcpsm = dcpsm;
+
 	dcpsm_data->func(dcpsm, dcpsm_data->data, NULL);
 	return;
 
@@ -1139,6 +1142,7 @@ static void free_dcpsm_data(gpointer data)
 	if (dcpsm_data->destroy)
 		dcpsm_data->destroy(dcpsm_data->data);
 
+	health_device_unref(dcpsm_data->dev);
 	g_free(dcpsm_data);
 }
 
@@ -1152,6 +1156,18 @@ gboolean hdp_get_dcpsm(struct hdp_device *device, hdp_continue_dcpsm_f func,
 	const bdaddr_t *dst;
 	uuid_t uuid;
 
+	/*
+	 * The data PSM is looked up once per device, reconnecting a data
+	 * channel then goes straight from the reconnect response to the
+	 * L2CAP connection instead of waiting on an SDP search first.
+	 */
+	if (device->dcpsm) {
+		func(device->dcpsm, data, NULL);
+		if (destroy)
+			destroy(data);
+		return TRUE;
+	}
+
 	src = btd_adapter_get_address(device_get_adapter(device->dev));
 	dst = device_get_address(device->dev);
 
@@ -1159,12 +1175,14 @@ gboolean hdp_get_dcpsm(struct hdp_device *device, hdp_continue_dcpsm_f func,
 	dcpsm_data->func = func;
 	dcpsm_data->data = data;
 	dcpsm_data->destroy = destroy;
+	dcpsm_data->dev = health_device_ref(device);
 
 	bt_string2uuid(&uuid, HDP_UUID);
 	if (bt_search_service(src, dst, &uuid, get_dcpsm_cb, dcpsm_data,
 						free_dcpsm_data, 0) < 0) {
 		g_set_error(err, HDP_ERROR, HDP_CONNECTION_ERROR,
 						"Can't get remote SDP record");
+		health_device_unref(device);
 		g_free(dcpsm_data);
 		return FALSE;
 	}
@@ -82,6 +82,14 @@ struct mcap_instance {
 struct mcap_csp;
 struct mcap_mdl_op_cb;
 
+/* Time from sending a create or reconnect request to data channel up */
+struct mcap_setup_stats {
+	unsigned int	count;
+	gint64		total;
+	gint64		min;
+	gint64		max;
+};
+
 struct mcap_mcl {
 	struct mcap_instance	*mi;		/* MCAP instance where this MCL belongs */
 	bdaddr_t		addr;		/* Device address */
@@ -99,6 +107,8 @@ struct mcap_mcl {
 	uint8_t			ctrl;		/* MCL control flag */
 	uint16_t		next_mdl;	/* id used to create next MDL */
 	struct mcap_csp		*csp;		/* CSP control structure */
+	struct mcap_setup_stats	create_stats;	/* Data channel setup times */
+	struct mcap_setup_stats	reconn_stats;	/* ... after a reconnect */
 };
 
 #define	MCAP_CTRL_CACHED	0x01	/* MCL is cached */
@@ -116,6 +126,8 @@ struct mcap_mdl {
 	uint8_t			mdep_id;	/* MCAP Data End Point */
 	MDLState		state;		/* MDL state */
 	int			ref;		/* References counter */
+	gint64			setup_start;	/* Setup request time, 0 if none */
+	gboolean		setup_reconn;	/* Setup is a reconnection */
 };
 
 struct sync_info_ind_data {
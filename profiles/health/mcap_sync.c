@@ -92,6 +92,18 @@ struct sync_set_data {
 static gboolean csp_caps_initialized = FALSE;
 struct csp_caps _caps;
 
+/* Read BT clock latency samples, gathered from the mainloop when idle */
+static struct {
+	guint		id;
+	struct mcap_mcl	*mcl;
+	gboolean	warm;
+	int		count;
+	int		retries;
+	int		latencies[SAMPLE_COUNT];
+} calib = { 0, NULL, FALSE, 0, MAX_RETRIES };
+
+static gboolean calibrate_idle(gpointer user_data);
+
 static int send_sync_cmd(struct mcap_mcl *mcl, const void *buf, uint32_t size)
 {
 	int sock;
@@ -157,6 +169,13 @@ void mcap_sync_init(struct mcap_mcl *mcl)
 	mcl->csp->csp_priv_data = NULL;
 
 	reset_tmstamp(mcl->csp, NULL, 0);
+
+	/* Measure the clock read latency ahead of the first CSP request */
+	if (!csp_caps_initialized && calib.id == 0) {
+		calib.mcl = mcl;
+		calib.id = g_idle_add_full(G_PRIORITY_LOW, calibrate_idle,
+								NULL, NULL);
+	}
 }
 
 void mcap_sync_stop(struct mcap_mcl *mcl)
@@ -164,6 +183,13 @@ void mcap_sync_stop(struct mcap_mcl *mcl)
 	if (!mcl->csp)
 		return;
 
+	if (calib.mcl == mcl) {
+		if (calib.id > 0)
+			g_source_remove(calib.id);
+		calib.id = 0;
+		calib.mcl = NULL;
+	}
+
 	if (mcl->csp->ind_timer)
 		g_source_remove(mcl->csp->ind_timer);
 
@@ -305,63 +331,68 @@ uint32_t mcap_get_btclock(struct mcap_mcl *mcl)
 	return btclock;
 }
 
-static gboolean initialize_caps(struct mcap_mcl *mcl)
+static void calibrate_reset(void)
+{
+	calib.warm = FALSE;
+	calib.count = 0;
+	calib.retries = MAX_RETRIES;
+}
+
+static void calibrate_sample(struct mcap_mcl *mcl)
 {
 	struct timespec t1, t2;
-	int latencies[SAMPLE_COUNT];
-	int latency, avg, dev;
 	uint32_t btclock;
 	uint16_t btaccuracy;
-	int i;
-	int retries;
 
-	clock_getres(CLK, &t1);
+	if (!calib.warm) {
+		/* A little exercise before measuing latency */
+		read_btclock_retry(mcl, &btclock, &btaccuracy);
+		calib.warm = TRUE;
+		return;
+	}
 
-	_caps.ts_res = time_us(&t1);
-	if (_caps.ts_res < 1)
-		_caps.ts_res = 1;
+	clock_gettime(CLK, &t1);
+	if (!read_btclock(mcl, &btclock, &btaccuracy)) {
+		calib.retries--;
+		return;
+	}
+	clock_gettime(CLK, &t2);
 
-	_caps.ts_acc = 20; /* ppm, estimated */
+	calib.latencies[calib.count++] = time_us(&t2) - time_us(&t1);
+}
 
-	/* A little exercise before measuing latency */
-	clock_gettime(CLK, &t1);
-	read_btclock_retry(mcl, &btclock, &btaccuracy);
+static void calibrate_finish(void)
+{
+	struct timespec res;
+	int latency, avg, dev;
+	int i;
 
-	/* Read clock a number of times and measure latency */
-	avg = 0;
-	i = 0;
-	retries = MAX_RETRIES;
-	while (i < SAMPLE_COUNT && retries > 0) {
-		clock_gettime(CLK, &t1);
-		if (!read_btclock(mcl, &btclock, &btaccuracy)) {
-			retries--;
-			continue;
-		}
-		clock_gettime(CLK, &t2);
+	clock_getres(CLK, &res);
 
-		latency = time_us(&t2) - time_us(&t1);
-		latencies[i] = latency;
-		avg += latency;
-		i++;
-	}
+	_caps.ts_res = time_us(&res);
+	if (_caps.ts_res < 1)
+		_caps.ts_res = 1;
 
-	if (retries <= 0)
-		return FALSE;
+	_caps.ts_acc = 20; /* ppm, estimated */
 
 	/* Calculate average and deviation */
+	avg = 0;
+	for (i = 0; i < SAMPLE_COUNT; ++i)
+		avg += calib.latencies[i];
 	avg /= SAMPLE_COUNT;
+
 	dev = 0;
 	for (i = 0; i < SAMPLE_COUNT; ++i)
-		dev += abs(latencies[i] - avg);
+		dev += abs(calib.latencies[i] - avg);
 	dev /= SAMPLE_COUNT;
 
 	/* Calculate corrected average, without 'freak' latencies */
 	latency = 0;
 	for (i = 0; i < SAMPLE_COUNT; ++i) {
-		if (latencies[i] > (avg + dev * 6))
+		if (calib.latencies[i] > (avg + dev * 6))
 			latency += avg;
 		else
-			latency += latencies[i];
+			latency += calib.latencies[i];
 	}
 	latency /= SAMPLE_COUNT;
 
@@ -370,6 +401,56 @@ static gboolean initialize_caps(struct mcap_mcl *mcl)
 	_caps.syncleadtime_ms = latency * 50 / 1000;
 
 	csp_caps_initialized = TRUE;
+
+	DBG("CSP: BT clock read latency %d us (deviation %d us)", latency,
+									dev);
+}
+
+/*
+ * Take one clock sample per idle iteration so the HCI round trips are
+ * spread out instead of stalling the first CSP request.
+ */
+static gboolean calibrate_idle(gpointer user_data)
+{
+	calibrate_sample(calib.mcl);
+
+	if (calib.retries <= 0) {
+		DBG("CSP: could not measure BT clock read latency");
+		calibrate_reset();
+		goto done;
+	}
+
+	if (calib.count < SAMPLE_COUNT)
+		return TRUE;
+
+	calibrate_finish();
+
+done:
+	calib.id = 0;
+	calib.mcl = NULL;
+
+	return FALSE;
+}
+
+static gboolean initialize_caps(struct mcap_mcl *mcl)
+{
+	if (calib.id > 0) {
+		g_source_remove(calib.id);
+		calib.id = 0;
+		calib.mcl = NULL;
+	}
+
+	/* Request arrived before background calibration was done */
+	while (calib.count < SAMPLE_COUNT && calib.retries > 0)
+		calibrate_sample(mcl);
+
+	if (calib.retries <= 0) {
+		calibrate_reset();
+		return FALSE;
+	}
+
+	calibrate_finish();
+
 	return TRUE;
 }
 
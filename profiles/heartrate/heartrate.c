@@ -48,6 +48,20 @@
 #define HEART_RATE_MANAGER_INTERFACE	"org.bluez.HeartRateManager1"
 #define HEART_RATE_WATCHER_INTERFACE	"org.bluez.HeartRateWatcher1"
 
+#define BATCH_INTERVAL		1000	/* ms */
+#define BATCH_INTERVAL_MAX	60000
+#define BATCH_COUNT		32
+#define BATCH_COUNT_MAX		256
+
+#define BATCH_ENTRY_SIGNATURE	DBUS_STRUCT_BEGIN_CHAR_AS_STRING	\
+				DBUS_TYPE_OBJECT_PATH_AS_STRING		\
+				DBUS_TYPE_ARRAY_AS_STRING		\
+				DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING	\
+				DBUS_TYPE_STRING_AS_STRING		\
+				DBUS_TYPE_VARIANT_AS_STRING		\
+				DBUS_DICT_ENTRY_END_CHAR_AS_STRING	\
+				DBUS_STRUCT_END_CHAR_AS_STRING
+
 #define HR_VALUE_FORMAT		0x01
 #define SENSOR_CONTACT_DETECTED	0x02
 #define SENSOR_CONTACT_SUPPORT	0x04
@@ -81,6 +95,15 @@ struct watcher {
 	guint				id;
 	char				*srv;
 	char				*path;
+
+	/* Batched delivery, disabled when interval is 0 */
+	uint16_t			interval;
+	uint16_t			count;
+	uint16_t			pending;
+	guint				flush_id;
+	DBusMessage			*batch;
+	DBusMessageIter			batch_iter;
+	DBusMessageIter			batch_array;
 };
 
 struct measurement {
@@ -166,6 +189,12 @@ static void destroy_watcher(gpointer user_data)
 {
 	struct watcher *watcher = user_data;
 
+	if (watcher->flush_id > 0)
+		g_source_remove(watcher->flush_id);
+
+	if (watcher->batch != NULL)
+		dbus_message_unref(watcher->batch);
+
 	g_free(watcher->path);
 	g_free(watcher->srv);
 	g_free(watcher);
@@ -262,26 +291,14 @@ static void char_write_cb(guint8 status, const guint8 *pdu, guint16 len,
 	g_free(msg);
 }
 
-static void update_watcher(gpointer data, gpointer user_data)
+static void append_measurement(DBusMessageIter *iter, struct measurement *m)
 {
-	struct watcher *w = data;
-	struct measurement *m = user_data;
-	struct heartrate *hr = m->hr;
-	const char *path = device_get_path(hr->dev);
-	DBusMessageIter iter;
+	const char *path = device_get_path(m->hr->dev);
 	DBusMessageIter dict;
-	DBusMessage *msg;
 
-	msg = dbus_message_new_method_call(w->srv, w->path,
-			HEART_RATE_WATCHER_INTERFACE, "MeasurementReceived");
-	if (msg == NULL)
-		return;
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH , &path);
 
-	dbus_message_iter_init_append(msg, &iter);
-
-	dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH , &path);
-
-	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
 			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
 			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
@@ -300,7 +317,80 @@ static void update_watcher(gpointer data, gpointer user_data)
 		dict_append_array(&dict, "Interval", DBUS_TYPE_UINT16,
 						&m->interval, m->num_interval);
 
-	dbus_message_iter_close_container(&iter, &dict);
+	dbus_message_iter_close_container(iter, &dict);
+}
+
+static gboolean flush_batch(gpointer user_data)
+{
+	struct watcher *w = user_data;
+
+	w->flush_id = 0;
+
+	if (w->batch == NULL)
+		return FALSE;
+
+	dbus_message_iter_close_container(&w->batch_iter, &w->batch_array);
+
+	dbus_message_set_no_reply(w->batch, TRUE);
+	g_dbus_send_message(btd_get_dbus_connection(), w->batch);
+
+	w->batch = NULL;
+	w->pending = 0;
+
+	return FALSE;
+}
+
+static void batch_measurement(struct watcher *w, struct measurement *m)
+{
+	DBusMessageIter entry;
+
+	if (w->batch == NULL) {
+		w->batch = dbus_message_new_method_call(w->srv, w->path,
+						HEART_RATE_WATCHER_INTERFACE,
+						"MeasurementsReceived");
+		if (w->batch == NULL)
+			return;
+
+		dbus_message_iter_init_append(w->batch, &w->batch_iter);
+		dbus_message_iter_open_container(&w->batch_iter,
+					DBUS_TYPE_ARRAY, BATCH_ENTRY_SIGNATURE,
+					&w->batch_array);
+
+		w->flush_id = g_timeout_add(w->interval, flush_batch, w);
+	}
+
+	dbus_message_iter_open_container(&w->batch_array, DBUS_TYPE_STRUCT,
+								NULL, &entry);
+	append_measurement(&entry, m);
+	dbus_message_iter_close_container(&w->batch_array, &entry);
+
+	if (++w->pending < w->count)
+		return;
+
+	g_source_remove(w->flush_id);
+	flush_batch(w);
+}
+
+static void update_watcher(gpointer data, gpointer user_data)
+{
+	struct watcher *w = data;
+	struct measurement *m = user_data;
+	DBusMessageIter iter;
+	DBusMessage *msg;
+
+	if (w->interval > 0) {
+		batch_measurement(w, m);
+		return;
+	}
+
+	msg = dbus_message_new_method_call(w->srv, w->path,
+			HEART_RATE_WATCHER_INTERFACE, "MeasurementReceived");
+	if (msg == NULL)
+		return;
+
+	dbus_message_iter_init_append(msg, &iter);
+
+	append_measurement(&iter, m);
 
 	dbus_message_set_no_reply(msg, TRUE);
 	g_dbus_send_message(btd_get_dbus_connection(), msg);
@@ -555,17 +645,13 @@ static void watcher_exit_cb(DBusConnection *conn, void *user_data)
 		g_slist_foreach(hradapter->devices, disable_measurement, 0);
 }
 
-static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
-								void *data)
+static DBusMessage *add_watcher(DBusConnection *conn, DBusMessage *msg,
+				struct heartrate_adapter *hradapter,
+				const char *path, uint16_t interval,
+				uint16_t count)
 {
-	struct heartrate_adapter *hradapter = data;
 	struct watcher *watcher;
 	const char *sender = dbus_message_get_sender(msg);
-	char *path;
-
-	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
-							DBUS_TYPE_INVALID))
-		return btd_error_invalid_args(msg);
 
 	watcher = find_watcher(hradapter->watchers, sender, path);
 	if (watcher != NULL)
@@ -577,6 +663,8 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 						watcher, destroy_watcher);
 	watcher->srv = g_strdup(sender);
 	watcher->path = g_strdup(path);
+	watcher->interval = interval;
+	watcher->count = count;
 
 	if (g_slist_length(hradapter->watchers) == 0)
 		g_slist_foreach(hradapter->devices, enable_measurement, 0);
@@ -588,6 +676,85 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct heartrate_adapter *hradapter = data;
+	char *path;
+
+	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
+							DBUS_TYPE_INVALID))
+		return btd_error_invalid_args(msg);
+
+	return add_watcher(conn, msg, hradapter, path, 0, 0);
+}
+
+static bool parse_batch_options(DBusMessageIter *iter, uint16_t *interval,
+							uint16_t *count)
+{
+	DBusMessageIter dict;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(iter, &dict);
+
+	while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry, value;
+		const char *key;
+
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &value);
+
+		if (dbus_message_iter_get_arg_type(&value) != DBUS_TYPE_UINT16)
+			return false;
+
+		if (g_str_equal(key, "Interval"))
+			dbus_message_iter_get_basic(&value, interval);
+		else if (g_str_equal(key, "Count"))
+			dbus_message_iter_get_basic(&value, count);
+		else
+			return false;
+
+		dbus_message_iter_next(&dict);
+	}
+
+	if (*interval == 0 || *interval > BATCH_INTERVAL_MAX)
+		return false;
+
+	if (*count == 0 || *count > BATCH_COUNT_MAX)
+		return false;
+
+	return true;
+}
+
+static DBusMessage *register_batch_watcher(DBusConnection *conn,
+						DBusMessage *msg, void *data)
+{
+	struct heartrate_adapter *hradapter = data;
+	uint16_t interval = BATCH_INTERVAL;
+	uint16_t count = BATCH_COUNT;
+	DBusMessageIter iter;
+	const char *path;
+
+	if (!dbus_message_iter_init(msg, &iter))
+		return btd_error_invalid_args(msg);
+
+	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH)
+		return btd_error_invalid_args(msg);
+
+	dbus_message_iter_get_basic(&iter, &path);
+	dbus_message_iter_next(&iter);
+
+	if (!parse_batch_options(&iter, &interval, &count))
+		return btd_error_invalid_args(msg);
+
+	return add_watcher(conn, msg, hradapter, path, interval, count);
+}
+
 static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 								void *data)
 {
@@ -622,6 +789,9 @@ static const GDBusMethodTable heartrate_manager_methods[] = {
 	{ GDBUS_METHOD("UnregisterWatcher",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
 			unregister_watcher) },
+	{ GDBUS_METHOD("RegisterBatchWatcher",
+			GDBUS_ARGS({ "agent", "o" }, { "options", "a{sv}" }),
+			NULL, register_batch_watcher) },
 	{ }
 };
 
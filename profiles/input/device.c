@@ -28,10 +28,13 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hidp.h>
@@ -49,6 +52,7 @@
 #include "src/profile.h"
 #include "src/service.h"
 #include "src/storage.h"
+#include "src/worker.h"
 #include "src/dbus-common.h"
 #include "src/error.h"
 #include "src/sdp-client.h"
@@ -59,6 +63,9 @@
 
 #define INPUT_INTERFACE "org.bluez.Input1"
 
+/* Maximum number of interrupt channel packets read per wakeup */
+#define INTR_BATCH 8
+
 enum reconnect_mode_t {
 	RECONNECT_NONE = 0,
 	RECONNECT_DEVICE,
@@ -66,6 +73,22 @@ enum reconnect_mode_t {
 	RECONNECT_ANY
 };
 
+/*
+ * Interrupt channel packets are received straight into uhid events, the
+ * HIDP header is split off into its own buffer by the scatter read.
+ */
+struct intr_batch {
+	struct mmsghdr		msgs[INTR_BATCH];
+	struct iovec		iov[INTR_BATCH][2];
+	uint8_t			hdr[INTR_BATCH];
+	uint8_t			cmsg[INTR_BATCH][CMSG_SPACE(
+						sizeof(struct timeval))];
+	struct uhid_event	ev[INTR_BATCH];
+	unsigned int		reports;
+	uint64_t		latency_sum;	/* us, receive to uhid */
+	uint64_t		latency_max;
+};
+
 struct input_device {
 	struct btd_service	*service;
 	struct btd_device	*device;
@@ -88,6 +111,7 @@ struct input_device {
 	uint8_t			report_req_pending;
 	guint			report_req_timer;
 	uint32_t		report_rsp_id;
+	struct intr_batch	*intr_batch;
 };
 
 static int idle_timeout = 0;
@@ -105,9 +129,11 @@ void input_enable_userspace_hid(bool state)
 
 static void input_device_enter_reconnect_mode(struct input_device *idev);
 static int connection_disconnect(struct input_device *idev, uint32_t flags);
+static void intr_batch_free(struct input_device *idev);
 
 static void input_device_free(struct input_device *idev)
 {
+	intr_batch_free(idev);
 	bt_uhid_unref(idev->uhid);
 	btd_service_unref(idev->service);
 	btd_device_unref(idev->device);
@@ -229,73 +255,184 @@ static bool uhid_send_feature_answer(struct input_device *idev,
 	return true;
 }
 
-static bool uhid_send_input_report(struct input_device *idev,
-					const uint8_t *data, size_t size)
+static bool uhid_prepare_input_event(struct input_device *idev,
+					struct uhid_event *ev, size_t size)
 {
-	struct uhid_event ev;
-	int err;
-
-	if (data == NULL)
-		size = 0;
-
-	if (size > sizeof(ev.u.input.data))
-		size = sizeof(ev.u.input.data);
+	if (size > sizeof(ev->u.input.data))
+		size = sizeof(ev->u.input.data);
 
 	if (!idev->uhid_created) {
 		DBG("HID report (%zu bytes) dropped", size);
 		return false;
 	}
 
-	memset(&ev, 0, sizeof(ev));
-	ev.type = UHID_INPUT;
-	ev.u.input.size = size;
+	/* The report data is already in place, only fill in the header */
+	ev->type = UHID_INPUT;
+	ev->u.input.size = size;
 
-	if (size > 0)
-		memcpy(ev.u.input.data, data, size);
+	DBG("HID report (%zu bytes)", size);
 
-	err = bt_uhid_send(idev->uhid, &ev);
-	if (err < 0) {
-		error("bt_uhid_send: %s (%d)", strerror(-err), -err);
-		return false;
+	return true;
+}
+
+static struct intr_batch *intr_batch_new(int fd)
+{
+	struct intr_batch *batch;
+	int opt = 1;
+	unsigned int i;
+
+	batch = g_new0(struct intr_batch, 1);
+
+	for (i = 0; i < INTR_BATCH; i++) {
+		batch->iov[i][0].iov_base = &batch->hdr[i];
+		batch->iov[i][0].iov_len = 1;
+		batch->iov[i][1].iov_base = batch->ev[i].u.input.data;
+		batch->iov[i][1].iov_len = sizeof(batch->ev[i].u.input.data);
+		batch->msgs[i].msg_hdr.msg_iov = batch->iov[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 2;
 	}
 
-	DBG("HID report (%zu bytes)", size);
+	/* Used to measure the latency from L2CAP receive to uhid write */
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &opt, sizeof(opt)) < 0)
+		DBG("Unable to enable timestamps: %s", strerror(errno));
 
-	return true;
+	return batch;
+}
+
+static void intr_batch_free(struct input_device *idev)
+{
+	struct intr_batch *batch = idev->intr_batch;
+	struct bt_uhid_stats stats;
+
+	if (!batch)
+		return;
+
+	if (bt_uhid_get_stats(idev->uhid, &stats) && stats.writes > 0)
+		DBG("%" PRIu64 " uhid events in %" PRIu64 " writes, "
+				"%" PRIu64 " errors", stats.events,
+				stats.writes, stats.errors);
+
+	if (batch->reports > 0)
+		DBG("%u reports latency avg %" PRIu64 " max %" PRIu64 " us",
+				batch->reports,
+				batch->latency_sum / batch->reports,
+				batch->latency_max);
+
+	g_free(batch);
+	idev->intr_batch = NULL;
+}
+
+static void intr_batch_latency(struct intr_batch *batch, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	struct timeval now, *tv = NULL;
+	uint64_t latency;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+					cmsg->cmsg_type == SCM_TIMESTAMP)
+			tv = (struct timeval *) CMSG_DATA(cmsg);
+	}
+
+	if (!tv)
+		return;
+
+	gettimeofday(&now, NULL);
+
+	if (timercmp(&now, tv, <))
+		return;
+
+	latency = (now.tv_sec - tv->tv_sec) * 1000000ULL +
+						now.tv_usec - tv->tv_usec;
+
+	batch->reports++;
+	batch->latency_sum += latency;
+
+	if (latency > batch->latency_max)
+		batch->latency_max = latency;
 }
 
 static bool hidp_recv_intr_data(GIOChannel *chan, struct input_device *idev)
 {
-	int fd;
-	ssize_t len;
-	uint8_t hdr;
-	uint8_t data[UHID_DATA_MAX + 1];
+	const struct uhid_event *ev[INTR_BATCH];
+	unsigned int msg[INTR_BATCH];
+	struct intr_batch *batch;
+	int fd, count, i, n = 0;
 
 	fd = g_io_channel_unix_get_fd(chan);
 
-	len = read(fd, data, sizeof(data));
-	if (len < 0) {
+	if (!idev->intr_batch)
+		idev->intr_batch = intr_batch_new(fd);
+
+	batch = idev->intr_batch;
+
+	for (i = 0; i < INTR_BATCH; i++) {
+		struct msghdr *msg = &batch->msgs[i].msg_hdr;
+
+		msg->msg_control = batch->cmsg[i];
+		msg->msg_controllen = sizeof(batch->cmsg[i]);
+		msg->msg_flags = 0;
+	}
+
+	count = recvmmsg(fd, batch->msgs, INTR_BATCH, MSG_DONTWAIT, NULL);
+	if (count < 0 && errno == ENOSYS) {
+		/* No recvmmsg support, fall back to one packet per wakeup */
+		count = recvmsg(fd, &batch->msgs[0].msg_hdr, MSG_DONTWAIT);
+		if (count >= 0) {
+			batch->msgs[0].msg_len = count;
+			count = 1;
+		}
+	}
+
+	if (count < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
 		error("BT socket read error: %s (%d)", strerror(errno), errno);
 		return false;
 	}
 
-	if (len == 0) {
-		DBG("BT socket read returned 0 bytes");
-		return true;
+	for (i = 0; i < count; i++) {
+		unsigned int len = batch->msgs[i].msg_len;
+
+		if (len == 0) {
+			DBG("BT socket read returned 0 bytes");
+			continue;
+		}
+
+		if (batch->hdr[i] != (HIDP_TRANS_DATA |
+						HIDP_DATA_RTYPE_INPUT)) {
+			DBG("unsupported HIDP protocol header 0x%02x",
+							batch->hdr[i]);
+			continue;
+		}
+
+		if (len < 2) {
+			DBG("received empty HID report");
+			continue;
+		}
+
+		if (uhid_prepare_input_event(idev, &batch->ev[i], len - 1)) {
+			ev[n] = &batch->ev[i];
+			msg[n++] = i;
+		}
 	}
 
-	hdr = data[0];
-	if (hdr != (HIDP_TRANS_DATA | HIDP_DATA_RTYPE_INPUT)) {
-		DBG("unsupported HIDP protocol header 0x%02x", hdr);
+	if (n == 0)
 		return true;
-	}
 
-	if (len < 2) {
-		DBG("received empty HID report");
+	/* Forward all reports of this wakeup with a single write */
+	count = bt_uhid_send_batch(idev->uhid, ev, n);
+	if (count < 0) {
+		error("bt_uhid_send: %s (%d)", strerror(-count), -count);
 		return true;
 	}
 
-	uhid_send_input_report(idev, data + 1, len - 1);
+	if (count < n)
+		error("bt_uhid_send: %d of %d reports dropped", n - count, n);
+
+	for (i = 0; i < count; i++)
+		intr_batch_latency(batch, &batch->msgs[msg[i]].msg_hdr);
 
 	return true;
 }
@@ -327,6 +464,8 @@ static gboolean intr_watch_cb(GIOChannel *chan, GIOCondition cond, gpointer data
 		idev->intr_io = NULL;
 	}
 
+	intr_batch_free(idev);
+
 	/* Close control channel */
 	if (idev->ctrl_io && !(cond & G_IO_NVAL))
 		g_io_channel_shutdown(idev->ctrl_io, TRUE, NULL);
@@ -943,7 +1082,7 @@ static int hidp_add_connection(struct input_device *idev)
 	sprintf(handle, "0x%8.8X", idev->handle);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	str = g_key_file_get_string(key_file, "ServiceRecords", handle, NULL);
 	g_key_file_free(key_file);
 
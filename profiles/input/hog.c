@@ -28,11 +28,12 @@
 #endif
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
 
 #include <bluetooth/bluetooth.h>
@@ -48,6 +49,7 @@
 #include "src/service.h"
 #include "src/shared/util.h"
 #include "src/shared/uhid.h"
+#include "src/worker.h"
 
 #include "src/plugin.h"
 
@@ -76,6 +78,15 @@
 #define HID_INFO_SIZE			4
 #define ATT_NOTIFICATION_HEADER_SIZE	3
 
+/*
+ * Connection parameters requested for HID devices: a 7.5 ms interval keeps
+ * input latency low while the device is active, and the slave latency lets
+ * it skip connection events, and save power, while idle.
+ */
+#define HOG_CONN_INTERVAL	0x0006
+#define HOG_CONN_LATENCY	0x0014
+#define HOG_CONN_TIMEOUT	0x012c
+
 struct hog_device {
 	uint16_t		id;
 	struct btd_device	*device;
@@ -90,6 +101,12 @@ struct hog_device {
 	uint16_t		proto_mode_handle;
 	uint16_t		ctrlpt_handle;
 	uint8_t			flags;
+	uint8_t			*report_map;
+	size_t			report_map_len;
+	unsigned int		report_count;	/* Input reports forwarded */
+	gint64			first_report;
+	gint64			last_report;
+	gint64			gap_min;	/* Shortest gap between reports */
 };
 
 struct report {
@@ -103,6 +120,35 @@ struct report {
 static gboolean suspend_supported = FALSE;
 static GSList *devices = NULL;
 
+static void update_report_stats(struct hog_device *hogdev)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (hogdev->report_count++ == 0)
+		hogdev->first_report = now;
+	else if (!hogdev->gap_min || now - hogdev->last_report <
+							hogdev->gap_min)
+		hogdev->gap_min = now - hogdev->last_report;
+
+	hogdev->last_report = now;
+}
+
+static void print_report_stats(struct hog_device *hogdev)
+{
+	gint64 elapsed = hogdev->last_report - hogdev->first_report;
+
+	if (hogdev->report_count > 1 && elapsed > 0)
+		DBG("0x%4X %u reports, %" G_GINT64_FORMAT " reports/s, "
+				"min gap %" G_GINT64_FORMAT " us", hogdev->id,
+				hogdev->report_count,
+				(hogdev->report_count - 1) *
+					G_GINT64_CONSTANT(1000000) / elapsed,
+				hogdev->gap_min);
+
+	hogdev->report_count = 0;
+	hogdev->gap_min = 0;
+}
+
 static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
 {
 	struct report *report = user_data;
@@ -119,7 +165,7 @@ static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
 	pdu += ATT_NOTIFICATION_HEADER_SIZE;
 	len -= ATT_NOTIFICATION_HEADER_SIZE;
 
-	memset(&ev, 0, sizeof(ev));
+	/* Only the used part of the event needs to be initialized */
 	ev.type = UHID_INPUT;
 	buf = ev.u.input.data;
 
@@ -140,9 +186,163 @@ static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
 		return;
 	}
 
+	update_report_stats(hogdev);
+
 	DBG("HoG report (%u bytes)", ev.u.input.size);
 }
 
+static char *cache_filename(struct hog_device *hogdev)
+{
+	struct btd_adapter *adapter = device_get_adapter(hogdev->device);
+	char src[18], dst[18];
+
+	ba2str(btd_adapter_get_address(adapter), src);
+	ba2str(device_get_address(hogdev->device), dst);
+
+	return g_strdup_printf(STORAGEDIR "/%s/%s/hog", src, dst);
+}
+
+/*
+ * The Report Map, Report references and HID Information of bonded devices
+ * are stored so that the uHID device can be created without any discovery
+ * the next time the device is loaded.
+ */
+static void store_cache(struct hog_device *hogdev)
+{
+	struct btd_device *device = hogdev->device;
+	GKeyFile *key_file;
+	char group[9];
+	char *filename, *str, **reports;
+	size_t i, length = 0;
+	GSList *l;
+
+	if (!hogdev->report_map)
+		return;
+
+	if (!device_is_bonded(device, btd_device_get_bdaddr_type(device)))
+		return;
+
+	filename = cache_filename(hogdev);
+	snprintf(group, sizeof(group), "0x%04x", hogdev->id);
+
+	key_file = g_key_file_new();
+	btd_worker_load_key_file(key_file, filename);
+
+	str = g_malloc(hogdev->report_map_len * 2 + 1);
+	for (i = 0; i < hogdev->report_map_len; i++)
+		sprintf(str + i * 2, "%02x", hogdev->report_map[i]);
+	g_key_file_set_string(key_file, group, "ReportMap", str);
+	g_free(str);
+
+	g_key_file_set_integer(key_file, group, "BcdHID", hogdev->bcdhid);
+	g_key_file_set_integer(key_file, group, "CountryCode",
+							hogdev->bcountrycode);
+	g_key_file_set_integer(key_file, group, "Flags", hogdev->flags);
+	g_key_file_set_integer(key_file, group, "ProtocolModeHandle",
+						hogdev->proto_mode_handle);
+	g_key_file_set_integer(key_file, group, "ControlPointHandle",
+							hogdev->ctrlpt_handle);
+
+	reports = g_new0(char *, g_slist_length(hogdev->reports) + 1);
+	for (l = hogdev->reports, i = 0; l; l = l->next, i++) {
+		struct report *r = l->data;
+
+		reports[i] = g_strdup_printf("%04x:%04x:%02x:%02x:%02x",
+					r->decl->handle, r->decl->value_handle,
+					r->decl->properties, r->id, r->type);
+	}
+	g_key_file_set_string_list(key_file, group, "Reports",
+				(const char * const *) reports, i);
+	g_strfreev(reports);
+
+	str = g_key_file_to_data(key_file, &length, NULL);
+	btd_worker_store_file(filename, str, length);
+
+	g_key_file_free(key_file);
+	g_free(filename);
+}
+
+static bool load_cache(struct hog_device *hogdev)
+{
+	GKeyFile *key_file;
+	char group[9];
+	char *filename, *str, **reports = NULL;
+	bt_uuid_t uuid;
+	gsize i, len, count = 0;
+	bool ret = false;
+
+	filename = cache_filename(hogdev);
+	snprintf(group, sizeof(group), "0x%04x", hogdev->id);
+
+	key_file = g_key_file_new();
+	if (!btd_worker_load_key_file(key_file, filename))
+		goto done;
+
+	str = g_key_file_get_string(key_file, group, "ReportMap", NULL);
+	if (!str)
+		goto done;
+
+	len = strlen(str) / 2;
+	if (len == 0 || len > HOG_REPORT_MAP_MAX_SIZE) {
+		g_free(str);
+		goto done;
+	}
+
+	hogdev->report_map = g_malloc(len);
+	hogdev->report_map_len = len;
+	for (i = 0; i < len; i++)
+		sscanf(str + i * 2, "%02hhx", &hogdev->report_map[i]);
+	g_free(str);
+
+	hogdev->bcdhid = g_key_file_get_integer(key_file, group, "BcdHID",
+									NULL);
+	hogdev->bcountrycode = g_key_file_get_integer(key_file, group,
+							"CountryCode", NULL);
+	hogdev->flags = g_key_file_get_integer(key_file, group, "Flags", NULL);
+	hogdev->proto_mode_handle = g_key_file_get_integer(key_file, group,
+						"ProtocolModeHandle", NULL);
+	hogdev->ctrlpt_handle = g_key_file_get_integer(key_file, group,
+						"ControlPointHandle", NULL);
+
+	bt_uuid16_create(&uuid, HOG_REPORT_UUID);
+
+	reports = g_key_file_get_string_list(key_file, group, "Reports",
+								&count, NULL);
+	for (i = 0; i < count; i++) {
+		unsigned int handle, value_handle, properties, id, type;
+		struct report *report;
+
+		if (sscanf(reports[i], "%04x:%04x:%02x:%02x:%02x", &handle,
+					&value_handle, &properties, &id,
+					&type) != 5)
+			continue;
+
+		report = g_new0(struct report, 1);
+		report->hogdev = hogdev;
+		report->id = id;
+		report->type = type;
+		report->decl = g_new0(struct gatt_char, 1);
+		report->decl->handle = handle;
+		report->decl->value_handle = value_handle;
+		report->decl->properties = properties;
+		bt_uuid_to_string(&uuid, report->decl->uuid,
+						sizeof(report->decl->uuid));
+		hogdev->reports = g_slist_append(hogdev->reports, report);
+	}
+
+	g_strfreev(reports);
+
+	DBG("0x%04X loaded from cache with %zu reports", hogdev->id, count);
+
+	ret = true;
+
+done:
+	g_key_file_free(key_file);
+	g_free(filename);
+
+	return ret;
+}
+
 static void report_ccc_written_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data)
 {
@@ -192,6 +392,8 @@ static void report_reference_cb(guint8 status, const guint8 *pdu,
 	report->id = pdu[1];
 	report->type = pdu[2];
 	DBG("Report ID: 0x%02x Report type: 0x%02x", pdu[1], pdu[2]);
+
+	store_cache(report->hogdev);
 }
 
 static void external_report_reference_cb(guint8 status, const guint8 *pdu,
@@ -439,29 +641,15 @@ static char *item2string(char *str, uint8_t *buf, uint8_t len)
 	return str;
 }
 
-static void report_map_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
-							gpointer user_data)
+static void create_uhid(struct hog_device *hogdev, uint8_t *value,
+								ssize_t vlen)
 {
-	struct hog_device *hogdev = user_data;
 	struct btd_adapter *adapter = device_get_adapter(hogdev->device);
-	uint8_t value[HOG_REPORT_MAP_MAX_SIZE];
 	struct uhid_event ev;
 	uint16_t vendor_src, vendor, product, version;
-	ssize_t vlen;
 	char itemstr[20]; /* 5x3 (data) + 4 (continuation) + 1 (null) */
 	int i, err;
 
-	if (status != 0) {
-		error("Report Map read failed: %s", att_ecode2str(status));
-		return;
-	}
-
-	vlen = dec_read_resp(pdu, plen, value, sizeof(value));
-	if (vlen < 0) {
-		error("ATT protocol error");
-		return;
-	}
-
 	DBG("Report MAP:");
 	for (i = 0; i < vlen;) {
 		ssize_t ilen = 0;
@@ -519,6 +707,33 @@ static void report_map_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 	bt_uhid_register(hogdev->uhid, UHID_OUTPUT, forward_report, hogdev);
 }
 
+static void report_map_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct hog_device *hogdev = user_data;
+	uint8_t value[HOG_REPORT_MAP_MAX_SIZE];
+	ssize_t vlen;
+
+	if (status != 0) {
+		error("Report Map read failed: %s", att_ecode2str(status));
+		return;
+	}
+
+	vlen = dec_read_resp(pdu, plen, value, sizeof(value));
+	if (vlen < 0) {
+		error("ATT protocol error");
+		return;
+	}
+
+	create_uhid(hogdev, value, vlen);
+
+	g_free(hogdev->report_map);
+	hogdev->report_map = g_memdup(value, vlen);
+	hogdev->report_map_len = vlen;
+
+	store_cache(hogdev);
+}
+
 static void info_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 							gpointer user_data)
 {
@@ -585,8 +800,11 @@ static void char_discovered_cb(uint8_t status, GSList *chars, void *user_data)
 	bt_uuid_t report_uuid, report_map_uuid, info_uuid;
 	bt_uuid_t proto_mode_uuid, ctrlpt_uuid;
 	struct report *report;
+	struct gatt_read_req reads[3];
+	unsigned int num_reads = 0;
 	GSList *l;
 	uint16_t info_handle = 0, proto_mode_handle = 0;
+	uint16_t report_map_handle = 0;
 
 	if (status != 0) {
 		const char *str = att_ecode2str(status);
@@ -624,8 +842,7 @@ static void char_discovered_cb(uint8_t status, GSList *chars, void *user_data)
 								report);
 			discover_descriptor(hogdev->attrib, start, end, report);
 		} else if (bt_uuid_cmp(&uuid, &report_map_uuid) == 0) {
-			gatt_read_char(hogdev->attrib, chr->value_handle,
-						report_map_read_cb, hogdev);
+			report_map_handle = chr->value_handle;
 			discover_descriptor(hogdev->attrib, start, end, hogdev);
 		} else if (bt_uuid_cmp(&uuid, &info_uuid) == 0)
 			info_handle = chr->value_handle;
@@ -635,15 +852,28 @@ static void char_discovered_cb(uint8_t status, GSList *chars, void *user_data)
 			hogdev->ctrlpt_handle = chr->value_handle;
 	}
 
+	/*
+	 * Read everything in one batch. HID Information goes first since
+	 * the uHID device created from the Report Map needs the country
+	 * code.
+	 */
+	if (info_handle) {
+		reads[num_reads].handle = info_handle;
+		reads[num_reads++].func = info_read_cb;
+	}
+
 	if (proto_mode_handle) {
 		hogdev->proto_mode_handle = proto_mode_handle;
-		gatt_read_char(hogdev->attrib, proto_mode_handle,
-						proto_mode_read_cb, hogdev);
+		reads[num_reads].handle = proto_mode_handle;
+		reads[num_reads++].func = proto_mode_read_cb;
 	}
 
-	if (info_handle)
-		gatt_read_char(hogdev->attrib, info_handle, info_read_cb,
-									hogdev);
+	if (report_map_handle) {
+		reads[num_reads].handle = report_map_handle;
+		reads[num_reads++].func = report_map_read_cb;
+	}
+
+	gatt_read_chars_multi(hogdev->attrib, reads, num_reads, NULL, hogdev);
 }
 
 static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
@@ -680,6 +910,8 @@ static void attio_disconnected_cb(gpointer user_data)
 
 	DBG("HoG disconnected");
 
+	print_report_stats(hogdev);
+
 	for (l = hogdev->reports; l; l = l->next) {
 		struct report *r = l->data;
 
@@ -723,6 +955,7 @@ static void hog_free_device(struct hog_device *hogdev)
 	g_slist_free_full(hogdev->reports, report_free);
 	g_attrib_unref(hogdev->attrib);
 	g_free(hogdev->hog_primary);
+	g_free(hogdev->report_map);
 	g_free(hogdev);
 }
 
@@ -744,6 +977,20 @@ static struct hog_device *hog_register_device(struct btd_device *device,
 
 	hogdev->hog_primary = g_memdup(prim, sizeof(*prim));
 
+	/* Known devices can be used as soon as they reconnect */
+	if (load_cache(hogdev))
+		create_uhid(hogdev, hogdev->report_map,
+						hogdev->report_map_len);
+
+	btd_adapter_set_conn_param(device_get_adapter(device),
+					device_get_address(device),
+					btd_device_get_bdaddr_type(device),
+					HOG_CONN_INTERVAL, HOG_CONN_INTERVAL,
+					HOG_CONN_LATENCY, HOG_CONN_TIMEOUT);
+
+	/* Input devices are reconnected ahead of sensors and the like */
+	btd_device_set_conn_priority(device, BTD_CONN_PRIORITY_HIGH);
+
 	hogdev->attioid = btd_device_add_attio_callback(device,
 							attio_connected_cb,
 							attio_disconnected_cb,
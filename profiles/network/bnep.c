@@ -27,14 +27,19 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <sys/param.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <net/if.h>
+#include <net/if_arp.h>
 #include <linux/sockios.h>
+#include <linux/if_tun.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/l2cap.h>
@@ -52,7 +57,37 @@
 #define CON_SETUP_RETRIES      3
 #define CON_SETUP_TO           9
 
-static int ctl;
+/* Frames moved per wakeup by the userspace data path */
+#define BNEP_BATCH		16
+
+static int ctl = -1;
+static gboolean userspace = FALSE;
+static GSList *taps = NULL;
+
+/*
+ * Userspace data path: the L2CAP channel is bridged to a TAP device
+ * instead of being handed to the kernel bnep module.
+ */
+struct bnep_tap {
+	bdaddr_t	dst;
+	char		iface[16];
+	int		sk;
+	int		fd;
+	guint		sk_watch;
+	guint		fd_watch;
+	uint8_t		local[ETH_ALEN];
+	uint8_t		remote[ETH_ALEN];
+	uint8_t		(*rx_buf)[BNEP_MTU];
+	uint8_t		(*tx_buf)[BNEP_MTU];
+	uint8_t		(*tx_hdr)[ETH_HLEN + 1];
+	uint64_t	rx_packets;
+	uint64_t	rx_bytes;
+	uint64_t	rx_batches;
+	uint64_t	tx_packets;
+	uint64_t	tx_bytes;
+	uint64_t	tx_batches;
+	uint64_t	tx_dropped;
+};
 
 static struct {
 	const char	*name;		/* Friendly name */
@@ -130,6 +165,11 @@ const char *bnep_name(uint16_t id)
 	return NULL;
 }
 
+void bnep_set_userspace(gboolean enable)
+{
+	userspace = enable;
+}
+
 int bnep_init(void)
 {
 	ctl = socket(PF_BLUETOOTH, SOCK_RAW, BTPROTO_BNEP);
@@ -137,6 +177,12 @@ int bnep_init(void)
 	if (ctl < 0) {
 		int err = -errno;
 
+		if (userspace) {
+			info("bnep: kernel module unavailable, using "
+							"userspace data path");
+			return 0;
+		}
+
 		if (err == -EPROTONOSUPPORT)
 			warn("kernel lacks bnep-protocol support");
 		else
@@ -151,14 +197,434 @@ int bnep_init(void)
 
 int bnep_cleanup(void)
 {
-	close(ctl);
+	if (ctl >= 0)
+		close(ctl);
+
+	ctl = -1;
+
 	return 0;
 }
 
+static struct bnep_tap *find_tap(const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = taps; l; l = l->next) {
+		struct bnep_tap *tap = l->data;
+
+		if (!bacmp(&tap->dst, dst))
+			return tap;
+	}
+
+	return NULL;
+}
+
+static void tap_free(struct bnep_tap *tap)
+{
+	if (tap->sk_watch > 0)
+		g_source_remove(tap->sk_watch);
+
+	if (tap->fd_watch > 0)
+		g_source_remove(tap->fd_watch);
+
+	if (tap->sk >= 0)
+		close(tap->sk);
+
+	if (tap->fd >= 0)
+		close(tap->fd);
+
+	g_free(tap->rx_buf);
+	g_free(tap->tx_buf);
+	g_free(tap->tx_hdr);
+	g_free(tap);
+}
+
+static void tap_control(struct bnep_tap *tap, const uint8_t *buf, size_t len)
+{
+	uint8_t pkt[3];
+
+	if (len < 1)
+		return;
+
+	switch (buf[0]) {
+	case BNEP_SETUP_CONN_REQ:
+		bnep_send_ctrl_rsp(tap->sk, BNEP_CONTROL, BNEP_SETUP_CONN_RSP,
+							BNEP_CONN_NOT_ALLOWED);
+		break;
+	case BNEP_FILTER_NET_TYPE_SET:
+		/* Filtering is left to the TAP side (e.g. netfilter) */
+		bnep_send_ctrl_rsp(tap->sk, BNEP_CONTROL,
+					BNEP_FILTER_NET_TYPE_RSP,
+					BNEP_FILTER_UNSUPPORTED_REQ);
+		break;
+	case BNEP_FILTER_MULT_ADDR_SET:
+		bnep_send_ctrl_rsp(tap->sk, BNEP_CONTROL,
+					BNEP_FILTER_MULT_ADDR_RSP,
+					BNEP_FILTER_UNSUPPORTED_REQ);
+		break;
+	case BNEP_CMD_NOT_UNDERSTOOD:
+	case BNEP_SETUP_CONN_RSP:
+	case BNEP_FILTER_NET_TYPE_RSP:
+	case BNEP_FILTER_MULT_ADDR_RSP:
+		break;
+	default:
+		pkt[0] = BNEP_CONTROL;
+		pkt[1] = BNEP_CMD_NOT_UNDERSTOOD;
+		pkt[2] = buf[0];
+		send(tap->sk, pkt, sizeof(pkt), MSG_DONTWAIT);
+		break;
+	}
+}
+
+/* Rebuild the Ethernet header of a BNEP frame and pass it to the TAP */
+static void tap_rx_frame(struct bnep_tap *tap, uint8_t *buf, size_t len)
+{
+	uint8_t hdr[ETH_HLEN];
+	struct iovec iov[2];
+	uint8_t type;
+	size_t off;
+
+	if (len < 1)
+		return;
+
+	type = buf[0] & BNEP_TYPE_MASK;
+	off = 1;
+
+	switch (type) {
+	case BNEP_CONTROL:
+		tap_control(tap, buf + 1, len - 1);
+		return;
+	case BNEP_GENERAL:
+		if (len < off + 2 * ETH_ALEN + 2)
+			return;
+		memcpy(hdr, buf + off, 2 * ETH_ALEN);
+		off += 2 * ETH_ALEN;
+		break;
+	case BNEP_COMPRESSED:
+		memcpy(hdr, tap->local, ETH_ALEN);
+		memcpy(hdr + ETH_ALEN, tap->remote, ETH_ALEN);
+		break;
+	case BNEP_COMPRESSED_SRC_ONLY:
+		if (len < off + ETH_ALEN + 2)
+			return;
+		memcpy(hdr, tap->local, ETH_ALEN);
+		memcpy(hdr + ETH_ALEN, buf + off, ETH_ALEN);
+		off += ETH_ALEN;
+		break;
+	case BNEP_COMPRESSED_DST_ONLY:
+		if (len < off + ETH_ALEN + 2)
+			return;
+		memcpy(hdr, buf + off, ETH_ALEN);
+		memcpy(hdr + ETH_ALEN, tap->remote, ETH_ALEN);
+		off += ETH_ALEN;
+		break;
+	default:
+		return;
+	}
+
+	if (len < off + 2)
+		return;
+
+	memcpy(hdr + 2 * ETH_ALEN, buf + off, 2);
+	off += 2;
+
+	/* Extension headers are not forwarded */
+	if (buf[0] & BNEP_EXT_HEADER) {
+		uint8_t ext;
+
+		do {
+			if (len < off + 2)
+				return;
+
+			ext = buf[off];
+			off += 2 + buf[off + 1];
+		} while (ext & BNEP_EXT_HEADER);
+
+		if (off > len)
+			return;
+	}
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = buf + off;
+	iov[1].iov_len = len - off;
+
+	if (writev(tap->fd, iov, 2) < 0) {
+		DBG("%s: write: %s (%d)", tap->iface, strerror(errno), errno);
+		return;
+	}
+
+	tap->rx_packets++;
+	tap->rx_bytes += len - off + sizeof(hdr);
+}
+
+static gboolean tap_sk_cb(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct bnep_tap *tap = user_data;
+	struct mmsghdr msgs[BNEP_BATCH];
+	struct iovec iov[BNEP_BATCH];
+	int i, count;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		tap->sk_watch = 0;
+		return FALSE;
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < BNEP_BATCH; i++) {
+		iov[i].iov_base = tap->rx_buf[i];
+		iov[i].iov_len = BNEP_MTU;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	count = recvmmsg(tap->sk, msgs, BNEP_BATCH, MSG_DONTWAIT, NULL);
+	if (count < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+
+		error("%s: recvmmsg: %s (%d)", tap->iface, strerror(errno),
+									errno);
+		tap->sk_watch = 0;
+		return FALSE;
+	}
+
+	tap->rx_batches++;
+
+	for (i = 0; i < count; i++)
+		tap_rx_frame(tap, tap->rx_buf[i], msgs[i].msg_len);
+
+	return TRUE;
+}
+
+/* Pick the most compact BNEP header for an outgoing Ethernet frame */
+static size_t tap_tx_header(struct bnep_tap *tap, const uint8_t *frame,
+								uint8_t *hdr)
+{
+	gboolean dst = !memcmp(frame, tap->remote, ETH_ALEN);
+	gboolean src = !memcmp(frame + ETH_ALEN, tap->local, ETH_ALEN);
+	size_t len = 1;
+
+	if (dst && src) {
+		hdr[0] = BNEP_COMPRESSED;
+	} else if (src) {
+		hdr[0] = BNEP_COMPRESSED_DST_ONLY;
+		memcpy(hdr + len, frame, ETH_ALEN);
+		len += ETH_ALEN;
+	} else if (dst) {
+		hdr[0] = BNEP_COMPRESSED_SRC_ONLY;
+		memcpy(hdr + len, frame + ETH_ALEN, ETH_ALEN);
+		len += ETH_ALEN;
+	} else {
+		hdr[0] = BNEP_GENERAL;
+		memcpy(hdr + len, frame, 2 * ETH_ALEN);
+		len += 2 * ETH_ALEN;
+	}
+
+	memcpy(hdr + len, frame + 2 * ETH_ALEN, 2);
+
+	return len + 2;
+}
+
+static gboolean tap_fd_cb(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct bnep_tap *tap = user_data;
+	struct mmsghdr msgs[BNEP_BATCH];
+	struct iovec iov[BNEP_BATCH][2];
+	int i, count, sent;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		tap->fd_watch = 0;
+		return FALSE;
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+
+	/* A TAP read returns one frame, drain up to a batch of them */
+	for (count = 0; count < BNEP_BATCH; count++) {
+		ssize_t len;
+
+		len = read(tap->fd, tap->tx_buf[count], BNEP_MTU);
+		if (len < ETH_HLEN)
+			break;
+
+		iov[count][0].iov_base = tap->tx_hdr[count];
+		iov[count][0].iov_len = tap_tx_header(tap, tap->tx_buf[count],
+							tap->tx_hdr[count]);
+		iov[count][1].iov_base = tap->tx_buf[count] + ETH_HLEN;
+		iov[count][1].iov_len = len - ETH_HLEN;
+
+		msgs[count].msg_hdr.msg_iov = iov[count];
+		msgs[count].msg_hdr.msg_iovlen = 2;
+	}
+
+	if (count == 0)
+		return TRUE;
+
+	/* Frames the channel can't take right now are dropped like a NIC
+	 * with a full queue would, rather than stalling the mainloop */
+	sent = sendmmsg(tap->sk, msgs, count, MSG_DONTWAIT);
+	if (sent < 0)
+		sent = 0;
+
+	tap->tx_batches++;
+	tap->tx_dropped += count - sent;
+
+	for (i = 0; i < sent; i++) {
+		tap->tx_packets++;
+		tap->tx_bytes += msgs[i].msg_len;
+	}
+
+	return TRUE;
+}
+
+static int tap_open(char *dev)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+		int err = -errno;
+		close(fd);
+		return err;
+	}
+
+	strncpy(dev, ifr.ifr_name, 16);
+	dev[15] = '\0';
+
+	return fd;
+}
+
+static int tap_set_hwaddr(const char *dev, const uint8_t *addr)
+{
+	struct ifreq ifr;
+	int sk, err;
+
+	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sk < 0)
+		return -errno;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, dev, IF_NAMESIZE - 1);
+	ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+	memcpy(ifr.ifr_hwaddr.sa_data, addr, ETH_ALEN);
+
+	err = ioctl(sk, SIOCSIFHWADDR, &ifr);
+
+	close(sk);
+
+	return err < 0 ? -errno : 0;
+}
+
+static int bnep_tap_add(int sk, char *dev)
+{
+	struct sockaddr_l2 src, dst;
+	socklen_t len;
+	struct bnep_tap *tap;
+	GIOChannel *io;
+	int err;
+
+	len = sizeof(src);
+	memset(&src, 0, len);
+	if (getsockname(sk, (struct sockaddr *) &src, &len) < 0)
+		return -errno;
+
+	len = sizeof(dst);
+	memset(&dst, 0, len);
+	if (getpeername(sk, (struct sockaddr *) &dst, &len) < 0)
+		return -errno;
+
+	tap = g_new0(struct bnep_tap, 1);
+	bacpy(&tap->dst, &dst.l2_bdaddr);
+	baswap((bdaddr_t *) tap->local, &src.l2_bdaddr);
+	baswap((bdaddr_t *) tap->remote, &dst.l2_bdaddr);
+	tap->fd = -1;
+
+	tap->sk = fcntl(sk, F_DUPFD_CLOEXEC, 0);
+	if (tap->sk < 0) {
+		err = -errno;
+		goto failed;
+	}
+
+	strncpy(tap->iface, dev, 16);
+	tap->iface[15] = '\0';
+
+	tap->fd = tap_open(tap->iface);
+	if (tap->fd < 0) {
+		err = tap->fd;
+		error("Failed to create TAP device %s: %s(%d)", dev,
+							strerror(-err), -err);
+		goto failed;
+	}
+
+	/* Same convention as the kernel module: the adapter address is
+	 * the interface address */
+	err = tap_set_hwaddr(tap->iface, tap->local);
+	if (err < 0)
+		error("Failed to set %s address: %s(%d)", tap->iface,
+							strerror(-err), -err);
+
+	tap->rx_buf = g_malloc(BNEP_BATCH * sizeof(*tap->rx_buf));
+	tap->tx_buf = g_malloc(BNEP_BATCH * sizeof(*tap->tx_buf));
+	tap->tx_hdr = g_malloc(BNEP_BATCH * sizeof(*tap->tx_hdr));
+
+	io = g_io_channel_unix_new(tap->sk);
+	tap->sk_watch = g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP |
+					G_IO_NVAL, tap_sk_cb, tap);
+	g_io_channel_unref(io);
+
+	io = g_io_channel_unix_new(tap->fd);
+	tap->fd_watch = g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP |
+					G_IO_NVAL, tap_fd_cb, tap);
+	g_io_channel_unref(io);
+
+	taps = g_slist_prepend(taps, tap);
+
+	strncpy(dev, tap->iface, 16);
+
+	DBG("%s: userspace data path started", tap->iface);
+
+	return 0;
+
+failed:
+	tap_free(tap);
+	return err;
+}
+
 static int bnep_conndel(const bdaddr_t *dst)
 {
 	struct bnep_conndel_req req;
 
+	if (userspace) {
+		struct bnep_tap *tap = find_tap(dst);
+
+		if (!tap)
+			return -ENOENT;
+
+		taps = g_slist_remove(taps, tap);
+	info("%s: rx %" PRIu64 " packets %" PRIu64 " bytes in %" PRIu64
+		" batches, tx %" PRIu64 " packets %" PRIu64 " bytes in %"
+		PRIu64 " batches, %" PRIu64 " dropped", tap->iface,
+		tap->rx_packets, tap->rx_bytes, tap->rx_batches,
+		tap->tx_packets, tap->tx_bytes, tap->tx_batches,
+		tap->tx_dropped);
+
+		tap_free(tap);
+
+		return 0;
+	}
+
 	memset(&req, 0, sizeof(req));
 	baswap((bdaddr_t *)&req.dst, dst);
 	req.flags = 0;
@@ -175,6 +641,9 @@ static int bnep_connadd(int sk, uint16_t role, char *dev)
 {
 	struct bnep_connadd_req req;
 
+	if (userspace)
+		return bnep_tap_add(sk, dev);
+
 	memset(&req, 0, sizeof(req));
 	strncpy(req.device, dev, 16);
 	req.device[15] = '\0';
@@ -23,6 +23,7 @@
 
 struct bnep;
 
+void bnep_set_userspace(gboolean enable);
 int bnep_init(void);
 int bnep_cleanup(void);
 
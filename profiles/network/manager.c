@@ -49,6 +49,7 @@
 #include "server.h"
 
 static gboolean conf_security = TRUE;
+static gboolean conf_userspace = FALSE;
 
 static void read_config(const char *file)
 {
@@ -69,11 +70,19 @@ static void read_config(const char *file)
 		g_clear_error(&err);
 	}
 
+	conf_userspace = g_key_file_get_boolean(keyfile, "General",
+						"UserspaceBNEP", &err);
+	if (err) {
+		DBG("%s: %s", file, err->message);
+		g_clear_error(&err);
+	}
+
 done:
 	g_key_file_free(keyfile);
 
-	DBG("Config options: Security=%s",
-				conf_security ? "true" : "false");
+	DBG("Config options: Security=%s UserspaceBNEP=%s",
+				conf_security ? "true" : "false",
+				conf_userspace ? "true" : "false");
 }
 
 static int panu_server_probe(struct btd_profile *p, struct btd_adapter *adapter)
@@ -175,6 +184,8 @@ static int network_init(void)
 
 	read_config(CONFIGDIR "/network.conf");
 
+	bnep_set_userspace(conf_userspace);
+
 	err = bnep_init();
 	if (err) {
 		if (err == -EPROTONOSUPPORT)
@@ -33,7 +33,6 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/stat.h>
 #include <glib.h>
 
 #include <bluetooth/bluetooth.h>
@@ -48,7 +47,7 @@
 #include "attrib/gattrib.h"
 #include "attrib/gatt.h"
 #include "src/attio.h"
-#include "src/textfile.h"
+#include "src/worker.h"
 
 #include "monitor.h"
 
@@ -60,6 +59,16 @@
 #define IMMEDIATE_TIMEOUT	5
 #define TX_POWER_SIZE		1
 
+/* Path loss sampling, shared by all monitors */
+#define RSSI_INTERVAL		1	/* seconds between sampling rounds */
+#define RSSI_BATCH		4	/* connections sampled per round */
+#define RSSI_INVALID		127
+
+/* Path loss (dB) upper bounds for "good" and "regular" signal levels */
+#define PATHLOSS_GOOD		65
+#define PATHLOSS_REGULAR	85
+#define PATHLOSS_HYSTERESIS	4
+
 enum {
 	ALERT_NONE = 0,
 	ALERT_MILD,
@@ -83,9 +92,16 @@ struct monitor {
 	uint16_t immediatehandle;	/* Immediate Alert Value Handle */
 	guint immediateto;		/* Reset Immediate Alert to "none" */
 	guint attioid;
+	gboolean has_txpowerlevel;
+	int8_t txpowerlevel;		/* Reporter Tx Power Level (dBm) */
+	gboolean has_pathloss;
+	int pathloss;			/* Smoothed path loss (dB) */
+	gboolean rssi_pending;
 };
 
 static GSList *monitors = NULL;
+static guint rssi_timer = 0;
+static unsigned int rssi_next = 0;
 
 static struct monitor *find_monitor(struct btd_device *device)
 {
@@ -116,7 +132,7 @@ static void write_proximity_config(struct btd_device *device, const char *alert,
 	}
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	if (level)
 		g_key_file_set_string(key_file, alert, "Level", level);
@@ -124,12 +140,10 @@ static void write_proximity_config(struct btd_device *device, const char *alert,
 		g_key_file_remove_group(key_file, alert, NULL);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 	g_free(filename);
 	g_key_file_free(key_file);
 }
@@ -147,7 +161,7 @@ static char *read_proximity_config(struct btd_device *device, const char *alert)
 	}
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	str = g_key_file_get_string(key_file, alert, "Level", NULL);
 
@@ -238,7 +252,9 @@ static int write_alert_level(struct monitor *monitor)
 static void tx_power_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 							gpointer user_data)
 {
+	struct monitor *monitor = user_data;
 	uint8_t value[TX_POWER_SIZE];
+	char level[5];
 	ssize_t vlen;
 
 	if (status != 0) {
@@ -258,6 +274,13 @@ static void tx_power_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 	}
 
 	DBG("Tx Power Level: %02x", (int8_t) value[0]);
+
+	monitor->txpowerlevel = value[0];
+	monitor->has_txpowerlevel = TRUE;
+
+	/* The Tx Power Level is fixed, don't read it on every connection */
+	snprintf(level, sizeof(level), "%d", monitor->txpowerlevel);
+	write_proximity_config(monitor->device, "TxPowerLevel", level);
 }
 
 static void tx_power_handle_cb(uint8_t status, GSList *characteristics,
@@ -297,6 +320,144 @@ static void read_tx_power(struct monitor *monitor)
 				&uuid, tx_power_handle_cb, monitor);
 }
 
+static const char *pathloss2level(const char *current, int pathloss)
+{
+	int good = PATHLOSS_GOOD;
+	int regular = PATHLOSS_REGULAR;
+
+	/* Widen the band of the current level so that readings close to
+	 * a threshold don't make the level flap */
+	if (g_strcmp0(current, "good") == 0)
+		good += PATHLOSS_HYSTERESIS;
+	else if (g_strcmp0(current, "weak") == 0)
+		regular -= PATHLOSS_HYSTERESIS;
+	else if (g_strcmp0(current, "regular") == 0) {
+		good -= PATHLOSS_HYSTERESIS;
+		regular += PATHLOSS_HYSTERESIS;
+	}
+
+	if (pathloss <= good)
+		return "good";
+
+	if (pathloss <= regular)
+		return "regular";
+
+	return "weak";
+}
+
+static void set_signal_level(struct monitor *monitor, const char *level)
+{
+	if (g_strcmp0(monitor->signallevel, level) == 0)
+		return;
+
+	g_free(monitor->signallevel);
+	monitor->signallevel = g_strdup(level);
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(),
+					device_get_path(monitor->device),
+					PROXIMITY_INTERFACE, "SignalLevel");
+}
+
+static void conn_info_cb(uint8_t status, int8_t rssi, int8_t tx_power,
+							void *user_data)
+{
+	struct btd_device *device = user_data;
+	struct monitor *monitor;
+	int pathloss;
+
+	monitor = find_monitor(device);
+	if (monitor == NULL)
+		return;
+
+	monitor->rssi_pending = FALSE;
+
+	if (status != 0 || rssi == RSSI_INVALID || monitor->attrib == NULL)
+		return;
+
+	/* Without the reporter Tx Power Level assume 0 dBm */
+	pathloss = (monitor->has_txpowerlevel ? monitor->txpowerlevel : 0)
+									- rssi;
+
+	if (monitor->has_pathloss)
+		monitor->pathloss = (monitor->pathloss * 3 + pathloss) / 4;
+	else
+		monitor->pathloss = pathloss;
+
+	monitor->has_pathloss = TRUE;
+
+	set_signal_level(monitor, pathloss2level(monitor->signallevel,
+							monitor->pathloss));
+}
+
+static gboolean rssi_sample(struct monitor *monitor)
+{
+	struct btd_device *device = monitor->device;
+
+	if (!monitor->enabled.pathloss || monitor->attrib == NULL)
+		return FALSE;
+
+	if (monitor->rssi_pending)
+		return TRUE;
+
+	if (btd_adapter_get_conn_info(device_get_adapter(device),
+					device_get_address(device),
+					btd_device_get_bdaddr_type(device),
+					conn_info_cb, btd_device_ref(device),
+					(GDestroyNotify) btd_device_unref) < 0) {
+		btd_device_unref(device);
+		return TRUE;
+	}
+
+	monitor->rssi_pending = TRUE;
+
+	return TRUE;
+}
+
+/*
+ * One timer serves every monitored connection: each round samples at
+ * most RSSI_BATCH of them, continuing where the previous round stopped,
+ * so the command rate stays flat however many devices are monitored.
+ */
+static gboolean rssi_timeout(gpointer user_data)
+{
+	unsigned int len = g_slist_length(monitors);
+	unsigned int i, sampled = 0, active = 0;
+
+	for (i = 0; i < len && sampled < RSSI_BATCH; i++) {
+		struct monitor *monitor;
+
+		monitor = g_slist_nth_data(monitors, (rssi_next + i) % len);
+		if (!rssi_sample(monitor))
+			continue;
+
+		active++;
+		if (!monitor->rssi_pending)
+			continue;
+
+		sampled++;
+	}
+
+	if (len > 0)
+		rssi_next = (rssi_next + i) % len;
+
+	if (active > 0)
+		return TRUE;
+
+	DBG("No connection to monitor, stopping path loss sampling");
+
+	rssi_timer = 0;
+
+	return FALSE;
+}
+
+static void rssi_schedule(void)
+{
+	if (rssi_timer > 0)
+		return;
+
+	rssi_timer = g_timeout_add_seconds(RSSI_INTERVAL, rssi_timeout, NULL);
+}
+
 static gboolean immediate_timeout(gpointer user_data)
 {
 	struct monitor *monitor = user_data;
@@ -388,8 +549,12 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 	if (monitor->enabled.linkloss)
 		write_alert_level(monitor);
 
-	if (monitor->enabled.pathloss)
-		read_tx_power(monitor);
+	if (monitor->enabled.pathloss) {
+		if (!monitor->has_txpowerlevel)
+			read_tx_power(monitor);
+
+		rssi_schedule();
+	}
 
 	if (monitor->immediatehandle == 0) {
 		if(monitor->enabled.pathloss || monitor->enabled.findme)
@@ -406,6 +571,10 @@ static void attio_disconnected_cb(gpointer user_data)
 	g_attrib_unref(monitor->attrib);
 	monitor->attrib = NULL;
 
+	monitor->has_pathloss = FALSE;
+	if (monitor->enabled.pathloss)
+		set_signal_level(monitor, "unknown");
+
 	if (monitor->immediateto == 0)
 		return;
 
@@ -702,6 +871,7 @@ int monitor_register_txpower(struct btd_device *device,
 						struct gatt_primary *txpower)
 {
 	struct monitor *monitor;
+	char *level;
 
 	if (!enabled->pathloss)
 		return 0;
@@ -714,6 +884,13 @@ int monitor_register_txpower(struct btd_device *device,
 	monitor->txpower->start = txpower->range.start;
 	monitor->txpower->end = txpower->range.end;
 
+	level = read_proximity_config(device, "TxPowerLevel");
+	if (level) {
+		monitor->txpowerlevel = atoi(level);
+		monitor->has_txpowerlevel = TRUE;
+		g_free(level);
+	}
+
 	update_monitor(monitor);
 
 	return 0;
@@ -267,6 +267,11 @@ static void scan_param_exit(void)
 	btd_profile_unregister(&scan_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(scanparam, VERSION,
+static const char * const scan_param_uuids[] = {
+	SCAN_PARAMETERS_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(scanparam, VERSION,
 			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-			scan_param_init, scan_param_exit)
+			scan_param_init, scan_param_exit, scan_param_uuids)
@@ -48,6 +48,20 @@
 #define THERMOMETER_MANAGER_INTERFACE	"org.bluez.ThermometerManager1"
 #define THERMOMETER_WATCHER_INTERFACE	"org.bluez.ThermometerWatcher1"
 
+#define BATCH_INTERVAL		1000	/* ms */
+#define BATCH_INTERVAL_MAX	60000
+#define BATCH_COUNT		32
+#define BATCH_COUNT_MAX		256
+
+#define BATCH_ENTRY_SIGNATURE	DBUS_STRUCT_BEGIN_CHAR_AS_STRING	\
+				DBUS_TYPE_OBJECT_PATH_AS_STRING		\
+				DBUS_TYPE_ARRAY_AS_STRING		\
+				DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING	\
+				DBUS_TYPE_STRING_AS_STRING		\
+				DBUS_TYPE_VARIANT_AS_STRING		\
+				DBUS_DICT_ENTRY_END_CHAR_AS_STRING	\
+				DBUS_STRUCT_END_CHAR_AS_STRING
+
 /* Temperature measurement flag fields */
 #define TEMP_UNITS		0x01
 #define TEMP_TIME_STAMP		0x02
@@ -59,6 +73,9 @@
 #define TEMPERATURE_TYPE_SIZE	1
 #define MEASUREMENT_INTERVAL_SIZE	2
 
+/* Temperature Type and Measurement Interval are read at connection */
+#define MAX_READS		2
+
 struct thermometer_adapter {
 	struct btd_adapter	*adapter;
 	GSList			*devices;
@@ -101,6 +118,15 @@ struct watcher {
 	guint				id;
 	char				*srv;
 	char				*path;
+
+	/* Batched delivery, disabled when interval is 0 */
+	uint16_t			interval;
+	uint16_t			count;
+	uint16_t			pending;
+	guint				flush_id;
+	DBusMessage			*batch;
+	DBusMessageIter			batch_iter;
+	DBusMessageIter			batch_array;
 };
 
 struct measurement {
@@ -147,6 +173,12 @@ static void destroy_watcher(gpointer user_data)
 {
 	struct watcher *watcher = user_data;
 
+	if (watcher->flush_id > 0)
+		g_source_remove(watcher->flush_id);
+
+	if (watcher->batch != NULL)
+		dbus_message_unref(watcher->batch);
+
 	g_free(watcher->path);
 	g_free(watcher->srv);
 	g_free(watcher);
@@ -274,26 +306,14 @@ static void change_property(struct thermometer *t, const char *name,
 						THERMOMETER_INTERFACE, name);
 }
 
-static void update_watcher(gpointer data, gpointer user_data)
+static void append_measurement(DBusMessageIter *iter, struct measurement *m)
 {
-	struct watcher *w = data;
-	struct measurement *m = user_data;
 	const char *path = device_get_path(m->t->dev);
-	DBusMessageIter iter;
 	DBusMessageIter dict;
-	DBusMessage *msg;
 
-	msg = dbus_message_new_method_call(w->srv, w->path,
-				THERMOMETER_WATCHER_INTERFACE,
-				"MeasurementReceived");
-	if (msg == NULL)
-		return;
-
-	dbus_message_iter_init_append(msg, &iter);
-
-	dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH , &path);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH , &path);
 
-	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
 			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
 			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
@@ -308,7 +328,81 @@ static void update_watcher(gpointer data, gpointer user_data)
 	dict_append_entry(&dict, "Type", DBUS_TYPE_STRING, &m->type);
 	dict_append_entry(&dict, "Measurement", DBUS_TYPE_STRING, &m->value);
 
-	dbus_message_iter_close_container(&iter, &dict);
+	dbus_message_iter_close_container(iter, &dict);
+}
+
+static gboolean flush_batch(gpointer user_data)
+{
+	struct watcher *w = user_data;
+
+	w->flush_id = 0;
+
+	if (w->batch == NULL)
+		return FALSE;
+
+	dbus_message_iter_close_container(&w->batch_iter, &w->batch_array);
+
+	dbus_message_set_no_reply(w->batch, TRUE);
+	g_dbus_send_message(btd_get_dbus_connection(), w->batch);
+
+	w->batch = NULL;
+	w->pending = 0;
+
+	return FALSE;
+}
+
+static void batch_measurement(struct watcher *w, struct measurement *m)
+{
+	DBusMessageIter entry;
+
+	if (w->batch == NULL) {
+		w->batch = dbus_message_new_method_call(w->srv, w->path,
+						THERMOMETER_WATCHER_INTERFACE,
+						"MeasurementsReceived");
+		if (w->batch == NULL)
+			return;
+
+		dbus_message_iter_init_append(w->batch, &w->batch_iter);
+		dbus_message_iter_open_container(&w->batch_iter,
+					DBUS_TYPE_ARRAY, BATCH_ENTRY_SIGNATURE,
+					&w->batch_array);
+
+		w->flush_id = g_timeout_add(w->interval, flush_batch, w);
+	}
+
+	dbus_message_iter_open_container(&w->batch_array, DBUS_TYPE_STRUCT,
+								NULL, &entry);
+	append_measurement(&entry, m);
+	dbus_message_iter_close_container(&w->batch_array, &entry);
+
+	if (++w->pending < w->count)
+		return;
+
+	g_source_remove(w->flush_id);
+	flush_batch(w);
+}
+
+static void update_watcher(gpointer data, gpointer user_data)
+{
+	struct watcher *w = data;
+	struct measurement *m = user_data;
+	DBusMessageIter iter;
+	DBusMessage *msg;
+
+	if (w->interval > 0) {
+		batch_measurement(w, m);
+		return;
+	}
+
+	msg = dbus_message_new_method_call(w->srv, w->path,
+				THERMOMETER_WATCHER_INTERFACE,
+				"MeasurementReceived");
+	if (msg == NULL)
+		return;
+
+	dbus_message_iter_init_append(msg, &iter);
+
+	append_measurement(&iter, m);
 
 	dbus_message_set_no_reply(msg, TRUE);
 	g_dbus_send_message(btd_get_dbus_connection(), msg);
@@ -677,7 +771,9 @@ static void read_interval_cb(guint8 status, const guint8 *pdu, guint16 len,
 }
 
 static void process_thermometer_char(struct thermometer *t,
-				struct gatt_char *c, struct gatt_char *c_next)
+				struct gatt_char *c, struct gatt_char *c_next,
+				struct gatt_read_req *reads,
+				unsigned int *num_reads)
 {
 	if (g_strcmp0(c->uuid, INTERMEDIATE_TEMPERATURE_UUID) == 0) {
 		gboolean intermediate = TRUE;
@@ -696,12 +792,17 @@ static void process_thermometer_char(struct thermometer *t,
 
 		discover_desc(t, c, c_next);
 	} else if (g_strcmp0(c->uuid, TEMPERATURE_TYPE_UUID) == 0) {
-		gatt_read_char(t->attrib, c->value_handle,
-							read_temp_type_cb, t);
+		if (*num_reads < MAX_READS) {
+			reads[*num_reads].handle = c->value_handle;
+			reads[(*num_reads)++].func = read_temp_type_cb;
+		}
 	} else if (g_strcmp0(c->uuid, MEASUREMENT_INTERVAL_UUID) == 0) {
 		bool need_desc = false;
 
-		gatt_read_char(t->attrib, c->value_handle, read_interval_cb, t);
+		if (*num_reads < MAX_READS) {
+			reads[*num_reads].handle = c->value_handle;
+			reads[(*num_reads)++].func = read_interval_cb;
+		}
 
 		if (c->properties & GATT_CHR_PROP_WRITE) {
 			t->interval_val_handle = c->value_handle;
@@ -724,6 +825,8 @@ static void configure_thermometer_cb(uint8_t status, GSList *characteristics,
 								void *user_data)
 {
 	struct thermometer *t = user_data;
+	struct gatt_read_req reads[MAX_READS];
+	unsigned int num_reads = 0;
 	GSList *l;
 
 	if (status != 0) {
@@ -736,8 +839,10 @@ static void configure_thermometer_cb(uint8_t status, GSList *characteristics,
 		struct gatt_char *c = l->data;
 		struct gatt_char *c_next = (l->next ? l->next->data : NULL);
 
-		process_thermometer_char(t, c, c_next);
+		process_thermometer_char(t, c, c_next, reads, &num_reads);
 	}
+
+	gatt_read_chars_multi(t->attrib, reads, num_reads, NULL, t);
 }
 
 static void write_interval_cb(guint8 status, const guint8 *pdu, guint16 len,
@@ -879,17 +984,13 @@ static struct watcher *find_watcher(GSList *list, const char *sender,
 	return NULL;
 }
 
-static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
-								void *data)
+static DBusMessage *add_watcher(DBusConnection *conn, DBusMessage *msg,
+				struct thermometer_adapter *tadapter,
+				const char *path, uint16_t interval,
+				uint16_t count)
 {
 	const char *sender = dbus_message_get_sender(msg);
-	struct thermometer_adapter *tadapter = data;
 	struct watcher *watcher;
-	char *path;
-
-	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
-							DBUS_TYPE_INVALID))
-		return btd_error_invalid_args(msg);
 
 	watcher = find_watcher(tadapter->fwatchers, sender, path);
 	if (watcher != NULL)
@@ -901,6 +1002,8 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 	watcher->srv = g_strdup(sender);
 	watcher->path = g_strdup(path);
 	watcher->tadapter = tadapter;
+	watcher->interval = interval;
+	watcher->count = count;
 	watcher->id = g_dbus_add_disconnect_watch(conn, sender, watcher_exit,
 						watcher, destroy_watcher);
 
@@ -912,6 +1015,85 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct thermometer_adapter *tadapter = data;
+	char *path;
+
+	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
+							DBUS_TYPE_INVALID))
+		return btd_error_invalid_args(msg);
+
+	return add_watcher(conn, msg, tadapter, path, 0, 0);
+}
+
+static bool parse_batch_options(DBusMessageIter *iter, uint16_t *interval,
+							uint16_t *count)
+{
+	DBusMessageIter dict;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(iter, &dict);
+
+	while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry, value;
+		const char *key;
+
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &value);
+
+		if (dbus_message_iter_get_arg_type(&value) != DBUS_TYPE_UINT16)
+			return false;
+
+		if (g_str_equal(key, "Interval"))
+			dbus_message_iter_get_basic(&value, interval);
+		else if (g_str_equal(key, "Count"))
+			dbus_message_iter_get_basic(&value, count);
+		else
+			return false;
+
+		dbus_message_iter_next(&dict);
+	}
+
+	if (*interval == 0 || *interval > BATCH_INTERVAL_MAX)
+		return false;
+
+	if (*count == 0 || *count > BATCH_COUNT_MAX)
+		return false;
+
+	return true;
+}
+
+static DBusMessage *register_batch_watcher(DBusConnection *conn,
+						DBusMessage *msg, void *data)
+{
+	struct thermometer_adapter *tadapter = data;
+	uint16_t interval = BATCH_INTERVAL;
+	uint16_t count = BATCH_COUNT;
+	DBusMessageIter iter;
+	const char *path;
+
+	if (!dbus_message_iter_init(msg, &iter))
+		return btd_error_invalid_args(msg);
+
+	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH)
+		return btd_error_invalid_args(msg);
+
+	dbus_message_iter_get_basic(&iter, &path);
+	dbus_message_iter_next(&iter);
+
+	if (!parse_batch_options(&iter, &interval, &count))
+		return btd_error_invalid_args(msg);
+
+	return add_watcher(conn, msg, tadapter, path, interval, count);
+}
+
 static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 								void *data)
 {
@@ -1216,6 +1398,9 @@ static const GDBusMethodTable thermometer_manager_methods[] = {
 	{ GDBUS_METHOD("UnregisterWatcher",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
 			unregister_watcher) },
+	{ GDBUS_METHOD("RegisterBatchWatcher",
+			GDBUS_ARGS({ "agent", "o" }, { "options", "a{sv}" }),
+			NULL, register_batch_watcher) },
 	{ GDBUS_METHOD("EnableIntermediateMeasurement",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
 			enable_intermediate) },
@@ -69,6 +69,8 @@
 #include "attrib/gatt.h"
 #include "attrib-server.h"
 #include "eir.h"
+#include "worker.h"
+#include "memstat.h"
 
 #define ADAPTER_INTERFACE	"org.bluez.Adapter1"
 
@@ -78,9 +80,12 @@
 #define MODE_UNKNOWN		0xff
 
 #define CONN_SCAN_TIMEOUT (3)
+#define CONN_SEEN_TIMEOUT (5)
 #define IDLE_DISCOV_TIMEOUT (5)
+#define STOP_DISCOV_DELAY (2)
 #define TEMP_DEV_TIMEOUT (3 * 60)
 #define BONDING_TIMEOUT (2 * 60)
+#define OOB_REFRESH_DELAY (30)
 
 static DBusConnection *dbus_conn = NULL;
 
@@ -152,6 +157,13 @@ struct service_auth {
 	struct agent *agent;		/* NULL for queued auths */
 };
 
+struct conn_req {
+	struct btd_device *device;
+	uint8_t priority;		/* Higher ones get connected first */
+	gint64 queued;			/* Waiting to (re)connect since */
+	gint64 last_seen;		/* Last advertising report */
+};
+
 struct btd_adapter_pin_cb_iter {
 	GSList *it;			/* current callback function */
 	unsigned int attempt;		/* numer of times it() was called */
@@ -163,6 +175,7 @@ struct btd_adapter {
 
 	uint16_t dev_id;
 	struct mgmt *mgmt;
+	gint64 init_start;		/* index added time during setup */
 
 	bdaddr_t bdaddr;		/* controller Bluetooth address */
 	uint32_t dev_class;		/* controller class of device */
@@ -190,6 +203,7 @@ struct btd_adapter {
 	GSList *discovery_list;		/* list of discovery clients */
 	GSList *discovery_found;	/* list of found devices */
 	guint discovery_idle_timeout;	/* timeout between discovery runs */
+	guint discovery_stop_timeout;	/* timeout before stopping discovery */
 	guint passive_scan_timeout;	/* timeout between passive scans */
 	guint temp_devices_timeout;	/* timeout for temporary devices */
 
@@ -199,8 +213,12 @@ struct btd_adapter {
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
-	GSList *connect_list;		/* Devices to connect when found */
+	GHashTable *devices_addr;	/* Devices indexed by address */
+	GHashTable *devices_path;	/* Devices indexed by object path */
+	GSList *connect_list;		/* conn_req of devices to connect */
+	GSList *conn_params;		/* LE connection parameters loaded */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
+	struct btd_device *connect_pending; /* LE device being connected */
 	sdp_list_t *services;		/* Services associated to adapter */
 
 	gboolean initialized;
@@ -212,6 +230,13 @@ struct btd_adapter {
 
 	struct oob_handler *oob_handler;
 
+	bool oob_prefetch;		/* Keep local OOB data ready */
+	bool oob_reading;		/* Read Local OOB Data pending */
+	bool oob_cached;		/* oob_hash/oob_randomizer valid */
+	uint8_t oob_hash[16];
+	uint8_t oob_randomizer[16];
+	guint oob_refresh_id;
+
 	unsigned int load_ltks_id;
 	guint load_ltks_timeout;
 
@@ -424,11 +449,8 @@ static void store_adapter_info(struct btd_adapter *adapter)
 	ba2str(&adapter->bdaddr, address);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings", address);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	btd_worker_store_file(filename, str, length);
 
 	g_key_file_free(key_file);
 }
@@ -436,6 +458,8 @@ static void store_adapter_info(struct btd_adapter *adapter)
 static void trigger_pairable_timeout(struct btd_adapter *adapter);
 static void adapter_start(struct btd_adapter *adapter);
 static void adapter_stop(struct btd_adapter *adapter);
+static void prefetch_local_oob_data(struct btd_adapter *adapter);
+static void invalidate_local_oob_data(struct btd_adapter *adapter);
 static void trigger_passive_scanning(struct btd_adapter *adapter);
 static bool set_mode(struct btd_adapter *adapter, uint16_t opcode,
 							uint8_t mode);
@@ -456,8 +480,10 @@ static void settings_changed(struct btd_adapter *adapter, uint32_t settings)
 
 		if (adapter->current_settings & MGMT_SETTING_POWERED) {
 			adapter_start(adapter);
+			prefetch_local_oob_data(adapter);
 		} else {
 			adapter_stop(adapter);
+			invalidate_local_oob_data(adapter);
 
 			if (powering_down) {
 				adapter_remaining--;
@@ -468,6 +494,13 @@ static void settings_changed(struct btd_adapter *adapter, uint32_t settings)
 		}
 	}
 
+	if (changed_mask & MGMT_SETTING_SSP) {
+		if (adapter->current_settings & MGMT_SETTING_SSP)
+			prefetch_local_oob_data(adapter);
+		else
+			invalidate_local_oob_data(adapter);
+	}
+
 	if (changed_mask & MGMT_SETTING_LE) {
 		if ((adapter->current_settings & MGMT_SETTING_POWERED) &&
 				(adapter->current_settings & MGMT_SETTING_LE))
@@ -735,6 +768,83 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+
+	return bdaddr->b[0] | bdaddr->b[1] << 8 | bdaddr->b[2] << 16 |
+			(bdaddr->b[3] ^ bdaddr->b[4] ^ bdaddr->b[5]) << 24;
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return bacmp(a, b) == 0;
+}
+
+static guint path_hash(gconstpointer key)
+{
+	const char *path = key;
+	guint hash = 5381;
+
+	for (; *path; path++)
+		hash = (hash << 5) + hash + g_ascii_tolower(*path);
+
+	return hash;
+}
+
+static gboolean path_equal(gconstpointer a, gconstpointer b)
+{
+	return strcasecmp(a, b) == 0;
+}
+
+static void device_index_add(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	GSList *list;
+
+	/*
+	 * Devices sharing an address (e.g. a BR/EDR and an LE random
+	 * identity) are kept in insertion order within the bucket so that
+	 * lookups resolve to the same device a linear scan would.
+	 */
+	list = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	if (list)
+		list = g_slist_append(list, device);
+	else
+		g_hash_table_insert(adapter->devices_addr,
+					g_memdup(bdaddr, sizeof(*bdaddr)),
+					g_slist_prepend(NULL, device));
+
+	g_hash_table_insert(adapter->devices_path,
+				(gpointer) device_get_path(device), device);
+}
+
+static void device_index_remove(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	const bdaddr_t *bdaddr = device_get_address(device);
+	gpointer key, list;
+
+	if (g_hash_table_lookup_extended(adapter->devices_addr, bdaddr,
+								&key, &list)) {
+		g_hash_table_steal(adapter->devices_addr, bdaddr);
+
+		list = g_slist_remove(list, device);
+		if (list)
+			g_hash_table_insert(adapter->devices_addr, key, list);
+		else
+			g_free(key);
+	}
+
+	g_hash_table_remove(adapter->devices_path, device_get_path(device));
+}
+
+static void device_list_free(gpointer data)
+{
+	g_slist_free(data);
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
@@ -749,8 +859,8 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
+	list = g_hash_table_lookup(adapter->devices_addr, dst);
+	list = g_slist_find_custom(list, &addr, device_addr_type_cmp);
 	if (!list)
 		return NULL;
 
@@ -1071,10 +1181,84 @@ static struct btd_device *adapter_create_device(struct btd_adapter *adapter,
 		return NULL;
 
 	adapter->devices = g_slist_append(adapter->devices, device);
+	device_index_add(adapter, device);
 
 	return device;
 }
 
+static gint conn_req_cmp_device(gconstpointer a, gconstpointer b)
+{
+	const struct conn_req *req = a;
+
+	return req->device == b ? 0 : -1;
+}
+
+static struct conn_req *find_conn_req(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	GSList *l;
+
+	l = g_slist_find_custom(adapter->connect_list, device,
+							conn_req_cmp_device);
+	if (!l)
+		return NULL;
+
+	return l->data;
+}
+
+/* Keeps the list by priority, first come first served within one */
+static gint conn_req_cmp_priority(gconstpointer a, gconstpointer b)
+{
+	const struct conn_req *req = a;
+	const struct conn_req *other = b;
+
+	return req->priority > other->priority ? -1 : 1;
+}
+
+static struct conn_req *conn_req_add(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct conn_req *req;
+
+	req = g_new0(struct conn_req, 1);
+	btd_mem_add(BTD_MEM_CONN_REQ, 1, sizeof(*req));
+	req->device = device;
+	req->priority = btd_device_get_conn_priority(device);
+
+	if (!btd_device_is_connected(device))
+		req->queued = g_get_monotonic_time();
+
+	adapter->connect_list = g_slist_insert_sorted(adapter->connect_list,
+						req, conn_req_cmp_priority);
+
+	return req;
+}
+
+static void conn_req_remove(struct btd_adapter *adapter,
+						struct conn_req *req)
+{
+	adapter->connect_list = g_slist_remove(adapter->connect_list, req);
+	btd_mem_remove(BTD_MEM_CONN_REQ, 1, sizeof(*req));
+	g_free(req);
+}
+
+static void conn_req_report(struct conn_req *req)
+{
+	char addr[18];
+	gint64 elapsed;
+
+	if (!req->queued)
+		return;
+
+	elapsed = (g_get_monotonic_time() - req->queued) / 1000;
+	req->queued = 0;
+
+	ba2str(device_get_address(req->device), addr);
+
+	info("%s reconnected after %" G_GINT64_FORMAT " ms (priority %u)",
+						addr, elapsed, req->priority);
+}
+
 static void service_auth_cancel(struct service_auth *auth)
 {
 	DBusError derr;
@@ -1100,10 +1284,14 @@ void btd_adapter_remove_device(struct btd_adapter *adapter,
 				struct btd_device *dev)
 {
 	GList *l;
+	struct conn_req *req;
 
-	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
+	req = find_conn_req(adapter, dev);
+	if (req)
+		conn_req_remove(adapter, req);
 
 	adapter->devices = g_slist_remove(adapter->devices, dev);
+	device_index_remove(adapter, dev);
 
 	adapter->discovery_found = g_slist_remove(adapter->discovery_found,
 									dev);
@@ -1113,6 +1301,9 @@ void btd_adapter_remove_device(struct btd_adapter *adapter,
 	if (adapter->connect_le == dev)
 		adapter->connect_le = NULL;
 
+	if (adapter->connect_pending == dev)
+		adapter->connect_pending = NULL;
+
 	l = adapter->auths->head;
 	while (l != NULL) {
 		struct service_auth *auth = l->data;
@@ -1188,6 +1379,14 @@ static gboolean passive_scanning_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static void cancel_stop_discovery(struct btd_adapter *adapter)
+{
+	if (adapter->discovery_stop_timeout > 0) {
+		g_source_remove(adapter->discovery_stop_timeout);
+		adapter->discovery_stop_timeout = 0;
+	}
+}
+
 static void trigger_passive_scanning(struct btd_adapter *adapter)
 {
 	if (!(adapter->current_settings & MGMT_SETTING_LE))
@@ -1239,12 +1438,62 @@ static void trigger_passive_scanning(struct btd_adapter *adapter)
 					passive_scanning_timeout, adapter);
 }
 
+/*
+ * Devices that advertised within the last few seconds are most likely
+ * still around, so they can be connected without another scan. The list
+ * is sorted, the first one found has the highest priority.
+ */
+static struct btd_device *next_conn_req(struct btd_adapter *adapter)
+{
+	gint64 now = g_get_monotonic_time();
+	GSList *l;
+
+	for (l = adapter->connect_list; l; l = g_slist_next(l)) {
+		struct conn_req *req = l->data;
+
+		if (!req->last_seen)
+			continue;
+
+		if (now - req->last_seen > CONN_SEEN_TIMEOUT * G_USEC_PER_SEC)
+			continue;
+
+		if (btd_device_is_connected(req->device))
+			continue;
+
+		return req->device;
+	}
+
+	return NULL;
+}
+
+static int connect_conn_req(struct btd_adapter *adapter,
+						struct btd_device *dev)
+{
+	struct conn_req *req;
+	int err;
+
+	/* It has to be seen again before any retry */
+	req = find_conn_req(adapter, dev);
+	if (req)
+		req->last_seen = 0;
+
+	adapter->connect_pending = dev;
+
+	err = device_connect_le(dev);
+	if (err < 0) {
+		error("LE auto connection failed: %s (%d)",
+						strerror(-err), -err);
+		adapter->connect_pending = NULL;
+	}
+
+	return err;
+}
+
 static void stop_passive_scanning_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
-	struct btd_device *dev;
-	int err;
+	struct btd_device *dev, *next;
 
 	DBG("status 0x%02x (%s)", status, mgmt_errstr(status));
 
@@ -1273,18 +1522,22 @@ static void stop_passive_scanning_complete(uint8_t status, uint16_t length,
 	adapter->discovery_type = 0x00;
 	adapter->discovery_enable = 0x00;
 
+	/*
+	 * Other devices may have shown up while stopping, go for the one
+	 * with the highest priority.
+	 */
+	next = next_conn_req(adapter);
+	if (next)
+		dev = next;
+
 	if (!dev) {
 		DBG("Device removed while stopping passive scanning");
 		trigger_passive_scanning(adapter);
 		return;
 	}
 
-	err = device_connect_le(dev);
-	if (err < 0) {
-		error("LE auto connection failed: %s (%d)",
-						strerror(-err), -err);
+	if (connect_conn_req(adapter, dev) < 0)
 		trigger_passive_scanning(adapter);
-	}
 }
 
 static void stop_passive_scanning(struct btd_adapter *adapter)
@@ -1301,6 +1554,8 @@ static void stop_passive_scanning(struct btd_adapter *adapter)
 	if (adapter->discovery_enable == 0x00)
 		return;
 
+	cancel_stop_discovery(adapter);
+
 	cp.type = adapter->discovery_type;
 
 	mgmt_send(adapter->mgmt, MGMT_OP_STOP_DISCOVERY,
@@ -1308,6 +1563,33 @@ static void stop_passive_scanning(struct btd_adapter *adapter)
 			stop_passive_scanning_complete, adapter, NULL);
 }
 
+/*
+ * LE Create Connection allows a single attempt at a time. Rather than
+ * going through another passive scanning round, start the next one as
+ * soon as the previous attempt is done if a device is known to be around.
+ */
+static void connect_next(struct btd_adapter *adapter)
+{
+	struct btd_device *dev;
+
+	dev = next_conn_req(adapter);
+	if (!dev || adapter->connect_le || adapter->connect_pending ||
+						adapter->discovery_list) {
+		trigger_passive_scanning(adapter);
+		return;
+	}
+
+	/* Passive scanning is still running, connect once it stopped */
+	if (adapter->discovery_enable == 0x01) {
+		adapter->connect_le = dev;
+		stop_passive_scanning(adapter);
+		return;
+	}
+
+	if (connect_conn_req(adapter, dev) < 0)
+		trigger_passive_scanning(adapter);
+}
+
 static void cancel_passive_scanning(struct btd_adapter *adapter)
 {
 	if (!(adapter->current_settings & MGMT_SETTING_LE))
@@ -1418,6 +1700,7 @@ static void trigger_start_discovery(struct btd_adapter *adapter, guint delay)
 	DBG("");
 
 	cancel_passive_scanning(adapter);
+	cancel_stop_discovery(adapter);
 
 	if (adapter->discovery_idle_timeout > 0) {
 		g_source_remove(adapter->discovery_idle_timeout);
@@ -1536,6 +1819,9 @@ static void discovering_callback(uint16_t index, uint16_t length,
 	 * passive scanning attempt.
 	 */
 	if (!adapter->discovery_list) {
+		if (!adapter->discovery_enable)
+			cancel_stop_discovery(adapter);
+
 		if (!adapter->connect_le)
 			trigger_passive_scanning(adapter);
 		return;
@@ -1569,14 +1855,69 @@ static void stop_discovery_complete(uint8_t status, uint16_t length,
 		adapter->discovery_type = 0x00;
 		adapter->discovery_enable = 0x00;
 
-		adapter->discovering = false;
-		g_dbus_emit_property_changed(dbus_conn, adapter->path,
+		if (adapter->discovering) {
+			adapter->discovering = false;
+			g_dbus_emit_property_changed(dbus_conn, adapter->path,
 					ADAPTER_INTERFACE, "Discovering");
+		}
 
 		trigger_passive_scanning(adapter);
 	}
 }
 
+static gboolean stop_discovery_timeout(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+	struct mgmt_cp_stop_discovery cp;
+
+	DBG("");
+
+	adapter->discovery_stop_timeout = 0;
+
+	if (adapter->discovery_list)
+		return FALSE;
+
+	if (adapter->discovery_enable == 0x00) {
+		trigger_passive_scanning(adapter);
+		return FALSE;
+	}
+
+	cp.type = adapter->discovery_type;
+
+	mgmt_send(adapter->mgmt, MGMT_OP_STOP_DISCOVERY,
+				adapter->dev_id, sizeof(cp), &cp,
+				stop_discovery_complete, adapter, NULL);
+
+	return FALSE;
+}
+
+static void schedule_stop_discovery(struct btd_adapter *adapter)
+{
+	adapter->discovering = false;
+	g_dbus_emit_property_changed(dbus_conn, adapter->path,
+					ADAPTER_INTERFACE, "Discovering");
+
+	/*
+	 * In the idle phase of a discovery, there is nothing to stop
+	 * and passive scanning can take over right away.
+	 */
+	if (adapter->discovery_enable == 0x00) {
+		trigger_passive_scanning(adapter);
+		return;
+	}
+
+	/*
+	 * Keep the controller scanning for a little while. Clients that
+	 * stop and start discovery in quick succession can then pick up
+	 * the running discovery instead of forcing a restart.
+	 */
+	cancel_stop_discovery(adapter);
+
+	adapter->discovery_stop_timeout =
+			g_timeout_add_seconds(STOP_DISCOV_DELAY,
+					stop_discovery_timeout, adapter);
+}
+
 static int compare_sender(gconstpointer a, gconstpointer b)
 {
 	const struct watch_client *client = a;
@@ -1661,7 +2002,6 @@ static void discovery_disconnect(DBusConnection *conn, void *user_data)
 {
 	struct watch_client *client = user_data;
 	struct btd_adapter *adapter = client->adapter;
-	struct mgmt_cp_stop_discovery cp;
 
 	DBG("owner %s", client->owner);
 
@@ -1678,24 +2018,7 @@ static void discovery_disconnect(DBusConnection *conn, void *user_data)
 	if (adapter->discovery_list)
 		return;
 
-	/*
-	 * In the idle phase of a discovery, there is no need to stop it
-	 * and so it is enough to send out the signal and just return.
-	 */
-	if (adapter->discovery_enable == 0x00) {
-		adapter->discovering = false;
-		g_dbus_emit_property_changed(dbus_conn, adapter->path,
-					ADAPTER_INTERFACE, "Discovering");
-
-		trigger_passive_scanning(adapter);
-		return;
-	}
-
-	cp.type = adapter->discovery_type;
-
-	mgmt_send(adapter->mgmt, MGMT_OP_STOP_DISCOVERY,
-				adapter->dev_id, sizeof(cp), &cp,
-				stop_discovery_complete, adapter, NULL);
+	schedule_stop_discovery(adapter);
 }
 
 static DBusMessage *start_discovery(DBusConnection *conn,
@@ -1746,7 +2069,6 @@ static DBusMessage *stop_discovery(DBusConnection *conn,
 {
 	struct btd_adapter *adapter = user_data;
 	const char *sender = dbus_message_get_sender(msg);
-	struct mgmt_cp_stop_discovery cp;
 	struct watch_client *client;
 	GSList *list;
 
@@ -1762,8 +2084,6 @@ static DBusMessage *stop_discovery(DBusConnection *conn,
 
 	client = list->data;
 
-	cp.type = adapter->discovery_type;
-
 	/*
 	 * The destroy function will cleanup the client information and
 	 * also remove it from the list of discovery clients.
@@ -1777,23 +2097,7 @@ static DBusMessage *stop_discovery(DBusConnection *conn,
 	if (adapter->discovery_list)
 		return dbus_message_new_method_return(msg);
 
-	/*
-	 * In the idle phase of a discovery, there is no need to stop it
-	 * and so it is enough to send out the signal and just return.
-	 */
-	if (adapter->discovery_enable == 0x00) {
-		adapter->discovering = false;
-		g_dbus_emit_property_changed(dbus_conn, adapter->path,
-					ADAPTER_INTERFACE, "Discovering");
-
-		trigger_passive_scanning(adapter);
-
-		return dbus_message_new_method_return(msg);
-	}
-
-	mgmt_send(adapter->mgmt, MGMT_OP_STOP_DISCOVERY,
-				adapter->dev_id, sizeof(cp), &cp,
-				stop_discovery_complete, adapter, NULL);
+	schedule_stop_discovery(adapter);
 
 	return dbus_message_new_method_return(msg);
 }
@@ -2231,36 +2535,24 @@ static gboolean property_get_modalias(const GDBusPropertyTable *property,
 	return TRUE;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 static DBusMessage *remove_device(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *device;
 	const char *path;
-	GSList *list;
 
 	if (dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = g_hash_table_lookup(adapter->devices_path, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, TRUE);
 
 	if (!btd_device_is_connected(device)) {
@@ -2862,6 +3154,7 @@ static void load_devices(struct btd_adapter *adapter)
 		struct irk_info *irk_info;
 		struct conn_param *param;
 		uint8_t bdaddr_type;
+		bdaddr_t addr;
 
 		if (entry->d_type == DT_UNKNOWN)
 			entry->d_type = util_get_dt(dirname, entry->d_name);
@@ -2873,27 +3166,31 @@ static void load_devices(struct btd_adapter *adapter)
 				entry->d_name);
 
 		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		btd_worker_load_key_file(key_file, filename);
 
+		/*
+		 * The order of the keys does not matter to the kernel, so
+		 * prepend to keep this linear with many bonded devices.
+		 */
 		key_info = get_key_info(key_file, entry->d_name);
 		if (key_info)
-			keys = g_slist_append(keys, key_info);
+			keys = g_slist_prepend(keys, key_info);
 
 		bdaddr_type = get_le_addr_type(key_file);
 
 		ltk_info = get_ltk_info(key_file, entry->d_name, bdaddr_type);
-		ltks = g_slist_concat(ltks, ltk_info);
+		ltks = g_slist_concat(ltk_info, ltks);
 
 		irk_info = get_irk_info(key_file, entry->d_name, bdaddr_type);
 		if (irk_info)
-			irks = g_slist_append(irks, irk_info);
+			irks = g_slist_prepend(irks, irk_info);
 
 		param = get_conn_param(key_file, entry->d_name, bdaddr_type);
 		if (param)
-			params = g_slist_append(params, param);
+			params = g_slist_prepend(params, param);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
+		str2ba(entry->d_name, &addr);
+		list = g_hash_table_lookup(adapter->devices_addr, &addr);
 		if (list) {
 			device = list->data;
 			goto device_exist;
@@ -2905,7 +3202,8 @@ static void load_devices(struct btd_adapter *adapter)
 			goto free;
 
 		btd_device_set_temporary(device, FALSE);
-		adapter->devices = g_slist_append(adapter->devices, device);
+		adapter->devices = g_slist_prepend(adapter->devices, device);
+		device_index_add(adapter, device);
 
 		/* TODO: register services from pre-loaded list of primaries */
 
@@ -2937,8 +3235,10 @@ free:
 	g_slist_free_full(ltks, g_free);
 	load_irks(adapter, irks);
 	g_slist_free_full(irks, g_free);
-	load_conn_params(adapter, params);
-	g_slist_free_full(params, g_free);
+
+	g_slist_free_full(adapter->conn_params, g_free);
+	adapter->conn_params = params;
+	load_conn_params(adapter, adapter->conn_params);
 }
 
 int btd_adapter_block_address(struct btd_adapter *adapter,
@@ -3062,8 +3362,14 @@ static void adapter_add_connection(struct btd_adapter *adapter,
 						struct btd_device *device,
 						uint8_t bdaddr_type)
 {
+	struct conn_req *req;
+
 	device_add_connection(device, bdaddr_type);
 
+	req = find_conn_req(adapter, device);
+	if (req)
+		conn_req_report(req);
+
 	if (g_slist_find(adapter->connections, device)) {
 		error("Device is already marked as connected");
 		return;
@@ -3151,6 +3457,11 @@ bool btd_adapter_get_connectable(struct btd_adapter *adapter)
 	return false;
 }
 
+bool btd_adapter_get_discovering(struct btd_adapter *adapter)
+{
+	return adapter->discovering;
+}
+
 uint32_t btd_adapter_get_class(struct btd_adapter *adapter)
 {
 	return adapter->dev_class;
@@ -3170,6 +3481,8 @@ const char *btd_adapter_get_name(struct btd_adapter *adapter)
 int adapter_connect_list_add(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
+	struct conn_req *req;
+
 	/*
 	 * If the adapter->connect_le device is getting added back to
 	 * the connect list it probably means that the connect attempt
@@ -3178,6 +3491,9 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 	if (device == adapter->connect_le)
 		adapter->connect_le = NULL;
 
+	if (device == adapter->connect_pending)
+		adapter->connect_pending = NULL;
+
 	/*
 	 * If kernel background scanning is supported then the
 	 * adapter_auto_connect_add() function is used to maintain what to
@@ -3186,9 +3502,11 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 	if (kernel_conn_control)
 		return 0;
 
-	if (g_slist_find(adapter->connect_list, device)) {
+	req = find_conn_req(adapter, device);
+	if (req) {
 		DBG("ignoring already added device %s",
 						device_get_path(device));
+		req->last_seen = 0;
 		goto done;
 	}
 
@@ -3198,7 +3516,7 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 		return -ENOTSUP;
 	}
 
-	adapter->connect_list = g_slist_append(adapter->connect_list, device);
+	conn_req_add(adapter, device);
 	DBG("%s added to %s's connect_list", device_get_path(device),
 							adapter->system_name);
 
@@ -3206,7 +3524,7 @@ done:
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return 0;
 
-	trigger_passive_scanning(adapter);
+	connect_next(adapter);
 
 	return 0;
 }
@@ -3214,6 +3532,8 @@ done:
 void adapter_connect_list_remove(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
+	struct conn_req *req;
+
 	/*
 	 * If the adapter->connect_le device is being removed from the
 	 * connect list it means the connection was successful and hence
@@ -3222,16 +3542,23 @@ void adapter_connect_list_remove(struct btd_adapter *adapter,
 	if (device == adapter->connect_le)
 		adapter->connect_le = NULL;
 
+	if (device == adapter->connect_pending)
+		adapter->connect_pending = NULL;
+
 	if (kernel_conn_control)
 		return;
 
-	if (!g_slist_find(adapter->connect_list, device)) {
+	req = find_conn_req(adapter, device);
+	if (!req) {
 		DBG("device %s is not on the list, ignoring",
 						device_get_path(device));
 		return;
 	}
 
-	adapter->connect_list = g_slist_remove(adapter->connect_list, device);
+	if (btd_device_is_connected(device))
+		conn_req_report(req);
+
+	conn_req_remove(adapter, req);
 	DBG("%s removed from %s's connect_list", device_get_path(device),
 							adapter->system_name);
 
@@ -3243,7 +3570,7 @@ void adapter_connect_list_remove(struct btd_adapter *adapter,
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return;
 
-	trigger_passive_scanning(adapter);
+	connect_next(adapter);
 }
 
 static void add_whitelist_complete(uint8_t status, uint16_t length,
@@ -3338,6 +3665,7 @@ static void add_device_complete(uint8_t status, uint16_t length,
 	const struct mgmt_rp_add_device *rp = param;
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *dev;
+	struct conn_req *req;
 	char addr[18];
 
 	if (length < sizeof(*rp)) {
@@ -3357,8 +3685,9 @@ static void add_device_complete(uint8_t status, uint16_t length,
 	if (status != MGMT_STATUS_SUCCESS) {
 		error("Failed to add device %s (%u): %s (0x%02x)",
 			addr, rp->addr.type, mgmt_errstr(status), status);
-		adapter->connect_list = g_slist_remove(adapter->connect_list,
-									dev);
+		req = find_conn_req(adapter, dev);
+		if (req)
+			conn_req_remove(adapter, req);
 		return;
 	}
 
@@ -3376,7 +3705,7 @@ void adapter_auto_connect_add(struct btd_adapter *adapter,
 	if (!kernel_conn_control)
 		return;
 
-	if (g_slist_find(adapter->connect_list, device)) {
+	if (find_conn_req(adapter, device)) {
 		DBG("ignoring already added device %s",
 						device_get_path(device));
 		return;
@@ -3401,7 +3730,7 @@ void adapter_auto_connect_add(struct btd_adapter *adapter,
 	if (id == 0)
 		return;
 
-	adapter->connect_list = g_slist_append(adapter->connect_list, device);
+	conn_req_add(adapter, device);
 }
 
 static void remove_device_complete(uint8_t status, uint16_t length,
@@ -3432,12 +3761,14 @@ void adapter_auto_connect_remove(struct btd_adapter *adapter,
 	struct mgmt_cp_remove_device cp;
 	const bdaddr_t *bdaddr;
 	uint8_t bdaddr_type;
+	struct conn_req *req;
 	unsigned int id;
 
 	if (!kernel_conn_control)
 		return;
 
-	if (!g_slist_find(adapter->connect_list, device)) {
+	req = find_conn_req(adapter, device);
+	if (!req) {
 		DBG("ignoring not added device %s", device_get_path(device));
 		return;
 	}
@@ -3460,7 +3791,20 @@ void adapter_auto_connect_remove(struct btd_adapter *adapter,
 	if (id == 0)
 		return;
 
-	adapter->connect_list = g_slist_remove(adapter->connect_list, device);
+	conn_req_remove(adapter, req);
+}
+
+static void init_timing(struct btd_adapter *adapter, const char *stage)
+{
+	gint64 elapsed;
+
+	if (!adapter->init_start)
+		return;
+
+	elapsed = (g_get_monotonic_time() - adapter->init_start) / 1000;
+
+	DBG("index %u %s after %" G_GINT64_FORMAT " ms", adapter->dev_id,
+							stage, elapsed);
 }
 
 static void adapter_start(struct btd_adapter *adapter)
@@ -3470,6 +3814,8 @@ static void adapter_start(struct btd_adapter *adapter)
 
 	DBG("adapter %s has been enabled", adapter->path);
 
+	init_timing(adapter, "enabled");
+
 	trigger_passive_scanning(adapter);
 }
 
@@ -3541,12 +3887,18 @@ static void adapter_free(gpointer user_data)
 	if (adapter->pair_device_timeout > 0)
 		g_source_remove(adapter->pair_device_timeout);
 
+	if (adapter->oob_refresh_id > 0)
+		g_source_remove(adapter->oob_refresh_id);
+
 	if (adapter->auth_idle_id)
 		g_source_remove(adapter->auth_idle_id);
 
 	g_queue_foreach(adapter->auths, free_service_auth, NULL);
 	g_queue_free(adapter->auths);
 
+	g_hash_table_destroy(adapter->devices_addr);
+	g_hash_table_destroy(adapter->devices_path);
+
 	/*
 	 * Unregister all handlers for this specific index since
 	 * the adapter bound to them is no longer valid.
@@ -3567,6 +3919,7 @@ static void adapter_free(gpointer user_data)
 	sdp_list_free(adapter->services, NULL);
 
 	g_slist_free(adapter->connections);
+	g_slist_free_full(adapter->conn_params, g_free);
 
 	g_free(adapter->path);
 	g_free(adapter->name);
@@ -3575,6 +3928,8 @@ static void adapter_free(gpointer user_data)
 	g_free(adapter->stored_alias);
 	g_free(adapter->current_alias);
 	free(adapter->modalias);
+
+	btd_mem_remove(BTD_MEM_ADAPTER, 1, sizeof(*adapter));
 	g_free(adapter);
 }
 
@@ -3619,15 +3974,13 @@ static void convert_names_entry(char *key, char *value, void *user_data)
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", address, str);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	g_key_file_set_string(key_file, "General", "Name", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-	g_free(data);
+	btd_worker_store_file(filename, data, length);
 
 	g_key_file_free(key_file);
 }
@@ -3847,19 +4200,17 @@ static void convert_entry(char *key, char *value, void *user_data)
 			converter->address, key);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	set_device_type(key_file, type);
 
 	converter->cb(key_file, value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 
 	g_key_file_free(key_file);
 }
@@ -3944,18 +4295,16 @@ static void store_sdp_record(char *local, char *peer, int handle, char *value)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	sprintf(handle_str, "0x%8.8X", handle);
 	g_key_file_set_string(key_file, "ServiceRecords", handle_str, value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 
 	g_key_file_free(key_file);
 }
@@ -4018,17 +4367,15 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 								dst_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	store_attribute_uuid(key_file, start, end, prim_uuid, uuid);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 	g_key_file_free(key_file);
 
 failed:
@@ -4069,7 +4416,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", address,
 									key);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	for (service = services; *service; service++) {
 		ret = sscanf(*service, "%04hX#%04hX#%s", &start, &end,
@@ -4089,25 +4436,24 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	if (length == 0)
 		goto end;
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_worker_store_file(filename, data, length);
+	data = NULL;
 
 	if (device_type < 0)
 		goto end;
 
-	g_free(data);
 	g_key_file_free(key_file);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", address, key);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	set_device_type(key_file, device_type);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
+		btd_worker_store_file(filename, data, length);
+		data = NULL;
 	}
 
 end:
@@ -4148,18 +4494,16 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/ccc", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 	g_key_file_free(key_file);
 }
 
@@ -4195,18 +4539,16 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/gatt", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 	g_key_file_free(key_file);
 }
 
@@ -4241,17 +4583,15 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/proximity", src_addr,
 									key);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	g_key_file_set_string(key_file, alert, "Level", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 	g_key_file_free(key_file);
 }
 
@@ -4345,11 +4685,8 @@ static void convert_config(struct btd_adapter *adapter, const char *filename,
 	if (read_local_name(&adapter->bdaddr, str) == 0)
 		g_key_file_set_string(key_file, "General", "Alias", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-	g_free(data);
+	btd_worker_store_file(filename, data, length);
 }
 
 static void fix_storage(struct btd_adapter *adapter)
@@ -4434,7 +4771,7 @@ static void load_config(struct btd_adapter *adapter)
 		convert_device_storage(adapter);
 	}
 
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	/* Get alias */
 	adapter->stored_alias = g_key_file_get_string(key_file, "General",
@@ -4483,6 +4820,8 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 	if (!adapter)
 		return NULL;
 
+	btd_mem_add(BTD_MEM_ADAPTER, 1, sizeof(*adapter));
+
 	adapter->dev_id = index;
 	adapter->mgmt = mgmt_ref(mgmt_master);
 	adapter->pincode_requested = false;
@@ -4514,6 +4853,11 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 
+	adapter->devices_addr = g_hash_table_new_full(bdaddr_hash,
+						bdaddr_equal, g_free,
+						device_list_free);
+	adapter->devices_path = g_hash_table_new(path_hash, path_equal);
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -4528,6 +4872,8 @@ static void adapter_remove(struct btd_adapter *adapter)
 		adapter->discovery_idle_timeout = 0;
 	}
 
+	cancel_stop_discovery(adapter);
+
 	if (adapter->temp_devices_timeout > 0) {
 		g_source_remove(adapter->temp_devices_timeout);
 		adapter->temp_devices_timeout = 0;
@@ -4535,7 +4881,7 @@ static void adapter_remove(struct btd_adapter *adapter)
 
 	discovery_cleanup(adapter);
 
-	g_slist_free(adapter->connect_list);
+	g_slist_free_full(adapter->connect_list, g_free);
 	adapter->connect_list = NULL;
 
 	for (l = adapter->devices; l; l = l->next)
@@ -4543,6 +4889,8 @@ static void adapter_remove(struct btd_adapter *adapter)
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
+	g_hash_table_remove_all(adapter->devices_addr);
+	g_hash_table_remove_all(adapter->devices_path);
 
 	unload_drivers(adapter);
 	btd_adapter_gatt_server_stop(adapter);
@@ -4647,6 +4995,67 @@ static void confirm_name(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
 						confirm_name_timeout, adapter);
 }
 
+static void add_eir_uuids(struct btd_device *dev, const uint8_t *data,
+							uint8_t data_len)
+{
+	char str[MAX_LEN_UUID_STR];
+	struct eir_iter iter;
+	struct eir_field field;
+	bt_uuid_t uuid, uuid128;
+	unsigned int i;
+
+	eir_iter_init(&iter, data, data_len);
+
+	while (eir_iter_next(&iter, &field)) {
+		for (i = 0; eir_field_get_uuid(&field, i, &uuid); i++) {
+			bt_uuid_to_uuid128(&uuid, &uuid128);
+			bt_uuid_to_string(&uuid128, str, sizeof(str));
+			device_add_eir_uuid(dev, str);
+		}
+	}
+}
+
+/*
+ * Makes room for another temporary device by removing the one seen the
+ * longest time ago, unless it's still below the configured limit.
+ */
+static void evict_temp_device(struct btd_adapter *adapter)
+{
+	struct btd_device *oldest = NULL;
+	time_t oldest_seen = 0;
+	unsigned int count = 0;
+	GSList *l;
+
+	for (l = adapter->devices; l; l = g_slist_next(l)) {
+		struct btd_device *dev = l->data;
+		time_t seen;
+
+		if (!device_is_temporary(dev))
+			continue;
+
+		count++;
+
+		if (btd_device_is_connected(dev) ||
+					device_is_bonding(dev, NULL) ||
+					find_conn_req(adapter, dev))
+			continue;
+
+		seen = device_get_last_seen(dev);
+		if (!oldest || seen < oldest_seen) {
+			oldest = dev;
+			oldest_seen = seen;
+		}
+	}
+
+	if (count < main_opts.max_temp_devices || !oldest)
+		return;
+
+	DBG("Removing least recently seen device %s",
+						device_get_path(oldest));
+
+	btd_adapter_remove_device(adapter, oldest);
+}
+
 static void update_found_devices(struct btd_adapter *adapter,
 					const bdaddr_t *bdaddr,
 					uint8_t bdaddr_type, int8_t rssi,
@@ -4654,12 +5063,47 @@ static void update_found_devices(struct btd_adapter *adapter,
 					const uint8_t *data, uint8_t data_len)
 {
 	struct btd_device *dev;
+	struct conn_req *req;
 	struct eir_data eir_data;
-	bool name_known, discoverable;
+	struct eir_iter iter;
+	struct eir_field field;
+	char name_buf[HCI_MAX_NAME_LENGTH + 2];
+	const char *name = NULL;
+	bool name_known, name_complete = false, discoverable;
 	char addr[18];
 
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+
+	/*
+	 * During discovery a device keeps repeating the same advertising
+	 * data. If it has already been reported and neither the payload
+	 * nor the RSSI changed, skip parsing and property updates.
+	 */
+	if (dev && adapter->discovery_list &&
+			device_adv_unchanged(dev, bdaddr_type, legacy, data,
+							data_len, rssi) &&
+			g_slist_find(adapter->discovery_found, dev)) {
+		device_update_last_seen(dev, bdaddr_type);
+		return;
+	}
+
+	/*
+	 * Only the fixed size fields are extracted here. The name is
+	 * decoded into a stack buffer and UUIDs are converted on demand
+	 * so that no allocations are made per advertising report.
+	 */
 	memset(&eir_data, 0, sizeof(eir_data));
-	eir_parse(&eir_data, data, data_len);
+	eir_iter_init(&iter, data, data_len);
+
+	while (eir_iter_next(&iter, &field)) {
+		if (field.type == EIR_NAME_SHORT ||
+					field.type == EIR_NAME_COMPLETE) {
+			eir_field_get_name(&field, name_buf, sizeof(name_buf));
+			name = name_buf;
+			name_complete = field.type == EIR_NAME_COMPLETE;
+		} else
+			eir_parse_field(&eir_data, &field);
+	}
 
 	if (bdaddr_type == BDADDR_BREDR)
 		discoverable = true;
@@ -4668,24 +5112,23 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	ba2str(bdaddr, addr);
 
-	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
 	if (!dev) {
 		/*
 		 * If no client has requested discovery or the device is
 		 * not marked as discoverable, then do not create new
 		 * device objects.
 		 */
-		if (!adapter->discovery_list || !discoverable) {
-			eir_data_free(&eir_data);
+		if (!adapter->discovery_list || !discoverable)
 			return;
-		}
+
+		if (main_opts.max_temp_devices > 0)
+			evict_temp_device(adapter);
 
 		dev = adapter_create_device(adapter, bdaddr, bdaddr_type);
 	}
 
 	if (!dev) {
 		error("Unable to create object for found device %s", addr);
-		eir_data_free(&eir_data);
 		return;
 	}
 
@@ -4701,17 +5144,15 @@ static void update_found_devices(struct btd_adapter *adapter,
 					!(eir_data.flags & EIR_BREDR_UNSUP))
 		device_set_bredr_support(dev);
 
-	if (eir_data.name != NULL && eir_data.name_complete)
-		device_store_cached_name(dev, eir_data.name);
+	if (name && name_complete)
+		device_store_cached_name(dev, name);
 
 	/*
 	 * If no client has requested discovery, then only update
 	 * already paired devices (skip temporary ones).
 	 */
-	if (device_is_temporary(dev) && !adapter->discovery_list) {
-		eir_data_free(&eir_data);
+	if (device_is_temporary(dev) && !adapter->discovery_list)
 		return;
-	}
 
 	device_set_legacy(dev, legacy);
 	device_set_rssi(dev, rssi);
@@ -4723,8 +5164,8 @@ static void update_found_devices(struct btd_adapter *adapter,
 	 * known, but still update the name with the known short name. */
 	name_known = device_name_known(dev);
 
-	if (eir_data.name && (eir_data.name_complete || !name_known))
-		btd_device_device_set_name(dev, eir_data.name);
+	if (name && (name_complete || !name_known))
+		btd_device_device_set_name(dev, name);
 
 	if (eir_data.class != 0)
 		device_set_class(dev, eir_data.class);
@@ -4736,9 +5177,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 							eir_data.did_product,
 							eir_data.did_version);
 
-	device_add_eir_uuids(dev, eir_data.services);
-
-	eir_data_free(&eir_data);
+	add_eir_uuids(dev, data, data_len);
 
 	/*
 	 * Only if at least one client has requested discovery, maintain
@@ -4752,8 +5191,13 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (g_slist_find(adapter->discovery_found, dev))
 		return;
 
+	/*
+	 * With name resolving disabled report every name as known so the
+	 * kernel never sends a Remote Name Request on our behalf.
+	 */
 	if (confirm)
-		confirm_name(adapter, bdaddr, bdaddr_type, name_known);
+		confirm_name(adapter, bdaddr, bdaddr_type,
+					name_known || !main_opts.name_resolv);
 
 	adapter->discovery_found = g_slist_prepend(adapter->discovery_found,
 									dev);
@@ -4762,30 +5206,36 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 connect_le:
 	/*
-	 * If we're in the process of stopping passive scanning and
-	 * connecting another (or maybe even the same) LE device just
-	 * ignore this one.
+	 * If kernel background scan is used then the kernel is
+	 * responsible for connecting.
 	 */
-	if (adapter->connect_le)
+	if (kernel_conn_control)
+		return;
+
+	if (bdaddr_type == BDADDR_BREDR || btd_device_is_connected(dev))
+		return;
+
+	req = find_conn_req(adapter, dev);
+	if (!req)
 		return;
 
+	req->last_seen = g_get_monotonic_time();
+
 	/*
-	 * If kernel background scan is used then the kernel is
-	 * responsible for connecting.
+	 * If we're in the process of stopping passive scanning or
+	 * connecting another (or maybe even the same) LE device just
+	 * remember this one was around, it gets picked up next.
 	 */
-	if (kernel_conn_control)
+	if (adapter->connect_le || adapter->connect_pending)
 		return;
 
 	/*
-	 * If this is an LE device that's not connected and part of the
-	 * connect_list stop passive scanning so that a connection
+	 * This is an LE device that's not connected and part of the
+	 * connect_list, stop passive scanning so that a connection
 	 * attempt to it can be made
 	 */
-	if (bdaddr_type != BDADDR_BREDR && !btd_device_is_connected(dev) &&
-				g_slist_find(adapter->connect_list, dev)) {
-		adapter->connect_le = dev;
-		stop_passive_scanning(adapter);
-	}
+	adapter->connect_le = dev;
+	stop_passive_scanning(adapter);
 }
 
 static void device_found_callback(uint16_t index, uint16_t length,
@@ -4844,6 +5294,8 @@ static void adapter_remove_connection(struct btd_adapter *adapter,
 						struct btd_device *device,
 						uint8_t bdaddr_type)
 {
+	struct conn_req *req;
+
 	DBG("");
 
 	if (!g_slist_find(adapter->connections, device)) {
@@ -4862,6 +5314,11 @@ static void adapter_remove_connection(struct btd_adapter *adapter,
 
 	adapter->connections = g_slist_remove(adapter->connections, device);
 
+	/* Kernel auto-connection keeps it listed, time the reconnection */
+	req = find_conn_req(adapter, device);
+	if (req && !req->queued)
+		req->queued = g_get_monotonic_time();
+
 	if (device_is_temporary(device) && !device_is_retrying(device)) {
 		const char *path = device_get_path(device);
 
@@ -4876,6 +5333,7 @@ static void adapter_stop(struct btd_adapter *adapter)
 	reply_pending_requests(adapter);
 
 	cancel_passive_scanning(adapter);
+	cancel_stop_discovery(adapter);
 
 	while (adapter->discovery_list) {
 		struct watch_client *client;
@@ -5883,7 +6341,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -5893,11 +6351,8 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	btd_worker_store_file(filename, str, length);
 
 	g_key_file_free(key_file);
 }
@@ -5975,7 +6430,7 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -5992,11 +6447,8 @@ static void store_longtermkey(const bdaddr_t *local, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	btd_worker_store_file(filename, str, length);
 
 	g_key_file_free(key_file);
 }
@@ -6096,18 +6548,15 @@ static void store_csrk(const bdaddr_t *local, const bdaddr_t *peer,
 						adapter_addr, device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, group, "Key", key_str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	btd_worker_store_file(filename, str, length);
 
 	g_key_file_free(key_file);
 }
@@ -6167,18 +6616,15 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
+	btd_worker_store_file(filename, store_data, length);
 
 	g_key_file_free(key_file);
 }
@@ -6222,7 +6668,9 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 		return;
 	}
 
+	device_index_remove(adapter, device);
 	device_update_addr(device, &addr->bdaddr, addr->type);
+	device_index_add(adapter, device);
 
 	if (duplicate)
 		device_merge_duplicate(device, duplicate);
@@ -6257,7 +6705,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"MinInterval", min_interval);
@@ -6268,15 +6716,128 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
+	btd_worker_store_file(filename, store_data, length);
 
 	g_key_file_free(key_file);
 }
 
+static void update_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *peer, uint8_t bdaddr_type,
+				uint16_t min_interval, uint16_t max_interval,
+				uint16_t latency, uint16_t timeout)
+{
+	struct conn_param *param = NULL;
+	GSList *l;
+
+	for (l = adapter->conn_params; l; l = g_slist_next(l)) {
+		struct conn_param *p = l->data;
+
+		if (p->bdaddr_type == bdaddr_type &&
+					!bacmp(&p->bdaddr, peer)) {
+			param = p;
+			break;
+		}
+	}
+
+	if (!param) {
+		param = g_new0(struct conn_param, 1);
+		bacpy(&param->bdaddr, peer);
+		param->bdaddr_type = bdaddr_type;
+		adapter->conn_params = g_slist_prepend(adapter->conn_params,
+									param);
+	}
+
+	param->min_interval = min_interval;
+	param->max_interval = max_interval;
+	param->latency = latency;
+	param->timeout = timeout;
+}
+
+int btd_adapter_set_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type,
+				uint16_t min_interval, uint16_t max_interval,
+				uint16_t latency, uint16_t timeout)
+{
+	if (!(adapter->supported_settings & MGMT_SETTING_LE))
+		return -ENOTSUP;
+
+	update_conn_param(adapter, bdaddr, bdaddr_type, min_interval,
+					max_interval, latency, timeout);
+
+	/*
+	 * Load Connection Parameters replaces the whole list in the
+	 * kernel, so all known parameters need to be sent again.
+	 */
+	load_conn_params(adapter, adapter->conn_params);
+
+	return 0;
+}
+
+struct conn_info_data {
+	btd_conn_info_cb cb;
+	void *user_data;
+	GDestroyNotify destroy;
+};
+
+static void conn_info_data_free(void *user_data)
+{
+	struct conn_info_data *data = user_data;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	g_free(data);
+}
+
+static void get_conn_info_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_rp_get_conn_info *rp = param;
+	struct conn_info_data *data = user_data;
+
+	if (status == MGMT_STATUS_SUCCESS && length < sizeof(*rp)) {
+		error("Too small Get Connection Information response");
+		status = MGMT_STATUS_FAILED;
+	}
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		data->cb(status, 0, 0, data->user_data);
+		return;
+	}
+
+	data->cb(status, rp->rssi, rp->tx_power, data->user_data);
+}
+
+int btd_adapter_get_conn_info(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type,
+				btd_conn_info_cb cb, void *user_data,
+				GDestroyNotify destroy)
+{
+	struct mgmt_cp_get_conn_info cp;
+	struct conn_info_data *data;
+
+	memset(&cp, 0, sizeof(cp));
+	bacpy(&cp.addr.bdaddr, bdaddr);
+	cp.addr.type = bdaddr_type;
+
+	data = g_new0(struct conn_info_data, 1);
+	data->cb = cb;
+	data->user_data = user_data;
+	data->destroy = destroy;
+
+	if (mgmt_send(adapter->mgmt, MGMT_OP_GET_CONN_INFO,
+				adapter->dev_id, sizeof(cp), &cp,
+				get_conn_info_complete, data,
+				conn_info_data_free) > 0)
+		return 0;
+
+	/* The caller keeps ownership of user_data on failure */
+	g_free(data);
+
+	return -EIO;
+}
+
 static void new_conn_param(uint16_t index, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -6308,6 +6869,9 @@ static void new_conn_param(uint16_t index, uint16_t length,
 		return;
 	}
 
+	update_conn_param(adapter, &ev->addr.bdaddr, ev->addr.type, min, max,
+							latency, timeout);
+
 	if (!ev->store_hint)
 		return;
 
@@ -6402,6 +6966,8 @@ static void read_local_oob_data_complete(uint8_t status, uint16_t length,
 	struct btd_adapter *adapter = user_data;
 	const uint8_t *hash, *randomizer;
 
+	adapter->oob_reading = false;
+
 	if (status != MGMT_STATUS_SUCCESS) {
 		error("Read local OOB data failed: %s (0x%02x)",
 						mgmt_errstr(status), status);
@@ -6415,8 +6981,16 @@ static void read_local_oob_data_complete(uint8_t status, uint16_t length,
 		randomizer = rp->randomizer;
 	}
 
-	if (!adapter->oob_handler || !adapter->oob_handler->read_local_cb)
+	if (!adapter->oob_handler || !adapter->oob_handler->read_local_cb) {
+		/* Nobody waiting, keep the data for the next request */
+		if (hash && adapter->oob_prefetch) {
+			memcpy(adapter->oob_hash, hash, 16);
+			memcpy(adapter->oob_randomizer, randomizer, 16);
+			adapter->oob_cached = true;
+		}
+
 		return;
+	}
 
 	adapter->oob_handler->read_local_cb(adapter, hash, randomizer,
 					adapter->oob_handler->user_data);
@@ -6429,14 +7003,99 @@ int btd_adapter_read_local_oob_data(struct btd_adapter *adapter)
 {
 	DBG("hci%u", adapter->dev_id);
 
+	/*
+	 * Every read makes the controller generate new values, so a pending
+	 * prefetch is simply handed over to the OOB handler instead.
+	 */
+	if (adapter->oob_reading)
+		return 0;
+
+	adapter->oob_cached = false;
+
 	if (mgmt_send(adapter->mgmt, MGMT_OP_READ_LOCAL_OOB_DATA,
 			adapter->dev_id, 0, NULL, read_local_oob_data_complete,
-			adapter, NULL) > 0)
+			adapter, NULL) > 0) {
+		adapter->oob_reading = true;
 		return 0;
+	}
 
 	return -EIO;
 }
 
+static void prefetch_local_oob_data(struct btd_adapter *adapter)
+{
+	if (!adapter->oob_prefetch || adapter->oob_cached ||
+						adapter->oob_reading)
+		return;
+
+	if (adapter->oob_refresh_id > 0)
+		return;
+
+	if (!(adapter->current_settings & MGMT_SETTING_POWERED) ||
+				!(adapter->current_settings & MGMT_SETTING_SSP))
+		return;
+
+	btd_adapter_read_local_oob_data(adapter);
+}
+
+static void invalidate_local_oob_data(struct btd_adapter *adapter)
+{
+	adapter->oob_cached = false;
+
+	if (adapter->oob_refresh_id > 0) {
+		g_source_remove(adapter->oob_refresh_id);
+		adapter->oob_refresh_id = 0;
+	}
+}
+
+static gboolean refresh_local_oob_data(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->oob_refresh_id = 0;
+
+	prefetch_local_oob_data(adapter);
+
+	return FALSE;
+}
+
+void btd_adapter_set_oob_prefetch(struct btd_adapter *adapter, bool enable)
+{
+	DBG("hci%u %s", adapter->dev_id, enable ? "enable" : "disable");
+
+	adapter->oob_prefetch = enable;
+
+	if (enable)
+		prefetch_local_oob_data(adapter);
+	else
+		invalidate_local_oob_data(adapter);
+}
+
+bool btd_adapter_take_local_oob_data(struct btd_adapter *adapter,
+					uint8_t *hash, uint8_t *randomizer)
+{
+	if (!adapter->oob_cached)
+		return false;
+
+	DBG("hci%u", adapter->dev_id);
+
+	memcpy(hash, adapter->oob_hash, 16);
+	memcpy(randomizer, adapter->oob_randomizer, 16);
+	adapter->oob_cached = false;
+
+	/*
+	 * The values handed out stay valid only until the next read, so
+	 * give the remote time to pair with them before fetching new ones.
+	 */
+	if (adapter->oob_refresh_id == 0)
+		adapter->oob_refresh_id = g_timeout_add_seconds(
+						OOB_REFRESH_DELAY,
+						refresh_local_oob_data,
+						adapter);
+
+	return true;
+}
+
 void btd_adapter_for_each_device(struct btd_adapter *adapter,
 			void (*cb)(struct btd_device *device, void *data),
 			void *data)
@@ -6795,7 +7454,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 								device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	if (type == BDADDR_BREDR) {
 		g_key_file_remove_group(key_file, "LinkKey", NULL);
@@ -6807,8 +7466,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	}
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	btd_worker_store_file(filename, str, length);
 
 	g_key_file_free(key_file);
 }
@@ -6881,6 +7539,8 @@ static void read_info_complete(uint8_t status, uint16_t length,
 
 	DBG("index %u status 0x%02x", adapter->dev_id, status);
 
+	init_timing(adapter, "read info");
+
 	if (status != MGMT_STATUS_SUCCESS) {
 		error("Failed to read info for index %u: %s (0x%02x)",
 				adapter->dev_id, mgmt_errstr(status), status);
@@ -7054,9 +7714,13 @@ static void read_info_complete(uint8_t status, uint16_t length,
 	if (adapter->stored_discoverable && !adapter->discoverable_timeout)
 		set_discoverable(adapter, 0x01, 0);
 
+	init_timing(adapter, "registered");
+
 	if (adapter->current_settings & MGMT_SETTING_POWERED)
 		adapter_start(adapter);
 
+	adapter->init_start = 0;
+
 	return;
 
 failed:
@@ -7106,6 +7770,13 @@ static void index_added(uint16_t index, uint16_t length, const void *param,
 	 */
 	adapter_list = g_list_append(adapter_list, adapter);
 
+	/*
+	 * Each index is brought up by its own chain of mgmt callbacks.
+	 * Since mgmt only serializes commands per index, all controllers
+	 * found at startup are initialized concurrently.
+	 */
+	adapter->init_start = g_get_monotonic_time();
+
 	DBG("sending read info command for index %u", index);
 
 	if (mgmt_send(mgmt_master, MGMT_OP_READ_INFO, index, 0, NULL,
@@ -78,6 +78,7 @@ void adapter_foreach(adapter_cb func, gpointer user_data);
 bool btd_adapter_get_pairable(struct btd_adapter *adapter);
 bool btd_adapter_get_powered(struct btd_adapter *adapter);
 bool btd_adapter_get_connectable(struct btd_adapter *adapter);
+bool btd_adapter_get_discovering(struct btd_adapter *adapter);
 
 uint32_t btd_adapter_get_class(struct btd_adapter *adapter);
 const char *btd_adapter_get_name(struct btd_adapter *adapter);
@@ -153,6 +154,23 @@ int btd_adapter_block_address(struct btd_adapter *adapter,
 int btd_adapter_unblock_address(struct btd_adapter *adapter,
 				const bdaddr_t *bdaddr, uint8_t bdaddr_type);
 
+/* Sets the LE connection parameters the kernel uses for the next connection
+ * to the device, they are not stored. */
+int btd_adapter_set_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type,
+				uint16_t min_interval, uint16_t max_interval,
+				uint16_t latency, uint16_t timeout);
+
+/* Reads RSSI and TX power of an active connection; the kernel caches the
+ * values for a short time, so frequent callers don't each hit the
+ * controller. */
+typedef void (*btd_conn_info_cb) (uint8_t status, int8_t rssi,
+					int8_t tx_power, void *user_data);
+int btd_adapter_get_conn_info(struct btd_adapter *adapter,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type,
+				btd_conn_info_cb cb, void *user_data,
+				GDestroyNotify destroy);
+
 int btd_adapter_disconnect_device(struct btd_adapter *adapter,
 							const bdaddr_t *bdaddr,
 							uint8_t bdaddr_type);
@@ -182,6 +200,9 @@ int adapter_cancel_bonding(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
 int adapter_set_io_capability(struct btd_adapter *adapter, uint8_t io_cap);
 
 int btd_adapter_read_local_oob_data(struct btd_adapter *adapter);
+void btd_adapter_set_oob_prefetch(struct btd_adapter *adapter, bool enable);
+bool btd_adapter_take_local_oob_data(struct btd_adapter *adapter,
+					uint8_t *hash, uint8_t *randomizer);
 
 int btd_adapter_add_remote_oob_data(struct btd_adapter *adapter,
 					const bdaddr_t *bdaddr,
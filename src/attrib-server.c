@@ -32,7 +32,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <glib.h>
-#include <sys/stat.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/sdp.h>
@@ -44,15 +43,21 @@
 #include "adapter.h"
 #include "device.h"
 #include "src/shared/util.h"
+#include "src/shared/handle-alloc.h"
 #include "attrib/gattrib.h"
 #include "attrib/att.h"
 #include "attrib/gatt.h"
 #include "attrib/att-database.h"
-#include "textfile.h"
+#include "worker.h"
 #include "storage.h"
 
 #include "attrib-server.h"
 
+#define CCC_SYNC_TIMEOUT 2
+
+/* Minimum time in milliseconds between value updates sent to a client */
+#define NOTIFY_INTERVAL 20
+
 static GSList *servers = NULL;
 
 struct gatt_server {
@@ -61,7 +66,11 @@ struct gatt_server {
 	GIOChannel *le_io;
 	uint32_t gatt_sdp_handle;
 	uint32_t gap_sdp_handle;
-	GList *database;
+	GPtrArray *database;
+	struct handle_alloc *free_handles;
+	GHashTable *types;
+	GHashTable *ccc;
+	guint ccc_sync_id;
 	GSList *clients;
 	uint16_t name_handle;
 	uint16_t appearance_handle;
@@ -76,6 +85,22 @@ struct gatt_channel {
 	struct gatt_server *server;
 	guint cleanup_id;
 	struct btd_device *device;
+	gint64 last_notify;
+	guint notify_id;
+	GSList *deferred;
+};
+
+struct ccc_state {
+	char *filename;
+	GHashTable *values;
+	gboolean dirty;
+};
+
+struct notify_pdu {
+	uint8_t opcode;
+	size_t vlen;
+	uint8_t *pdu;
+	uint16_t len;
 };
 
 struct group_elem {
@@ -93,6 +118,10 @@ static bt_uuid_t snd_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_SND_SVC_UUID
 };
+static bt_uuid_t chr_uuid = {
+			.type = BT_UUID16,
+			.value.u16 = GATT_CHARAC_UUID
+};
 static bt_uuid_t ccc_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID
@@ -115,12 +144,22 @@ static void attrib_free(void *data)
 	g_free(a);
 }
 
+static void type_list_free(void *data)
+{
+	g_ptr_array_free(data, TRUE);
+}
+
 static void channel_free(struct gatt_channel *channel)
 {
 
 	if (channel->cleanup_id)
 		g_source_remove(channel->cleanup_id);
 
+	if (channel->notify_id)
+		g_source_remove(channel->notify_id);
+
+	g_slist_free(channel->deferred);
+
 	if (channel->device)
 		btd_device_unref(channel->device);
 
@@ -128,9 +167,16 @@ static void channel_free(struct gatt_channel *channel)
 	g_free(channel);
 }
 
+static void ccc_sync(struct gatt_server *server);
+
 static void gatt_server_free(struct gatt_server *server)
 {
-	g_list_free_full(server->database, attrib_free);
+	ccc_sync(server);
+	g_hash_table_destroy(server->ccc);
+
+	g_hash_table_destroy(server->types);
+	g_ptr_array_free(server->database, TRUE);
+	handle_alloc_destroy(server->free_handles);
 
 	if (server->l2cap_io != NULL) {
 		g_io_channel_shutdown(server->l2cap_io, FALSE, NULL);
@@ -247,54 +293,198 @@ static sdp_record_t *server_record_new(uuid_t *uuid, uint16_t start, uint16_t en
 	return record;
 }
 
-static int handle_cmp(gconstpointer a, gconstpointer b)
+/* Position of the first attribute with a handle not lower than handle */
+static guint lower_bound(GPtrArray *list, uint16_t handle)
+{
+	guint lo = 0, hi = list->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		struct attribute *a = g_ptr_array_index(list, mid);
+
+		if (a->handle < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void list_insert(GPtrArray *list, struct attribute *a)
+{
+	guint i = lower_bound(list, a->handle);
+
+	g_ptr_array_add(list, NULL);
+	memmove(&list->pdata[i + 1], &list->pdata[i],
+				(list->len - i - 1) * sizeof(gpointer));
+	list->pdata[i] = a;
+}
+
+static void list_remove(GPtrArray *list, struct attribute *a)
+{
+	guint i = lower_bound(list, a->handle);
+
+	if (i < list->len && g_ptr_array_index(list, i) == a)
+		g_ptr_array_remove_index(list, i);
+}
+
+static struct attribute *find_attribute(struct gatt_server *server,
+							uint16_t handle)
+{
+	GPtrArray *database = server->database;
+	struct attribute *a;
+	guint i;
+
+	i = lower_bound(database, handle);
+	if (i == database->len)
+		return NULL;
+
+	a = g_ptr_array_index(database, i);
+
+	return a->handle == handle ? a : NULL;
+}
+
+/* 16-bit form of uuid, if it is derived from the Bluetooth base UUID */
+static bool uuid_to_16(const bt_uuid_t *uuid, uint16_t *value)
 {
-	const struct attribute *attrib = a;
-	uint16_t handle = GPOINTER_TO_UINT(b);
+	bt_uuid_t u128, u16;
+
+	if (uuid->type == BT_UUID16) {
+		*value = uuid->value.u16;
+		return true;
+	}
+
+	bt_uuid_to_uuid128(uuid, &u128);
+	bt_uuid16_create(&u16, get_be16(&u128.value.u128.data[2]));
+
+	if (bt_uuid_cmp(&u16, uuid) != 0)
+		return false;
 
-	return attrib->handle - handle;
+	*value = u16.value.u16;
+
+	return true;
 }
 
-static int attribute_cmp(gconstpointer a1, gconstpointer a2)
+/* Attributes of a 16-bit type, sorted by handle */
+static GPtrArray *type_list(struct gatt_server *server, const bt_uuid_t *uuid)
 {
-	const struct attribute *attrib1 = a1;
-	const struct attribute *attrib2 = a2;
+	uint16_t value;
+
+	if (!uuid_to_16(uuid, &value))
+		return NULL;
 
-	return attrib1->handle - attrib2->handle;
+	return g_hash_table_lookup(server->types, GUINT_TO_POINTER(value));
+}
+
+static void index_attribute(struct gatt_server *server, struct attribute *a)
+{
+	GPtrArray *list;
+	uint16_t value;
+
+	if (!uuid_to_16(&a->uuid, &value))
+		return;
+
+	list = g_hash_table_lookup(server->types, GUINT_TO_POINTER(value));
+	if (!list) {
+		list = g_ptr_array_new();
+		g_hash_table_insert(server->types, GUINT_TO_POINTER(value),
+									list);
+	}
+
+	list_insert(list, a);
+}
+
+static void unindex_attribute(struct gatt_server *server,
+							struct attribute *a)
+{
+	GPtrArray *list;
+
+	list = type_list(server, &a->uuid);
+	if (list)
+		list_remove(list, a);
+}
+
+/*
+ * Attributes to walk when looking for a type: its index for 16-bit types,
+ * the whole database otherwise. Returns NULL if no attribute has the type.
+ */
+static GPtrArray *lookup_list(struct gatt_server *server,
+						const bt_uuid_t *uuid)
+{
+	uint16_t value;
+
+	if (!uuid_to_16(uuid, &value))
+		return server->database;
+
+	return g_hash_table_lookup(server->types, GUINT_TO_POINTER(value));
+}
+
+static uint16_t handle_at(GPtrArray *list, guint i)
+{
+	struct attribute *a = g_ptr_array_index(list, i);
+
+	return a->handle;
+}
+
+/* Handle of the first service declaration after handle, or 0 if none */
+static uint16_t next_service(struct gatt_server *server, uint16_t handle)
+{
+	bt_uuid_t *types[] = { &prim_uuid, &snd_uuid };
+	uint16_t next = 0;
+	GPtrArray *list;
+	unsigned int t;
+	guint i;
+
+	if (handle == 0xffff)
+		return 0;
+
+	for (t = 0; t < G_N_ELEMENTS(types); t++) {
+		list = type_list(server, types[t]);
+		if (!list)
+			continue;
+
+		i = lower_bound(list, handle + 1);
+		if (i < list->len && (!next || handle_at(list, i) < next))
+			next = handle_at(list, i);
+	}
+
+	return next;
+}
+
+/* Last handle of the service declared at handle */
+static uint16_t group_end(struct gatt_server *server, uint16_t handle)
+{
+	GPtrArray *database = server->database;
+	uint16_t next;
+	guint i;
+
+	next = next_service(server, handle);
+	if (next)
+		i = lower_bound(database, next);
+	else
+		i = database->len;
+
+	return handle_at(database, i - 1);
 }
 
 static struct attribute *find_svc_range(struct gatt_server *server,
 					uint16_t start, uint16_t *end)
 {
 	struct attribute *attrib;
-	guint h = start;
-	GList *l;
 
 	if (end == NULL)
 		return NULL;
 
-	l = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (!l)
+	attrib = find_attribute(server, start);
+	if (!attrib)
 		return NULL;
 
-	attrib = l->data;
-
 	if (bt_uuid_cmp(&attrib->uuid, &prim_uuid) != 0 &&
 			bt_uuid_cmp(&attrib->uuid, &snd_uuid) != 0)
 		return NULL;
 
-	*end = start;
-
-	for (l = l->next; l; l = l->next) {
-		struct attribute *a = l->data;
-
-		if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
-			break;
-
-		*end = a->handle;
-	}
+	*end = group_end(server, start);
 
 	return attrib;
 }
@@ -350,12 +540,13 @@ static struct attribute *attrib_db_add_new(struct gatt_server *server,
 				const uint8_t *value, size_t len)
 {
 	struct attribute *a;
-	guint h = handle;
 
 	DBG("handle=0x%04x", handle);
 
-	if (g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp))
+	if (find_attribute(server, handle))
+		return NULL;
+
+	if (!handle_alloc_reserve(server->free_handles, handle, 1))
 		return NULL;
 
 	a = g_new0(struct attribute, 1);
@@ -366,8 +557,8 @@ static struct attribute *attrib_db_add_new(struct gatt_server *server,
 	a->read_req = read_req;
 	a->write_req = write_req;
 
-	server->database = g_list_insert_sorted(server->database, a,
-								attribute_cmp);
+	list_insert(server->database, a);
+	index_attribute(server, a);
 
 	return a;
 }
@@ -410,13 +601,15 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len)
 {
+	struct gatt_server *server = channel->server;
 	struct att_data_list *adl;
 	struct attribute *a;
-	struct group_elem *cur, *old = NULL;
+	struct group_elem *cur;
 	GSList *l, *groups;
-	GList *dl, *database;
-	uint16_t length, last_handle, last_size = 0;
+	GPtrArray *list;
+	uint16_t length, num = 0, last_size = 0;
 	uint8_t status;
+	guint idx;
 	int i;
 
 	if (start > end || start == 0x0000)
@@ -433,35 +626,22 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, 0x0000,
 					ATT_ECODE_UNSUPP_GRP_TYPE, pdu, len);
 
-	last_handle = end;
-	database = channel->server->database;
-	for (dl = database, groups = NULL, cur = NULL; dl; dl = dl->next) {
-
-		a = dl->data;
+	list = lookup_list(server, uuid);
+	idx = list ? lower_bound(list, start) : 0;
 
-		if (a->handle < start)
-			continue;
+	for (groups = NULL; list && idx < list->len; idx++) {
+		a = g_ptr_array_index(list, idx);
 
-		if (a->handle >= end)
+		if (a->handle > end)
 			break;
 
-		/* The old group ends when a new one starts */
-		if (old && (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)) {
-			old->end = last_handle;
-			old = NULL;
-		}
-
-		if (bt_uuid_cmp(&a->uuid, uuid) != 0) {
-			/* Still inside a service, update its last handle */
-			if (old)
-				last_handle = a->handle;
-			continue;
-		}
-
 		if (last_size && (last_size != a->len))
 			break;
 
+		/* Stop once the response is full */
+		if (num && 2 + (size_t) (num + 1) * (last_size + 4) > len)
+			break;
+
 		status = att_check_reqs(channel, ATT_OP_READ_BY_GROUP_REQ,
 								a->read_req);
 
@@ -477,29 +657,22 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 
 		cur = g_new0(struct group_elem, 1);
 		cur->handle = a->handle;
+		cur->end = group_end(server, a->handle);
 		cur->data = a->data;
 		cur->len = a->len;
 
 		/* Attribute Grouping Type found */
 		groups = g_slist_append(groups, cur);
+		num++;
 
 		last_size = a->len;
-		old = cur;
-		last_handle = cur->handle;
 	}
 
 	if (groups == NULL)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
 					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	if (dl == NULL)
-		cur->end = a->handle;
-	else
-		cur->end = last_handle;
-
-	length = g_slist_length(groups);
-
-	adl = att_data_list_alloc(length, last_size + 4);
+	adl = att_data_list_alloc(num, last_size + 4);
 	if (adl == NULL) {
 		g_slist_free_full(groups, g_free);
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
@@ -533,23 +706,23 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 {
 	struct att_data_list *adl;
 	GSList *l, *types;
-	GList *dl, *database;
+	GPtrArray *list;
 	struct attribute *a;
 	uint16_t num, length;
 	uint8_t status;
+	guint idx;
 	int i;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	database = channel->server->database;
-	for (dl = database, length = 0, types = NULL; dl; dl = dl->next) {
-
-		a = dl->data;
+	list = lookup_list(channel->server, uuid);
+	idx = list ? lower_bound(list, start) : 0;
 
-		if (a->handle < start)
-			continue;
+	for (length = 0, num = 0, types = NULL; list && idx < list->len;
+								idx++) {
+		a = g_ptr_array_index(list, idx);
 
 		if (a->handle > end)
 			break;
@@ -557,6 +730,10 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 		if (bt_uuid_cmp(&a->uuid, uuid)  != 0)
 			continue;
 
+		/* Stop once the response is full */
+		if (num && 2 + (size_t) (num + 1) * (length + 2) > len)
+			break;
+
 		status = att_check_reqs(channel, ATT_OP_READ_BY_TYPE_REQ,
 								a->read_req);
 
@@ -577,14 +754,13 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 			break;
 
 		types = g_slist_append(types, a);
+		num++;
 	}
 
 	if (types == NULL)
 		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
 					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	num = g_slist_length(types);
-
 	/* Handle length plus attribute value length */
 	length += 2;
 
@@ -622,9 +798,10 @@ static uint16_t find_info(struct gatt_channel *channel, uint16_t start,
 	struct attribute *a;
 	struct att_data_list *adl;
 	GSList *l, *info;
-	GList *dl, *database;
+	GPtrArray *database;
 	uint8_t format, last_type = BT_UUID_UNSPEC;
 	uint16_t length, num;
+	guint idx;
 	int i;
 
 	if (start > end || start == 0x0000)
@@ -632,11 +809,10 @@ static uint16_t find_info(struct gatt_channel *channel, uint16_t start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
 	database = channel->server->database;
-	for (dl = database, info = NULL, num = 0; dl; dl = dl->next) {
-		a = dl->data;
+	idx = lower_bound(database, start);
 
-		if (a->handle < start)
-			continue;
+	for (info = NULL, num = 0; idx < database->len; idx++) {
+		a = g_ptr_array_index(database, idx);
 
 		if (a->handle > end)
 			break;
@@ -647,6 +823,11 @@ static uint16_t find_info(struct gatt_channel *channel, uint16_t start,
 		if (a->uuid.type != last_type)
 			break;
 
+		/* Stop once the response is full */
+		if (num && 2 + (size_t) (num + 1) *
+					(bt_uuid_len(&a->uuid) + 2) > len)
+			break;
+
 		info = g_slist_append(info, a);
 		num++;
 
@@ -704,45 +885,47 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 	struct attribute *a;
 	struct att_range *range;
 	GSList *matches;
-	GList *dl, *database;
-	uint16_t len;
+	GPtrArray *list;
+	uint16_t len, num = 0;
+	guint idx;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, opdu, mtu);
 
-	/* Searching first requested handle number */
-	database = channel->server->database;
-	for (dl = database, matches = NULL, range = NULL; dl; dl = dl->next) {
-		a = dl->data;
+	list = lookup_list(channel->server, uuid);
+	idx = list ? lower_bound(list, start) : 0;
 
-		if (a->handle < start)
-			continue;
+	for (matches = NULL; list && idx < list->len; idx++) {
+		a = g_ptr_array_index(list, idx);
 
 		if (a->handle > end)
 			break;
 
 		/* Primary service? Attribute value matches? */
-		if ((bt_uuid_cmp(&a->uuid, uuid) == 0) && (a->len == vlen) &&
-					(memcmp(a->data, value, vlen) == 0)) {
+		if ((bt_uuid_cmp(&a->uuid, uuid) != 0) || (a->len != vlen) ||
+					(memcmp(a->data, value, vlen) != 0))
+			continue;
+
+		/* Stop once the response is full */
+		if (num && 1 + (size_t) (num + 1) * 4 > mtu)
+			break;
+
+		range = g_new0(struct att_range, 1);
+		range->start = a->handle;
 
-			range = g_new0(struct att_range, 1);
-			range->start = a->handle;
-			/* It is allowed to have end group handle the same as
-			 * start handle, for groups with only one attribute. */
+		/*
+		 * Services span up to the next service declaration, other
+		 * attributes are groups on their own.
+		 */
+		if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
+				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
+			range->end = group_end(channel->server, a->handle);
+		else
 			range->end = a->handle;
 
-			matches = g_slist_append(matches, range);
-		} else if (range) {
-			/* Update the last found handle or reset the pointer
-			 * to track that a new group started: Primary or
-			 * Secondary service. */
-			if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-					bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
-				range = NULL;
-			else
-				range->end = a->handle;
-		}
+		matches = g_slist_append(matches, range);
+		num++;
 	}
 
 	if (matches == NULL)
@@ -756,38 +939,179 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 	return len;
 }
 
-static int read_device_ccc(struct btd_device *device, uint16_t handle,
-				uint16_t *value)
+static void ccc_state_free(void *data)
 {
-	char *filename;
+	struct ccc_state *state = data;
+
+	g_hash_table_destroy(state->values);
+	g_free(state->filename);
+	g_free(state);
+}
+
+static struct ccc_state *ccc_state_load(char *filename)
+{
+	struct ccc_state *state;
 	GKeyFile *key_file;
-	char group[6];
-	char *str;
-	unsigned int config;
-	int err = 0;
+	char **groups;
+	int i;
+
+	state = g_new0(struct ccc_state, 1);
+	state->filename = filename;
+	state->values = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	key_file = g_key_file_new();
+	btd_worker_load_key_file(key_file, filename);
+
+	groups = g_key_file_get_groups(key_file, NULL);
+
+	for (i = 0; groups[i]; i++) {
+		unsigned int handle, config;
+		char *str;
+
+		if (sscanf(groups[i], "%u", &handle) != 1)
+			continue;
+
+		str = g_key_file_get_string(key_file, groups[i], "Value",
+									NULL);
+		if (str && sscanf(str, "%04X", &config) == 1)
+			g_hash_table_insert(state->values,
+						GUINT_TO_POINTER(handle),
+						GUINT_TO_POINTER(config));
+
+		g_free(str);
+	}
+
+	g_strfreev(groups);
+	g_key_file_free(key_file);
+
+	return state;
+}
+
+/*
+ * CCC values of a device, loaded from its storage the first time they are
+ * needed and written back shortly after they change.
+ */
+static struct ccc_state *ccc_state_get(struct gatt_server *server,
+						struct btd_device *device)
+{
+	struct ccc_state *state;
+	char *filename;
 
 	filename = btd_device_get_storage_path(device, "ccc");
 	if (!filename) {
 		warn("Unable to get ccc storage path for device");
-		return -ENOENT;
+		return NULL;
+	}
+
+	state = g_hash_table_lookup(server->ccc, filename);
+	if (state) {
+		g_free(filename);
+		return state;
 	}
 
+	state = ccc_state_load(filename);
+	g_hash_table_insert(server->ccc, state->filename, state);
+
+	return state;
+}
+
+static void ccc_state_store(struct ccc_state *state)
+{
+	GHashTableIter iter;
+	GKeyFile *key_file;
+	gpointer handle, config;
+	char group[6], value[5];
+	char *data;
+	gsize length = 0;
+
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
 
-	sprintf(group, "%hu", handle);
+	g_hash_table_iter_init(&iter, state->values);
+	while (g_hash_table_iter_next(&iter, &handle, &config)) {
+		sprintf(group, "%hu", (uint16_t) GPOINTER_TO_UINT(handle));
+		sprintf(value, "%hX", (uint16_t) GPOINTER_TO_UINT(config));
+		g_key_file_set_string(key_file, group, "Value", value);
+	}
 
-	str = g_key_file_get_string(key_file, group, "Value", NULL);
-	if (!str || sscanf(str, "%04X", &config) != 1)
-		err = -ENOENT;
+	data = g_key_file_to_data(key_file, &length, NULL);
+	if (length > 0)
+		btd_worker_store_file(state->filename, data, length);
 	else
-		*value = config;
-
-	g_free(str);
-	g_free(filename);
+		g_free(data);
 	g_key_file_free(key_file);
 
-	return err;
+	state->dirty = FALSE;
+}
+
+static void ccc_sync(struct gatt_server *server)
+{
+	GHashTableIter iter;
+	gpointer state;
+
+	if (server->ccc_sync_id) {
+		g_source_remove(server->ccc_sync_id);
+		server->ccc_sync_id = 0;
+	}
+
+	g_hash_table_iter_init(&iter, server->ccc);
+	while (g_hash_table_iter_next(&iter, NULL, &state)) {
+		if (((struct ccc_state *) state)->dirty)
+			ccc_state_store(state);
+	}
+}
+
+static gboolean ccc_sync_timeout(gpointer user_data)
+{
+	struct gatt_server *server = user_data;
+
+	server->ccc_sync_id = 0;
+	ccc_sync(server);
+
+	return FALSE;
+}
+
+static int read_device_ccc(struct gatt_server *server,
+				struct btd_device *device, uint16_t handle,
+				uint16_t *value)
+{
+	struct ccc_state *state;
+	gpointer config;
+
+	state = ccc_state_get(server, device);
+	if (!state)
+		return -ENOENT;
+
+	if (!g_hash_table_lookup_extended(state->values,
+					GUINT_TO_POINTER(handle), NULL,
+					&config))
+		return -ENOENT;
+
+	*value = GPOINTER_TO_UINT(config);
+
+	return 0;
+}
+
+static int write_device_ccc(struct gatt_server *server,
+				struct btd_device *device, uint16_t handle,
+				uint16_t value)
+{
+	struct ccc_state *state;
+
+	state = ccc_state_get(server, device);
+	if (!state)
+		return -ENOENT;
+
+	g_hash_table_insert(state->values, GUINT_TO_POINTER(handle),
+						GUINT_TO_POINTER(value));
+
+	state->dirty = TRUE;
+
+	if (!server->ccc_sync_id)
+		server->ccc_sync_id = g_timeout_add_seconds(CCC_SYNC_TIMEOUT,
+							ccc_sync_timeout,
+							server);
+
+	return 0;
 }
 
 static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
@@ -795,20 +1119,16 @@ static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
 	uint16_t cccval;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = find_attribute(channel->server, handle);
+	if (!a)
 		return enc_error_resp(ATT_OP_READ_REQ, handle,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(channel->device, handle, &cccval) == 0) {
+		read_device_ccc(channel->server, channel->device, handle,
+							&cccval) == 0) {
 		uint8_t config[2];
 
 		put_le16(cccval, config);
@@ -832,24 +1152,20 @@ static uint16_t read_blob(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
 	uint16_t cccval;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = find_attribute(channel->server, handle);
+	if (!a)
 		return enc_error_resp(ATT_OP_READ_BLOB_REQ, handle,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	if (a->len <= offset)
 		return enc_error_resp(ATT_OP_READ_BLOB_REQ, handle,
 					ATT_ECODE_INVALID_OFFSET, pdu, len);
 
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(channel->device, handle, &cccval) == 0) {
+		read_device_ccc(channel->server, channel->device, handle,
+							&cccval) == 0) {
 		uint8_t config[2];
 
 		put_le16(cccval, config);
@@ -875,17 +1191,12 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 {
 	struct attribute *a;
 	uint8_t status;
-	GList *l;
-	guint h = handle;
 
-	l = g_list_find_custom(channel->server->database,
-					GUINT_TO_POINTER(h), handle_cmp);
-	if (!l)
+	a = find_attribute(channel->server, handle);
+	if (!a)
 		return enc_error_resp(ATT_OP_WRITE_REQ, handle,
 				ATT_ECODE_INVALID_HANDLE, pdu, len);
 
-	a = l->data;
-
 	status = att_check_reqs(channel, ATT_OP_WRITE_REQ, a->write_req);
 	if (status)
 		return enc_error_resp(ATT_OP_WRITE_REQ, handle, status, pdu,
@@ -903,38 +1214,10 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 				return enc_error_resp(ATT_OP_WRITE_REQ, handle,
 							status, pdu, len);
 		}
-	} else {
-		uint16_t cccval = get_le16(value);
-		char *filename;
-		GKeyFile *key_file;
-		char group[6], value[5];
-		char *data;
-		gsize length = 0;
-
-		filename = btd_device_get_storage_path(channel->device, "ccc");
-		if (!filename) {
-			warn("Unable to get ccc storage path for device");
-			return enc_error_resp(ATT_OP_WRITE_REQ, handle,
-						ATT_ECODE_WRITE_NOT_PERM,
-						pdu, len);
-		}
-
-		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
-
-		sprintf(group, "%hu", handle);
-		sprintf(value, "%hX", cccval);
-		g_key_file_set_string(key_file, group, "Value", value);
-
-		data = g_key_file_to_data(key_file, &length, NULL);
-		if (length > 0) {
-			create_file(filename, S_IRUSR | S_IWUSR);
-			g_file_set_contents(filename, data, length, NULL);
-		}
-
-		g_free(data);
-		g_free(filename);
-		g_key_file_free(key_file);
+	} else if (write_device_ccc(channel->server, channel->device,
+					handle, get_le16(value)) < 0) {
+		return enc_error_resp(ATT_OP_WRITE_REQ, handle,
+					ATT_ECODE_WRITE_NOT_PERM, pdu, len);
 	}
 
 	return enc_write_resp(pdu);
@@ -1184,9 +1467,13 @@ guint attrib_channel_attach(GAttrib *attrib)
 
 		filename = btd_device_get_storage_path(device, "ccc");
 		if (filename) {
+			g_hash_table_remove(server->ccc, filename);
 			unlink(filename);
 			g_free(filename);
 		}
+	} else {
+		/* Restore the subscriptions before the first request */
+		ccc_state_get(server, device);
 	}
 
 	if (cid != ATT_CID) {
@@ -1364,6 +1651,12 @@ int btd_adapter_gatt_server_start(struct btd_adapter *adapter)
 
 	server = g_new0(struct gatt_server, 1);
 	server->adapter = btd_adapter_ref(adapter);
+	server->database = g_ptr_array_new_with_free_func(attrib_free);
+	server->free_handles = handle_alloc_new(0x0001, 0xffff);
+	server->types = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, type_list_free);
+	server->ccc = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+							ccc_state_free);
 
 	addr = btd_adapter_get_address(server->adapter);
 
@@ -1438,92 +1731,125 @@ void attrib_free_sdp(struct btd_adapter *adapter, uint32_t sdp_handle)
 	adapter_service_remove(adapter, sdp_handle);
 }
 
-static uint16_t find_uuid16_avail(struct btd_adapter *adapter, uint16_t nitems)
+static bool is_service(struct attribute *a)
 {
+	return bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
+				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0;
+}
+
+struct find_avail {
 	struct gatt_server *server;
+	uint16_t nitems;
+	unsigned int bound;
 	uint16_t handle;
-	GSList *l;
-	GList *dl;
+};
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
-		return 0;
+/*
+ * Only free ranges right in front of a service declaration, or at the end
+ * of the database, are between services. Others are holes in a service.
+ */
+static bool between_services(struct gatt_server *server, uint16_t end)
+{
+	struct attribute *a;
 
-	server = l->data;
-	if (server->database == NULL)
-		return 0x0001;
+	if (end == 0xffff)
+		return true;
 
-	for (dl = server->database, handle = 0x0001; dl; dl = dl->next) {
-		struct attribute *a = dl->data;
+	a = find_attribute(server, end + 1);
 
-		if ((bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0) &&
-				a->handle - handle >= nitems)
-			/* Note: the range above excludes the current handle */
-			return handle;
+	return a && is_service(a);
+}
 
-		if (a->len == 16 && (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
-				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)) {
-			/* 128 bit UUID service definition */
-			return 0;
-		}
+/* Lowest 128-bit service declaration and highest 16-bit one */
+static void find_service_bounds(struct gatt_server *server,
+					unsigned int *uuid128_first,
+					unsigned int *uuid16_last)
+{
+	GPtrArray *lists[] = { type_list(server, &prim_uuid),
+					type_list(server, &snd_uuid) };
+	guint i, j;
 
-		if (a->handle == 0xffff)
-			return 0;
+	*uuid128_first = 0x10000;
+	*uuid16_last = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(lists); i++) {
+		for (j = 0; lists[i] && j < lists[i]->len; j++) {
+			struct attribute *a = g_ptr_array_index(lists[i], j);
 
-		handle = a->handle + 1;
+			if (a->len == 16)
+				*uuid128_first = MIN(*uuid128_first, a->handle);
+			else if (a->len == 2)
+				*uuid16_last = MAX(*uuid16_last, a->handle);
+		}
 	}
+}
 
-	if (0xffff - handle + 1 >= nitems)
-		return handle;
+static bool find_uuid16_range(uint16_t start, uint16_t end, void *user_data)
+{
+	struct find_avail *data = user_data;
 
-	return 0;
+	/* 16 bit UUID services are all kept below 128 bit UUID ones */
+	if (start > data->bound)
+		return true;
+
+	if (end - start + 1 < data->nitems ||
+				!between_services(data->server, end))
+		return false;
+
+	data->handle = start;
+
+	return true;
 }
 
-static uint16_t find_uuid128_avail(struct btd_adapter *adapter, uint16_t nitems)
+static bool find_uuid128_range(uint16_t start, uint16_t end, void *user_data)
 {
-	uint16_t handle = 0, end = 0xffff;
-	struct gatt_server *server;
-	GList *dl;
-	GSList *l;
+	struct find_avail *data = user_data;
 
-	l = g_slist_find_custom(servers, adapter, adapter_cmp);
-	if (l == NULL)
-		return 0;
+	if (end < data->bound)
+		return true;
 
-	server = l->data;
-	if (server->database == NULL)
-		return 0xffff - nitems + 1;
+	if (end - start + 1 < data->nitems ||
+				!between_services(data->server, end))
+		return false;
 
-	for (dl = g_list_last(server->database); dl; dl = dl->prev) {
-		struct attribute *a = dl->data;
+	data->handle = end - data->nitems + 1;
 
-		if (handle == 0)
-			handle = a->handle;
+	return true;
+}
 
-		if (bt_uuid_cmp(&a->uuid, &prim_uuid) != 0 &&
-				bt_uuid_cmp(&a->uuid, &snd_uuid) != 0)
-			continue;
+/*
+ * 16 bit UUID services are allocated from the lowest handles and 128 bit
+ * UUID ones from the highest, each in the first gap between services that
+ * is large enough. Only the free ranges are walked, not the database.
+ */
+static uint16_t find_avail(struct btd_adapter *adapter, bool uuid16,
+							uint16_t nitems)
+{
+	struct find_avail data;
+	unsigned int uuid128_first, uuid16_last;
+	GSList *l;
 
-		if (end - handle >= nitems)
-			return end - nitems + 1;
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return 0;
 
-		if (a->len == 2) {
-			/* 16 bit UUID service definition */
-			return 0;
-		}
+	memset(&data, 0, sizeof(data));
+	data.server = l->data;
+	data.nitems = nitems;
 
-		if (a->handle == 0x0001)
-			return 0;
+	find_service_bounds(data.server, &uuid128_first, &uuid16_last);
 
-		end = a->handle - 1;
-		handle = 0;
+	if (uuid16) {
+		data.bound = uuid128_first;
+		handle_alloc_foreach(data.server->free_handles, false,
+						find_uuid16_range, &data);
+	} else {
+		data.bound = uuid16_last;
+		handle_alloc_foreach(data.server->free_handles, true,
+						find_uuid128_range, &data);
 	}
 
-	if (end - 0x0001 >= nitems)
-		return end - nitems + 1;
-
-	return 0;
+	return data.handle;
 }
 
 uint16_t attrib_db_find_avail(struct btd_adapter *adapter, bt_uuid_t *svc_uuid,
@@ -1532,9 +1858,9 @@ uint16_t attrib_db_find_avail(struct btd_adapter *adapter, bt_uuid_t *svc_uuid,
 	g_assert(nitems > 0);
 
 	if (svc_uuid->type == BT_UUID16)
-		return find_uuid16_avail(adapter, nitems);
+		return find_avail(adapter, true, nitems);
 	else if (svc_uuid->type == BT_UUID128)
-		return find_uuid128_avail(adapter, nitems);
+		return find_avail(adapter, false, nitems);
 	else {
 		char uuidstr[MAX_LEN_UUID_STR];
 
@@ -1567,8 +1893,6 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	struct gatt_server *server;
 	struct attribute *a;
 	GSList *l;
-	GList *dl;
-	guint h = handle;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
@@ -1578,13 +1902,10 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 
 	DBG("handle=0x%04x", handle);
 
-	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (dl == NULL)
+	a = find_attribute(server, handle);
+	if (a == NULL)
 		return -ENOENT;
 
-	a = dl->data;
-
 	a->data = g_try_realloc(a->data, len);
 	if (len && a->data == NULL)
 		return -ENOMEM;
@@ -1592,8 +1913,11 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	a->len = len;
 	memcpy(a->data, value, len);
 
-	if (uuid != NULL)
+	if (uuid != NULL && bt_uuid_cmp(&a->uuid, uuid) != 0) {
+		unindex_attribute(server, a);
 		a->uuid = *uuid;
+		index_attribute(server, a);
+	}
 
 	if (attr)
 		*attr = a;
@@ -1601,13 +1925,200 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	return 0;
 }
 
+/* CCC descriptor of the characteristic whose value is at handle, or 0 */
+static uint16_t find_ccc(struct gatt_server *server, uint16_t handle)
+{
+	GPtrArray *list;
+	uint16_t ccc, next;
+	guint i;
+
+	list = type_list(server, &ccc_uuid);
+	if (!list)
+		return 0;
+
+	i = lower_bound(list, handle + 1);
+	if (i == list->len)
+		return 0;
+
+	ccc = handle_at(list, i);
+
+	/* It must not belong to a later characteristic or service */
+	list = type_list(server, &chr_uuid);
+	if (list) {
+		i = lower_bound(list, handle + 1);
+		if (i < list->len && handle_at(list, i) < ccc)
+			return 0;
+	}
+
+	next = next_service(server, handle);
+	if (next && next < ccc)
+		return 0;
+
+	return ccc;
+}
+
+static void notify_pdu_free(void *data)
+{
+	struct notify_pdu *np = data;
+
+	g_free(np->pdu);
+	g_free(np);
+}
+
+/*
+ * PDUs only differ by opcode and by how much of the value fits in the
+ * MTU, so each variant is encoded once per update and shared by every
+ * channel needing it.
+ */
+static struct notify_pdu *notify_pdu_get(GSList **cache, struct attribute *a,
+						uint8_t opcode, guint mtu)
+{
+	struct notify_pdu *np;
+	size_t vlen = MIN(a->len, mtu - 3);
+	GSList *l;
+
+	for (l = *cache; l; l = l->next) {
+		np = l->data;
+
+		if (np->opcode == opcode && np->vlen == vlen)
+			return np;
+	}
+
+	np = g_new0(struct notify_pdu, 1);
+	np->opcode = opcode;
+	np->vlen = vlen;
+	np->pdu = g_malloc(vlen + 3);
+
+	if (opcode == ATT_OP_HANDLE_NOTIFY)
+		np->len = enc_notification(a->handle, a->data, vlen, np->pdu,
+								vlen + 3);
+	else
+		np->len = enc_indication(a->handle, a->data, vlen, np->pdu,
+								vlen + 3);
+
+	*cache = g_slist_prepend(*cache, np);
+
+	return np;
+}
+
+static void notify_channel(struct gatt_channel *channel, struct attribute *a,
+					uint16_t ccc, GSList **cache)
+{
+	struct notify_pdu *np;
+	uint16_t config;
+	uint8_t opcode;
+
+	if (read_device_ccc(channel->server, channel->device, ccc,
+							&config) < 0)
+		return;
+
+	if (config & GATT_CLIENT_CHARAC_CFG_NOTIF_BIT)
+		opcode = ATT_OP_HANDLE_NOTIFY;
+	else if (config & GATT_CLIENT_CHARAC_CFG_IND_BIT)
+		opcode = ATT_OP_HANDLE_IND;
+	else
+		return;
+
+	np = notify_pdu_get(cache, a, opcode, channel->mtu);
+
+	g_attrib_send(channel->attrib, 0, np->pdu, np->len, NULL, NULL, NULL);
+
+	channel->last_notify = g_get_monotonic_time();
+}
+
+static gboolean deferred_notify(gpointer user_data)
+{
+	struct gatt_channel *channel = user_data;
+	GSList *handles = channel->deferred, *l;
+	GSList *cache = NULL;
+
+	channel->notify_id = 0;
+	channel->deferred = NULL;
+
+	/* Send the latest value of every handle updated meanwhile */
+	for (l = handles; l; l = l->next) {
+		uint16_t handle = GPOINTER_TO_UINT(l->data);
+		struct attribute *a;
+		uint16_t ccc;
+
+		a = find_attribute(channel->server, handle);
+		ccc = find_ccc(channel->server, handle);
+		if (a && ccc)
+			notify_channel(channel, a, ccc, &cache);
+
+		g_slist_free_full(cache, notify_pdu_free);
+		cache = NULL;
+	}
+
+	g_slist_free(handles);
+
+	return FALSE;
+}
+
+static void defer_notify(struct gatt_channel *channel, uint16_t handle,
+								gint64 now)
+{
+	gint64 elapsed = (now - channel->last_notify) / 1000;
+
+	if (!g_slist_find(channel->deferred, GUINT_TO_POINTER(handle)))
+		channel->deferred = g_slist_append(channel->deferred,
+						GUINT_TO_POINTER(handle));
+
+	if (channel->notify_id)
+		return;
+
+	channel->notify_id = g_timeout_add(MAX(NOTIFY_INTERVAL - elapsed, 1),
+						deferred_notify, channel);
+}
+
+int attrib_db_notify(struct btd_adapter *adapter, uint16_t handle)
+{
+	struct gatt_server *server;
+	struct attribute *a;
+	GSList *l, *cache = NULL;
+	uint16_t ccc;
+	gint64 now;
+
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return -ENOENT;
+
+	server = l->data;
+
+	a = find_attribute(server, handle);
+	if (a == NULL)
+		return -ENOENT;
+
+	ccc = find_ccc(server, handle);
+	if (!ccc)
+		return -EINVAL;
+
+	now = g_get_monotonic_time();
+
+	for (l = server->clients; l; l = l->next) {
+		struct gatt_channel *channel = l->data;
+
+		/* Updates within the interval are coalesced per client */
+		if (channel->notify_id ||
+				now - channel->last_notify <
+						NOTIFY_INTERVAL * 1000) {
+			defer_notify(channel, handle, now);
+			continue;
+		}
+
+		notify_channel(channel, a, ccc, &cache);
+	}
+
+	g_slist_free_full(cache, notify_pdu_free);
+
+	return 0;
+}
+
 int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 {
 	struct gatt_server *server;
 	struct attribute *a;
 	GSList *l;
-	GList *dl;
-	guint h = handle;
 
 	l = g_slist_find_custom(servers, adapter, adapter_cmp);
 	if (l == NULL)
@@ -1617,15 +2128,15 @@ int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 
 	DBG("handle=0x%04x", handle);
 
-	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
-								handle_cmp);
-	if (dl == NULL)
+	a = find_attribute(server, handle);
+	if (a == NULL)
 		return -ENOENT;
 
-	a = dl->data;
-	server->database = g_list_remove(server->database, a);
-	g_free(a->data);
-	g_free(a);
+	unindex_attribute(server, a);
+	handle_alloc_put(server->free_handles, handle, 1);
+
+	/* The database owns its attributes, removing frees it */
+	list_remove(server->database, a);
 
 	return 0;
 }
@@ -1658,3 +2169,16 @@ int attrib_gap_set(struct btd_adapter *adapter, uint16_t uuid,
 
 	return attrib_db_update(adapter, handle, NULL, value, len, NULL);
 }
+
+int attrib_read_ccc(struct btd_device *device, uint16_t handle,
+							uint16_t *value)
+{
+	struct btd_adapter *adapter = device_get_adapter(device);
+	GSList *l;
+
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return -ENOENT;
+
+	return read_device_ccc(l->data, device, handle, value);
+}
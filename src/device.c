@@ -66,11 +66,14 @@
 #include "textfile.h"
 #include "storage.h"
 #include "attrib-server.h"
+#include "worker.h"
+#include "memstat.h"
 
 #define IO_CAPABILITY_NOINPUTNOOUTPUT	0x03
 
 #define DISCONNECT_TIMER	2
 #define DISCOVERY_TIMER		1
+#define STORE_INFO_DELAY	1
 
 static DBusConnection *dbus_conn = NULL;
 unsigned service_state_cb_id;
@@ -175,6 +178,7 @@ struct btd_device {
 	GSList		*svc_callbacks;
 	GSList		*eir_uuids;
 	char		name[MAX_NAME_LENGTH + 1];
+	time_t		name_expires;	/* cache entry, 0 if none */
 	char		*alias;
 	uint32_t	class;
 	uint16_t	vendor_src;
@@ -188,6 +192,8 @@ struct btd_device {
 	GSList		*primaries;		/* List of primary services */
 	GSList		*services;		/* List of btd_service */
 	GSList		*pending;		/* Pending services */
+	GSList		*connecting;		/* Services being connected */
+	gint64		connect_start;
 	GSList		*watches;		/* List of disconnect_data */
 	gboolean	temporary;
 	guint		disconn_timer;
@@ -215,16 +221,43 @@ struct btd_device {
 	gboolean	blocked;
 	gboolean	auto_connect;
 	gboolean	disable_auto_connect;
+	uint8_t		conn_priority;
 	gboolean	general_connect;
 
 	bool		legacy;
 	int8_t		rssi;
+	uint32_t	adv_hash[2];		/* Last advertising payloads */
+	unsigned int	props_dirty;		/* Deferred property changes */
+	guint		props_timer;
 
 	GIOChannel	*att_io;
 	guint		cleanup_id;
 	guint		store_id;
 };
 
+/* Properties updated from discovery results, signalled in batches */
+enum {
+	DEVICE_PROP_NAME,
+	DEVICE_PROP_ALIAS,
+	DEVICE_PROP_CLASS,
+	DEVICE_PROP_ICON,
+	DEVICE_PROP_APPEARANCE,
+	DEVICE_PROP_UUIDS,
+	DEVICE_PROP_LEGACY,
+	DEVICE_PROP_RSSI,
+};
+
+static const char *const device_prop_names[] = {
+	[DEVICE_PROP_NAME] = "Name",
+	[DEVICE_PROP_ALIAS] = "Alias",
+	[DEVICE_PROP_CLASS] = "Class",
+	[DEVICE_PROP_ICON] = "Icon",
+	[DEVICE_PROP_APPEARANCE] = "Appearance",
+	[DEVICE_PROP_UUIDS] = "UUIDs",
+	[DEVICE_PROP_LEGACY] = "LegacyPairing",
+	[DEVICE_PROP_RSSI] = "RSSI",
+};
+
 static const uint16_t uuid_list[] = {
 	L2CAP_UUID,
 	PNP_INFO_SVCLASS_ID,
@@ -233,6 +266,58 @@ static const uint16_t uuid_list[] = {
 };
 
 static int device_browse_primary(struct btd_device *device, DBusMessage *msg);
+
+static void flush_props(struct btd_device *device)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(device_prop_names); i++) {
+		if (device->props_dirty & (1 << i))
+			g_dbus_emit_property_changed(dbus_conn, device->path,
+							DEVICE_INTERFACE,
+							device_prop_names[i]);
+	}
+
+	device->props_dirty = 0;
+}
+
+static gboolean props_timeout(gpointer user_data)
+{
+	struct btd_device *device = user_data;
+
+	device->props_timer = 0;
+
+	flush_props(device);
+
+	return FALSE;
+}
+
+/*
+ * While discovering, the same devices report their properties over and
+ * over. Collect the changes and let gdbus merge them into a single
+ * PropertiesChanged signal per interval instead of one per report.
+ */
+static void emit_prop_changed(struct btd_device *device, unsigned int prop)
+{
+	device->props_dirty |= 1 << prop;
+
+	if (!main_opts.prop_interval ||
+			!btd_adapter_get_discovering(device->adapter)) {
+		if (device->props_timer) {
+			g_source_remove(device->props_timer);
+			device->props_timer = 0;
+		}
+
+		flush_props(device);
+		return;
+	}
+
+	if (device->props_timer)
+		return;
+
+	device->props_timer = g_timeout_add(main_opts.prop_interval,
+							props_timeout, device);
+}
 static int device_browse_sdp(struct btd_device *device, DBusMessage *msg);
 
 static struct bearer_state *get_state(struct btd_device *dev,
@@ -244,6 +329,17 @@ static struct bearer_state *get_state(struct btd_device *dev,
 		return &dev->le_state;
 }
 
+static void clear_pending(struct btd_device *dev)
+{
+	g_slist_free(dev->pending);
+	dev->pending = NULL;
+
+	g_slist_free(dev->connecting);
+	dev->connecting = NULL;
+
+	dev->connect_start = 0;
+}
+
 static GSList *find_service_with_profile(GSList *list, struct btd_profile *p)
 {
 	GSList *l;
@@ -318,7 +414,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 			device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -376,11 +472,9 @@ static gboolean store_device_info_cb(gpointer user_data)
 		g_key_file_remove_group(key_file, "DeviceID", NULL);
 	}
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
+	/* The worker skips the rewrite if nothing actually changed */
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	btd_worker_store_file(filename, str, length);
 
 	g_key_file_free(key_file);
 	g_free(uuids);
@@ -413,7 +507,13 @@ static void store_device_info(struct btd_device *device)
 		return;
 	}
 
-	device->store_id = g_idle_add(store_device_info_cb, device);
+	/*
+	 * Changes tend to come in bursts, e.g. while discovering or
+	 * resolving services, so collect them into a single write.
+	 * device_remove() flushes anything still pending.
+	 */
+	device->store_id = g_timeout_add_seconds(STORE_INFO_DELAY,
+						store_device_info_cb, device);
 }
 
 void device_store_cached_name(struct btd_device *dev, const char *name)
@@ -424,24 +524,46 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	char *data;
 	gsize length = 0;
 
+	time_t now, expires = 0;
+
 	if (device_address_is_private(dev)) {
 		warn("Can't store name for private addressed device %s",
 								dev->path);
 		return;
 	}
 
+	now = time(NULL);
+	if (main_opts.name_cache_ttl)
+		expires = now + main_opts.name_cache_ttl;
+
+	/*
+	 * Discovery keeps reporting the same name. Only rewrite the cache
+	 * file when the name changed or half of its lifetime has passed.
+	 */
+	if (dev->name_expires && !strcmp(dev->name, name) &&
+			(!expires || dev->name_expires - now >
+					(time_t) main_opts.name_cache_ttl / 2))
+		return;
+
+	dev->name_expires = expires ? expires : 1;
+
 	ba2str(btd_adapter_get_address(dev->adapter), s_addr);
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", s_addr, d_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	g_key_file_set_string(key_file, "General", "Name", name);
 
+	if (expires)
+		g_key_file_set_int64(key_file, "General", "NameExpires",
+								expires);
+	else
+		g_key_file_remove_key(key_file, "General", "NameExpires",
+									NULL);
+
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-	g_free(data);
+	btd_worker_store_file(filename, data, length);
 
 	g_key_file_free(key_file);
 }
@@ -510,12 +632,23 @@ static void svc_dev_remove(gpointer user_data)
 	g_free(cb);
 }
 
+static void free_primaries(struct btd_device *device)
+{
+	unsigned int count = g_slist_length(device->primaries);
+
+	btd_mem_remove(BTD_MEM_GATT_PRIMARY, count,
+					count * sizeof(struct gatt_primary));
+
+	g_slist_free_full(device->primaries, g_free);
+	device->primaries = NULL;
+}
+
 static void device_free(gpointer user_data)
 {
 	struct btd_device *device = user_data;
 
 	g_slist_free_full(device->uuids, g_free);
-	g_slist_free_full(device->primaries, g_free);
+	free_primaries(device);
 	g_slist_free_full(device->attios, g_free);
 	g_slist_free_full(device->attios_offline, g_free);
 	g_slist_free_full(device->svc_callbacks, svc_dev_remove);
@@ -532,6 +665,12 @@ static void device_free(gpointer user_data)
 	if (device->discov_timer)
 		g_source_remove(device->discov_timer);
 
+	if (device->props_timer)
+		g_source_remove(device->props_timer);
+
+	if (device->store_id)
+		g_source_remove(device->store_id);
+
 	if (device->connect)
 		dbus_message_unref(device->connect);
 
@@ -553,6 +692,8 @@ static void device_free(gpointer user_data)
 	g_free(device->path);
 	g_free(device->alias);
 	free(device->modalias);
+
+	btd_mem_remove(BTD_MEM_DEVICE, 1, sizeof(*device));
 	g_free(device);
 }
 
@@ -1121,8 +1262,7 @@ void device_request_disconnect(struct btd_device *device, DBusMessage *msg)
 
 	g_slist_foreach(device->services, dev_disconn_service, NULL);
 
-	g_slist_free(device->pending);
-	device->pending = NULL;
+	clear_pending(device);
 
 	while (device->watches) {
 		struct btd_disconnect_data *data = device->watches->data;
@@ -1204,35 +1344,60 @@ static DBusMessage *dev_disconnect(DBusConnection *conn, DBusMessage *msg,
 	return NULL;
 }
 
+/*
+ * Services are connected in order of priority. Services of the same
+ * priority are connected concurrently unless their profile requires
+ * to be connected on its own.
+ */
 static int connect_next(struct btd_device *dev)
 {
 	struct btd_service *service;
-	int err = -ENOENT;
+	struct btd_profile *p, *current = NULL;
+
+	if (dev->connecting)
+		current = btd_service_get_profile(dev->connecting->data);
+
+	if (!dev->connect_start)
+		dev->connect_start = g_get_monotonic_time();
 
 	while (dev->pending) {
 		service = dev->pending->data;
+		p = btd_service_get_profile(service);
 
-		if (btd_service_connect(service) == 0)
-			return 0;
+		if (current && (current->serial_connect || p->serial_connect ||
+					current->priority != p->priority))
+			break;
 
 		dev->pending = g_slist_delete_link(dev->pending, dev->pending);
+		dev->connecting = g_slist_append(dev->connecting, service);
+
+		if (btd_service_connect(service) < 0) {
+			dev->connecting = g_slist_remove(dev->connecting,
+								service);
+			continue;
+		}
+
+		DBG("%s connecting", p->name);
+
+		current = p;
 	}
 
-	return err;
+	return dev->connecting ? 0 : -ENOENT;
 }
 
 static void device_profile_connected(struct btd_device *dev,
 					struct btd_profile *profile, int err)
 {
-	struct btd_service *pending;
 	GSList *l;
 
-	DBG("%s %s (%d)", profile->name, strerror(-err), -err);
+	DBG("%s %s (%d) after %" G_GINT64_FORMAT " ms", profile->name,
+		strerror(-err), -err, dev->connect_start ?
+		(g_get_monotonic_time() - dev->connect_start) / 1000 : 0);
 
 	if (!err)
 		btd_device_set_temporary(dev, FALSE);
 
-	if (dev->pending == NULL)
+	if (dev->connecting == NULL)
 		return;
 
 	if (!btd_device_is_connected(dev)) {
@@ -1244,25 +1409,27 @@ static void device_profile_connected(struct btd_device *dev,
 		}
 	}
 
-
-	pending = dev->pending->data;
 	l = find_service_with_profile(dev->pending, profile);
 	if (l != NULL)
 		dev->pending = g_slist_delete_link(dev->pending, l);
 
-	/* Only continue connecting the next profile if it matches the first
-	 * pending, otherwise it will trigger another connect to the same
-	 * profile
+	/* Only continue with the next services once every service started
+	 * along with this one has completed, a profile not connected by us
+	 * must not trigger another connect.
 	 */
-	if (profile != btd_service_get_profile(pending))
+	l = find_service_with_profile(dev->connecting, profile);
+	if (l == NULL)
+		return;
+
+	dev->connecting = g_slist_delete_link(dev->connecting, l);
+	if (dev->connecting)
 		return;
 
 	if (connect_next(dev) == 0)
 		return;
 
 done:
-	g_slist_free(dev->pending);
-	dev->pending = NULL;
+	clear_pending(dev);
 
 	if (!dev->connect)
 		return;
@@ -1289,25 +1456,25 @@ done:
 	dev->connect = NULL;
 }
 
-void device_add_eir_uuids(struct btd_device *dev, GSList *uuids)
+void device_add_eir_uuid(struct btd_device *dev, const char *uuid)
 {
-	GSList *l;
-	bool added = false;
-
 	if (dev->bredr_state.svc_resolved || dev->le_state.svc_resolved)
 		return;
 
-	for (l = uuids; l != NULL; l = l->next) {
-		const char *str = l->data;
-		if (g_slist_find_custom(dev->eir_uuids, str, bt_uuid_strcmp))
-			continue;
-		added = true;
-		dev->eir_uuids = g_slist_append(dev->eir_uuids, g_strdup(str));
-	}
+	if (g_slist_find_custom(dev->eir_uuids, uuid, bt_uuid_strcmp))
+		return;
 
-	if (added)
-		g_dbus_emit_property_changed(dbus_conn, dev->path,
-						DEVICE_INTERFACE, "UUIDs");
+	dev->eir_uuids = g_slist_append(dev->eir_uuids, g_strdup(uuid));
+
+	emit_prop_changed(dev, DEVICE_PROP_UUIDS);
+}
+
+void device_add_eir_uuids(struct btd_device *dev, GSList *uuids)
+{
+	GSList *l;
+
+	for (l = uuids; l != NULL; l = l->next)
+		device_add_eir_uuid(dev, l->data);
 }
 
 static struct btd_service *find_connectable_service(struct btd_device *dev,
@@ -1376,7 +1543,7 @@ int btd_device_connect_services(struct btd_device *dev, GSList *services)
 {
 	GSList *l;
 
-	if (dev->pending || dev->connect || dev->browse)
+	if (dev->pending || dev->connecting || dev->connect || dev->browse)
 		return -EBUSY;
 
 	if (!btd_adapter_get_powered(dev->adapter))
@@ -1404,7 +1571,7 @@ static DBusMessage *connect_profiles(struct btd_device *dev, uint8_t bdaddr_type
 	DBG("%s %s, client %s", dev->path, uuid ? uuid : "(all)",
 						dbus_message_get_sender(msg));
 
-	if (dev->pending || dev->connect || dev->browse)
+	if (dev->pending || dev->connecting || dev->connect || dev->browse)
 		return btd_error_in_progress(msg);
 
 	if (!btd_adapter_get_powered(dev->adapter))
@@ -1956,7 +2123,8 @@ static const GDBusPropertyTable device_properties[] = {
 	{ "Trusted", "b", dev_property_get_trusted, dev_property_set_trusted },
 	{ "Blocked", "b", dev_property_get_blocked, dev_property_set_blocked },
 	{ "LegacyPairing", "b", dev_property_get_legacy },
-	{ "RSSI", "n", dev_property_get_rssi, NULL, dev_property_exists_rssi },
+	{ "RSSI", "n", dev_property_get_rssi, NULL, dev_property_exists_rssi,
+					G_DBUS_PROPERTY_FLAG_THROTTLED },
 	{ "Connected", "b", dev_property_get_connected },
 	{ "UUIDs", "as", dev_property_get_uuids },
 	{ "Modalias", "s", dev_property_get_modalias, NULL,
@@ -1970,6 +2138,16 @@ uint8_t btd_device_get_bdaddr_type(struct btd_device *dev)
 	return dev->bdaddr_type;
 }
 
+void btd_device_set_conn_priority(struct btd_device *dev, uint8_t priority)
+{
+	dev->conn_priority = priority;
+}
+
+uint8_t btd_device_get_conn_priority(struct btd_device *dev)
+{
+	return dev->conn_priority;
+}
+
 bool btd_device_is_connected(struct btd_device *dev)
 {
 	return dev->bredr_state.connected || dev->le_state.connected;
@@ -2080,22 +2258,40 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	char *str = NULL;
+	gint64 expires;
 	int len;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
+	if (!btd_worker_load_key_file(key_file, filename))
 		goto failed;
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
-	if (str) {
-		len = strlen(str);
-		if (len > HCI_MAX_NAME_LENGTH)
-			str[HCI_MAX_NAME_LENGTH] = '\0';
+	if (!str)
+		goto failed;
+
+	len = strlen(str);
+	if (len > HCI_MAX_NAME_LENGTH)
+		str[HCI_MAX_NAME_LENGTH] = '\0';
+
+	/*
+	 * Entries written before expiry was introduced have no NameExpires
+	 * and stay valid. Expired names are dropped so that the name gets
+	 * resolved again during the next discovery.
+	 */
+	expires = g_key_file_get_int64(key_file, "General", "NameExpires",
+									NULL);
+	if (expires > 0 && expires < time(NULL)) {
+		DBG("cached name of %s expired", peer);
+		g_free(str);
+		str = NULL;
+		goto failed;
 	}
 
+	device->name_expires = expires > 0 ? expires : 1;
+
 failed:
 	g_key_file_free(key_file);
 
@@ -2253,7 +2449,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 			peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	groups = g_key_file_get_groups(key_file, NULL);
 
 	for (handle = groups; *handle; handle++) {
@@ -2315,6 +2511,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 		g_free(str);
 
 		device->primaries = g_slist_append(device->primaries, prim);
+		btd_mem_add(BTD_MEM_GATT_PRIMARY, 1, sizeof(*prim));
 	}
 
 	g_strfreev(groups);
@@ -2335,6 +2532,8 @@ static struct btd_device *device_new(struct btd_adapter *adapter,
 	if (device == NULL)
 		return NULL;
 
+	btd_mem_add(BTD_MEM_DEVICE, 1, sizeof(*device));
+
 	address_up = g_ascii_strup(address, -1);
 	device->path = g_strdup_printf("%s/dev_%s", adapter_path, address_up);
 	g_strdelimit(device->path, ":", '_');
@@ -2447,14 +2646,12 @@ void btd_device_device_set_name(struct btd_device *device, const char *name)
 
 	store_device_info(device);
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "Name");
+	emit_prop_changed(device, DEVICE_PROP_NAME);
 
 	if (device->alias != NULL)
 		return;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "Alias");
+	emit_prop_changed(device, DEVICE_PROP_ALIAS);
 }
 
 void device_get_name(struct btd_device *device, char *name, size_t len)
@@ -2481,10 +2678,8 @@ void device_set_class(struct btd_device *device, uint32_t class)
 
 	store_device_info(device);
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "Class");
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "Icon");
+	emit_prop_changed(device, DEVICE_PROP_CLASS);
+	emit_prop_changed(device, DEVICE_PROP_ICON);
 }
 
 void device_update_addr(struct btd_device *device, const bdaddr_t *bdaddr,
@@ -2536,6 +2731,11 @@ void device_update_last_seen(struct btd_device *device, uint8_t bdaddr_type)
 		device->le_seen = time(NULL);
 }
 
+time_t device_get_last_seen(struct btd_device *device)
+{
+	return MAX(device->bredr_seen, device->le_seen);
+}
+
 /* It is possible that we have two device objects for the same device in
  * case it has first been discovered over BR/EDR and has a private
  * address when discovered over LE for the first time. In such a case we
@@ -2596,36 +2796,6 @@ uint16_t btd_device_get_version(struct btd_device *device)
 	return device->version;
 }
 
-static void delete_folder_tree(const char *dirname)
-{
-	DIR *dir;
-	struct dirent *entry;
-	char filename[PATH_MAX];
-
-	dir = opendir(dirname);
-	if (dir == NULL)
-		return;
-
-	while ((entry = readdir(dir)) != NULL) {
-		if (g_str_equal(entry->d_name, ".") ||
-				g_str_equal(entry->d_name, ".."))
-			continue;
-
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
-
-		if (entry->d_type == DT_DIR)
-			delete_folder_tree(filename);
-		else
-			unlink(filename);
-	}
-	closedir(dir);
-
-	rmdir(dirname);
-}
-
 static void device_remove_stored(struct btd_device *device)
 {
 	const bdaddr_t *src = btd_adapter_get_address(device->adapter);
@@ -2651,6 +2821,12 @@ static void device_remove_stored(struct btd_device *device)
 	device->bredr_state.paired = false;
 	device->le_state.paired = false;
 
+	if (device->tmp_records) {
+		sdp_list_free(device->tmp_records,
+					(sdp_free_func_t) sdp_record_free);
+		device->tmp_records = NULL;
+	}
+
 	if (device->blocked)
 		device_unblock(device, TRUE, FALSE);
 
@@ -2659,22 +2835,21 @@ static void device_remove_stored(struct btd_device *device)
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", adapter_addr,
 			device_addr);
-	delete_folder_tree(filename);
+	btd_worker_remove_tree(filename);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", adapter_addr,
 			device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 
-	g_free(data);
 	g_key_file_free(key_file);
 }
 
@@ -2703,8 +2878,7 @@ void device_remove(struct btd_device *device, gboolean remove_stored)
 		service_remove(service);
 	}
 
-	g_slist_free(device->pending);
-	device->pending = NULL;
+	clear_pending(device);
 
 	if (btd_device_is_connected(device))
 		disconnect_all(device);
@@ -2877,7 +3051,7 @@ void device_probe_profile(gpointer a, gpointer b)
 
 	device->pending = g_slist_append(device->pending, service);
 
-	if (g_slist_length(device->pending) == 1)
+	if (!device->connecting)
 		connect_next(device);
 }
 
@@ -2895,6 +3069,7 @@ void device_remove_profile(gpointer a, gpointer b)
 	service = l->data;
 	device->services = g_slist_delete_link(device->services, l);
 	device->pending = g_slist_remove(device->pending, service);
+	device->connecting = g_slist_remove(device->connecting, service);
 	service_remove(service);
 }
 
@@ -2913,6 +3088,8 @@ void device_probe_profiles(struct btd_device *device, GSList *uuids)
 
 	DBG("Probing profiles for device %s", addr);
 
+	plugin_init_for_uuids(uuids);
+
 	btd_profile_foreach(dev_probe, &d);
 
 add_uuids:
@@ -3057,13 +3234,13 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 							srcaddr, dstaddr);
 
 		sdp_key_file = g_key_file_new();
-		g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+		btd_worker_load_key_file(sdp_key_file, sdp_file);
 
 		snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes",
 							srcaddr, dstaddr);
 
 		att_key_file = g_key_file_new();
-		g_key_file_load_from_file(att_key_file, att_file, 0, NULL);
+		btd_worker_load_key_file(att_key_file, att_file);
 	}
 
 	for (seq = recs; seq; seq = seq->next) {
@@ -3127,23 +3304,21 @@ next:
 
 	if (sdp_key_file) {
 		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
-		}
+		if (length > 0)
+			btd_worker_store_file(sdp_file, data, length);
+		else
+			g_free(data);
 
-		g_free(data);
 		g_key_file_free(sdp_key_file);
 	}
 
 	if (att_key_file) {
 		data = g_key_file_to_data(att_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(att_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(att_file, data, length, NULL);
-		}
+		if (length > 0)
+			btd_worker_store_file(att_file, data, length);
+		else
+			g_free(data);
 
-		g_free(data);
 		g_key_file_free(att_key_file);
 	}
 }
@@ -3218,6 +3393,11 @@ static GSList *device_services_from_record(struct btd_device *device,
 static void device_register_primaries(struct btd_device *device,
 						GSList *prim_list, int psm)
 {
+	unsigned int count = g_slist_length(prim_list);
+
+	btd_mem_add(BTD_MEM_GATT_PRIMARY, count,
+					count * sizeof(struct gatt_primary));
+
 	device->primaries = g_slist_concat(device->primaries, prim_list);
 }
 
@@ -3361,13 +3541,12 @@ static void store_services(struct btd_device *device)
 	}
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_worker_store_file(filename, data, length);
+	else
+		g_free(data);
 
 	free(prim_uuid);
-	g_free(data);
 	g_key_file_free(key_file);
 }
 
@@ -3446,8 +3625,7 @@ static void register_all_services(struct browse_req *req, GSList *services)
 	btd_device_set_temporary(device, FALSE);
 
 	update_gatt_services(req, device->primaries, services);
-	g_slist_free_full(device->primaries, g_free);
-	device->primaries = NULL;
+	free_primaries(device);
 
 	device_register_primaries(device, services, -1);
 
@@ -4070,8 +4248,20 @@ void device_set_legacy(struct btd_device *device, bool legacy)
 
 	device->legacy = legacy;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-					DEVICE_INTERFACE, "LegacyPairing");
+	emit_prop_changed(device, DEVICE_PROP_LEGACY);
+}
+
+static bool rssi_changed(struct btd_device *device, int8_t rssi)
+{
+	int delta;
+
+	if (rssi == 0 || device->rssi == 0)
+		return device->rssi != rssi;
+
+	delta = abs(device->rssi - rssi);
+
+	/* only report changes of at least the configured threshold */
+	return delta > 0 && delta >= main_opts.rssi_delta;
 }
 
 void device_set_rssi(struct btd_device *device, int8_t rssi)
@@ -4079,32 +4269,52 @@ void device_set_rssi(struct btd_device *device, int8_t rssi)
 	if (!device)
 		return;
 
-	if (rssi == 0 || device->rssi == 0) {
-		if (device->rssi == rssi)
-			return;
+	if (!rssi_changed(device, rssi))
+		return;
 
-		DBG("rssi %d", rssi);
+	DBG("rssi %d delta %d", rssi, abs(device->rssi - rssi));
 
-		device->rssi = rssi;
-	} else {
-		int delta;
+	device->rssi = rssi;
 
-		if (device->rssi > rssi)
-			delta = device->rssi - rssi;
-		else
-			delta = rssi - device->rssi;
+	emit_prop_changed(device, DEVICE_PROP_RSSI);
+}
 
-		/* only report changes of 8 dBm or more */
-		if (delta < 8)
-			return;
+static uint32_t adv_hash(uint8_t bdaddr_type, bool legacy,
+					const uint8_t *data, uint8_t data_len)
+{
+	uint32_t hash = 2166136261u;
+	uint8_t i;
 
-		DBG("rssi %d delta %d", rssi, delta);
+	hash = (hash ^ bdaddr_type) * 16777619u;
+	hash = (hash ^ legacy) * 16777619u;
+	hash = (hash ^ data_len) * 16777619u;
 
-		device->rssi = rssi;
-	}
+	for (i = 0; i < data_len; i++)
+		hash = (hash ^ data[i]) * 16777619u;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "RSSI");
+	/* Zero marks an unused slot */
+	return hash ? hash : 1;
+}
+
+/*
+ * Returns true if the advertising report matches one of the last two
+ * payloads seen from this device (older kernels deliver ADV_IND and
+ * SCAN_RSP separately) and the RSSI has not moved past the reporting
+ * threshold, meaning processing it again would not change anything.
+ */
+bool device_adv_unchanged(struct btd_device *device, uint8_t bdaddr_type,
+					bool legacy, const uint8_t *data,
+					uint8_t data_len, int8_t rssi)
+{
+	uint32_t hash = adv_hash(bdaddr_type, legacy, data, data_len);
+
+	if (hash == device->adv_hash[0] || hash == device->adv_hash[1])
+		return !rssi_changed(device, rssi);
+
+	device->adv_hash[1] = device->adv_hash[0];
+	device->adv_hash[0] = hash;
+
+	return false;
 }
 
 static gboolean start_discovery(gpointer user_data)
@@ -4154,6 +4364,13 @@ void device_set_unpaired(struct btd_device *dev, uint8_t bdaddr_type)
 
 	state->paired = false;
 
+	/* Stored records are only trusted while the device is paired */
+	if (bdaddr_type == BDADDR_BREDR && dev->tmp_records) {
+		sdp_list_free(dev->tmp_records,
+					(sdp_free_func_t) sdp_record_free);
+		dev->tmp_records = NULL;
+	}
+
 	/*
 	 * If the other bearer state is still true we don't need to
 	 * send any property signals or remove device.
@@ -4774,7 +4991,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_worker_load_key_file(key_file, filename);
 	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
 
 	for (handle = keys; handle && *handle; handle++) {
@@ -4856,12 +5073,10 @@ void device_set_appearance(struct btd_device *device, uint16_t value)
 	if (device->appearance == value)
 		return;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-					DEVICE_INTERFACE, "Appearance");
+	emit_prop_changed(device, DEVICE_PROP_APPEARANCE);
 
 	if (icon)
-		g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "Icon");
+		emit_prop_changed(device, DEVICE_PROP_ICON);
 
 	device->appearance = value;
 	store_device_info(device);
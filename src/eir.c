@@ -37,6 +37,7 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/sdp.h>
 
+#include "lib/uuid.h"
 #include "src/shared/util.h"
 #include "uuid-helper.h"
 #include "eir.h"
@@ -55,194 +56,235 @@ void eir_data_free(struct eir_data *eir)
 	eir->randomizer = NULL;
 }
 
-static void eir_parse_uuid16(struct eir_data *eir, const void *data,
-								uint8_t len)
+void eir_iter_init(struct eir_iter *iter, const uint8_t *data, uint16_t len)
 {
-	const uint16_t *uuid16 = data;
-	uuid_t service;
-	char *uuid_str;
-	unsigned int i;
+	iter->data = data;
+	iter->len = data ? len : 0;
+}
 
-	service.type = SDP_UUID16;
-	for (i = 0; i < len / 2; i++, uuid16++) {
-		service.value.uuid16 = get_le16(uuid16);
+/*
+ * Returns the next AD structure as a view into the buffer passed to
+ * eir_iter_init. AD structures are length prefixed, so the type octets
+ * are found by hopping over the lengths rather than by scanning bytes.
+ */
+bool eir_iter_next(struct eir_iter *iter, struct eir_field *field)
+{
+	uint8_t field_len;
 
-		uuid_str = bt_uuid2string(&service);
-		if (!uuid_str)
-			continue;
-		eir->services = g_slist_append(eir->services, uuid_str);
+	if (iter->len < 2)
+		return false;
+
+	field_len = iter->data[0];
+
+	/* Check for the end of EIR */
+	if (field_len == 0)
+		return false;
+
+	/* Do not continue EIR Data parsing if got incorrect length */
+	if (field_len + 1 > iter->len)
+		return false;
+
+	field->type = iter->data[1];
+	field->len = field_len - 1;
+	field->data = &iter->data[2];
+
+	iter->data += field_len + 1;
+	iter->len -= field_len + 1;
+
+	return true;
+}
+
+static uint8_t uuid_size(uint8_t type)
+{
+	switch (type) {
+	case EIR_UUID16_SOME:
+	case EIR_UUID16_ALL:
+		return 2;
+	case EIR_UUID32_SOME:
+	case EIR_UUID32_ALL:
+		return 4;
+	case EIR_UUID128_SOME:
+	case EIR_UUID128_ALL:
+		return 16;
 	}
+
+	return 0;
 }
 
-static void eir_parse_uuid32(struct eir_data *eir, const void *data,
-								uint8_t len)
+unsigned int eir_field_uuid_count(const struct eir_field *field)
 {
-	const uint32_t *uuid32 = data;
-	uuid_t service;
-	char *uuid_str;
-	unsigned int i;
+	uint8_t size = uuid_size(field->type);
 
-	service.type = SDP_UUID32;
-	for (i = 0; i < len / 4; i++, uuid32++) {
-		service.value.uuid32 = get_le32(uuid32);
+	if (!size)
+		return 0;
 
-		uuid_str = bt_uuid2string(&service);
-		if (!uuid_str)
-			continue;
-		eir->services = g_slist_append(eir->services, uuid_str);
-	}
+	return field->len / size;
 }
 
-static void eir_parse_uuid128(struct eir_data *eir, const uint8_t *data,
-								uint8_t len)
+bool eir_field_get_uuid(const struct eir_field *field, unsigned int index,
+							bt_uuid_t *uuid)
 {
-	const uint8_t *uuid_ptr = data;
-	uuid_t service;
-	char *uuid_str;
-	unsigned int i;
+	uint8_t size = uuid_size(field->type);
+	const uint8_t *data;
+	uint128_t u128;
 	int k;
 
-	service.type = SDP_UUID128;
-	for (i = 0; i < len / 16; i++) {
+	if (!size || index >= field->len / size)
+		return false;
+
+	data = field->data + index * size;
+
+	switch (size) {
+	case 2:
+		bt_uuid16_create(uuid, get_le16(data));
+		break;
+	case 4:
+		bt_uuid32_create(uuid, get_le32(data));
+		break;
+	case 16:
 		for (k = 0; k < 16; k++)
-			service.value.uuid128.data[k] = uuid_ptr[16 - k - 1];
-		uuid_str = bt_uuid2string(&service);
-		if (!uuid_str)
-			continue;
-		eir->services = g_slist_append(eir->services, uuid_str);
-		uuid_ptr += 16;
+			u128.data[k] = data[16 - k - 1];
+		bt_uuid128_create(uuid, u128);
+		break;
+	}
+
+	return true;
+}
+
+static void eir_parse_uuids(struct eir_data *eir,
+					const struct eir_field *field)
+{
+	unsigned int i, count = eir_field_uuid_count(field);
+	char str[MAX_LEN_UUID_STR];
+	bt_uuid_t uuid, uuid128;
+
+	for (i = 0; i < count; i++) {
+		eir_field_get_uuid(field, i, &uuid);
+		bt_uuid_to_uuid128(&uuid, &uuid128);
+		bt_uuid_to_string(&uuid128, str, sizeof(str));
+
+		eir->services = g_slist_append(eir->services, strdup(str));
 	}
 }
 
-static char *name2utf8(const uint8_t *name, uint8_t len)
+void eir_field_get_name(const struct eir_field *field, char *name,
+								size_t size)
 {
-	char utf8_name[HCI_MAX_NAME_LENGTH + 2];
-	int i;
+	uint8_t len = field->len;
+	size_t i;
+
+	/* Some vendors put a NUL byte terminator into the name */
+	while (len > 0 && field->data[len - 1] == '\0')
+		len--;
 
-	if (g_utf8_validate((const char *) name, len, NULL))
-		return g_strndup((char *) name, len);
+	if (len > size - 1)
+		len = size - 1;
 
-	memset(utf8_name, 0, sizeof(utf8_name));
-	strncpy(utf8_name, (char *) name, len);
+	memcpy(name, field->data, len);
+	name[len] = '\0';
+
+	if (g_utf8_validate(name, len, NULL))
+		return;
 
 	/* Assume ASCII, and replace all non-ASCII with spaces */
-	for (i = 0; utf8_name[i] != '\0'; i++) {
-		if (!isascii(utf8_name[i]))
-			utf8_name[i] = ' ';
+	for (i = 0; name[i] != '\0'; i++) {
+		if (!isascii(name[i]))
+			name[i] = ' ';
 	}
 
 	/* Remove leading and trailing whitespace characters */
-	g_strstrip(utf8_name);
-
-	return g_strdup(utf8_name);
+	g_strstrip(name);
 }
 
-void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+/* Parses the fields that need no allocation */
+void eir_parse_field(struct eir_data *eir, const struct eir_field *field)
 {
-	uint16_t len = 0;
+	const uint8_t *data = field->data;
 
-	eir->flags = 0;
-	eir->tx_power = 127;
+	switch (field->type) {
+	case EIR_FLAGS:
+		if (field->len > 0)
+			eir->flags = *data;
+		break;
 
-	/* No EIR data to parse */
-	if (eir_data == NULL)
-		return;
-
-	while (len < eir_len - 1) {
-		uint8_t field_len = eir_data[0];
-		const uint8_t *data;
-		uint8_t data_len;
+	case EIR_TX_POWER:
+		if (field->len < 1)
+			break;
+		eir->tx_power = (int8_t) data[0];
+		break;
 
-		/* Check for the end of EIR */
-		if (field_len == 0)
+	case EIR_CLASS_OF_DEV:
+		if (field->len < 3)
 			break;
+		eir->class = data[0] | (data[1] << 8) | (data[2] << 16);
+		break;
 
-		len += field_len + 1;
+	case EIR_GAP_APPEARANCE:
+		if (field->len < 2)
+			break;
+		eir->appearance = get_le16(data);
+		break;
 
-		/* Do not continue EIR Data parsing if got incorrect length */
-		if (len > eir_len)
+	case EIR_DEVICE_ID:
+		if (field->len < 8)
 			break;
 
-		data = &eir_data[2];
-		data_len = field_len - 1;
+		eir->did_source = data[0] | (data[1] << 8);
+		eir->did_vendor = data[2] | (data[3] << 8);
+		eir->did_product = data[4] | (data[5] << 8);
+		eir->did_version = data[6] | (data[7] << 8);
+		break;
+	}
+}
 
-		switch (eir_data[1]) {
+void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+{
+	char name[HCI_MAX_NAME_LENGTH + 2];
+	struct eir_iter iter;
+	struct eir_field field;
+
+	eir->flags = 0;
+	eir->tx_power = 127;
+
+	eir_iter_init(&iter, eir_data, eir_len);
+
+	while (eir_iter_next(&iter, &field)) {
+		switch (field.type) {
 		case EIR_UUID16_SOME:
 		case EIR_UUID16_ALL:
-			eir_parse_uuid16(eir, data, data_len);
-			break;
-
 		case EIR_UUID32_SOME:
 		case EIR_UUID32_ALL:
-			eir_parse_uuid32(eir, data, data_len);
-			break;
-
 		case EIR_UUID128_SOME:
 		case EIR_UUID128_ALL:
-			eir_parse_uuid128(eir, data, data_len);
-			break;
-
-		case EIR_FLAGS:
-			if (data_len > 0)
-				eir->flags = *data;
+			eir_parse_uuids(eir, &field);
 			break;
 
 		case EIR_NAME_SHORT:
 		case EIR_NAME_COMPLETE:
-			/* Some vendors put a NUL byte terminator into
-			 * the name */
-			while (data_len > 0 && data[data_len - 1] == '\0')
-				data_len--;
+			eir_field_get_name(&field, name, sizeof(name));
 
 			g_free(eir->name);
 
-			eir->name = name2utf8(data, data_len);
-			eir->name_complete = eir_data[1] == EIR_NAME_COMPLETE;
-			break;
-
-		case EIR_TX_POWER:
-			if (data_len < 1)
-				break;
-			eir->tx_power = (int8_t) data[0];
-			break;
-
-		case EIR_CLASS_OF_DEV:
-			if (data_len < 3)
-				break;
-			eir->class = data[0] | (data[1] << 8) |
-							(data[2] << 16);
-			break;
-
-		case EIR_GAP_APPEARANCE:
-			if (data_len < 2)
-				break;
-			eir->appearance = get_le16(data);
+			eir->name = g_strdup(name);
+			eir->name_complete = field.type == EIR_NAME_COMPLETE;
 			break;
 
 		case EIR_SSP_HASH:
-			if (data_len < 16)
+			if (field.len < 16)
 				break;
-			eir->hash = g_memdup(data, 16);
+			eir->hash = g_memdup(field.data, 16);
 			break;
 
 		case EIR_SSP_RANDOMIZER:
-			if (data_len < 16)
+			if (field.len < 16)
 				break;
-			eir->randomizer = g_memdup(data, 16);
+			eir->randomizer = g_memdup(field.data, 16);
 			break;
 
-		case EIR_DEVICE_ID:
-			if (data_len < 8)
-				break;
-
-			eir->did_source = data[0] | (data[1] << 8);
-			eir->did_vendor = data[2] | (data[3] << 8);
-			eir->did_product = data[4] | (data[5] << 8);
-			eir->did_version = data[6] | (data[7] << 8);
+		default:
+			eir_parse_field(eir, &field);
 			break;
 		}
-
-		eir_data += field_len + 1;
 	}
 }
 
@@ -37,6 +37,7 @@
 #define EIR_SSP_RANDOMIZER          0x0F  /* SSP Randomizer */
 #define EIR_DEVICE_ID               0x10  /* device ID */
 #define EIR_GAP_APPEARANCE          0x19  /* GAP appearance */
+#define EIR_MANUFACTURER_DATA       0xFF  /* Manufacturer Specific Data */
 
 /* Flags Descriptions */
 #define EIR_LIM_DISC                0x01 /* LE Limited Discoverable Mode */
@@ -64,6 +65,26 @@ struct eir_data {
 	uint16_t did_source;
 };
 
+struct eir_field {
+	uint8_t type;
+	uint8_t len;
+	const uint8_t *data;
+};
+
+struct eir_iter {
+	const uint8_t *data;
+	uint16_t len;
+};
+
+void eir_iter_init(struct eir_iter *iter, const uint8_t *data, uint16_t len);
+bool eir_iter_next(struct eir_iter *iter, struct eir_field *field);
+unsigned int eir_field_uuid_count(const struct eir_field *field);
+bool eir_field_get_uuid(const struct eir_field *field, unsigned int index,
+							bt_uuid_t *uuid);
+void eir_field_get_name(const struct eir_field *field, char *name,
+								size_t size);
+void eir_parse_field(struct eir_data *eir, const struct eir_field *field);
+
 void eir_data_free(struct eir_data *eir);
 void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
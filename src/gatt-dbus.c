@@ -26,6 +26,7 @@
 #endif
 
 #include <stdint.h>
+#include <string.h>
 #include <errno.h>
 
 #include <glib.h>
@@ -50,6 +51,8 @@
 #define GATT_CHR_IFACE			"org.bluez.GattCharacteristic1"
 #define GATT_DESCRIPTOR_IFACE		"org.bluez.GattDescriptor1"
 
+#define GET_TIMEOUT			5000
+
 struct external_service {
 	char *owner;
 	char *path;
@@ -57,15 +60,49 @@ struct external_service {
 	GDBusClient *client;
 	GSList *proxies;
 	struct btd_attribute *service;
+	GSList *attrs;
+};
+
+struct proxy_attr {
+	GDBusProxy *proxy;
+	struct external_service *esvc;
+
+	/*
+	 * Cached value, kept up to date by PropertiesChanged signals. It
+	 * is fetched with a Get call if the application didn't expose it.
+	 */
+	bool cached;
+	uint8_t *value;
+	size_t len;
+
+	/* Reads waiting for the Get call */
+	DBusPendingCall *get;
+	GSList *reads;
+};
+
+/* Characteristic or descriptor parsed from the object snapshot */
+struct attr_decl {
+	GDBusProxy *proxy;
+	bt_uuid_t uuid;
+	bool chr;
+	uint8_t props;
+};
+
+struct pending_read {
+	btd_attr_read_result_t result;
+	void *user_data;
 };
 
 struct proxy_write_data {
+	struct btd_attribute *attr;
 	btd_attr_write_result_t result_cb;
 	void *user_data;
+	uint8_t *value;
+	size_t len;
 };
 
 /*
- * Attribute to Proxy hash table. Used to map incoming
+ * Attribute to proxy_attr hash table. Used to map incoming
  * ATT operations to its external characteristic proxy.
  */
 static GHashTable *proxy_hash;
@@ -112,9 +149,16 @@ static void external_service_free(void *user_data)
 static void remove_service(DBusConnection *conn, void *user_data)
 {
 	struct external_service *esvc = user_data;
+	GSList *list;
 
 	external_services = g_slist_remove(external_services, esvc);
 
+	for (list = esvc->attrs; list; list = list->next)
+		g_hash_table_remove(proxy_hash, list->data);
+
+	g_slist_free(esvc->attrs);
+	esvc->attrs = NULL;
+
 	if (esvc->service)
 		btd_gatt_remove_service(esvc->service);
 
@@ -233,49 +277,180 @@ static void proxy_removed(GDBusProxy *proxy, void *user_data)
 	esvc->proxies = g_slist_remove(esvc->proxies, proxy);
 }
 
+static bool get_value(DBusMessageIter *iter, uint8_t **value, int *len)
+{
+	DBusMessageIter array;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(iter, &array);
+	dbus_message_iter_get_fixed_array(&array, value, len);
+
+	return true;
+}
+
+static void cache_set(struct proxy_attr *pattr, const uint8_t *value,
+								size_t len)
+{
+	uint8_t *copy;
+
+	copy = g_memdup(value, len);
+
+	g_free(pattr->value);
+	pattr->value = copy;
+	pattr->len = len;
+	pattr->cached = true;
+}
+
+static void complete_reads(struct proxy_attr *pattr, int err)
+{
+	GSList *reads = pattr->reads, *list;
+
+	pattr->reads = NULL;
+
+	for (list = reads; list; list = list->next) {
+		struct pending_read *read = list->data;
+
+		if (err)
+			read->result(err, NULL, 0, read->user_data);
+		else
+			read->result(0, pattr->value, pattr->len,
+							read->user_data);
+	}
+
+	g_slist_free_full(reads, g_free);
+}
+
+static void get_reply(DBusPendingCall *call, void *user_data)
+{
+	struct proxy_attr *pattr = user_data;
+	DBusMessage *reply = dbus_pending_call_steal_reply(call);
+	DBusMessageIter iter, variant;
+	uint8_t *value;
+	int len, err = -EPROTO;
+
+	dbus_pending_call_unref(pattr->get);
+	pattr->get = NULL;
+
+	if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+		goto done;
+
+	if (!dbus_message_iter_init(reply, &iter) ||
+			dbus_message_iter_get_arg_type(&iter) !=
+							DBUS_TYPE_VARIANT)
+		goto done;
+
+	dbus_message_iter_recurse(&iter, &variant);
+
+	if (!get_value(&variant, &value, &len))
+		goto done;
+
+	cache_set(pattr, value, len);
+	err = 0;
+
+done:
+	dbus_message_unref(reply);
+	complete_reads(pattr, err);
+}
+
+static bool refresh_value(struct proxy_attr *pattr)
+{
+	const char *iface = g_dbus_proxy_get_interface(pattr->proxy);
+	const char *name = "Value";
+	DBusMessage *msg;
+
+	if (pattr->get)
+		return true;
+
+	msg = dbus_message_new_method_call(pattr->esvc->owner,
+					g_dbus_proxy_get_path(pattr->proxy),
+					DBUS_INTERFACE_PROPERTIES, "Get");
+	if (!msg)
+		return false;
+
+	dbus_message_append_args(msg, DBUS_TYPE_STRING, &iface,
+					DBUS_TYPE_STRING, &name,
+					DBUS_TYPE_INVALID);
+
+	if (!g_dbus_send_message_with_reply(btd_get_dbus_connection(), msg,
+						&pattr->get, GET_TIMEOUT) ||
+						!pattr->get) {
+		dbus_message_unref(msg);
+		return false;
+	}
+
+	dbus_pending_call_set_notify(pattr->get, get_reply, pattr, NULL);
+	dbus_message_unref(msg);
+
+	return true;
+}
+
+static void proxy_attr_free(void *data)
+{
+	struct proxy_attr *pattr = data;
+
+	g_dbus_proxy_set_property_watch(pattr->proxy, NULL, NULL);
+
+	if (pattr->get) {
+		dbus_pending_call_cancel(pattr->get);
+		dbus_pending_call_unref(pattr->get);
+	}
+
+	complete_reads(pattr, -ECANCELED);
+
+	g_dbus_proxy_unref(pattr->proxy);
+	g_free(pattr->value);
+	g_free(pattr);
+}
+
 static void proxy_read_cb(struct btd_attribute *attr,
 				btd_attr_read_result_t result, void *user_data)
 {
-	DBusMessageIter iter, array;
-	GDBusProxy *proxy;
-	uint8_t *value;
-	int len;
+	struct proxy_attr *pattr;
+	struct pending_read *read;
 
 	/*
-	 * Remote device is trying to read the informed attribute,
-	 * "Value" should be read from the proxy. GDBusProxy tracks
-	 * properties changes automatically, it is not necessary to
-	 * get the value directly from the GATT server.
+	 * Remote device is trying to read the informed attribute. The
+	 * value is served from the cache, which is kept up to date by
+	 * PropertiesChanged signals.
 	 */
-	proxy = g_hash_table_lookup(proxy_hash, attr);
-	if (!proxy) {
+	pattr = g_hash_table_lookup(proxy_hash, attr);
+	if (!pattr) {
 		result(-ENOENT, NULL, 0, user_data);
 		return;
 	}
 
-	if (!g_dbus_proxy_get_property(proxy, "Value", &iter)) {
-		/* Unusual situation, read property will checked earlier */
-		result(-EPERM, NULL, 0, user_data);
+	if (pattr->cached) {
+		DBG("attribute: %p read %zu bytes", attr, pattr->len);
+		result(0, pattr->value, pattr->len, user_data);
 		return;
 	}
 
-	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
-		DBG("External service inconsistent!");
+	if (!refresh_value(pattr)) {
 		result(-EPERM, NULL, 0, user_data);
 		return;
 	}
 
-	dbus_message_iter_recurse(&iter, &array);
-	dbus_message_iter_get_fixed_array(&array, &value, &len);
+	read = g_new0(struct pending_read, 1);
+	read->result = result;
+	read->user_data = user_data;
+
+	pattr->reads = g_slist_append(pattr->reads, read);
+}
 
-	DBG("attribute: %p read %d bytes", attr, len);
+static void proxy_write_data_free(void *user_data)
+{
+	struct proxy_write_data *wdata = user_data;
 
-	result(0, value, len, user_data);
+	g_free(wdata->value);
+	g_free(wdata);
 }
 
 static void proxy_write_reply(const DBusError *derr, void *user_data)
 {
 	struct proxy_write_data *wdata = user_data;
+	struct proxy_attr *pattr;
 	int err;
 
 	/*
@@ -286,6 +461,11 @@ static void proxy_write_reply(const DBusError *derr, void *user_data)
 
 	if (!dbus_error_is_set(derr)) {
 		err = 0;
+
+		pattr = g_hash_table_lookup(proxy_hash, wdata->attr);
+		if (pattr)
+			cache_set(pattr, wdata->value, wdata->len);
+
 		goto done;
 	}
 
@@ -299,7 +479,7 @@ static void proxy_write_reply(const DBusError *derr, void *user_data)
 		err = -EPROTO;
 
 done:
-	if (wdata && wdata->result_cb)
+	if (wdata->result_cb)
 		wdata->result_cb(err, wdata->user_data);
 }
 
@@ -308,11 +488,13 @@ static void proxy_write_cb(struct btd_attribute *attr,
 					btd_attr_write_result_t result,
 					void *user_data)
 {
-	GDBusProxy *proxy;
+	struct proxy_attr *pattr;
+	struct proxy_write_data *wdata;
 
-	proxy = g_hash_table_lookup(proxy_hash, attr);
-	if (!proxy) {
-		result(-ENOENT, user_data);
+	pattr = g_hash_table_lookup(proxy_hash, attr);
+	if (!pattr) {
+		if (result)
+			result(-ENOENT, user_data);
 		return;
 	}
 
@@ -322,163 +504,226 @@ static void proxy_write_cb(struct btd_attribute *attr,
 	 * Command. Descriptors requires Write Request operation. For
 	 * Characteristics, the implementation will define which operations
 	 * are allowed based on the properties/flags.
-	 * TODO: Write Long Characteristics/Descriptors.
 	 */
 
-	if (result) {
-		struct proxy_write_data *wdata;
+	wdata = g_new0(struct proxy_write_data, 1);
+	wdata->attr = attr;
+	wdata->result_cb = result;
+	wdata->user_data = user_data;
+	wdata->value = g_memdup(value, len);
+	wdata->len = len;
 
-		wdata = g_new0(struct proxy_write_data, 1);
-		wdata->result_cb = result;
-		wdata->user_data = user_data;
-
-		if (!g_dbus_proxy_set_property_array(proxy, "Value",
+	if (!g_dbus_proxy_set_property_array(pattr->proxy, "Value",
 						DBUS_TYPE_BYTE, value, len,
-						proxy_write_reply,
-						wdata, g_free)) {
-			g_free(wdata);
+						proxy_write_reply, wdata,
+						proxy_write_data_free)) {
+		proxy_write_data_free(wdata);
+		if (result)
 			result(-ENOENT, user_data);
-		}
-	} else {
-		/*
-		 * Caller is not interested in the Set method call result.
-		 * This flow implements the ATT Write Command scenario, where
-		 * the remote doesn't receive ATT response.
-		 */
-		g_dbus_proxy_set_property_array(proxy, "Value", DBUS_TYPE_BYTE,
-						value, len, proxy_write_reply,
-						NULL, NULL);
 	}
 
 	DBG("Server: Write attribute callback %s",
-					g_dbus_proxy_get_path(proxy));
+					g_dbus_proxy_get_path(pattr->proxy));
 
 }
 
-static int register_external_service(struct external_service *esvc,
-							GDBusProxy *proxy)
+static void value_changed(GDBusProxy *proxy, const char *name,
+					DBusMessageIter *iter, void *user_data)
 {
-	DBusMessageIter iter;
-	const char *str, *path, *iface;
-	bt_uuid_t uuid;
+	struct proxy_attr *pattr = user_data;
+	uint8_t *value;
+	int len;
 
-	path = g_dbus_proxy_get_path(proxy);
-	iface = g_dbus_proxy_get_interface(proxy);
-	if (g_strcmp0(esvc->path, path) != 0 ||
-			g_strcmp0(iface, GATT_SERVICE_IFACE) != 0)
-		return -EINVAL;
+	if (strcmp(name, "Value") || !get_value(iter, &value, &len))
+		return;
 
-	if (!g_dbus_proxy_get_property(proxy, "UUID", &iter))
-		return -EINVAL;
+	cache_set(pattr, value, len);
+}
 
-	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
-		return -EINVAL;
+static struct proxy_attr *proxy_attr_new(struct external_service *esvc,
+						GDBusProxy *proxy,
+						struct btd_attribute *attr)
+{
+	struct proxy_attr *pattr;
+	DBusMessageIter iter;
+	uint8_t *value;
+	int len;
 
-	dbus_message_iter_get_basic(&iter, &str);
+	pattr = g_new0(struct proxy_attr, 1);
+	pattr->proxy = g_dbus_proxy_ref(proxy);
+	pattr->esvc = esvc;
 
-	if (bt_string_to_uuid(&uuid, str) < 0)
-		return -EINVAL;
+	if (g_dbus_proxy_get_property(proxy, "Value", &iter) &&
+					get_value(&iter, &value, &len))
+		cache_set(pattr, value, len);
 
-	esvc->service = btd_gatt_add_service(&uuid);
-	if (!esvc->service)
-		return -EINVAL;
+	g_dbus_proxy_set_property_watch(proxy, value_changed, pattr);
 
-	return 0;
+	g_hash_table_insert(proxy_hash, attr, pattr);
+	esvc->attrs = g_slist_prepend(esvc->attrs, attr);
+
+	btd_gatt_set_external(attr);
+
+	return pattr;
 }
 
-static int add_char(GDBusProxy *proxy, const bt_uuid_t *uuid)
+static int add_char(struct external_service *esvc, struct attr_decl *decl)
 {
-	DBusMessageIter iter;
 	struct btd_attribute *attr;
 	btd_attr_write_t write_cb;
 	btd_attr_read_t read_cb;
-	uint8_t propmask = 0;
 
-	/*
-	 * Optional property. If is not informed, read and write
-	 * procedures will be allowed. Upper-layer should handle
-	 * characteristic requirements.
-	 */
-	if (g_dbus_proxy_get_property(proxy, "Flags", &iter))
-		propmask = flags_get_bitmask(&iter);
-	else
-		propmask = GATT_CHR_PROP_WRITE_WITHOUT_RESP
-						| GATT_CHR_PROP_WRITE
-						| GATT_CHR_PROP_READ;
-	if (!propmask)
-		return -EINVAL;
-
-	if (propmask & GATT_CHR_PROP_READ)
+	if (decl->props & GATT_CHR_PROP_READ)
 		read_cb = proxy_read_cb;
 	else
 		read_cb = NULL;
 
-	if (propmask & (GATT_CHR_PROP_WRITE | GATT_CHR_PROP_WRITE_WITHOUT_RESP))
+	if (decl->props & (GATT_CHR_PROP_WRITE |
+					GATT_CHR_PROP_WRITE_WITHOUT_RESP))
 		write_cb = proxy_write_cb;
 	else
 		write_cb = NULL;
 
-	attr = btd_gatt_add_char(uuid, propmask, read_cb, write_cb);
+	attr = btd_gatt_add_char(&decl->uuid, decl->props, read_cb, write_cb);
 	if (!attr)
 		return -ENOMEM;
 
-	g_hash_table_insert(proxy_hash, attr, g_dbus_proxy_ref(proxy));
+	proxy_attr_new(esvc, decl->proxy, attr);
 
 	return 0;
 }
 
-static int add_char_desc(GDBusProxy *proxy, const bt_uuid_t *uuid)
+static int add_char_desc(struct external_service *esvc,
+						struct attr_decl *decl)
 {
 	struct btd_attribute *attr;
 
-	attr = btd_gatt_add_char_desc(uuid, proxy_read_cb, proxy_write_cb);
+	attr = btd_gatt_add_char_desc(&decl->uuid, proxy_read_cb,
+							proxy_write_cb);
 	if (!attr)
 		return -ENOMEM;
 
-	g_hash_table_insert(proxy_hash, attr, g_dbus_proxy_ref(proxy));
+	proxy_attr_new(esvc, decl->proxy, attr);
+
+	return 0;
+}
+
+static int proxy_get_uuid(GDBusProxy *proxy, bt_uuid_t *uuid)
+{
+	DBusMessageIter iter;
+	const char *str;
+
+	/* Mandatory property */
+	if (!g_dbus_proxy_get_property(proxy, "UUID", &iter))
+		return -EINVAL;
+
+	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
+		return -EINVAL;
+
+	dbus_message_iter_get_basic(&iter, &str);
+
+	if (bt_string_to_uuid(uuid, str) < 0)
+		return -EINVAL;
 
 	return 0;
 }
 
-static int register_external_characteristics(GSList *proxies)
+static int parse_attr(GDBusProxy *proxy, struct attr_decl *decl)
+{
+	DBusMessageIter iter;
+
+	if (proxy_get_uuid(proxy, &decl->uuid) < 0)
+		return -EINVAL;
+
+	decl->proxy = proxy;
+	decl->chr = !strcmp(GATT_CHR_IFACE, g_dbus_proxy_get_interface(proxy));
+	if (!decl->chr)
+		return 0;
+
+	/*
+	 * Optional property. If is not informed, read and write
+	 * procedures will be allowed. Upper-layer should handle
+	 * characteristic requirements.
+	 */
+	if (g_dbus_proxy_get_property(proxy, "Flags", &iter))
+		decl->props = flags_get_bitmask(&iter);
+	else
+		decl->props = GATT_CHR_PROP_WRITE_WITHOUT_RESP
+						| GATT_CHR_PROP_WRITE
+						| GATT_CHR_PROP_READ;
+	if (!decl->props)
+		return -EINVAL;
+
+	return 0;
+}
 
+/*
+ * Registers the service from the objects returned by GetManagedObjects.
+ * Every object is validated before anything is added, so the handle
+ * range can be reserved up front, and the service only becomes visible
+ * to peers once it is complete.
+ */
+static int register_external_service(struct external_service *esvc,
+							GDBusProxy *proxy)
 {
+	const char *path, *iface;
+	struct attr_decl *decls;
+	uint16_t num_handles = 1;
+	unsigned int count, i;
+	bt_uuid_t uuid;
 	GSList *list;
+	int err = -EINVAL;
 
-	for (list = proxies; list; list = g_slist_next(list)) {
-		GDBusProxy *proxy = list->data;
-		DBusMessageIter iter;
-		bt_uuid_t uuid;
-		const char *path, *iface, *str;
-		int ret;
+	path = g_dbus_proxy_get_path(proxy);
+	iface = g_dbus_proxy_get_interface(proxy);
+	if (g_strcmp0(esvc->path, path) != 0 ||
+			g_strcmp0(iface, GATT_SERVICE_IFACE) != 0)
+		return -EINVAL;
 
-		/* Mandatory property */
-		if (!g_dbus_proxy_get_property(proxy, "UUID", &iter))
-			return -EINVAL;
+	if (proxy_get_uuid(proxy, &uuid) < 0)
+		return -EINVAL;
 
-		if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
-			return -EINVAL;
+	count = g_slist_length(esvc->proxies) - 1;
+	decls = g_new0(struct attr_decl, count);
 
-		dbus_message_iter_get_basic(&iter, &str);
+	/* Declaration and value for characteristics, one for descriptors */
+	for (list = g_slist_next(esvc->proxies), i = 0; list;
+						list = list->next, i++) {
+		if (parse_attr(list->data, &decls[i]) < 0) {
+			error("Invalid GATT object: %s",
+					g_dbus_proxy_get_path(list->data));
+			goto done;
+		}
+
+		if (num_handles > UINT16_MAX - 2)
+			goto done;
 
-		if (bt_string_to_uuid(&uuid, str) < 0)
-			return -EINVAL;
+		num_handles += decls[i].chr ? 2 : 1;
+	}
 
-		iface = g_dbus_proxy_get_interface(proxy);
-		path = g_dbus_proxy_get_path(proxy);
+	esvc->service = btd_gatt_add_service(&uuid, num_handles);
+	if (!esvc->service)
+		goto done;
 
-		if (!strcmp(GATT_CHR_IFACE, iface))
-			ret = add_char(proxy, &uuid);
+	for (i = 0; i < count; i++) {
+		if (decls[i].chr)
+			err = add_char(esvc, &decls[i]);
 		else
-			ret = add_char_desc(proxy, &uuid);
+			err = add_char_desc(esvc, &decls[i]);
 
-		if (ret < 0)
-			return ret;
+		if (err < 0)
+			goto done;
 
-		DBG("Added GATT: %s (%s)", path, str);
+		DBG("Added GATT: %s", g_dbus_proxy_get_path(decls[i].proxy));
 	}
 
-	return 0;
+	btd_gatt_set_service_active(esvc->service, true);
+	err = 0;
+
+done:
+	g_free(decls);
+
+	return err;
 }
 
 static void client_ready(GDBusClient *client, void *user_data)
@@ -495,9 +740,6 @@ static void client_ready(GDBusClient *client, void *user_data)
 	if (register_external_service(esvc, proxy) < 0)
 		goto fail;
 
-	if (register_external_characteristics(g_slist_next(esvc->proxies)) < 0)
-		goto fail;
-
 	DBG("Added GATT service %s", esvc->path);
 
 	reply = dbus_message_new_method_return(esvc->reg);
@@ -635,7 +877,7 @@ gboolean gatt_dbus_manager_register(void)
 		return FALSE;
 
 	proxy_hash = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-				NULL, (GDestroyNotify) g_dbus_proxy_unref);
+							NULL, proxy_attr_free);
 
 	return TRUE;
 }
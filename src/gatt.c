@@ -27,68 +27,194 @@
 
 #include <glib.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <inttypes.h>
 
 #include "log.h"
+#include "lib/bluetooth.h"
 #include "lib/uuid.h"
 #include "attrib/att.h"
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/gatt-db.h"
 
 #include "gatt-dbus.h"
 #include "gatt.h"
 
-/* Common GATT UUIDs */
-static const bt_uuid_t primary_uuid  = { .type = BT_UUID16,
-					.value.u16 = GATT_PRIM_SVC_UUID };
+#define STATS_LOG_INTERVAL	1024
 
-static const bt_uuid_t chr_uuid = { .type = BT_UUID16,
-					.value.u16 = GATT_CHARAC_UUID };
+enum attr_kind {
+	ATTR_KIND_LOCAL,
+	ATTR_KIND_EXTERNAL,
+	ATTR_KIND_MAX,
+};
+
+static const char *attr_kind_str[] = { "local", "external" };
+
+struct op_stats {
+	unsigned int count;
+	unsigned int errors;
+	uint64_t total;
+	uint64_t max;
+};
 
 struct btd_attribute {
 	uint16_t handle;
-	bt_uuid_t type;
+	enum attr_kind kind;
 	btd_attr_read_t read_cb;
 	btd_attr_write_t write_cb;
-	uint16_t value_len;
-	uint8_t value[0];
+
+	/* Characteristic and descriptor attributes of a service */
+	GSList *attrs;
+};
+
+struct pending_read {
+	unsigned int id;
+	uint16_t offset;
+	enum attr_kind kind;
+	gint64 start;
 };
 
-static GList *local_attribute_db;
-static uint16_t next_handle = 0x0001;
+struct pending_write {
+	unsigned int id;
+	enum attr_kind kind;
+	gint64 start;
+};
+
+static struct gatt_db *local_db;
+
+/* Service that new characteristics and descriptors are added to */
+static struct btd_attribute *last_service;
+
+/* Time from request to result, per attribute kind */
+static struct op_stats read_stats[ATTR_KIND_MAX];
+static struct op_stats write_stats[ATTR_KIND_MAX];
+
+static void stats_log(const char *op, enum attr_kind kind,
+						const struct op_stats *stats)
+{
+	if (!stats->count)
+		return;
+
+	info("GATT %s %s: %u ops, %u errors, avg %" PRIu64 " us, "
+			"max %" PRIu64 " us", attr_kind_str[kind], op,
+			stats->count, stats->errors,
+			stats->total / stats->count, stats->max);
+}
+
+static void stats_update(const char *op, struct op_stats *stats,
+					enum attr_kind kind, gint64 start, int err)
+{
+	struct op_stats *s = &stats[kind];
+	uint64_t elapsed = g_get_monotonic_time() - start;
+
+	s->count++;
+	s->total += elapsed;
+
+	if (err)
+		s->errors++;
+
+	if (elapsed > s->max)
+		s->max = elapsed;
+
+	if (!(s->count % STATS_LOG_INTERVAL))
+		stats_log(op, kind, s);
+}
 
-static inline void put_uuid_le(const bt_uuid_t *src, void *dst)
+static uint8_t err_to_att(int err, uint8_t not_permitted)
 {
-	if (src->type == BT_UUID16)
-		put_le16(src->value.u16, dst);
-	else if (src->type == BT_UUID32)
-		put_le32(src->value.u32, dst);
+	switch (err) {
+	case 0:
+		return 0;
+	case -EPERM:
+		return not_permitted;
+	default:
+		return ATT_ECODE_UNLIKELY;
+	}
+}
+
+static void read_result(int err, uint8_t *value, size_t len, void *user_data)
+{
+	struct pending_read *pending = user_data;
+
+	stats_update("read", read_stats, pending->kind, pending->start, err);
+
+	if (!err && pending->offset > len)
+		gatt_db_complete(local_db, pending->id,
+					ATT_ECODE_INVALID_OFFSET, NULL, 0);
+	else if (!err)
+		gatt_db_complete(local_db, pending->id, 0,
+					value + pending->offset,
+					len - pending->offset);
 	else
-		/* Convert from 128-bit BE to LE */
-		bswap_128(&src->value.u128, dst);
+		gatt_db_complete(local_db, pending->id,
+				err_to_att(err, ATT_ECODE_READ_NOT_PERM),
+				NULL, 0);
+
+	g_free(pending);
 }
 
-/*
- * Helper function to create new attributes containing constant/static values.
- * eg: declaration of services/characteristics, and characteristics with
- * fixed values.
- */
-static struct btd_attribute *new_const_attribute(const bt_uuid_t *type,
-							const uint8_t *value,
-							uint16_t len)
+static void local_read(struct gatt_db *db, unsigned int id, uint16_t handle,
+					uint16_t offset, uint8_t att_opcode,
+					bdaddr_t *bdaddr, void *user_data)
 {
-	struct btd_attribute *attr;
+	struct btd_attribute *attr = user_data;
+	struct pending_read *pending;
 
-	attr = malloc0(sizeof(struct btd_attribute) + len);
-	if (!attr)
-		return NULL;
+	pending = g_new0(struct pending_read, 1);
+	pending->id = id;
+	pending->offset = offset;
+	pending->kind = attr->kind;
+	pending->start = g_get_monotonic_time();
 
-	attr->type = *type;
-	memcpy(&attr->value, value, len);
-	attr->value_len = len;
+	attr->read_cb(attr, read_result, pending);
+}
 
-	return attr;
+static void write_result(int err, void *user_data)
+{
+	struct pending_write *pending = user_data;
+
+	stats_update("write", write_stats, pending->kind, pending->start, err);
+
+	gatt_db_complete(local_db, pending->id,
+				err_to_att(err, ATT_ECODE_WRITE_NOT_PERM),
+				NULL, 0);
+
+	g_free(pending);
 }
 
-static struct btd_attribute *new_attribute(const bt_uuid_t *type,
+static void local_write(struct gatt_db *db, unsigned int id, uint16_t handle,
+					uint16_t offset, const uint8_t *value,
+					size_t len, uint8_t att_opcode,
+					bdaddr_t *bdaddr, void *user_data)
+{
+	struct btd_attribute *attr = user_data;
+	struct pending_write *pending;
+
+	/* TODO: Write Long Characteristics/Descriptors */
+	if (offset) {
+		gatt_db_complete(db, id, ATT_ECODE_INVALID_OFFSET, NULL, 0);
+		return;
+	}
+
+	/* Commands have no response so the result isn't needed */
+	if (att_opcode == ATT_OP_WRITE_CMD ||
+				att_opcode == ATT_OP_SIGNED_WRITE_CMD) {
+		attr->write_cb(attr, value, len, NULL, NULL);
+		gatt_db_complete(db, id, 0, NULL, 0);
+		return;
+	}
+
+	pending = g_new0(struct pending_write, 1);
+	pending->id = id;
+	pending->kind = attr->kind;
+	pending->start = g_get_monotonic_time();
+
+	attr->write_cb(attr, value, len, write_result, pending);
+}
+
+static struct btd_attribute *new_attribute(uint16_t handle,
 						btd_attr_read_t read_cb,
 						btd_attr_write_t write_cb)
 {
@@ -98,97 +224,69 @@ static struct btd_attribute *new_attribute(const bt_uuid_t *type,
 	if (!attr)
 		return NULL;
 
-	attr->type = *type;
+	attr->handle = handle;
 	attr->read_cb = read_cb;
 	attr->write_cb = write_cb;
 
+	gatt_db_set_async(local_db, handle, read_cb ? local_read : NULL,
+					write_cb ? local_write : NULL, attr);
+
+	last_service->attrs = g_slist_prepend(last_service->attrs, attr);
+
 	return attr;
 }
 
-static bool is_service(const struct btd_attribute *attr)
+void btd_gatt_set_external(struct btd_attribute *attr)
 {
-	if (attr->type.type != BT_UUID16)
-		return false;
-
-	if (attr->type.value.u16 == GATT_PRIM_SVC_UUID ||
-			attr->type.value.u16 == GATT_SND_SVC_UUID)
-		return true;
-
-	return false;
+	attr->kind = ATTR_KIND_EXTERNAL;
 }
 
-static int local_database_add(uint16_t handle, struct btd_attribute *attr)
+struct gatt_db *btd_gatt_get_db(void)
 {
-	attr->handle = handle;
-
-	local_attribute_db = g_list_append(local_attribute_db, attr);
-
-	return 0;
+	return local_db;
 }
 
-struct btd_attribute *btd_gatt_add_service(const bt_uuid_t *uuid)
+struct btd_attribute *btd_gatt_add_service(const bt_uuid_t *uuid,
+							uint16_t num_handles)
 {
 	struct btd_attribute *attr;
-	uint16_t len = bt_uuid_len(uuid);
-	uint8_t value[len];
-
-	/*
-	 * Service DECLARATION
-	 *
-	 *   TYPE         ATTRIBUTE VALUE
-	 * +-------+---------------------------------+
-	 * |0x2800 | 0xYYYY...                       |
-	 * | (1)   | (2)                             |
-	 * +------+----------------------------------+
-	 * (1) - 2 octets: Primary/Secondary Service UUID
-	 * (2) - 2 or 16 octets: Service UUID
-	 */
+	uint16_t handle;
 
-	/* Set attribute value */
-	put_uuid_le(uuid, value);
+	if (!local_db)
+		return NULL;
 
-	attr = new_const_attribute(&primary_uuid, value, len);
-	if (!attr)
+	handle = gatt_db_add_service(local_db, uuid, true, num_handles);
+	if (!handle)
 		return NULL;
 
-	if (local_database_add(next_handle, attr) < 0) {
-		free(attr);
+	attr = new0(struct btd_attribute, 1);
+	if (!attr) {
+		gatt_db_remove_service(local_db, handle);
 		return NULL;
 	}
 
-	/* TODO: missing overflow checking */
-	next_handle = next_handle + 1;
+	attr->handle = handle;
+
+	last_service = attr;
 
 	return attr;
 }
 
-void btd_gatt_remove_service(struct btd_attribute *service)
+void btd_gatt_set_service_active(struct btd_attribute *service, bool active)
 {
-	GList *list = g_list_find(local_attribute_db, service);
-	bool first_node;
+	gatt_db_service_set_active(local_db, service->handle, active);
+}
 
-	if (!list)
+void btd_gatt_remove_service(struct btd_attribute *service)
+{
+	if (!gatt_db_remove_service(local_db, service->handle))
 		return;
 
-	first_node = local_attribute_db == list;
+	if (last_service == service)
+		last_service = NULL;
 
-	/* Remove service declaration attribute */
-	free(list->data);
-	list = g_list_delete_link(list, list);
-
-	/* Remove all characteristics until next service declaration */
-	while (list && !is_service(list->data)) {
-		free(list->data);
-		list = g_list_delete_link(list, list);
-	}
-
-	/*
-	 * When removing the first node, local attribute database head
-	 * needs to be updated. Node removed from middle doesn't change
-	 * the list head address.
-	 */
-	if (first_node)
-		local_attribute_db = list;
+	g_slist_free_full(service->attrs, free);
+	free(service);
 }
 
 struct btd_attribute *btd_gatt_add_char(const bt_uuid_t *uuid,
@@ -196,89 +294,32 @@ struct btd_attribute *btd_gatt_add_char(const bt_uuid_t *uuid,
 						btd_attr_read_t read_cb,
 						btd_attr_write_t write_cb)
 {
-	struct btd_attribute *char_decl, *char_value = NULL;
-
-	/* Attribute value length */
-	uint16_t len = 1 + 2 + bt_uuid_len(uuid);
-	uint8_t value[len];
-
-	/*
-	 * Characteristic DECLARATION
-	 *
-	 *   TYPE         ATTRIBUTE VALUE
-	 * +-------+---------------------------------+
-	 * |0x2803 | 0xXX 0xYYYY 0xZZZZ...           |
-	 * | (1)   |  (2)   (3)   (4)                |
-	 * +------+----------------------------------+
-	 * (1) - 2 octets: Characteristic declaration UUID
-	 * (2) - 1 octet : Properties
-	 * (3) - 2 octets: Handle of the characteristic Value
-	 * (4) - 2 or 16 octets: Characteristic UUID
-	 */
-
-	value[0] = properties;
-
-	/*
-	 * Since we don't know yet the characteristic value attribute
-	 * handle, we skip and set it later.
-	 */
-
-	put_uuid_le(uuid, &value[3]);
-
-	char_decl = new_const_attribute(&chr_uuid, value, len);
-	if (!char_decl)
-		goto fail;
-
-	char_value = new_attribute(uuid, read_cb, write_cb);
-	if (!char_value)
-		goto fail;
-
-	if (local_database_add(next_handle, char_decl) < 0)
-		goto fail;
-
-	next_handle = next_handle + 1;
-
-	/*
-	 * Characteristic VALUE
-	 *
-	 *   TYPE         ATTRIBUTE VALUE
-	 * +----------+---------------------------------+
-	 * |0xZZZZ... | 0x...                           |
-	 * |  (1)     |  (2)                            |
-	 * +----------+---------------------------------+
-	 * (1) - 2 or 16 octets: Characteristic UUID
-	 * (2) - N octets: Value is read dynamically from the service
-	 * implementation (external entity).
-	 */
-
-	if (local_database_add(next_handle, char_value) < 0)
-		/* TODO: remove declaration */
-		goto fail;
+	uint16_t handle;
 
-	next_handle = next_handle + 1;
+	if (!last_service)
+		return NULL;
 
 	/*
-	 * Update characteristic value handle in characteristic declaration
-	 * attribute. For local attributes, we can assume that the handle
-	 * representing the characteristic value will get the next available
-	 * handle. However, for remote attribute this assumption is not valid.
+	 * The declaration, with the handle of the characteristic value
+	 * attribute that follows it, is built by the database.
 	 */
-	put_le16(char_value->handle, &char_decl->value[1]);
-
-	return char_value;
-
-fail:
-	free(char_decl);
-	free(char_value);
+	handle = gatt_db_add_characteristic(local_db, last_service->handle,
+						uuid, 0, properties,
+						NULL, NULL, NULL);
+	if (!handle)
+		return NULL;
 
-	return NULL;
+	return new_attribute(handle, read_cb, write_cb);
 }
 
 struct btd_attribute *btd_gatt_add_char_desc(const bt_uuid_t *uuid,
 						btd_attr_read_t read_cb,
 						btd_attr_write_t write_cb)
 {
-	struct btd_attribute *attr;
+	uint16_t handle;
+
+	if (!last_service)
+		return NULL;
 
 	/*
 	 * From Core SPEC 4.1 page 2184:
@@ -291,30 +332,36 @@ struct btd_attribute *btd_gatt_add_char_desc(const bt_uuid_t *uuid,
 	 * additional permissions constraints.
 	 */
 
-	attr = new_attribute(uuid, read_cb, write_cb);
-	if (!attr)
+	handle = gatt_db_add_char_descriptor(local_db, last_service->handle,
+						uuid, 0, NULL, NULL, NULL);
+	if (!handle)
 		return NULL;
 
-	if (local_database_add(next_handle, attr) < 0) {
-		free(attr);
-		return NULL;
-	}
-
-	next_handle = next_handle + 1;
-
-	return attr;
+	return new_attribute(handle, read_cb, write_cb);
 }
 
 void gatt_init(void)
 {
 	DBG("Starting GATT server");
 
+	local_db = gatt_db_new();
+
 	gatt_dbus_manager_register();
 }
 
 void gatt_cleanup(void)
 {
+	enum attr_kind kind;
+
 	DBG("Stopping GATT server");
 
+	for (kind = 0; kind < ATTR_KIND_MAX; kind++) {
+		stats_log("read", kind, &read_stats[kind]);
+		stats_log("write", kind, &write_stats[kind]);
+	}
+
 	gatt_dbus_manager_unregister();
+
+	gatt_db_destroy(local_db);
+	local_db = NULL;
 }
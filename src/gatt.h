@@ -22,11 +22,14 @@
  */
 
 struct btd_attribute;
+struct gatt_db;
 
 void gatt_init(void);
 
 void gatt_cleanup(void);
 
+struct gatt_db *btd_gatt_get_db(void);
+
 /*
  * Read operation result callback. Called from the service implementation
  * informing the core (ATT layer) the result of read operation.
@@ -74,11 +77,25 @@ typedef void (*btd_attr_write_t) (struct btd_attribute *attr,
 
 /* btd_gatt_add_service - Add a service declaration to local attribute database.
  * @uuid:	Service UUID.
+ * @num_handles: Number of handles reserved for the service, including its
+ *		declaration: two per characteristic and one per descriptor.
+ *
+ * The service is not visible to remote devices until it is activated with
+ * btd_gatt_set_service_active().
  *
  * Returns a reference to service declaration attribute. In case of error,
  * NULL is returned.
  */
-struct btd_attribute *btd_gatt_add_service(const bt_uuid_t *uuid);
+struct btd_attribute *btd_gatt_add_service(const bt_uuid_t *uuid,
+							uint16_t num_handles);
+
+/*
+ * btd_gatt_set_service_active - Make a service visible to remote devices,
+ * or hide it again.
+ * @service:	Service declaration attribute.
+ * @active:	Whether the service should be visible.
+ */
+void btd_gatt_set_service_active(struct btd_attribute *service, bool active);
 
 /*
  * btd_gatt_remove_service - Remove a service (along with all its
@@ -89,7 +106,7 @@ void btd_gatt_remove_service(struct btd_attribute *service);
 
 /*
  * btd_gatt_add_char - Add a characteristic (declaration and value attributes)
- * to local attribute database.
+ * to the last service added to the local attribute database.
  * @uuid:	Characteristic UUID (16-bits or 128-bits).
  * @properties:	Characteristic properties. See Core SPEC 4.1 page 2183.
  * @read_cb:	Callback used to provide the characteristic value.
@@ -105,8 +122,8 @@ struct btd_attribute *btd_gatt_add_char(const bt_uuid_t *uuid,
 						btd_attr_write_t write_cb);
 
 /*
- * btd_gatt_add_char_desc - Add a characteristic descriptor to the local
- * attribute database.
+ * btd_gatt_add_char_desc - Add a characteristic descriptor to the last
+ * service added to the local attribute database.
  * @uuid:	Characteristic Descriptor UUID (16-bits or 128-bits).
  * @read_cb:	Callback that should be called once the characteristic
  *		descriptor attribute is read.
@@ -119,3 +136,11 @@ struct btd_attribute *btd_gatt_add_char(const bt_uuid_t *uuid,
 struct btd_attribute *btd_gatt_add_char_desc(const bt_uuid_t *uuid,
 						btd_attr_read_t read_cb,
 						btd_attr_write_t write_cb);
+
+/*
+ * btd_gatt_set_external - Mark an attribute as backed by an external
+ * (D-Bus) implementation, so its request latency is accounted separately
+ * from attributes implemented inside the daemon.
+ * @attr:	Characteristic or descriptor attribute.
+ */
+void btd_gatt_set_external(struct btd_attribute *attr);
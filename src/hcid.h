@@ -31,7 +31,11 @@ struct main_opts {
 	uint32_t	discovto;
 	gboolean	reverse_sdp;
 	gboolean	name_resolv;
+	uint32_t	name_cache_ttl;
 	gboolean	debug_keys;
+	uint8_t		rssi_delta;
+	uint16_t	prop_interval;
+	uint32_t	max_temp_devices;
 
 	uint16_t	did_source;
 	uint16_t	did_vendor;
@@ -43,6 +47,7 @@ extern struct main_opts main_opts;
 
 gboolean plugin_init(const char *enable, const char *disable);
 void plugin_cleanup(void);
+void plugin_init_for_uuids(GSList *uuids);
 
 void rfkill_init(void);
 void rfkill_exit(void);
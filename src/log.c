@@ -27,12 +27,68 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
 #include <syslog.h>
+#include <sys/time.h>
 
 #include <glib.h>
 
 #include "log.h"
 
+#define DEBUG_BUFFER_SLOTS	512
+#define DEBUG_BUFFER_MSG_MAX	160
+
+struct debug_entry {
+	struct timeval tv;
+	char msg[DEBUG_BUFFER_MSG_MAX];
+};
+
+/*
+ * When enabled debug messages are kept in memory instead of being sent
+ * to syslog. Only the messages preceding an error, or all of them on
+ * request, are written out.
+ */
+struct debug_buffer {
+	struct debug_entry *entries;
+	unsigned int head;
+	unsigned int count;
+};
+
+static struct debug_buffer buffer;
+
+static void buffer_add(const char *format, va_list ap)
+{
+	struct debug_entry *entry;
+
+	entry = &buffer.entries[buffer.head];
+	buffer.head = (buffer.head + 1) % DEBUG_BUFFER_SLOTS;
+	if (buffer.count < DEBUG_BUFFER_SLOTS)
+		buffer.count++;
+
+	gettimeofday(&entry->tv, NULL);
+	vsnprintf(entry->msg, sizeof(entry->msg), format, ap);
+}
+
+static void buffer_flush(void)
+{
+	unsigned int i;
+
+	for (i = DEBUG_BUFFER_SLOTS - buffer.count; buffer.count > 0;
+							buffer.count--, i++) {
+		struct debug_entry *entry;
+		struct tm tm;
+
+		entry = &buffer.entries[(buffer.head + i) % DEBUG_BUFFER_SLOTS];
+
+		localtime_r(&entry->tv.tv_sec, &tm);
+
+		syslog(LOG_DEBUG, "[%02d:%02d:%02d.%06ld] %s", tm.tm_hour,
+				tm.tm_min, tm.tm_sec,
+				(long) entry->tv.tv_usec, entry->msg);
+	}
+}
+
 void info(const char *format, ...)
 {
 	va_list ap;
@@ -59,6 +115,9 @@ void error(const char *format, ...)
 {
 	va_list ap;
 
+	if (buffer.entries)
+		buffer_flush();
+
 	va_start(ap, format);
 
 	vsyslog(LOG_ERR, format, ap);
@@ -72,11 +131,28 @@ void btd_debug(const char *format, ...)
 
 	va_start(ap, format);
 
-	vsyslog(LOG_DEBUG, format, ap);
+	if (buffer.entries)
+		buffer_add(format, ap);
+	else
+		vsyslog(LOG_DEBUG, format, ap);
 
 	va_end(ap);
 }
 
+void __btd_log_buffer_enable(void)
+{
+	if (buffer.entries)
+		return;
+
+	buffer.entries = g_new0(struct debug_entry, DEBUG_BUFFER_SLOTS);
+}
+
+void __btd_log_buffer_flush(void)
+{
+	if (buffer.entries)
+		buffer_flush();
+}
+
 extern struct btd_debug_desc __start___debug[];
 extern struct btd_debug_desc __stop___debug[];
 
@@ -138,6 +214,12 @@ void __btd_log_init(const char *debug, int detach)
 
 void __btd_log_cleanup(void)
 {
+	if (buffer.entries) {
+		buffer_flush();
+		g_free(buffer.entries);
+		buffer.entries = NULL;
+	}
+
 	closelog();
 
 	g_strfreev(enabled);
@@ -30,6 +30,8 @@ void btd_debug(const char *format, ...) __attribute__((format(printf, 1, 2)));
 void __btd_log_init(const char *debug, int detach);
 void __btd_log_cleanup(void);
 void __btd_toggle_debug(void);
+void __btd_log_buffer_enable(void);
+void __btd_log_buffer_flush(void);
 
 struct btd_debug_desc {
 	const char *file;
@@ -48,7 +50,16 @@ void __btd_enable_debug(struct btd_debug_desc *start,
  *
  * Simple macro around btd_debug() which also include the function
  * name it is called in.
+ *
+ * Defining BTD_DISABLE_DEBUG before including this header, e.g. in the
+ * CPPFLAGS of a plugin, compiles the debug messages out completely.
  */
+#ifdef BTD_DISABLE_DEBUG
+#define DBG(fmt, arg...) do { \
+	if (0) \
+		btd_debug("%s:%s() " fmt,  __FILE__, __func__ , ## arg); \
+} while (0)
+#else
 #define DBG(fmt, arg...) do { \
 	static struct btd_debug_desc __btd_debug_desc \
 	__attribute__((used, section("__debug"), aligned(8))) = { \
@@ -57,3 +68,4 @@ void __btd_enable_debug(struct btd_debug_desc *start,
 	if (__btd_debug_desc.flags & BTD_DEBUG_FLAG_PRINT) \
 		btd_debug("%s:%s() " fmt,  __FILE__, __func__ , ## arg); \
 } while (0)
+#endif
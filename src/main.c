@@ -50,6 +50,7 @@
 #include "lib/uuid.h"
 #include "hcid.h"
 #include "sdpd.h"
+#include "sdp-client.h"
 #include "adapter.h"
 #include "device.h"
 #include "dbus-common.h"
@@ -57,11 +58,15 @@
 #include "profile.h"
 #include "gatt.h"
 #include "systemd.h"
+#include "worker.h"
+#include "memstat.h"
 
 #define BLUEZ_NAME "org.bluez"
 
 #define DEFAULT_PAIRABLE_TIMEOUT       0 /* disabled */
 #define DEFAULT_DISCOVERABLE_TIMEOUT 180 /* 3 minutes */
+#define DEFAULT_RSSI_THRESHOLD         8 /* dBm */
+#define DEFAULT_NAME_CACHE_TTL    604800 /* 1 week */
 
 #define SHUTDOWN_GRACE_SECONDS 10
 
@@ -78,7 +83,12 @@ static const char * const supported_options[] = {
 	"DeviceID",
 	"ReverseServiceDiscovery",
 	"NameResolving",
+	"NameCacheTTL",
 	"DebugKeys",
+	"RSSIThreshold",
+	"DiscoveryUpdateInterval",
+	"SDPSessionTimeout",
+	"TemporaryDevices",
 };
 
 GKeyFile *btd_get_main_conf(void)
@@ -276,12 +286,70 @@ static void parse_config(GKeyFile *config)
 	else
 		main_opts.name_resolv = boolean;
 
+	val = g_key_file_get_integer(config, "General", "NameCacheTTL", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		error("Invalid NameCacheTTL value %d", val);
+	} else {
+		DBG("name_cache_ttl=%d", val);
+		main_opts.name_cache_ttl = val;
+	}
+
 	boolean = g_key_file_get_boolean(config, "General",
 						"DebugKeys", &err);
 	if (err)
 		g_clear_error(&err);
 	else
 		main_opts.debug_keys = boolean;
+
+	val = g_key_file_get_integer(config, "General", "RSSIThreshold", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0 || val > UINT8_MAX) {
+		error("Invalid RSSIThreshold value %d", val);
+	} else {
+		DBG("rssi_delta=%d", val);
+		main_opts.rssi_delta = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+					"DiscoveryUpdateInterval", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0 || val > UINT16_MAX) {
+		error("Invalid DiscoveryUpdateInterval value %d", val);
+	} else {
+		DBG("prop_interval=%d", val);
+		main_opts.prop_interval = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+					"SDPSessionTimeout", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0 || val > UINT16_MAX) {
+		error("Invalid SDPSessionTimeout value %d", val);
+	} else {
+		DBG("sdp_session_timeout=%d", val);
+		bt_set_cached_session_timeout(val);
+	}
+
+	val = g_key_file_get_integer(config, "General",
+					"TemporaryDevices", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		error("Invalid TemporaryDevices value %d", val);
+	} else {
+		DBG("max_temp_devices=%d", val);
+		main_opts.max_temp_devices = val;
+	}
 }
 
 static void init_defaults(void)
@@ -296,7 +364,9 @@ static void init_defaults(void)
 	main_opts.discovto = DEFAULT_DISCOVERABLE_TIMEOUT;
 	main_opts.reverse_sdp = TRUE;
 	main_opts.name_resolv = TRUE;
+	main_opts.name_cache_ttl = DEFAULT_NAME_CACHE_TTL;
 	main_opts.debug_keys = FALSE;
+	main_opts.rssi_delta = DEFAULT_RSSI_THRESHOLD;
 
 	if (sscanf(VERSION, "%hhu.%hhu", &major, &minor) != 2)
 		return;
@@ -351,6 +421,10 @@ static gboolean signal_handler(GIOChannel *channel, GIOCondition cond,
 
 		__terminated = 1;
 		break;
+	case SIGUSR1:
+		__btd_log_buffer_flush();
+		btd_mem_dump();
+		break;
 	case SIGUSR2:
 		__btd_toggle_debug();
 		break;
@@ -369,6 +443,7 @@ static guint setup_signalfd(void)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 	sigaddset(&mask, SIGUSR2);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
@@ -404,6 +479,7 @@ static gboolean option_compat = FALSE;
 static gboolean option_detach = TRUE;
 static gboolean option_version = FALSE;
 static gboolean option_experimental = FALSE;
+static gboolean option_debug_buffer = FALSE;
 
 static void free_options(void)
 {
@@ -483,6 +559,8 @@ static GOptionEntry options[] = {
 	{ "debug", 'd', G_OPTION_FLAG_OPTIONAL_ARG,
 				G_OPTION_ARG_CALLBACK, parse_debug,
 				"Specify debug options to enable", "DEBUG" },
+	{ "debug-buffer", 'b', 0, G_OPTION_ARG_NONE, &option_debug_buffer,
+				"Buffer debug messages in memory" },
 	{ "plugin", 'p', 0, G_OPTION_ARG_STRING, &option_plugin,
 				"Specify plugins to load", "NAME,..," },
 	{ "noplugin", 'P', 0, G_OPTION_ARG_STRING, &option_noplugin,
@@ -538,6 +616,9 @@ int main(int argc, char *argv[])
 
 	__btd_log_init(option_debug, option_detach);
 
+	if (option_debug_buffer)
+		__btd_log_buffer_enable();
+
 	sd_notify(0, "STATUS=Starting up");
 
 	main_conf = load_config(CONFIGDIR "/main.conf");
@@ -554,6 +635,8 @@ int main(int argc, char *argv[])
 
 	g_dbus_set_flags(gdbus_flags);
 
+	btd_worker_init();
+
 	gatt_init();
 
 	if (adapter_init() < 0) {
@@ -618,6 +701,9 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	/* Lets the stores queued while shutting down reach the disk */
+	btd_worker_cleanup();
+
 	gatt_cleanup();
 
 	rfkill_exit();
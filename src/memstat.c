@@ -0,0 +1,103 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "memstat.h"
+
+struct mem_stat {
+	const char *name;
+	unsigned long count;
+	unsigned long max_count;
+	size_t bytes;
+	size_t max_bytes;
+};
+
+static struct mem_stat stats[BTD_MEM_TYPES] = {
+	[BTD_MEM_ADAPTER]	= { .name = "adapter" },
+	[BTD_MEM_DEVICE]	= { .name = "device" },
+	[BTD_MEM_SERVICE]	= { .name = "service" },
+	[BTD_MEM_CONN_REQ]	= { .name = "conn-request" },
+	[BTD_MEM_GATT_PRIMARY]	= { .name = "gatt-primary" },
+	[BTD_MEM_SDP_RECORD]	= { .name = "sdp-record" },
+	[BTD_MEM_SDP_CACHE]	= { .name = "sdp-cache" },
+	[BTD_MEM_MEDIA_CONFIG]	= { .name = "media-config" },
+};
+
+void btd_mem_add(enum btd_mem_type type, unsigned int count, size_t size)
+{
+	struct mem_stat *stat = &stats[type];
+
+	stat->count += count;
+	stat->bytes += size;
+
+	if (stat->count > stat->max_count)
+		stat->max_count = stat->count;
+
+	if (stat->bytes > stat->max_bytes)
+		stat->max_bytes = stat->bytes;
+}
+
+void btd_mem_remove(enum btd_mem_type type, unsigned int count,
+								size_t size)
+{
+	struct mem_stat *stat = &stats[type];
+
+	if (stat->count < count || stat->bytes < size) {
+		error("Unbalanced %s accounting", stat->name);
+		return;
+	}
+
+	stat->count -= count;
+	stat->bytes -= size;
+}
+
+void btd_mem_dump(void)
+{
+	unsigned long count = 0;
+	size_t bytes = 0;
+	int i;
+
+	info("Memory usage: objects bytes (peak objects bytes)");
+
+	for (i = 0; i < BTD_MEM_TYPES; i++) {
+		struct mem_stat *stat = &stats[i];
+
+		info("  %-14s %6lu %9zu (%lu %zu)", stat->name, stat->count,
+					stat->bytes, stat->max_count,
+					stat->max_bytes);
+
+		count += stat->count;
+		bytes += stat->bytes;
+	}
+
+	info("  %-14s %6lu %9zu", "total", count, bytes);
+}
@@ -0,0 +1,47 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * Allocation accounting per object type, dumped to the log on SIGUSR1.
+ * Callers charge "count" objects taking "size" bytes in total, usually the
+ * structures themselves, and must release exactly that again. Only to be
+ * used from the main loop.
+ */
+enum btd_mem_type {
+	BTD_MEM_ADAPTER,
+	BTD_MEM_DEVICE,
+	BTD_MEM_SERVICE,
+	BTD_MEM_CONN_REQ,
+	BTD_MEM_GATT_PRIMARY,
+	BTD_MEM_SDP_RECORD,
+	BTD_MEM_SDP_CACHE,
+	BTD_MEM_MEDIA_CONFIG,
+	BTD_MEM_TYPES
+};
+
+void btd_mem_add(enum btd_mem_type type, unsigned int count, size_t size);
+void btd_mem_remove(enum btd_mem_type type, unsigned int count,
+								size_t size);
+
+void btd_mem_dump(void);
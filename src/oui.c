@@ -25,45 +25,81 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
 #include "oui.h"
 
 #ifdef HAVE_UDEV_HWDB_NEW
 #include <libudev.h>
 
-char *batocomp(const bdaddr_t *ba)
+#define OUI_CACHE_SIZE	64
+
+/*
+ * Opened on first use and kept open, with recent lookups cached since
+ * scan results tend to share a handful of vendors.
+ */
+static struct udev *udev;
+static struct udev_hwdb *hwdb;
+
+static struct {
+	bool valid;
+	uint32_t oui;
+	char *comp;
+} oui_cache[OUI_CACHE_SIZE];
+
+static char *lookup_comp(const bdaddr_t *ba)
 {
-	struct udev *udev;
-	struct udev_hwdb *hwdb;
 	struct udev_list_entry *head, *entry;
-	char modalias[11], *comp = NULL;
+	char modalias[11];
 
-	sprintf(modalias, "OUI:%2.2X%2.2X%2.2X", ba->b[5], ba->b[4], ba->b[3]);
+	if (!hwdb) {
+		if (!udev) {
+			udev = udev_new();
+			if (!udev)
+				return NULL;
+		}
 
-	udev = udev_new();
-	if (!udev)
-		return NULL;
+		hwdb = udev_hwdb_new(udev);
+		if (!hwdb)
+			return NULL;
+	}
 
-	hwdb = udev_hwdb_new(udev);
-	if (!hwdb)
-		goto done;
+	sprintf(modalias, "OUI:%2.2X%2.2X%2.2X", ba->b[5], ba->b[4], ba->b[3]);
 
 	head = udev_hwdb_get_properties_list_entry(hwdb, modalias, 0);
 
 	udev_list_entry_foreach(entry, head) {
 		const char *name = udev_list_entry_get_name(entry);
 
-		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE")) {
-			comp = strdup(udev_list_entry_get_value(entry));
-			break;
-		}
+		if (name && !strcmp(name, "ID_OUI_FROM_DATABASE"))
+			return strdup(udev_list_entry_get_value(entry));
 	}
 
-	hwdb = udev_hwdb_unref(hwdb);
+	return NULL;
+}
+
+char *batocomp(const bdaddr_t *ba)
+{
+	uint32_t oui = ba->b[5] << 16 | ba->b[4] << 8 | ba->b[3];
+	unsigned int slot = (ba->b[5] ^ ba->b[4] ^ ba->b[3]) % OUI_CACHE_SIZE;
+
+	if (!oui_cache[slot].valid || oui_cache[slot].oui != oui) {
+		/* Failures to open the database are not cached */
+		char *comp = lookup_comp(ba);
 
-done:
-	udev = udev_unref(udev);
+		if (!hwdb)
+			return NULL;
+
+		free(oui_cache[slot].comp);
+		oui_cache[slot].comp = comp;
+		oui_cache[slot].oui = oui;
+		oui_cache[slot].valid = true;
+	}
 
-	return comp;
+	return oui_cache[slot].comp ? strdup(oui_cache[slot].comp) : NULL;
 }
 #else
 char *batocomp(const bdaddr_t *ba)
@@ -35,6 +35,7 @@
 #include <glib.h>
 
 #include "btio/btio.h"
+#include "lib/uuid.h"
 #include "src/plugin.h"
 #include "src/log.h"
 #include "src/hcid.h"
@@ -44,6 +45,7 @@ static GSList *plugins = NULL;
 struct bluetooth_plugin {
 	void *handle;
 	gboolean active;
+	gboolean deferred;
 	struct bluetooth_plugin_desc *desc;
 };
 
@@ -110,6 +112,57 @@ static gboolean enable_plugin(const char *name, char **cli_enable,
 	return TRUE;
 }
 
+static void init_plugin(struct bluetooth_plugin *plugin)
+{
+	gint64 start;
+	int err;
+
+	plugin->deferred = FALSE;
+
+	start = g_get_monotonic_time();
+
+	err = plugin->desc->init();
+	if (err < 0) {
+		if (err == -ENOSYS)
+			warn("System does not support %s plugin",
+							plugin->desc->name);
+		else
+			error("Failed to init %s plugin", plugin->desc->name);
+		return;
+	}
+
+	DBG("%s plugin initialized in %" G_GINT64_FORMAT " us",
+			plugin->desc->name, g_get_monotonic_time() - start);
+
+	plugin->active = TRUE;
+}
+
+static gboolean match_uuids(struct bluetooth_plugin *plugin, GSList *uuids)
+{
+	const char * const *uuid;
+
+	for (uuid = plugin->desc->uuids; *uuid; uuid++) {
+		if (g_slist_find_custom(uuids, *uuid, bt_uuid_strcmp))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+void plugin_init_for_uuids(GSList *uuids)
+{
+	GSList *list;
+
+	for (list = plugins; list; list = list->next) {
+		struct bluetooth_plugin *plugin = list->data;
+
+		if (!plugin->deferred || !match_uuids(plugin, uuids))
+			continue;
+
+		init_plugin(plugin);
+	}
+}
+
 #include "src/builtin.h"
 
 gboolean plugin_init(const char *enable, const char *disable)
@@ -119,11 +172,14 @@ gboolean plugin_init(const char *enable, const char *disable)
 	const char *file;
 	char **cli_disabled, **cli_enabled;
 	unsigned int i;
+	gint64 start;
 
 	/* Make a call to BtIO API so its symbols got resolved before the
 	 * plugins are loaded. */
 	bt_io_error_quark();
 
+	start = g_get_monotonic_time();
+
 	if (enable)
 		cli_enabled = g_strsplit_set(enable, ", ", -1);
 	else
@@ -195,22 +251,19 @@ gboolean plugin_init(const char *enable, const char *disable)
 start:
 	for (list = plugins; list; list = list->next) {
 		struct bluetooth_plugin *plugin = list->data;
-		int err;
 
-		err = plugin->desc->init();
-		if (err < 0) {
-			if (err == -ENOSYS)
-				warn("System does not support %s plugin",
-							plugin->desc->name);
-			else
-				error("Failed to init %s plugin",
-							plugin->desc->name);
+		if (plugin->desc->uuids) {
+			DBG("Deferring %s plugin", plugin->desc->name);
+			plugin->deferred = TRUE;
 			continue;
 		}
 
-		plugin->active = TRUE;
+		init_plugin(plugin);
 	}
 
+	DBG("Plugins initialized in %" G_GINT64_FORMAT " us",
+					g_get_monotonic_time() - start);
+
 	g_strfreev(cli_enabled);
 	g_strfreev(cli_disabled);
 
@@ -32,13 +32,24 @@ struct bluetooth_plugin_desc {
 	void (*exit) (void);
 	void *debug_start;
 	void *debug_stop;
+	const char * const *uuids;
 };
 
+/*
+ * Plugins defined with BLUETOOTH_PLUGIN_DEFINE_LAZY are initialized only
+ * once a device with one of the given UUIDs is probed.
+ */
 #ifdef BLUETOOTH_PLUGIN_BUILTIN
 #define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
 		struct bluetooth_plugin_desc __bluetooth_builtin_ ## name = { \
 			#name, version, priority, init, exit \
 		};
+#define BLUETOOTH_PLUGIN_DEFINE_LAZY(name, version, priority, init, exit, \
+								uuids) \
+		struct bluetooth_plugin_desc __bluetooth_builtin_ ## name = { \
+			#name, version, priority, init, exit, NULL, NULL, \
+			uuids \
+		};
 #else
 #define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
 		extern struct btd_debug_desc __start___debug[] \
@@ -51,4 +62,16 @@ struct bluetooth_plugin_desc {
 			#name, version, priority, init, exit, \
 			__start___debug, __stop___debug \
 		};
+#define BLUETOOTH_PLUGIN_DEFINE_LAZY(name, version, priority, init, exit, \
+								uuids) \
+		extern struct btd_debug_desc __start___debug[] \
+				__attribute__ ((weak, visibility("hidden"))); \
+		extern struct btd_debug_desc __stop___debug[] \
+				__attribute__ ((weak, visibility("hidden"))); \
+		extern struct bluetooth_plugin_desc bluetooth_plugin_desc \
+				__attribute__ ((visibility("default"))); \
+		struct bluetooth_plugin_desc bluetooth_plugin_desc = { \
+			#name, version, priority, init, exit, \
+			__start___debug, __stop___debug, uuids \
+		};
 #endif
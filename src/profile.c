@@ -68,6 +68,9 @@
 #define BTD_PROFILE_PSM_AUTO	-1
 #define BTD_PROFILE_CHAN_AUTO	-1
 
+/* Largest SDU an ERTM channel can carry, GOEP 2.0 packets fit in one SDU */
+#define BTD_PROFILE_ERTM_MTU	65535
+
 #define HFP_HF_RECORD							\
 	"<?xml version=\"1.0\" encoding=\"UTF-8\" ?>			\
 	<record>							\
@@ -614,6 +617,7 @@ struct ext_io {
 
 	bool resolving;
 	bool connected;
+	bool cached;
 
 	uint16_t version;
 	uint16_t features;
@@ -669,6 +673,10 @@ void btd_profile_foreach(void (*func)(struct btd_profile *p, void *data),
 int btd_profile_register(struct btd_profile *profile)
 {
 	profiles = g_slist_append(profiles, profile);
+
+	/* Profiles of lazily initialized plugins show up after adapters */
+	adapter_foreach(adapter_add_profile, profile);
+
 	return 0;
 }
 
@@ -956,6 +964,27 @@ static bool send_new_connection(struct ext_profile *ext, struct ext_io *conn)
 	return true;
 }
 
+static int resolve_service(struct ext_io *conn, const bdaddr_t *src,
+							const bdaddr_t *dst);
+
+static int retry_resolve(struct ext_io *conn)
+{
+	DBG("%s stored record may be stale, resolving again", conn->ext->name);
+
+	conn->cached = false;
+	conn->psm = 0;
+	conn->chan = 0;
+
+	if (conn->io) {
+		g_io_channel_shutdown(conn->io, FALSE, NULL);
+		g_io_channel_unref(conn->io);
+		conn->io = NULL;
+	}
+
+	return resolve_service(conn, btd_adapter_get_address(conn->adapter),
+					device_get_address(conn->device));
+}
+
 static void ext_connect(GIOChannel *io, GError *err, gpointer user_data)
 {
 	struct ext_io *conn = user_data;
@@ -980,6 +1009,9 @@ static void ext_connect(GIOChannel *io, GError *err, gpointer user_data)
 	if (err != NULL) {
 		error("%s failed to connect to %s: %s", ext->name, addr,
 								err->message);
+		if (conn->cached && retry_resolve(conn) == 0)
+			return;
+
 		goto drop;
 	}
 
@@ -1195,6 +1227,16 @@ static uint32_t ext_register_record(struct ext_profile *ext,
 	return rec->handle;
 }
 
+static uint16_t ext_imtu(struct ext_profile *ext)
+{
+	/* Basic mode keeps the kernel default, ERTM gets the largest MTU so
+	 * the remote can use one L2CAP SDU per OBEX packet */
+	if (ext->mode == BT_IO_MODE_ERTM)
+		return BTD_PROFILE_ERTM_MTU;
+
+	return 0;
+}
+
 static uint32_t ext_start_servers(struct ext_profile *ext,
 						struct btd_adapter *adapter)
 {
@@ -1228,6 +1270,7 @@ static uint32_t ext_start_servers(struct ext_profile *ext,
 					BT_IO_OPT_SOURCE_BDADDR,
 					btd_adapter_get_address(adapter),
 					BT_IO_OPT_MODE, ext->mode,
+					BT_IO_OPT_IMTU, ext_imtu(ext),
 					BT_IO_OPT_PSM, psm,
 					BT_IO_OPT_SEC_LEVEL, ext->sec_level,
 					BT_IO_OPT_INVALID);
@@ -1445,6 +1488,8 @@ static int connect_io(struct ext_io *conn, const bdaddr_t *src,
 					BT_IO_OPT_SOURCE_BDADDR, src,
 					BT_IO_OPT_DEST_BDADDR, dst,
 					BT_IO_OPT_SEC_LEVEL, ext->sec_level,
+					BT_IO_OPT_MODE, ext->mode,
+					BT_IO_OPT_IMTU, ext_imtu(ext),
 					BT_IO_OPT_PSM, conn->psm,
 					BT_IO_OPT_INVALID);
 	} else {
@@ -1468,7 +1513,7 @@ static int connect_io(struct ext_io *conn, const bdaddr_t *src,
 	return 0;
 }
 
-static uint16_t get_goep_l2cap_psm(sdp_record_t *rec)
+static uint16_t get_goep_l2cap_psm(const sdp_record_t *rec)
 {
 	sdp_data_t *data;
 
@@ -1486,6 +1531,37 @@ static uint16_t get_goep_l2cap_psm(sdp_record_t *rec)
 	return data->val.uint16;
 }
 
+static int parse_record(struct ext_io *conn, const sdp_record_t *rec)
+{
+	struct ext_profile *ext = conn->ext;
+	sdp_list_t *protos;
+	int port;
+
+	if (sdp_get_access_protos(rec, &protos) < 0) {
+		error("Unable to get proto list from %s record", ext->name);
+		return -EINVAL;
+	}
+
+	port = sdp_get_proto_port(protos, L2CAP_UUID);
+	if (port > 0)
+		conn->psm = port;
+
+	port = sdp_get_proto_port(protos, RFCOMM_UUID);
+	if (port > 0)
+		conn->chan = port;
+
+	if (conn->psm == 0 && sdp_get_proto_desc(protos, OBEX_UUID))
+		conn->psm = get_goep_l2cap_psm(rec);
+
+	conn->features = get_supported_features(rec);
+	conn->version = get_profile_version(rec);
+
+	sdp_list_foreach(protos, (sdp_list_func_t) sdp_list_free, NULL);
+	sdp_list_free(protos, NULL);
+
+	return 0;
+}
+
 static void record_cb(sdp_list_t *recs, int err, gpointer user_data)
 {
 	struct ext_io *conn = user_data;
@@ -1506,33 +1582,8 @@ static void record_cb(sdp_list_t *recs, int err, gpointer user_data)
 	}
 
 	for (r = recs; r != NULL; r = r->next) {
-		sdp_record_t *rec = r->data;
-		sdp_list_t *protos;
-		int port;
-
-		if (sdp_get_access_protos(rec, &protos) < 0) {
-			error("Unable to get proto list from %s record",
-								ext->name);
+		if (parse_record(conn, r->data) < 0)
 			goto failed;
-		}
-
-		port = sdp_get_proto_port(protos, L2CAP_UUID);
-		if (port > 0)
-			conn->psm = port;
-
-		port = sdp_get_proto_port(protos, RFCOMM_UUID);
-		if (port > 0)
-			conn->chan = port;
-
-		if (conn->psm == 0 && sdp_get_proto_desc(protos, OBEX_UUID))
-			conn->psm = get_goep_l2cap_psm(rec);
-
-		conn->features = get_supported_features(rec);
-		conn->version = get_profile_version(rec);
-
-		sdp_list_foreach(protos, (sdp_list_func_t) sdp_list_free,
-									NULL);
-		sdp_list_free(protos, NULL);
 
 		if (conn->chan || conn->psm)
 			break;
@@ -1578,6 +1629,36 @@ static int resolve_service(struct ext_io *conn, const bdaddr_t *src,
 	return err;
 }
 
+/*
+ * Use the record stored by the service discovery of a bonded device to
+ * avoid a SDP round-trip on every connect. If connecting with it fails
+ * the record is resolved again over SDP, see ext_connect.
+ */
+static int resolve_cached(struct ext_io *conn, struct btd_device *dev)
+{
+	struct ext_profile *ext = conn->ext;
+	const sdp_record_t *rec;
+
+	if (!device_is_bonded(dev, BDADDR_BREDR))
+		return -ENOENT;
+
+	rec = btd_device_get_record(dev, ext->remote_uuid);
+	if (!rec)
+		return -ENOENT;
+
+	if (parse_record(conn, rec) < 0 || (!conn->chan && !conn->psm)) {
+		conn->psm = 0;
+		conn->chan = 0;
+		return -ENOENT;
+	}
+
+	DBG("%s using stored record", ext->name);
+
+	conn->cached = true;
+
+	return 0;
+}
+
 static int ext_connect_dev(struct btd_service *service)
 {
 	struct btd_device *dev = btd_service_get_device(service);
@@ -1605,6 +1686,9 @@ static int ext_connect_dev(struct btd_service *service)
 		conn->chan = ext->remote_chan;
 		err = connect_io(conn, btd_adapter_get_address(adapter),
 						device_get_address(dev));
+	} else if (resolve_cached(conn, dev) == 0) {
+		err = connect_io(conn, btd_adapter_get_address(adapter),
+						device_get_address(dev));
 	} else {
 		err = resolve_service(conn, btd_adapter_get_address(adapter),
 						device_get_address(dev));
@@ -36,6 +36,9 @@ struct btd_profile {
 
 	bool auto_connect;
 
+	/* Never connect concurrently with other profiles of the device */
+	bool serial_connect;
+
 	int (*device_probe) (struct btd_service *service);
 	void (*device_remove) (struct btd_service *service);
 
@@ -37,9 +37,11 @@
 #include "log.h"
 #include "sdp-client.h"
 
-/* Number of seconds to keep a sdp_session_t in the cache */
+/* Default number of seconds to keep a sdp_session_t in the cache */
 #define CACHE_TIMEOUT 2
 
+static unsigned int cache_timeout = CACHE_TIMEOUT;
+
 struct cached_sdp_session {
 	bdaddr_t src;
 	bdaddr_t dst;
@@ -120,7 +122,7 @@ static void cache_sdp_session(bdaddr_t *src, bdaddr_t *dst,
 
 	cached_sdp_sessions = g_slist_append(cached_sdp_sessions, cached);
 
-	cached->timer = g_timeout_add_seconds(CACHE_TIMEOUT,
+	cached->timer = g_timeout_add_seconds(cache_timeout,
 						cached_session_expired,
 						cached);
 
@@ -142,11 +144,34 @@ struct search_context {
 	bt_destroy_t		destroy;
 	gpointer		user_data;
 	uuid_t			uuid;
+	uint16_t		flags;
 	guint			io_id;
 };
 
+/*
+ * Searches to the same device share a single SDP session: only the first
+ * context of each device in the list owns the session, the others wait
+ * for it to finish and take over the session afterwards.
+ */
 static GSList *context_list = NULL;
 
+static struct search_context *find_context(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = context_list; l != NULL; l = l->next) {
+		struct search_context *ctxt = l->data;
+
+		if (!bacmp(&ctxt->src, src) && !bacmp(&ctxt->dst, dst))
+			return ctxt;
+	}
+
+	return NULL;
+}
+
+static void start_next_search(const bdaddr_t *src, const bdaddr_t *dst);
+
 static void search_context_cleanup(struct search_context *ctxt)
 {
 	context_list = g_slist_remove(context_list, ctxt);
@@ -157,6 +182,18 @@ static void search_context_cleanup(struct search_context *ctxt)
 	g_free(ctxt);
 }
 
+static void search_context_finish(struct search_context *ctxt)
+{
+	bdaddr_t src, dst;
+
+	bacpy(&src, &ctxt->src);
+	bacpy(&dst, &ctxt->dst);
+
+	search_context_cleanup(ctxt);
+
+	start_next_search(&src, &dst);
+}
+
 static void search_completed_cb(uint8_t type, uint16_t status,
 			uint8_t *rsp, size_t size, void *user_data)
 {
@@ -207,7 +244,7 @@ done:
 	if (recs)
 		sdp_list_free(recs, (sdp_free_func_t) sdp_record_free);
 
-	search_context_cleanup(ctxt);
+	search_context_finish(ctxt);
 }
 
 static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
@@ -222,7 +259,7 @@ static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
 		if (ctxt->cb)
 			ctxt->cb(NULL, -EIO, ctxt->user_data);
 
-		search_context_cleanup(ctxt);
+		search_context_finish(ctxt);
 		return FALSE;
 	}
 
@@ -285,41 +322,27 @@ failed:
 	if (ctxt->cb)
 		ctxt->cb(NULL, err, ctxt->user_data);
 
-	search_context_cleanup(ctxt);
+	search_context_finish(ctxt);
 
 	return FALSE;
 }
 
-static int create_search_context(struct search_context **ctxt,
-					const bdaddr_t *src,
-					const bdaddr_t *dst,
-					uuid_t *uuid, uint16_t flags)
+static int start_search(struct search_context *ctxt)
 {
 	sdp_session_t *s;
 	GIOChannel *chan;
 	uint32_t prio = 1;
 	int sk;
 
-	if (!ctxt)
-		return -EINVAL;
-
-	s = get_cached_sdp_session(src, dst);
+	s = get_cached_sdp_session(&ctxt->src, &ctxt->dst);
 	if (!s)
-		s = sdp_connect(src, dst, SDP_NON_BLOCKING | flags);
+		s = sdp_connect(&ctxt->src, &ctxt->dst,
+					SDP_NON_BLOCKING | ctxt->flags);
 
 	if (!s)
 		return -errno;
 
-	*ctxt = g_try_malloc0(sizeof(struct search_context));
-	if (!*ctxt) {
-		sdp_close(s);
-		return -ENOMEM;
-	}
-
-	bacpy(&(*ctxt)->src, src);
-	bacpy(&(*ctxt)->dst, dst);
-	(*ctxt)->session = s;
-	(*ctxt)->uuid = *uuid;
+	ctxt->session = s;
 
 	sk = sdp_get_socket(s);
 	/* Set low priority for the SDP connection not to interfere with
@@ -330,75 +353,93 @@ static int create_search_context(struct search_context **ctxt,
 						strerror(errno), errno);
 
 	chan = g_io_channel_unix_new(sk);
-	(*ctxt)->io_id = g_io_add_watch(chan,
+	ctxt->io_id = g_io_add_watch(chan,
 				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				connect_watch, *ctxt);
+				connect_watch, ctxt);
 	g_io_channel_unref(chan);
 
 	return 0;
 }
 
+static void start_next_search(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	struct search_context *ctxt;
+	int err;
+
+	while ((ctxt = find_context(src, dst))) {
+		if (ctxt->session)
+			return;
+
+		err = start_search(ctxt);
+		if (err == 0)
+			return;
+
+		if (ctxt->cb)
+			ctxt->cb(NULL, err, ctxt->user_data);
+
+		search_context_cleanup(ctxt);
+	}
+}
+
 int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 			uuid_t *uuid, bt_callback_t cb, void *user_data,
 			bt_destroy_t destroy, uint16_t flags)
 {
-	struct search_context *ctxt = NULL;
+	struct search_context *ctxt;
+	gboolean busy;
 	int err;
 
 	if (!cb)
 		return -EINVAL;
 
-	err = create_search_context(&ctxt, src, dst, uuid, flags);
-	if (err < 0)
-		return err;
+	ctxt = g_try_new0(struct search_context, 1);
+	if (!ctxt)
+		return -ENOMEM;
 
+	bacpy(&ctxt->src, src);
+	bacpy(&ctxt->dst, dst);
+	ctxt->uuid	= *uuid;
+	ctxt->flags	= flags;
 	ctxt->cb	= cb;
 	ctxt->destroy	= destroy;
 	ctxt->user_data	= user_data;
 
-	context_list = g_slist_append(context_list, ctxt);
+	/* Queue behind an ongoing search to the same device if any */
+	busy = find_context(src, dst) != NULL;
 
-	return 0;
-}
+	context_list = g_slist_append(context_list, ctxt);
 
-static int find_by_bdaddr(gconstpointer data, gconstpointer user_data)
-{
-	const struct search_context *ctxt = data, *search = user_data;
-	int ret;
+	if (busy)
+		return 0;
 
-	ret = bacmp(&ctxt->src, &search->src);
-	if (ret != 0)
-		return ret;
+	err = start_search(ctxt);
+	if (err < 0) {
+		context_list = g_slist_remove(context_list, ctxt);
+		g_free(ctxt);
+		return err;
+	}
 
-	return bacmp(&ctxt->dst, &search->dst);
+	return 0;
 }
 
 int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 {
-	struct search_context match, *ctxt;
-	GSList *l;
-
-	memset(&match, 0, sizeof(match));
-	bacpy(&match.src, src);
-	bacpy(&match.dst, dst);
+	struct search_context *ctxt;
 
 	/* Ongoing SDP Discovery */
-	l = g_slist_find_custom(context_list, &match, find_by_bdaddr);
-	if (l == NULL)
+	ctxt = find_context(src, dst);
+	if (ctxt == NULL)
 		return -ENOENT;
 
-	ctxt = l->data;
-
 	if (!ctxt->session)
 		return -ENOTCONN;
 
 	if (ctxt->io_id)
 		g_source_remove(ctxt->io_id);
 
-	if (ctxt->session)
-		sdp_close(ctxt->session);
+	sdp_close(ctxt->session);
 
-	search_context_cleanup(ctxt);
+	search_context_finish(ctxt);
 
 	return 0;
 }
@@ -411,3 +452,8 @@ void bt_clear_cached_session(const bdaddr_t *src, const bdaddr_t *dst)
 	if (session)
 		sdp_close(session);
 }
+
+void bt_set_cached_session_timeout(unsigned int timeout)
+{
+	cache_timeout = timeout;
+}
@@ -29,6 +29,9 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/sdp.h>
@@ -36,10 +39,23 @@
 
 #include "sdpd.h"
 #include "log.h"
+#include "memstat.h"
 
 static sdp_list_t *service_db;
 static sdp_list_t *access_db;
 
+/* Bumped on every change to the records or their attributes */
+static unsigned int svcdb_generation = 1;
+
+/*
+ * Inverted index from 128-bit UUID to the records having it in their
+ * search pattern, each list in handle order like service_db. Records get
+ * their pattern filled in after being added, so the index is rebuilt on
+ * the first search following a change.
+ */
+static GHashTable *uuid_index;
+static unsigned int uuid_index_generation;
+
 typedef struct {
 	uint32_t handle;
 	bdaddr_t device;
@@ -86,11 +102,125 @@ static void access_free(void *p)
  */
 void sdp_svcdb_reset(void)
 {
+	btd_mem_remove(BTD_MEM_SDP_RECORD, sdp_list_len(service_db),
+			sdp_list_len(service_db) * sizeof(sdp_record_t));
+
 	sdp_list_free(service_db, (sdp_free_func_t) sdp_record_free);
 	service_db = NULL;
 
 	sdp_list_free(access_db, access_free);
 	access_db = NULL;
+
+	if (uuid_index) {
+		g_hash_table_destroy(uuid_index);
+		uuid_index = NULL;
+	}
+
+	svcdb_generation++;
+}
+
+static guint uuid128_hash(gconstpointer key)
+{
+	const uuid_t *uuid = key;
+	const uint8_t *data = uuid->value.uuid128.data;
+	guint h = 0;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h = (h << 5) - h + data[i];
+
+	return h;
+}
+
+static gboolean uuid128_equal(gconstpointer a, gconstpointer b)
+{
+	const uuid_t *u1 = a;
+	const uuid_t *u2 = b;
+
+	return memcmp(&u1->value.uuid128, &u2->value.uuid128,
+					sizeof(u1->value.uuid128)) == 0;
+}
+
+static void index_list_free(gpointer data)
+{
+	sdp_list_free(data, NULL);
+}
+
+static void uuid_index_build(void)
+{
+	sdp_list_t *r, *p;
+
+	if (uuid_index == NULL)
+		uuid_index = g_hash_table_new_full(uuid128_hash, uuid128_equal,
+						g_free, index_list_free);
+	else
+		g_hash_table_remove_all(uuid_index);
+
+	for (r = service_db; r; r = r->next) {
+		sdp_record_t *rec = r->data;
+
+		for (p = rec->pattern; p; p = p->next) {
+			uuid_t *uuid = p->data;
+			sdp_list_t *recs;
+
+			if (uuid == NULL || uuid->type != SDP_UUID128)
+				continue;
+
+			/* service_db is sorted, appending keeps handle order */
+			recs = g_hash_table_lookup(uuid_index, uuid);
+			if (recs == NULL) {
+				g_hash_table_insert(uuid_index,
+						g_memdup(uuid, sizeof(*uuid)),
+						sdp_list_append(NULL, rec));
+				continue;
+			}
+
+			sdp_list_append(recs, rec);
+		}
+	}
+
+	uuid_index_generation = svcdb_generation;
+}
+
+/*
+ * Mark everything derived from the records stale, called whenever records
+ * or their attributes changed
+ */
+void sdp_svcdb_changed(void)
+{
+	svcdb_generation++;
+}
+
+unsigned int sdp_svcdb_generation(void)
+{
+	return svcdb_generation;
+}
+
+/*
+ * Return the records whose search pattern contains uuid, in handle order
+ */
+sdp_list_t *sdp_svcdb_find_uuid(const uuid_t *uuid)
+{
+	uuid_t uuid128;
+
+	switch (uuid->type) {
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(&uuid128, uuid);
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(&uuid128, uuid);
+		break;
+	case SDP_UUID128:
+		uuid128 = *uuid;
+		break;
+	default:
+		return NULL;
+	}
+
+	if (uuid_index_generation != svcdb_generation)
+		uuid_index_build();
+
+	return g_hash_table_lookup(uuid_index, &uuid128);
 }
 
 typedef struct _indexed {
@@ -179,6 +309,9 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 	SDPDBG("with handle : 0x%x", rec->handle);
 
 	service_db = sdp_list_insert_sorted(service_db, rec, record_sort);
+	svcdb_generation++;
+
+	btd_mem_add(BTD_MEM_SDP_RECORD, 1, sizeof(*rec));
 
 	dev = malloc(sizeof(*dev));
 	if (!dev)
@@ -250,8 +383,12 @@ int sdp_record_remove(uint32_t handle)
 	}
 
 	r = p->data;
-	if (r)
+	if (r) {
 		service_db = sdp_list_remove(service_db, r);
+		btd_mem_remove(BTD_MEM_SDP_RECORD, 1, sizeof(*r));
+	}
+
+	svcdb_generation++;
 
 	p = access_locate(handle);
 	if (p == NULL || p->data == NULL)
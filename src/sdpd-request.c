@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <limits.h>
 
+#include <glib.h>
+
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/l2cap.h>
 #include <bluetooth/sdp.h>
@@ -41,6 +43,7 @@
 
 #include "sdpd.h"
 #include "log.h"
+#include "memstat.h"
 
 typedef struct {
 	uint32_t timestamp;
@@ -56,38 +59,77 @@ typedef struct {
 
 typedef struct _sdp_cstate_list sdp_cstate_list_t;
 
+/*
+ * Cached responses are owned by the socket that requested them, so peers
+ * paging through large responses at the same time never see each other's
+ * buffers. A socket only pages one response at a time; starting a new one
+ * drops the previous buffer.
+ */
 struct _sdp_cstate_list {
 	sdp_cstate_list_t *next;
+	int sock;
 	uint32_t timestamp;
 	sdp_buf_t buf;
 };
 
 static sdp_cstate_list_t *cstates;
+static uint32_t cstate_id;
 
-/* FIXME: should probably remove it when it's found */
-static sdp_buf_t *sdp_get_cached_rsp(sdp_cont_state_t *cstate)
+static sdp_buf_t *sdp_get_cached_rsp(sdp_req_t *req, sdp_cont_state_t *cstate)
 {
 	sdp_cstate_list_t *p;
 
 	for (p = cstates; p; p = p->next)
-		if (p->timestamp == cstate->timestamp)
+		if (p->sock == req->sock && p->timestamp == cstate->timestamp)
 			return &p->buf;
 	return 0;
 }
 
-static uint32_t sdp_cstate_alloc_buf(sdp_buf_t *buf)
+void sdp_cstate_cleanup(int sock)
 {
-	sdp_cstate_list_t *cstate = malloc(sizeof(sdp_cstate_list_t));
-	uint8_t *data = malloc(buf->data_size);
+	sdp_cstate_list_t *p, **prev = &cstates;
+
+	while ((p = *prev) != NULL) {
+		if (p->sock != sock) {
+			prev = &p->next;
+			continue;
+		}
+
+		*prev = p->next;
+		btd_mem_remove(BTD_MEM_SDP_CACHE, 1,
+					sizeof(*p) + p->buf.data_size);
+		free(p->buf.data);
+		free(p);
+	}
+}
+
+static uint32_t sdp_cstate_alloc_buf(sdp_req_t *req, sdp_buf_t *buf)
+{
+	sdp_cstate_list_t *cstate;
+	uint8_t *data;
+
+	sdp_cstate_cleanup(req->sock);
+
+	cstate = malloc(sizeof(sdp_cstate_list_t));
+	data = malloc(buf->data_size);
 
 	memcpy(data, buf->data, buf->data_size);
 	memset((char *)cstate, 0, sizeof(sdp_cstate_list_t));
 	cstate->buf.data = data;
 	cstate->buf.data_size = buf->data_size;
 	cstate->buf.buf_size = buf->data_size;
-	cstate->timestamp = sdp_get_time();
+	cstate->sock = req->sock;
+
+	/* Unique per response, a timestamp repeats within the same second */
+	if (++cstate_id == 0)
+		cstate_id++;
+	cstate->timestamp = cstate_id;
+
 	cstate->next = cstates;
 	cstates = cstate;
+
+	btd_mem_add(BTD_MEM_SDP_CACHE, 1, sizeof(*cstate) + buf->data_size);
+
 	return cstate->timestamp;
 }
 
@@ -353,6 +395,40 @@ static int sdp_match_uuid(sdp_list_t *search, sdp_list_t *pattern)
 	return 1;
 }
 
+/*
+ * Pick the shortest record list from the UUID index among the search
+ * UUIDs; only those records can match all of them. Every candidate still
+ * goes through sdp_match_uuid().
+ */
+static sdp_list_t *match_candidates(sdp_list_t *search)
+{
+	sdp_list_t *best = NULL;
+	int best_len = -1;
+
+	if (search == NULL)
+		return sdp_get_record_list();
+
+	for (; search; search = search->next) {
+		sdp_list_t *recs;
+		int len;
+
+		if (search->data == NULL)
+			return NULL;
+
+		recs = sdp_svcdb_find_uuid(search->data);
+		if (recs == NULL)
+			return NULL;
+
+		len = sdp_list_len(recs);
+		if (best_len < 0 || len < best_len) {
+			best = recs;
+			best_len = len;
+		}
+	}
+
+	return best;
+}
+
 /*
  * Service search request PDU. This method extracts the search pattern
  * (a sequence of UUIDs) and calls the matching function
@@ -430,8 +506,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->data_size += sizeof(uint16_t);
 
 	if (cstate == NULL) {
-		/* for every record in the DB, do a pattern search */
-		sdp_list_t *list = sdp_get_record_list();
+		/* for every candidate record, do a pattern search */
+		sdp_list_t *list = match_candidates(pattern);
 
 		handleSize = 0;
 		for (; list && rsp_count < expected; list = list->next) {
@@ -456,7 +532,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 		if (rsp_count > actual) {
 			/* cache the rsp and generate a continuation state */
-			cStateId = sdp_cstate_alloc_buf(buf);
+			cStateId = sdp_cstate_alloc_buf(req, buf);
 			/*
 			 * subtract handleSize since we now send only
 			 * a subset of handles
@@ -477,7 +553,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			 * Get the previous sdp_cont_state_t and obtain
 			 * the cached rsp
 			 */
-			sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+			sdp_buf_t *pCache = sdp_get_cached_rsp(req, cstate);
 			if (pCache) {
 				pCacheBuffer = pCache->data;
 				/* get the rsp_count from the cached buffer */
@@ -558,9 +634,160 @@ done:
  * requested identifiers are present in the PDU form of
  * the request
  */
-static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
+/*
+ * Attribute ID/value pairs of a record serialized once, in attribute ID
+ * order, so that every requested ID or ID range is a single contiguous
+ * copy. The cache is flushed whenever the database generation moves on.
+ */
+struct record_pdu {
+	uint8_t *data;
+	int count;
+	uint16_t *ids;
+	uint32_t *offsets;	/* count + 1 entries, last one is the size */
+	size_t size;		/* Memory accounted for all of the above */
+};
+
+static GHashTable *record_pdus;
+static unsigned int record_pdus_generation;
+
+static void record_pdu_free(gpointer data)
+{
+	struct record_pdu *rp = data;
+
+	if (rp->size)
+		btd_mem_remove(BTD_MEM_SDP_CACHE, 1, rp->size);
+
+	free(rp->data);
+	g_free(rp->ids);
+	g_free(rp->offsets);
+	g_free(rp);
+}
+
+static int attr_cmp(const void *a, const void *b)
 {
+	const sdp_data_t *d1 = *(sdp_data_t * const *) a;
+	const sdp_data_t *d2 = *(sdp_data_t * const *) b;
+
+	return d1->attrId - d2->attrId;
+}
+
+static struct record_pdu *record_pdu_new(sdp_record_t *rec)
+{
+	struct record_pdu *rp;
+	sdp_data_t **attrs;
+	sdp_list_t *l;
 	sdp_buf_t pdu;
+	int i, hlen = 0;
+
+	memset(&pdu, 0, sizeof(pdu));
+	pdu.data = malloc(USHRT_MAX);
+	if (!pdu.data)
+		return NULL;
+	memset(pdu.data, 0, USHRT_MAX);
+	pdu.buf_size = USHRT_MAX;
+
+	rp = g_new0(struct record_pdu, 1);
+	rp->count = sdp_list_len(rec->attrlist);
+	rp->ids = g_new0(uint16_t, rp->count);
+	rp->offsets = g_new0(uint32_t, rp->count + 1);
+
+	attrs = g_new0(sdp_data_t *, rp->count);
+	for (l = rec->attrlist, i = 0; l; l = l->next, i++)
+		attrs[i] = l->data;
+
+	qsort(attrs, rp->count, sizeof(*attrs), attr_cmp);
+
+	for (i = 0; i < rp->count; i++) {
+		/* Leave out the sequence header sdp_append_to_buf maintains */
+		if (pdu.data_size > 0)
+			hlen = pdu.data[0] == SDP_SEQ8 ? 2 : 3;
+
+		rp->ids[i] = attrs[i]->attrId;
+		rp->offsets[i] = pdu.data_size - hlen;
+		sdp_append_to_pdu(&pdu, attrs[i]);
+	}
+
+	if (pdu.data_size > 0)
+		hlen = pdu.data[0] == SDP_SEQ8 ? 2 : 3;
+
+	rp->offsets[rp->count] = pdu.data_size - hlen;
+	rp->data = malloc(rp->offsets[rp->count] + 1);
+	if (rp->data)
+		memcpy(rp->data, pdu.data + hlen, rp->offsets[rp->count]);
+
+	g_free(attrs);
+	free(pdu.data);
+
+	if (!rp->data) {
+		record_pdu_free(rp);
+		return NULL;
+	}
+
+	rp->size = sizeof(*rp) + rp->offsets[rp->count] + 1 +
+			rp->count * sizeof(*rp->ids) +
+			(rp->count + 1) * sizeof(*rp->offsets);
+	btd_mem_add(BTD_MEM_SDP_CACHE, 1, rp->size);
+
+	return rp;
+}
+
+static struct record_pdu *record_pdu_get(sdp_record_t *rec)
+{
+	struct record_pdu *rp;
+
+	if (!record_pdus)
+		record_pdus = g_hash_table_new_full(g_direct_hash,
+							g_direct_equal, NULL,
+							record_pdu_free);
+
+	if (record_pdus_generation != sdp_svcdb_generation()) {
+		g_hash_table_remove_all(record_pdus);
+		record_pdus_generation = sdp_svcdb_generation();
+	}
+
+	rp = g_hash_table_lookup(record_pdus, GUINT_TO_POINTER(rec->handle));
+	if (rp)
+		return rp;
+
+	rp = record_pdu_new(rec);
+	if (rp)
+		g_hash_table_insert(record_pdus, GUINT_TO_POINTER(rec->handle),
+									rp);
+
+	return rp;
+}
+
+/* Index of the first attribute with an ID not below id */
+static int record_pdu_find(struct record_pdu *rp, uint32_t id)
+{
+	int low = 0, high = rp->count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		if (rp->ids[mid] < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* Append attributes [first, last) of the record */
+static void record_pdu_append(struct record_pdu *rp, int first, int last,
+								sdp_buf_t *buf)
+{
+	if (first >= last)
+		return;
+
+	sdp_append_to_buf(buf, rp->data + rp->offsets[first],
+				rp->offsets[last] - rp->offsets[first]);
+}
+
+static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
+{
+	struct record_pdu *rp;
 
 	if (!rec)
 		return SDP_INVALID_RECORD_HANDLE;
@@ -572,54 +799,51 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 
 	SDPDBG("Entries in attr seq : %d", sdp_list_len(seq));
 
-	sdp_gen_record_pdu(rec, &pdu);
+	rp = record_pdu_get(rec);
+	if (!rp)
+		return SDP_INVALID_RECORD_HANDLE;
 
 	for (; seq; seq = seq->next) {
 		struct attrid *aid = seq->data;
+		int first;
 
 		SDPDBG("AttrDataType : %d", aid->dtd);
 
 		if (aid->dtd == SDP_UINT16) {
-			uint16_t attr = aid->uint16;
-			sdp_data_t *a = sdp_data_get(rec, attr);
-			if (a)
-				sdp_append_to_pdu(buf, a);
+			first = record_pdu_find(rp, aid->uint16);
+			if (first < rp->count && rp->ids[first] == aid->uint16)
+				record_pdu_append(rp, first, first + 1, buf);
 		} else if (aid->dtd == SDP_UINT32) {
 			uint32_t range = aid->uint32;
-			uint16_t attr;
 			uint16_t low = (0xffff0000 & range) >> 16;
 			uint16_t high = 0x0000ffff & range;
-			sdp_data_t *data;
 
 			SDPDBG("attr range : 0x%x", range);
 			SDPDBG("Low id : 0x%x", low);
 			SDPDBG("High id : 0x%x", high);
 
-			if (low == 0x0000 && high == 0xffff && pdu.data_size <= buf->buf_size) {
-				/* copy it */
-				memcpy(buf->data, pdu.data, pdu.data_size);
-				buf->data_size = pdu.data_size;
+			if (low == 0x0000 && high == 0xffff &&
+				rp->offsets[rp->count] + 3 <= buf->buf_size) {
+				/* whole record replaces anything so far */
+				buf->data_size = 0;
+				buf->data[0] = 0;
+				record_pdu_append(rp, 0, rp->count, buf);
 				break;
 			}
-			/* (else) sub-range of attributes */
-			for (attr = low; attr < high; attr++) {
-				data = sdp_data_get(rec, attr);
-				if (data)
-					sdp_append_to_pdu(buf, data);
-			}
-			data = sdp_data_get(rec, high);
-			if (data)
-				sdp_append_to_pdu(buf, data);
+
+			/* an inverted range only yields the high ID */
+			if (low > high)
+				low = high;
+
+			record_pdu_append(rp, record_pdu_find(rp, low),
+					record_pdu_find(rp, high + 1), buf);
 		} else {
 			error("Unexpected data type : 0x%x", aid->dtd);
 			error("Expect uint16_t or uint32_t");
-			free(pdu.data);
 			return SDP_INVALID_SYNTAX;
 		}
 	}
 
-	free(pdu.data);
-
 	return 0;
 }
 
@@ -718,7 +942,7 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->buf_size -= sizeof(uint16_t);
 
 	if (cstate) {
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req, cstate);
 
 		SDPDBG("Obtained cached rsp : %p", pCache);
 
@@ -746,7 +970,7 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req, buf);
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -854,7 +1078,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 		goto done;
 	}
 
-	svcList = sdp_get_record_list();
+	svcList = match_candidates(pattern);
 
 	tmpbuf.data = malloc(USHRT_MAX);
 	tmpbuf.data_size = 0;
@@ -903,7 +1127,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req, buf);
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -915,7 +1139,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			cstate_size = sdp_set_cstate_pdu(buf, NULL);
 	} else {
 		/* continuation State exists -> get from cache */
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req, cstate);
 		if (pCache) {
 			uint16_t sent = MIN(max, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
@@ -47,6 +47,7 @@ typedef struct request {
 
 void handle_internal_request(int sk, int mtu, void *data, int len);
 void handle_request(int sk, uint8_t *data, int len);
+void sdp_cstate_cleanup(int sock);
 
 void set_fixed_db_timestamp(uint32_t dbts);
 
@@ -68,6 +69,9 @@ sdp_record_t *sdp_record_find(uint32_t handle);
 void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec);
 int sdp_record_remove(uint32_t handle);
 sdp_list_t *sdp_get_record_list(void);
+void sdp_svcdb_changed(void);
+unsigned int sdp_svcdb_generation(void);
+sdp_list_t *sdp_svcdb_find_uuid(const uuid_t *uuid);
 int sdp_check_access(uint32_t handle, bdaddr_t *device);
 uint32_t sdp_next_handle(void);
 
@@ -45,6 +45,7 @@
 #include "device.h"
 #include "profile.h"
 #include "service.h"
+#include "memstat.h"
 
 struct btd_service {
 	int			ref;
@@ -127,6 +128,7 @@ void btd_service_unref(struct btd_service *service)
 	if (service->ref > 0)
 		return;
 
+	btd_mem_remove(BTD_MEM_SERVICE, 1, sizeof(*service));
 	g_free(service);
 }
 
@@ -141,6 +143,8 @@ struct btd_service *service_create(struct btd_device *device,
 		return NULL;
 	}
 
+	btd_mem_add(BTD_MEM_SERVICE, 1, sizeof(*service));
+
 	service->ref = 1;
 	service->device = device; /* Weak ref */
 	service->profile = profile;
@@ -21,10 +21,16 @@
  *
  */
 
+#ifndef __BT_ATT_TYPES_H
+#define __BT_ATT_TYPES_H
+
 #include <stdint.h>
 
 #define BT_ATT_DEFAULT_LE_MTU 23
 
+/* Pseudo opcode used to register for all incoming requests */
+#define BT_ATT_ALL_REQUESTS 0x00
+
 /* ATT protocol opcodes */
 #define BT_ATT_OP_ERROR_RSP	      		0x01
 #define BT_ATT_OP_MTU_REQ			0x02
@@ -73,3 +79,28 @@
 #define BT_ATT_ERROR_INSUFFICIENT_ENCRYPTION		0x0F
 #define BT_ATT_ERROR_UNSUPPORTED_GROUP_TYPE		0x10
 #define BT_ATT_ERROR_INSUFFICIENT_RESOURCES		0x11
+
+/* ATT opcode classes */
+enum bt_att_op_type {
+	BT_ATT_OP_TYPE_UNKNOWN = 0,
+	BT_ATT_OP_TYPE_REQ,
+	BT_ATT_OP_TYPE_RSP,
+	BT_ATT_OP_TYPE_CMD,
+	BT_ATT_OP_TYPE_IND,
+	BT_ATT_OP_TYPE_NOT,
+	BT_ATT_OP_TYPE_CONF,
+};
+
+/*
+ * Per-opcode classification, indexed directly by the opcode byte. For
+ * requests and indications "peer" is the opcode expected in reply, for
+ * responses and confirmations it is the opcode that elicited them.
+ */
+struct bt_att_opcode_info {
+	uint8_t type;
+	uint8_t peer;
+};
+
+extern const struct bt_att_opcode_info bt_att_opcode_info[256];
+
+#endif /* __BT_ATT_TYPES_H */
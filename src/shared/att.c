@@ -28,11 +28,16 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
+#include "src/shared/idmap.h"
 #include "src/shared/util.h"
 #include "src/shared/timeout.h"
+#include "src/shared/trace.h"
 #include "lib/uuid.h"
 #include "src/shared/att.h"
 #include "src/shared/att-types.h"
@@ -41,22 +46,49 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_TIMEOUT_MIN			500  /* 500 ms */
+#define ATT_RTT_MIN_SAMPLES		8
+#define ATT_WRITE_BATCH_MAX		16
+#define ATT_OP_POOL_MAX			16
+#define ATT_PRIORITY_COUNT		(BT_ATT_PRIORITY_HIGH + 1)
 
 struct att_send_op;
+struct bt_att;
 
-struct bt_att {
-	int ref_count;
+/*
+ * A bearer the ATT protocol runs on. Each bearer can have one request in
+ * flight. Indications and PDUs that don't expect a response are only sent
+ * on the primary bearer, the one bt_att was created with.
+ */
+struct att_chan {
+	struct bt_att *att;
 	int fd;
 	struct io *io;
-
-	struct queue *req_queue;	/* Queued ATT protocol requests */
+	uint8_t *buf;
 	struct att_send_op *pending_req;
+	bool writer_active;
+};
+
+struct bt_att {
+	int ref_count;
+	struct queue *chans;		/* Bearers, primary one first */
+	bool close_on_unref;
+
+	/* Queued ATT protocol requests and PDUs ready to send, per priority */
+	struct queue *req_queue[ATT_PRIORITY_COUNT];
+	struct queue *write_queue[ATT_PRIORITY_COUNT];
 	struct queue *ind_queue;	/* Queued ATT protocol indications */
 	struct att_send_op *pending_ind;
-	struct queue *write_queue;	/* Queue of PDUs ready to send */
-	bool writer_active;
 
-	struct queue *notify_list;	/* List of registered callbacks */
+	unsigned int write_high;	/* Write queue watermarks */
+	unsigned int write_low;
+	bool write_blocked;
+	bt_att_writable_func_t writable_callback;
+	bt_att_destroy_func_t writable_destroy;
+	void *writable_data;
+
+	struct idmap *notify_list;	/* Registered callbacks by id */
+	struct queue *notify_table[256];	/* Callbacks by opcode */
 	bool in_notify;
 	bool need_notify_cleanup;
 
@@ -64,12 +96,26 @@ struct bt_att {
 	bool in_disconn;
 	bool need_disconn_cleanup;
 
-	uint8_t *buf;
 	uint16_t mtu;
 
+	struct att_send_op *op_pool;	/* Free list of recycled ops */
+	unsigned int op_pool_len;
+	unsigned int op_pool_hits;
+	unsigned int op_pool_misses;
+
+	struct bt_att_stats stats;
+	struct bt_att_latency *op_rtt[256];	/* Round trip time by opcode */
+
 	unsigned int next_send_id;	/* IDs for "send" ops */
 	unsigned int next_reg_id;	/* IDs for registered callbacks */
 
+	unsigned int timeout;		/* Default transaction timeout in ms */
+	bool adaptive_timeout;
+	bool fail_fast;
+	uint64_t srtt;			/* Smoothed round trip time in usec */
+	uint64_t rttvar;
+	unsigned int rtt_samples;
+
 	bt_att_timeout_func_t timeout_callback;
 	bt_att_destroy_func_t timeout_destroy;
 	void *timeout_data;
@@ -79,105 +125,306 @@ struct bt_att {
 	void *debug_data;
 };
 
-enum att_op_type {
-	ATT_OP_TYPE_REQ,
-	ATT_OP_TYPE_RSP,
-	ATT_OP_TYPE_CMD,
-	ATT_OP_TYPE_IND,
-	ATT_OP_TYPE_NOT,
-	ATT_OP_TYPE_CONF,
-	ATT_OP_TYPE_UNKNOWN,
+#define BT_ATT_OPCODE_REQ(req, rsp) \
+	[req] = { BT_ATT_OP_TYPE_REQ, rsp }, \
+	[rsp] = { BT_ATT_OP_TYPE_RSP, req }
+
+const struct bt_att_opcode_info bt_att_opcode_info[256] = {
+	[BT_ATT_OP_ERROR_RSP]		= { BT_ATT_OP_TYPE_RSP, 0 },
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_MTU_REQ, BT_ATT_OP_MTU_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_FIND_INFO_REQ, BT_ATT_OP_FIND_INFO_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_FIND_BY_TYPE_VAL_REQ,
+					BT_ATT_OP_FIND_BY_TYPE_VAL_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_READ_BY_TYPE_REQ,
+					BT_ATT_OP_READ_BY_TYPE_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_READ_REQ, BT_ATT_OP_READ_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_READ_BLOB_REQ, BT_ATT_OP_READ_BLOB_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_READ_MULT_REQ, BT_ATT_OP_READ_MULT_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_READ_BY_GRP_TYPE_REQ,
+					BT_ATT_OP_READ_BY_GRP_TYPE_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_WRITE_REQ, BT_ATT_OP_WRITE_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_PREP_WRITE_REQ, BT_ATT_OP_PREP_WRITE_RSP),
+	BT_ATT_OPCODE_REQ(BT_ATT_OP_EXEC_WRITE_REQ, BT_ATT_OP_EXEC_WRITE_RSP),
+	[BT_ATT_OP_WRITE_CMD]		= { BT_ATT_OP_TYPE_CMD, 0 },
+	[BT_ATT_OP_SIGNED_WRITE_CMD]	= { BT_ATT_OP_TYPE_CMD, 0 },
+	[BT_ATT_OP_HANDLE_VAL_NOT]	= { BT_ATT_OP_TYPE_NOT, 0 },
+	[BT_ATT_OP_HANDLE_VAL_IND]	= { BT_ATT_OP_TYPE_IND,
+						BT_ATT_OP_HANDLE_VAL_CONF },
+	[BT_ATT_OP_HANDLE_VAL_CONF]	= { BT_ATT_OP_TYPE_CONF,
+						BT_ATT_OP_HANDLE_VAL_IND },
 };
 
-static const struct {
-	uint8_t opcode;
-	enum att_op_type type;
-} att_opcode_type_table[] = {
-	{ BT_ATT_OP_ERROR_RSP,			ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_MTU_REQ,			ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_MTU_RSP,			ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_FIND_INFO_REQ,		ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_FIND_INFO_RSP,		ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_FIND_BY_TYPE_VAL_REQ,	ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_FIND_BY_TYPE_VAL_RSP,	ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_READ_BY_TYPE_REQ,		ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_READ_BY_TYPE_RSP,		ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_READ_REQ,			ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_READ_RSP,			ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_READ_BLOB_REQ,		ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_READ_BLOB_RSP,		ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_READ_MULT_REQ,		ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_READ_MULT_RSP,		ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_READ_BY_GRP_TYPE_REQ,	ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_READ_BY_GRP_TYPE_RSP,	ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_WRITE_REQ,			ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_WRITE_RSP,			ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_WRITE_CMD,			ATT_OP_TYPE_CMD },
-	{ BT_ATT_OP_SIGNED_WRITE_CMD,		ATT_OP_TYPE_CMD },
-	{ BT_ATT_OP_PREP_WRITE_REQ,		ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_PREP_WRITE_RSP,		ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_EXEC_WRITE_REQ,		ATT_OP_TYPE_REQ },
-	{ BT_ATT_OP_EXEC_WRITE_RSP,		ATT_OP_TYPE_RSP },
-	{ BT_ATT_OP_HANDLE_VAL_NOT,		ATT_OP_TYPE_NOT },
-	{ BT_ATT_OP_HANDLE_VAL_IND,		ATT_OP_TYPE_IND },
-	{ BT_ATT_OP_HANDLE_VAL_CONF,		ATT_OP_TYPE_CONF },
-	{ }
-};
+#undef BT_ATT_OPCODE_REQ
 
-static enum att_op_type get_op_type(uint8_t opcode)
+static enum bt_att_op_type get_op_type(uint8_t opcode)
 {
-	int i;
+	return bt_att_opcode_info[opcode].type;
+}
 
-	for (i = 0; att_opcode_type_table[i].opcode; i++) {
-		if (att_opcode_type_table[i].opcode == opcode)
-			return att_opcode_type_table[i].type;
-	}
+/*
+ * Notifications and indications are server initiated, anything else that
+ * is dispatched to handlers counts as a request. Unknown opcodes are kept
+ * so that servers can reject them with "Request Not Supported".
+ */
+static bool is_request(uint8_t opcode)
+{
+	enum bt_att_op_type type = get_op_type(opcode);
 
-	return ATT_OP_TYPE_UNKNOWN;
+	return type != BT_ATT_OP_TYPE_NOT && type != BT_ATT_OP_TYPE_IND;
 }
 
-static const struct {
-	uint8_t req_opcode;
-	uint8_t rsp_opcode;
-} att_req_rsp_mapping_table[] = {
-	{ BT_ATT_OP_MTU_REQ,			BT_ATT_OP_MTU_RSP },
-	{ BT_ATT_OP_FIND_INFO_REQ,		BT_ATT_OP_FIND_INFO_RSP},
-	{ BT_ATT_OP_FIND_BY_TYPE_VAL_REQ,	BT_ATT_OP_FIND_BY_TYPE_VAL_RSP },
-	{ BT_ATT_OP_READ_BY_TYPE_REQ,		BT_ATT_OP_READ_BY_TYPE_RSP },
-	{ BT_ATT_OP_READ_REQ,			BT_ATT_OP_READ_RSP },
-	{ BT_ATT_OP_READ_BLOB_REQ,		BT_ATT_OP_READ_BLOB_RSP },
-	{ BT_ATT_OP_READ_MULT_REQ,		BT_ATT_OP_READ_MULT_RSP },
-	{ BT_ATT_OP_READ_BY_GRP_TYPE_REQ,	BT_ATT_OP_READ_BY_GRP_TYPE_RSP },
-	{ BT_ATT_OP_WRITE_REQ,			BT_ATT_OP_WRITE_RSP },
-	{ BT_ATT_OP_PREP_WRITE_REQ,		BT_ATT_OP_PREP_WRITE_RSP },
-	{ BT_ATT_OP_EXEC_WRITE_REQ,		BT_ATT_OP_EXEC_WRITE_RSP },
-	{ }
-};
-
 static uint8_t get_req_opcode(uint8_t rsp_opcode)
 {
-	int i;
-
-	for (i = 0; att_req_rsp_mapping_table[i].rsp_opcode; i++) {
-		if (att_req_rsp_mapping_table[i].rsp_opcode == rsp_opcode)
-			return att_req_rsp_mapping_table[i].req_opcode;
-	}
+	if (get_op_type(rsp_opcode) != BT_ATT_OP_TYPE_RSP)
+		return 0;
 
-	return 0;
+	return bt_att_opcode_info[rsp_opcode].peer;
 }
 
+struct timeout_data {
+	struct bt_att *att;
+	unsigned int id;
+};
+
 struct att_send_op {
+	struct bt_att *att;
+	struct att_send_op *next;	/* Link in the op pool */
 	unsigned int id;
 	unsigned int timeout_id;
-	enum att_op_type type;
+	unsigned int timeout_ms;	/* Per operation deadline, if any */
+	struct timeout_data timeout;
+	enum bt_att_op_type type;
+	uint8_t priority;
 	uint16_t opcode;
 	void *pdu;
+	uint16_t pdu_size;		/* Allocated size of pdu */
 	uint16_t len;
+	uint8_t hdr;			/* Opcode byte for caller buffers */
+	const void *buf;
+	bt_att_destroy_func_t release;
+	void *release_data;
+	uint64_t queued;		/* Timestamps in usec */
+	uint64_t sent;
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
 };
 
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void latency_add(struct bt_att_latency *lat, uint64_t usec)
+{
+	uint64_t msec = usec / 1000;
+	int i;
+
+	if (!lat->count || usec < lat->min)
+		lat->min = usec;
+
+	if (usec > lat->max)
+		lat->max = usec;
+
+	lat->count++;
+	lat->total += usec;
+
+	/* Bucket 0 is below 1 ms, bucket i holds [2^(i-1), 2^i) ms */
+	for (i = 0; msec && i < BT_ATT_LATENCY_BUCKETS - 1; i++)
+		msec >>= 1;
+
+	lat->hist[i]++;
+}
+
+static void stats_sent(struct bt_att *att, struct att_send_op *op,
+								size_t len)
+{
+	op->sent = get_usec();
+
+	att->stats.pdus_sent++;
+	att->stats.bytes_sent += len;
+
+	latency_add(&att->stats.write_delay, op->sent - op->queued);
+
+	BT_TRACE4(att_send, att, op->opcode, len, op->sent - op->queued);
+}
+
+static void update_rtt_estimate(struct bt_att *att, uint64_t rtt)
+{
+	uint64_t delta;
+
+	if (!att->rtt_samples++) {
+		att->srtt = rtt;
+		att->rttvar = rtt / 2;
+		return;
+	}
+
+	delta = att->srtt > rtt ? att->srtt - rtt : rtt - att->srtt;
+
+	att->rttvar = (3 * att->rttvar + delta) / 4;
+	att->srtt = (7 * att->srtt + rtt) / 8;
+}
+
+static void stats_completed(struct bt_att *att, struct att_send_op *op)
+{
+	uint64_t rtt = get_usec() - op->sent;
+
+	latency_add(&att->stats.rtt, rtt);
+	update_rtt_estimate(att, rtt);
+
+	if (!att->op_rtt[op->opcode]) {
+		att->op_rtt[op->opcode] = new0(struct bt_att_latency, 1);
+		if (!att->op_rtt[op->opcode])
+			return;
+	}
+
+	latency_add(att->op_rtt[op->opcode], rtt);
+}
+
+/* PDUs taken from each write queue per scheduling round */
+static const unsigned int att_priority_weight[ATT_PRIORITY_COUNT] = {
+	[BT_ATT_PRIORITY_LOW]		= 1,
+	[BT_ATT_PRIORITY_NORMAL]	= 4,
+	[BT_ATT_PRIORITY_HIGH]		= 8,
+};
+
+static bool queues_new(struct queue **queues)
+{
+	int i;
+
+	for (i = 0; i < ATT_PRIORITY_COUNT; i++) {
+		queues[i] = queue_new();
+		if (!queues[i])
+			return false;
+	}
+
+	return true;
+}
+
+static void queues_destroy(struct queue **queues)
+{
+	int i;
+
+	for (i = 0; i < ATT_PRIORITY_COUNT; i++) {
+		queue_destroy(queues[i], NULL);
+		queues[i] = NULL;
+	}
+}
+
+static unsigned int queues_length(struct queue **queues)
+{
+	unsigned int len = 0;
+	int i;
+
+	for (i = 0; i < ATT_PRIORITY_COUNT; i++)
+		len += queue_length(queues[i]);
+
+	return len;
+}
+
+/* Returns the highest priority with anything queued, -1 if all are empty */
+static int queues_top(struct queue **queues)
+{
+	int i;
+
+	for (i = ATT_PRIORITY_COUNT - 1; i >= 0; i--) {
+		if (!queue_isempty(queues[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+static struct att_send_op *queues_pop(struct queue **queues)
+{
+	int prio = queues_top(queues);
+
+	if (prio < 0)
+		return NULL;
+
+	return queue_pop_head(queues[prio]);
+}
+
+static void update_peak(unsigned int *peak, struct queue **queues)
+{
+	unsigned int len = queues_length(queues);
+
+	if (len > *peak)
+		*peak = len;
+}
+
+static struct att_send_op *alloc_att_send_op(struct bt_att *att)
+{
+	struct att_send_op *op = att->op_pool;
+	void *pdu;
+	uint16_t pdu_size;
+
+	if (!op) {
+		att->op_pool_misses++;
+
+		op = new0(struct att_send_op, 1);
+		if (op)
+			op->att = att;
+
+		return op;
+	}
+
+	att->op_pool = op->next;
+	att->op_pool_len--;
+	att->op_pool_hits++;
+
+	/* Keep the PDU buffer around, it's sized from the MTU */
+	pdu = op->pdu;
+	pdu_size = op->pdu_size;
+
+	memset(op, 0, sizeof(*op));
+
+	op->att = att;
+	op->pdu = pdu;
+	op->pdu_size = pdu_size;
+
+	return op;
+}
+
+static void free_att_send_op(struct att_send_op *op)
+{
+	struct bt_att *att = op->att;
+
+	if (att->op_pool_len >= ATT_OP_POOL_MAX) {
+		free(op->pdu);
+		free(op);
+		return;
+	}
+
+	/* Buffers from before an MTU change are too small to be reused */
+	if (op->pdu_size < att->mtu) {
+		free(op->pdu);
+		op->pdu = NULL;
+		op->pdu_size = 0;
+	}
+
+	op->next = att->op_pool;
+	att->op_pool = op;
+	att->op_pool_len++;
+}
+
+static void flush_op_pool(struct bt_att *att)
+{
+	struct att_send_op *op;
+
+	while ((op = att->op_pool)) {
+		att->op_pool = op->next;
+		free(op->pdu);
+		free(op);
+	}
+
+	att->op_pool_len = 0;
+}
+
 static void destroy_att_send_op(void *data)
 {
 	struct att_send_op *op = data;
@@ -188,8 +435,56 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->pdu);
-	free(op);
+	if (op->release)
+		op->release(op->release_data);
+
+	free_att_send_op(op);
+}
+
+static void cancel_att_send_op(struct att_send_op *op)
+{
+	if (op->destroy)
+		op->destroy(op->user_data);
+
+	op->callback = NULL;
+	op->destroy = NULL;
+	op->user_data = NULL;
+}
+
+static int att_send_op_iov(struct att_send_op *op, struct iovec *iov)
+{
+	if (!op->buf) {
+		iov[0].iov_base = op->pdu;
+		iov[0].iov_len = op->len;
+		return 1;
+	}
+
+	iov[0].iov_base = &op->hdr;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void *) op->buf;
+	iov[1].iov_len = op->len - 1;
+
+	return 2;
+}
+
+static void hexdump_att_send_op(struct bt_att *att, struct att_send_op *op,
+							size_t len)
+{
+	struct iovec iov[2];
+	int i, count;
+
+	if (!att->debug_callback)
+		return;
+
+	count = att_send_op_iov(op, iov);
+
+	for (i = 0; i < count && len; i++) {
+		size_t chunk = iov[i].iov_len < len ? iov[i].iov_len : len;
+
+		util_hexdump('<', iov[i].iov_base, chunk,
+					att->debug_callback, att->debug_data);
+		len -= chunk;
+	}
 }
 
 struct att_notify {
@@ -211,14 +506,6 @@ static void destroy_att_notify(void *data)
 	free(notify);
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct att_notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 static bool match_notify_removed(const void *a, const void *b)
 {
 	const struct att_notify *notify = a;
@@ -233,6 +520,35 @@ static void mark_notify_removed(void *data, void *user_data)
 	notify->removed = true;
 }
 
+static void unlink_notify(void *data, void *user_data)
+{
+	struct att_notify *notify = data;
+	struct bt_att *att = user_data;
+
+	if (!notify->removed)
+		return;
+
+	queue_remove(att->notify_table[notify->opcode], notify);
+}
+
+static void cleanup_notify_list(struct bt_att *att)
+{
+	idmap_foreach(att->notify_list, unlink_notify, att);
+	idmap_remove_all(att->notify_list, match_notify_removed, NULL,
+							destroy_att_notify);
+	att->need_notify_cleanup = false;
+}
+
+static void destroy_notify_table(struct bt_att *att)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		queue_destroy(att->notify_table[i], NULL);
+		att->notify_table[i] = NULL;
+	}
+}
+
 struct att_disconn {
 	unsigned int id;
 	bool removed;
@@ -284,10 +600,19 @@ static bool encode_pdu(struct att_send_op *op, const void *pdu,
 	if (pdu_len > mtu)
 		return false;
 
+	if (op->pdu_size < pdu_len) {
+		free(op->pdu);
+
+		op->pdu = malloc(mtu);
+		if (!op->pdu) {
+			op->pdu_size = 0;
+			return false;
+		}
+
+		op->pdu_size = mtu;
+	}
+
 	op->len = pdu_len;
-	op->pdu = malloc(op->len);
-	if (!op->pdu)
-		return false;
 
 	((uint8_t *) op->pdu)[0] = op->opcode;
 	if (pdu_len > 1)
@@ -296,67 +621,94 @@ static bool encode_pdu(struct att_send_op *op, const void *pdu,
 	return true;
 }
 
-static struct att_send_op *create_att_send_op(uint8_t opcode, const void *pdu,
-						uint16_t length, uint16_t mtu,
+static struct att_send_op *new_att_send_op(struct bt_att *att, uint8_t opcode,
 						bt_att_response_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
-	enum att_op_type op_type;
-
-	if (length && !pdu)
-		return NULL;
+	enum bt_att_op_type op_type;
 
 	op_type = get_op_type(opcode);
-	if (op_type == ATT_OP_TYPE_UNKNOWN)
+	if (op_type == BT_ATT_OP_TYPE_UNKNOWN)
 		return NULL;
 
 	/* If the opcode corresponds to an operation type that does not elicit a
 	 * response from the remote end, then no callback should have been
 	 * provided, since it will never be called.
 	 */
-	if (callback && op_type != ATT_OP_TYPE_REQ && op_type != ATT_OP_TYPE_IND)
+	if (callback && op_type != BT_ATT_OP_TYPE_REQ &&
+					op_type != BT_ATT_OP_TYPE_IND)
 		return NULL;
 
 	/* Similarly, if the operation does elicit a response then a callback
 	 * must be provided.
 	 */
-	if (!callback && (op_type == ATT_OP_TYPE_REQ || op_type == ATT_OP_TYPE_IND))
+	if (!callback && (op_type == BT_ATT_OP_TYPE_REQ ||
+					op_type == BT_ATT_OP_TYPE_IND))
 		return NULL;
 
-	op = new0(struct att_send_op, 1);
+	op = alloc_att_send_op(att);
 	if (!op)
 		return NULL;
 
 	op->type = op_type;
+	op->priority = BT_ATT_PRIORITY_NORMAL;
 	op->opcode = opcode;
 	op->callback = callback;
 	op->destroy = destroy;
 	op->user_data = user_data;
 
-	if (!encode_pdu(op, pdu, length, mtu)) {
-		free(op);
+	return op;
+}
+
+static struct att_send_op *create_att_send_op(struct bt_att *att,
+						uint8_t opcode, const void *pdu,
+						uint16_t length,
+						bt_att_response_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (length && !pdu)
+		return NULL;
+
+	op = new_att_send_op(att, opcode, callback, user_data, destroy);
+	if (!op)
+		return NULL;
+
+	if (!encode_pdu(op, pdu, length, att->mtu)) {
+		free_att_send_op(op);
 		return NULL;
 	}
 
 	return op;
 }
 
-static struct att_send_op *pick_next_send_op(struct bt_att *att)
+static struct att_chan *primary_chan(struct bt_att *att)
 {
-	struct att_send_op *op;
+	return queue_peek_head(att->chans);
+}
 
-	/* See if any operations are already in the write queue */
-	op = queue_pop_head(att->write_queue);
-	if (op)
-		return op;
+static bool att_connected(struct bt_att *att)
+{
+	struct att_chan *chan = primary_chan(att);
+
+	return chan && chan->io;
+}
+
+static struct att_send_op *pick_next_send_op(struct att_chan *chan)
+{
+	struct bt_att *att = chan->att;
+	bool primary = chan == primary_chan(att);
+	struct att_send_op *op;
 
-	/* If there is no pending request, pick an operation from the
-	 * request queue.
+	/* If there is no pending request on this bearer, pick an operation
+	 * from the request queue.
 	 */
-	if (!att->pending_req) {
-		op = queue_pop_head(att->req_queue);
+	if (!chan->pending_req) {
+		op = queues_pop(att->req_queue);
 		if (op)
 			return op;
 	}
@@ -364,71 +716,292 @@ static struct att_send_op *pick_next_send_op(struct bt_att *att)
 	/* There is either a request pending or no requests queued. If there is
 	 * no pending indication, pick an operation from the indication queue.
 	 */
-	if (!att->pending_ind) {
+	if (primary && !att->pending_ind) {
 		op = queue_pop_head(att->ind_queue);
 		if (op)
 			return op;
 	}
 
-	return NULL;
-}
+	return NULL;
+}
+
+static bool match_pending_id(const void *a, const void *b)
+{
+	const struct att_chan *chan = a;
+	unsigned int id = PTR_TO_UINT(b);
+
+	return chan->pending_req && chan->pending_req->id == id;
+}
+
+static void destroy_chan(void *data)
+{
+	struct att_chan *chan = data;
+
+	io_destroy(chan->io);
+	free(chan->buf);
+	free(chan);
+}
+
+static bool disconnect_cb(struct io *io, void *user_data);
+
+static unsigned int op_timeout(struct bt_att *att, struct att_send_op *op)
+{
+	uint64_t rto;
+
+	if (op->timeout_ms)
+		return op->timeout_ms;
+
+	if (!att->adaptive_timeout || att->rtt_samples < ATT_RTT_MIN_SAMPLES)
+		return att->timeout;
+
+	rto = (att->srtt + 4 * att->rttvar) / 1000;
+	if (rto < ATT_TIMEOUT_MIN)
+		return ATT_TIMEOUT_MIN;
+
+	if (rto > att->timeout)
+		return att->timeout;
+
+	return rto;
+}
+
+static bool timeout_cb(void *user_data)
+{
+	struct timeout_data *timeout = user_data;
+	struct bt_att *att = timeout->att;
+	struct att_chan *chan;
+	struct att_send_op *op = NULL;
+
+	chan = queue_find(att->chans, match_pending_id,
+						UINT_TO_PTR(timeout->id));
+	if (chan) {
+		op = chan->pending_req;
+		chan->pending_req = NULL;
+	} else if (att->pending_ind && att->pending_ind->id == timeout->id) {
+		op = att->pending_ind;
+		att->pending_ind = NULL;
+		chan = primary_chan(att);
+	}
+
+	if (!op)
+		return false;
+
+	bt_att_ref(att);
+
+	/* No further operations can be sent on a bearer after a transaction
+	 * timed out. Secondary bearers are simply dropped, the others keep
+	 * serving the queues.
+	 */
+	if (chan != primary_chan(att)) {
+		queue_remove(att->chans, chan);
+		destroy_chan(chan);
+		chan = NULL;
+	} else if (!att->fail_fast) {
+		io_destroy(chan->io);
+		chan->io = NULL;
+		chan = NULL;
+	}
+
+	util_debug(att->debug_callback, att->debug_data,
+				"Operation timed out: 0x%02x", op->opcode);
+
+	att->stats.timeouts++;
+
+	BT_TRACE2(att_timeout, att, op->opcode);
+
+	if (att->timeout_callback)
+		att->timeout_callback(op->id, op->opcode, att->timeout_data);
+
+	op->timeout_id = 0;
+	destroy_att_send_op(op);
+
+	/* In fail fast mode the link is brought down right away so that
+	 * everybody waiting on it gets notified.
+	 */
+	if (chan && chan->io) {
+		shutdown(chan->fd, SHUT_RDWR);
+		disconnect_cb(chan->io, chan);
+	}
+
+	bt_att_unref(att);
+
+	return false;
+}
+
+static void write_watch_destroy(void *user_data)
+{
+	struct att_chan *chan = user_data;
+
+	chan->writer_active = false;
+}
+
+static ssize_t write_batch_fallback(struct att_chan *chan,
+							struct mmsghdr *msg)
+{
+	ssize_t bytes_written;
+
+	bytes_written = writev(chan->fd, msg->msg_hdr.msg_iov,
+						msg->msg_hdr.msg_iovlen);
+	if (bytes_written < 0)
+		return -1;
+
+	msg->msg_len = bytes_written;
+
+	return 1;
+}
+
+static void check_writable(struct bt_att *att)
+{
+	if (!att->write_blocked)
+		return;
+
+	if (queues_length(att->write_queue) > att->write_low)
+		return;
+
+	att->write_blocked = false;
+
+	if (att->writable_callback)
+		att->writable_callback(att->writable_data);
+}
+
+/*
+ * Fill a batch by taking up to the weight of each priority from its queue,
+ * highest first, and repeating until the batch is full. Bulk traffic keeps
+ * flowing but can't hold up more urgent PDUs behind it.
+ */
+static int pick_batch(struct bt_att *att, struct att_send_op **ops)
+{
+	struct att_send_op *op;
+	unsigned int n;
+	int count = 0;
+	int prio;
+	bool more = true;
+
+	while (more && count < ATT_WRITE_BATCH_MAX) {
+		more = false;
+
+		for (prio = ATT_PRIORITY_COUNT - 1; prio >= 0; prio--) {
+			for (n = 0; n < att_priority_weight[prio]; n++) {
+				if (count == ATT_WRITE_BATCH_MAX)
+					return count;
+
+				op = queue_pop_head(att->write_queue[prio]);
+				if (!op)
+					break;
+
+				ops[count++] = op;
+				more = true;
+			}
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Send the PDUs in the write queue, none of which expect a response, as a
+ * single batch. Each PDU keeps its own message so that the SDU boundaries
+ * on the L2CAP channel are preserved.
+ */
+static void write_batch(struct att_chan *chan)
+{
+	struct bt_att *att = chan->att;
+	struct att_send_op *ops[ATT_WRITE_BATCH_MAX];
+	struct att_send_op *failed = NULL;
+	struct mmsghdr msgs[ATT_WRITE_BATCH_MAX];
+	struct iovec iov[ATT_WRITE_BATCH_MAX][2];
+	int count, sent, i;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	count = pick_batch(att, ops);
+
+	for (i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_iov = iov[i];
+		msgs[i].msg_hdr.msg_iovlen = att_send_op_iov(ops[i], iov[i]);
+	}
+
+	sent = sendmmsg(chan->fd, msgs, count, MSG_DONTWAIT);
+	if (sent < 0 && errno == ENOTSOCK)
+		sent = write_batch_fallback(chan, msgs);
+
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			sent = 0;
+			goto requeue;
+		}
+
+		/* Only the first message failed, the rest are retried */
+		util_debug(att->debug_callback, att->debug_data,
+					"write failed: %s", strerror(errno));
+		failed = ops[0];
+		sent = 1;
+		goto requeue;
+	}
+
+	for (i = 0; i < sent; i++) {
+		util_debug(att->debug_callback, att->debug_data,
+					"ATT op 0x%02x", ops[i]->opcode);
 
-struct timeout_data {
-	struct bt_att *att;
-	unsigned int id;
-};
+		hexdump_att_send_op(att, ops[i], msgs[i].msg_len);
 
-static bool timeout_cb(void *user_data)
-{
-	struct timeout_data *timeout = user_data;
-	struct bt_att *att = timeout->att;
-	struct att_send_op *op = NULL;
+		stats_sent(att, ops[i], msgs[i].msg_len);
 
-	if (att->pending_req && att->pending_req->id == timeout->id) {
-		op = att->pending_req;
-		att->pending_req = NULL;
-	} else if (att->pending_ind && att->pending_ind->id == timeout->id) {
-		op = att->pending_ind;
-		att->pending_ind = NULL;
+		destroy_att_send_op(ops[i]);
 	}
 
-	if (!op)
-		return false;
-
-	io_destroy(att->io);
-	att->io = NULL;
-
-	util_debug(att->debug_callback, att->debug_data,
-				"Operation timed out: 0x%02x", op->opcode);
+requeue:
+	/* Put back whatever didn't make it out, preserving the order */
+	for (i = count - 1; i >= sent; i--)
+		queue_push_head(att->write_queue[ops[i]->priority], ops[i]);
 
-	if (att->timeout_callback)
-		att->timeout_callback(op->id, op->opcode, att->timeout_data);
+	if (sent > 0)
+		check_writable(att);
 
-	op->timeout_id = 0;
-	destroy_att_send_op(op);
+	/* Report the failure once the queues are consistent again */
+	if (failed) {
+		if (failed->callback)
+			failed->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
+							failed->user_data);
 
-	return false;
+		destroy_att_send_op(failed);
+	}
 }
 
-static void write_watch_destroy(void *user_data)
+static bool request_first(struct att_chan *chan)
 {
-	struct bt_att *att = user_data;
+	struct bt_att *att = chan->att;
+	int write_prio = queues_top(att->write_queue);
+
+	if (write_prio < 0)
+		return true;
+
+	if (chan->pending_req)
+		return false;
 
-	att->writer_active = false;
+	return queues_top(att->req_queue) >= write_prio;
 }
 
 static bool can_write_data(struct io *io, void *user_data)
 {
-	struct bt_att *att = user_data;
+	struct att_chan *chan = user_data;
+	struct bt_att *att = chan->att;
 	struct att_send_op *op;
-	struct timeout_data *timeout;
+	struct iovec iov[2];
 	ssize_t bytes_written;
 
-	op = pick_next_send_op(att);
+	/* A request goes first unless more urgent PDUs are waiting, so that
+	 * a stream of commands doesn't hold requests back indefinitely.
+	 */
+	if (chan == primary_chan(att) && !request_first(chan)) {
+		write_batch(chan);
+		return true;
+	}
+
+	op = pick_next_send_op(chan);
 	if (!op)
 		return false;
 
-	bytes_written = write(att->fd, op->pdu, op->len);
+	bytes_written = writev(chan->fd, iov, att_send_op_iov(op, iov));
 	if (bytes_written < 0) {
 		util_debug(att->debug_callback, att->debug_data,
 					"write failed: %s", strerror(errno));
@@ -443,18 +1016,19 @@ static bool can_write_data(struct io *io, void *user_data)
 	util_debug(att->debug_callback, att->debug_data,
 					"ATT op 0x%02x", op->opcode);
 
-	util_hexdump('<', op->pdu, bytes_written,
-					att->debug_callback, att->debug_data);
+	hexdump_att_send_op(att, op, bytes_written);
+
+	stats_sent(att, op, bytes_written);
 
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
 	 * no need to keep it around.
 	 */
 	switch (op->type) {
-	case ATT_OP_TYPE_REQ:
-		att->pending_req = op;
+	case BT_ATT_OP_TYPE_REQ:
+		chan->pending_req = op;
 		break;
-	case ATT_OP_TYPE_IND:
+	case BT_ATT_OP_TYPE_IND:
 		att->pending_ind = op;
 		break;
 	default:
@@ -462,44 +1036,62 @@ static bool can_write_data(struct io *io, void *user_data)
 		return true;
 	}
 
-	timeout = new0(struct timeout_data, 1);
-	if (!timeout)
-		return true;
-
-	timeout->att = att;
-	timeout->id = op->id;
-	op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
-								timeout, free);
+	op->timeout.att = att;
+	op->timeout.id = op->id;
+	op->timeout_id = timeout_add(op_timeout(att, op), timeout_cb,
+							&op->timeout, NULL);
 
 	/* Return true as there may be more operations ready to write. */
 	return true;
 }
 
-static void wakeup_writer(struct bt_att *att)
+static bool chan_can_write(struct att_chan *chan)
+{
+	struct bt_att *att = chan->att;
+
+	if (!chan->pending_req && queues_top(att->req_queue) >= 0)
+		return true;
+
+	/* Everything but requests goes out on the primary bearer */
+	if (chan != primary_chan(att))
+		return false;
+
+	if (queues_top(att->write_queue) >= 0)
+		return true;
+
+	return !att->pending_ind && !queue_isempty(att->ind_queue);
+}
+
+static void wakeup_chan_writer(void *data, void *user_data)
 {
-	if (att->writer_active)
+	struct att_chan *chan = data;
+
+	if (chan->writer_active || !chan->io)
 		return;
 
 	/* Set the write handler only if there is anything that can be sent
 	 * at all.
 	 */
-	if (queue_isempty(att->write_queue)) {
-		if ((att->pending_req || queue_isempty(att->req_queue)) &&
-			(att->pending_ind || queue_isempty(att->ind_queue)))
-			return;
-	}
+	if (!chan_can_write(chan))
+		return;
 
-	if (!io_set_write_handler(att->io, can_write_data, att,
+	if (!io_set_write_handler(chan->io, can_write_data, chan,
 							write_watch_destroy))
 		return;
 
-	att->writer_active = true;
+	chan->writer_active = true;
+}
+
+static void wakeup_writer(struct bt_att *att)
+{
+	queue_foreach(att->chans, wakeup_chan_writer, NULL);
 }
 
-static void handle_rsp(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
+static void handle_rsp(struct att_chan *chan, uint8_t opcode, uint8_t *pdu,
 								ssize_t pdu_len)
 {
-	struct att_send_op *op = att->pending_req;
+	struct bt_att *att = chan->att;
+	struct att_send_op *op = chan->pending_req;
 	uint8_t req_opcode;
 	uint8_t rsp_opcode;
 	uint8_t *rsp_pdu = NULL;
@@ -525,6 +1117,8 @@ static void handle_rsp(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 	if (req_opcode != op->opcode)
 		goto fail;
 
+	stats_completed(att, op);
+
 	rsp_opcode = opcode;
 
 	if (pdu_len > 0) {
@@ -545,7 +1139,30 @@ done:
 		op->callback(rsp_opcode, rsp_pdu, rsp_pdu_len, op->user_data);
 
 	destroy_att_send_op(op);
-	att->pending_req = NULL;
+	chan->pending_req = NULL;
+
+	wakeup_writer(att);
+}
+
+static void handle_conf(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
+								ssize_t pdu_len)
+{
+	struct att_send_op *op = att->pending_ind;
+
+	/* A confirmation without a pending indication is simply dropped */
+	if (!op || pdu_len) {
+		wakeup_writer(att);
+		return;
+	}
+
+	att->pending_ind = NULL;
+
+	stats_completed(att, op);
+
+	if (op->callback)
+		op->callback(opcode, NULL, 0, op->user_data);
+
+	destroy_att_send_op(op);
 
 	wakeup_writer(att);
 }
@@ -564,9 +1181,6 @@ static void notify_handler(void *data, void *user_data)
 	if (notify->removed)
 		return;
 
-	if (notify->opcode != not_data->opcode)
-		return;
-
 	if (notify->callback)
 		notify->callback(not_data->opcode, not_data->pdu,
 					not_data->pdu_len, notify->user_data);
@@ -588,49 +1202,61 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 		data.pdu_len = pdu_len;
 	}
 
-	queue_foreach(att->notify_list, notify_handler, &data);
+	/* Handlers for this specific opcode go first, then the ones that were
+	 * registered for all requests. The wildcard bucket is keyed on 0x00,
+	 * so a PDU with that opcode has already been dispatched to it.
+	 */
+	queue_foreach(att->notify_table[opcode], notify_handler, &data);
+
+	if (opcode != BT_ATT_ALL_REQUESTS && is_request(opcode))
+		queue_foreach(att->notify_table[BT_ATT_ALL_REQUESTS],
+						notify_handler, &data);
 
 	att->in_notify = false;
 
-	if (att->need_notify_cleanup) {
-		queue_remove_all(att->notify_list, match_notify_removed, NULL,
-							destroy_att_notify);
-		att->need_notify_cleanup = false;
-	}
+	if (att->need_notify_cleanup)
+		cleanup_notify_list(att);
 
 	bt_att_unref(att);
 }
 
 static bool can_read_data(struct io *io, void *user_data)
 {
-	struct bt_att *att = user_data;
+	struct att_chan *chan = user_data;
+	struct bt_att *att = chan->att;
 	uint8_t opcode;
 	uint8_t *pdu;
 	ssize_t bytes_read;
 
-	bytes_read = read(att->fd, att->buf, att->mtu);
+	bytes_read = read(chan->fd, chan->buf, att->mtu);
 	if (bytes_read < 0)
 		return false;
 
-	util_hexdump('>', att->buf, bytes_read,
+	util_hexdump('>', chan->buf, bytes_read,
 					att->debug_callback, att->debug_data);
 
+	att->stats.pdus_received++;
+	att->stats.bytes_received += bytes_read;
+
 	if (bytes_read < ATT_MIN_PDU_LEN)
 		return true;
 
-	pdu = att->buf;
+	pdu = chan->buf;
 	opcode = pdu[0];
 
+	BT_TRACE3(att_recv, att, opcode, bytes_read);
+
 	/* Act on the received PDU based on the opcode type */
 	switch (get_op_type(opcode)) {
-	case ATT_OP_TYPE_RSP:
+	case BT_ATT_OP_TYPE_RSP:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT response received: 0x%02x", opcode);
-		handle_rsp(att, opcode, pdu + 1, bytes_read - 1);
+		handle_rsp(chan, opcode, pdu + 1, bytes_read - 1);
 		break;
-	case ATT_OP_TYPE_CONF:
+	case BT_ATT_OP_TYPE_CONF:
 		util_debug(att->debug_callback, att->debug_data,
-				"ATT opcode cannot be handled: 0x%02x", opcode);
+				"ATT confirmation received: 0x%02x", opcode);
+		handle_conf(att, opcode, pdu + 1, bytes_read - 1);
 		break;
 	default:
 		/* For all other opcodes notify the upper layer of the PDU and
@@ -656,12 +1282,39 @@ static void disconn_handler(void *data, void *user_data)
 		disconn->callback(disconn->user_data);
 }
 
+static void chan_disconnected(struct att_chan *chan)
+{
+	struct bt_att *att = chan->att;
+	struct att_send_op *op = chan->pending_req;
+
+	util_debug(att->debug_callback, att->debug_data,
+					"Bearer disconnected (fd %d)", chan->fd);
+
+	queue_remove(att->chans, chan);
+	destroy_chan(chan);
+
+	/* Give the outstanding request another go on the remaining bearers */
+	if (op) {
+		timeout_remove(op->timeout_id);
+		op->timeout_id = 0;
+		queue_push_head(att->req_queue[op->priority], op);
+	}
+
+	wakeup_writer(att);
+}
+
 static bool disconnect_cb(struct io *io, void *user_data)
 {
-	struct bt_att *att = user_data;
+	struct att_chan *chan = user_data;
+	struct bt_att *att = chan->att;
+
+	if (chan != primary_chan(att)) {
+		chan_disconnected(chan);
+		return false;
+	}
 
-	io_destroy(att->io);
-	att->io = NULL;
+	io_destroy(chan->io);
+	chan->io = NULL;
 
 	util_debug(att->debug_callback, att->debug_data,
 						"Physical link disconnected");
@@ -685,165 +1338,398 @@ static bool disconnect_cb(struct io *io, void *user_data)
 	return false;
 }
 
+static struct att_chan *chan_new(struct bt_att *att, int fd)
+{
+	struct att_chan *chan;
+
+	chan = new0(struct att_chan, 1);
+	if (!chan)
+		return NULL;
+
+	chan->att = att;
+	chan->fd = fd;
+
+	chan->buf = malloc(att->mtu);
+	if (!chan->buf)
+		goto fail;
+
+	chan->io = io_new(fd);
+	if (!chan->io)
+		goto fail;
+
+	if (!io_set_read_handler(chan->io, can_read_data, chan, NULL))
+		goto fail;
+
+	if (!io_set_disconnect_handler(chan->io, disconnect_cb, chan, NULL))
+		goto fail;
+
+	if (att->close_on_unref)
+		io_set_close_on_destroy(chan->io, true);
+
+	return chan;
+
+fail:
+	io_destroy(chan->io);
+	free(chan->buf);
+	free(chan);
+
+	return NULL;
+}
+
 struct bt_att *bt_att_new(int fd)
 {
 	struct bt_att *att;
+	struct att_chan *chan;
 
 	if (fd < 0)
 		return NULL;
 
-	att = new0(struct bt_att, 1);
-	if (!att)
-		return NULL;
+	att = new0(struct bt_att, 1);
+	if (!att)
+		return NULL;
+
+	att->mtu = BT_ATT_DEFAULT_LE_MTU;
+	att->timeout = ATT_TIMEOUT_INTERVAL;
+
+	att->chans = queue_new();
+	if (!att->chans)
+		goto fail;
+
+	if (!queues_new(att->req_queue))
+		goto fail;
+
+	att->ind_queue = queue_new();
+	if (!att->ind_queue)
+		goto fail;
+
+	if (!queues_new(att->write_queue))
+		goto fail;
+
+	att->notify_list = idmap_new();
+	if (!att->notify_list)
+		goto fail;
+
+	att->disconn_list = queue_new();
+	if (!att->disconn_list)
+		goto fail;
+
+	chan = chan_new(att, fd);
+	if (!chan)
+		goto fail;
+
+	if (!queue_push_tail(att->chans, chan)) {
+		destroy_chan(chan);
+		goto fail;
+	}
+
+	return bt_att_ref(att);
+
+fail:
+	queue_destroy(att->chans, NULL);
+	queues_destroy(att->req_queue);
+	queue_destroy(att->ind_queue, NULL);
+	queues_destroy(att->write_queue);
+	idmap_destroy(att->notify_list, NULL);
+	queue_destroy(att->disconn_list, NULL);
+	free(att);
+
+	return NULL;
+}
+
+struct bt_att *bt_att_ref(struct bt_att *att)
+{
+	if (!att)
+		return NULL;
+
+	__sync_fetch_and_add(&att->ref_count, 1);
+
+	return att;
+}
+
+void bt_att_unref(struct bt_att *att)
+{
+	int i;
+
+	if (!att)
+		return;
+
+	if (__sync_sub_and_fetch(&att->ref_count, 1))
+		return;
+
+	bt_att_unregister_all(att);
+	bt_att_cancel_all(att);
+
+	queue_destroy(att->chans, destroy_chan);
+	queues_destroy(att->req_queue);
+	queue_destroy(att->ind_queue, NULL);
+	queues_destroy(att->write_queue);
+	idmap_destroy(att->notify_list, NULL);
+	queue_destroy(att->disconn_list, NULL);
+	destroy_notify_table(att);
+	att->chans = NULL;
+	att->ind_queue = NULL;
+	att->notify_list = NULL;
+
+	if (att->timeout_destroy)
+		att->timeout_destroy(att->timeout_data);
+
+	if (att->writable_destroy)
+		att->writable_destroy(att->writable_data);
+
+	if (att->debug_destroy)
+		att->debug_destroy(att->debug_data);
+
+	flush_op_pool(att);
+
+	for (i = 0; i < 256; i++)
+		free(att->op_rtt[i]);
+
+	free(att);
+}
+
+static void set_close_on_destroy(void *data, void *user_data)
+{
+	struct att_chan *chan = data;
+	bool *do_close = user_data;
+
+	io_set_close_on_destroy(chan->io, *do_close);
+}
+
+bool bt_att_set_close_on_unref(struct bt_att *att, bool do_close)
+{
+	if (!att || !att_connected(att))
+		return false;
+
+	att->close_on_unref = do_close;
+	queue_foreach(att->chans, set_close_on_destroy, &do_close);
+
+	return true;
+}
+
+bool bt_att_attach_fd(struct bt_att *att, int fd)
+{
+	struct att_chan *chan;
+
+	if (!att || fd < 0 || !att_connected(att))
+		return false;
+
+	chan = chan_new(att, fd);
+	if (!chan)
+		return false;
+
+	if (!queue_push_tail(att->chans, chan)) {
+		destroy_chan(chan);
+		return false;
+	}
+
+	/* Queued requests may be sent right away on the new bearer */
+	wakeup_writer(att);
+
+	return true;
+}
+
+unsigned int bt_att_get_channels(struct bt_att *att)
+{
+	if (!att)
+		return 0;
+
+	return queue_length(att->chans);
+}
+
+bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
+				void *user_data, bt_att_destroy_func_t destroy)
+{
+	if (!att)
+		return false;
+
+	if (att->debug_destroy)
+		att->debug_destroy(att->debug_data);
+
+	att->debug_callback = callback;
+	att->debug_destroy = destroy;
+	att->debug_data = user_data;
+
+	return true;
+}
+
+uint16_t bt_att_get_mtu(struct bt_att *att)
+{
+	if (!att)
+		return 0;
+
+	return att->mtu;
+}
+
+struct resize_data {
+	void **bufs;
+	unsigned int index;
+};
 
-	att->fd = fd;
+static void swap_chan_buf(void *data, void *user_data)
+{
+	struct att_chan *chan = data;
+	struct resize_data *resize = user_data;
 
-	att->mtu = BT_ATT_DEFAULT_LE_MTU;
-	att->buf = malloc(att->mtu);
-	if (!att->buf)
-		goto fail;
+	free(chan->buf);
+	chan->buf = resize->bufs[resize->index++];
+}
 
-	att->io = io_new(fd);
-	if (!att->io)
-		goto fail;
+bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
+{
+	struct resize_data resize;
+	unsigned int i, count;
 
-	att->req_queue = queue_new();
-	if (!att->req_queue)
-		goto fail;
+	if (!att)
+		return false;
 
-	att->ind_queue = queue_new();
-	if (!att->ind_queue)
-		goto fail;
+	if (mtu < BT_ATT_DEFAULT_LE_MTU)
+		return false;
 
-	att->write_queue = queue_new();
-	if (!att->write_queue)
-		goto fail;
+	count = queue_length(att->chans);
 
-	att->notify_list = queue_new();
-	if (!att->notify_list)
-		goto fail;
+	resize.bufs = new0(void *, count);
+	if (count && !resize.bufs)
+		return false;
 
-	att->disconn_list = queue_new();
-	if (!att->disconn_list)
-		goto fail;
+	/* Allocate every bearer's buffer before replacing any of them, so that
+	 * a failure leaves all bearers sized for the current MTU.
+	 */
+	for (i = 0; i < count; i++) {
+		resize.bufs[i] = malloc(mtu);
+		if (!resize.bufs[i])
+			goto fail;
+	}
 
-	if (!io_set_read_handler(att->io, can_read_data, att, NULL))
-		goto fail;
+	resize.index = 0;
+	queue_foreach(att->chans, swap_chan_buf, &resize);
+	free(resize.bufs);
 
-	if (!io_set_disconnect_handler(att->io, disconnect_cb, att, NULL))
-		goto fail;
+	/* Pooled PDU buffers are sized from the MTU */
+	if (mtu > att->mtu)
+		flush_op_pool(att);
 
-	return bt_att_ref(att);
+	att->mtu = mtu;
+
+	return true;
 
 fail:
-	queue_destroy(att->req_queue, NULL);
-	queue_destroy(att->ind_queue, NULL);
-	queue_destroy(att->write_queue, NULL);
-	queue_destroy(att->notify_list, NULL);
-	queue_destroy(att->disconn_list, NULL);
-	io_destroy(att->io);
-	free(att->buf);
-	free(att);
+	while (i--)
+		free(resize.bufs[i]);
 
-	return NULL;
+	free(resize.bufs);
+
+	return false;
 }
 
-struct bt_att *bt_att_ref(struct bt_att *att)
+bool bt_att_get_pool_stats(struct bt_att *att, unsigned int *hits,
+							unsigned int *misses)
 {
 	if (!att)
-		return NULL;
+		return false;
 
-	__sync_fetch_and_add(&att->ref_count, 1);
+	if (hits)
+		*hits = att->op_pool_hits;
 
-	return att;
+	if (misses)
+		*misses = att->op_pool_misses;
+
+	return true;
 }
 
-void bt_att_unref(struct bt_att *att)
+bool bt_att_get_stats(struct bt_att *att, struct bt_att_stats *stats)
 {
-	if (!att)
-		return;
-
-	if (__sync_sub_and_fetch(&att->ref_count, 1))
-		return;
-
-	bt_att_unregister_all(att);
-	bt_att_cancel_all(att);
+	if (!att || !stats)
+		return false;
 
-	io_destroy(att->io);
-	att->io = NULL;
+	*stats = att->stats;
 
-	queue_destroy(att->req_queue, NULL);
-	queue_destroy(att->ind_queue, NULL);
-	queue_destroy(att->write_queue, NULL);
-	queue_destroy(att->notify_list, NULL);
-	queue_destroy(att->disconn_list, NULL);
-	att->req_queue = NULL;
-	att->ind_queue = NULL;
-	att->write_queue = NULL;
-	att->notify_list = NULL;
+	stats->req_queue_len = queues_length(att->req_queue);
+	stats->ind_queue_len = queue_length(att->ind_queue);
+	stats->write_queue_len = queues_length(att->write_queue);
 
-	if (att->timeout_destroy)
-		att->timeout_destroy(att->timeout_data);
+	return true;
+}
 
-	if (att->debug_destroy)
-		att->debug_destroy(att->debug_data);
+bool bt_att_get_latency(struct bt_att *att, uint8_t opcode,
+					struct bt_att_latency *latency)
+{
+	if (!att || !latency || !att->op_rtt[opcode])
+		return false;
 
-	free(att->buf);
-	att->buf = NULL;
+	*latency = *att->op_rtt[opcode];
 
-	free(att);
+	return true;
 }
 
-bool bt_att_set_close_on_unref(struct bt_att *att, bool do_close)
+void bt_att_reset_stats(struct bt_att *att)
 {
-	if (!att || !att->io)
-		return false;
+	int i;
+
+	if (!att)
+		return;
 
-	return io_set_close_on_destroy(att->io, do_close);
+	memset(&att->stats, 0, sizeof(att->stats));
+
+	for (i = 0; i < 256; i++) {
+		free(att->op_rtt[i]);
+		att->op_rtt[i] = NULL;
+	}
 }
 
-bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
-				void *user_data, bt_att_destroy_func_t destroy)
+bool bt_att_set_timeout(struct bt_att *att, unsigned int msec)
 {
 	if (!att)
 		return false;
 
-	if (att->debug_destroy)
-		att->debug_destroy(att->debug_data);
+	/* The protocol doesn't allow transactions to take any longer */
+	if (!msec || msec > ATT_TIMEOUT_INTERVAL)
+		msec = ATT_TIMEOUT_INTERVAL;
 
-	att->debug_callback = callback;
-	att->debug_destroy = destroy;
-	att->debug_data = user_data;
+	att->timeout = msec;
 
 	return true;
 }
 
-uint16_t bt_att_get_mtu(struct bt_att *att)
+bool bt_att_set_adaptive_timeout(struct bt_att *att, bool enable)
 {
 	if (!att)
-		return 0;
+		return false;
 
-	return att->mtu;
+	att->adaptive_timeout = enable;
+
+	return true;
 }
 
-bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
+bool bt_att_set_fail_fast(struct bt_att *att, bool enable)
 {
-	void *buf;
-
 	if (!att)
 		return false;
 
-	if (mtu < BT_ATT_DEFAULT_LE_MTU)
-		return false;
+	att->fail_fast = enable;
+
+	return true;
+}
 
-	buf = malloc(mtu);
-	if (!buf)
+bool bt_att_set_write_watermark(struct bt_att *att, unsigned int high,
+					unsigned int low,
+					bt_att_writable_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy)
+{
+	if (!att || (high && low >= high))
 		return false;
 
-	free(att->buf);
+	if (att->writable_destroy)
+		att->writable_destroy(att->writable_data);
 
-	att->mtu = mtu;
-	att->buf = buf;
+	att->write_high = high;
+	att->write_low = low;
+	att->writable_callback = callback;
+	att->writable_destroy = destroy;
+	att->writable_data = user_data;
+
+	if (!high)
+		att->write_blocked = false;
 
 	return true;
 }
@@ -872,7 +1758,7 @@ unsigned int bt_att_register_disconnect(struct bt_att *att,
 {
 	struct att_disconn *disconn;
 
-	if (!att || !att->io)
+	if (!att || !att_connected(att))
 		return 0;
 
 	disconn = new0(struct att_disconn, 1);
@@ -920,43 +1806,61 @@ bool bt_att_unregister_disconnect(struct bt_att *att, unsigned int id)
 	return true;
 }
 
-unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
-				const void *pdu, uint16_t length,
-				bt_att_response_func_t callback, void *user_data,
-				bt_att_destroy_func_t destroy)
+/*
+ * Commands and notifications are refused once the write queue reaches the
+ * high watermark, until it drained down to the low one again.
+ */
+static bool write_throttled(struct bt_att *att, struct att_send_op *op)
 {
-	struct att_send_op *op;
-	bool result;
+	if (op->type != BT_ATT_OP_TYPE_CMD && op->type != BT_ATT_OP_TYPE_NOT)
+		return false;
 
-	if (!att || !att->io)
-		return 0;
+	if (!att->write_high)
+		return false;
 
-	op = create_att_send_op(opcode, pdu, length, att->mtu, callback,
-							user_data, destroy);
-	if (!op)
+	if (!att->write_blocked &&
+			queues_length(att->write_queue) < att->write_high)
+		return false;
+
+	att->write_blocked = true;
+
+	return true;
+}
+
+static unsigned int send_op(struct bt_att *att, struct att_send_op *op)
+{
+	bool result;
+
+	if (write_throttled(att, op)) {
+		free_att_send_op(op);
 		return 0;
+	}
 
 	if (att->next_send_id < 1)
 		att->next_send_id = 1;
 
 	op->id = att->next_send_id++;
+	op->queued = get_usec();
 
 	/* Add the op to the correct queue based on its type */
 	switch (op->type) {
-	case ATT_OP_TYPE_REQ:
-		result = queue_push_tail(att->req_queue, op);
+	case BT_ATT_OP_TYPE_REQ:
+		result = queue_push_tail(att->req_queue[op->priority], op);
+		update_peak(&att->stats.req_queue_peak, att->req_queue);
 		break;
-	case ATT_OP_TYPE_IND:
+	case BT_ATT_OP_TYPE_IND:
 		result = queue_push_tail(att->ind_queue, op);
+		if (queue_length(att->ind_queue) > att->stats.ind_queue_peak)
+			att->stats.ind_queue_peak = queue_length(att->ind_queue);
 		break;
 	default:
-		result = queue_push_tail(att->write_queue, op);
+		result = queue_push_tail(att->write_queue[op->priority], op);
+		update_peak(&att->stats.write_queue_peak, att->write_queue);
 		break;
 	}
 
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		free_att_send_op(op);
 		return 0;
 	}
 
@@ -965,6 +1869,57 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	return op->id;
 }
 
+unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
+				const void *pdu, uint16_t length,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || !att_connected(att))
+		return 0;
+
+	op = create_att_send_op(att, opcode, pdu, length, callback,
+							user_data, destroy);
+	if (!op)
+		return 0;
+
+	return send_op(att, op);
+}
+
+unsigned int bt_att_send_buf(struct bt_att *att, uint8_t opcode,
+				const void *pdu, uint16_t length,
+				bt_att_destroy_func_t release,
+				void *release_data,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || !att_connected(att))
+		return 0;
+
+	if (!pdu || !length || length > att->mtu - 1)
+		return 0;
+
+	op = new_att_send_op(att, opcode, callback, user_data, destroy);
+	if (!op)
+		return 0;
+
+	op->hdr = opcode;
+	op->buf = pdu;
+	op->len = length + 1;
+
+	if (!send_op(att, op))
+		return 0;
+
+	/* Only take ownership of the buffer once the op is queued */
+	op->release = release;
+	op->release_data = release_data;
+
+	return op->id;
+}
+
 static bool match_op_id(const void *a, const void *b)
 {
 	const struct att_send_op *op = a;
@@ -973,26 +1928,83 @@ static bool match_op_id(const void *a, const void *b)
 	return op->id == id;
 }
 
+static struct att_send_op *queues_remove(struct queue **queues,
+							unsigned int id)
+{
+	struct att_send_op *op;
+	int i;
+
+	for (i = 0; i < ATT_PRIORITY_COUNT; i++) {
+		op = queue_remove_if(queues[i], match_op_id, UINT_TO_PTR(id));
+		if (op)
+			return op;
+	}
+
+	return NULL;
+}
+
+bool bt_att_set_priority(struct bt_att *att, unsigned int id,
+							uint8_t priority)
+{
+	struct att_send_op *op;
+	struct queue **queues;
+
+	if (!att || !id || priority > BT_ATT_PRIORITY_HIGH)
+		return false;
+
+	/* Only operations that are still queued can be rescheduled */
+	queues = att->req_queue;
+	op = queues_remove(queues, id);
+	if (!op) {
+		queues = att->write_queue;
+		op = queues_remove(queues, id);
+	}
+
+	if (!op)
+		return false;
+
+	op->priority = priority;
+
+	if (!queue_push_tail(queues[priority], op)) {
+		destroy_att_send_op(op);
+		return false;
+	}
+
+	wakeup_writer(att);
+
+	return true;
+}
+
 bool bt_att_cancel(struct bt_att *att, unsigned int id)
 {
+	struct att_chan *chan;
 	struct att_send_op *op;
 
 	if (!att || !id)
 		return false;
 
-	if (att->pending_req && att->pending_req->id == id) {
-		op = att->pending_req;
-		att->pending_req = NULL;
+	/* An operation that is already on the air stays pending until the
+	 * peer answers, so that its response is not taken for the reply to
+	 * the next one. Only its handlers are dropped.
+	 */
+	chan = queue_find(att->chans, match_pending_id, UINT_TO_PTR(id));
+	if (chan) {
+		if (chan->io) {
+			cancel_att_send_op(chan->pending_req);
+			return true;
+		}
+
+		op = chan->pending_req;
+		chan->pending_req = NULL;
 		goto done;
 	}
 
 	if (att->pending_ind && att->pending_ind->id == id) {
-		op = att->pending_ind;
-		att->pending_ind = NULL;
-		goto done;
+		cancel_att_send_op(att->pending_ind);
+		return true;
 	}
 
-	op = queue_remove_if(att->req_queue, match_op_id, UINT_TO_PTR(id));
+	op = queues_remove(att->req_queue, id);
 	if (op)
 		goto done;
 
@@ -1000,9 +2012,13 @@ bool bt_att_cancel(struct bt_att *att, unsigned int id)
 	if (op)
 		goto done;
 
-	op = queue_remove_if(att->write_queue, match_op_id, UINT_TO_PTR(id));
-	if (op)
-		goto done;
+	op = queues_remove(att->write_queue, id);
+	if (op) {
+		destroy_att_send_op(op);
+		check_writable(att);
+		wakeup_writer(att);
+		return true;
+	}
 
 	if (!op)
 		return false;
@@ -1015,19 +2031,84 @@ done:
 	return true;
 }
 
+static void cancel_pending_req(void *data, void *user_data)
+{
+	struct att_chan *chan = data;
+
+	if (!chan->pending_req)
+		return;
+
+	destroy_att_send_op(chan->pending_req);
+	chan->pending_req = NULL;
+}
+
+static struct att_send_op *find_op(struct bt_att *att, unsigned int id)
+{
+	struct att_chan *chan;
+	struct att_send_op *op;
+	int i;
+
+	chan = queue_find(att->chans, match_pending_id, UINT_TO_PTR(id));
+	if (chan)
+		return chan->pending_req;
+
+	if (att->pending_ind && att->pending_ind->id == id)
+		return att->pending_ind;
+
+	for (i = 0; i < ATT_PRIORITY_COUNT; i++) {
+		op = queue_find(att->req_queue[i], match_op_id,
+							UINT_TO_PTR(id));
+		if (op)
+			return op;
+	}
+
+	return queue_find(att->ind_queue, match_op_id, UINT_TO_PTR(id));
+}
+
+bool bt_att_set_op_timeout(struct bt_att *att, unsigned int id,
+							unsigned int msec)
+{
+	struct att_send_op *op;
+
+	if (!att || !id)
+		return false;
+
+	if (msec > ATT_TIMEOUT_INTERVAL)
+		msec = ATT_TIMEOUT_INTERVAL;
+
+	op = find_op(att, id);
+	if (!op)
+		return false;
+
+	op->timeout_ms = msec;
+
+	/* Already on the air, restart the timer with the new deadline */
+	if (op->timeout_id) {
+		timeout_remove(op->timeout_id);
+		op->timeout_id = timeout_add(op_timeout(att, op), timeout_cb,
+							&op->timeout, NULL);
+	}
+
+	return true;
+}
+
 bool bt_att_cancel_all(struct bt_att *att)
 {
+	int i;
+
 	if (!att)
 		return false;
 
-	queue_remove_all(att->req_queue, NULL, NULL, destroy_att_send_op);
+	for (i = 0; i < ATT_PRIORITY_COUNT; i++) {
+		queue_remove_all(att->req_queue[i], NULL, NULL,
+							destroy_att_send_op);
+		queue_remove_all(att->write_queue[i], NULL, NULL,
+							destroy_att_send_op);
+	}
+
 	queue_remove_all(att->ind_queue, NULL, NULL, destroy_att_send_op);
-	queue_remove_all(att->write_queue, NULL, NULL, destroy_att_send_op);
 
-	if (att->pending_req) {
-		destroy_att_send_op(att->pending_req);
-		att->pending_req = NULL;
-	}
+	queue_foreach(att->chans, cancel_pending_req, NULL);
 
 	if (att->pending_ind) {
 		destroy_att_send_op(att->pending_ind);
@@ -1044,9 +2125,15 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 {
 	struct att_notify *notify;
 
-	if (!att || !opcode || !callback || !att->io)
+	if (!att || !callback || !att_connected(att))
 		return 0;
 
+	if (!att->notify_table[opcode]) {
+		att->notify_table[opcode] = queue_new();
+		if (!att->notify_table[opcode])
+			return 0;
+	}
+
 	notify = new0(struct att_notify, 1);
 	if (!notify)
 		return 0;
@@ -1061,7 +2148,13 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 
 	notify->id = att->next_reg_id++;
 
-	if (!queue_push_tail(att->notify_list, notify)) {
+	if (!idmap_insert(att->notify_list, notify->id, notify)) {
+		free(notify);
+		return 0;
+	}
+
+	if (!queue_push_tail(att->notify_table[opcode], notify)) {
+		idmap_remove(att->notify_list, notify->id);
 		free(notify);
 		return 0;
 	}
@@ -1076,13 +2169,13 @@ bool bt_att_unregister(struct bt_att *att, unsigned int id)
 	if (!att || !id)
 		return false;
 
-	notify = queue_find(att->notify_list, match_notify_id,
-							UINT_TO_PTR(id));
+	notify = idmap_lookup(att->notify_list, id);
 	if (!notify)
 		return false;
 
 	if (!att->in_notify) {
-		queue_remove(att->notify_list, notify);
+		queue_remove(att->notify_table[notify->opcode], notify);
+		idmap_remove(att->notify_list, id);
 		destroy_att_notify(notify);
 		return true;
 	}
@@ -1099,10 +2192,11 @@ bool bt_att_unregister_all(struct bt_att *att)
 		return false;
 
 	if (att->in_notify) {
-		queue_foreach(att->notify_list, mark_notify_removed, NULL);
+		idmap_foreach(att->notify_list, mark_notify_removed, NULL);
 		att->need_notify_cleanup = true;
 	} else {
-		queue_remove_all(att->notify_list, NULL, NULL,
+		destroy_notify_table(att);
+		idmap_remove_all(att->notify_list, NULL, NULL,
 							destroy_att_notify);
 	}
 
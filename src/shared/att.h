@@ -35,6 +35,9 @@ void bt_att_unref(struct bt_att *att);
 
 bool bt_att_set_close_on_unref(struct bt_att *att, bool do_close);
 
+bool bt_att_attach_fd(struct bt_att *att, int fd);
+unsigned int bt_att_get_channels(struct bt_att *att);
+
 typedef void (*bt_att_response_func_t)(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data);
 typedef void (*bt_att_notify_func_t)(uint8_t opcode, const void *pdu,
@@ -44,6 +47,7 @@ typedef void (*bt_att_debug_func_t)(const char *str, void *user_data);
 typedef void (*bt_att_timeout_func_t)(unsigned int id, uint8_t opcode,
 							void *user_data);
 typedef void (*bt_att_disconnect_func_t)(void *user_data);
+typedef void (*bt_att_writable_func_t)(void *user_data);
 
 bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 				void *user_data, bt_att_destroy_func_t destroy);
@@ -51,16 +55,78 @@ bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 uint16_t bt_att_get_mtu(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
 
+bool bt_att_get_pool_stats(struct bt_att *att, unsigned int *hits,
+							unsigned int *misses);
+
+#define BT_ATT_LATENCY_BUCKETS 16
+
+/* Times are in microseconds, histogram bucket 0 holds samples below 1 ms
+ * and bucket n the ones in [2^(n-1), 2^n) ms, the last one is open ended.
+ */
+struct bt_att_latency {
+	unsigned int count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	unsigned int hist[BT_ATT_LATENCY_BUCKETS];
+};
+
+struct bt_att_stats {
+	unsigned int pdus_sent;
+	unsigned int pdus_received;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	unsigned int timeouts;
+	unsigned int req_queue_len;
+	unsigned int req_queue_peak;
+	unsigned int ind_queue_len;
+	unsigned int ind_queue_peak;
+	unsigned int write_queue_len;
+	unsigned int write_queue_peak;
+	struct bt_att_latency rtt;		/* Request to response */
+	struct bt_att_latency write_delay;	/* Enqueue to write */
+};
+
+bool bt_att_get_stats(struct bt_att *att, struct bt_att_stats *stats);
+bool bt_att_get_latency(struct bt_att *att, uint8_t opcode,
+					struct bt_att_latency *latency);
+void bt_att_reset_stats(struct bt_att *att);
+
 bool bt_att_set_timeout_cb(struct bt_att *att, bt_att_timeout_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy);
+bool bt_att_set_write_watermark(struct bt_att *att, unsigned int high,
+					unsigned int low,
+					bt_att_writable_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
+
+bool bt_att_set_timeout(struct bt_att *att, unsigned int msec);
+bool bt_att_set_adaptive_timeout(struct bt_att *att, bool enable);
+bool bt_att_set_fail_fast(struct bt_att *att, bool enable);
 
 unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					const void *pdu, uint16_t length,
 					bt_att_response_func_t callback,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
+unsigned int bt_att_send_buf(struct bt_att *att, uint8_t opcode,
+					const void *pdu, uint16_t length,
+					bt_att_destroy_func_t release,
+					void *release_data,
+					bt_att_response_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
+
+#define BT_ATT_PRIORITY_LOW	0x00	/* Bulk data */
+#define BT_ATT_PRIORITY_NORMAL	0x01
+#define BT_ATT_PRIORITY_HIGH	0x02	/* Control traffic */
+
+bool bt_att_set_priority(struct bt_att *att, unsigned int id,
+							uint8_t priority);
 bool bt_att_cancel(struct bt_att *att, unsigned int id);
+bool bt_att_set_op_timeout(struct bt_att *att, unsigned int id,
+							unsigned int msec);
 bool bt_att_cancel_all(struct bt_att *att);
 
 unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
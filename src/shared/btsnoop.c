@@ -28,9 +28,11 @@
 #include <endian.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "src/shared/btsnoop.h"
@@ -57,6 +59,28 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 
 static const uint32_t btsnoop_version = 1;
 
+/*
+ * The optional index file next to a trace maps the timestamp of every
+ * BTSNOOP_INDEX_INTERVAL-th packet to its offset in the trace.
+ */
+struct btsnoop_idx_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 1 */
+	uint32_t	interval;	/* Packets between entries */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_HDR_SIZE (sizeof(struct btsnoop_idx_hdr))
+
+struct btsnoop_idx_entry {
+	uint64_t	ts;		/* Timestamp microseconds */
+	uint64_t	offset;		/* Offset of the packet record */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_ENTRY_SIZE (sizeof(struct btsnoop_idx_entry))
+
+#define BTSNOOP_INDEX_INTERVAL 1000
+
+static const uint8_t btsnoop_idx_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x69, 0x64, 0x78, 0x00 };
+
 struct pklg_pkt {
 	uint32_t	len;
 	uint64_t	ts;
@@ -72,8 +96,101 @@ struct btsnoop {
 	uint16_t index;
 	bool aborted;
 	bool pklg_format;
+	const uint8_t *map;
+	size_t map_size;
+	size_t map_offset;
+	int idx_fd;
+	uint64_t offset;
+	uint32_t count;
+	char *path;
+	char *idx_path;
+	uint8_t *buf;
+	size_t buf_size;
+	size_t buf_len;
+	uint64_t flush_interval;
+	uint64_t last_flush;
+	uint64_t max_size;
+	uint64_t max_age;
+	uint64_t file_start;
+	unsigned int max_files;
 };
 
+/*
+ * Files opened for reading are mapped into memory when possible, so
+ * reading a packet is a copy out of the mapping instead of a couple of
+ * read() system calls.
+ */
+static void map_file(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->map_offset = 0;
+}
+
+static ssize_t read_file(struct btsnoop *btsnoop, void *buf, size_t len)
+{
+	size_t avail;
+
+	if (!btsnoop->map)
+		return read(btsnoop->fd, buf, len);
+
+	avail = btsnoop->map_size - btsnoop->map_offset;
+	if (len > avail)
+		len = avail;
+
+	memcpy(buf, btsnoop->map + btsnoop->map_offset, len);
+	btsnoop->map_offset += len;
+
+	return len;
+}
+
+static int open_index(const char *path)
+{
+	struct btsnoop_idx_hdr hdr;
+	char *idx_path;
+	int fd;
+
+	if (asprintf(&idx_path, "%s.idx", path) < 0)
+		return -1;
+
+	fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+	free(idx_path);
+
+	if (fd < 0)
+		return -1;
+
+	if (read(fd, &hdr, BTSNOOP_IDX_HDR_SIZE) != BTSNOOP_IDX_HDR_SIZE)
+		goto failed;
+
+	if (memcmp(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id)))
+		goto failed;
+
+	if (be32toh(hdr.version) != btsnoop_version)
+		goto failed;
+
+	return fd;
+
+failed:
+	close(fd);
+
+	return -1;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -91,8 +208,11 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 	}
 
 	btsnoop->flags = flags;
+	btsnoop->idx_fd = -1;
+
+	map_file(btsnoop);
 
-	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+	len = read_file(btsnoop, &hdr, BTSNOOP_HDR_SIZE);
 	if (len < 0 || len != BTSNOOP_HDR_SIZE)
 		goto failed;
 
@@ -103,6 +223,8 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 		btsnoop->type = be32toh(hdr.type);
 		btsnoop->index = 0xffff;
+
+		btsnoop->idx_fd = open_index(path);
 	} else {
 		if (!(btsnoop->flags & BTSNOOP_FLAG_PKLG_SUPPORT))
 			goto failed;
@@ -116,50 +238,276 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		btsnoop->pklg_format = true;
 
 		/* Apple Packet Logger format has no header */
-		lseek(btsnoop->fd, 0, SEEK_SET);
+		if (btsnoop->map)
+			btsnoop->map_offset = 0;
+		else
+			lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
 	return btsnoop_ref(btsnoop);
 
 failed:
+	if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
+
 	close(btsnoop->fd);
 	free(btsnoop);
 
 	return NULL;
 }
 
-struct btsnoop *btsnoop_create(const char *path, uint32_t type)
+static int create_file(const char *path, uint32_t type)
 {
-	struct btsnoop *btsnoop;
 	struct btsnoop_hdr hdr;
 	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return -1;
+
+	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(type);
+
+	written = write(fd, &hdr, BTSNOOP_HDR_SIZE);
+	if (written < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int create_index_file(const char *path)
+{
+	struct btsnoop_idx_hdr hdr;
+	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return -1;
+
+	memcpy(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id));
+	hdr.version = htobe32(btsnoop_version);
+	hdr.interval = htobe32(BTSNOOP_INDEX_INTERVAL);
+
+	written = write(fd, &hdr, BTSNOOP_IDX_HDR_SIZE);
+	if (written < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct btsnoop *btsnoop_create(const char *path, uint32_t type)
+{
+	struct btsnoop *btsnoop;
 
 	btsnoop = calloc(1, sizeof(*btsnoop));
 	if (!btsnoop)
 		return NULL;
 
-	btsnoop->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
-					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	btsnoop->path = strdup(path);
+	if (!btsnoop->path) {
+		free(btsnoop);
+		return NULL;
+	}
+
+	btsnoop->fd = create_file(path, type);
 	if (btsnoop->fd < 0) {
+		free(btsnoop->path);
 		free(btsnoop);
 		return NULL;
 	}
 
 	btsnoop->type = type;
 	btsnoop->index = 0xffff;
+	btsnoop->idx_fd = -1;
+	btsnoop->offset = BTSNOOP_HDR_SIZE;
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->type);
+	return btsnoop_ref(btsnoop);
+}
 
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
-		close(btsnoop->fd);
-		free(btsnoop);
+bool btsnoop_create_index(struct btsnoop *btsnoop, const char *path)
+{
+	if (!btsnoop || !btsnoop->path || btsnoop->idx_fd >= 0)
+		return false;
+
+	btsnoop->idx_path = strdup(path);
+	if (!btsnoop->idx_path)
+		return false;
+
+	btsnoop->idx_fd = create_index_file(path);
+	if (btsnoop->idx_fd < 0) {
+		free(btsnoop->idx_path);
+		btsnoop->idx_path = NULL;
+		return false;
+	}
+
+	btsnoop->count = 0;
+
+	return true;
+}
+
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, uint32_t size,
+						unsigned int interval)
+{
+	uint8_t *buf;
+
+	if (!btsnoop || !btsnoop->path || !size)
+		return false;
+
+	if (!btsnoop_flush(btsnoop))
+		return false;
+
+	buf = realloc(btsnoop->buf, size);
+	if (!buf)
+		return false;
+
+	btsnoop->buf = buf;
+	btsnoop->buf_size = size;
+	btsnoop->flush_interval = interval * 1000ll;
+
+	return true;
+}
+
+bool btsnoop_set_rotation(struct btsnoop *btsnoop, uint64_t max_size,
+				unsigned int max_age, unsigned int max_files)
+{
+	if (!btsnoop || !btsnoop->path || !max_files)
+		return false;
+
+	btsnoop->max_size = max_size;
+	btsnoop->max_age = max_age * 1000000ll;
+	btsnoop->max_files = max_files;
+
+	return true;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t written;
+
+		written = write(fd, data, len);
+		if (written < 0)
+			return false;
+
+		data += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	bool result;
+
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	if (!btsnoop->buf_len)
+		return true;
+
+	result = write_all(btsnoop->fd, btsnoop->buf, btsnoop->buf_len);
+	btsnoop->buf_len = 0;
+
+	return result;
+}
+
+static bool write_data(struct btsnoop *btsnoop, const void *data, size_t len)
+{
+	if (!btsnoop->buf)
+		return write_all(btsnoop->fd, data, len);
+
+	if (btsnoop->buf_len + len > btsnoop->buf_size &&
+						!btsnoop_flush(btsnoop))
+		return false;
+
+	if (len > btsnoop->buf_size)
+		return write_all(btsnoop->fd, data, len);
+
+	memcpy(btsnoop->buf + btsnoop->buf_len, data, len);
+	btsnoop->buf_len += len;
+
+	return true;
+}
+
+static char *rotated_name(const char *path, unsigned int num,
+							const char *suffix)
+{
+	char *name;
+	int err;
+
+	if (num)
+		err = asprintf(&name, "%s.%u%s", path, num, suffix);
+	else
+		err = asprintf(&name, "%s%s", path, suffix);
+
+	if (err < 0)
 		return NULL;
+
+	return name;
+}
+
+static void rotate_names(const char *path, const char *suffix,
+						unsigned int max_files)
+{
+	unsigned int i;
+
+	for (i = max_files - 1; i > 0; i--) {
+		char *from, *to;
+
+		from = rotated_name(path, i - 1, suffix);
+		to = rotated_name(path, i, suffix);
+
+		if (from && to)
+			rename(from, to);
+
+		free(from);
+		free(to);
 	}
+}
 
-	return btsnoop_ref(btsnoop);
+/*
+ * The current file becomes <path>.1, older files move up by one and
+ * the one beyond max_files is overwritten. An index <path>.idx follows
+ * its trace as <path>.1.idx and so on.
+ */
+static bool rotate_file(struct btsnoop *btsnoop)
+{
+	size_t len = strlen(btsnoop->path);
+
+	btsnoop_flush(btsnoop);
+
+	close(btsnoop->fd);
+	rotate_names(btsnoop->path, "", btsnoop->max_files);
+
+	btsnoop->fd = create_file(btsnoop->path, btsnoop->type);
+	if (btsnoop->fd < 0)
+		return false;
+
+	btsnoop->offset = BTSNOOP_HDR_SIZE;
+
+	if (btsnoop->idx_fd < 0)
+		return true;
+
+	close(btsnoop->idx_fd);
+
+	if (!strncmp(btsnoop->idx_path, btsnoop->path, len))
+		rotate_names(btsnoop->path, btsnoop->idx_path + len,
+							btsnoop->max_files);
+
+	btsnoop->idx_fd = create_index_file(btsnoop->idx_path);
+	btsnoop->count = 0;
+
+	return true;
 }
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop)
@@ -180,9 +528,20 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
+
+	btsnoop_flush(btsnoop);
+
+	if (btsnoop->idx_fd >= 0)
+		close(btsnoop->idx_fd);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
+	free(btsnoop->buf);
+	free(btsnoop->idx_path);
+	free(btsnoop->path);
 	free(btsnoop);
 }
 
@@ -199,27 +558,64 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 {
 	struct btsnoop_pkt pkt;
 	uint64_t ts;
-	ssize_t written;
 
-	if (!btsnoop || !tv)
+	if (!btsnoop || !tv || btsnoop->fd < 0)
 		return false;
 
 	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
 
+	if (!btsnoop->file_start)
+		btsnoop->file_start = ts;
+
+	if (btsnoop->max_files && btsnoop->offset > BTSNOOP_HDR_SIZE &&
+		((btsnoop->max_size && btsnoop->offset + BTSNOOP_PKT_SIZE +
+					size > btsnoop->max_size) ||
+		(btsnoop->max_age &&
+			ts - btsnoop->file_start >= btsnoop->max_age))) {
+		if (!rotate_file(btsnoop))
+			return false;
+
+		btsnoop->file_start = ts;
+	}
+
 	pkt.size  = htobe32(size);
 	pkt.len   = htobe32(size);
 	pkt.flags = htobe32(flags);
 	pkt.drops = htobe32(0);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
+	if (btsnoop->idx_fd >= 0 &&
+			btsnoop->count++ % BTSNOOP_INDEX_INTERVAL == 0) {
+		struct btsnoop_idx_entry entry;
+		ssize_t written;
+
+		entry.ts = pkt.ts;
+		entry.offset = htobe64(btsnoop->offset);
+
+		written = write(btsnoop->idx_fd, &entry,
+						BTSNOOP_IDX_ENTRY_SIZE);
+		if (written < 0) {
+			close(btsnoop->idx_fd);
+			btsnoop->idx_fd = -1;
+		}
+	}
+
+	if (!write_data(btsnoop, &pkt, BTSNOOP_PKT_SIZE))
 		return false;
 
+	btsnoop->offset += BTSNOOP_PKT_SIZE;
+
 	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
+		if (!write_data(btsnoop, data, size))
 			return false;
+
+		btsnoop->offset += size;
+	}
+
+	if (btsnoop->buf && ts - btsnoop->last_flush >=
+						btsnoop->flush_interval) {
+		btsnoop->last_flush = ts;
+		return btsnoop_flush(btsnoop);
 	}
 
 	return true;
@@ -325,7 +721,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	uint64_t ts;
 	ssize_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
+	len = read_file(btsnoop, &pkt, PKLG_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -335,6 +731,10 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	}
 
 	toread = be32toh(pkt.len) - 9;
+	if (toread > BTSNOOP_MAX_PACKET_SIZE) {
+		btsnoop->aborted = true;
+		return false;
+	}
 
 	ts = be64toh(pkt.ts);
 	tv->tv_sec = ts >> 32;
@@ -343,7 +743,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	*index = 0;
 	*opcode = get_opcode_from_pklg(pkt.type);
 
-	len = read(btsnoop->fd, data, toread);
+	len = read_file(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -405,7 +805,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = read_file(btsnoop, &pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -433,8 +833,8 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_TYPE_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
-		if (len < 0) {
+		len = read_file(btsnoop, &pkt_type, 1);
+		if (len < 0 || toread < 1) {
 			btsnoop->aborted = true;
 			return false;
 		}
@@ -454,7 +854,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = read_file(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -465,6 +865,73 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
+static bool read_index_entry(struct btsnoop *btsnoop, uint64_t pos,
+					uint64_t *ts, uint64_t *offset)
+{
+	struct btsnoop_idx_entry entry;
+	off_t where;
+
+	where = BTSNOOP_IDX_HDR_SIZE + pos * BTSNOOP_IDX_ENTRY_SIZE;
+
+	if (pread(btsnoop->idx_fd, &entry, BTSNOOP_IDX_ENTRY_SIZE, where) !=
+						BTSNOOP_IDX_ENTRY_SIZE)
+		return false;
+
+	*ts = be64toh(entry.ts);
+	*offset = be64toh(entry.offset);
+
+	return true;
+}
+
+bool btsnoop_seek(struct btsnoop *btsnoop, const struct timeval *tv)
+{
+	struct stat st;
+	uint64_t target, ts, offset, lo, hi, found = 0;
+
+	if (!btsnoop || !tv || btsnoop->idx_fd < 0 || btsnoop->aborted)
+		return false;
+
+	if (fstat(btsnoop->idx_fd, &st) < 0 ||
+				st.st_size <= (off_t) BTSNOOP_IDX_HDR_SIZE)
+		return false;
+
+	target = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+	target += 0x00E03AB44A676000ll;
+
+	/* Find the last entry not later than the requested time */
+	lo = 0;
+	hi = (st.st_size - BTSNOOP_IDX_HDR_SIZE) / BTSNOOP_IDX_ENTRY_SIZE;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (!read_index_entry(btsnoop, mid, &ts, &offset))
+			return false;
+
+		if (ts <= target) {
+			found = offset;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	if (btsnoop->map) {
+		if (found > btsnoop->map_size)
+			return false;
+
+		btsnoop->map_offset = found;
+	} else if (lseek(btsnoop->fd, found, SEEK_SET) < 0) {
+		btsnoop->aborted = true;
+		return false;
+	}
+
+	return true;
+}
+
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size)
 {
@@ -57,6 +57,12 @@ struct btsnoop;
 
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags);
 struct btsnoop *btsnoop_create(const char *path, uint32_t type);
+bool btsnoop_create_index(struct btsnoop *btsnoop, const char *path);
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, uint32_t size,
+						unsigned int interval);
+bool btsnoop_set_rotation(struct btsnoop *btsnoop, uint64_t max_size,
+				unsigned int max_age, unsigned int max_files);
+bool btsnoop_flush(struct btsnoop *btsnoop);
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop);
 void btsnoop_unref(struct btsnoop *btsnoop);
@@ -74,5 +80,6 @@ bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
 					void *data, uint16_t *size);
+bool btsnoop_seek(struct btsnoop *btsnoop, const struct timeval *tv);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
@@ -66,11 +66,34 @@ struct af_alg_iv {
 #define SOL_ALG		279
 #endif
 
+/*
+ * The key of an AF_ALG transform lives in the bound socket and is shared
+ * by every operation socket accepted from it, so each cached key needs a
+ * transform socket of its own.
+ */
+#define ALG_CACHE_SIZE		8
+
+/* Blocks handed to the kernel per sendmsg() by the batch functions */
+#define ALG_BATCH_BLOCKS	64
+
+struct alg_key {
+	int alg_fd;		/* Bound transform socket, -1 if none */
+	int op_fd;		/* Keyed operation socket, -1 if none */
+	uint8_t key[16];
+	unsigned int last_used;
+};
+
+struct alg_cache {
+	int (*setup)(void);
+	unsigned int clock;
+	struct alg_key keys[ALG_CACHE_SIZE];
+};
+
 struct bt_crypto {
 	int ref_count;
-	int ecb_aes;
 	int urandom;
-	int cmac_aes;
+	struct alg_cache ecb_aes;
+	struct alg_cache cmac_aes;
 };
 
 static int urandom_setup(void)
@@ -128,6 +151,37 @@ static int cmac_aes_setup(void)
 	return fd;
 }
 
+static bool alg_cache_init(struct alg_cache *cache, int (*setup)(void))
+{
+	int i;
+
+	cache->setup = setup;
+	cache->clock = 0;
+
+	for (i = 0; i < ALG_CACHE_SIZE; i++) {
+		cache->keys[i].alg_fd = -1;
+		cache->keys[i].op_fd = -1;
+	}
+
+	/* The first transform doubles as a check for kernel support */
+	cache->keys[0].alg_fd = setup();
+
+	return cache->keys[0].alg_fd >= 0;
+}
+
+static void alg_cache_clear(struct alg_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < ALG_CACHE_SIZE; i++) {
+		if (cache->keys[i].op_fd >= 0)
+			close(cache->keys[i].op_fd);
+
+		if (cache->keys[i].alg_fd >= 0)
+			close(cache->keys[i].alg_fd);
+	}
+}
+
 struct bt_crypto *bt_crypto_new(void)
 {
 	struct bt_crypto *crypto;
@@ -136,23 +190,22 @@ struct bt_crypto *bt_crypto_new(void)
 	if (!crypto)
 		return NULL;
 
-	crypto->ecb_aes = ecb_aes_setup();
-	if (crypto->ecb_aes < 0) {
+	if (!alg_cache_init(&crypto->ecb_aes, ecb_aes_setup)) {
 		free(crypto);
 		return NULL;
 	}
 
 	crypto->urandom = urandom_setup();
 	if (crypto->urandom < 0) {
-		close(crypto->ecb_aes);
+		alg_cache_clear(&crypto->ecb_aes);
 		free(crypto);
 		return NULL;
 	}
 
-	crypto->cmac_aes = cmac_aes_setup();
-	if (crypto->cmac_aes < 0) {
+	if (!alg_cache_init(&crypto->cmac_aes, cmac_aes_setup)) {
+		alg_cache_clear(&crypto->cmac_aes);
 		close(crypto->urandom);
-		close(crypto->ecb_aes);
+		alg_cache_clear(&crypto->ecb_aes);
 		free(crypto);
 		return NULL;
 	}
@@ -179,8 +232,8 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
+	alg_cache_clear(&crypto->ecb_aes);
+	alg_cache_clear(&crypto->cmac_aes);
 
 	free(crypto);
 }
@@ -205,8 +258,7 @@ static int alg_new(int fd, const void *keyval, socklen_t keylen)
 	if (setsockopt(fd, SOL_ALG, ALG_SET_KEY, keyval, keylen) < 0)
 		return -1;
 
-	/* FIXME: This should use accept4() with SOCK_CLOEXEC */
-	return accept(fd, NULL, 0);
+	return accept4(fd, NULL, 0, SOCK_CLOEXEC);
 }
 
 static bool alg_encrypt(int fd, const void *inbuf, size_t inlen,
@@ -238,12 +290,17 @@ static bool alg_encrypt(int fd, const void *inbuf, size_t inlen,
 	msg.msg_iovlen = 1;
 
 	len = sendmsg(fd, &msg, 0);
-	if (len < 0)
+	if (len < (ssize_t) inlen)
 		return false;
 
-	len = read(fd, outbuf, outlen);
-	if (len < 0)
-		return false;
+	while (outlen > 0) {
+		len = read(fd, outbuf, outlen);
+		if (len <= 0)
+			return false;
+
+		outbuf += len;
+		outlen -= len;
+	}
 
 	return true;
 }
@@ -256,6 +313,66 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+/*
+ * Keyed operation sockets are kept around since signing, address
+ * resolution and pairing keep using the same few keys over and over. An
+ * operation socket can be reused once its result has been read, so only
+ * a cache miss costs the setsockopt() and accept() round trip.
+ */
+static int alg_cache_get(struct alg_cache *cache, const uint8_t key[16])
+{
+	struct alg_key *entry, *lru = NULL;
+	int i;
+
+	for (i = 0; i < ALG_CACHE_SIZE; i++) {
+		entry = &cache->keys[i];
+
+		if (entry->op_fd >= 0 && !memcmp(entry->key, key, 16)) {
+			entry->last_used = ++cache->clock;
+			return entry->op_fd;
+		}
+
+		/* Prefer unused entries, then the least recently used one */
+		if (!lru || (lru->op_fd >= 0 && (entry->op_fd < 0 ||
+					entry->last_used < lru->last_used)))
+			lru = entry;
+	}
+
+	if (lru->op_fd >= 0) {
+		close(lru->op_fd);
+		lru->op_fd = -1;
+	}
+
+	if (lru->alg_fd < 0) {
+		lru->alg_fd = cache->setup();
+		if (lru->alg_fd < 0)
+			return -1;
+	}
+
+	lru->op_fd = alg_new(lru->alg_fd, key, 16);
+	if (lru->op_fd < 0)
+		return -1;
+
+	memcpy(lru->key, key, 16);
+	lru->last_used = ++cache->clock;
+
+	return lru->op_fd;
+}
+
+static void alg_cache_reset(struct alg_cache *cache, int fd)
+{
+	int i;
+
+	for (i = 0; i < ALG_CACHE_SIZE; i++) {
+		if (cache->keys[i].op_fd != fd)
+			continue;
+
+		close(fd);
+		cache->keys[i].op_fd = -1;
+		break;
+	}
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12])
@@ -279,7 +396,7 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
+	fd = alg_cache_get(&crypto->cmac_aes, tmp);
 	if (fd < 0)
 		return false;
 
@@ -288,18 +405,16 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 
 	len = send(fd, msg_s, msg_len, 0);
 	if (len < 0) {
-		close(fd);
+		alg_cache_reset(&crypto->cmac_aes, fd);
 		return false;
 	}
 
 	len = read(fd, out, 16);
 	if (len < 0) {
-		close(fd);
+		alg_cache_reset(&crypto->cmac_aes, fd);
 		return false;
 	}
 
-	close(fd);
-
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
 	 * be placed in the signature
@@ -316,6 +431,39 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 
 	return true;
 }
+/*
+ * Database hash as defined in Core 5.1 Vol 3 Part G 7.3: AES-CMAC with a
+ * zero key over the given message.
+ */
+bool bt_crypto_gatt_hash(struct bt_crypto *crypto, const uint8_t *m,
+					size_t m_len, uint8_t hash[16])
+{
+	static const uint8_t key[16];
+	ssize_t len;
+	int fd;
+
+	if (!crypto)
+		return false;
+
+	fd = alg_cache_get(&crypto->cmac_aes, key);
+	if (fd < 0)
+		return false;
+
+	len = send(fd, m, m_len, 0);
+	if (len < 0) {
+		alg_cache_reset(&crypto->cmac_aes, fd);
+		return false;
+	}
+
+	len = read(fd, hash, 16);
+	if (len < 0) {
+		alg_cache_reset(&crypto->cmac_aes, fd);
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Security function e
  *
@@ -341,23 +489,65 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
+	fd = alg_cache_get(&crypto->ecb_aes, tmp);
 	if (fd < 0)
 		return false;
 
-
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
 	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
+		alg_cache_reset(&crypto->ecb_aes, fd);
 		return false;
 	}
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
+	return true;
+}
+
+/*
+ * Security function e over many blocks with the same key. ECB handles
+ * every block on its own, so a whole batch goes through one sendmsg().
+ * The plaintext and encrypted arrays may be the same.
+ */
+bool bt_crypto_e_batch(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t (*plaintext)[16],
+				uint8_t (*encrypted)[16], size_t num)
+{
+	uint8_t tmp[16], buf[ALG_BATCH_BLOCKS][16];
+	size_t i, count;
+	int fd;
+
+	if (!crypto)
+		return false;
+
+	/* The most significant octet of key corresponds to key[0] */
+	swap_buf(key, tmp, 16);
+
+	fd = alg_cache_get(&crypto->ecb_aes, tmp);
+	if (fd < 0)
+		return false;
+
+	while (num > 0) {
+		count = num < ALG_BATCH_BLOCKS ? num : ALG_BATCH_BLOCKS;
+
+		for (i = 0; i < count; i++)
+			swap_buf(plaintext[i], buf[i], 16);
+
+		if (!alg_encrypt(fd, buf, count * 16, buf, count * 16)) {
+			alg_cache_reset(&crypto->ecb_aes, fd);
+			return false;
+		}
+
+		for (i = 0; i < count; i++)
+			swap_buf(buf[i], encrypted[i], 16);
+
+		plaintext += count;
+		encrypted += count;
+		num -= count;
+	}
 
 	return true;
 }
@@ -417,6 +607,49 @@ bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 	return true;
 }
 
+/*
+ * Random address hash function ah for many values of r with the same k,
+ * as used when checking a batch of resolvable private addresses against
+ * one IRK.
+ */
+bool bt_crypto_ah_batch(struct bt_crypto *crypto, const uint8_t k[16],
+				const uint8_t (*r)[3], uint8_t (*hash)[3],
+				size_t num)
+{
+	uint8_t rp[ALG_BATCH_BLOCKS][16];
+	size_t i, count;
+
+	if (!crypto)
+		return false;
+
+	memset(rp, 0, sizeof(rp));
+
+	while (num > 0) {
+		count = num < ALG_BATCH_BLOCKS ? num : ALG_BATCH_BLOCKS;
+
+		/* r' = padding || r */
+		for (i = 0; i < count; i++)
+			memcpy(rp[i], r[i], 3);
+
+		/* e(k, r') */
+		if (!bt_crypto_e_batch(crypto, k, (const uint8_t (*)[16]) rp,
+								rp, count))
+			return false;
+
+		/* ah(k, r) = e(k, r') mod 2^24 */
+		for (i = 0; i < count; i++) {
+			memcpy(hash[i], rp[i], 3);
+			memset(rp[i] + 3, 0, 13);
+		}
+
+		r += count;
+		hash += count;
+		num -= count;
+	}
+
+	return true;
+}
+
 typedef struct {
 	uint64_t a, b;
 } u128;
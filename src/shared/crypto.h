@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 struct bt_crypto;
 
@@ -36,8 +37,14 @@ bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 
 bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16]);
+bool bt_crypto_e_batch(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t (*plaintext)[16],
+				uint8_t (*encrypted)[16], size_t num);
 bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 					const uint8_t r[3], uint8_t hash[3]);
+bool bt_crypto_ah_batch(struct bt_crypto *crypto, const uint8_t k[16],
+				const uint8_t (*r)[3], uint8_t (*hash)[3],
+				size_t num);
 bool bt_crypto_c1(struct bt_crypto *crypto, const uint8_t k[16],
 			const uint8_t r[16], const uint8_t pres[7],
 			const uint8_t preq[7], uint8_t iat,
@@ -49,3 +56,5 @@ bool bt_crypto_s1(struct bt_crypto *crypto, const uint8_t k[16],
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12]);
+bool bt_crypto_gatt_hash(struct bt_crypto *crypto, const uint8_t *m,
+					size_t m_len, uint8_t hash[16]);
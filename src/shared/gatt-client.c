@@ -27,7 +27,14 @@
 #include "src/shared/gatt-helpers.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
-
+#include "src/shared/idmap.h"
+#include "src/shared/timeout.h"
+#include "src/shared/crypto.h"
+#include "src/shared/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <assert.h>
 #include <limits.h>
 
@@ -44,6 +51,11 @@
 #define GATT_SVC_UUID	0x1801
 #define SVC_CHNGD_UUID	0x2a05
 
+#define CACHE_HEADER	"# BlueZ GATT attribute cache v1"
+
+/* Delay in ms during which coalesced reads are collected */
+#define READ_BATCH_TIMEOUT	1
+
 struct chrc_data {
 	/* The public characteristic entry. */
 	bt_gatt_characteristic_t chrc_external;
@@ -63,13 +75,41 @@ struct chrc_data {
 	 */
 	struct queue *reg_notify_queue;
 	unsigned int ccc_write_id;
+	struct notify_data *ccc_write_data;
+
+	/* Registered handlers for this value handle, used to dispatch incoming
+	 * notifications without walking every registration. The entries are
+	 * owned by the client's notify_list.
+	 */
+	struct queue *notify_list;
+
+	/* Set once the server returned a value of unexpected length, reads
+	 * of this characteristic are then never coalesced again.
+	 */
+	bool no_coalesce;
+
+	/* False while the descriptors have not been discovered yet, which
+	 * only happens in lazy mode. Callers waiting for the discovery to
+	 * complete are queued in "desc_waiters".
+	 */
+	bool descs_known;
+	bool descs_pending;
+	struct queue *desc_waiters;
 };
 
-struct service_list {
+struct service_data {
 	bt_gatt_service_t service;
-	struct chrc_data *chrcs;
+	struct chrc_data *chrcs;	/* Sorted by handle */
 	size_t num_chrcs;
-	struct service_list *next;
+};
+
+/* Services are kept in a contiguous array sorted by handle, so that they can
+ * be looked up with a binary search.
+ */
+struct service_array {
+	struct service_data *svcs;
+	size_t len;
+	size_t alloc;
 };
 
 struct bt_gatt_client {
@@ -84,7 +124,14 @@ struct bt_gatt_client {
 	bt_gatt_client_destroy_func_t debug_destroy;
 	void *debug_data;
 
-	struct service_list *svc_head, *svc_tail;
+	/* Link usage reported to the connection parameter policy */
+	bt_gatt_client_link_callback_t link_callback;
+	bt_gatt_client_destroy_func_t link_destroy;
+	void *link_data;
+	uint8_t link_state;
+	unsigned int bulk_ops;
+
+	struct service_array svcs;
 	bool in_init;
 	bool ready;
 
@@ -96,9 +143,10 @@ struct bt_gatt_client {
 	 */
 	struct queue *long_write_queue;
 	bool in_long_write;
+	unsigned int prep_window;	/* Prepare Writes in flight or 0 */
 
-	/* List of registered notification/indication callbacks */
-	struct queue *notify_list;
+	/* Registered notification/indication callbacks by id */
+	struct idmap *notify_list;
 	int next_reg_id;
 	unsigned int notify_id, ind_id;
 	bool in_notify;
@@ -113,6 +161,23 @@ struct bt_gatt_client {
 	unsigned int svc_chngd_ind_id;
 	struct queue *svc_chngd_queue;  /* Queued service changed events */
 	bool in_svc_chngd;
+
+	/* Path of the persistent attribute cache, or NULL if not used */
+	char *cache_path;
+
+	/* Discover descriptors only when a characteristic is first used */
+	bool lazy_descs;
+
+	/* Reads waiting to be merged into a Read Multiple request */
+	bool coalesce_reads;
+	struct queue *read_batch;
+	unsigned int read_batch_id;
+
+	/* Local CSRK and sign counter for Signed Write Commands */
+	struct bt_crypto *crypto;
+	uint8_t csrk[16];
+	bool csrk_set;
+	uint32_t sign_cnt;
 };
 
 struct notify_data {
@@ -148,14 +213,6 @@ static void notify_data_unref(void *data)
 	free(notify_data);
 }
 
-static bool match_notify_data_id(const void *a, const void *b)
-{
-	const struct notify_data *notify_data = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify_data->id == id;
-}
-
 static bool match_notify_data_removed(const void *a, const void *b)
 {
 	const struct notify_data *notify_data = a;
@@ -196,32 +253,63 @@ static void mark_notify_data_invalid_if_in_range(void *data, void *user_data)
 		notify_data->invalid = true;
 }
 
-static bool service_list_add_service(struct service_list **head,
-						struct service_list **tail,
+static bool service_array_grow(struct service_array *array, size_t len)
+{
+	struct service_data *svcs;
+	size_t alloc;
+
+	if (array->len + len <= array->alloc)
+		return true;
+
+	alloc = MAX(array->alloc * 2, array->len + len);
+	alloc = MAX(alloc, 8);
+
+	svcs = realloc(array->svcs, alloc * sizeof(*svcs));
+	if (!svcs)
+		return false;
+
+	array->svcs = svcs;
+	array->alloc = alloc;
+
+	return true;
+}
+
+static bool service_array_add(struct service_array *array,
 						uint16_t start, uint16_t end,
 						uint8_t uuid[BT_GATT_UUID_SIZE])
 {
-	struct service_list *list;
+	struct service_data *svc;
 
-	list = new0(struct service_list, 1);
-	if (!list)
+	if (!service_array_grow(array, 1))
 		return false;
 
-	list->service.start_handle = start;
-	list->service.end_handle = end;
-	memcpy(list->service.uuid, uuid, UUID_BYTES);
+	svc = &array->svcs[array->len++];
+	memset(svc, 0, sizeof(*svc));
 
-	if (!(*head))
-		*head = *tail = list;
-	else {
-		(*tail)->next = list;
-		*tail = list;
-	}
+	svc->service.start_handle = start;
+	svc->service.end_handle = end;
+	memcpy(svc->service.uuid, uuid, UUID_BYTES);
 
 	return true;
 }
 
-static void service_destroy_characteristics(struct service_list *service)
+struct desc_waiter {
+	bt_gatt_client_callback_t callback;
+	void *user_data;
+	bt_gatt_client_destroy_func_t destroy;
+};
+
+static void desc_waiter_free(void *data)
+{
+	struct desc_waiter *waiter = data;
+
+	if (waiter->destroy)
+		waiter->destroy(waiter->user_data);
+
+	free(waiter);
+}
+
+static void service_destroy_characteristics(struct service_data *service)
 {
 	unsigned int i;
 
@@ -229,101 +317,156 @@ static void service_destroy_characteristics(struct service_list *service)
 		free(service->chrcs[i].descs);
 		queue_destroy(service->chrcs[i].reg_notify_queue,
 							notify_data_unref);
+		queue_destroy(service->chrcs[i].desc_waiters,
+							desc_waiter_free);
+		queue_destroy(service->chrcs[i].notify_list, NULL);
 	}
 
 	free(service->chrcs);
 }
 
-static void service_list_clear(struct service_list **head,
-						struct service_list **tail)
+static void service_array_clear(struct service_array *array)
 {
-	struct service_list *l, *tmp;
+	size_t i;
 
-	if (!(*head) || !(*tail))
-		return;
+	for (i = 0; i < array->len; i++)
+		service_destroy_characteristics(&array->svcs[i]);
+
+	free(array->svcs);
+	memset(array, 0, sizeof(*array));
+}
+
+/* Returns the index of the first service that ends at or after "handle" */
+static size_t service_array_lower_bound(struct service_array *array,
+							uint16_t handle)
+{
+	size_t lo = 0, hi = array->len, mid;
 
-	l = *head;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
 
-	while (l) {
-		service_destroy_characteristics(l);
-		tmp = l;
-		l = tmp->next;
-		free(tmp);
+		if (array->svcs[mid].service.end_handle < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	*head = *tail = NULL;
+	return lo;
 }
 
-static void service_list_clear_range(struct service_list **head,
-						struct service_list **tail,
-						uint16_t start, uint16_t end)
+static struct service_data *service_array_find(struct service_array *array,
+							uint16_t handle)
 {
-	struct service_list *cur, *prev, *tmp;
+	size_t i;
 
-	if (!(*head) || !(*tail))
-		return;
+	i = service_array_lower_bound(array, handle);
+	if (i == array->len || array->svcs[i].service.start_handle > handle)
+		return NULL;
 
-	prev = NULL;
-	cur = *head;
-	while (cur) {
-		if (cur->service.end_handle < start ||
-					cur->service.start_handle > end) {
-			prev = cur;
-			cur = cur->next;
-			continue;
-		}
+	return &array->svcs[i];
+}
 
-		service_destroy_characteristics(cur);
+static void service_array_clear_range(struct service_array *array,
+						uint16_t start, uint16_t end)
+{
+	size_t first, last;
 
-		if (!prev)
-			*head = cur->next;
-		else
-			prev->next = cur->next;
+	first = service_array_lower_bound(array, start);
 
-		if (*tail == cur)
-			*tail = prev;
+	for (last = first; last < array->len; last++) {
+		if (array->svcs[last].service.start_handle > end)
+			break;
 
-		tmp = cur;
-		cur = cur->next;
-		free(tmp);
+		service_destroy_characteristics(&array->svcs[last]);
 	}
+
+	memmove(array->svcs + first, array->svcs + last,
+				(array->len - last) * sizeof(*array->svcs));
+	array->len -= last - first;
 }
 
-static void service_list_insert_services(struct service_list **head,
-						struct service_list **tail,
-						struct service_list *svc_head,
-						struct service_list *svc_tail)
+/* Moves the services in "src", which must not overlap any service in "array",
+ * into their sorted position in "array" as a contiguous chunk.
+ */
+static bool service_array_insert(struct service_array *array,
+						struct service_array *src)
 {
-	struct service_list *cur, *prev;
+	size_t pos;
 
-	if (!(*head) || !(*tail)) {
-		*head = svc_head;
-		*tail = svc_tail;
-		return;
+	if (!src->len)
+		return true;
+
+	if (!service_array_grow(array, src->len))
+		return false;
+
+	pos = service_array_lower_bound(array,
+					src->svcs[0].service.start_handle);
+
+	memmove(array->svcs + pos + src->len, array->svcs + pos,
+				(array->len - pos) * sizeof(*array->svcs));
+	memcpy(array->svcs + pos, src->svcs, src->len * sizeof(*src->svcs));
+	array->len += src->len;
+
+	free(src->svcs);
+	memset(src, 0, sizeof(*src));
+
+	return true;
+}
+
+static struct chrc_data *service_find_chrc(struct service_data *svc,
+							uint16_t value_handle)
+{
+	size_t lo = 0, hi = svc->num_chrcs, mid;
+	uint16_t handle;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		handle = svc->chrcs[mid].chrc_external.value_handle;
+
+		if (handle == value_handle)
+			return &svc->chrcs[mid];
+
+		if (handle < value_handle)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	prev = NULL;
-	cur = *head;
-	while (cur) {
-		if (svc_tail->service.end_handle < cur->service.start_handle) {
-			if (!prev)
-				*head = svc_head;
-			else
-				prev->next = svc_head;
+	return NULL;
+}
 
-			svc_tail->next = cur;
-			return;
-		}
+/* Returns the characteristic whose declaration range contains "handle" */
+static struct chrc_data *service_find_chrc_by_handle(struct service_data *svc,
+							uint16_t handle)
+{
+	size_t lo = 0, hi = svc->num_chrcs, mid;
+	bt_gatt_characteristic_t *chrc;
 
-		prev = cur;
-		cur = cur->next;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		chrc = &svc->chrcs[mid].chrc_external;
+
+		if (handle < chrc->start_handle)
+			hi = mid;
+		else if (handle > chrc->end_handle)
+			lo = mid + 1;
+		else
+			return &svc->chrcs[mid];
 	}
 
-	if (prev != *tail)
-		return;
+	return NULL;
+}
+
+static struct chrc_data *gatt_client_find_chrc(struct bt_gatt_client *client,
+							uint16_t value_handle)
+{
+	struct service_data *svc;
 
-	prev->next = svc_head;
-	*tail = svc_tail;
+	svc = service_array_find(&client->svcs, value_handle);
+	if (!svc)
+		return NULL;
+
+	return service_find_chrc(svc, value_handle);
 }
 
 static void gatt_client_remove_all_notify_in_range(
@@ -336,29 +479,212 @@ static void gatt_client_remove_all_notify_in_range(
 	range.end = end_handle;
 
 	if (client->in_notify) {
-		queue_foreach(client->notify_list,
+		idmap_foreach(client->notify_list,
 					mark_notify_data_invalid_if_in_range,
 					&range);
 		client->need_notify_cleanup = true;
 		return;
 	}
 
-	queue_remove_all(client->notify_list, match_notify_data_handle_range,
+	idmap_remove_all(client->notify_list, match_notify_data_handle_range,
 						&range, notify_data_unref);
 }
 
+static bool match_notify_data_chrc(const void *a, const void *b)
+{
+	const struct notify_data *notify_data = a;
+
+	return notify_data->chrc == b;
+}
+
+static void mark_notify_data_invalid_if_chrc(void *data, void *user_data)
+{
+	struct notify_data *notify_data = data;
+
+	if (notify_data->chrc == user_data)
+		notify_data->invalid = true;
+}
+
+/* Drops all registrations of a characteristic that is about to go away */
+static void gatt_client_remove_chrc_notify(struct bt_gatt_client *client,
+						struct chrc_data *chrc)
+{
+	if (chrc->ccc_write_id) {
+		bt_att_cancel(client->att, chrc->ccc_write_id);
+		chrc->ccc_write_id = 0;
+		chrc->ccc_write_data = NULL;
+	}
+
+	if (client->in_notify) {
+		idmap_foreach(client->notify_list,
+					mark_notify_data_invalid_if_chrc, chrc);
+		client->need_notify_cleanup = true;
+		return;
+	}
+
+	idmap_remove_all(client->notify_list, match_notify_data_chrc, chrc,
+							notify_data_unref);
+}
+
+/* Returns true if a rediscovered characteristic matches a cached one */
+static bool chrc_unchanged(struct chrc_data *old, struct chrc_data *new)
+{
+	bt_gatt_characteristic_t *a = &old->chrc_external;
+	bt_gatt_characteristic_t *b = &new->chrc_external;
+	size_t i;
+
+	if (a->start_handle != b->start_handle ||
+					a->end_handle != b->end_handle ||
+					a->value_handle != b->value_handle ||
+					a->properties != b->properties ||
+					memcmp(a->uuid, b->uuid, UUID_BYTES))
+		return false;
+
+	/* Descriptors not discovered on one side can only be assumed equal */
+	if (!old->descs_known || !new->descs_known)
+		return true;
+
+	if (a->num_descs != b->num_descs)
+		return false;
+
+	for (i = 0; i < a->num_descs; i++) {
+		if (a->descs[i].handle != b->descs[i].handle ||
+				memcmp(a->descs[i].uuid, b->descs[i].uuid,
+								UUID_BYTES))
+			return false;
+	}
+
+	return true;
+}
+
+static void set_notify_data_chrc(void *data, void *user_data)
+{
+	struct notify_data *notify_data = data;
+
+	notify_data->chrc = user_data;
+}
+
+static void swap_queues(struct queue **a, struct queue **b)
+{
+	struct queue *tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+static void complete_desc_discovery(struct chrc_data *chrc, bool success,
+							uint8_t att_ecode);
+
+/* Moves the registrations and learned state of an unchanged characteristic
+ * over to its rediscovered entry, so no CCC needs to be written again.
+ */
+static void chrc_move_state(struct chrc_data *dst, struct chrc_data *src)
+{
+	if (!dst->descs_known && src->descs_known) {
+		free(dst->descs);
+		dst->descs = src->descs;
+		dst->chrc_external.descs = src->descs;
+		dst->chrc_external.num_descs = src->chrc_external.num_descs;
+		dst->ccc_handle = src->ccc_handle;
+		dst->descs_known = true;
+
+		src->descs = NULL;
+		src->chrc_external.num_descs = 0;
+	}
+
+	dst->descs_pending = src->descs_pending;
+	swap_queues(&dst->desc_waiters, &src->desc_waiters);
+	swap_queues(&dst->reg_notify_queue, &src->reg_notify_queue);
+	swap_queues(&dst->notify_list, &src->notify_list);
+
+	dst->notify_count = src->notify_count;
+	dst->ccc_write_id = src->ccc_write_id;
+	dst->ccc_write_data = src->ccc_write_data;
+	dst->no_coalesce = src->no_coalesce;
+
+	queue_foreach(dst->reg_notify_queue, set_notify_data_chrc, dst);
+	queue_foreach(dst->notify_list, set_notify_data_chrc, dst);
+
+	if (dst->ccc_write_data)
+		dst->ccc_write_data->chrc = dst;
+
+	src->notify_count = 0;
+	src->ccc_write_id = 0;
+	src->ccc_write_data = NULL;
+	src->descs_pending = false;
+
+	/* The rediscovery already found what a lazy discovery waits for */
+	if (dst->descs_pending && dst->descs_known)
+		complete_desc_discovery(dst, true, 0);
+}
+
+/* Replaces the services in [start, end] with the rediscovered ones in "src",
+ * keeping the registrations of every characteristic that is unchanged.
+ */
+static bool gatt_client_merge_range(struct bt_gatt_client *client,
+						struct service_array *src,
+						uint16_t start, uint16_t end)
+{
+	struct service_array *array = &client->svcs;
+	struct service_data *old_svc, *new_svc;
+	struct chrc_data *old, *new;
+	uint16_t handle;
+	size_t i, j;
+
+	/* Make sure the final insert can't fail after the range is gone */
+	if (!service_array_grow(array, src->len))
+		return false;
+
+	for (i = service_array_lower_bound(array, start); i < array->len; i++) {
+		old_svc = &array->svcs[i];
+
+		if (old_svc->service.start_handle > end)
+			break;
+
+		handle = old_svc->service.start_handle;
+		new_svc = service_array_find(src, handle);
+		if (new_svc && (new_svc->service.start_handle != handle ||
+					memcmp(new_svc->service.uuid,
+						old_svc->service.uuid,
+						UUID_BYTES)))
+			new_svc = NULL;
+
+		for (j = 0; j < old_svc->num_chrcs; j++) {
+			old = &old_svc->chrcs[j];
+			handle = old->chrc_external.value_handle;
+			new = NULL;
+
+			if (new_svc)
+				new = service_find_chrc(new_svc, handle);
+
+			if (new && chrc_unchanged(old, new))
+				chrc_move_state(new, old);
+			else
+				gatt_client_remove_chrc_notify(client, old);
+		}
+	}
+
+	service_array_clear_range(array, start, end);
+
+	return service_array_insert(array, src);
+}
+
 static void gatt_client_clear_services(struct bt_gatt_client *client)
 {
 
 	gatt_client_remove_all_notify_in_range(client, 0x0001, 0xffff);
-	service_list_clear(&client->svc_head, &client->svc_tail);
+	service_array_clear(&client->svcs);
 }
 
 struct discovery_op {
 	struct bt_gatt_client *client;
-	struct service_list *result_head, *result_tail, *cur_service;
-	struct chrc_data *cur_chrc;
-	int cur_chrc_index;
+	struct service_array result;
+	unsigned int pending;	/* Outstanding descriptor discoveries */
+	bool success;
+	uint8_t att_ecode;
+	bool from_cache;
+	uint16_t start;		/* Range of a Service Changed */
+	uint16_t end;
 	int ref_count;
 	void (*complete_func)(struct discovery_op *op, bool success,
 							uint8_t att_ecode);
@@ -378,6 +704,7 @@ static void discovery_op_unref(void *data)
 	if (__sync_sub_and_fetch(&op->ref_count, 1))
 		return;
 
+	service_array_clear(&op->result);
 	free(data);
 }
 
@@ -391,10 +718,6 @@ static void uuid_to_string(const uint8_t uuid[BT_GATT_UUID_SIZE],
 	bt_uuid_to_string(&tmp, str, MAX_LEN_UUID_STR * sizeof(char));
 }
 
-static void discover_chrcs_cb(bool success, uint8_t att_ecode,
-						struct bt_gatt_result *result,
-						void *user_data);
-
 static int uuid_cmp(const uint8_t uuid128[16], uint16_t uuid16)
 {
 	uint8_t rhs_uuid[16] = {
@@ -407,111 +730,100 @@ static int uuid_cmp(const uint8_t uuid128[16], uint16_t uuid16)
 	return memcmp(uuid128, rhs_uuid, sizeof(rhs_uuid));
 }
 
-static void discover_descs_cb(bool success, uint8_t att_ecode,
-						struct bt_gatt_result *result,
-						void *user_data)
-{
-	struct discovery_op *op = user_data;
-	struct bt_gatt_client *client = op->client;
-	struct bt_gatt_iter iter;
-	char uuid_str[MAX_LEN_UUID_STR];
-	unsigned int desc_count;
-	uint16_t desc_start;
-	unsigned int i;
-	bt_gatt_descriptor_t *descs;
+/*
+ * Characteristics whose value has a fixed length by specification. A Read
+ * Multiple response carries no lengths, so only these can be coalesced
+ * and split again without guessing.
+ */
+static const struct {
+	uint16_t uuid;
+	uint16_t len;
+} fixed_len_chrcs[] = {
+	{ 0x2a01, 2 },	/* Appearance */
+	{ 0x2a04, 8 },	/* Peripheral Preferred Connection Parameters */
+	{ 0x2a06, 1 },	/* Alert Level */
+	{ 0x2a07, 1 },	/* Tx Power Level */
+	{ 0x2a08, 7 },	/* Date Time */
+	{ 0x2a0f, 2 },	/* Local Time Information */
+	{ 0x2a14, 4 },	/* Reference Time Information */
+	{ 0x2a19, 1 },	/* Battery Level */
+	{ 0x2a1d, 1 },	/* Temperature Type */
+	{ 0x2a21, 2 },	/* Measurement Interval */
+	{ 0x2a23, 8 },	/* System ID */
+	{ 0x2a2b, 10 },	/* Current Time */
+	{ 0x2a38, 1 },	/* Body Sensor Location */
+	{ 0x2a4a, 4 },	/* HID Information */
+	{ 0x2a4e, 1 },	/* Protocol Mode */
+	{ 0x2a50, 7 },	/* PnP ID */
+	{ 0x2a5d, 1 },	/* Sensor Location */
+};
 
-	if (!success) {
-		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-			success = true;
-			goto next;
-		}
+#define NUM_FIXED_LEN_CHRCS \
+		(sizeof(fixed_len_chrcs) / sizeof(fixed_len_chrcs[0]))
 
-		goto done;
-	}
+static uint16_t chrc_fixed_len(const struct chrc_data *chrc)
+{
+	size_t i;
 
-	if (!result || !bt_gatt_iter_init(&iter, result)) {
-		success = false;
-		goto done;
-	}
+	if (chrc->no_coalesce)
+		return 0;
 
-	desc_count = bt_gatt_result_descriptor_count(result);
-	if (desc_count == 0) {
-		success = false;
-		goto done;
+	for (i = 0; i < NUM_FIXED_LEN_CHRCS; i++) {
+		if (!uuid_cmp(chrc->chrc_external.uuid,
+						fixed_len_chrcs[i].uuid))
+			return fixed_len_chrcs[i].len;
 	}
 
-	util_debug(client->debug_callback, client->debug_data,
-					"Descriptors found: %u", desc_count);
-
-	descs = new0(bt_gatt_descriptor_t, desc_count);
-	if (!descs) {
-		success = false;
-		goto done;
-	}
+	return 0;
+}
 
-	i = 0;
-	while (bt_gatt_iter_next_descriptor(&iter, &descs[i].handle,
-							descs[i].uuid)) {
-		uuid_to_string(descs[i].uuid, uuid_str);
-		util_debug(client->debug_callback, client->debug_data,
-						"handle: 0x%04x, uuid: %s",
-						descs[i].handle, uuid_str);
+static struct chrc_data *service_add_chrc(struct service_data *svc)
+{
+	struct chrc_data *chrcs, *chrc;
 
-		if (uuid_cmp(descs[i].uuid, GATT_CLIENT_CHARAC_CFG_UUID) == 0)
-			op->cur_chrc->ccc_handle = descs[i].handle;
+	chrcs = realloc(svc->chrcs, (svc->num_chrcs + 1) * sizeof(*chrcs));
+	if (!chrcs)
+		return NULL;
 
-		i++;
-	}
+	svc->chrcs = chrcs;
+	chrc = &chrcs[svc->num_chrcs];
+	memset(chrc, 0, sizeof(*chrc));
 
-	op->cur_chrc->chrc_external.num_descs = desc_count;
-	op->cur_chrc->descs = descs;
-	op->cur_chrc->chrc_external.descs = descs;
+	/* Count the entry right away so that it is freed on failure */
+	svc->num_chrcs++;
 
-	for (i = op->cur_chrc_index + 1; i < op->cur_service->num_chrcs; i++) {
-		op->cur_chrc_index = i;
-		op->cur_chrc++;
-		desc_start = op->cur_chrc->chrc_external.value_handle + 1;
-		if (desc_start > op->cur_chrc->chrc_external.end_handle)
-			continue;
+	chrc->reg_notify_queue = queue_new();
+	chrc->notify_list = queue_new();
+	if (!chrc->reg_notify_queue || !chrc->notify_list)
+		return NULL;
 
-		if (bt_gatt_discover_descriptors(client->att, desc_start,
-					op->cur_chrc->chrc_external.end_handle,
-					discover_descs_cb, discovery_op_ref(op),
-					discovery_op_unref))
-			return;
+	return chrc;
+}
 
-		util_debug(client->debug_callback, client->debug_data,
-					"Failed to start descriptor discovery");
-		discovery_op_unref(op);
-		success = false;
+static bool chrc_add_desc(struct chrc_data *chrc, uint16_t handle,
+					const uint8_t uuid[BT_GATT_UUID_SIZE])
+{
+	bt_gatt_descriptor_t *descs;
+	size_t num = chrc->chrc_external.num_descs;
 
-		goto done;
-	}
+	descs = realloc(chrc->descs, (num + 1) * sizeof(*descs));
+	if (!descs)
+		return false;
 
-next:
-	if (!op->cur_service->next)
-		goto done;
+	descs[num].handle = handle;
+	memcpy(descs[num].uuid, uuid, UUID_BYTES);
 
-	/* Move on to the next service */
-	op->cur_service = op->cur_service->next;
-	if (bt_gatt_discover_characteristics(client->att,
-					op->cur_service->service.start_handle,
-					op->cur_service->service.end_handle,
-					discover_chrcs_cb,
-					discovery_op_ref(op),
-					discovery_op_unref))
-		return;
+	if (uuid_cmp(uuid, GATT_CLIENT_CHARAC_CFG_UUID) == 0)
+		chrc->ccc_handle = handle;
 
-	util_debug(client->debug_callback, client->debug_data,
-				"Failed to start characteristic discovery");
-	discovery_op_unref(op);
-	success = false;
+	chrc->descs = descs;
+	chrc->chrc_external.descs = descs;
+	chrc->chrc_external.num_descs = num + 1;
 
-done:
-	op->complete_func(op, success, att_ecode);
+	return true;
 }
 
-static void discover_chrcs_cb(bool success, uint8_t att_ecode,
+static void discover_descs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data)
 {
@@ -519,110 +831,202 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 	struct bt_gatt_client *client = op->client;
 	struct bt_gatt_iter iter;
 	char uuid_str[MAX_LEN_UUID_STR];
-	unsigned int chrc_count;
-	unsigned int i;
-	uint16_t desc_start;
-	struct chrc_data *chrcs;
+	struct service_data *svc;
+	struct chrc_data *chrc;
+	uint8_t uuid[BT_GATT_UUID_SIZE];
+	uint16_t handle;
 
 	if (!success) {
-		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-			success = true;
+		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
 			goto next;
-		}
 
-		goto done;
+		op->success = false;
+		op->att_ecode = att_ecode;
+		goto next;
 	}
 
 	if (!result || !bt_gatt_iter_init(&iter, result)) {
-		success = false;
-		goto done;
+		op->success = false;
+		goto next;
 	}
 
-	chrc_count = bt_gatt_result_characteristic_count(result);
 	util_debug(client->debug_callback, client->debug_data,
-				"Characteristics found: %u", chrc_count);
+				"Descriptors found: %u",
+				bt_gatt_result_descriptor_count(result));
 
-	if (chrc_count == 0)
-		goto next;
+	while (bt_gatt_iter_next_descriptor(&iter, &handle, uuid)) {
+		svc = service_array_find(&op->result, handle);
+		if (!svc)
+			continue;
 
-	chrcs = new0(struct chrc_data, chrc_count);
-	if (!chrcs) {
-		success = false;
-		goto done;
-	}
+		chrc = service_find_chrc_by_handle(svc, handle);
+
+		/* A merged request also returns the declaration and value of
+		 * every characteristic after the first one; skip those.
+		 */
+		if (!chrc || handle <= chrc->chrc_external.value_handle)
+			continue;
 
-	i = 0;
-	while (bt_gatt_iter_next_characteristic(&iter,
-					&chrcs[i].chrc_external.start_handle,
-					&chrcs[i].chrc_external.end_handle,
-					&chrcs[i].chrc_external.value_handle,
-					&chrcs[i].chrc_external.properties,
-					chrcs[i].chrc_external.uuid)) {
-		uuid_to_string(chrcs[i].chrc_external.uuid, uuid_str);
+		uuid_to_string(uuid, uuid_str);
 		util_debug(client->debug_callback, client->debug_data,
-				"start: 0x%04x, end: 0x%04x, value: 0x%04x, "
-				"props: 0x%02x, uuid: %s",
-				chrcs[i].chrc_external.start_handle,
-				chrcs[i].chrc_external.end_handle,
-				chrcs[i].chrc_external.value_handle,
-				chrcs[i].chrc_external.properties,
-				uuid_str);
-
-		chrcs[i].reg_notify_queue = queue_new();
-		if (!chrcs[i].reg_notify_queue) {
-			success = false;
-			goto done;
+						"handle: 0x%04x, uuid: %s",
+						handle, uuid_str);
+
+		if (!chrc_add_desc(chrc, handle, uuid)) {
+			op->success = false;
+			break;
 		}
+	}
 
-		if (uuid_cmp(chrcs[i].chrc_external.uuid, SVC_CHNGD_UUID) == 0)
-			client->svc_chngd_val_handle =
-					chrcs[i].chrc_external.value_handle;
+next:
+	if (--op->pending)
+		return;
 
-		i++;
-	}
+	op->complete_func(op, op->success, op->att_ecode);
+}
 
-	op->cur_service->chrcs = chrcs;
-	op->cur_service->num_chrcs = chrc_count;
+static bool chrc_has_descs(struct chrc_data *chrc)
+{
+	return chrc->chrc_external.value_handle <
+					chrc->chrc_external.end_handle;
+}
 
-	for (i = 0; i < chrc_count; i++) {
-		op->cur_chrc_index = i;
-		op->cur_chrc = chrcs + i;
-		desc_start = chrcs[i].chrc_external.value_handle + 1;
-		if (desc_start > chrcs[i].chrc_external.end_handle)
-			continue;
+/* Starts descriptor discovery for every characteristic at once rather than
+ * one at a time, so that the requests are queued back to back (and spread
+ * over all bearers). Runs of adjacent characteristics that have descriptors
+ * are covered by a single Find Information request.
+ */
+static void discover_all_descs(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	struct service_data *svc;
+	struct chrc_data *first, *last, *end;
+	size_t i;
 
-		if (bt_gatt_discover_descriptors(client->att, desc_start,
-					chrcs[i].chrc_external.end_handle,
-					discover_descs_cb, discovery_op_ref(op),
-					discovery_op_unref))
-			return;
+	/* Don't complete until every request has been sent */
+	op->pending = 1;
 
-		util_debug(client->debug_callback, client->debug_data,
+	for (i = 0; i < op->result.len; i++) {
+		svc = &op->result.svcs[i];
+		first = svc->chrcs;
+		end = svc->chrcs + svc->num_chrcs;
+
+		while (first < end) {
+			if (!chrc_has_descs(first)) {
+				first++;
+				continue;
+			}
+
+			for (last = first; last + 1 < end; last++) {
+				if (!chrc_has_descs(last + 1))
+					break;
+			}
+
+			if (!bt_gatt_discover_descriptors(client->att,
+					first->chrc_external.value_handle + 1,
+					last->chrc_external.end_handle,
+					discover_descs_cb, discovery_op_ref(op),
+					discovery_op_unref)) {
+				util_debug(client->debug_callback,
+					client->debug_data,
 					"Failed to start descriptor discovery");
-		discovery_op_unref(op);
-		success = false;
+				discovery_op_unref(op);
+				op->success = false;
+				goto done;
+			}
 
-		goto done;
+			op->pending++;
+			first = last + 1;
+		}
 	}
 
-next:
-	if (!op->cur_service->next)
+done:
+	if (--op->pending)
+		return;
+
+	op->complete_func(op, op->success, op->att_ecode);
+}
+
+static void discover_chrcs_cb(bool success, uint8_t att_ecode,
+						struct bt_gatt_result *result,
+						void *user_data)
+{
+	struct discovery_op *op = user_data;
+	struct bt_gatt_client *client = op->client;
+	struct bt_gatt_iter iter;
+	char uuid_str[MAX_LEN_UUID_STR];
+	uint16_t start, end, value;
+	uint8_t props, uuid[BT_GATT_UUID_SIZE];
+	struct service_data *svc;
+	struct chrc_data *chrc;
+
+	if (!success) {
+		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
+			success = true;
+			att_ecode = 0;
+		}
+
 		goto done;
+	}
 
-	/* Move on to the next service */
-	op->cur_service = op->cur_service->next;
-	if (bt_gatt_discover_characteristics(client->att,
-					op->cur_service->service.start_handle,
-					op->cur_service->service.end_handle,
-					discover_chrcs_cb,
-					discovery_op_ref(op),
-					discovery_op_unref))
-		return;
+	if (!result || !bt_gatt_iter_init(&iter, result)) {
+		success = false;
+		goto done;
+	}
 
 	util_debug(client->debug_callback, client->debug_data,
-				"Failed to start characteristic discovery");
-	discovery_op_unref(op);
-	success = false;
+				"Characteristics found: %u",
+				bt_gatt_result_characteristic_count(result));
+
+	BT_TRACE2(gatt_chrcs_discovered, client,
+				bt_gatt_result_characteristic_count(result));
+
+	while (bt_gatt_iter_next_characteristic(&iter, &start, &end, &value,
+							&props, uuid)) {
+		/* Characteristics of secondary services are not exposed */
+		svc = service_array_find(&op->result, start);
+		if (!svc)
+			continue;
+
+		/* The last characteristic of a service ends with the service,
+		 * not just before the next characteristic declaration.
+		 */
+		end = MIN(end, svc->service.end_handle);
+
+		uuid_to_string(uuid, uuid_str);
+		util_debug(client->debug_callback, client->debug_data,
+				"start: 0x%04x, end: 0x%04x, value: 0x%04x, "
+				"props: 0x%02x, uuid: %s",
+				start, end, value, props, uuid_str);
+
+		chrc = service_add_chrc(svc);
+		if (!chrc) {
+			success = false;
+			goto done;
+		}
+
+		chrc->chrc_external.start_handle = start;
+		chrc->chrc_external.end_handle = end;
+		chrc->chrc_external.value_handle = value;
+		chrc->chrc_external.properties = props;
+		memcpy(chrc->chrc_external.uuid, uuid, UUID_BYTES);
+
+		/* In lazy mode descriptors are discovered on first use */
+		chrc->descs_known = !client->lazy_descs ||
+							!chrc_has_descs(chrc);
+
+		if (uuid_cmp(uuid, SVC_CHNGD_UUID) == 0)
+			client->svc_chngd_val_handle = value;
+	}
+
+	if (client->lazy_descs) {
+		success = true;
+		goto done;
+	}
+
+	op->success = true;
+	discover_all_descs(op);
+	return;
 
 done:
 	op->complete_func(op, success, att_ecode);
@@ -640,6 +1044,13 @@ static void discover_primary_cb(bool success, uint8_t att_ecode,
 	char uuid_str[MAX_LEN_UUID_STR];
 
 	if (!success) {
+		/* A range without any service left is not an error */
+		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
+			success = true;
+			att_ecode = 0;
+			goto done;
+		}
+
 		util_debug(client->debug_callback, client->debug_data,
 					"Primary service discovery failed."
 					" ATT ECODE: 0x%02x", att_ecode);
@@ -655,6 +1066,9 @@ static void discover_primary_cb(bool success, uint8_t att_ecode,
 					"Primary services found: %u",
 					bt_gatt_result_service_count(result));
 
+	BT_TRACE2(gatt_primary_discovered, client,
+					bt_gatt_result_service_count(result));
+
 	while (bt_gatt_iter_next_service(&iter, &start, &end, uuid)) {
 		/* Log debug message. */
 		uuid_to_string(uuid, uuid_str);
@@ -663,8 +1077,7 @@ static void discover_primary_cb(bool success, uint8_t att_ecode,
 				start, end, uuid_str);
 
 		/* Store the service */
-		if (!service_list_add_service(&op->result_head,
-					&op->result_tail, start, end, uuid)) {
+		if (!service_array_add(&op->result, start, end, uuid)) {
 			util_debug(client->debug_callback, client->debug_data,
 						"Failed to store service");
 			success = false;
@@ -676,14 +1089,17 @@ static void discover_primary_cb(bool success, uint8_t att_ecode,
 	}
 
 	/* Complete the process if the service list is empty */
-	if (!op->result_head)
+	if (!op->result.len)
 		goto done;
 
-	/* Sequentially discover the characteristics of all services */
-	op->cur_service = op->result_head;
-	if (bt_gatt_discover_characteristics(client->att,
-					op->cur_service->service.start_handle,
-					op->cur_service->service.end_handle,
+	/* Discover the characteristics of all services with a single
+	 * procedure, which saves the round trip that terminates each
+	 * per-service search. They are sorted into services by handle.
+	 */
+	start = op->result.svcs[0].service.start_handle;
+	end = op->result.svcs[op->result.len - 1].service.end_handle;
+
+	if (bt_gatt_discover_characteristics(client->att, start, end,
 					discover_chrcs_cb,
 					discovery_op_ref(op),
 					discovery_op_unref))
@@ -698,6 +1114,257 @@ done:
 	op->complete_func(op, success, att_ecode);
 }
 
+static void uuid_to_hex(const uint8_t uuid[BT_GATT_UUID_SIZE],
+					char str[BT_GATT_UUID_SIZE * 2 + 1])
+{
+	unsigned int i;
+
+	for (i = 0; i < BT_GATT_UUID_SIZE; i++)
+		sprintf(str + (i * 2), "%2.2x", uuid[i]);
+}
+
+static bool hex_to_uuid(const char *str, uint8_t uuid[BT_GATT_UUID_SIZE])
+{
+	unsigned int i, val;
+
+	if (strlen(str) != BT_GATT_UUID_SIZE * 2)
+		return false;
+
+	for (i = 0; i < BT_GATT_UUID_SIZE; i++) {
+		if (sscanf(str + (i * 2), "%2x", &val) != 1)
+			return false;
+
+		uuid[i] = val;
+	}
+
+	return true;
+}
+
+static void gatt_client_store_cache(struct bt_gatt_client *client)
+{
+	char tmp[PATH_MAX], uuid[BT_GATT_UUID_SIZE * 2 + 1];
+	struct service_data *svc;
+	struct chrc_data *chrc;
+	size_t i, j, k;
+	FILE *f;
+	int err;
+
+	if (!client->cache_path)
+		return;
+
+	/* Without "Service Changed" the server has no way to invalidate the
+	 * cache, so such servers are always discovered again.
+	 */
+	if (!client->svc_chngd_val_handle) {
+		unlink(client->cache_path);
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", client->cache_path);
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		util_debug(client->debug_callback, client->debug_data,
+					"Failed to open cache: %s", tmp);
+		return;
+	}
+
+	fprintf(f, "%s\n", CACHE_HEADER);
+
+	for (k = 0; k < client->svcs.len; k++) {
+		svc = &client->svcs.svcs[k];
+
+		uuid_to_hex(svc->service.uuid, uuid);
+		fprintf(f, "service %04x %04x %s\n", svc->service.start_handle,
+					svc->service.end_handle, uuid);
+
+		for (i = 0; i < svc->num_chrcs; i++) {
+			chrc = &svc->chrcs[i];
+
+			uuid_to_hex(chrc->chrc_external.uuid, uuid);
+			fprintf(f, "chrc %04x %04x %04x %02x %s\n",
+					chrc->chrc_external.start_handle,
+					chrc->chrc_external.end_handle,
+					chrc->chrc_external.value_handle,
+					chrc->chrc_external.properties, uuid);
+
+			for (j = 0; j < chrc->chrc_external.num_descs; j++) {
+				uuid_to_hex(chrc->descs[j].uuid, uuid);
+				fprintf(f, "desc %04x %s\n",
+						chrc->descs[j].handle, uuid);
+			}
+		}
+	}
+
+	/* Replace the old cache atomically so that a crash never leaves a
+	 * truncated database behind.
+	 */
+	err = ferror(f);
+	if (fclose(f) < 0 || err || rename(tmp, client->cache_path) < 0) {
+		util_debug(client->debug_callback, client->debug_data,
+					"Failed to store cache: %s",
+					client->cache_path);
+		unlink(tmp);
+		return;
+	}
+
+	util_debug(client->debug_callback, client->debug_data,
+					"Stored attribute cache: %s",
+					client->cache_path);
+}
+
+static bool gatt_client_load_cache(struct bt_gatt_client *client,
+						struct service_array *array)
+{
+	char line[128], uuid_str[BT_GATT_UUID_SIZE * 2 + 1];
+	unsigned int start, end, value, props;
+	uint8_t uuid[BT_GATT_UUID_SIZE];
+	struct service_data *svc = NULL;
+	struct chrc_data *chrc = NULL;
+	uint16_t last = 0;
+	FILE *f;
+
+	f = fopen(client->cache_path, "r");
+	if (!f)
+		return false;
+
+	if (!fgets(line, sizeof(line), f) ||
+			strncmp(line, CACHE_HEADER, strlen(CACHE_HEADER)))
+		goto fail;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "service %4x %4x %32s", &start, &end,
+							uuid_str) == 3) {
+			if (!start || start > end || start <= last ||
+						!hex_to_uuid(uuid_str, uuid))
+				goto fail;
+
+			if (!service_array_add(array, start, end, uuid))
+				goto fail;
+
+			if (uuid_cmp(uuid, GATT_SVC_UUID) == 0)
+				client->gatt_svc_handle = start;
+
+			svc = &array->svcs[array->len - 1];
+			chrc = NULL;
+			last = end;
+			continue;
+		}
+
+		if (sscanf(line, "chrc %4x %4x %4x %2x %32s", &start, &end,
+					&value, &props, uuid_str) == 5) {
+			if (!svc || start < svc->service.start_handle ||
+					end > svc->service.end_handle ||
+					(chrc && start <=
+					chrc->chrc_external.end_handle) ||
+					value <= start || value > end ||
+					!hex_to_uuid(uuid_str, uuid))
+				goto fail;
+
+			chrc = service_add_chrc(svc);
+			if (!chrc)
+				goto fail;
+
+			chrc->chrc_external.start_handle = start;
+			chrc->chrc_external.end_handle = end;
+			chrc->chrc_external.value_handle = value;
+			chrc->chrc_external.properties = props;
+			memcpy(chrc->chrc_external.uuid, uuid, UUID_BYTES);
+
+			/* Corrected below once a descriptor is found */
+			chrc->descs_known = !chrc_has_descs(chrc);
+
+			if (uuid_cmp(uuid, SVC_CHNGD_UUID) == 0)
+				client->svc_chngd_val_handle = value;
+
+			continue;
+		}
+
+		if (sscanf(line, "desc %4x %32s", &start, uuid_str) == 2) {
+			if (!chrc ||
+				start <= chrc->chrc_external.value_handle ||
+				start > chrc->chrc_external.end_handle ||
+				!hex_to_uuid(uuid_str, uuid))
+				goto fail;
+
+			if (!chrc_add_desc(chrc, start, uuid))
+				goto fail;
+
+			chrc->descs_known = true;
+			continue;
+		}
+
+		goto fail;
+	}
+
+	/* Caches are only stored for servers with "Service Changed" */
+	if (!client->svc_chngd_val_handle)
+		goto fail;
+
+	fclose(f);
+
+	util_debug(client->debug_callback, client->debug_data,
+					"Loaded attribute cache: %s",
+					client->cache_path);
+
+	return true;
+
+fail:
+	util_debug(client->debug_callback, client->debug_data,
+					"Ignoring invalid cache: %s",
+					client->cache_path);
+	service_array_clear(array);
+	client->gatt_svc_handle = 0;
+	client->svc_chngd_val_handle = 0;
+	fclose(f);
+
+	return false;
+}
+
+static void link_update(struct bt_gatt_client *client)
+{
+	uint8_t state;
+
+	if (client->in_init || client->in_svc_chngd)
+		state = BT_GATT_CLIENT_LINK_DISCOVERY;
+	else if (client->bulk_ops)
+		state = BT_GATT_CLIENT_LINK_BULK;
+	else
+		state = BT_GATT_CLIENT_LINK_IDLE;
+
+	if (state == client->link_state)
+		return;
+
+	client->link_state = state;
+
+	if (client->link_callback)
+		client->link_callback(state, bt_att_get_mtu(client->att),
+							client->link_data);
+}
+
+static void bulk_op_start(struct bt_gatt_client *client)
+{
+	client->bulk_ops++;
+	link_update(client);
+}
+
+static void bulk_op_end(struct bt_gatt_client *client)
+{
+	client->bulk_ops--;
+	link_update(client);
+}
+
+static void client_ready(struct bt_gatt_client *client, bool success,
+							uint8_t att_ecode)
+{
+	link_update(client);
+
+	BT_TRACE3(gatt_client_ready, client, success, att_ecode);
+
+	if (client->ready_callback)
+		client->ready_callback(success, att_ecode, client->ready_data);
+}
+
 static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct discovery_op *op = user_data;
@@ -708,11 +1375,10 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 				"MTU Exchange failed. ATT ECODE: 0x%02x",
 				att_ecode);
 
+		service_array_clear(&op->result);
 		client->in_init = false;
 
-		if (client->ready_callback)
-			client->ready_callback(success, att_ecode,
-							client->ready_data);
+		client_ready(client, success, att_ecode);
 
 		return;
 	}
@@ -721,6 +1387,16 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 					"MTU exchange complete, with MTU: %u",
 					bt_att_get_mtu(client->att));
 
+	BT_TRACE2(gatt_mtu_exchanged, client, bt_att_get_mtu(client->att));
+
+	/* The cached database stays valid until the server tells us otherwise
+	 * through "Service Changed", so skip discovery entirely.
+	 */
+	if (op->from_cache) {
+		op->complete_func(op, true, 0);
+		return;
+	}
+
 	if (bt_gatt_discover_all_primary_services(client->att, NULL,
 							discover_primary_cb,
 							discovery_op_ref(op),
@@ -732,8 +1408,7 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 
 	client->in_init = false;
 
-	if (client->ready_callback)
-		client->ready_callback(success, att_ecode, client->ready_data);
+	client_ready(client, success, att_ecode);
 
 	discovery_op_unref(op);
 }
@@ -760,27 +1435,38 @@ static void service_changed_complete(struct discovery_op *op, bool success,
 		util_debug(client->debug_callback, client->debug_data,
 			"Failed to discover services within changed range - "
 			"error: 0x%02x", att_ecode);
-		return;
+		goto fail;
 	}
 
-	/* No new services in the modified range */
-	if (!op->result_head || !op->result_tail)
-		return;
+	if (!gatt_client_merge_range(client, &op->result, op->start,
+								op->end)) {
+		util_debug(client->debug_callback, client->debug_data,
+					"Failed to store changed services");
+		goto fail;
+	}
+
+	gatt_client_store_cache(client);
+	goto next;
+
+fail:
+	/* Nothing cached within the range can be trusted anymore */
+	gatt_client_remove_all_notify_in_range(client, op->start, op->end);
+	service_array_clear_range(&client->svcs, op->start, op->end);
 
-	/* Insert all newly discovered services in their correct place as a
-	 * contiguous chunk */
-	service_list_insert_services(&client->svc_head, &client->svc_tail,
-					op->result_head, op->result_tail);
+	if (client->cache_path)
+		unlink(client->cache_path);
 
+next:
 	/* Process any queued events */
 	next_sc_op = queue_pop_head(client->svc_chngd_queue);
 	if (next_sc_op) {
 		process_service_changed(client, next_sc_op->start_handle,
 							next_sc_op->end_handle);
-		free(op);
-		return;
+		free(next_sc_op);
 	}
 
+	link_update(client);
+
 	/* TODO: if the GATT service has changed then register a handler
 	 * for "Service Changed".
 	 */
@@ -790,17 +1476,22 @@ static void process_service_changed(struct bt_gatt_client *client,
 							uint16_t start_handle,
 							uint16_t end_handle)
 {
+	struct service_array *array = &client->svcs;
 	struct discovery_op *op;
+	size_t i;
 
-	/* Invalidate and remove all effected notify callbacks */
-	gatt_client_remove_all_notify_in_range(client, start_handle,
-								end_handle);
-
-	/* Remove all services that overlap the modified range since we'll
-	 * rediscover them
+	/* Cached services that the range only cuts through are rediscovered
+	 * as a whole. Until the discovery completes the cached ones remain
+	 * in place, so notifications keep being delivered.
 	 */
-	service_list_clear_range(&client->svc_head, &client->svc_tail,
-						start_handle, end_handle);
+	i = service_array_lower_bound(array, start_handle);
+	if (i < array->len && array->svcs[i].service.start_handle <= end_handle)
+		start_handle = MIN(start_handle,
+					array->svcs[i].service.start_handle);
+
+	i = service_array_lower_bound(array, end_handle);
+	if (i < array->len && array->svcs[i].service.start_handle <= end_handle)
+		end_handle = MAX(end_handle, array->svcs[i].service.end_handle);
 
 	op = new0(struct discovery_op, 1);
 	if (!op) {
@@ -811,6 +1502,8 @@ static void process_service_changed(struct bt_gatt_client *client,
 	}
 
 	op->client = client;
+	op->start = start_handle;
+	op->end = end_handle;
 	op->complete_func = service_changed_complete;
 
 	if (!bt_gatt_discover_primary_services(client->att, NULL,
@@ -826,6 +1519,7 @@ static void process_service_changed(struct bt_gatt_client *client,
 	}
 
 	client->in_svc_chngd = true;
+	link_update(client);
 }
 
 static void service_changed_cb(uint16_t value_handle, const uint8_t *value,
@@ -854,6 +1548,9 @@ static void service_changed_cb(uint16_t value_handle, const uint8_t *value,
 	if (!op)
 		return;
 
+	op->start_handle = start;
+	op->end_handle = end;
+
 	queue_push_tail(client->svc_chngd_queue, op);
 }
 
@@ -877,8 +1574,7 @@ static void service_changed_register_cb(unsigned int id, uint16_t att_ecode,
 			"Registered handler for \"Service Changed\": %u", id);
 
 done:
-	if (client->ready_callback)
-		client->ready_callback(success, att_ecode, client->ready_data);
+	client_ready(client, success, att_ecode);
 }
 
 static void init_complete(struct discovery_op *op, bool success,
@@ -892,10 +1588,13 @@ static void init_complete(struct discovery_op *op, bool success,
 	if (!success)
 		goto fail;
 
-	client->svc_head = op->result_head;
-	client->svc_tail = op->result_tail;
+	client->svcs = op->result;
+
+	if (!op->from_cache)
+		gatt_client_store_cache(client);
 
 	if (!client->svc_chngd_val_handle) {
+		memset(&op->result, 0, sizeof(op->result));
 		client->ready = true;
 		goto done;
 	}
@@ -913,22 +1612,27 @@ static void init_complete(struct discovery_op *op, bool success,
 						client, NULL);
 	client->ready = false;
 
-	if (registered)
+	if (registered) {
+		memset(&op->result, 0, sizeof(op->result));
 		return;
+	}
 
 	util_debug(client->debug_callback, client->debug_data,
 			"Failed to register handler for \"Service Changed\"");
 
-	client->svc_head = client->svc_tail = NULL;
+	memset(&client->svcs, 0, sizeof(client->svcs));
 
 fail:
 	util_debug(client->debug_callback, client->debug_data,
 			"Failed to initialize gatt-client");
-	service_list_clear(&op->result_head, &op->result_tail);
+	service_array_clear(&op->result);
+
+	/* Don't trust the cache on the next connection */
+	if (op->from_cache)
+		unlink(client->cache_path);
 
 done:
-	if (client->ready_callback)
-		client->ready_callback(success, att_ecode, client->ready_data);
+	client_ready(client, success, att_ecode);
 }
 
 static bool gatt_client_init(struct bt_gatt_client *client, uint16_t mtu)
@@ -945,18 +1649,24 @@ static bool gatt_client_init(struct bt_gatt_client *client, uint16_t mtu)
 	op->client = client;
 	op->complete_func = init_complete;
 
+	if (client->cache_path)
+		op->from_cache = gatt_client_load_cache(client, &op->result);
+
+	BT_TRACE2(gatt_discovery_start, client, op->from_cache);
+
 	/* Configure the MTU */
 	if (!bt_gatt_exchange_mtu(client->att, MAX(BT_ATT_DEFAULT_LE_MTU, mtu),
 							exchange_mtu_cb,
 							discovery_op_ref(op),
 							discovery_op_unref)) {
-		if (client->ready_callback)
-			client->ready_callback(false, 0, client->ready_data);
+		client_ready(client, false, 0);
 
+		service_array_clear(&op->result);
 		free(op);
 	}
 
 	client->in_init = true;
+	link_update(client);
 
 	return true;
 }
@@ -973,17 +1683,19 @@ static void complete_notify_request(void *data)
 	/* Increment the per-characteristic ref count of notify handlers */
 	__sync_fetch_and_add(&notify_data->chrc->notify_count, 1);
 
-	/* Add the handler to the bt_gatt_client's general list */
-	queue_push_tail(notify_data->client->notify_list,
-						notify_data_ref(notify_data));
-
-	/* Assign an ID to the handler and notify the caller that it was
-	 * successfully registered.
+	/* Assign an ID to the handler and add it to the bt_gatt_client's
+	 * general list.
 	 */
 	if (notify_data->client->next_reg_id < 1)
 		notify_data->client->next_reg_id = 1;
 
 	notify_data->id = notify_data->client->next_reg_id++;
+
+	idmap_insert(notify_data->client->notify_list, notify_data->id,
+						notify_data_ref(notify_data));
+	queue_push_tail(notify_data->chrc->notify_list, notify_data);
+
+	/* Notify the caller that it was successfully registered */
 	notify_data->callback(notify_data->id, 0, notify_data->user_data);
 }
 
@@ -1017,8 +1729,12 @@ static bool notify_data_write_ccc(struct notify_data *notify_data, bool enable,
 						pdu, sizeof(pdu),
 						callback,
 						notify_data, notify_data_unref);
+	if (!notify_data->chrc->ccc_write_id)
+		return false;
 
-	return !!notify_data->chrc->ccc_write_id;
+	notify_data->chrc->ccc_write_data = notify_data;
+
+	return true;
 }
 
 static uint8_t process_error(const void *pdu, uint16_t length)
@@ -1039,6 +1755,7 @@ static void enable_ccc_callback(uint8_t opcode, const void *pdu,
 	assert(notify_data->chrc->ccc_write_id);
 
 	notify_data->chrc->ccc_write_id = 0;
+	notify_data->chrc->ccc_write_data = NULL;
 
 	if (opcode == BT_ATT_OP_ERROR_RSP) {
 		att_ecode = process_error(pdu, length);
@@ -1076,6 +1793,7 @@ static void disable_ccc_callback(uint8_t opcode, const void *pdu,
 	assert(notify_data->chrc->ccc_write_id);
 
 	notify_data->chrc->ccc_write_id = 0;
+	notify_data->chrc->ccc_write_data = NULL;
 
 	/* This is a best effort procedure, so ignore errors and process any
 	 * queued requests.
@@ -1092,6 +1810,8 @@ static void complete_unregister_notify(void *data)
 {
 	struct notify_data *notify_data = data;
 
+	queue_remove(notify_data->chrc->notify_list, notify_data);
+
 	if (__sync_sub_and_fetch(&notify_data->chrc->notify_count, 1)) {
 		notify_data_unref(notify_data);
 		return;
@@ -1107,14 +1827,14 @@ static void notify_handler(void *data, void *user_data)
 	uint16_t value_handle;
 	const uint8_t *value = NULL;
 
-	if (notify_data->removed)
+	/* Handlers invalidated by a Service Changed processed from an earlier
+	 * handler refer to a characteristic that no longer exists.
+	 */
+	if (notify_data->removed || notify_data->invalid)
 		return;
 
 	value_handle = get_le16(pdu_data->pdu);
 
-	if (notify_data->chrc->chrc_external.value_handle != value_handle)
-		return;
-
 	if (pdu_data->length > 2)
 		value = pdu_data->pdu + 2;
 
@@ -1128,27 +1848,37 @@ static void notify_cb(uint8_t opcode, const void *pdu, uint16_t length,
 {
 	struct bt_gatt_client *client = user_data;
 	struct pdu_data pdu_data;
+	struct chrc_data *chrc;
 
 	bt_gatt_client_ref(client);
 
+	if (length < 2)
+		goto done;
+
+	/* Only the handlers registered for this characteristic are called */
+	chrc = gatt_client_find_chrc(client, get_le16(pdu));
+	if (!chrc)
+		goto done;
+
 	client->in_notify = true;
 
 	memset(&pdu_data, 0, sizeof(pdu_data));
 	pdu_data.pdu = pdu;
 	pdu_data.length = length;
 
-	queue_foreach(client->notify_list, notify_handler, &pdu_data);
+	queue_foreach(chrc->notify_list, notify_handler, &pdu_data);
 
 	client->in_notify = false;
 
 	if (client->need_notify_cleanup) {
-		queue_remove_all(client->notify_list, match_notify_data_invalid,
+		idmap_remove_all(client->notify_list, match_notify_data_invalid,
 						NULL, notify_data_unref);
-		queue_remove_all(client->notify_list, match_notify_data_removed,
+		idmap_remove_all(client->notify_list, match_notify_data_removed,
 					NULL, complete_unregister_notify);
 		client->need_notify_cleanup = false;
 	}
 
+done:
 	if (opcode == BT_ATT_OP_HANDLE_VAL_IND)
 		bt_att_send(client->att, BT_ATT_OP_HANDLE_VAL_CONF, NULL, 0,
 							NULL, NULL, NULL);
@@ -1156,7 +1886,9 @@ static void notify_cb(uint8_t opcode, const void *pdu, uint16_t length,
 	bt_gatt_client_unref(client);
 }
 
-struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
+static struct bt_gatt_client *gatt_client_new(struct bt_att *att,
+							uint16_t mtu,
+							const char *cache_path)
 {
 	struct bt_gatt_client *client;
 
@@ -1167,8 +1899,17 @@ struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
 	if (!client)
 		return NULL;
 
+	if (cache_path) {
+		client->cache_path = strdup(cache_path);
+		if (!client->cache_path) {
+			free(client);
+			return NULL;
+		}
+	}
+
 	client->long_write_queue = queue_new();
 	if (!client->long_write_queue) {
+		free(client->cache_path);
 		free(client);
 		return NULL;
 	}
@@ -1176,14 +1917,26 @@ struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
 	client->svc_chngd_queue = queue_new();
 	if (!client->svc_chngd_queue) {
 		queue_destroy(client->long_write_queue, NULL);
+		free(client->cache_path);
 		free(client);
 		return NULL;
 	}
 
-	client->notify_list = queue_new();
+	client->notify_list = idmap_new();
 	if (!client->notify_list) {
 		queue_destroy(client->svc_chngd_queue, NULL);
 		queue_destroy(client->long_write_queue, NULL);
+		free(client->cache_path);
+		free(client);
+		return NULL;
+	}
+
+	client->read_batch = queue_new();
+	if (!client->read_batch) {
+		idmap_destroy(client->notify_list, NULL);
+		queue_destroy(client->svc_chngd_queue, NULL);
+		queue_destroy(client->long_write_queue, NULL);
+		free(client->cache_path);
 		free(client);
 		return NULL;
 	}
@@ -1191,9 +1944,11 @@ struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
 	client->notify_id = bt_att_register(att, BT_ATT_OP_HANDLE_VAL_NOT,
 						notify_cb, client, NULL);
 	if (!client->notify_id) {
-		queue_destroy(client->notify_list, NULL);
+		queue_destroy(client->read_batch, NULL);
+		idmap_destroy(client->notify_list, NULL);
 		queue_destroy(client->svc_chngd_queue, NULL);
 		queue_destroy(client->long_write_queue, NULL);
+		free(client->cache_path);
 		free(client);
 		return NULL;
 	}
@@ -1202,9 +1957,11 @@ struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
 						notify_cb, client, NULL);
 	if (!client->ind_id) {
 		bt_att_unregister(att, client->notify_id);
-		queue_destroy(client->notify_list, NULL);
+		queue_destroy(client->read_batch, NULL);
+		idmap_destroy(client->notify_list, NULL);
 		queue_destroy(client->svc_chngd_queue, NULL);
 		queue_destroy(client->long_write_queue, NULL);
+		free(client->cache_path);
 		free(client);
 		return NULL;
 	}
@@ -1216,6 +1973,21 @@ struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
 	return bt_gatt_client_ref(client);
 }
 
+struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu)
+{
+	return gatt_client_new(att, mtu, NULL);
+}
+
+struct bt_gatt_client *bt_gatt_client_new_with_cache(struct bt_att *att,
+							uint16_t mtu,
+							const char *cache_path)
+{
+	if (!cache_path)
+		return NULL;
+
+	return gatt_client_new(att, mtu, cache_path);
+}
+
 struct bt_gatt_client *bt_gatt_client_ref(struct bt_gatt_client *client)
 {
 	if (!client)
@@ -1227,6 +1999,7 @@ struct bt_gatt_client *bt_gatt_client_ref(struct bt_gatt_client *client)
 }
 
 static void long_write_op_unref(void *data);
+static void destroy_read_op(void *data);
 
 void bt_gatt_client_unref(struct bt_gatt_client *client)
 {
@@ -1239,19 +2012,27 @@ void bt_gatt_client_unref(struct bt_gatt_client *client)
 	if (client->ready_destroy)
 		client->ready_destroy(client->ready_data);
 
+	if (client->link_destroy)
+		client->link_destroy(client->link_data);
+
 	if (client->debug_destroy)
 		client->debug_destroy(client->debug_data);
 
 	bt_att_unregister(client->att, client->notify_id);
 	bt_att_unregister(client->att, client->ind_id);
 
-	queue_destroy(client->svc_chngd_queue, free);
-	queue_destroy(client->long_write_queue, long_write_op_unref);
-	queue_destroy(client->notify_list, notify_data_unref);
+	timeout_remove(client->read_batch_id);
+	queue_destroy(client->read_batch, destroy_read_op);
 
 	gatt_client_clear_services(client);
 
+	queue_destroy(client->svc_chngd_queue, free);
+	queue_destroy(client->long_write_queue, long_write_op_unref);
+	idmap_destroy(client->notify_list, notify_data_unref);
+
 	bt_att_unref(client->att);
+	bt_crypto_unref(client->crypto);
+	free(client->cache_path);
 	free(client);
 }
 
@@ -1260,6 +2041,14 @@ bool bt_gatt_client_is_ready(struct bt_gatt_client *client)
 	return (client && client->ready);
 }
 
+uint16_t bt_gatt_client_get_mtu(struct bt_gatt_client *client)
+{
+	if (!client)
+		return 0;
+
+	return bt_att_get_mtu(client->att);
+}
+
 bool bt_gatt_client_set_ready_handler(struct bt_gatt_client *client,
 					bt_gatt_client_callback_t callback,
 					void *user_data,
@@ -1278,6 +2067,24 @@ bool bt_gatt_client_set_ready_handler(struct bt_gatt_client *client,
 	return true;
 }
 
+bool bt_gatt_client_set_link_handler(struct bt_gatt_client *client,
+					bt_gatt_client_link_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	if (!client)
+		return false;
+
+	if (client->link_destroy)
+		client->link_destroy(client->link_data);
+
+	client->link_callback = callback;
+	client->link_destroy = destroy;
+	client->link_data = user_data;
+
+	return true;
+}
+
 bool bt_gatt_client_set_debug(struct bt_gatt_client *client,
 					bt_gatt_client_debug_func_t callback,
 					void *user_data,
@@ -1314,23 +2121,25 @@ bool bt_gatt_service_iter_init(struct bt_gatt_service_iter *iter,
 bool bt_gatt_service_iter_next(struct bt_gatt_service_iter *iter,
 					const bt_gatt_service_t **service)
 {
-	struct service_list *l;
+	struct service_array *svcs;
+	struct service_data *svc;
 
 	if (!iter || !service)
 		return false;
 
-	l = iter->ptr;
+	svcs = &iter->client->svcs;
+	svc = iter->ptr;
 
-	if (!l)
-		l = iter->client->svc_head;
+	if (!svc)
+		svc = svcs->svcs;
 	else
-		l = l->next;
+		svc++;
 
-	if (!l)
+	if (!svc || svc >= svcs->svcs + svcs->len)
 		return false;
 
-	*service = &l->service;
-	iter->ptr = l;
+	*service = &svc->service;
+	iter->ptr = svc;
 
 	return true;
 }
@@ -1339,12 +2148,23 @@ bool bt_gatt_service_iter_next_by_handle(struct bt_gatt_service_iter *iter,
 					uint16_t start_handle,
 					const bt_gatt_service_t **service)
 {
-	while (bt_gatt_service_iter_next(iter, service)) {
-		if ((*service)->start_handle == start_handle)
-			return true;
-	}
+	struct service_data *svc;
 
-	return false;
+	if (!iter || !service)
+		return false;
+
+	svc = service_array_find(&iter->client->svcs, start_handle);
+	if (!svc || svc->service.start_handle != start_handle)
+		return false;
+
+	/* Only services after the current position are considered */
+	if (iter->ptr && svc <= (struct service_data *) iter->ptr)
+		return false;
+
+	*service = &svc->service;
+	iter->ptr = svc;
+
+	return true;
 }
 
 bool bt_gatt_service_iter_next_by_uuid(struct bt_gatt_service_iter *iter,
@@ -1366,7 +2186,7 @@ bool bt_gatt_characteristic_iter_init(struct bt_gatt_characteristic_iter *iter,
 		return false;
 
 	memset(iter, 0, sizeof(*iter));
-	iter->service = (struct service_list *) service;
+	iter->service = (struct service_data *) service;
 
 	return true;
 }
@@ -1374,7 +2194,7 @@ bool bt_gatt_characteristic_iter_init(struct bt_gatt_characteristic_iter *iter,
 bool bt_gatt_characteristic_iter_next(struct bt_gatt_characteristic_iter *iter,
 					const bt_gatt_characteristic_t **chrc)
 {
-	struct service_list *service;
+	struct service_data *service;
 
 	if (!iter || !chrc)
 		return false;
@@ -1390,11 +2210,40 @@ bool bt_gatt_characteristic_iter_next(struct bt_gatt_characteristic_iter *iter,
 }
 
 struct read_op {
+	struct bt_gatt_client *client;
+	uint16_t value_handle;
+	uint16_t value_len;	/* Expected length when coalesced */
 	bt_gatt_client_read_callback_t callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
 };
 
+static struct read_op *read_op_new(struct bt_gatt_client *client,
+					bt_gatt_client_read_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	struct read_op *op;
+
+	op = new0(struct read_op, 1);
+	if (!op)
+		return NULL;
+
+	/* Responses may arrive after the last user reference is dropped */
+	op->client = bt_gatt_client_ref(client);
+	op->callback = callback;
+	op->user_data = user_data;
+	op->destroy = destroy;
+
+	return op;
+}
+
+static void read_op_free(struct read_op *op)
+{
+	bt_gatt_client_unref(op->client);
+	free(op);
+}
+
 static void destroy_read_op(void *data)
 {
 	struct read_op *op = data;
@@ -1402,7 +2251,7 @@ static void destroy_read_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op);
+	read_op_free(op);
 }
 
 static void read_cb(uint8_t opcode, const void *pdu, uint16_t length,
@@ -1420,7 +2269,9 @@ static void read_cb(uint8_t opcode, const void *pdu, uint16_t length,
 		goto done;
 	}
 
-	if (opcode != BT_ATT_OP_READ_RSP || (!pdu && length)) {
+	if ((opcode != BT_ATT_OP_READ_RSP &&
+				opcode != BT_ATT_OP_READ_MULT_RSP) ||
+				(!pdu && length)) {
 		success = false;
 		goto done;
 	}
@@ -1435,6 +2286,167 @@ done:
 		op->callback(success, att_ecode, value, length, op->user_data);
 }
 
+static bool read_op_send(struct read_op *op)
+{
+	uint8_t pdu[2];
+
+	put_le16(op->value_handle, pdu);
+
+	return !!bt_att_send(op->client->att, BT_ATT_OP_READ_REQ,
+							pdu, sizeof(pdu),
+							read_cb, op,
+							destroy_read_op);
+}
+
+struct read_batch {
+	struct queue *reads;
+	uint16_t length;
+};
+
+static void destroy_read_batch(void *data)
+{
+	struct read_batch *batch = data;
+
+	queue_destroy(batch->reads, destroy_read_op);
+	free(batch);
+}
+
+static void read_batch_cb(uint8_t opcode, const void *pdu, uint16_t length,
+								void *user_data)
+{
+	struct read_batch *batch = user_data;
+	struct read_op *op;
+	struct chrc_data *chrc;
+	const uint8_t *value = pdu;
+
+	if (opcode == BT_ATT_OP_READ_MULT_RSP && length == batch->length) {
+		while ((op = queue_pop_head(batch->reads))) {
+			if (op->callback)
+				op->callback(true, 0, op->value_len ? value :
+							NULL, op->value_len,
+							op->user_data);
+
+			value += op->value_len;
+			destroy_read_op(op);
+		}
+
+		return;
+	}
+
+	/* Either one of the reads failed, which fails the entire request, or
+	 * the server doesn't stick to the specified lengths. Read each value
+	 * on its own so that the result is reported per handle.
+	 */
+	while ((op = queue_pop_head(batch->reads))) {
+		if (opcode == BT_ATT_OP_READ_MULT_RSP) {
+			chrc = gatt_client_find_chrc(op->client,
+							op->value_handle);
+			if (chrc)
+				chrc->no_coalesce = true;
+		}
+
+		if (read_op_send(op))
+			continue;
+
+		if (op->callback)
+			op->callback(false, 0, NULL, 0, op->user_data);
+
+		destroy_read_op(op);
+	}
+}
+
+static void read_batch_send(struct bt_gatt_client *client)
+{
+	uint16_t mtu = bt_att_get_mtu(client->att);
+	struct read_batch *batch;
+	struct read_op *op;
+	uint8_t *pdu;
+	unsigned int num = 0;
+
+	batch = new0(struct read_batch, 1);
+	if (!batch)
+		goto fail;
+
+	batch->reads = queue_new();
+	pdu = malloc(mtu - 1);
+	if (!batch->reads || !pdu) {
+		free(pdu);
+		destroy_read_batch(batch);
+		goto fail;
+	}
+
+	/* Both the request and the response have to fit into the MTU */
+	while ((op = queue_peek_head(client->read_batch))) {
+		if ((num + 1) * 2 > (unsigned int) mtu - 1 ||
+				batch->length + op->value_len > mtu - 1)
+			break;
+
+		queue_pop_head(client->read_batch);
+		queue_push_tail(batch->reads, op);
+		put_le16(op->value_handle, pdu + num * 2);
+		batch->length += op->value_len;
+		num++;
+	}
+
+	/* Read Multiple requires at least two handles */
+	if (num == 1) {
+		op = queue_pop_head(batch->reads);
+		destroy_read_batch(batch);
+		free(pdu);
+
+		if (!read_op_send(op))
+			goto fail_op;
+
+		return;
+	}
+
+	util_debug(client->debug_callback, client->debug_data,
+				"Coalescing %u reads into Read Multiple", num);
+
+	if (!bt_att_send(client->att, BT_ATT_OP_READ_MULT_REQ, pdu, num * 2,
+							read_batch_cb, batch,
+							destroy_read_batch)) {
+		/* Let the fallback path report each read */
+		read_batch_cb(BT_ATT_OP_ERROR_RSP, NULL, 0, batch);
+		destroy_read_batch(batch);
+	}
+
+	free(pdu);
+	return;
+
+fail:
+	op = queue_pop_head(client->read_batch);
+
+fail_op:
+	if (op->callback)
+		op->callback(false, 0, NULL, 0, op->user_data);
+
+	destroy_read_op(op);
+}
+
+static bool read_batch_timeout(void *user_data)
+{
+	struct bt_gatt_client *client = user_data;
+
+	client->read_batch_id = 0;
+
+	while (!queue_isempty(client->read_batch))
+		read_batch_send(client);
+
+	return false;
+}
+
+bool bt_gatt_client_set_read_coalescing(struct bt_gatt_client *client,
+								bool enable)
+{
+	if (!client)
+		return false;
+
+	client->coalesce_reads = enable;
+
+	return true;
+}
+
 bool bt_gatt_client_read_value(struct bt_gatt_client *client,
 					uint16_t value_handle,
 					bt_gatt_client_read_callback_t callback,
@@ -1442,28 +2454,90 @@ bool bt_gatt_client_read_value(struct bt_gatt_client *client,
 					bt_gatt_client_destroy_func_t destroy)
 {
 	struct read_op *op;
-	uint8_t pdu[2];
+	struct chrc_data *chrc;
 
 	if (!client)
 		return false;
 
-	op = new0(struct read_op, 1);
+	op = read_op_new(client, callback, user_data, destroy);
 	if (!op)
 		return false;
 
-	op->callback = callback;
-	op->user_data = user_data;
-	op->destroy = destroy;
+	op->value_handle = value_handle;
 
-	put_le16(value_handle, pdu);
+	if (!client->coalesce_reads)
+		goto send;
+
+	/* Only values of fixed length can be demultiplexed */
+	chrc = gatt_client_find_chrc(client, value_handle);
+	if (!chrc)
+		goto send;
+
+	op->value_len = chrc_fixed_len(chrc);
+	if (!op->value_len)
+		goto send;
+
+	if (!client->read_batch_id) {
+		client->read_batch_id = timeout_add(READ_BATCH_TIMEOUT,
+							read_batch_timeout,
+							client, NULL);
+		if (!client->read_batch_id)
+			goto send;
+	}
+
+	queue_push_tail(client->read_batch, op);
+
+	return true;
 
-	if (!bt_att_send(client->att, BT_ATT_OP_READ_REQ, pdu, sizeof(pdu),
+send:
+	if (!read_op_send(op)) {
+		read_op_free(op);
+		return false;
+	}
+
+	return true;
+}
+
+bool bt_gatt_client_read_multiple(struct bt_gatt_client *client,
+					uint16_t *handles, uint8_t num_handles,
+					bt_gatt_client_read_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	struct read_op *op;
+	uint8_t *pdu;
+	uint8_t i;
+
+	if (!client || !handles || num_handles < 2)
+		return false;
+
+	if (num_handles * 2 > bt_att_get_mtu(client->att) - 1)
+		return false;
+
+	op = read_op_new(client, callback, user_data, destroy);
+	if (!op)
+		return false;
+
+	pdu = malloc(num_handles * 2);
+	if (!pdu) {
+		read_op_free(op);
+		return false;
+	}
+
+	for (i = 0; i < num_handles; i++)
+		put_le16(handles[i], pdu + i * 2);
+
+	if (!bt_att_send(client->att, BT_ATT_OP_READ_MULT_REQ, pdu,
+							num_handles * 2,
 							read_cb, op,
 							destroy_read_op)) {
-		free(op);
+		free(pdu);
+		read_op_free(op);
 		return false;
 	}
 
+	free(pdu);
+
 	return true;
 }
 
@@ -1473,48 +2547,19 @@ struct read_long_op {
 	uint16_t value_handle;
 	size_t orig_offset;
 	size_t offset;
-	struct queue *blobs;
+
+	/* Buffer the value is assembled in, unless it is streamed */
+	uint8_t *value;
+	size_t value_size;
+	bool own_value;
+
+	bt_gatt_client_read_chunk_callback_t chunk;
+	bt_gatt_client_callback_t complete;
 	bt_gatt_client_read_callback_t callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
 };
 
-struct blob {
-	uint8_t *data;
-	uint16_t offset;
-	uint16_t length;
-};
-
-static struct blob *create_blob(const uint8_t *data, uint16_t len,
-								uint16_t offset)
-{
-	struct blob *blob;
-
-	blob = new0(struct blob, 1);
-	if (!blob)
-		return NULL;
-
-	blob->data = malloc(len);
-	if (!blob->data) {
-		free(blob);
-		return NULL;
-	}
-
-	memcpy(blob->data, data, len);
-	blob->length = len;
-	blob->offset = offset;
-
-	return blob;
-}
-
-static void destroy_blob(void *data)
-{
-	struct blob *blob = data;
-
-	free(blob->data);
-	free(blob);
-}
-
 static struct read_long_op *read_long_op_ref(struct read_long_op *op)
 {
 	__sync_fetch_and_add(&op->ref_count, 1);
@@ -1532,53 +2577,69 @@ static void read_long_op_unref(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	queue_destroy(op->blobs, destroy_blob);
+	if (op->own_value)
+		free(op->value);
 
 	free(op);
 }
 
-static void append_blob(void *data, void *user_data)
-{
-	struct blob *blob = data;
-	uint8_t *value = user_data;
-
-	memcpy(value + blob->offset, blob->data, blob->length);
-}
-
 static void complete_read_long_op(struct read_long_op *op, bool success,
 							uint8_t att_ecode)
 {
-	uint8_t *value = NULL;
 	uint16_t length = 0;
 
-	if (!success)
-		goto done;
-
-	length = op->offset - op->orig_offset;
+	bulk_op_end(op->client);
 
-	if (!length)
-		goto done;
+	if (op->chunk) {
+		if (op->complete)
+			op->complete(success, att_ecode, op->user_data);
 
-	value = malloc(length);
-	if (!value) {
-		success = false;
-		goto done;
+		return;
 	}
 
-	queue_foreach(op->blobs, append_blob, value - op->orig_offset);
+	if (success)
+		length = MIN(op->offset - op->orig_offset, op->value_size);
 
-done:
 	if (op->callback)
-		op->callback(success, att_ecode, value, length, op->user_data);
+		op->callback(success, att_ecode, length ? op->value : NULL,
+						length, op->user_data);
+}
+
+/* Stores a Read Blob response, returning false on allocation failure */
+static bool read_long_op_store(struct read_long_op *op, const uint8_t *data,
+							uint16_t length)
+{
+	size_t pos = op->offset - op->orig_offset;
+	size_t size;
+	uint8_t *value;
+
+	if (op->chunk) {
+		op->chunk(op->offset, data, length, op->user_data);
+		return true;
+	}
+
+	if (op->own_value && pos + length > op->value_size) {
+		size = MAX(op->value_size * 2, pos + length);
+
+		value = realloc(op->value, size);
+		if (!value)
+			return false;
+
+		op->value = value;
+		op->value_size = size;
+	}
 
-	free(value);
+	if (pos < op->value_size)
+		memcpy(op->value + pos, data,
+					MIN(length, op->value_size - pos));
+
+	return true;
 }
 
 static void read_long_cb(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data)
 {
 	struct read_long_op *op = user_data;
-	struct blob *blob;
 	bool success;
 	uint8_t att_ecode = 0;
 
@@ -1596,17 +2657,20 @@ static void read_long_cb(uint8_t opcode, const void *pdu,
 	if (!length)
 		goto success;
 
-	blob = create_blob(pdu, length, op->offset);
-	if (!blob) {
+	if (!read_long_op_store(op, pdu, length)) {
 		success = false;
 		goto done;
 	}
 
-	queue_push_tail(op->blobs, blob);
 	op->offset += length;
 	if (op->offset > UINT16_MAX)
 		goto success;
 
+	/* Stop once a caller provided buffer is full */
+	if (!op->own_value && !op->chunk &&
+			op->offset - op->orig_offset >= op->value_size)
+		goto success;
+
 	if (length >= bt_att_get_mtu(op->client->att) - 1) {
 		uint8_t pdu[4];
 
@@ -1632,6 +2696,34 @@ done:
 	complete_read_long_op(op, success, att_ecode);
 }
 
+static bool read_long_op_start(struct bt_gatt_client *client,
+						struct read_long_op *op,
+						uint16_t value_handle,
+						uint16_t offset)
+{
+	uint8_t pdu[4];
+
+	op->client = client;
+	op->value_handle = value_handle;
+	op->orig_offset = offset;
+	op->offset = offset;
+
+	put_le16(value_handle, pdu);
+	put_le16(offset, pdu + 2);
+
+	if (!bt_att_send(client->att, BT_ATT_OP_READ_BLOB_REQ, pdu, sizeof(pdu),
+							read_long_cb,
+							read_long_op_ref(op),
+							read_long_op_unref)) {
+		free(op);
+		return false;
+	}
+
+	bulk_op_start(client);
+
+	return true;
+}
+
 bool bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 					uint16_t value_handle, uint16_t offset,
 					bt_gatt_client_read_callback_t callback,
@@ -1639,7 +2731,6 @@ bool bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 					bt_gatt_client_destroy_func_t destroy)
 {
 	struct read_long_op *op;
-	uint8_t pdu[4];
 
 	if (!client)
 		return false;
@@ -1648,32 +2739,129 @@ bool bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 	if (!op)
 		return false;
 
-	op->blobs = queue_new();
-	if (!op->blobs) {
-		free(op);
+	op->own_value = true;
+	op->callback = callback;
+	op->user_data = user_data;
+	op->destroy = destroy;
+
+	return read_long_op_start(client, op, value_handle, offset);
+}
+
+bool bt_gatt_client_read_long_value_buf(struct bt_gatt_client *client,
+					uint16_t value_handle, uint16_t offset,
+					uint8_t *buf, uint16_t size,
+					bt_gatt_client_read_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	struct read_long_op *op;
+
+	if (!client || !buf || !size)
 		return false;
-	}
 
-	op->client = client;
-	op->value_handle = value_handle;
-	op->orig_offset = offset;
-	op->offset = offset;
+	op = new0(struct read_long_op, 1);
+	if (!op)
+		return false;
+
+	op->value = buf;
+	op->value_size = size;
 	op->callback = callback;
 	op->user_data = user_data;
 	op->destroy = destroy;
 
-	put_le16(value_handle, pdu);
-	put_le16(offset, pdu + 2);
+	return read_long_op_start(client, op, value_handle, offset);
+}
 
-	if (!bt_att_send(client->att, BT_ATT_OP_READ_BLOB_REQ, pdu, sizeof(pdu),
-							read_long_cb,
-							read_long_op_ref(op),
-							read_long_op_unref)) {
-		queue_destroy(op->blobs, free);
-		free(op);
+bool bt_gatt_client_read_long_value_stream(struct bt_gatt_client *client,
+					uint16_t value_handle, uint16_t offset,
+				bt_gatt_client_read_chunk_callback_t chunk,
+					bt_gatt_client_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	struct read_long_op *op;
+
+	if (!client || !chunk)
 		return false;
+
+	op = new0(struct read_long_op, 1);
+	if (!op)
+		return false;
+
+	op->chunk = chunk;
+	op->complete = callback;
+	op->user_data = user_data;
+	op->destroy = destroy;
+
+	return read_long_op_start(client, op, value_handle, offset);
+}
+
+bool bt_gatt_client_set_local_csrk(struct bt_gatt_client *client,
+					const uint8_t key[16],
+					uint32_t sign_cnt)
+{
+	if (!client)
+		return false;
+
+	if (!key) {
+		memset(client->csrk, 0, sizeof(client->csrk));
+		client->csrk_set = false;
+		return true;
 	}
 
+	/* The crypto context is only set up once signing is needed */
+	if (!client->crypto) {
+		client->crypto = bt_crypto_new();
+		if (!client->crypto)
+			return false;
+	}
+
+	memcpy(client->csrk, key, sizeof(client->csrk));
+	client->csrk_set = true;
+	client->sign_cnt = sign_cnt;
+
+	return true;
+}
+
+bool bt_gatt_client_get_sign_counter(struct bt_gatt_client *client,
+							uint32_t *sign_cnt)
+{
+	if (!client || !client->csrk_set || !sign_cnt)
+		return false;
+
+	*sign_cnt = client->sign_cnt;
+
+	return true;
+}
+
+static bool write_signed(struct bt_gatt_client *client, uint16_t value_handle,
+					uint8_t *value, uint16_t length)
+{
+	uint8_t pdu[1 + 2 + length + 12];
+
+	if (!client->csrk_set)
+		return false;
+
+	if (sizeof(pdu) > bt_att_get_mtu(client->att))
+		return false;
+
+	/* The signature covers the opcode too */
+	pdu[0] = BT_ATT_OP_SIGNED_WRITE_CMD;
+	put_le16(value_handle, pdu + 1);
+	memcpy(pdu + 3, value, length);
+
+	if (!bt_crypto_sign_att(client->crypto, client->csrk, pdu, 3 + length,
+						client->sign_cnt,
+						pdu + 3 + length))
+		return false;
+
+	if (!bt_att_send(client->att, BT_ATT_OP_SIGNED_WRITE_CMD,
+						pdu + 1, sizeof(pdu) - 1,
+						NULL, NULL, NULL))
+		return false;
+
+	client->sign_cnt++;
+
 	return true;
 }
 
@@ -1686,9 +2874,8 @@ bool bt_gatt_client_write_without_response(struct bt_gatt_client *client,
 	if (!client)
 		return 0;
 
-	/* TODO: Support this once bt_att_send supports signed writes. */
 	if (signed_write)
-		return 0;
+		return write_signed(client, value_handle, value, length);
 
 	put_le16(value_handle, pdu);
 	memcpy(pdu + 2, value, length);
@@ -1768,6 +2955,13 @@ bool bt_gatt_client_write_value(struct bt_gatt_client *client,
 	return true;
 }
 
+struct long_write_op;
+
+struct prep_write_req {
+	struct long_write_op *op;
+	unsigned int index;
+};
+
 struct long_write_op {
 	struct bt_gatt_client *client;
 	int ref_count;
@@ -1776,11 +2970,20 @@ struct long_write_op {
 	uint8_t att_ecode;
 	bool reliable_error;
 	uint16_t value_handle;
-	uint8_t *value;
 	uint16_t length;
 	uint16_t offset;
-	uint16_t index;
-	uint16_t cur_length;
+
+	/* All Prepare Write PDUs are built once, back to back, so they can be
+	 * sent without copying and compared against the responses directly.
+	 */
+	uint8_t *pdus;
+	uint16_t chunk_len;
+	unsigned int num_chunks;
+	unsigned int next_chunk;
+	unsigned int done_chunks;
+	unsigned int pending;
+	struct prep_write_req *reqs;
+
 	bt_gatt_client_write_long_callback_t callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
@@ -1793,6 +2996,13 @@ static struct long_write_op *long_write_op_ref(struct long_write_op *op)
 	return op;
 }
 
+static void long_write_op_free(struct long_write_op *op)
+{
+	free(op->pdus);
+	free(op->reqs);
+	free(op);
+}
+
 static void long_write_op_unref(void *data)
 {
 	struct long_write_op *op = data;
@@ -1803,8 +3013,22 @@ static void long_write_op_unref(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->value);
-	free(op);
+	long_write_op_free(op);
+}
+
+static void prep_write_req_unref(void *data)
+{
+	struct prep_write_req *req = data;
+
+	long_write_op_unref(req->op);
+}
+
+static uint8_t *prep_write_pdu(struct long_write_op *op, unsigned int index,
+							uint16_t *len)
+{
+	*len = MIN(op->chunk_len, op->length - index * op->chunk_len) + 4;
+
+	return op->pdus + index * (op->chunk_len + 4);
 }
 
 static void prepare_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
@@ -1812,41 +3036,43 @@ static void prepare_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
 static void complete_write_long_op(struct long_write_op *op, bool success,
 					uint8_t att_ecode, bool reliable_error);
 
-static void handle_next_prep_write(struct long_write_op *op)
+static unsigned int prep_window(struct bt_gatt_client *client)
 {
-	bool success = true;
-	uint8_t *pdu;
+	if (client->prep_window)
+		return client->prep_window;
 
-	pdu = malloc(op->cur_length + 4);
-	if (!pdu) {
-		success = false;
-		goto done;
-	}
-
-	put_le16(op->value_handle, pdu);
-	put_le16(op->offset + op->index, pdu + 2);
-	memcpy(pdu + 4, op->value + op->index, op->cur_length);
+	/* By default keep one Prepare Write in flight per bearer */
+	return MAX(bt_att_get_channels(client->att), 1u);
+}
 
-	if (!bt_att_send(op->client->att, BT_ATT_OP_PREP_WRITE_REQ,
-							pdu, op->cur_length + 4,
-							prepare_write_cb,
-							long_write_op_ref(op),
-							long_write_op_unref)) {
-		long_write_op_unref(op);
-		success = false;
-	}
+static void send_prep_writes(struct long_write_op *op)
+{
+	unsigned int window = prep_window(op->client);
+	struct prep_write_req *req;
+	uint8_t *pdu;
+	uint16_t len;
 
-	free(pdu);
+	while (op->success && op->pending < window &&
+					op->next_chunk < op->num_chunks) {
+		req = &op->reqs[op->next_chunk];
+		pdu = prep_write_pdu(op, op->next_chunk, &len);
 
-	/* If so far successful, then the operation should continue.
-	 * Otherwise, there was an error and the procedure should be
-	 * completed.
-	 */
-	if (success)
-		return;
+		/* Only take the request's reference once it is queued, the
+		 * caller still needs the op if the send fails.
+		 */
+		if (!bt_att_send_buf(op->client->att,
+						BT_ATT_OP_PREP_WRITE_REQ,
+						pdu, len, NULL, NULL,
+						prepare_write_cb, req,
+						prep_write_req_unref)) {
+			op->success = false;
+			break;
+		}
 
-done:
-	complete_write_long_op(op, success, 0, false);
+		long_write_op_ref(op);
+		op->next_chunk++;
+		op->pending++;
+	}
 }
 
 static void start_next_long_write(struct bt_gatt_client *client)
@@ -1862,10 +3088,13 @@ static void start_next_long_write(struct bt_gatt_client *client)
 	if (!op)
 		return;
 
-	handle_next_prep_write(op);
+	send_prep_writes(op);
+	if (!op->pending)
+		complete_write_long_op(op, false, 0, false);
 
-	/* send_next_prep_write adds an extra ref. Unref here to clean up if
-	 * necessary, since we also added a ref before pushing to the queue.
+	/* send_prep_writes adds an extra ref per request. Unref here to clean
+	 * up if necessary, since we also added a ref before pushing to the
+	 * queue.
 	 */
 	long_write_op_unref(op);
 }
@@ -1883,6 +3112,8 @@ static void execute_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
 	} else if (opcode != BT_ATT_OP_EXEC_WRITE_RSP || pdu || length)
 		success = false;
 
+	bulk_op_end(op->client);
+
 	if (op->callback)
 		op->callback(success, op->reliable_error, att_ecode,
 								op->user_data);
@@ -1914,6 +3145,8 @@ static void complete_write_long_op(struct long_write_op *op, bool success,
 	long_write_op_unref(op);
 	success = false;
 
+	bulk_op_end(op->client);
+
 	if (op->callback)
 		op->callback(success, reliable_error, att_ecode, op->user_data);
 
@@ -1923,63 +3156,61 @@ static void complete_write_long_op(struct long_write_op *op, bool success,
 static void prepare_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
 								void *user_data)
 {
-	struct long_write_op *op = user_data;
-	bool success = true;
-	bool reliable_error = false;
-	uint8_t att_ecode = 0;
-	uint16_t next_index;
+	struct prep_write_req *req = user_data;
+	struct long_write_op *op = req->op;
+	const uint8_t *sent;
+	uint16_t sent_len;
+
+	op->pending--;
+
+	/* Only the first failure is reported, later responses are drained */
+	if (!op->success)
+		goto done;
 
 	if (opcode == BT_ATT_OP_ERROR_RSP) {
-		success = false;
-		att_ecode = process_error(pdu, length);
+		op->success = false;
+		op->att_ecode = process_error(pdu, length);
 		goto done;
 	}
 
 	if (opcode != BT_ATT_OP_PREP_WRITE_RSP) {
-		success = false;
+		op->success = false;
 		goto done;
 	}
 
 	if (op->reliable) {
-		if (!pdu || length != (op->cur_length + 4)) {
-			success = false;
-			reliable_error = true;
-			goto done;
-		}
+		sent = prep_write_pdu(op, req->index, &sent_len);
 
-		if (get_le16(pdu) != op->value_handle ||
-				get_le16(pdu + 2) != (op->offset + op->index)) {
-			success = false;
-			reliable_error = true;
-			goto done;
-		}
-
-		if (memcmp(pdu + 4, op->value + op->index, op->cur_length)) {
-			success = false;
-			reliable_error = true;
+		if (!pdu || length != sent_len ||
+					memcmp(pdu, sent, sent_len)) {
+			op->success = false;
+			op->reliable_error = true;
 			goto done;
 		}
 	}
 
-	next_index = op->index + op->cur_length;
-	if (next_index == op->length) {
-		/* All bytes written */
-		goto done;
-	}
+	op->done_chunks++;
+	send_prep_writes(op);
 
-	/* If the last written length was greater than or equal to what can fit
-	 * inside a PDU, then there is more data to send.
-	 */
-	if (op->cur_length >= bt_att_get_mtu(op->client->att) - 5) {
-		op->index = next_index;
-		op->cur_length = MIN(op->length - op->index,
-					bt_att_get_mtu(op->client->att) - 5);
-		handle_next_prep_write(op);
+done:
+	/* The Execute Write must not overtake any outstanding request */
+	if (op->pending)
 		return;
-	}
 
-done:
-	complete_write_long_op(op, success, att_ecode, reliable_error);
+	complete_write_long_op(op, op->success &&
+					op->done_chunks == op->num_chunks,
+					op->att_ecode, op->reliable_error);
+}
+
+bool bt_gatt_client_set_prepare_window(struct bt_gatt_client *client,
+							unsigned int window)
+{
+	if (!client)
+		return false;
+
+	client->prep_window = window;
+
+	return true;
 }
 
 bool bt_gatt_client_write_long_value(struct bt_gatt_client *client,
@@ -1991,8 +3222,9 @@ bool bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 				bt_gatt_client_destroy_func_t destroy)
 {
 	struct long_write_op *op;
+	unsigned int i;
 	uint8_t *pdu;
-	bool status;
+	uint16_t len;
 
 	if (!client)
 		return false;
@@ -2010,20 +3242,33 @@ bool bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 	if (!op)
 		return false;
 
-	op->value = malloc(length);
-	if (!op->value) {
-		free(op);
+	op->chunk_len = bt_att_get_mtu(client->att) - 5;
+	op->num_chunks = (length + op->chunk_len - 1) / op->chunk_len;
+	op->length = length;
+
+	op->pdus = malloc(op->num_chunks * (op->chunk_len + 4));
+	op->reqs = new0(struct prep_write_req, op->num_chunks);
+	if (!op->pdus || !op->reqs) {
+		long_write_op_free(op);
 		return false;
 	}
 
-	memcpy(op->value, value, length);
+	for (i = 0; i < op->num_chunks; i++) {
+		pdu = prep_write_pdu(op, i, &len);
+
+		put_le16(value_handle, pdu);
+		put_le16(offset + i * op->chunk_len, pdu + 2);
+		memcpy(pdu + 4, value + i * op->chunk_len, len - 4);
+
+		op->reqs[i].op = op;
+		op->reqs[i].index = i;
+	}
 
 	op->client = client;
 	op->reliable = reliable;
+	op->success = true;
 	op->value_handle = value_handle;
-	op->length = length;
 	op->offset = offset;
-	op->cur_length = MIN(length, bt_att_get_mtu(client->att) - 5);
 	op->callback = callback;
 	op->user_data = user_data;
 	op->destroy = destroy;
@@ -2031,35 +3276,205 @@ bool bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 	if (client->in_long_write) {
 		queue_push_tail(client->long_write_queue,
 						long_write_op_ref(op));
+		bulk_op_start(client);
 		return true;
 	}
 
-	pdu = malloc(op->cur_length + 4);
-	if (!pdu) {
-		free(op->value);
-		free(op);
+	send_prep_writes(op);
+
+	/* Nothing was queued so no reference was taken; free the op without
+	 * calling destroy since the caller is told the write failed.
+	 */
+	if (!op->pending) {
+		long_write_op_free(op);
 		return false;
 	}
 
-	put_le16(value_handle, pdu);
-	put_le16(offset, pdu + 2);
-	memcpy(pdu + 4, op->value, op->cur_length);
+	client->in_long_write = true;
+	bulk_op_start(client);
 
-	status = bt_att_send(client->att, BT_ATT_OP_PREP_WRITE_REQ,
-							pdu, op->cur_length + 4,
-							prepare_write_cb,
-							long_write_op_ref(op),
-							long_write_op_unref);
+	return true;
+}
 
-	free(pdu);
+static bool chrc_can_notify(struct chrc_data *chrc)
+{
+	/* Without descriptors known yet, rely on the properties alone */
+	if (chrc->descs_known && !chrc->ccc_handle)
+		return false;
 
-	if (!status) {
-		free(op->value);
+	return !!(chrc->chrc_external.properties & (BT_GATT_CHRC_PROP_NOTIFY |
+						BT_GATT_CHRC_PROP_INDICATE));
+}
+
+struct desc_disc_op {
+	struct bt_gatt_client *client;
+	uint16_t value_handle;
+};
+
+static void complete_desc_discovery(struct chrc_data *chrc, bool success,
+							uint8_t att_ecode)
+{
+	struct desc_waiter *waiter;
+	struct notify_data *notify_data;
+
+	chrc->descs_pending = false;
+	chrc->descs_known = success;
+
+	while ((waiter = queue_pop_head(chrc->desc_waiters))) {
+		if (waiter->callback)
+			waiter->callback(success, att_ecode, waiter->user_data);
+
+		desc_waiter_free(waiter);
+	}
+
+	/* Now that the CCC descriptor is known, process the registrations
+	 * that were queued meanwhile.
+	 */
+	while ((notify_data = queue_pop_head(chrc->reg_notify_queue))) {
+		if (chrc->ccc_handle && notify_data_write_ccc(notify_data, true,
+							enable_ccc_callback))
+			return;
+
+		notify_data->callback(0, att_ecode, notify_data->user_data);
+		notify_data_unref(notify_data);
+	}
+}
+
+static void lazy_descs_cb(bool success, uint8_t att_ecode,
+						struct bt_gatt_result *result,
+						void *user_data)
+{
+	struct desc_disc_op *op = user_data;
+	struct bt_gatt_client *client = op->client;
+	struct bt_gatt_iter iter;
+	struct chrc_data *chrc;
+	uint8_t uuid[BT_GATT_UUID_SIZE];
+	uint16_t handle;
+
+	/* The characteristic may have gone away with a Service Changed */
+	chrc = gatt_client_find_chrc(client, op->value_handle);
+	if (!chrc || !chrc->descs_pending)
+		return;
+
+	if (!success) {
+		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
+			success = true;
+			att_ecode = 0;
+		}
+
+		goto done;
+	}
+
+	if (!result || !bt_gatt_iter_init(&iter, result)) {
+		success = false;
+		goto done;
+	}
+
+	util_debug(client->debug_callback, client->debug_data,
+				"Descriptors found for 0x%04x: %u",
+				op->value_handle,
+				bt_gatt_result_descriptor_count(result));
+
+	while (bt_gatt_iter_next_descriptor(&iter, &handle, uuid)) {
+		if (!chrc_add_desc(chrc, handle, uuid)) {
+			success = false;
+			goto done;
+		}
+	}
+
+done:
+	if (success)
+		gatt_client_store_cache(client);
+
+	complete_desc_discovery(chrc, success, att_ecode);
+}
+
+static bool start_desc_discovery(struct bt_gatt_client *client,
+						struct chrc_data *chrc)
+{
+	struct desc_disc_op *op;
+
+	if (chrc->descs_pending)
+		return true;
+
+	if (!chrc->desc_waiters) {
+		chrc->desc_waiters = queue_new();
+		if (!chrc->desc_waiters)
+			return false;
+	}
+
+	op = new0(struct desc_disc_op, 1);
+	if (!op)
+		return false;
+
+	op->client = client;
+	op->value_handle = chrc->chrc_external.value_handle;
+
+	if (!bt_gatt_discover_descriptors(client->att,
+					chrc->chrc_external.value_handle + 1,
+					chrc->chrc_external.end_handle,
+					lazy_descs_cb, op, free)) {
 		free(op);
 		return false;
 	}
 
-	client->in_long_write = true;
+	chrc->descs_pending = true;
+
+	return true;
+}
+
+bool bt_gatt_client_set_lazy_descriptors(struct bt_gatt_client *client,
+								bool enable)
+{
+	/* Has to be set before characteristic discovery completes */
+	if (!client || client->ready)
+		return false;
+
+	client->lazy_descs = enable;
+
+	return true;
+}
+
+bool bt_gatt_client_discover_descriptors(struct bt_gatt_client *client,
+					uint16_t value_handle,
+					bt_gatt_client_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	struct chrc_data *chrc;
+	struct desc_waiter *waiter;
+
+	if (!client || !client->ready || client->in_svc_chngd)
+		return false;
+
+	chrc = gatt_client_find_chrc(client, value_handle);
+	if (!chrc)
+		return false;
+
+	if (chrc->descs_known) {
+		if (callback)
+			callback(true, 0, user_data);
+
+		if (destroy)
+			destroy(user_data);
+
+		return true;
+	}
+
+	waiter = new0(struct desc_waiter, 1);
+	if (!waiter)
+		return false;
+
+	waiter->callback = callback;
+	waiter->user_data = user_data;
+	waiter->destroy = destroy;
+
+	if (!start_desc_discovery(client, chrc)) {
+		free(waiter);
+		return false;
+	}
+
+	queue_push_tail(chrc->desc_waiters, waiter);
 
 	return true;
 }
@@ -2072,11 +3487,7 @@ bool bt_gatt_client_register_notify(struct bt_gatt_client *client,
 				bt_gatt_client_destroy_func_t destroy)
 {
 	struct notify_data *notify_data;
-	struct service_list *svc_data = NULL;
-	struct chrc_data *chrc = NULL;
-	struct bt_gatt_service_iter iter;
-	const bt_gatt_service_t *service;
-	size_t i;
+	struct chrc_data *chrc;
 
 	if (!client || !chrc_value_handle || !callback)
 		return false;
@@ -2084,31 +3495,14 @@ bool bt_gatt_client_register_notify(struct bt_gatt_client *client,
 	if (!bt_gatt_client_is_ready(client) || client->in_svc_chngd)
 		return false;
 
-	/* Check that chrc_value_handle belongs to a known characteristic */
-	if (!bt_gatt_service_iter_init(&iter, client))
+	if (client->in_init)
 		return false;
 
-	while (bt_gatt_service_iter_next(&iter, &service)) {
-		if (chrc_value_handle >= service->start_handle &&
-				chrc_value_handle <= service->end_handle) {
-			svc_data = (struct service_list *) service;
-			break;
-		}
-	}
-
-	if (!svc_data)
-		return false;
-
-	for (i = 0; i < svc_data->num_chrcs; i++) {
-		if (svc_data->chrcs[i].chrc_external.value_handle ==
-							chrc_value_handle) {
-			chrc = svc_data->chrcs + i;
-			break;
-		}
-	}
+	/* Check that chrc_value_handle belongs to a known characteristic */
+	chrc = gatt_client_find_chrc(client, chrc_value_handle);
 
 	/* Check that the characteristic supports notifications/indications */
-	if (!chrc || !chrc->ccc_handle || chrc->notify_count == INT_MAX)
+	if (!chrc || !chrc_can_notify(chrc) || chrc->notify_count == INT_MAX)
 		return false;
 
 	notify_data = new0(struct notify_data, 1);
@@ -2123,6 +3517,17 @@ bool bt_gatt_client_register_notify(struct bt_gatt_client *client,
 	notify_data->user_data = user_data;
 	notify_data->destroy = destroy;
 
+	/* The CCC descriptor has to be discovered first */
+	if (!chrc->descs_known) {
+		if (!start_desc_discovery(client, chrc)) {
+			free(notify_data);
+			return false;
+		}
+
+		queue_push_tail(chrc->reg_notify_queue, notify_data);
+		return true;
+	}
+
 	/* If a write to the CCC descriptor is in progress, then queue this
 	 * request.
 	 */
@@ -2147,6 +3552,102 @@ bool bt_gatt_client_register_notify(struct bt_gatt_client *client,
 	return true;
 }
 
+struct notify_group {
+	int ref_count;
+	bt_gatt_client_notify_id_callback_t callback;
+	bt_gatt_client_notify_callback_t notify;
+	void *user_data;
+	bt_gatt_client_destroy_func_t destroy;
+};
+
+static void notify_group_unref(void *data)
+{
+	struct notify_group *group = data;
+
+	if (__sync_sub_and_fetch(&group->ref_count, 1))
+		return;
+
+	if (group->destroy)
+		group->destroy(group->user_data);
+
+	free(group);
+}
+
+static void notify_group_id_cb(unsigned int id, uint16_t att_ecode,
+							void *user_data)
+{
+	struct notify_group *group = user_data;
+
+	group->callback(id, att_ecode, group->user_data);
+}
+
+static void notify_group_cb(uint16_t value_handle, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct notify_group *group = user_data;
+
+	if (group->notify)
+		group->notify(value_handle, value, length, group->user_data);
+}
+
+bool bt_gatt_client_register_notify_multiple(struct bt_gatt_client *client,
+				const uint16_t *value_handles,
+				size_t num_handles,
+				bt_gatt_client_notify_id_callback_t callback,
+				bt_gatt_client_notify_callback_t notify,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy)
+{
+	struct notify_group *group;
+	struct chrc_data *chrc;
+	size_t i;
+
+	if (!client || !value_handles || !num_handles || !callback)
+		return false;
+
+	if (!bt_gatt_client_is_ready(client) || client->in_svc_chngd)
+		return false;
+
+	/* Validate every handle first so that nothing is registered if one of
+	 * them can't be.
+	 */
+	for (i = 0; i < num_handles; i++) {
+		chrc = gatt_client_find_chrc(client, value_handles[i]);
+		if (!chrc || !chrc_can_notify(chrc))
+			return false;
+	}
+
+	group = new0(struct notify_group, 1);
+	if (!group)
+		return false;
+
+	group->ref_count = 1;
+	group->callback = callback;
+	group->notify = notify;
+	group->user_data = user_data;
+	group->destroy = destroy;
+
+	/* All CCC writes get queued at once, so they go out back to back and
+	 * across all bearers rather than one per caller round trip.
+	 */
+	for (i = 0; i < num_handles; i++) {
+		__sync_fetch_and_add(&group->ref_count, 1);
+
+		if (bt_gatt_client_register_notify(client, value_handles[i],
+						notify_group_id_cb,
+						notify_group_cb, group,
+						notify_group_unref))
+			continue;
+
+		callback(0, 0, user_data);
+		notify_group_unref(group);
+	}
+
+	notify_group_unref(group);
+
+	return true;
+}
+
 bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 							unsigned int id)
 {
@@ -2155,8 +3656,7 @@ bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 	if (!client || !id)
 		return false;
 
-	notify_data = queue_find(client->notify_list, match_notify_data_id,
-							UINT_TO_PTR(id));
+	notify_data = idmap_lookup(client->notify_list, id);
 	if (!notify_data || notify_data->removed)
 		return false;
 
@@ -2164,7 +3664,7 @@ bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 	assert(!notify_data->chrc->ccc_write_id);
 
 	if (!client->in_notify) {
-		queue_remove(client->notify_list, notify_data);
+		idmap_remove(client->notify_list, id);
 		complete_unregister_notify(notify_data);
 		return true;
 	}
@@ -40,6 +40,9 @@
 struct bt_gatt_client;
 
 struct bt_gatt_client *bt_gatt_client_new(struct bt_att *att, uint16_t mtu);
+struct bt_gatt_client *bt_gatt_client_new_with_cache(struct bt_att *att,
+							uint16_t mtu,
+							const char *cache_path);
 
 struct bt_gatt_client *bt_gatt_client_ref(struct bt_gatt_client *client);
 void bt_gatt_client_unref(struct bt_gatt_client *client);
@@ -58,11 +61,23 @@ typedef void (*bt_gatt_client_notify_id_callback_t)(unsigned int id,
 							uint16_t att_ecode,
 							void *user_data);
 
+#define BT_GATT_CLIENT_LINK_IDLE	0x00
+#define BT_GATT_CLIENT_LINK_DISCOVERY	0x01
+#define BT_GATT_CLIENT_LINK_BULK	0x02
+
+typedef void (*bt_gatt_client_link_callback_t)(uint8_t state, uint16_t mtu,
+							void *user_data);
+
 bool bt_gatt_client_is_ready(struct bt_gatt_client *client);
+uint16_t bt_gatt_client_get_mtu(struct bt_gatt_client *client);
 bool bt_gatt_client_set_ready_handler(struct bt_gatt_client *client,
 					bt_gatt_client_callback_t callback,
 					void *user_data,
 					bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_set_link_handler(struct bt_gatt_client *client,
+					bt_gatt_client_link_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy);
 bool bt_gatt_client_set_debug(struct bt_gatt_client *client,
 					bt_gatt_client_debug_func_t callback,
 					void *user_data,
@@ -118,18 +133,45 @@ bool bt_gatt_characteristic_iter_next(struct bt_gatt_characteristic_iter *iter,
 typedef void (*bt_gatt_client_read_callback_t)(bool success, uint8_t att_ecode,
 					const uint8_t *value, uint16_t length,
 					void *user_data);
+typedef void (*bt_gatt_client_read_chunk_callback_t)(uint16_t offset,
+					const uint8_t *value, uint16_t length,
+					void *user_data);
 
 bool bt_gatt_client_read_value(struct bt_gatt_client *client,
 					uint16_t value_handle,
 					bt_gatt_client_read_callback_t callback,
 					void *user_data,
 					bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_read_multiple(struct bt_gatt_client *client,
+					uint16_t *handles, uint8_t num_handles,
+					bt_gatt_client_read_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_set_read_coalescing(struct bt_gatt_client *client,
+								bool enable);
 bool bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 					uint16_t value_handle, uint16_t offset,
 					bt_gatt_client_read_callback_t callback,
 					void *user_data,
 					bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_read_long_value_buf(struct bt_gatt_client *client,
+					uint16_t value_handle, uint16_t offset,
+					uint8_t *buf, uint16_t size,
+					bt_gatt_client_read_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_read_long_value_stream(struct bt_gatt_client *client,
+					uint16_t value_handle, uint16_t offset,
+				bt_gatt_client_read_chunk_callback_t chunk,
+					bt_gatt_client_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy);
 
+bool bt_gatt_client_set_local_csrk(struct bt_gatt_client *client,
+					const uint8_t key[16],
+					uint32_t sign_cnt);
+bool bt_gatt_client_get_sign_counter(struct bt_gatt_client *client,
+							uint32_t *sign_cnt);
 bool bt_gatt_client_write_without_response(struct bt_gatt_client *client,
 					uint16_t value_handle,
 					bool signed_write,
@@ -140,6 +182,8 @@ bool bt_gatt_client_write_value(struct bt_gatt_client *client,
 					bt_gatt_client_callback_t callback,
 					void *user_data,
 					bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_set_prepare_window(struct bt_gatt_client *client,
+							unsigned int window);
 bool bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 				bool reliable,
 				uint16_t value_handle, uint16_t offset,
@@ -148,11 +192,26 @@ bool bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 				void *user_data,
 				bt_gatt_client_destroy_func_t destroy);
 
+bool bt_gatt_client_set_lazy_descriptors(struct bt_gatt_client *client,
+								bool enable);
+bool bt_gatt_client_discover_descriptors(struct bt_gatt_client *client,
+					uint16_t value_handle,
+					bt_gatt_client_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy);
+
 bool bt_gatt_client_register_notify(struct bt_gatt_client *client,
 				uint16_t chrc_value_handle,
 				bt_gatt_client_notify_id_callback_t callback,
 				bt_gatt_client_notify_callback_t notify,
 				void *user_data,
 				bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_register_notify_multiple(struct bt_gatt_client *client,
+				const uint16_t *value_handles,
+				size_t num_handles,
+				bt_gatt_client_notify_id_callback_t callback,
+				bt_gatt_client_notify_callback_t notify,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy);
 bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 							unsigned int id);
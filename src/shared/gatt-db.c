@@ -22,12 +22,24 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
 
 #include "lib/uuid.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/crypto.h"
+#include "src/shared/handle-alloc.h"
+#include "src/shared/att-types.h"
 #include "src/shared/gatt-db.h"
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 #define MAX_CHAR_DECL_VALUE_LEN 19
 #define MAX_INCLUDED_VALUE_LEN 6
 
@@ -39,88 +51,449 @@ static const bt_uuid_t characteristic_uuid = { .type = BT_UUID16,
 					.value.u16 = GATT_CHARAC_UUID };
 static const bt_uuid_t included_service_uuid = { .type = BT_UUID16,
 					.value.u16 = GATT_INCLUDE_UUID };
+static const bt_uuid_t ccc_uuid = { .type = BT_UUID16,
+				.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID };
+
+/*
+ * Attribute types with a per-type handle index. These are interned first
+ * so that their type ids match their position here.
+ */
+static const bt_uuid_t *indexed_types[] = {
+	&primary_service_uuid,
+	&secondary_service_uuid,
+	&included_service_uuid,
+	&characteristic_uuid,
+	&ccc_uuid,
+};
+
+#define NUM_INDEXED_TYPES (sizeof(indexed_types) / sizeof(indexed_types[0]))
+
+struct handle_list {
+	uint16_t *handles;
+	unsigned int len;
+	unsigned int size;
+};
 
 struct gatt_db {
-	uint16_t next_handle;
+	struct handle_alloc *alloc;
 	struct queue *services;
+
+	/* Service owning each handle, indexed by handle */
+	struct gatt_db_service **handles;
+	unsigned int handles_len;
+
+	/* Attribute types, indexed by type id */
+	bt_uuid_t **types;
+	unsigned int types_len;
+
+	/* Sorted handles of the attributes of each indexed type */
+	struct handle_list type_index[NUM_INDEXED_TYPES];
+
+	uint32_t generation;
+	struct bt_crypto *crypto;
+	uint8_t hash[16];
+	bool hash_valid;
+
+	/* Asynchronous reads and writes waiting for gatt_db_complete() */
+	struct queue *ops;
+	unsigned int next_op_id;
 };
 
 struct gatt_db_attribute {
 	uint16_t handle;
-	bt_uuid_t uuid;
-	uint32_t permissions;
+	uint16_t type;
 	uint16_t value_len;
-	uint8_t *value;
+	uint32_t permissions;
 
-	gatt_db_read_t read_func;
-	gatt_db_write_t write_func;
+	/* Values that fit in the pointer are stored inline */
+	union {
+		uint8_t *ptr;
+		uint8_t buf[sizeof(uint8_t *)];
+	} value;
+
+	/* Callbacks are the asynchronous variants if "async" is set */
+	bool async;
+	union {
+		gatt_db_read_t sync;
+		gatt_db_read_async_t async;
+	} read_func;
+	union {
+		gatt_db_write_t sync;
+		gatt_db_write_async_t async;
+	} write_func;
 	void *user_data;
 };
 
 struct gatt_db_service {
 	bool active;
 	uint16_t num_handles;
-	struct gatt_db_attribute **attributes;
+	struct gatt_db_attribute attributes[0];
 };
 
-static bool match_service_by_handle(const void *data, const void *user_data)
+static uint8_t *attribute_value(struct gatt_db_attribute *attribute)
 {
-	const struct gatt_db_service *service = data;
+	if (attribute->value_len > sizeof(attribute->value.buf))
+		return attribute->value.ptr;
 
-	return service->attributes[0]->handle == PTR_TO_INT(user_data);
+	return attribute->value.buf;
 }
 
-static struct gatt_db_attribute *new_attribute(const bt_uuid_t *type,
-							const uint8_t *val,
-							uint16_t len)
+static struct gatt_db_service *find_service(struct gatt_db *db,
+							uint16_t handle)
+{
+	if (handle >= db->handles_len)
+		return NULL;
+
+	return db->handles[handle];
+}
+
+/* Returns the service whose declaration is at "handle" */
+static struct gatt_db_service *find_service_by_handle(struct gatt_db *db,
+							uint16_t handle)
+{
+	struct gatt_db_service *service;
+
+	service = find_service(db, handle);
+	if (!service || service->attributes[0].handle != handle)
+		return NULL;
+
+	return service;
+}
+
+static struct gatt_db_attribute *find_attribute(struct gatt_db *db,
+							uint16_t handle)
 {
+	struct gatt_db_service *service;
 	struct gatt_db_attribute *attribute;
 
-	attribute = new0(struct gatt_db_attribute, 1);
-	if (!attribute)
+	service = find_service(db, handle);
+	if (!service)
 		return NULL;
 
-	attribute->uuid = *type;
-	attribute->value_len = len;
-	if (len) {
-		attribute->value = malloc0(len);
-		if (!attribute->value) {
-			free(attribute);
-			return NULL;
-		}
+	attribute = &service->attributes[handle -
+					service->attributes[0].handle];
+
+	return attribute->handle ? attribute : NULL;
+}
+
+static bool index_service(struct gatt_db *db, uint16_t start,
+					uint16_t num_handles,
+					struct gatt_db_service *service)
+{
+	struct gatt_db_service **handles;
+	unsigned int len = start + num_handles;
+
+	if (len > db->handles_len) {
+		len = MAX(len, db->handles_len * 2);
+		len = MIN(len, UINT16_MAX + 1);
+
+		handles = realloc(db->handles, len * sizeof(*handles));
+		if (!handles)
+			return false;
+
+		memset(handles + db->handles_len, 0,
+				(len - db->handles_len) * sizeof(*handles));
+
+		db->handles = handles;
+		db->handles_len = len;
+	}
+
+	for (len = start; len < start + num_handles; len++)
+		db->handles[len] = service;
+
+	return true;
+}
+
+static bool uuid_match(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
+{
+	if (uuid1->type == BT_UUID16 && uuid2->type == BT_UUID16)
+		return uuid1->value.u16 == uuid2->value.u16;
+
+	return !bt_uuid_cmp(uuid1, uuid2);
+}
+
+static int find_type(struct gatt_db *db, const bt_uuid_t *uuid)
+{
+	unsigned int i;
+
+	for (i = 0; i < db->types_len; i++) {
+		if (uuid_match(uuid, db->types[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Returns the type id of "uuid", adding it to the type table if needed */
+static int intern_type(struct gatt_db *db, const bt_uuid_t *uuid)
+{
+	bt_uuid_t **types;
+	int id;
+
+	id = find_type(db, uuid);
+	if (id >= 0)
+		return id;
 
-		memcpy(attribute->value, val, len);
+	if (db->types_len > UINT16_MAX)
+		return -1;
+
+	types = realloc(db->types, (db->types_len + 1) * sizeof(*types));
+	if (!types)
+		return -1;
+
+	db->types = types;
+
+	types[db->types_len] = new0(bt_uuid_t, 1);
+	if (!types[db->types_len])
+		return -1;
+
+	*types[db->types_len] = *uuid;
+
+	return db->types_len++;
+}
+
+static struct handle_list *type_list(struct gatt_db *db, unsigned int type)
+{
+	if (type >= NUM_INDEXED_TYPES)
+		return NULL;
+
+	return &db->type_index[type];
+}
+
+/* Returns the position of the first handle not lower than "handle" */
+static unsigned int handle_list_find(struct handle_list *list,
+							uint16_t handle)
+{
+	unsigned int low = 0, high = list->len;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+
+		if (list->handles[mid] < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool handle_list_insert(struct handle_list *list, uint16_t handle)
+{
+	unsigned int pos;
+
+	if (list->len == list->size) {
+		unsigned int size = MAX(list->size * 2, 8);
+		uint16_t *handles;
+
+		handles = realloc(list->handles, size * sizeof(*handles));
+		if (!handles)
+			return false;
+
+		list->handles = handles;
+		list->size = size;
+	}
+
+	pos = handle_list_find(list, handle);
+	memmove(list->handles + pos + 1, list->handles + pos,
+				(list->len - pos) * sizeof(*list->handles));
+	list->handles[pos] = handle;
+	list->len++;
+
+	return true;
+}
+
+static void handle_list_remove(struct handle_list *list, uint16_t start,
+								uint16_t end)
+{
+	unsigned int first, last;
+
+	first = handle_list_find(list, start);
+	for (last = first; last < list->len; last++) {
+		if (list->handles[last] > end)
+			break;
+	}
+
+	/* The list may never have been allocated */
+	if (first == last)
+		return;
+
+	memmove(list->handles + first, list->handles + last,
+				(list->len - last) * sizeof(*list->handles));
+	list->len -= last - first;
+}
+
+static bool index_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute)
+{
+	struct handle_list *list;
+
+	list = type_list(db, attribute->type);
+	if (!list)
+		return true;
+
+	return handle_list_insert(list, attribute->handle);
+}
+
+static void unindex_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute)
+{
+	struct handle_list *list;
+
+	list = type_list(db, attribute->type);
+	if (list)
+		handle_list_remove(list, attribute->handle, attribute->handle);
+}
+
+static bool init_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute,
+					const bt_uuid_t *type,
+					const uint8_t *val, uint16_t len)
+{
+	int id;
+
+	id = intern_type(db, type);
+	if (id < 0)
+		return false;
+
+	if (len > sizeof(attribute->value.buf)) {
+		attribute->value.ptr = malloc(len);
+		if (!attribute->value.ptr)
+			return false;
 	}
 
-	return attribute;
+	attribute->type = id;
+	attribute->value_len = len;
+	if (len)
+		memcpy(attribute_value(attribute), val, len);
+
+	return true;
 }
 
 static void attribute_destroy(struct gatt_db_attribute *attribute)
 {
-	/* Attribute was not initialized by user */
-	if (!attribute)
+	if (attribute->value_len > sizeof(attribute->value.buf))
+		free(attribute->value.ptr);
+
+	memset(attribute, 0, sizeof(*attribute));
+}
+
+struct gatt_db_op {
+	unsigned int id;
+	uint16_t handle;
+	gatt_db_complete_t func;
+	void *user_data;
+	struct gatt_db_batch *batch;
+	unsigned int index;
+};
+
+struct gatt_db_batch {
+	struct gatt_db_result *results;
+	unsigned int num;
+	unsigned int pending;
+	gatt_db_batch_complete_t func;
+	void *user_data;
+};
+
+static void batch_free(struct gatt_db_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++)
+		free(batch->results[i].value);
+
+	free(batch->results);
+	free(batch);
+}
+
+static void batch_unref(struct gatt_db_batch *batch)
+{
+	if (--batch->pending)
 		return;
 
-	free(attribute->value);
-	free(attribute);
+	if (batch->func)
+		batch->func(batch->results, batch->num, batch->user_data);
+
+	batch_free(batch);
+}
+
+static void batch_result(struct gatt_db_batch *batch, unsigned int index,
+					uint8_t ecode,
+					const uint8_t *value, size_t len)
+{
+	struct gatt_db_result *result = &batch->results[index];
+
+	result->ecode = ecode;
+
+	if (!ecode && len) {
+		result->value = malloc(len);
+		if (result->value) {
+			memcpy(result->value, value, len);
+			result->len = len;
+		} else {
+			result->ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	batch_unref(batch);
+}
+
+static void op_free(void *data)
+{
+	struct gatt_db_op *op = data;
+
+	/* Pending batches are released without being reported */
+	if (op->batch && !--op->batch->pending)
+		batch_free(op->batch);
+
+	free(op);
+}
+
+static void gatt_db_free(struct gatt_db *db)
+{
+	unsigned int i;
+
+	free(db->handles);
+
+	for (i = 0; i < db->types_len; i++)
+		free(db->types[i]);
+
+	free(db->types);
+
+	for (i = 0; i < NUM_INDEXED_TYPES; i++)
+		free(db->type_index[i].handles);
+
+	queue_destroy(db->ops, op_free);
+	handle_alloc_destroy(db->alloc);
+	bt_crypto_unref(db->crypto);
+	free(db);
 }
 
 struct gatt_db *gatt_db_new(void)
 {
 	struct gatt_db *db;
+	unsigned int i;
 
 	db = new0(struct gatt_db, 1);
 	if (!db)
 		return NULL;
 
+	for (i = 0; i < NUM_INDEXED_TYPES; i++) {
+		if (intern_type(db, indexed_types[i]) < 0) {
+			gatt_db_free(db);
+			return NULL;
+		}
+	}
+
 	db->services = queue_new();
-	if (!db->services) {
-		free(db);
+	db->ops = queue_new();
+	db->alloc = handle_alloc_new(0x0001, UINT16_MAX - 1);
+	if (!db->services || !db->ops || !db->alloc) {
+		queue_destroy(db->services, NULL);
+		gatt_db_free(db);
 		return NULL;
 	}
 
-	db->next_handle = 0x0001;
-
 	return db;
 }
 
@@ -130,9 +503,8 @@ static void gatt_db_service_destroy(void *data)
 	int i;
 
 	for (i = 0; i < service->num_handles; i++)
-		attribute_destroy(service->attributes[i]);
+		attribute_destroy(&service->attributes[i]);
 
-	free(service->attributes);
 	free(service);
 }
 
@@ -142,7 +514,13 @@ void gatt_db_destroy(struct gatt_db *db)
 		return;
 
 	queue_destroy(db->services, gatt_db_service_destroy);
-	free(db);
+	gatt_db_free(db);
+}
+
+static void db_changed(struct gatt_db *db)
+{
+	db->generation++;
+	db->hash_valid = false;
 }
 
 static int uuid_to_le(const bt_uuid_t *uuid, uint8_t *dst)
@@ -159,26 +537,59 @@ static int uuid_to_le(const bt_uuid_t *uuid, uint8_t *dst)
 	return bt_uuid_len(&uuid128);
 }
 
+/* Makes a service whose attributes are already set up visible in the db */
+static bool insert_service(struct gatt_db *db,
+					struct gatt_db_service *service)
+{
+	uint16_t start = service->attributes[0].handle;
+	int i;
+
+	if (!index_service(db, start, service->num_handles, service))
+		return false;
+
+	for (i = 0; i < service->num_handles; i++) {
+		if (!service->attributes[i].handle)
+			continue;
+
+		if (!index_attribute(db, &service->attributes[i]))
+			goto fail;
+	}
+
+	if (queue_push_tail(db->services, service)) {
+		db_changed(db);
+		return true;
+	}
+
+fail:
+	while (i-- > 0) {
+		if (service->attributes[i].handle)
+			unindex_attribute(db, &service->attributes[i]);
+	}
+
+	index_service(db, start, service->num_handles, NULL);
+
+	return false;
+}
+
 uint16_t gatt_db_add_service(struct gatt_db *db, const bt_uuid_t *uuid,
 					bool primary, uint16_t num_handles)
 {
 	struct gatt_db_service *service;
+	struct gatt_db_attribute *attribute;
 	const bt_uuid_t *type;
 	uint8_t value[16];
 	uint16_t len;
 
-	if (num_handles < 1 || (num_handles + db->next_handle) > UINT16_MAX)
+	if (num_handles < 1)
 		return 0;
 
-	service = new0(struct gatt_db_service, 1);
+	service = malloc0(sizeof(*service) +
+				num_handles * sizeof(struct gatt_db_attribute));
 	if (!service)
 		return 0;
 
-	service->attributes = new0(struct gatt_db_attribute *, num_handles);
-	if (!service->attributes) {
-		free(service);
-		return 0;
-	}
+	service->num_handles = num_handles;
+	attribute = &service->attributes[0];
 
 	if (primary)
 		type = &primary_service_uuid;
@@ -187,38 +598,46 @@ uint16_t gatt_db_add_service(struct gatt_db *db, const bt_uuid_t *uuid,
 
 	len = uuid_to_le(uuid, value);
 
-	service->attributes[0] = new_attribute(type, value, len);
-	if (!service->attributes[0]) {
+	if (!init_attribute(db, attribute, type, value, len)) {
 		gatt_db_service_destroy(service);
 		return 0;
 	}
 
-	if (!queue_push_tail(db->services, service)) {
+	/* Holes left by removed services are reused */
+	attribute->handle = handle_alloc_get(db->alloc, num_handles);
+	if (!attribute->handle) {
 		gatt_db_service_destroy(service);
 		return 0;
 	}
 
-	/* TODO now we get next handle from database. We should first look
-	 * for 'holes' between existing services first, and assign next_handle
-	 * only if enough space was not found.
-	 */
-	service->attributes[0]->handle = db->next_handle;
-	db->next_handle += num_handles;
-	service->num_handles = num_handles;
+	if (!insert_service(db, service)) {
+		handle_alloc_put(db->alloc, attribute->handle, num_handles);
+		gatt_db_service_destroy(service);
+		return 0;
+	}
 
-	return service->attributes[0]->handle;
+	return attribute->handle;
 }
 
 bool gatt_db_remove_service(struct gatt_db *db, uint16_t handle)
 {
 	struct gatt_db_service *service;
+	unsigned int i;
 
-	service = queue_remove_if(db->services, match_service_by_handle,
-							INT_TO_PTR(handle));
+	service = find_service_by_handle(db, handle);
 	if (!service)
 		return false;
 
+	queue_remove(db->services, service);
+	index_service(db, handle, service->num_handles, NULL);
+	handle_alloc_put(db->alloc, handle, service->num_handles);
+
+	for (i = 0; i < NUM_INDEXED_TYPES; i++)
+		handle_list_remove(&db->type_index[i], handle,
+					handle + service->num_handles - 1);
+
 	gatt_db_service_destroy(service);
+	db_changed(db);
 
 	return true;
 }
@@ -230,7 +649,7 @@ static uint16_t get_attribute_index(struct gatt_db_service *service,
 
 	/* Here we look for first free attribute index with given offset */
 	while (i < (service->num_handles - end_offset) &&
-						service->attributes[i])
+					service->attributes[i].handle)
 		i++;
 
 	return i == (service->num_handles - end_offset) ? 0 : i;
@@ -239,7 +658,7 @@ static uint16_t get_attribute_index(struct gatt_db_service *service,
 static uint16_t get_handle_at_index(struct gatt_db_service *service,
 								int index)
 {
-	return service->attributes[index]->handle;
+	return service->attributes[index].handle;
 }
 
 static uint16_t update_attribute_handle(struct gatt_db_service *service,
@@ -250,10 +669,10 @@ static uint16_t update_attribute_handle(struct gatt_db_service *service,
 	/* We call this function with index > 0, because index 0 is reserved
 	 * for service declaration, and is set in add_service()
 	 */
-	previous_handle = service->attributes[index - 1]->handle;
-	service->attributes[index]->handle = previous_handle + 1;
+	previous_handle = service->attributes[index - 1].handle;
+	service->attributes[index].handle = previous_handle + 1;
 
-	return service->attributes[index]->handle;
+	return service->attributes[index].handle;
 }
 
 static void set_attribute_data(struct gatt_db_attribute *attribute,
@@ -263,8 +682,8 @@ static void set_attribute_data(struct gatt_db_attribute *attribute,
 						void *user_data)
 {
 	attribute->permissions = permissions;
-	attribute->read_func = read_func;
-	attribute->write_func = write_func;
+	attribute->read_func.sync = read_func;
+	attribute->write_func.sync = write_func;
 	attribute->user_data = user_data;
 }
 
@@ -278,11 +697,11 @@ uint16_t gatt_db_add_characteristic(struct gatt_db *db, uint16_t handle,
 {
 	uint8_t value[MAX_CHAR_DECL_VALUE_LEN];
 	struct gatt_db_service *service;
+	struct gatt_db_attribute *decl, *attribute;
 	uint16_t len = 0;
 	int i;
 
-	service = queue_find(db->services, match_service_by_handle,
-							INT_TO_PTR(handle));
+	service = find_service_by_handle(db, handle);
 	if (!service)
 		return 0;
 
@@ -290,6 +709,9 @@ uint16_t gatt_db_add_characteristic(struct gatt_db *db, uint16_t handle,
 	if (!i)
 		return 0;
 
+	decl = &service->attributes[i];
+	attribute = &service->attributes[i + 1];
+
 	value[0] = properties;
 	len += sizeof(properties);
 	/* We set handle of characteristic value, which will be added next */
@@ -297,23 +719,37 @@ uint16_t gatt_db_add_characteristic(struct gatt_db *db, uint16_t handle,
 	len += sizeof(uint16_t);
 	len += uuid_to_le(uuid, &value[3]);
 
-	service->attributes[i] = new_attribute(&characteristic_uuid, value,
-									len);
-	if (!service->attributes[i])
+	if (!init_attribute(db, decl, &characteristic_uuid, value, len))
 		return 0;
 
-	update_attribute_handle(service, i++);
-
-	service->attributes[i] = new_attribute(uuid, NULL, 0);
-	if (!service->attributes[i]) {
-		free(service->attributes[i - 1]);
+	if (!init_attribute(db, attribute, uuid, NULL, 0)) {
+		attribute_destroy(decl);
 		return 0;
 	}
 
-	set_attribute_data(service->attributes[i], read_func, write_func,
-							permissions, user_data);
+	set_attribute_data(attribute, read_func, write_func, permissions,
+								user_data);
+
+	update_attribute_handle(service, i);
+	update_attribute_handle(service, i + 1);
+
+	if (!index_attribute(db, decl))
+		goto fail;
+
+	if (!index_attribute(db, attribute)) {
+		unindex_attribute(db, decl);
+		goto fail;
+	}
+
+	db_changed(db);
+
+	return attribute->handle;
 
-	return update_attribute_handle(service, i);
+fail:
+	attribute_destroy(decl);
+	attribute_destroy(attribute);
+
+	return 0;
 }
 
 uint16_t gatt_db_add_char_descriptor(struct gatt_db *db, uint16_t handle,
@@ -324,10 +760,10 @@ uint16_t gatt_db_add_char_descriptor(struct gatt_db *db, uint16_t handle,
 						void *user_data)
 {
 	struct gatt_db_service *service;
+	struct gatt_db_attribute *attribute;
 	int i;
 
-	service = queue_find(db->services, match_service_by_handle,
-							INT_TO_PTR(handle));
+	service = find_service_by_handle(db, handle);
 	if (!service)
 		return 0;
 
@@ -335,36 +771,48 @@ uint16_t gatt_db_add_char_descriptor(struct gatt_db *db, uint16_t handle,
 	if (!i)
 		return 0;
 
-	service->attributes[i] = new_attribute(uuid, NULL, 0);
-	if (!service->attributes[i])
+	attribute = &service->attributes[i];
+
+	if (!init_attribute(db, attribute, uuid, NULL, 0))
+		return 0;
+
+	set_attribute_data(attribute, read_func, write_func, permissions,
+								user_data);
+
+	update_attribute_handle(service, i);
+
+	if (!index_attribute(db, attribute)) {
+		attribute_destroy(attribute);
 		return 0;
+	}
 
-	set_attribute_data(service->attributes[i], read_func, write_func,
-							permissions, user_data);
+	db_changed(db);
 
-	return update_attribute_handle(service, i);
+	return attribute->handle;
 }
 
 uint16_t gatt_db_add_included_service(struct gatt_db *db, uint16_t handle,
 						uint16_t included_handle)
 {
 	struct gatt_db_service *included_service;
+	struct gatt_db_attribute *included_decl;
 	uint8_t value[MAX_INCLUDED_VALUE_LEN];
 	uint16_t len = 0;
 	struct gatt_db_service *service;
+	struct gatt_db_attribute *attribute;
 	int index;
 
-	service = queue_find(db->services, match_service_by_handle,
-							INT_TO_PTR(handle));
+	service = find_service_by_handle(db, handle);
 	if (!service)
 		return 0;
 
-	included_service = queue_find(db->services, match_service_by_handle,
-						INT_TO_PTR(included_handle));
+	included_service = find_service_by_handle(db, included_handle);
 
 	if (!included_service)
 		return 0;
 
+	included_decl = &included_service->attributes[0];
+
 	put_le16(included_handle, &value[len]);
 	len += sizeof(uint16_t);
 
@@ -375,19 +823,19 @@ uint16_t gatt_db_add_included_service(struct gatt_db *db, uint16_t handle,
 	/* The Service UUID shall only be present when the UUID is a 16-bit
 	 * Bluetooth UUID. Vol 2. Part G. 3.2
 	 */
-	if (included_service->attributes[0]->value_len == sizeof(uint16_t)) {
-		memcpy(&value[len], included_service->attributes[0]->value,
-				included_service->attributes[0]->value_len);
-		len += included_service->attributes[0]->value_len;
+	if (included_decl->value_len == sizeof(uint16_t)) {
+		memcpy(&value[len], attribute_value(included_decl),
+						included_decl->value_len);
+		len += included_decl->value_len;
 	}
 
 	index = get_attribute_index(service, 0);
 	if (!index)
 		return 0;
 
-	service->attributes[index] = new_attribute(&included_service_uuid,
-								value, len);
-	if (!service->attributes[index])
+	attribute = &service->attributes[index];
+
+	if (!init_attribute(db, attribute, &included_service_uuid, value, len))
 		return 0;
 
 	/* The Attribute Permissions shall be read only and not require
@@ -395,9 +843,18 @@ uint16_t gatt_db_add_included_service(struct gatt_db *db, uint16_t handle,
 	 *
 	 * TODO handle permissions
 	 */
-	set_attribute_data(service->attributes[index], NULL, NULL, 0, NULL);
+	set_attribute_data(attribute, NULL, NULL, 0, NULL);
+
+	update_attribute_handle(service, index);
+
+	if (!index_attribute(db, attribute)) {
+		attribute_destroy(attribute);
+		return 0;
+	}
+
+	db_changed(db);
 
-	return update_attribute_handle(service, index);
+	return attribute->handle;
 }
 
 bool gatt_db_service_set_active(struct gatt_db *db, uint16_t handle,
@@ -405,256 +862,238 @@ bool gatt_db_service_set_active(struct gatt_db *db, uint16_t handle,
 {
 	struct gatt_db_service *service;
 
-	service = queue_find(db->services, match_service_by_handle,
-							INT_TO_PTR(handle));
+	service = find_service_by_handle(db, handle);
 	if (!service)
 		return false;
 
-	service->active = active;
+	if (service->active != active) {
+		service->active = active;
+		db_changed(db);
+	}
 
 	return true;
 }
 
-struct read_by_group_type_data {
-	struct queue *queue;
-	bt_uuid_t uuid;
-	uint16_t start_handle;
-	uint16_t end_handle;
-	uint16_t uuid_size;
-	bool stop_search;
-};
+typedef bool (*attribute_func_t)(struct gatt_db_service *service,
+					struct gatt_db_attribute *attribute,
+					void *user_data);
 
-static void read_by_group_type(void *data, void *user_data)
+static void foreach_indexed(struct gatt_db *db, struct handle_list *list,
+					uint16_t start, uint16_t end,
+					attribute_func_t func, void *user_data)
 {
-	struct read_by_group_type_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-
-	if (!service->active)
-		return;
+	unsigned int i;
 
-	/* Don't want more results as they have different size */
-	if (search_data->stop_search)
-		return;
+	for (i = handle_list_find(list, start); i < list->len; i++) {
+		uint16_t handle = list->handles[i];
+		struct gatt_db_service *service;
 
-	if (bt_uuid_cmp(&search_data->uuid, &service->attributes[0]->uuid))
-		return;
+		if (handle > end)
+			return;
 
-	if (service->attributes[0]->handle < search_data->start_handle)
-		return;
+		service = find_service(db, handle);
+		if (!service->active)
+			continue;
 
-	/* Remember size of uuid */
-	if (!search_data->uuid_size) {
-		search_data->uuid_size = service->attributes[0]->value_len;
-	} else if (search_data->uuid_size !=
-					service->attributes[0]->value_len) {
-		/* Don't want more results. This is last */
-		search_data->stop_search = true;
-		return;
+		if (!func(service, find_attribute(db, handle), user_data))
+			return;
 	}
-
-	queue_push_tail(search_data->queue,
-			UINT_TO_PTR(service->attributes[0]->handle));
 }
 
-void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
-							uint16_t end_handle,
-							const bt_uuid_t type,
-							struct queue *queue)
+/*
+ * Calls func for the attributes of active services within [start, end] in
+ * handle order, optionally only for those of the given type, until func
+ * returns false.
+ */
+static void foreach_in_range(struct gatt_db *db, uint16_t start,
+					uint16_t end, const bt_uuid_t *type,
+					attribute_func_t func, void *user_data)
 {
-	struct read_by_group_type_data data;
-
-	data.uuid = type;
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
-	data.queue = queue;
-	data.uuid_size = 0;
-	data.stop_search = false;
+	struct gatt_db_service *service;
+	struct gatt_db_attribute *attribute;
+	struct handle_list *list;
+	unsigned int handle, first, last;
+	int id = -1;
+
+	if (type) {
+		/* No attribute can match a type that was never added */
+		id = find_type(db, type);
+		if (id < 0)
+			return;
 
-	queue_foreach(db->services, read_by_group_type, &data);
-}
-
-struct find_by_type_value_data {
-	struct queue *queue;
-	bt_uuid_t uuid;
-	uint16_t start_handle;
-	uint16_t end_handle;
-};
+		list = type_list(db, id);
+		if (list) {
+			foreach_indexed(db, list, start, end, func, user_data);
+			return;
+		}
+	}
 
-static void find_by_type(void *data, void *user_data)
-{
-	struct find_by_type_value_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
+	handle = start;
 
-	if (!service->active)
-		return;
+	while (handle <= end && handle < db->handles_len) {
+		service = db->handles[handle];
+		if (!service) {
+			handle++;
+			continue;
+		}
 
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
+		first = service->attributes[0].handle;
+		last = first + service->num_handles - 1;
 
-		if (!attribute)
-			continue;
+		for (; service->active && handle <= MIN(last, end); handle++) {
+			attribute = &service->attributes[handle - first];
+			if (!attribute->handle)
+				continue;
 
-		if ((attribute->handle < search_data->start_handle) ||
-				(attribute->handle > search_data->end_handle))
-			continue;
+			if (id >= 0 && attribute->type != id)
+				continue;
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
-			continue;
+			if (!func(service, attribute, user_data))
+				return;
+		}
 
-		queue_push_tail(search_data->queue,
-						UINT_TO_PTR(attribute->handle));
+		handle = last + 1;
 	}
 }
-
-void gatt_db_find_by_type(struct gatt_db *db, uint16_t start_handle,
-							uint16_t end_handle,
-							const bt_uuid_t *type,
-							struct queue *queue)
+static bool push_handle(struct gatt_db_service *service,
+				struct gatt_db_attribute *attribute,
+				void *user_data)
 {
-	struct find_by_type_value_data data;
+	struct queue *queue = user_data;
 
-	data.uuid = *type;
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
-	data.queue = queue;
+	queue_push_tail(queue, UINT_TO_PTR(attribute->handle));
 
-	queue_foreach(db->services, find_by_type, &data);
+	return true;
 }
 
-struct read_by_type_data {
+struct read_by_group_type_data {
 	struct queue *queue;
-	bt_uuid_t uuid;
-	uint16_t start_handle;
-	uint16_t end_handle;
+	uint16_t uuid_size;
 };
 
-static void read_by_type(void *data, void *user_data)
+static bool read_by_group_type(struct gatt_db_service *service,
+					struct gatt_db_attribute *attribute,
+					void *user_data)
 {
-	struct read_by_type_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
-
-	if (!service->active)
-		return;
-
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
-		if (!attribute)
-			continue;
+	struct read_by_group_type_data *search_data = user_data;
 
-		if (attribute->handle < search_data->start_handle)
-			continue;
+	/* Only service declarations start a group */
+	if (attribute != &service->attributes[0])
+		return true;
 
-		if (attribute->handle > search_data->end_handle)
-			return;
+	/* Remember size of uuid */
+	if (!search_data->uuid_size) {
+		search_data->uuid_size = attribute->value_len;
+	} else if (search_data->uuid_size != attribute->value_len) {
+		/* Don't want more results as they have different size */
+		return false;
+	}
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
-			continue;
+	queue_push_tail(search_data->queue, UINT_TO_PTR(attribute->handle));
 
-		queue_push_tail(search_data->queue,
-						UINT_TO_PTR(attribute->handle));
-	}
+	return true;
 }
 
-void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
-						uint16_t end_handle,
-						const bt_uuid_t type,
-						struct queue *queue)
+void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
+							uint16_t end_handle,
+							const bt_uuid_t type,
+							struct queue *queue)
 {
-	struct read_by_type_data data;
-	data.uuid = type;
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
+	struct read_by_group_type_data data;
+
 	data.queue = queue;
+	data.uuid_size = 0;
 
-	queue_foreach(db->services, read_by_type, &data);
+	foreach_in_range(db, start_handle, end_handle, &type,
+						read_by_group_type, &data);
 }
 
-
-struct find_information_data {
-	struct queue *queue;
-	uint16_t start_handle;
-	uint16_t end_handle;
-};
-
-static void find_information(void *data, void *user_data)
+void gatt_db_find_by_type(struct gatt_db *db, uint16_t start_handle,
+							uint16_t end_handle,
+							const bt_uuid_t *type,
+							struct queue *queue)
 {
-	struct find_information_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
-
-	if (!service->active)
-		return;
-
-	/* Check if service is in range */
-	if ((service->attributes[0]->handle + service->num_handles - 1) <
-						search_data->start_handle)
-		return;
-
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
-		if (!attribute)
-			continue;
-
-		if (attribute->handle < search_data->start_handle)
-			continue;
-
-		if (attribute->handle > search_data->end_handle)
-			return;
+	foreach_in_range(db, start_handle, end_handle, type, push_handle,
+									queue);
+}
 
-		queue_push_tail(search_data->queue,
-						UINT_TO_PTR(attribute->handle));
-	}
+void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
+						uint16_t end_handle,
+						const bt_uuid_t type,
+						struct queue *queue)
+{
+	foreach_in_range(db, start_handle, end_handle, &type, push_handle,
+									queue);
 }
 
 void gatt_db_find_information(struct gatt_db *db, uint16_t start_handle,
 							uint16_t end_handle,
 							struct queue *queue)
 {
-	struct find_information_data data;
+	foreach_in_range(db, start_handle, end_handle, NULL, push_handle,
+									queue);
+}
 
-	data.start_handle = start_handle;
-	data.end_handle = end_handle;
-	data.queue = queue;
+struct foreach_data {
+	struct gatt_db *db;
+	gatt_db_foreach_t func;
+	void *user_data;
+};
 
-	queue_foreach(db->services, find_information, &data);
+static bool foreach_entry(struct gatt_db_service *service,
+					struct gatt_db_attribute *attribute,
+					void *user_data)
+{
+	struct foreach_data *data = user_data;
+	struct gatt_db_entry entry;
+
+	entry.handle = attribute->handle;
+	entry.end_handle = service->attributes[0].handle +
+						service->num_handles - 1;
+	entry.type = data->db->types[attribute->type];
+	entry.permissions = attribute->permissions;
+
+	/* Either variant of the callback means the stored value is unused */
+	if (attribute->read_func.sync) {
+		entry.value = NULL;
+		entry.value_len = 0;
+	} else {
+		entry.value = attribute_value(attribute);
+		entry.value_len = attribute->value_len;
+	}
+
+	return data->func(&entry, data->user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
+void gatt_db_foreach_in_range(struct gatt_db *db, uint16_t start_handle,
+						uint16_t end_handle,
+						const bt_uuid_t *type,
+						gatt_db_foreach_t func,
+						void *user_data)
 {
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_INT(user_data);
-	uint16_t start, end;
+	struct foreach_data data;
+
+	if (!db || !func)
+		return;
 
-	start = service->attributes[0]->handle;
-	end = start + service->num_handles;
+	data.db = db;
+	data.func = func;
+	data.user_data = user_data;
 
-	return (start <= handle) && (handle < end);
+	foreach_in_range(db, start_handle, end_handle, type, foreach_entry,
+									&data);
 }
 
 bool gatt_db_read(struct gatt_db *db, uint16_t handle, uint16_t offset,
 				uint8_t att_opcode, bdaddr_t *bdaddr,
 				uint8_t **value, int *length)
 {
-	struct gatt_db_service *service;
-	uint16_t service_handle;
 	struct gatt_db_attribute *a;
 
 	if (!value || !length)
 		return false;
 
-	service = queue_find(db->services, find_service_for_handle,
-						INT_TO_PTR(handle));
-	if (!service)
-		return false;
-
-	service_handle = service->attributes[0]->handle;
-
-	a = service->attributes[handle - service_handle];
+	a = find_attribute(db, handle);
 	if (!a)
 		return false;
 
@@ -662,15 +1101,19 @@ bool gatt_db_read(struct gatt_db *db, uint16_t handle, uint16_t offset,
 	 * We call callback, and set length to -1, to notify user that callback
 	 * has been called. Otherwise we set length to value length in database.
 	 */
-	if (a->read_func) {
+	if (a->async)
+		return false;
+
+	if (a->read_func.sync) {
 		*value = NULL;
 		*length = -1;
-		a->read_func(handle, offset, att_opcode, bdaddr, a->user_data);
+		a->read_func.sync(handle, offset, att_opcode, bdaddr,
+								a->user_data);
 	} else {
 		if (offset > a->value_len)
 			return false;
 
-		*value = &a->value[offset];
+		*value = attribute_value(a) + offset;
 		*length = a->value_len - offset;
 	}
 
@@ -681,23 +1124,222 @@ bool gatt_db_write(struct gatt_db *db, uint16_t handle, uint16_t offset,
 					const uint8_t *value, size_t len,
 					uint8_t att_opcode, bdaddr_t *bdaddr)
 {
-	struct gatt_db_service *service;
-	uint16_t service_handle;
 	struct gatt_db_attribute *a;
 
-	service = queue_find(db->services, find_service_for_handle,
-						INT_TO_PTR(handle));
-	if (!service)
+	a = find_attribute(db, handle);
+	if (!a || a->async || !a->write_func.sync)
 		return false;
 
-	service_handle = service->attributes[0]->handle;
+	a->write_func.sync(handle, offset, value, len, att_opcode, bdaddr,
+								a->user_data);
+
+	return true;
+}
+
+static void op_complete(struct gatt_db_op *op, uint8_t ecode,
+					const uint8_t *value, size_t len)
+{
+	if (op->batch)
+		batch_result(op->batch, op->index, ecode, value, len);
+	else if (op->func)
+		op->func(op->handle, ecode, value, len, op->user_data);
+
+	free(op);
+}
+
+static bool match_op_id(const void *a, const void *b)
+{
+	const struct gatt_db_op *op = a;
+
+	return op->id == PTR_TO_UINT(b);
+}
+
+static unsigned int op_start(struct gatt_db *db, struct gatt_db_op *op,
+					bool write, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t att_opcode, bdaddr_t *bdaddr)
+{
+	struct gatt_db_attribute *a;
+	unsigned int id;
+
+	if (db->next_op_id < 1)
+		db->next_op_id = 1;
+
+	id = op->id = db->next_op_id++;
+
+	a = find_attribute(db, op->handle);
+	if (!a) {
+		op_complete(op, BT_ATT_ERROR_INVALID_HANDLE, NULL, 0);
+		return id;
+	}
+
+	/* Synchronous callbacks respond through their own channel */
+	if (write && !(a->async && a->write_func.async)) {
+		if (a->write_func.sync)
+			op_complete(op, BT_ATT_ERROR_UNLIKELY, NULL, 0);
+		else
+			op_complete(op, BT_ATT_ERROR_WRITE_NOT_PERMITTED,
+								NULL, 0);
+
+		return id;
+	}
+
+	if (!write && !(a->async && a->read_func.async)) {
+		if (a->read_func.sync)
+			op_complete(op, BT_ATT_ERROR_UNLIKELY, NULL, 0);
+		else if (offset > a->value_len)
+			op_complete(op, BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+		else
+			op_complete(op, 0, attribute_value(a) + offset,
+							a->value_len - offset);
+
+		return id;
+	}
+
+	if (!queue_push_tail(db->ops, op)) {
+		op_complete(op, BT_ATT_ERROR_INSUFFICIENT_RESOURCES, NULL, 0);
+		return id;
+	}
+
+	/* The backend may complete the operation before this returns */
+	if (write)
+		a->write_func.async(db, id, op->handle, offset, value, len,
+					att_opcode, bdaddr, a->user_data);
+	else
+		a->read_func.async(db, id, op->handle, offset, att_opcode,
+							bdaddr, a->user_data);
 
-	a = service->attributes[handle - service_handle];
-	if (!a || !a->write_func)
+	return id;
+}
+
+bool gatt_db_set_async(struct gatt_db *db, uint16_t handle,
+					gatt_db_read_async_t read_func,
+					gatt_db_write_async_t write_func,
+					void *user_data)
+{
+	struct gatt_db_attribute *a;
+
+	a = find_attribute(db, handle);
+	if (!a)
 		return false;
 
-	a->write_func(handle, offset, value, len, att_opcode, bdaddr,
-								a->user_data);
+	a->async = true;
+	a->read_func.async = read_func;
+	a->write_func.async = write_func;
+	a->user_data = user_data;
+
+	return true;
+}
+
+unsigned int gatt_db_read_async(struct gatt_db *db, uint16_t handle,
+					uint16_t offset, uint8_t att_opcode,
+					bdaddr_t *bdaddr,
+					gatt_db_complete_t func,
+					void *user_data)
+{
+	struct gatt_db_op *op;
+
+	op = new0(struct gatt_db_op, 1);
+	if (!op)
+		return 0;
+
+	op->handle = handle;
+	op->func = func;
+	op->user_data = user_data;
+
+	return op_start(db, op, false, offset, NULL, 0, att_opcode, bdaddr);
+}
+
+unsigned int gatt_db_write_async(struct gatt_db *db, uint16_t handle,
+					uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t att_opcode, bdaddr_t *bdaddr,
+					gatt_db_complete_t func,
+					void *user_data)
+{
+	struct gatt_db_op *op;
+
+	op = new0(struct gatt_db_op, 1);
+	if (!op)
+		return 0;
+
+	op->handle = handle;
+	op->func = func;
+	op->user_data = user_data;
+
+	return op_start(db, op, true, offset, value, len, att_opcode, bdaddr);
+}
+
+bool gatt_db_read_batch(struct gatt_db *db, const uint16_t *handles,
+					unsigned int num, uint8_t att_opcode,
+					bdaddr_t *bdaddr,
+					gatt_db_batch_complete_t func,
+					void *user_data)
+{
+	struct gatt_db_batch *batch;
+	struct gatt_db_op **ops;
+	unsigned int i;
+
+	if (!num)
+		return false;
+
+	batch = new0(struct gatt_db_batch, 1);
+	if (!batch)
+		return false;
+
+	batch->results = new0(struct gatt_db_result, num);
+	ops = new0(struct gatt_db_op *, num);
+	if (!batch->results || !ops)
+		goto fail;
+
+	/* Allocate everything up front so that a batch can't half start */
+	for (i = 0; i < num; i++) {
+		ops[i] = new0(struct gatt_db_op, 1);
+		if (!ops[i])
+			goto fail;
+
+		ops[i]->handle = handles[i];
+		ops[i]->batch = batch;
+		ops[i]->index = i;
+		batch->results[i].handle = handles[i];
+	}
+
+	batch->num = num;
+	batch->func = func;
+	batch->user_data = user_data;
+
+	/* Hold the batch until all reads are started */
+	batch->pending = num + 1;
+
+	for (i = 0; i < num; i++)
+		op_start(db, ops[i], false, 0, NULL, 0, att_opcode, bdaddr);
+
+	free(ops);
+	batch_unref(batch);
+
+	return true;
+
+fail:
+	for (i = 0; ops && i < num; i++)
+		free(ops[i]);
+
+	free(ops);
+	free(batch->results);
+	free(batch);
+
+	return false;
+}
+
+bool gatt_db_complete(struct gatt_db *db, unsigned int id, uint8_t ecode,
+					const uint8_t *value, size_t len)
+{
+	struct gatt_db_op *op;
+
+	op = queue_remove_if(db->ops, match_op_id, UINT_TO_PTR(id));
+	if (!op)
+		return false;
+
+	op_complete(op, ecode, value, len);
 
 	return true;
 }
@@ -705,34 +1347,24 @@ bool gatt_db_write(struct gatt_db *db, uint16_t handle, uint16_t offset,
 const bt_uuid_t *gatt_db_get_attribute_type(struct gatt_db *db,
 							uint16_t handle)
 {
-	struct gatt_db_service *service;
 	struct gatt_db_attribute *attribute;
-	uint16_t service_handle;
-
-	service = queue_find(db->services, find_service_for_handle,
-						INT_TO_PTR(handle));
-	if (!service)
-		return NULL;
-
-	service_handle = service->attributes[0]->handle;
 
-	attribute = service->attributes[handle - service_handle];
+	attribute = find_attribute(db, handle);
 	if (!attribute)
 		return NULL;
 
-	return &attribute->uuid;
+	return db->types[attribute->type];
 }
 
 uint16_t gatt_db_get_end_handle(struct gatt_db *db, uint16_t handle)
 {
 	struct gatt_db_service *service;
 
-	service = queue_find(db->services, find_service_for_handle,
-						INT_TO_PTR(handle));
+	service = find_service(db, handle);
 	if (!service)
 		return 0;
 
-	return service->attributes[0]->handle + service->num_handles - 1;
+	return service->attributes[0].handle + service->num_handles - 1;
 }
 
 bool gatt_db_get_service_uuid(struct gatt_db *db, uint16_t handle,
@@ -740,24 +1372,23 @@ bool gatt_db_get_service_uuid(struct gatt_db *db, uint16_t handle,
 {
 	struct gatt_db_service *service;
 
-	service = queue_find(db->services, find_service_for_handle,
-						INT_TO_PTR(handle));
+	service = find_service(db, handle);
 	if (!service)
 		return false;
 
-	if (service->attributes[0]->value_len == 2) {
+	if (service->attributes[0].value_len == 2) {
 		uint16_t value;
 
-		value = get_le16(service->attributes[0]->value);
+		value = get_le16(attribute_value(&service->attributes[0]));
 		bt_uuid16_create(uuid, value);
 
 		return true;
 	}
 
-	if (service->attributes[0]->value_len == 16) {
+	if (service->attributes[0].value_len == 16) {
 		uint128_t value;
 
-		bswap_128(service->attributes[0]->value, &value);
+		bswap_128(attribute_value(&service->attributes[0]), &value);
 		bt_uuid128_create(uuid, value);
 
 		return true;
@@ -770,26 +1401,444 @@ bool gatt_db_get_attribute_permissions(struct gatt_db *db, uint16_t handle,
 							uint32_t *permissions)
 {
 	struct gatt_db_attribute *attribute;
+
+	attribute = find_attribute(db, handle);
+	if (!attribute)
+		return false;
+
+	*permissions = attribute->permissions;
+	return true;
+
+}
+
+uint32_t gatt_db_get_generation(struct gatt_db *db)
+{
+	return db->generation;
+}
+
+/*
+ * Returns how many bytes the attribute adds to the database hash message
+ * (Core 5.1 Vol 3 Part G 7.3.1), writing them to "buf" if not NULL.
+ */
+static size_t hash_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute,
+					uint8_t *buf)
+{
+	const bt_uuid_t *type = db->types[attribute->type];
+	size_t len;
+
+	if (type->type != BT_UUID16)
+		return 0;
+
+	switch (type->value.u16) {
+	case GATT_PRIM_SVC_UUID:
+	case GATT_SND_SVC_UUID:
+	case GATT_INCLUDE_UUID:
+	case GATT_CHARAC_UUID:
+	case GATT_CHARAC_EXT_PROPER_UUID:
+		len = 4 + attribute->value_len;
+		break;
+	case GATT_CHARAC_USER_DESC_UUID:
+	case GATT_CLIENT_CHARAC_CFG_UUID:
+	case GATT_SERVER_CHARAC_CFG_UUID:
+	case GATT_CHARAC_FMT_UUID:
+	case GATT_CHARAC_AGREG_FMT_UUID:
+		len = 4;
+		break;
+	default:
+		return 0;
+	}
+
+	if (buf) {
+		put_le16(attribute->handle, buf);
+		put_le16(type->value.u16, buf + 2);
+		memcpy(buf + 4, attribute_value(attribute), len - 4);
+	}
+
+	return len;
+}
+
+static void hash_services(struct gatt_db *db, uint8_t *buf, size_t *len)
+{
 	struct gatt_db_service *service;
-	uint16_t service_handle;
+	unsigned int handle = 1;
+	int i;
 
-	service = queue_find(db->services, find_service_for_handle,
-							INT_TO_PTR(handle));
-	if (!service)
+	while (handle < db->handles_len) {
+		service = db->handles[handle];
+		if (!service) {
+			handle++;
+			continue;
+		}
+
+		for (i = 0; service->active && i < service->num_handles; i++) {
+			struct gatt_db_attribute *attribute;
+
+			attribute = &service->attributes[i];
+			if (!attribute->handle)
+				continue;
+
+			*len += hash_attribute(db, attribute,
+						buf ? buf + *len : NULL);
+		}
+
+		handle += service->num_handles;
+	}
+}
+
+bool gatt_db_get_hash(struct gatt_db *db, uint8_t hash[16])
+{
+	uint8_t *buf;
+	size_t len = 0;
+	bool ret;
+
+	if (db->hash_valid)
+		goto done;
+
+	if (!db->crypto) {
+		db->crypto = bt_crypto_new();
+		if (!db->crypto)
+			return false;
+	}
+
+	hash_services(db, NULL, &len);
+
+	buf = malloc(len);
+	if (!buf && len)
 		return false;
 
-	service_handle = service->attributes[0]->handle;
+	len = 0;
+	hash_services(db, buf, &len);
 
-	/*
-	 * We can safely get attribute from attributes array with offset,
-	 * because find_service_for_handle() check if given handle is
-	 * in service range.
-	 */
-	attribute = service->attributes[handle - service_handle];
-	if (!attribute)
+	ret = bt_crypto_gatt_hash(db->crypto, buf, len, db->hash);
+	free(buf);
+
+	if (!ret)
 		return false;
 
-	*permissions = attribute->permissions;
+	db->hash_valid = true;
+
+done:
+	memcpy(hash, db->hash, 16);
+
+	return true;
+}
+
+bool gatt_db_set_callbacks(struct gatt_db *db, uint16_t handle,
+					gatt_db_read_t read_func,
+					gatt_db_write_t write_func,
+					void *user_data)
+{
+	struct gatt_db_attribute *a;
+
+	a = find_attribute(db, handle);
+	if (!a)
+		return false;
+
+	a->async = false;
+	a->read_func.sync = read_func;
+	a->write_func.sync = write_func;
+	a->user_data = user_data;
+
+	return true;
+}
+
+/*
+ * Snapshot layout, all fields little endian:
+ *
+ *   header:	magic (4), version (1), reserved (1), service count (2)
+ *   service:	start handle (2), handle count (2), flags (1),
+ *		attribute count (2)
+ *   attribute:	handle (2), type length (1), type (2 or 16),
+ *		permissions (4), value length (2), value
+ *
+ * Services are stored in handle order. The attributes of a service have
+ * consecutive handles and the first one is the service declaration.
+ * Callbacks are not stored and have to be set again after importing.
+ */
+#define SNAPSHOT_MAGIC		0x42445447
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_HEADER_LEN	8
+#define SNAPSHOT_SERVICE_LEN	7
+#define SNAPSHOT_ACTIVE		0x01
+
+static size_t export_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute,
+					uint8_t *buf)
+{
+	const bt_uuid_t *type = db->types[attribute->type];
+	uint8_t type_len = type->type == BT_UUID16 ? 2 : 16;
+
+	if (buf) {
+		put_le16(attribute->handle, buf);
+		buf[2] = type_len;
+		uuid_to_le(type, buf + 3);
+		put_le32(attribute->permissions, buf + 3 + type_len);
+		put_le16(attribute->value_len, buf + 7 + type_len);
+		memcpy(buf + 9 + type_len, attribute_value(attribute),
+							attribute->value_len);
+	}
+
+	return 9 + type_len + attribute->value_len;
+}
+
+/* Returns the snapshot length, writing it to "buf" if not NULL */
+static size_t export_services(struct gatt_db *db, uint8_t *buf)
+{
+	struct gatt_db_service *service;
+	size_t len = SNAPSHOT_HEADER_LEN;
+	unsigned int handle = 1;
+	uint16_t count = 0;
+	int i, num;
+
+	while (handle < db->handles_len) {
+		service = db->handles[handle];
+		if (!service) {
+			handle++;
+			continue;
+		}
+
+		num = get_attribute_index(service, 0);
+		if (!num)
+			num = service->num_handles;
+
+		if (buf) {
+			put_le16(handle, buf + len);
+			put_le16(service->num_handles, buf + len + 2);
+			buf[len + 4] = service->active ? SNAPSHOT_ACTIVE : 0;
+			put_le16(num, buf + len + 5);
+		}
+
+		len += SNAPSHOT_SERVICE_LEN;
+
+		for (i = 0; i < num; i++)
+			len += export_attribute(db, &service->attributes[i],
+							buf ? buf + len : NULL);
+
+		handle += service->num_handles;
+		count++;
+	}
+
+	if (buf) {
+		put_le32(SNAPSHOT_MAGIC, buf);
+		buf[4] = SNAPSHOT_VERSION;
+		buf[5] = 0;
+		put_le16(count, buf + 6);
+	}
+
+	return len;
+}
+
+bool gatt_db_export(struct gatt_db *db, uint8_t **data, size_t *len)
+{
+	if (!db || !data || !len)
+		return false;
+
+	*len = export_services(db, NULL);
+
+	*data = malloc(*len);
+	if (!*data)
+		return false;
+
+	export_services(db, *data);
+
 	return true;
+}
+
+struct snapshot_reader {
+	const uint8_t *data;
+	size_t len;
+};
+
+static const uint8_t *snapshot_pull(struct snapshot_reader *reader,
+								size_t len)
+{
+	const uint8_t *data = reader->data;
+
+	if (reader->len < len)
+		return NULL;
+
+	reader->data += len;
+	reader->len -= len;
+
+	return data;
+}
 
+/*
+ * Parses one service from the snapshot. Unless "build" is set the service
+ * is only checked, "next" being the lowest handle it may start at on input
+ * and the handle following it on output.
+ */
+static bool import_service(struct gatt_db *db,
+					struct snapshot_reader *reader,
+					bool build, unsigned int *next)
+{
+	struct gatt_db_service *service = NULL;
+	struct gatt_db_attribute *attribute;
+	const uint8_t *p, *value;
+	uint16_t num_handles, count, value_len;
+	uint8_t flags, type_len;
+	uint32_t permissions;
+	unsigned int handle, i;
+	bt_uuid_t type;
+
+	p = snapshot_pull(reader, SNAPSHOT_SERVICE_LEN);
+	if (!p)
+		return false;
+
+	handle = get_le16(p);
+	num_handles = get_le16(p + 2);
+	flags = p[4];
+	count = get_le16(p + 5);
+
+	if (!handle || !count || count > num_handles ||
+				handle + num_handles > UINT16_MAX)
+		return false;
+
+	if (!build) {
+		/* Services must be in handle order and not overlap */
+		if (handle < *next)
+			return false;
+
+		for (i = handle; i < handle + num_handles; i++) {
+			if (find_service(db, i))
+				return false;
+		}
+
+		*next = handle + num_handles;
+	} else {
+		service = malloc0(sizeof(*service) +
+				num_handles * sizeof(struct gatt_db_attribute));
+		if (!service)
+			return false;
+
+		service->num_handles = num_handles;
+		service->active = flags & SNAPSHOT_ACTIVE;
+	}
+
+	for (i = 0; i < count; i++) {
+		p = snapshot_pull(reader, 3);
+		if (!p || get_le16(p) != handle + i)
+			goto fail;
+
+		type_len = p[2];
+
+		p = snapshot_pull(reader, type_len);
+		if (!p)
+			goto fail;
+
+		if (type_len == 2) {
+			bt_uuid16_create(&type, get_le16(p));
+		} else if (type_len == 16) {
+			uint128_t u128;
+
+			bswap_128(p, &u128);
+			bt_uuid128_create(&type, u128);
+		} else {
+			goto fail;
+		}
+
+		p = snapshot_pull(reader, 6);
+		if (!p)
+			goto fail;
+
+		permissions = get_le32(p);
+		value_len = get_le16(p + 4);
+
+		value = snapshot_pull(reader, value_len);
+		if (!value)
+			goto fail;
+
+		if (!i && !uuid_match(&type, &primary_service_uuid) &&
+				!uuid_match(&type, &secondary_service_uuid))
+			goto fail;
+
+		if (!build)
+			continue;
+
+		attribute = &service->attributes[i];
+
+		if (!init_attribute(db, attribute, &type, value, value_len))
+			goto fail;
+
+		attribute->handle = handle + i;
+		attribute->permissions = permissions;
+	}
+
+	if (!build)
+		return true;
+
+	if (!handle_alloc_reserve(db->alloc, handle, num_handles))
+		goto fail;
+
+	if (!insert_service(db, service)) {
+		handle_alloc_put(db->alloc, handle, num_handles);
+		goto fail;
+	}
+
+	return true;
+
+fail:
+	if (service)
+		gatt_db_service_destroy(service);
+
+	return false;
+}
+
+bool gatt_db_import(struct gatt_db *db, const uint8_t *data, size_t len)
+{
+	struct snapshot_reader reader;
+	uint16_t *starts;
+	unsigned int i, next = 1;
+	uint16_t count;
+	const uint8_t *p;
+
+	if (!db || !data)
+		return false;
+
+	reader.data = data;
+	reader.len = len;
+
+	p = snapshot_pull(&reader, SNAPSHOT_HEADER_LEN);
+	if (!p || get_le32(p) != SNAPSHOT_MAGIC || p[4] != SNAPSHOT_VERSION)
+		return false;
+
+	count = get_le16(p + 6);
+
+	starts = new0(uint16_t, count + 1);
+	if (!starts)
+		return false;
+
+	/* Check the whole snapshot first so that it is loaded all or none */
+	for (i = 0; i < count; i++) {
+		if (reader.len >= 2)
+			starts[i] = get_le16(reader.data);
+
+		if (!import_service(db, &reader, false, &next))
+			goto fail;
+	}
+
+	if (reader.len)
+		goto fail;
+
+	reader.data = data + SNAPSHOT_HEADER_LEN;
+	reader.len = len - SNAPSHOT_HEADER_LEN;
+
+	for (i = 0; i < count; i++) {
+		if (!import_service(db, &reader, true, NULL))
+			break;
+	}
+
+	if (i == count) {
+		free(starts);
+		return true;
+	}
+
+	while (i-- > 0)
+		gatt_db_remove_service(db, starts[i]);
+
+fail:
+	free(starts);
+
+	return false;
 }
@@ -79,6 +79,24 @@ void gatt_db_find_information(struct gatt_db *db, uint16_t start_handle,
 							uint16_t end_handle,
 							struct queue *queue);
 
+struct gatt_db_entry {
+	uint16_t handle;
+	uint16_t end_handle;		/* Last handle of the service */
+	const bt_uuid_t *type;
+	const uint8_t *value;		/* NULL if read through a callback */
+	uint16_t value_len;
+	uint32_t permissions;
+};
+
+typedef bool (*gatt_db_foreach_t) (const struct gatt_db_entry *entry,
+							void *user_data);
+
+void gatt_db_foreach_in_range(struct gatt_db *db, uint16_t start_handle,
+						uint16_t end_handle,
+						const bt_uuid_t *type,
+						gatt_db_foreach_t func,
+						void *user_data);
+
 bool gatt_db_read(struct gatt_db *db, uint16_t handle, uint16_t offset,
 					uint8_t att_opcode, bdaddr_t *bdaddr,
 					uint8_t **value, int *length);
@@ -87,6 +105,64 @@ bool gatt_db_write(struct gatt_db *db, uint16_t handle, uint16_t offset,
 					const uint8_t *value, size_t len,
 					uint8_t att_opcode, bdaddr_t *bdaddr);
 
+typedef void (*gatt_db_read_async_t) (struct gatt_db *db, unsigned int id,
+					uint16_t handle, uint16_t offset,
+					uint8_t att_opcode, bdaddr_t *bdaddr,
+					void *user_data);
+
+typedef void (*gatt_db_write_async_t) (struct gatt_db *db, unsigned int id,
+					uint16_t handle, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t att_opcode, bdaddr_t *bdaddr,
+					void *user_data);
+
+bool gatt_db_set_async(struct gatt_db *db, uint16_t handle,
+					gatt_db_read_async_t read_func,
+					gatt_db_write_async_t write_func,
+					void *user_data);
+
+bool gatt_db_set_callbacks(struct gatt_db *db, uint16_t handle,
+					gatt_db_read_t read_func,
+					gatt_db_write_t write_func,
+					void *user_data);
+
+typedef void (*gatt_db_complete_t) (uint16_t handle, uint8_t ecode,
+					const uint8_t *value, size_t len,
+					void *user_data);
+
+unsigned int gatt_db_read_async(struct gatt_db *db, uint16_t handle,
+					uint16_t offset, uint8_t att_opcode,
+					bdaddr_t *bdaddr,
+					gatt_db_complete_t func,
+					void *user_data);
+
+unsigned int gatt_db_write_async(struct gatt_db *db, uint16_t handle,
+					uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t att_opcode, bdaddr_t *bdaddr,
+					gatt_db_complete_t func,
+					void *user_data);
+
+bool gatt_db_complete(struct gatt_db *db, unsigned int id, uint8_t ecode,
+					const uint8_t *value, size_t len);
+
+struct gatt_db_result {
+	uint16_t handle;
+	uint8_t ecode;
+	uint8_t *value;
+	size_t len;
+};
+
+typedef void (*gatt_db_batch_complete_t) (
+					const struct gatt_db_result *results,
+					unsigned int num, void *user_data);
+
+bool gatt_db_read_batch(struct gatt_db *db, const uint16_t *handles,
+					unsigned int num, uint8_t att_opcode,
+					bdaddr_t *bdaddr,
+					gatt_db_batch_complete_t func,
+					void *user_data);
+
 const bt_uuid_t *gatt_db_get_attribute_type(struct gatt_db *db,
 							uint16_t handle);
 
@@ -96,3 +172,9 @@ bool gatt_db_get_service_uuid(struct gatt_db *db, uint16_t handle,
 
 bool gatt_db_get_attribute_permissions(struct gatt_db *db, uint16_t handle,
 							uint32_t *permissions);
+
+uint32_t gatt_db_get_generation(struct gatt_db *db);
+bool gatt_db_get_hash(struct gatt_db *db, uint8_t hash[16]);
+
+bool gatt_db_export(struct gatt_db *db, uint8_t **data, size_t *len);
+bool gatt_db_import(struct gatt_db *db, const uint8_t *data, size_t len);
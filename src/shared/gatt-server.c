@@ -0,0 +1,1598 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/att.h"
+#include "src/shared/att-types.h"
+#include "src/shared/queue.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-server.h"
+#include "src/shared/util.h"
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/* Attribute values can be at most 512 octets, Vol 3, Part F, 3.2.9 */
+#define MAX_VALUE_LEN		512
+#define MAX_PREP_WRITES		64
+
+#define CCC_NOTIFY		0x0001
+#define CCC_INDICATE		0x0002
+
+static const uint8_t request_opcodes[] = {
+	BT_ATT_OP_MTU_REQ,
+	BT_ATT_OP_FIND_INFO_REQ,
+	BT_ATT_OP_FIND_BY_TYPE_VAL_REQ,
+	BT_ATT_OP_READ_BY_TYPE_REQ,
+	BT_ATT_OP_READ_REQ,
+	BT_ATT_OP_READ_BLOB_REQ,
+	BT_ATT_OP_READ_MULT_REQ,
+	BT_ATT_OP_READ_BY_GRP_TYPE_REQ,
+	BT_ATT_OP_WRITE_REQ,
+	BT_ATT_OP_WRITE_CMD,
+	BT_ATT_OP_PREP_WRITE_REQ,
+	BT_ATT_OP_EXEC_WRITE_REQ,
+};
+
+#define NUM_REQUESTS (sizeof(request_opcodes) / sizeof(request_opcodes[0]))
+
+static const bt_uuid_t primary_service_uuid = { .type = BT_UUID16,
+					.value.u16 = GATT_PRIM_SVC_UUID };
+static const bt_uuid_t secondary_service_uuid = { .type = BT_UUID16,
+					.value.u16 = GATT_SND_SVC_UUID };
+static const bt_uuid_t characteristic_uuid = { .type = BT_UUID16,
+					.value.u16 = GATT_CHARAC_UUID };
+static const bt_uuid_t ccc_uuid = { .type = BT_UUID16,
+				.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID };
+
+/*
+ * Client Characteristic Configuration descriptors without callbacks in
+ * the database are kept per client by the server.
+ */
+struct ccc_state {
+	uint16_t handle;
+	uint16_t value_handle;
+	uint16_t value;
+};
+
+struct prep_write {
+	uint16_t handle;
+	uint16_t offset;
+	uint16_t length;
+	uint8_t value[0];
+};
+
+struct bt_gatt_server {
+	int ref_count;
+	struct gatt_db *db;
+	struct bt_att *att;
+	uint16_t mtu;
+	unsigned int request_ids[NUM_REQUESTS];
+
+	struct queue *ccc;
+	struct queue *prep_queue;
+	bool exec_pending;
+
+	bt_gatt_server_authorize_func_t authorize_callback;
+	bt_gatt_server_destroy_func_t authorize_destroy;
+	void *authorize_data;
+
+	bt_gatt_server_debug_func_t debug_callback;
+	bt_gatt_server_destroy_func_t debug_destroy;
+	void *debug_data;
+};
+
+/* An operation waiting for the database to complete it */
+struct async_req {
+	struct bt_gatt_server *server;
+	uint8_t opcode;
+	uint16_t handle;
+};
+
+struct ind_data {
+	bt_gatt_server_conf_func_t callback;
+	bt_gatt_server_destroy_func_t destroy;
+	void *user_data;
+};
+
+/* A PDU shared by the notifications of several clients */
+struct shared_pdu {
+	int ref_count;
+	uint16_t len;
+	uint8_t data[0];
+};
+
+static struct async_req *async_req_new(struct bt_gatt_server *server,
+					uint8_t opcode, uint16_t handle)
+{
+	struct async_req *req;
+
+	req = new0(struct async_req, 1);
+	if (!req)
+		return NULL;
+
+	req->server = bt_gatt_server_ref(server);
+	req->opcode = opcode;
+	req->handle = handle;
+
+	return req;
+}
+
+static void async_req_free(struct async_req *req)
+{
+	bt_gatt_server_unref(req->server);
+	free(req);
+}
+
+static void send_error(struct bt_gatt_server *server, uint8_t opcode,
+					uint16_t handle, uint8_t ecode)
+{
+	uint8_t pdu[4];
+
+	pdu[0] = opcode;
+	put_le16(handle, pdu + 1);
+	pdu[3] = ecode;
+
+	util_debug(server->debug_callback, server->debug_data,
+				"Error response to 0x%02x: handle 0x%04x "
+				"ecode 0x%02x", opcode, handle, ecode);
+
+	bt_att_send(server->att, BT_ATT_OP_ERROR_RSP, pdu, sizeof(pdu),
+							NULL, NULL, NULL);
+}
+
+/* Response PDUs are built in place in a buffer of the link MTU */
+static uint8_t *rsp_alloc(struct bt_gatt_server *server, uint16_t *max)
+{
+	*max = bt_att_get_mtu(server->att) - 1;
+
+	return malloc(*max);
+}
+
+static void rsp_send(struct bt_gatt_server *server, uint8_t opcode,
+						uint8_t *buf, uint16_t len)
+{
+	if (!len) {
+		bt_att_send(server->att, opcode, NULL, 0, NULL, NULL, NULL);
+		free(buf);
+		return;
+	}
+
+	if (!bt_att_send_buf(server->att, opcode, buf, len, free, buf,
+							NULL, NULL, NULL))
+		free(buf);
+}
+
+static bool get_range(const uint8_t *pdu, uint16_t *start, uint16_t *end)
+{
+	*start = get_le16(pdu);
+	*end = get_le16(pdu + 2);
+
+	return *start && *start <= *end;
+}
+
+static bool get_uuid_le(const uint8_t *src, uint16_t len, bt_uuid_t *uuid)
+{
+	uint128_t u128;
+
+	switch (len) {
+	case 2:
+		bt_uuid16_create(uuid, get_le16(src));
+		return true;
+	case 16:
+		bswap_128(src, &u128);
+		bt_uuid128_create(uuid, u128);
+		return true;
+	}
+
+	return false;
+}
+
+static uint16_t put_uuid_le(const bt_uuid_t *uuid, uint8_t *dst)
+{
+	bt_uuid_t uuid128;
+
+	if (uuid->type == BT_UUID16) {
+		put_le16(uuid->value.u16, dst);
+		return 2;
+	}
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+	bswap_128(&uuid128.value.u128, dst);
+
+	return 16;
+}
+
+static bool uuid_is(const bt_uuid_t *uuid, const bt_uuid_t *type)
+{
+	if (uuid->type == BT_UUID16 && type->type == BT_UUID16)
+		return uuid->value.u16 == type->value.u16;
+
+	return !bt_uuid_cmp(uuid, type);
+}
+
+static bool copy_entry(const struct gatt_db_entry *entry, void *user_data)
+{
+	memcpy(user_data, entry, sizeof(*entry));
+
+	return false;
+}
+
+static bool lookup_entry(struct bt_gatt_server *server, uint16_t handle,
+						struct gatt_db_entry *entry)
+{
+	entry->handle = 0;
+
+	if (handle)
+		gatt_db_foreach_in_range(server->db, handle, handle, NULL,
+							copy_entry, entry);
+
+	return entry->handle == handle && handle;
+}
+
+static uint8_t authorize(struct bt_gatt_server *server, uint16_t handle,
+				uint8_t opcode, uint32_t permissions)
+{
+	if (!server->authorize_callback)
+		return 0;
+
+	return server->authorize_callback(handle, opcode, permissions,
+						server->authorize_data);
+}
+
+static bool is_server_ccc(const struct gatt_db_entry *entry)
+{
+	/* Descriptors with callbacks are managed by their owner */
+	return entry->value && uuid_is(entry->type, &ccc_uuid);
+}
+
+static bool match_ccc_handle(const void *a, const void *b)
+{
+	const struct ccc_state *ccc = a;
+
+	return ccc->handle == PTR_TO_UINT(b);
+}
+
+static bool match_ccc_value_handle(const void *a, const void *b)
+{
+	const struct ccc_state *ccc = a;
+
+	return ccc->value_handle == PTR_TO_UINT(b);
+}
+
+struct find_chrc_data {
+	uint16_t handle;
+	uint16_t end_handle;
+	uint16_t value_handle;
+};
+
+static bool find_chrc(const struct gatt_db_entry *entry, void *user_data)
+{
+	struct find_chrc_data *data = user_data;
+
+	if (entry->handle >= data->handle)
+		return false;
+
+	/* The last declaration before the descriptor in the same service */
+	if (entry->end_handle == data->end_handle && entry->value_len >= 5)
+		data->value_handle = get_le16(entry->value + 1);
+
+	return true;
+}
+
+static struct ccc_state *get_ccc(struct bt_gatt_server *server,
+				const struct gatt_db_entry *entry)
+{
+	struct find_chrc_data data;
+	struct ccc_state *ccc;
+
+	ccc = queue_find(server->ccc, match_ccc_handle,
+						UINT_TO_PTR(entry->handle));
+	if (ccc)
+		return ccc;
+
+	memset(&data, 0, sizeof(data));
+	data.handle = entry->handle;
+	data.end_handle = entry->end_handle;
+
+	gatt_db_foreach_in_range(server->db, 0x0001, entry->handle,
+					&characteristic_uuid, find_chrc, &data);
+	if (!data.value_handle)
+		return NULL;
+
+	ccc = new0(struct ccc_state, 1);
+	if (!ccc)
+		return NULL;
+
+	ccc->handle = entry->handle;
+	ccc->value_handle = data.value_handle;
+
+	if (!queue_push_tail(server->ccc, ccc)) {
+		free(ccc);
+		return NULL;
+	}
+
+	return ccc;
+}
+
+static uint8_t write_ccc(struct bt_gatt_server *server,
+				const struct gatt_db_entry *entry,
+				uint16_t offset, const uint8_t *value,
+				uint16_t len)
+{
+	struct ccc_state *ccc;
+
+	if (offset)
+		return BT_ATT_ERROR_INVALID_OFFSET;
+
+	if (len != 2)
+		return BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+
+	ccc = get_ccc(server, entry);
+	if (!ccc)
+		return BT_ATT_ERROR_UNLIKELY;
+
+	ccc->value = get_le16(value);
+
+	util_debug(server->debug_callback, server->debug_data,
+			"CCC 0x%04x of 0x%04x set to 0x%04x", ccc->handle,
+			ccc->value_handle, ccc->value);
+
+	return 0;
+}
+
+static void exchange_mtu(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	uint16_t client_mtu, mtu;
+	uint8_t rsp[2];
+
+	if (len != 2) {
+		send_error(server, BT_ATT_OP_MTU_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	client_mtu = get_le16(pdu);
+	mtu = MAX(MIN(client_mtu, server->mtu), BT_ATT_DEFAULT_LE_MTU);
+
+	put_le16(server->mtu, rsp);
+	bt_att_send(server->att, BT_ATT_OP_MTU_RSP, rsp, sizeof(rsp),
+							NULL, NULL, NULL);
+
+	/* The response is already encoded, the new MTU applies after it */
+	bt_att_set_mtu(server->att, mtu);
+
+	util_debug(server->debug_callback, server->debug_data,
+					"MTU exchange: client %u, using %u",
+					client_mtu, mtu);
+}
+
+struct rsp_data {
+	struct bt_gatt_server *server;
+	uint8_t opcode;
+	uint8_t *buf;
+	uint16_t len;
+	uint16_t max;
+	const bt_uuid_t *uuid;
+	const uint8_t *value;
+	uint16_t value_len;
+	uint16_t async_handle;
+	uint16_t err_handle;
+	uint8_t ecode;
+};
+
+static bool find_info_entry(const struct gatt_db_entry *entry,
+							void *user_data)
+{
+	struct rsp_data *data = user_data;
+	uint8_t format = entry->type->type == BT_UUID16 ? 0x01 : 0x02;
+	uint16_t size = format == 0x01 ? 4 : 18;
+
+	/* All entries of a response share the format of the first one */
+	if (!data->len) {
+		data->buf[0] = format;
+		data->len = 1;
+	} else if (data->buf[0] != format) {
+		return false;
+	}
+
+	if (data->len + size > data->max)
+		return false;
+
+	put_le16(entry->handle, data->buf + data->len);
+	put_uuid_le(entry->type, data->buf + data->len + 2);
+	data->len += size;
+
+	return true;
+}
+
+static void find_info(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	struct rsp_data data;
+	uint16_t start, end;
+
+	if (len != 4) {
+		send_error(server, BT_ATT_OP_FIND_INFO_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	if (!get_range(pdu, &start, &end)) {
+		send_error(server, BT_ATT_OP_FIND_INFO_REQ, start,
+						BT_ATT_ERROR_INVALID_HANDLE);
+		return;
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.buf = rsp_alloc(server, &data.max);
+	if (!data.buf) {
+		send_error(server, BT_ATT_OP_FIND_INFO_REQ, start,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	gatt_db_foreach_in_range(server->db, start, end, NULL,
+						find_info_entry, &data);
+
+	if (!data.len) {
+		free(data.buf);
+		send_error(server, BT_ATT_OP_FIND_INFO_REQ, start,
+					BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+		return;
+	}
+
+	rsp_send(server, BT_ATT_OP_FIND_INFO_RSP, data.buf, data.len);
+}
+
+static bool find_by_type_entry(const struct gatt_db_entry *entry,
+							void *user_data)
+{
+	struct rsp_data *data = user_data;
+	uint16_t end;
+
+	if (!entry->value || entry->value_len != data->value_len ||
+			memcmp(entry->value, data->value, data->value_len))
+		return true;
+
+	if (data->len + 4 > data->max)
+		return false;
+
+	/* Only service declarations group other attributes */
+	if (uuid_is(entry->type, &primary_service_uuid) ||
+			uuid_is(entry->type, &secondary_service_uuid))
+		end = entry->end_handle;
+	else
+		end = entry->handle;
+
+	put_le16(entry->handle, data->buf + data->len);
+	put_le16(end, data->buf + data->len + 2);
+	data->len += 4;
+
+	return true;
+}
+
+static void find_by_type(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	struct rsp_data data;
+	uint16_t start, end;
+	bt_uuid_t type;
+
+	if (len < 6) {
+		send_error(server, BT_ATT_OP_FIND_BY_TYPE_VAL_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	if (!get_range(pdu, &start, &end)) {
+		send_error(server, BT_ATT_OP_FIND_BY_TYPE_VAL_REQ, start,
+						BT_ATT_ERROR_INVALID_HANDLE);
+		return;
+	}
+
+	bt_uuid16_create(&type, get_le16(pdu + 4));
+
+	memset(&data, 0, sizeof(data));
+	data.value = pdu + 6;
+	data.value_len = len - 6;
+	data.buf = rsp_alloc(server, &data.max);
+	if (!data.buf) {
+		send_error(server, BT_ATT_OP_FIND_BY_TYPE_VAL_REQ, start,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	gatt_db_foreach_in_range(server->db, start, end, &type,
+						find_by_type_entry, &data);
+
+	if (!data.len) {
+		free(data.buf);
+		send_error(server, BT_ATT_OP_FIND_BY_TYPE_VAL_REQ, start,
+					BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+		return;
+	}
+
+	rsp_send(server, BT_ATT_OP_FIND_BY_TYPE_VAL_RSP, data.buf, data.len);
+}
+
+static bool read_by_type_entry(const struct gatt_db_entry *entry,
+							void *user_data)
+{
+	struct rsp_data *data = user_data;
+	const uint8_t *value = entry->value;
+	uint16_t value_len = entry->value_len;
+	struct ccc_state *ccc;
+	uint8_t ccc_value[2];
+	uint8_t ecode;
+
+	ecode = authorize(data->server, entry->handle, data->opcode,
+							entry->permissions);
+	if (ecode) {
+		if (!data->len) {
+			data->ecode = ecode;
+			data->err_handle = entry->handle;
+		}
+
+		return false;
+	}
+
+	if (is_server_ccc(entry)) {
+		ccc = queue_find(data->server->ccc, match_ccc_handle,
+						UINT_TO_PTR(entry->handle));
+		put_le16(ccc ? ccc->value : 0, ccc_value);
+		value = ccc_value;
+		value_len = sizeof(ccc_value);
+	} else if (!value) {
+		/* Values read through callbacks are answered on their own */
+		if (!data->len)
+			data->async_handle = entry->handle;
+
+		return false;
+	}
+
+	/* Only the first value may be truncated to fit, Vol 3, Part F, 3.4.4.2 */
+	if (!data->len) {
+		value_len = MIN(value_len, data->max - 3);
+		value_len = MIN(value_len, UINT8_MAX - 2);
+		data->buf[0] = value_len + 2;
+		data->len = 1;
+	} else if (value_len + 2 != data->buf[0]) {
+		return false;
+	}
+
+	if (data->len + value_len + 2 > data->max)
+		return false;
+
+	put_le16(entry->handle, data->buf + data->len);
+	memcpy(data->buf + data->len + 2, value, value_len);
+	data->len += value_len + 2;
+
+	return true;
+}
+
+static void read_by_type_complete(uint16_t handle, uint8_t ecode,
+					const uint8_t *value, size_t len,
+					void *user_data)
+{
+	struct async_req *req = user_data;
+	struct bt_gatt_server *server = req->server;
+	uint8_t *buf;
+	uint16_t max;
+
+	if (ecode) {
+		send_error(server, req->opcode, handle, ecode);
+		goto done;
+	}
+
+	buf = rsp_alloc(server, &max);
+	if (!buf) {
+		send_error(server, req->opcode, handle,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		goto done;
+	}
+
+	len = MIN(len, (size_t) max - 3);
+	len = MIN(len, UINT8_MAX - 2);
+
+	buf[0] = len + 2;
+	put_le16(handle, buf + 1);
+	memcpy(buf + 3, value, len);
+
+	rsp_send(server, BT_ATT_OP_READ_BY_TYPE_RSP, buf, len + 3);
+
+done:
+	async_req_free(req);
+}
+
+static void read_by_type(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	struct async_req *req;
+	struct rsp_data data;
+	uint16_t start, end;
+	bt_uuid_t type;
+
+	if (len != 6 && len != 20) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	if (!get_range(pdu, &start, &end)) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ, start,
+						BT_ATT_ERROR_INVALID_HANDLE);
+		return;
+	}
+
+	get_uuid_le(pdu + 4, len - 4, &type);
+
+	memset(&data, 0, sizeof(data));
+	data.server = server;
+	data.opcode = BT_ATT_OP_READ_BY_TYPE_REQ;
+	data.buf = rsp_alloc(server, &data.max);
+	if (!data.buf) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ, start,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	gatt_db_foreach_in_range(server->db, start, end, &type,
+						read_by_type_entry, &data);
+
+	if (data.len) {
+		rsp_send(server, BT_ATT_OP_READ_BY_TYPE_RSP, data.buf,
+								data.len);
+		return;
+	}
+
+	free(data.buf);
+
+	if (data.ecode) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ,
+						data.err_handle, data.ecode);
+		return;
+	}
+
+	if (!data.async_handle) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ, start,
+					BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+		return;
+	}
+
+	req = async_req_new(server, BT_ATT_OP_READ_BY_TYPE_REQ,
+							data.async_handle);
+	if (!req) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ, start,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	if (!gatt_db_read_async(server->db, data.async_handle, 0,
+					BT_ATT_OP_READ_BY_TYPE_REQ, NULL,
+					read_by_type_complete, req)) {
+		send_error(server, BT_ATT_OP_READ_BY_TYPE_REQ,
+					data.async_handle,
+					BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		async_req_free(req);
+	}
+}
+
+static void read_complete(uint16_t handle, uint8_t ecode,
+					const uint8_t *value, size_t len,
+					void *user_data)
+{
+	struct async_req *req = user_data;
+	struct bt_gatt_server *server = req->server;
+	uint8_t rsp_opcode;
+
+	if (ecode) {
+		send_error(server, req->opcode, handle, ecode);
+		goto done;
+	}
+
+	if (req->opcode == BT_ATT_OP_READ_BLOB_REQ)
+		rsp_opcode = BT_ATT_OP_READ_BLOB_RSP;
+	else
+		rsp_opcode = BT_ATT_OP_READ_RSP;
+
+	len = MIN(len, (size_t) bt_att_get_mtu(server->att) - 1);
+
+	bt_att_send(server->att, rsp_opcode, len ? value : NULL, len,
+							NULL, NULL, NULL);
+
+done:
+	async_req_free(req);
+}
+
+static void read_value(struct bt_gatt_server *server, uint8_t opcode,
+					const uint8_t *pdu, uint16_t len)
+{
+	struct gatt_db_entry entry;
+	struct async_req *req;
+	struct ccc_state *ccc;
+	uint16_t handle, offset = 0;
+	uint8_t value[2];
+	uint8_t ecode;
+
+	if (len != (opcode == BT_ATT_OP_READ_BLOB_REQ ? 4 : 2)) {
+		send_error(server, opcode, 0, BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	handle = get_le16(pdu);
+	if (opcode == BT_ATT_OP_READ_BLOB_REQ)
+		offset = get_le16(pdu + 2);
+
+	if (!lookup_entry(server, handle, &entry)) {
+		send_error(server, opcode, handle,
+						BT_ATT_ERROR_INVALID_HANDLE);
+		return;
+	}
+
+	ecode = authorize(server, handle, opcode, entry.permissions);
+	if (ecode) {
+		send_error(server, opcode, handle, ecode);
+		return;
+	}
+
+	req = async_req_new(server, opcode, handle);
+	if (!req) {
+		send_error(server, opcode, handle,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	if (is_server_ccc(&entry)) {
+		ccc = queue_find(server->ccc, match_ccc_handle,
+							UINT_TO_PTR(handle));
+		put_le16(ccc ? ccc->value : 0, value);
+
+		if (offset > sizeof(value))
+			read_complete(handle, BT_ATT_ERROR_INVALID_OFFSET,
+							NULL, 0, req);
+		else
+			read_complete(handle, 0, value + offset,
+						sizeof(value) - offset, req);
+		return;
+	}
+
+	/* Completes right away for values stored in the database */
+	if (!gatt_db_read_async(server->db, handle, offset, opcode, NULL,
+							read_complete, req)) {
+		send_error(server, opcode, handle,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		async_req_free(req);
+	}
+}
+
+static void read_mult_complete(const struct gatt_db_result *results,
+					unsigned int num, void *user_data)
+{
+	struct async_req *req = user_data;
+	struct bt_gatt_server *server = req->server;
+	uint16_t len = 0, max, size;
+	unsigned int i;
+	uint8_t *buf;
+
+	for (i = 0; i < num; i++) {
+		if (results[i].ecode) {
+			send_error(server, BT_ATT_OP_READ_MULT_REQ,
+						results[i].handle,
+						results[i].ecode);
+			goto done;
+		}
+	}
+
+	buf = rsp_alloc(server, &max);
+	if (!buf) {
+		send_error(server, BT_ATT_OP_READ_MULT_REQ, results[0].handle,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		goto done;
+	}
+
+	/* Values are concatenated, the last one may be cut short */
+	for (i = 0; i < num && len < max; i++) {
+		size = MIN(results[i].len, (size_t) (max - len));
+		memcpy(buf + len, results[i].value, size);
+		len += size;
+	}
+
+	rsp_send(server, BT_ATT_OP_READ_MULT_RSP, buf, len);
+
+done:
+	async_req_free(req);
+}
+
+static void read_mult(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	struct gatt_db_entry entry;
+	struct async_req *req;
+	uint16_t *handles;
+	unsigned int i, num;
+	uint8_t ecode;
+
+	if (len < 4 || len % 2) {
+		send_error(server, BT_ATT_OP_READ_MULT_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	num = len / 2;
+
+	handles = new0(uint16_t, num);
+	if (!handles) {
+		send_error(server, BT_ATT_OP_READ_MULT_REQ, get_le16(pdu),
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		handles[i] = get_le16(pdu + i * 2);
+
+		if (!lookup_entry(server, handles[i], &entry)) {
+			ecode = BT_ATT_ERROR_INVALID_HANDLE;
+			goto fail;
+		}
+
+		ecode = authorize(server, handles[i], BT_ATT_OP_READ_MULT_REQ,
+							entry.permissions);
+		if (ecode)
+			goto fail;
+	}
+
+	req = async_req_new(server, BT_ATT_OP_READ_MULT_REQ, handles[0]);
+	if (!req) {
+		ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+		goto fail;
+	}
+
+	if (!gatt_db_read_batch(server->db, handles, num,
+					BT_ATT_OP_READ_MULT_REQ, NULL,
+					read_mult_complete, req)) {
+		async_req_free(req);
+		i = 0;
+		ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+		goto fail;
+	}
+
+	free(handles);
+	return;
+
+fail:
+	send_error(server, BT_ATT_OP_READ_MULT_REQ, handles[i], ecode);
+	free(handles);
+}
+
+static bool read_by_grp_type_entry(const struct gatt_db_entry *entry,
+							void *user_data)
+{
+	struct rsp_data *data = user_data;
+	uint16_t size = entry->value_len + 4;
+
+	if (!entry->value)
+		return false;
+
+	if (!data->len) {
+		data->buf[0] = size;
+		data->len = 1;
+	} else if (data->buf[0] != size) {
+		return false;
+	}
+
+	if (data->len + size > data->max)
+		return false;
+
+	put_le16(entry->handle, data->buf + data->len);
+	put_le16(entry->end_handle, data->buf + data->len + 2);
+	memcpy(data->buf + data->len + 4, entry->value, entry->value_len);
+	data->len += size;
+
+	return true;
+}
+
+static void read_by_grp_type(struct bt_gatt_server *server,
+					const uint8_t *pdu, uint16_t len)
+{
+	struct rsp_data data;
+	uint16_t start, end;
+	bt_uuid_t type;
+
+	if (len != 6 && len != 20) {
+		send_error(server, BT_ATT_OP_READ_BY_GRP_TYPE_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	if (!get_range(pdu, &start, &end)) {
+		send_error(server, BT_ATT_OP_READ_BY_GRP_TYPE_REQ, start,
+						BT_ATT_ERROR_INVALID_HANDLE);
+		return;
+	}
+
+	get_uuid_le(pdu + 4, len - 4, &type);
+
+	if (!uuid_is(&type, &primary_service_uuid) &&
+				!uuid_is(&type, &secondary_service_uuid)) {
+		send_error(server, BT_ATT_OP_READ_BY_GRP_TYPE_REQ, start,
+				BT_ATT_ERROR_UNSUPPORTED_GROUP_TYPE);
+		return;
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.buf = rsp_alloc(server, &data.max);
+	if (!data.buf) {
+		send_error(server, BT_ATT_OP_READ_BY_GRP_TYPE_REQ, start,
+				BT_ATT_ERROR_INSUFFICIENT_RESOURCES);
+		return;
+	}
+
+	gatt_db_foreach_in_range(server->db, start, end, &type,
+					read_by_grp_type_entry, &data);
+
+	if (!data.len) {
+		free(data.buf);
+		send_error(server, BT_ATT_OP_READ_BY_GRP_TYPE_REQ, start,
+					BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+		return;
+	}
+
+	rsp_send(server, BT_ATT_OP_READ_BY_GRP_TYPE_RSP, data.buf, data.len);
+}
+
+/*
+ * Writes a value through the database, or to the per client state for
+ * descriptors the server manages. "func" is always called unless this
+ * returns false.
+ */
+static bool write_value(struct bt_gatt_server *server,
+					const struct gatt_db_entry *entry,
+					uint16_t offset, const uint8_t *value,
+					uint16_t len, uint8_t opcode,
+					gatt_db_complete_t func,
+					void *user_data)
+{
+	uint8_t ecode;
+
+	if (is_server_ccc(entry)) {
+		ecode = write_ccc(server, entry, offset, value, len);
+		if (func)
+			func(entry->handle, ecode, NULL, 0, user_data);
+
+		return true;
+	}
+
+	return gatt_db_write_async(server->db, entry->handle, offset, value,
+						len, opcode, NULL, func,
+						user_data) != 0;
+}
+
+static void write_complete(uint16_t handle, uint8_t ecode,
+					const uint8_t *value, size_t len,
+					void *user_data)
+{
+	struct async_req *req = user_data;
+
+	if (ecode)
+		send_error(req->server, req->opcode, handle, ecode);
+	else
+		bt_att_send(req->server->att, BT_ATT_OP_WRITE_RSP, NULL, 0,
+							NULL, NULL, NULL);
+
+	async_req_free(req);
+}
+
+static void write_req(struct bt_gatt_server *server, uint8_t opcode,
+					const uint8_t *pdu, uint16_t len)
+{
+	struct gatt_db_entry entry;
+	struct async_req *req = NULL;
+	uint16_t handle;
+	uint8_t ecode;
+
+	/* Commands are never answered, not even with an error */
+	if (len < 2) {
+		if (opcode == BT_ATT_OP_WRITE_REQ)
+			send_error(server, opcode, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	handle = get_le16(pdu);
+
+	if (!lookup_entry(server, handle, &entry)) {
+		ecode = BT_ATT_ERROR_INVALID_HANDLE;
+		goto fail;
+	}
+
+	ecode = authorize(server, handle, opcode, entry.permissions);
+	if (ecode)
+		goto fail;
+
+	if (opcode == BT_ATT_OP_WRITE_REQ) {
+		req = async_req_new(server, opcode, handle);
+		if (!req) {
+			ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+			goto fail;
+		}
+	}
+
+	if (write_value(server, &entry, 0, pdu + 2, len - 2, opcode,
+					req ? write_complete : NULL, req))
+		return;
+
+	if (req)
+		async_req_free(req);
+
+	ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+
+fail:
+	if (opcode == BT_ATT_OP_WRITE_REQ)
+		send_error(server, opcode, handle, ecode);
+}
+
+static void prep_write(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	struct gatt_db_entry entry;
+	struct prep_write *last, *prep;
+	uint16_t handle, offset, length;
+	uint8_t ecode;
+
+	if (len < 4) {
+		send_error(server, BT_ATT_OP_PREP_WRITE_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	handle = get_le16(pdu);
+	offset = get_le16(pdu + 2);
+	length = len - 4;
+
+	if (!lookup_entry(server, handle, &entry)) {
+		ecode = BT_ATT_ERROR_INVALID_HANDLE;
+		goto fail;
+	}
+
+	ecode = authorize(server, handle, BT_ATT_OP_PREP_WRITE_REQ,
+							entry.permissions);
+	if (ecode)
+		goto fail;
+
+	/* Extend the previous write when the client continues it */
+	last = queue_peek_tail(server->prep_queue);
+	if (last && last->handle == handle &&
+				last->offset + last->length == offset &&
+				last->length + length <= MAX_VALUE_LEN) {
+		prep = malloc(sizeof(*prep) + last->length + length);
+		if (!prep) {
+			ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+			goto fail;
+		}
+
+		memcpy(prep, last, sizeof(*prep) + last->length);
+		memcpy(prep->value + prep->length, pdu + 4, length);
+		prep->length += length;
+
+		queue_remove(server->prep_queue, last);
+		free(last);
+
+		if (!queue_push_tail(server->prep_queue, prep)) {
+			free(prep);
+			ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+			goto fail;
+		}
+
+		goto done;
+	}
+
+	if (queue_length(server->prep_queue) >= MAX_PREP_WRITES) {
+		ecode = BT_ATT_ERROR_PREPARE_QUEUE_FULL;
+		goto fail;
+	}
+
+	prep = malloc(sizeof(*prep) + length);
+	if (!prep) {
+		ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+		goto fail;
+	}
+
+	prep->handle = handle;
+	prep->offset = offset;
+	prep->length = length;
+	memcpy(prep->value, pdu + 4, length);
+
+	if (!queue_push_tail(server->prep_queue, prep)) {
+		free(prep);
+		ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+		goto fail;
+	}
+
+done:
+	/* The response echoes the request */
+	bt_att_send(server->att, BT_ATT_OP_PREP_WRITE_RSP, pdu, len,
+							NULL, NULL, NULL);
+	return;
+
+fail:
+	send_error(server, BT_ATT_OP_PREP_WRITE_REQ, handle, ecode);
+}
+
+static void exec_next(struct bt_gatt_server *server);
+
+static void exec_write_complete(uint16_t handle, uint8_t ecode,
+					const uint8_t *value, size_t len,
+					void *user_data)
+{
+	struct async_req *req = user_data;
+	struct bt_gatt_server *server = req->server;
+
+	if (ecode) {
+		queue_remove_all(server->prep_queue, NULL, NULL, free);
+		server->exec_pending = false;
+		send_error(server, BT_ATT_OP_EXEC_WRITE_REQ, handle, ecode);
+	} else {
+		exec_next(server);
+	}
+
+	async_req_free(req);
+}
+
+static void exec_next(struct bt_gatt_server *server)
+{
+	struct gatt_db_entry entry;
+	struct prep_write *prep;
+	struct async_req *req;
+	uint16_t handle;
+	uint8_t ecode;
+
+	prep = queue_pop_head(server->prep_queue);
+	if (!prep) {
+		server->exec_pending = false;
+		bt_att_send(server->att, BT_ATT_OP_EXEC_WRITE_RSP, NULL, 0,
+							NULL, NULL, NULL);
+		return;
+	}
+
+	handle = prep->handle;
+
+	if (!lookup_entry(server, handle, &entry)) {
+		ecode = BT_ATT_ERROR_INVALID_HANDLE;
+		goto fail;
+	}
+
+	req = async_req_new(server, BT_ATT_OP_EXEC_WRITE_REQ, handle);
+	if (!req) {
+		ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+		goto fail;
+	}
+
+	if (write_value(server, &entry, prep->offset, prep->value,
+					prep->length, BT_ATT_OP_EXEC_WRITE_REQ,
+					exec_write_complete, req)) {
+		free(prep);
+		return;
+	}
+
+	async_req_free(req);
+	ecode = BT_ATT_ERROR_INSUFFICIENT_RESOURCES;
+
+fail:
+	free(prep);
+	queue_remove_all(server->prep_queue, NULL, NULL, free);
+	server->exec_pending = false;
+	send_error(server, BT_ATT_OP_EXEC_WRITE_REQ, handle, ecode);
+}
+
+static void exec_write(struct bt_gatt_server *server, const uint8_t *pdu,
+								uint16_t len)
+{
+	if (len != 1 || pdu[0] > 0x01) {
+		send_error(server, BT_ATT_OP_EXEC_WRITE_REQ, 0,
+						BT_ATT_ERROR_INVALID_PDU);
+		return;
+	}
+
+	if (server->exec_pending) {
+		send_error(server, BT_ATT_OP_EXEC_WRITE_REQ, 0,
+						BT_ATT_ERROR_UNLIKELY);
+		return;
+	}
+
+	if (!pdu[0]) {
+		queue_remove_all(server->prep_queue, NULL, NULL, free);
+		bt_att_send(server->att, BT_ATT_OP_EXEC_WRITE_RSP, NULL, 0,
+							NULL, NULL, NULL);
+		return;
+	}
+
+	server->exec_pending = true;
+	exec_next(server);
+}
+
+static void handle_request(uint8_t opcode, const void *pdu, uint16_t len,
+							void *user_data)
+{
+	struct bt_gatt_server *server = user_data;
+
+	util_debug(server->debug_callback, server->debug_data,
+				"Request 0x%02x (%u bytes)", opcode, len);
+
+	bt_gatt_server_ref(server);
+
+	switch (opcode) {
+	case BT_ATT_OP_MTU_REQ:
+		exchange_mtu(server, pdu, len);
+		break;
+	case BT_ATT_OP_FIND_INFO_REQ:
+		find_info(server, pdu, len);
+		break;
+	case BT_ATT_OP_FIND_BY_TYPE_VAL_REQ:
+		find_by_type(server, pdu, len);
+		break;
+	case BT_ATT_OP_READ_BY_TYPE_REQ:
+		read_by_type(server, pdu, len);
+		break;
+	case BT_ATT_OP_READ_REQ:
+	case BT_ATT_OP_READ_BLOB_REQ:
+		read_value(server, opcode, pdu, len);
+		break;
+	case BT_ATT_OP_READ_MULT_REQ:
+		read_mult(server, pdu, len);
+		break;
+	case BT_ATT_OP_READ_BY_GRP_TYPE_REQ:
+		read_by_grp_type(server, pdu, len);
+		break;
+	case BT_ATT_OP_WRITE_REQ:
+	case BT_ATT_OP_WRITE_CMD:
+		write_req(server, opcode, pdu, len);
+		break;
+	case BT_ATT_OP_PREP_WRITE_REQ:
+		prep_write(server, pdu, len);
+		break;
+	case BT_ATT_OP_EXEC_WRITE_REQ:
+		exec_write(server, pdu, len);
+		break;
+	}
+
+	bt_gatt_server_unref(server);
+}
+
+struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
+					struct bt_att *att, uint16_t mtu)
+{
+	struct bt_gatt_server *server;
+	unsigned int i;
+
+	if (!db || !att)
+		return NULL;
+
+	server = new0(struct bt_gatt_server, 1);
+	if (!server)
+		return NULL;
+
+	server->db = db;
+	server->att = bt_att_ref(att);
+	server->mtu = MAX(mtu, BT_ATT_DEFAULT_LE_MTU);
+
+	server->ccc = queue_new();
+	server->prep_queue = queue_new();
+	if (!server->ccc || !server->prep_queue)
+		goto fail;
+
+	for (i = 0; i < NUM_REQUESTS; i++) {
+		server->request_ids[i] = bt_att_register(att,
+							request_opcodes[i],
+							handle_request,
+							server, NULL);
+		if (!server->request_ids[i])
+			goto fail;
+	}
+
+	return bt_gatt_server_ref(server);
+
+fail:
+	for (i = 0; i < NUM_REQUESTS; i++)
+		bt_att_unregister(att, server->request_ids[i]);
+
+	queue_destroy(server->ccc, NULL);
+	queue_destroy(server->prep_queue, NULL);
+	bt_att_unref(server->att);
+	free(server);
+
+	return NULL;
+}
+
+struct bt_gatt_server *bt_gatt_server_ref(struct bt_gatt_server *server)
+{
+	if (!server)
+		return NULL;
+
+	__sync_fetch_and_add(&server->ref_count, 1);
+
+	return server;
+}
+
+void bt_gatt_server_unref(struct bt_gatt_server *server)
+{
+	unsigned int i;
+
+	if (!server)
+		return;
+
+	if (__sync_sub_and_fetch(&server->ref_count, 1))
+		return;
+
+	for (i = 0; i < NUM_REQUESTS; i++)
+		bt_att_unregister(server->att, server->request_ids[i]);
+
+	if (server->authorize_destroy)
+		server->authorize_destroy(server->authorize_data);
+
+	if (server->debug_destroy)
+		server->debug_destroy(server->debug_data);
+
+	queue_destroy(server->ccc, free);
+	queue_destroy(server->prep_queue, free);
+	bt_att_unref(server->att);
+	free(server);
+}
+
+bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
+					bt_gatt_server_debug_func_t callback,
+					void *user_data,
+					bt_gatt_server_destroy_func_t destroy)
+{
+	if (!server)
+		return false;
+
+	if (server->debug_destroy)
+		server->debug_destroy(server->debug_data);
+
+	server->debug_callback = callback;
+	server->debug_destroy = destroy;
+	server->debug_data = user_data;
+
+	return true;
+}
+
+bool bt_gatt_server_set_authorize(struct bt_gatt_server *server,
+				bt_gatt_server_authorize_func_t callback,
+				void *user_data,
+				bt_gatt_server_destroy_func_t destroy)
+{
+	if (!server)
+		return false;
+
+	if (server->authorize_destroy)
+		server->authorize_destroy(server->authorize_data);
+
+	server->authorize_callback = callback;
+	server->authorize_destroy = destroy;
+	server->authorize_data = user_data;
+
+	return true;
+}
+
+uint16_t bt_gatt_server_get_mtu(struct bt_gatt_server *server)
+{
+	if (!server)
+		return 0;
+
+	return bt_att_get_mtu(server->att);
+}
+
+static uint8_t *value_pdu(struct bt_gatt_server *server, uint16_t handle,
+					const uint8_t *value, uint16_t *length)
+{
+	uint8_t *pdu;
+
+	*length = MIN(*length, bt_att_get_mtu(server->att) - 3);
+
+	pdu = malloc(*length + 2);
+	if (!pdu)
+		return NULL;
+
+	put_le16(handle, pdu);
+	if (*length)
+		memcpy(pdu + 2, value, *length);
+
+	*length += 2;
+
+	return pdu;
+}
+
+bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length)
+{
+	uint8_t *pdu;
+
+	if (!server || !handle || (length && !value))
+		return false;
+
+	pdu = value_pdu(server, handle, value, &length);
+	if (!pdu)
+		return false;
+
+	if (!bt_att_send_buf(server->att, BT_ATT_OP_HANDLE_VAL_NOT, pdu,
+					length, free, pdu, NULL, NULL, NULL)) {
+		free(pdu);
+		return false;
+	}
+
+	return true;
+}
+
+static void conf_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct ind_data *data = user_data;
+
+	if (opcode == BT_ATT_OP_HANDLE_VAL_CONF && data && data->callback)
+		data->callback(data->user_data);
+}
+
+static void ind_data_destroy(void *user_data)
+{
+	struct ind_data *data = user_data;
+
+	if (!data)
+		return;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+}
+
+bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length,
+					bt_gatt_server_conf_func_t callback,
+					void *user_data,
+					bt_gatt_server_destroy_func_t destroy)
+{
+	struct ind_data *data;
+	uint8_t *pdu;
+
+	if (!server || !handle || (length && !value))
+		return false;
+
+	data = new0(struct ind_data, 1);
+	if (!data)
+		return false;
+
+	data->callback = callback;
+	data->destroy = destroy;
+	data->user_data = user_data;
+
+	pdu = value_pdu(server, handle, value, &length);
+	if (!pdu) {
+		free(data);
+		return false;
+	}
+
+	if (!bt_att_send_buf(server->att, BT_ATT_OP_HANDLE_VAL_IND, pdu,
+					length, free, pdu, conf_cb, data,
+					ind_data_destroy)) {
+		free(pdu);
+		free(data);
+		return false;
+	}
+
+	return true;
+}
+
+static void shared_pdu_unref(void *user_data)
+{
+	struct shared_pdu *pdu = user_data;
+
+	if (__sync_sub_and_fetch(&pdu->ref_count, 1))
+		return;
+
+	free(pdu);
+}
+
+struct notify_all_data {
+	struct shared_pdu *pdu;
+	uint16_t handle;
+	unsigned int count;
+};
+
+static void notify_server(void *data, void *user_data)
+{
+	struct bt_gatt_server *server = data;
+	struct notify_all_data *notify = user_data;
+	struct shared_pdu *pdu = notify->pdu;
+	struct ccc_state *ccc;
+	uint16_t len;
+	uint8_t opcode;
+	bool sent;
+
+	ccc = queue_find(server->ccc, match_ccc_value_handle,
+						UINT_TO_PTR(notify->handle));
+	if (!ccc || !(ccc->value & (CCC_NOTIFY | CCC_INDICATE)))
+		return;
+
+	len = MIN(pdu->len, bt_att_get_mtu(server->att) - 1);
+	opcode = ccc->value & CCC_NOTIFY ? BT_ATT_OP_HANDLE_VAL_NOT :
+						BT_ATT_OP_HANDLE_VAL_IND;
+
+	__sync_fetch_and_add(&pdu->ref_count, 1);
+
+	/* Indications need a response handler even if nobody waits for it */
+	sent = bt_att_send_buf(server->att, opcode, pdu->data, len,
+				shared_pdu_unref, pdu,
+				opcode == BT_ATT_OP_HANDLE_VAL_IND ?
+							conf_cb : NULL,
+				NULL, NULL) != 0;
+	if (!sent) {
+		shared_pdu_unref(pdu);
+		return;
+	}
+
+	notify->count++;
+}
+
+unsigned int bt_gatt_server_notify_all(struct queue *servers,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length)
+{
+	struct notify_all_data data;
+
+	if (!servers || !handle || (length && !value))
+		return 0;
+
+	length = MIN(length, MAX_VALUE_LEN);
+
+	data.pdu = malloc(sizeof(*data.pdu) + length + 2);
+	if (!data.pdu)
+		return 0;
+
+	data.pdu->ref_count = 1;
+	data.pdu->len = length + 2;
+	put_le16(handle, data.pdu->data);
+	if (length)
+		memcpy(data.pdu->data + 2, value, length);
+
+	data.handle = handle;
+	data.count = 0;
+
+	queue_foreach(servers, notify_server, &data);
+
+	shared_pdu_unref(data.pdu);
+
+	return data.count;
+}
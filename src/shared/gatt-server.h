@@ -0,0 +1,81 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bt_gatt_server;
+struct gatt_db;
+struct queue;
+
+/*
+ * Serves "db" to the remote end of "att". The database must outlive the
+ * server, several servers may share one database.
+ */
+struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
+					struct bt_att *att, uint16_t mtu);
+
+struct bt_gatt_server *bt_gatt_server_ref(struct bt_gatt_server *server);
+void bt_gatt_server_unref(struct bt_gatt_server *server);
+
+typedef void (*bt_gatt_server_destroy_func_t)(void *user_data);
+typedef void (*bt_gatt_server_debug_func_t)(const char *str, void *user_data);
+typedef void (*bt_gatt_server_conf_func_t)(void *user_data);
+
+/* Returns 0 to allow the access or the ATT error code to reject it with */
+typedef uint8_t (*bt_gatt_server_authorize_func_t)(uint16_t handle,
+						uint8_t att_opcode,
+						uint32_t permissions,
+						void *user_data);
+
+bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
+					bt_gatt_server_debug_func_t callback,
+					void *user_data,
+					bt_gatt_server_destroy_func_t destroy);
+
+bool bt_gatt_server_set_authorize(struct bt_gatt_server *server,
+				bt_gatt_server_authorize_func_t callback,
+				void *user_data,
+				bt_gatt_server_destroy_func_t destroy);
+
+uint16_t bt_gatt_server_get_mtu(struct bt_gatt_server *server);
+
+bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length);
+
+bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length,
+					bt_gatt_server_conf_func_t callback,
+					void *user_data,
+					bt_gatt_server_destroy_func_t destroy);
+
+/*
+ * Sends the new value of "handle" to every server in "servers" whose
+ * client enabled notifications or indications for it, sharing a single
+ * PDU buffer. Returns the number of clients the value was sent to.
+ */
+unsigned int bt_gatt_server_notify_all(struct queue *servers,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length);
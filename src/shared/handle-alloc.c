@@ -0,0 +1,258 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/handle-alloc.h"
+
+struct handle_range {
+	uint16_t start;
+	uint16_t end;
+};
+
+/* Free ranges, sorted and never adjacent to each other */
+struct handle_alloc {
+	uint16_t first;
+	uint16_t last;
+	struct handle_range *ranges;
+	unsigned int len;
+	unsigned int size;
+};
+
+struct handle_alloc *handle_alloc_new(uint16_t first, uint16_t last)
+{
+	struct handle_alloc *alloc;
+
+	if (!first || first > last)
+		return NULL;
+
+	alloc = new0(struct handle_alloc, 1);
+	if (!alloc)
+		return NULL;
+
+	alloc->ranges = new0(struct handle_range, 1);
+	if (!alloc->ranges) {
+		free(alloc);
+		return NULL;
+	}
+
+	alloc->first = first;
+	alloc->last = last;
+	alloc->ranges[0].start = first;
+	alloc->ranges[0].end = last;
+	alloc->len = 1;
+	alloc->size = 1;
+
+	return alloc;
+}
+
+void handle_alloc_destroy(struct handle_alloc *alloc)
+{
+	if (!alloc)
+		return;
+
+	free(alloc->ranges);
+	free(alloc);
+}
+
+/* Index of the first range not ending below "handle" */
+static unsigned int find_range(struct handle_alloc *alloc, uint16_t handle)
+{
+	unsigned int low = 0, high = alloc->len;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+
+		if (alloc->ranges[mid].end < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool insert_range(struct handle_alloc *alloc, unsigned int i,
+					uint16_t start, uint16_t end)
+{
+	struct handle_range *ranges;
+
+	if (alloc->len == alloc->size) {
+		ranges = realloc(alloc->ranges,
+				alloc->size * 2 * sizeof(*ranges));
+		if (!ranges)
+			return false;
+
+		alloc->ranges = ranges;
+		alloc->size *= 2;
+	}
+
+	memmove(&alloc->ranges[i + 1], &alloc->ranges[i],
+			(alloc->len - i) * sizeof(*alloc->ranges));
+	alloc->ranges[i].start = start;
+	alloc->ranges[i].end = end;
+	alloc->len++;
+
+	return true;
+}
+
+static void remove_range(struct handle_alloc *alloc, unsigned int i)
+{
+	alloc->len--;
+	memmove(&alloc->ranges[i], &alloc->ranges[i + 1],
+			(alloc->len - i) * sizeof(*alloc->ranges));
+}
+
+/* Takes start to end out of range i, which must contain both */
+static bool take(struct handle_alloc *alloc, unsigned int i,
+					uint16_t start, uint16_t end)
+{
+	struct handle_range *range = &alloc->ranges[i];
+
+	if (range->start == start && range->end == end) {
+		remove_range(alloc, i);
+		return true;
+	}
+
+	if (range->start == start) {
+		range->start = end + 1;
+		return true;
+	}
+
+	if (range->end == end) {
+		range->end = start - 1;
+		return true;
+	}
+
+	if (!insert_range(alloc, i + 1, end + 1, range->end))
+		return false;
+
+	alloc->ranges[i].end = start - 1;
+
+	return true;
+}
+
+uint16_t handle_alloc_get(struct handle_alloc *alloc, uint16_t count)
+{
+	unsigned int i;
+
+	if (!alloc || !count)
+		return 0;
+
+	for (i = 0; i < alloc->len; i++) {
+		struct handle_range *range = &alloc->ranges[i];
+		uint16_t start = range->start;
+
+		if (range->end - start + 1 < count)
+			continue;
+
+		if (!take(alloc, i, start, start + count - 1))
+			return 0;
+
+		return start;
+	}
+
+	return 0;
+}
+
+bool handle_alloc_reserve(struct handle_alloc *alloc, uint16_t start,
+							uint16_t count)
+{
+	unsigned int i;
+	uint16_t end;
+
+	if (!alloc || !count || start < alloc->first ||
+					count - 1 > alloc->last - start)
+		return false;
+
+	end = start + count - 1;
+
+	i = find_range(alloc, start);
+	if (i == alloc->len || alloc->ranges[i].start > start ||
+						alloc->ranges[i].end < end)
+		return false;
+
+	return take(alloc, i, start, end);
+}
+
+void handle_alloc_put(struct handle_alloc *alloc, uint16_t start,
+							uint16_t count)
+{
+	struct handle_range *prev = NULL, *next = NULL;
+	unsigned int i;
+	uint16_t end;
+
+	if (!alloc || !count || start < alloc->first ||
+					count - 1 > alloc->last - start)
+		return;
+
+	end = start + count - 1;
+
+	i = find_range(alloc, start);
+
+	/* Already free, at least partly */
+	if (i < alloc->len && alloc->ranges[i].start <= end)
+		return;
+
+	if (i > 0 && alloc->ranges[i - 1].end == start - 1)
+		prev = &alloc->ranges[i - 1];
+
+	if (i < alloc->len && alloc->ranges[i].start == end + 1)
+		next = &alloc->ranges[i];
+
+	if (prev && next) {
+		prev->end = next->end;
+		remove_range(alloc, i);
+	} else if (prev) {
+		prev->end = end;
+	} else if (next) {
+		next->start = start;
+	} else {
+		insert_range(alloc, i, start, end);
+	}
+}
+
+void handle_alloc_foreach(struct handle_alloc *alloc, bool reverse,
+					handle_alloc_func_t func,
+					void *user_data)
+{
+	unsigned int i;
+
+	if (!alloc || !func)
+		return;
+
+	for (i = 0; i < alloc->len; i++) {
+		struct handle_range *range;
+
+		range = &alloc->ranges[reverse ? alloc->len - i - 1 : i];
+
+		if (func(range->start, range->end, user_data))
+			return;
+	}
+}
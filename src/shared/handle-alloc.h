@@ -0,0 +1,55 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hands out ranges of consecutive handles, reusing the ones released
+ * earlier. Only the free ranges are stored, so the cost of every
+ * operation depends on the number of holes, not on the number of handles
+ * in use.
+ */
+struct handle_alloc;
+
+struct handle_alloc *handle_alloc_new(uint16_t first, uint16_t last);
+void handle_alloc_destroy(struct handle_alloc *alloc);
+
+/* Lowest free range of "count" handles, 0 if there is none */
+uint16_t handle_alloc_get(struct handle_alloc *alloc, uint16_t count);
+
+/* Takes exactly "start" to "start + count - 1", fails if any is in use */
+bool handle_alloc_reserve(struct handle_alloc *alloc, uint16_t start,
+							uint16_t count);
+
+void handle_alloc_put(struct handle_alloc *alloc, uint16_t start,
+							uint16_t count);
+
+/* Walks the free ranges in handle order until "func" returns true */
+typedef bool (*handle_alloc_func_t)(uint16_t start, uint16_t end,
+							void *user_data);
+
+void handle_alloc_foreach(struct handle_alloc *alloc, bool reverse,
+					handle_alloc_func_t func,
+					void *user_data);
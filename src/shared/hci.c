@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 
 #include "monitor/bt.h"
@@ -36,6 +37,7 @@
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 #include "src/shared/hci.h"
+#include "src/shared/trace.h"
 
 #define BTPROTO_HCI	1
 struct sockaddr_hci {
@@ -54,6 +56,12 @@ struct hci_filter {
 	uint16_t opcode;
 };
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define HCI_POOL_MAX 8
+#define HCI_POOL_BUF_SIZE 32
+#define HCI_DATA_IOV_MAX 8
+
 struct bt_hci {
 	int ref_count;
 	struct io *io;
@@ -64,7 +72,17 @@ struct bt_hci {
 	unsigned int next_evt_id;
 	struct queue *cmd_queue;
 	struct queue *rsp_queue;
-	struct queue *evt_list;
+	struct queue *evt_list[256];
+	struct cmd *pool;
+	unsigned int pool_count;
+	uint16_t acl_mtu;
+	uint16_t acl_max;
+	uint16_t acl_pkts;
+	bool acl_le;
+	unsigned int data_queued;
+	struct queue *conn_list;
+	struct queue *conn_ready;
+	struct queue *data_list;
 };
 
 struct cmd {
@@ -75,6 +93,10 @@ struct cmd {
 	bt_hci_callback_func_t callback;
 	bt_hci_destroy_func_t destroy;
 	void *user_data;
+	struct bt_hci *hci;
+	struct cmd *next;
+	unsigned int alloc;
+	uint8_t buf[0];
 };
 
 struct evt {
@@ -85,6 +107,70 @@ struct evt {
 	void *user_data;
 };
 
+static struct cmd *cmd_alloc(struct bt_hci *hci, uint8_t size)
+{
+	struct cmd *cmd;
+	unsigned int alloc;
+
+	if (size <= HCI_POOL_BUF_SIZE && hci->pool) {
+		cmd = hci->pool;
+		hci->pool = cmd->next;
+		hci->pool_count--;
+	} else {
+		alloc = size > HCI_POOL_BUF_SIZE ? size : HCI_POOL_BUF_SIZE;
+
+		cmd = malloc(sizeof(*cmd) + alloc);
+		if (!cmd)
+			return NULL;
+
+		cmd->alloc = alloc;
+	}
+
+	alloc = cmd->alloc;
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->alloc = alloc;
+
+	cmd->hci = hci;
+	cmd->data = cmd->buf;
+	cmd->size = size;
+
+	return cmd;
+}
+
+static void cmd_release(struct cmd *cmd)
+{
+	struct bt_hci *hci = cmd->hci;
+
+	if (cmd->alloc > HCI_POOL_BUF_SIZE ||
+					hci->pool_count >= HCI_POOL_MAX) {
+		free(cmd);
+		return;
+	}
+
+	cmd->next = hci->pool;
+	hci->pool = cmd;
+	hci->pool_count++;
+}
+
+struct conn {
+	uint16_t handle;
+	unsigned int pending;
+	struct queue *pkts;
+};
+
+struct pkt {
+	uint16_t handle;
+	uint16_t len;
+	uint8_t data[0];
+};
+
+struct data {
+	unsigned int id;
+	bt_hci_data_func_t callback;
+	bt_hci_destroy_func_t destroy;
+	void *user_data;
+};
+
 static void cmd_free(void *data)
 {
 	struct cmd *cmd = data;
@@ -92,8 +178,19 @@ static void cmd_free(void *data)
 	if (cmd->destroy)
 		cmd->destroy(cmd->user_data);
 
-	free(cmd->data);
-	free(cmd);
+	cmd_release(cmd);
+}
+
+static void pool_free(struct bt_hci *hci)
+{
+	while (hci->pool) {
+		struct cmd *cmd = hci->pool;
+
+		hci->pool = cmd->next;
+		free(cmd);
+	}
+
+	hci->pool_count = 0;
 }
 
 static void evt_free(void *data)
@@ -106,7 +203,25 @@ static void evt_free(void *data)
 	free(evt);
 }
 
-static void send_command(struct bt_hci *hci, uint16_t opcode,
+static void data_free(void *data)
+{
+	struct data *handler = data;
+
+	if (handler->destroy)
+		handler->destroy(handler->user_data);
+
+	free(handler);
+}
+
+static void conn_free(void *data)
+{
+	struct conn *conn = data;
+
+	queue_destroy(conn->pkts, free);
+	free(conn);
+}
+
+static bool send_command(struct bt_hci *hci, uint16_t opcode,
 						void *data, uint8_t size)
 {
 	uint8_t type = BT_H4_CMD_PKT;
@@ -115,7 +230,7 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 	int fd, iovcnt;
 
 	if (hci->num_cmds < 1)
-		return;
+		return false;
 
 	hdr.opcode = cpu_to_le16(opcode);
 	hdr.plen = size;
@@ -134,12 +249,101 @@ static void send_command(struct bt_hci *hci, uint16_t opcode,
 
 	fd = io_get_fd(hci->io);
 	if (fd < 0)
-		return;
+		return false;
 
 	if (writev(fd, iov, iovcnt) < 0)
-		return;
+		return false;
+
+	BT_TRACE2(hci_command, opcode, size);
 
 	hci->num_cmds--;
+
+	return true;
+}
+
+static bool acl_credits(struct bt_hci *hci)
+{
+	/* Without known buffer sizes the data path is not flow controlled */
+	return !hci->acl_max || hci->acl_pkts > 0;
+}
+
+static bool send_data(struct bt_hci *hci, uint16_t handle,
+					const struct iovec *iov, int iovcnt)
+{
+	uint8_t type = BT_H4_ACL_PKT;
+	struct bt_hci_acl_hdr hdr;
+	struct iovec vec[HCI_DATA_IOV_MAX + 2];
+	size_t len = 0;
+	int fd, i;
+
+	for (i = 0; i < iovcnt; i++) {
+		vec[i + 2] = iov[i];
+		len += iov[i].iov_len;
+	}
+
+	hdr.handle = cpu_to_le16(handle);
+	hdr.dlen = cpu_to_le16(len);
+
+	vec[0].iov_base = &type;
+	vec[0].iov_len  = 1;
+	vec[1].iov_base = &hdr;
+	vec[1].iov_len  = sizeof(hdr);
+
+	fd = io_get_fd(hci->io);
+	if (fd < 0)
+		return false;
+
+	if (writev(fd, vec, iovcnt + 2) < 0)
+		return false;
+
+	if (hci->acl_max)
+		hci->acl_pkts--;
+
+	return true;
+}
+
+static bool match_conn_handle(const void *a, const void *b)
+{
+	const struct conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return conn->handle == handle;
+}
+
+static void write_data(struct bt_hci *hci)
+{
+	/*
+	 * Connections with queued packets take turns, one packet each,
+	 * so a single busy link cannot starve the others.
+	 */
+	while (hci->data_queued > 0 && acl_credits(hci)) {
+		struct conn *conn;
+		struct pkt *pkt;
+		struct iovec iov;
+
+		conn = queue_pop_head(hci->conn_ready);
+		if (!conn)
+			break;
+
+		pkt = queue_peek_head(conn->pkts);
+
+		iov.iov_base = pkt->data;
+		iov.iov_len = pkt->len;
+
+		if (!send_data(hci, pkt->handle, &iov, 1)) {
+			queue_push_head(hci->conn_ready, conn);
+			break;
+		}
+
+		queue_pop_head(conn->pkts);
+		free(pkt);
+
+		hci->data_queued--;
+		conn->pending++;
+
+		if (!queue_isempty(conn->pkts))
+			queue_push_tail(hci->conn_ready, conn);
+	}
 }
 
 static bool io_write_callback(struct io *io, void *user_data)
@@ -147,12 +351,26 @@ static bool io_write_callback(struct io *io, void *user_data)
 	struct bt_hci *hci = user_data;
 	struct cmd *cmd;
 
-	cmd = queue_pop_head(hci->cmd_queue);
-	if (cmd) {
-		send_command(hci, cmd->opcode, cmd->data, cmd->size);
+	/*
+	 * Submit as many commands as the controller has announced credits
+	 * for. Responses are matched in order, so several commands with
+	 * the same opcode can safely be outstanding at once.
+	 */
+	while (hci->num_cmds > 0) {
+		cmd = queue_pop_head(hci->cmd_queue);
+		if (!cmd)
+			break;
+
+		if (!send_command(hci, cmd->opcode, cmd->data, cmd->size)) {
+			queue_push_head(hci->cmd_queue, cmd);
+			break;
+		}
+
 		queue_push_tail(hci->rsp_queue, cmd);
 	}
 
+	write_data(hci);
+
 	hci->writer_active = false;
 
 	return false;
@@ -163,10 +381,8 @@ static void wakeup_writer(struct bt_hci *hci)
 	if (hci->writer_active)
 		return;
 
-	if (hci->num_cmds < 1)
-		return;
-
-	if (queue_isempty(hci->cmd_queue))
+	if ((hci->num_cmds < 1 || queue_isempty(hci->cmd_queue)) &&
+			(!hci->data_queued || !acl_credits(hci)))
 		return;
 
 	if (!io_set_write_handler(hci->io, io_write_callback, hci, NULL))
@@ -183,18 +399,59 @@ static bool match_cmd_opcode(const void *a, const void *b)
 	return cmd->opcode == opcode;
 }
 
+static void set_acl_buffers(struct bt_hci *hci, uint16_t mtu, uint16_t max)
+{
+	unsigned int pending = hci->acl_max - hci->acl_pkts;
+
+	hci->acl_mtu = mtu;
+	hci->acl_max = max;
+	hci->acl_pkts = max > pending ? max - pending : 0;
+}
+
+static void process_buffer_size(struct bt_hci *hci, uint16_t opcode,
+					const void *data, size_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rsp = data;
+	const struct bt_hci_rsp_le_read_buffer_size *le_rsp = data;
+
+	switch (opcode) {
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		if (size < sizeof(*rsp) || rsp->status)
+			return;
+		set_acl_buffers(hci, le16_to_cpu(rsp->acl_mtu),
+					le16_to_cpu(rsp->acl_max_pkt));
+		hci->acl_le = false;
+		break;
+
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		/* LE only controllers have no BR/EDR buffer information */
+		if (size < sizeof(*le_rsp) || le_rsp->status)
+			return;
+		if (!le_rsp->le_max_pkt || (hci->acl_max && !hci->acl_le))
+			return;
+		set_acl_buffers(hci, le16_to_cpu(le_rsp->le_mtu),
+						le_rsp->le_max_pkt);
+		hci->acl_le = true;
+		break;
+	}
+}
+
 static void process_response(struct bt_hci *hci, uint16_t opcode,
 					const void *data, size_t size)
 {
 	struct cmd *cmd;
 
+	BT_TRACE2(hci_response, opcode, size);
+
 	if (opcode == BT_HCI_CMD_NOP)
 		goto done;
 
+	process_buffer_size(hci, opcode, data, size);
+
 	cmd = queue_remove_if(hci->rsp_queue, match_cmd_opcode,
 						UINT_TO_PTR(opcode));
 	if (!cmd)
-		return;
+		goto done;
 
 	if (cmd->callback)
 		cmd->callback(data, size, cmd->user_data);
@@ -210,11 +467,64 @@ static void process_notify(void *data, void *user_data)
 	struct bt_hci_evt_hdr *hdr = user_data;
 	struct evt *evt = data;
 
-	if (evt->event == hdr->evt)
-		evt->callback(user_data + sizeof(struct bt_hci_evt_hdr),
+	evt->callback(user_data + sizeof(struct bt_hci_evt_hdr),
 						hdr->plen, evt->user_data);
 }
 
+static void process_completed(struct bt_hci *hci, const void *data,
+								size_t size)
+{
+	const struct bt_hci_evt_num_completed_packets *evt = data;
+	const uint8_t *ptr = data + 1;
+	uint8_t i;
+
+	if (size < 1 || size < 1 + evt->num_handles * 4U)
+		return;
+
+	for (i = 0; i < evt->num_handles; i++, ptr += 4) {
+		uint16_t handle = get_le16(ptr) & 0x0fff;
+		uint16_t count = get_le16(ptr + 2);
+		struct conn *conn;
+
+		conn = queue_find(hci->conn_list, match_conn_handle,
+							UINT_TO_PTR(handle));
+		if (conn)
+			conn->pending -= MIN(count, conn->pending);
+
+		if (hci->acl_max)
+			hci->acl_pkts = MIN(hci->acl_pkts + count,
+							hci->acl_max);
+	}
+
+	wakeup_writer(hci);
+}
+
+static void process_disconnect(struct bt_hci *hci, const void *data,
+								size_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = queue_remove_if(hci->conn_list, match_conn_handle,
+				UINT_TO_PTR(le16_to_cpu(evt->handle)));
+	if (!conn)
+		return;
+
+	/* The controller flushes whatever was still buffered for the link */
+	if (hci->acl_max)
+		hci->acl_pkts = MIN(hci->acl_pkts + conn->pending,
+							hci->acl_max);
+
+	hci->data_queued -= queue_length(conn->pkts);
+	queue_remove(hci->conn_ready, conn);
+	conn_free(conn);
+
+	wakeup_writer(hci);
+}
+
 static void process_event(struct bt_hci *hci, const void *data, size_t size)
 {
 	const struct bt_hci_evt_hdr *hdr = data;
@@ -230,6 +540,8 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 	if (hdr->plen != size)
 		return;
 
+	BT_TRACE2(hci_event, hdr->evt, size);
+
 	switch (hdr->evt) {
 	case BT_HCI_EVT_CMD_COMPLETE:
 		if (size < sizeof(*cc))
@@ -249,16 +561,67 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 		process_response(hci, le16_to_cpu(cs->opcode), &cs->status, 1);
 		break;
 
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		process_completed(hci, data, size);
+		queue_foreach(hci->evt_list[hdr->evt], process_notify,
+								(void *) hdr);
+		break;
+
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		process_disconnect(hci, data, size);
+		queue_foreach(hci->evt_list[hdr->evt], process_notify,
+								(void *) hdr);
+		break;
+
 	default:
-		queue_foreach(hci->evt_list, process_notify, (void *) hdr);
+		queue_foreach(hci->evt_list[hdr->evt], process_notify,
+								(void *) hdr);
 		break;
 	}
 }
 
+struct data_notify {
+	uint16_t handle;
+	uint8_t flags;
+	const void *data;
+	uint16_t size;
+};
+
+static void process_data_notify(void *data, void *user_data)
+{
+	struct data_notify *notify = user_data;
+	struct data *handler = data;
+
+	handler->callback(notify->handle, notify->flags, notify->data,
+					notify->size, handler->user_data);
+}
+
+static void process_data(struct bt_hci *hci, const void *data, size_t size)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	struct data_notify notify;
+	uint16_t handle;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	if (le16_to_cpu(hdr->dlen) != size - sizeof(*hdr))
+		return;
+
+	handle = le16_to_cpu(hdr->handle);
+
+	notify.handle = handle & 0x0fff;
+	notify.flags = handle >> 12;
+	notify.data = data + sizeof(*hdr);
+	notify.size = size - sizeof(*hdr);
+
+	queue_foreach(hci->data_list, process_data_notify, &notify);
+}
+
 static bool io_read_callback(struct io *io, void *user_data)
 {
 	struct bt_hci *hci = user_data;
-	uint8_t buf[512];
+	uint8_t buf[4096];
 	ssize_t len;
 	int fd;
 
@@ -280,6 +643,9 @@ static bool io_read_callback(struct io *io, void *user_data)
 	case BT_H4_EVT_PKT:
 		process_event(hci, buf + 1, len - 1);
 		break;
+	case BT_H4_ACL_PKT:
+		process_data(hci, buf + 1, len - 1);
+		break;
 	}
 
 	return true;
@@ -323,8 +689,13 @@ static struct bt_hci *create_hci(int fd)
 		return NULL;
 	}
 
-	hci->evt_list = queue_new();
-	if (!hci->evt_list) {
+	hci->conn_list = queue_new();
+	hci->conn_ready = queue_new();
+	hci->data_list = queue_new();
+	if (!hci->conn_list || !hci->conn_ready || !hci->data_list) {
+		queue_destroy(hci->data_list, NULL);
+		queue_destroy(hci->conn_ready, NULL);
+		queue_destroy(hci->conn_list, NULL);
 		queue_destroy(hci->rsp_queue, NULL);
 		queue_destroy(hci->cmd_queue, NULL);
 		io_destroy(hci->io);
@@ -333,7 +704,9 @@ static struct bt_hci *create_hci(int fd)
 	}
 
 	if (!io_set_read_handler(hci->io, io_read_callback, hci, NULL)) {
-		queue_destroy(hci->evt_list, NULL);
+		queue_destroy(hci->data_list, NULL);
+		queue_destroy(hci->conn_ready, NULL);
+		queue_destroy(hci->conn_list, NULL);
 		queue_destroy(hci->rsp_queue, NULL);
 		queue_destroy(hci->cmd_queue, NULL);
 		io_destroy(hci->io);
@@ -445,16 +818,26 @@ struct bt_hci *bt_hci_ref(struct bt_hci *hci)
 
 void bt_hci_unref(struct bt_hci *hci)
 {
+	int i;
+
 	if (!hci)
 		return;
 
 	if (__sync_sub_and_fetch(&hci->ref_count, 1))
 		return;
 
-	queue_destroy(hci->evt_list, evt_free);
+	for (i = 0; i < 256; i++)
+		queue_destroy(hci->evt_list[i], evt_free);
+
+	queue_destroy(hci->data_list, data_free);
+	queue_destroy(hci->conn_ready, NULL);
+	queue_destroy(hci->conn_list, conn_free);
+
 	queue_destroy(hci->cmd_queue, cmd_free);
 	queue_destroy(hci->rsp_queue, cmd_free);
 
+	pool_free(hci);
+
 	io_destroy(hci->io);
 
 	free(hci);
@@ -478,22 +861,14 @@ unsigned int bt_hci_send(struct bt_hci *hci, uint16_t opcode,
 	if (!hci)
 		return 0;
 
-	cmd = new0(struct cmd, 1);
+	cmd = cmd_alloc(hci, size);
 	if (!cmd)
 		return 0;
 
 	cmd->opcode = opcode;
-	cmd->size = size;
-
-	if (cmd->size > 0) {
-		cmd->data = malloc(cmd->size);
-		if (!cmd->data) {
-			free(cmd);
-			return 0;
-		}
 
+	if (cmd->size > 0)
 		memcpy(cmd->data, data, cmd->size);
-	}
 
 	if (hci->next_cmd_id < 1)
 		hci->next_cmd_id = 1;
@@ -505,8 +880,7 @@ unsigned int bt_hci_send(struct bt_hci *hci, uint16_t opcode,
 	cmd->user_data = user_data;
 
 	if (!queue_push_tail(hci->cmd_queue, cmd)) {
-		free(cmd->data);
-		free(cmd);
+		cmd_release(cmd);
 		return 0;
 	}
 
@@ -558,6 +932,10 @@ bool bt_hci_flush(struct bt_hci *hci)
 	queue_remove_all(hci->cmd_queue, NULL, NULL, cmd_free);
 	queue_remove_all(hci->rsp_queue, NULL, NULL, cmd_free);
 
+	queue_remove_all(hci->conn_ready, NULL, NULL, NULL);
+	queue_remove_all(hci->conn_list, NULL, NULL, conn_free);
+	hci->data_queued = 0;
+
 	return true;
 }
 
@@ -570,6 +948,12 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 	if (!hci)
 		return 0;
 
+	if (!hci->evt_list[event]) {
+		hci->evt_list[event] = queue_new();
+		if (!hci->evt_list[event])
+			return 0;
+	}
+
 	evt = new0(struct evt, 1);
 	if (!evt)
 		return 0;
@@ -585,7 +969,7 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 	evt->destroy = destroy;
 	evt->user_data = user_data;
 
-	if (!queue_push_tail(hci->evt_list, evt)) {
+	if (!queue_push_tail(hci->evt_list[event], evt)) {
 		free(evt);
 		return 0;
 	}
@@ -601,18 +985,157 @@ static bool match_evt_id(const void *a, const void *b)
 	return evt->id == id;
 }
 
+static bool match_data_id(const void *a, const void *b)
+{
+	const struct data *handler = a;
+	unsigned int id = PTR_TO_UINT(b);
+
+	return handler->id == id;
+}
+
 bool bt_hci_unregister(struct bt_hci *hci, unsigned int id)
 {
+	struct data *handler;
 	struct evt *evt;
+	int i;
 
 	if (!hci || !id)
 		return false;
 
-	evt = queue_remove_if(hci->evt_list, match_evt_id, UINT_TO_PTR(id));
-	if (!evt)
+	for (i = 0; i < 256; i++) {
+		evt = queue_remove_if(hci->evt_list[i], match_evt_id,
+							UINT_TO_PTR(id));
+		if (evt) {
+			evt_free(evt);
+			return true;
+		}
+	}
+
+	handler = queue_remove_if(hci->data_list, match_data_id,
+							UINT_TO_PTR(id));
+	if (!handler)
 		return false;
 
-	evt_free(evt);
+	data_free(handler);
 
 	return true;
 }
+
+static struct conn *get_conn(struct bt_hci *hci, uint16_t handle)
+{
+	struct conn *conn;
+
+	conn = queue_find(hci->conn_list, match_conn_handle,
+							UINT_TO_PTR(handle));
+	if (conn)
+		return conn;
+
+	conn = new0(struct conn, 1);
+	if (!conn)
+		return NULL;
+
+	conn->handle = handle;
+
+	conn->pkts = queue_new();
+	if (!conn->pkts) {
+		free(conn);
+		return NULL;
+	}
+
+	if (!queue_push_tail(hci->conn_list, conn)) {
+		conn_free(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+bool bt_hci_send_data(struct bt_hci *hci, uint16_t handle, uint8_t flags,
+					const struct iovec *iov, int iovcnt)
+{
+	struct conn *conn;
+	struct pkt *pkt;
+	size_t len = 0;
+	uint8_t *ptr;
+	int i;
+
+	if (!hci || handle > 0x0eff || (iovcnt > 0 && !iov) || iovcnt < 0)
+		return false;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > UINT16_MAX || (hci->acl_mtu && len > hci->acl_mtu))
+		return false;
+
+	conn = get_conn(hci, handle);
+	if (!conn)
+		return false;
+
+	handle |= (flags & 0x0f) << 12;
+
+	/* Send straight from the caller's buffers when nothing is queued */
+	if (!hci->data_queued && acl_credits(hci) &&
+					iovcnt <= HCI_DATA_IOV_MAX) {
+		if (send_data(hci, handle, iov, iovcnt)) {
+			conn->pending++;
+			return true;
+		}
+	}
+
+	pkt = malloc(sizeof(*pkt) + len);
+	if (!pkt)
+		return false;
+
+	pkt->handle = handle;
+	pkt->len = len;
+
+	for (i = 0, ptr = pkt->data; i < iovcnt; i++) {
+		memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+		ptr += iov[i].iov_len;
+	}
+
+	if (!queue_push_tail(conn->pkts, pkt)) {
+		free(pkt);
+		return false;
+	}
+
+	if (queue_length(conn->pkts) == 1)
+		queue_push_tail(hci->conn_ready, conn);
+
+	hci->data_queued++;
+
+	wakeup_writer(hci);
+
+	return true;
+}
+
+unsigned int bt_hci_register_data(struct bt_hci *hci,
+				bt_hci_data_func_t callback,
+				void *user_data, bt_hci_destroy_func_t destroy)
+{
+	struct data *handler;
+
+	if (!hci || !callback)
+		return 0;
+
+	handler = new0(struct data, 1);
+	if (!handler)
+		return 0;
+
+	if (hci->next_evt_id < 1)
+		hci->next_evt_id = 1;
+
+	handler->id = hci->next_evt_id++;
+
+	handler->callback = callback;
+	handler->destroy = destroy;
+	handler->user_data = user_data;
+
+	if (!queue_push_tail(hci->data_list, handler)) {
+		free(handler);
+		return 0;
+	}
+
+	return handler->id;
+}
@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 typedef void (*bt_hci_destroy_func_t)(void *user_data);
 
@@ -51,3 +52,13 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 				bt_hci_callback_func_t callback,
 				void *user_data, bt_hci_destroy_func_t destroy);
 bool bt_hci_unregister(struct bt_hci *hci, unsigned int id);
+
+typedef void (*bt_hci_data_func_t)(uint16_t handle, uint8_t flags,
+					const void *data, uint16_t size,
+					void *user_data);
+
+bool bt_hci_send_data(struct bt_hci *hci, uint16_t handle, uint8_t flags,
+					const struct iovec *iov, int iovcnt);
+unsigned int bt_hci_register_data(struct bt_hci *hci,
+				bt_hci_data_func_t callback,
+				void *user_data, bt_hci_destroy_func_t destroy);
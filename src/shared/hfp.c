@@ -33,7 +33,6 @@
 
 #include "src/shared/util.h"
 #include "src/shared/ringbuf.h"
-#include "src/shared/queue.h"
 #include "src/shared/io.h"
 #include "src/shared/hfp.h"
 
@@ -44,7 +43,7 @@ struct hfp_gw {
 	struct io *io;
 	struct ringbuf *read_buf;
 	struct ringbuf *write_buf;
-	struct queue *cmd_handlers;
+	struct cmd_node *cmd_trie;
 	bool writer_active;
 	bool permissive_syntax;
 	bool result_pending;
@@ -70,6 +69,18 @@ struct cmd_handler {
 	hfp_result_func_t callback;
 };
 
+/*
+ * Registered prefixes are kept in a trie with one node per character so
+ * dispatching a command costs one walk over its prefix instead of a
+ * string compare against every handler.
+ */
+struct cmd_node {
+	char c;
+	struct cmd_handler *handler;
+	struct cmd_node *child;
+	struct cmd_node *next;
+};
+
 struct hfp_gw_result {
 	const char *data;
 	unsigned int offset;
@@ -87,18 +98,99 @@ static void destroy_cmd_handler(void *data)
 	free(handler);
 }
 
-static bool match_handler_prefix(const void *a, const void *b)
+static struct cmd_node *cmd_trie_find(struct cmd_node *node,
+							const char *prefix)
 {
-	const struct cmd_handler *handler = a;
-	const char *prefix = b;
+	if (*prefix == '\0')
+		return NULL;
 
-	if (strlen(handler->prefix) != strlen(prefix))
-		return false;
+	while (node) {
+		if (node->c != *prefix) {
+			node = node->next;
+			continue;
+		}
 
-	if (memcmp(handler->prefix, prefix, strlen(prefix)))
-		return false;
+		if (*++prefix == '\0')
+			return node;
 
-	return true;
+		node = node->child;
+	}
+
+	return NULL;
+}
+
+static struct cmd_node *cmd_trie_add(struct cmd_node **list,
+							const char *prefix)
+{
+	struct cmd_node *node = NULL;
+
+	for (; *prefix != '\0'; prefix++) {
+		for (node = *list; node; node = node->next)
+			if (node->c == *prefix)
+				break;
+
+		if (!node) {
+			node = new0(struct cmd_node, 1);
+			if (!node)
+				return NULL;
+
+			node->c = *prefix;
+			node->next = *list;
+			*list = node;
+		}
+
+		list = &node->child;
+	}
+
+	return node;
+}
+
+/* Detach the handler of prefix and free the nodes left without use */
+static struct cmd_handler *cmd_trie_remove(struct cmd_node **list,
+							const char *prefix)
+{
+	struct cmd_handler *handler;
+	struct cmd_node *node;
+
+	if (*prefix == '\0')
+		return NULL;
+
+	for (; *list; list = &(*list)->next)
+		if ((*list)->c == *prefix)
+			break;
+
+	node = *list;
+	if (!node)
+		return NULL;
+
+	if (prefix[1] == '\0') {
+		handler = node->handler;
+		node->handler = NULL;
+	} else {
+		handler = cmd_trie_remove(&node->child, prefix + 1);
+	}
+
+	if (!node->handler && !node->child) {
+		*list = node->next;
+		free(node);
+	}
+
+	return handler;
+}
+
+static void cmd_trie_free(struct cmd_node *node)
+{
+	while (node) {
+		struct cmd_node *next = node->next;
+
+		cmd_trie_free(node->child);
+
+		if (node->handler)
+			destroy_cmd_handler(node->handler);
+
+		free(node);
+		node = next;
+	}
 }
 
 static void write_watch_destroy(void *user_data)
@@ -147,6 +239,7 @@ static void skip_whitespace(struct hfp_gw_result *result)
 static bool call_prefix_handler(struct hfp_gw *hfp, const char *data)
 {
 	struct cmd_handler *handler;
+	struct cmd_node *node;
 	const char *separators = ";?=\0";
 	struct hfp_gw_result result;
 	enum hfp_gw_cmd_type type;
@@ -210,11 +303,12 @@ static bool call_prefix_handler(struct hfp_gw *hfp, const char *data)
 
 done:
 
-	handler = queue_find(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
-	if (!handler)
+	node = cmd_trie_find(hfp->cmd_trie, lookup_prefix);
+	if (!node || !node->handler)
 		return false;
 
+	handler = node->handler;
+
 	handler->callback(&result, type, handler->user_data);
 
 	return true;
@@ -377,7 +471,7 @@ bool hfp_gw_result_has_next(struct hfp_gw_result *result)
 	return result->data[result->offset] != '\0';
 }
 
-static void process_input(struct hfp_gw *hfp)
+static bool process_input(struct hfp_gw *hfp)
 {
 	char *str, *ptr;
 	size_t len, count;
@@ -385,7 +479,7 @@ static void process_input(struct hfp_gw *hfp)
 
 	str = ringbuf_peek(hfp->read_buf, 0, &len);
 	if (!str)
-		return;
+		return false;
 
 	ptr = memchr(str, '\r', len);
 	if (!ptr) {
@@ -396,18 +490,28 @@ static void process_input(struct hfp_gw *hfp)
 		 * it's just an incomplete command.
 		 */
 		if (len == ringbuf_len(hfp->read_buf))
-			return;
+			return false;
 
 		str2 = ringbuf_peek(hfp->read_buf, len, &len2);
 		if (!str2)
-			return;
+			return false;
 
 		ptr = memchr(str2, '\r', len2);
 		if (!ptr)
-			return;
+			return false;
+
+		/* Command wraps around the end of the ring, join the two
+		 * pieces using the lengths already known */
+		count = len + (ptr - str2);
+
+		ptr = malloc(count + 1);
+		if (!ptr)
+			return false;
+
+		memcpy(ptr, str, len);
+		memcpy(ptr + len, str2, count - len);
+		ptr[count] = '\0';
 
-		*ptr = '\0';
-		count = asprintf(&ptr, "%s%s", str, str2);
 		free_ptr = true;
 		str = ptr;
 	} else {
@@ -428,6 +532,8 @@ static void process_input(struct hfp_gw *hfp)
 
 	if (free_ptr)
 		free(ptr);
+
+	return true;
 }
 
 static void read_watch_destroy(void *user_data)
@@ -443,10 +549,10 @@ static bool can_read_data(struct io *io, void *user_data)
 	if (bytes_read < 0)
 		return false;
 
-	if (hfp->result_pending)
-		return true;
-
-	process_input(hfp);
+	/* Handle every complete command already buffered as long as each
+	 * one gets its result synchronously */
+	while (!hfp->result_pending && process_input(hfp))
+		;
 
 	return true;
 }
@@ -486,19 +592,8 @@ struct hfp_gw *hfp_gw_new(int fd)
 		return NULL;
 	}
 
-	hfp->cmd_handlers = queue_new();
-	if (!hfp->cmd_handlers) {
-		io_destroy(hfp->io);
-		ringbuf_free(hfp->write_buf);
-		ringbuf_free(hfp->read_buf);
-		free(hfp);
-		return NULL;
-	}
-
 	if (!io_set_read_handler(hfp->io, can_read_data,
 					hfp, read_watch_destroy)) {
-		queue_destroy(hfp->cmd_handlers,
-						destroy_cmd_handler);
 		io_destroy(hfp->io);
 		ringbuf_free(hfp->write_buf);
 		ringbuf_free(hfp->read_buf);
@@ -551,8 +646,8 @@ void hfp_gw_unref(struct hfp_gw *hfp)
 	ringbuf_free(hfp->write_buf);
 	hfp->write_buf = NULL;
 
-	queue_destroy(hfp->cmd_handlers, destroy_cmd_handler);
-	hfp->cmd_handlers = NULL;
+	cmd_trie_free(hfp->cmd_trie);
+	hfp->cmd_trie = NULL;
 
 	if (!hfp->in_disconnect) {
 		free(hfp);
@@ -715,6 +810,14 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 						hfp_destroy_func_t destroy)
 {
 	struct cmd_handler *handler;
+	struct cmd_node *node;
+
+	if (!prefix || *prefix == '\0')
+		return false;
+
+	node = cmd_trie_find(hfp->cmd_trie, prefix);
+	if (node && node->handler)
+		return false;
 
 	handler = new0(struct cmd_handler, 1);
 	if (!handler)
@@ -729,30 +832,27 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 		return false;
 	}
 
-	if (queue_find(hfp->cmd_handlers, match_handler_prefix,
-							handler->prefix)) {
-		destroy_cmd_handler(handler);
+	node = cmd_trie_add(&hfp->cmd_trie, prefix);
+	if (!node) {
+		free(handler->prefix);
+		free(handler);
 		return false;
 	}
 
 	handler->destroy = destroy;
+	node->handler = handler;
 
-	return queue_push_tail(hfp->cmd_handlers, handler);
+	return true;
 }
 
 bool hfp_gw_unregister(struct hfp_gw *hfp, const char *prefix)
 {
 	struct cmd_handler *handler;
-	char *lookup_prefix;
 
-	lookup_prefix = strdup(prefix);
-	if (!lookup_prefix)
+	if (!prefix)
 		return false;
 
-	handler = queue_remove_if(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
-	free(lookup_prefix);
-
+	handler = cmd_trie_remove(&hfp->cmd_trie, prefix);
 	if (!handler)
 		return false;
 
@@ -0,0 +1,356 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "src/shared/util.h"
+#include "src/shared/idmap.h"
+
+#define IDMAP_MIN_BITS 4
+
+/*
+ * Entries are hashed by id for lookup and additionally kept in insertion
+ * order for iteration. Entries removed while the map is being iterated
+ * are only unhashed and marked; they are unlinked once the outermost
+ * iteration has finished, so callbacks may freely modify the map.
+ */
+struct idmap_entry {
+	unsigned int id;
+	void *data;
+	bool removed;
+	struct idmap_entry *hash_next;
+	struct idmap_entry *prev;
+	struct idmap_entry *next;
+};
+
+struct idmap {
+	int ref_count;
+	struct idmap_entry **buckets;
+	unsigned int bits;
+	unsigned int entries;
+	struct idmap_entry *head;
+	struct idmap_entry *tail;
+	unsigned int in_iter;
+	bool need_cleanup;
+};
+
+static struct idmap *idmap_ref(struct idmap *map)
+{
+	if (!map)
+		return NULL;
+
+	__sync_fetch_and_add(&map->ref_count, 1);
+
+	return map;
+}
+
+static void idmap_unref(struct idmap *map)
+{
+	if (__sync_sub_and_fetch(&map->ref_count, 1))
+		return;
+
+	free(map->buckets);
+	free(map);
+}
+
+static unsigned int idmap_hash(unsigned int bits, unsigned int id)
+{
+	return (id * 0x9e3779b1u) >> (32 - bits);
+}
+
+static struct idmap_entry **find_slot(struct idmap *map, unsigned int id)
+{
+	struct idmap_entry **slot;
+
+	slot = &map->buckets[idmap_hash(map->bits, id)];
+
+	while (*slot && (*slot)->id != id)
+		slot = &(*slot)->hash_next;
+
+	return slot;
+}
+
+static bool idmap_grow(struct idmap *map)
+{
+	struct idmap_entry **buckets;
+	struct idmap_entry *entry;
+	unsigned int bits = map->bits + 1;
+
+	buckets = new0(struct idmap_entry *, 1 << bits);
+	if (!buckets)
+		return false;
+
+	for (entry = map->head; entry; entry = entry->next) {
+		unsigned int hash;
+
+		if (entry->removed)
+			continue;
+
+		hash = idmap_hash(bits, entry->id);
+		entry->hash_next = buckets[hash];
+		buckets[hash] = entry;
+	}
+
+	free(map->buckets);
+	map->buckets = buckets;
+	map->bits = bits;
+
+	return true;
+}
+
+static void unlink_entry(struct idmap *map, struct idmap_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		map->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		map->tail = entry->prev;
+
+	free(entry);
+}
+
+static void *remove_entry(struct idmap *map, struct idmap_entry **slot)
+{
+	struct idmap_entry *entry = *slot;
+	void *data = entry->data;
+
+	*slot = entry->hash_next;
+	map->entries--;
+
+	if (map->in_iter) {
+		entry->removed = true;
+		entry->data = NULL;
+		map->need_cleanup = true;
+	} else
+		unlink_entry(map, entry);
+
+	return data;
+}
+
+static void iter_begin(struct idmap *map)
+{
+	idmap_ref(map);
+	map->in_iter++;
+}
+
+static void iter_end(struct idmap *map)
+{
+	struct idmap_entry *entry, *next;
+
+	if (--map->in_iter || !map->need_cleanup)
+		goto done;
+
+	for (entry = map->head; entry; entry = next) {
+		next = entry->next;
+
+		if (entry->removed)
+			unlink_entry(map, entry);
+	}
+
+	map->need_cleanup = false;
+
+done:
+	idmap_unref(map);
+}
+
+struct idmap *idmap_new(void)
+{
+	struct idmap *map;
+
+	map = new0(struct idmap, 1);
+	if (!map)
+		return NULL;
+
+	map->buckets = new0(struct idmap_entry *, 1 << IDMAP_MIN_BITS);
+	if (!map->buckets) {
+		free(map);
+		return NULL;
+	}
+
+	map->bits = IDMAP_MIN_BITS;
+
+	return idmap_ref(map);
+}
+
+void idmap_destroy(struct idmap *map, idmap_destroy_func_t destroy)
+{
+	if (!map)
+		return;
+
+	idmap_remove_all(map, NULL, NULL, destroy);
+
+	idmap_unref(map);
+}
+
+bool idmap_insert(struct idmap *map, unsigned int id, void *data)
+{
+	struct idmap_entry **slot;
+	struct idmap_entry *entry;
+
+	if (!map || !id)
+		return false;
+
+	slot = find_slot(map, id);
+	if (*slot)
+		return false;
+
+	if (map->entries >= 1u << map->bits) {
+		if (!idmap_grow(map))
+			return false;
+
+		slot = find_slot(map, id);
+	}
+
+	entry = new0(struct idmap_entry, 1);
+	if (!entry)
+		return false;
+
+	entry->id = id;
+	entry->data = data;
+	*slot = entry;
+
+	entry->prev = map->tail;
+	if (map->tail)
+		map->tail->next = entry;
+	else
+		map->head = entry;
+	map->tail = entry;
+
+	map->entries++;
+
+	return true;
+}
+
+void *idmap_lookup(struct idmap *map, unsigned int id)
+{
+	struct idmap_entry *entry;
+
+	if (!map || !id)
+		return NULL;
+
+	entry = *find_slot(map, id);
+
+	return entry ? entry->data : NULL;
+}
+
+void *idmap_remove(struct idmap *map, unsigned int id)
+{
+	struct idmap_entry **slot;
+
+	if (!map || !id)
+		return NULL;
+
+	slot = find_slot(map, id);
+	if (!*slot)
+		return NULL;
+
+	return remove_entry(map, slot);
+}
+
+void idmap_foreach(struct idmap *map, idmap_foreach_func_t function,
+							void *user_data)
+{
+	struct idmap_entry *entry;
+
+	if (!map || !function)
+		return;
+
+	iter_begin(map);
+
+	for (entry = map->head; entry; entry = entry->next) {
+		if (!entry->removed)
+			function(entry->data, user_data);
+	}
+
+	iter_end(map);
+}
+
+void *idmap_find(struct idmap *map, idmap_match_func_t function,
+							const void *match_data)
+{
+	struct idmap_entry *entry;
+
+	if (!map || !function)
+		return NULL;
+
+	for (entry = map->head; entry; entry = entry->next) {
+		if (!entry->removed && function(entry->data, match_data))
+			return entry->data;
+	}
+
+	return NULL;
+}
+
+unsigned int idmap_remove_all(struct idmap *map, idmap_match_func_t function,
+				void *user_data, idmap_destroy_func_t destroy)
+{
+	struct idmap_entry *entry;
+	unsigned int count = 0;
+
+	if (!map)
+		return 0;
+
+	iter_begin(map);
+
+	for (entry = map->head; entry; entry = entry->next) {
+		void *data;
+
+		if (entry->removed)
+			continue;
+
+		if (function && !function(entry->data, user_data))
+			continue;
+
+		data = remove_entry(map, find_slot(map, entry->id));
+		count++;
+
+		if (destroy)
+			destroy(data);
+	}
+
+	iter_end(map);
+
+	return count;
+}
+
+unsigned int idmap_size(struct idmap *map)
+{
+	if (!map)
+		return 0;
+
+	return map->entries;
+}
+
+bool idmap_isempty(struct idmap *map)
+{
+	if (!map)
+		return true;
+
+	return map->entries == 0;
+}
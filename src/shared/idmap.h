@@ -0,0 +1,51 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+
+typedef void (*idmap_destroy_func_t)(void *data);
+
+struct idmap;
+
+struct idmap *idmap_new(void);
+void idmap_destroy(struct idmap *map, idmap_destroy_func_t destroy);
+
+bool idmap_insert(struct idmap *map, unsigned int id, void *data);
+void *idmap_lookup(struct idmap *map, unsigned int id);
+void *idmap_remove(struct idmap *map, unsigned int id);
+
+typedef void (*idmap_foreach_func_t)(void *data, void *user_data);
+
+void idmap_foreach(struct idmap *map, idmap_foreach_func_t function,
+							void *user_data);
+
+typedef bool (*idmap_match_func_t)(const void *a, const void *b);
+
+void *idmap_find(struct idmap *map, idmap_match_func_t function,
+							const void *match_data);
+
+unsigned int idmap_remove_all(struct idmap *map, idmap_match_func_t function,
+				void *user_data, idmap_destroy_func_t destroy);
+
+unsigned int idmap_size(struct idmap *map);
+bool idmap_isempty(struct idmap *map);
@@ -25,6 +25,7 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
@@ -300,6 +301,129 @@ bool io_set_disconnect_handler(struct io *io, io_callback_func_t callback,
 	return true;
 }
 
+struct io_recv {
+	io_recv_func_t callback;
+	io_destroy_func_t destroy;
+	void *user_data;
+	unsigned int max_msgs;
+	size_t msg_len;
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	uint8_t *buf;
+	bool in_callback;
+	bool removed;
+};
+
+static void recv_free(struct io_recv *recv)
+{
+	free(recv->msgs);
+	free(recv->iov);
+	free(recv->buf);
+	free(recv);
+}
+
+static void recv_destroy(void *user_data)
+{
+	struct io_recv *recv = user_data;
+
+	if (recv->destroy)
+		recv->destroy(recv->user_data);
+
+	/* The buffers are still in use while the handler runs */
+	if (recv->in_callback) {
+		recv->removed = true;
+		return;
+	}
+
+	recv_free(recv);
+}
+
+static bool recv_read(struct io *io, void *user_data)
+{
+	struct io_recv *recv = user_data;
+	unsigned int i;
+	bool result;
+	int count;
+
+	for (i = 0; i < recv->max_msgs; i++)
+		recv->iov[i].iov_len = recv->msg_len;
+
+	count = recvmmsg(io_get_fd(io), recv->msgs, recv->max_msgs,
+							MSG_DONTWAIT, NULL);
+	if (count < 0 && errno == ENOSYS) {
+		/* No recvmmsg support, fall back to one message per wakeup */
+		count = read(io_get_fd(io), recv->buf, recv->msg_len);
+		if (count >= 0) {
+			recv->msgs[0].msg_len = count;
+			count = 1;
+		}
+	}
+
+	if (count < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	for (i = 0; i < (unsigned int) count; i++)
+		recv->iov[i].iov_len = recv->msgs[i].msg_len;
+
+	recv->in_callback = true;
+	result = recv->callback(io, recv->iov, count, recv->user_data);
+	recv->in_callback = false;
+
+	if (recv->removed) {
+		recv_free(recv);
+		return false;
+	}
+
+	return result;
+}
+
+bool io_set_recv_handler(struct io *io, unsigned int max_msgs,
+				size_t msg_len, io_recv_func_t callback,
+				void *user_data, io_destroy_func_t destroy)
+{
+	struct io_recv *recv;
+	unsigned int i;
+
+	if (!callback)
+		return io_set_read_handler(io, NULL, NULL, NULL);
+
+	if (!io || !max_msgs || !msg_len)
+		return false;
+
+	recv = new0(struct io_recv, 1);
+	if (!recv)
+		return false;
+
+	recv->msgs = new0(struct mmsghdr, max_msgs);
+	recv->iov = new0(struct iovec, max_msgs);
+	recv->buf = malloc(max_msgs * msg_len);
+	if (!recv->msgs || !recv->iov || !recv->buf) {
+		recv_free(recv);
+		return false;
+	}
+
+	for (i = 0; i < max_msgs; i++) {
+		recv->iov[i].iov_base = recv->buf + i * msg_len;
+		recv->msgs[i].msg_hdr.msg_iov = &recv->iov[i];
+		recv->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	recv->callback = callback;
+	recv->user_data = user_data;
+	recv->max_msgs = max_msgs;
+	recv->msg_len = msg_len;
+
+	if (!io_set_read_handler(io, recv_read, recv, recv_destroy)) {
+		recv_free(recv);
+		return false;
+	}
+
+	/* Only take ownership of user_data once nothing can fail */
+	recv->destroy = destroy;
+
+	return true;
+}
+
 bool io_shutdown(struct io *io)
 {
 	if (!io || io->fd < 0)
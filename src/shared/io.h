@@ -22,6 +22,8 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
 
 typedef void (*io_destroy_func_t)(void *data);
 
@@ -43,3 +45,10 @@ bool io_set_write_handler(struct io *io, io_callback_func_t callback,
 				void *user_data, io_destroy_func_t destroy);
 bool io_set_disconnect_handler(struct io *io, io_callback_func_t callback,
 				void *user_data, io_destroy_func_t destroy);
+
+typedef bool (*io_recv_func_t)(struct io *io, const struct iovec *msgs,
+					unsigned int count, void *user_data);
+
+bool io_set_recv_handler(struct io *io, unsigned int max_msgs,
+				size_t msg_len, io_recv_func_t callback,
+				void *user_data, io_destroy_func_t destroy);
@@ -36,8 +36,18 @@
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
+#include "src/shared/idmap.h"
 #include "src/shared/util.h"
 #include "src/shared/mgmt.h"
+#include "src/shared/trace.h"
+
+/* Messages read from the socket per wakeup, at most */
+#define MGMT_RECV_BATCH 8
+#define MGMT_RECV_SIZE 512
+
+/* Small requests are recycled instead of being freed */
+#define MGMT_POOL_MAX 8
+#define MGMT_POOL_BUF_SIZE 64
 
 struct mgmt {
 	int ref_count;
@@ -47,29 +57,41 @@ struct mgmt {
 	bool writer_active;
 	struct queue *request_queue;
 	struct queue *reply_queue;
-	struct queue *pending_list;
-	struct queue *notify_list;
+	struct idmap *pending_list;
+	struct idmap *notify_list;
+	struct mgmt_request *pool;
+	unsigned int pool_count;
 	unsigned int next_request_id;
 	unsigned int next_notify_id;
 	bool need_notify_cleanup;
 	bool in_notify;
 	bool destroyed;
-	void *buf;
-	uint16_t len;
 	mgmt_debug_func_t debug_callback;
 	mgmt_destroy_func_t debug_destroy;
 	void *debug_data;
 };
 
+struct mgmt_batch {
+	unsigned int ref_count;
+	mgmt_request_func_t callback;
+	mgmt_destroy_func_t destroy;
+	void *user_data;
+};
+
 struct mgmt_request {
+	struct mgmt *mgmt;
+	struct mgmt_request *next;
 	unsigned int id;
 	uint16_t opcode;
 	uint16_t index;
 	void *buf;
 	uint16_t len;
+	uint16_t size;
+	struct mgmt_batch *batch;
 	mgmt_request_func_t callback;
 	mgmt_destroy_func_t destroy;
 	void *user_data;
+	uint8_t data[0];
 };
 
 struct mgmt_notify {
@@ -82,15 +104,84 @@ struct mgmt_notify {
 	void *user_data;
 };
 
+static struct mgmt_request *request_alloc(struct mgmt *mgmt, uint16_t len)
+{
+	struct mgmt_request *request;
+	uint16_t size;
+
+	if (len <= MGMT_POOL_BUF_SIZE && mgmt->pool) {
+		request = mgmt->pool;
+		mgmt->pool = request->next;
+		mgmt->pool_count--;
+	} else {
+		size = len > MGMT_POOL_BUF_SIZE ? len : MGMT_POOL_BUF_SIZE;
+
+		request = malloc(sizeof(*request) + size);
+		if (!request)
+			return NULL;
+
+		request->size = size;
+	}
+
+	size = request->size;
+	memset(request, 0, sizeof(*request));
+	request->size = size;
+
+	request->mgmt = mgmt;
+	request->buf = request->data;
+	request->len = len;
+
+	return request;
+}
+
+static void request_free(struct mgmt_request *request)
+{
+	struct mgmt *mgmt = request->mgmt;
+
+	if (request->size > MGMT_POOL_BUF_SIZE ||
+					mgmt->pool_count >= MGMT_POOL_MAX) {
+		free(request);
+		return;
+	}
+
+	request->next = mgmt->pool;
+	mgmt->pool = request;
+	mgmt->pool_count++;
+}
+
+static void pool_free(struct mgmt *mgmt)
+{
+	while (mgmt->pool) {
+		struct mgmt_request *request = mgmt->pool;
+
+		mgmt->pool = request->next;
+		free(request);
+	}
+
+	mgmt->pool_count = 0;
+}
+
+static void batch_unref(struct mgmt_batch *batch)
+{
+	if (--batch->ref_count)
+		return;
+
+	if (batch->destroy)
+		batch->destroy(batch->user_data);
+
+	free(batch);
+}
+
 static void destroy_request(void *data)
 {
 	struct mgmt_request *request = data;
 
-	if (request->destroy)
+	if (request->batch)
+		batch_unref(request->batch);
+	else if (request->destroy)
 		request->destroy(request->user_data);
 
-	free(request->buf);
-	free(request);
+	request_free(request);
 }
 
 static bool match_request_id(const void *a, const void *b)
@@ -119,14 +210,6 @@ static void destroy_notify(void *data)
 	free(notify);
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct mgmt_notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 static bool match_notify_index(const void *a, const void *b)
 {
 	const struct mgmt_notify *notify = a;
@@ -158,31 +241,87 @@ static void write_watch_destroy(void *user_data)
 	mgmt->writer_active = false;
 }
 
+static bool match_request_ready(const void *a, const void *b)
+{
+	const struct mgmt_request *request = a;
+	const struct mgmt *mgmt = b;
+
+	return !idmap_find(mgmt->pending_list, match_request_index,
+					UINT_TO_PTR(request->index));
+}
+
+/*
+ * Replies identify their command only by opcode and index, and the kernel
+ * rejects many commands while another one is pending for the same
+ * controller. So commands are serialized per index but commands to
+ * different indexes are pipelined. Reply commands can always jump the
+ * queue.
+ */
+static struct mgmt_request *next_request(struct mgmt *mgmt)
+{
+	struct mgmt_request *request;
+
+	request = queue_peek_head(mgmt->reply_queue);
+	if (request)
+		return request;
+
+	if (idmap_isempty(mgmt->pending_list))
+		return queue_peek_head(mgmt->request_queue);
+
+	return queue_find(mgmt->request_queue, match_request_ready, mgmt);
+}
+
+static void request_finish(struct mgmt *mgmt, struct mgmt_request *request,
+					uint8_t status, uint16_t length,
+					const void *param)
+{
+	struct mgmt_batch *batch = request->batch;
+	mgmt_request_func_t callback = request->callback;
+	mgmt_destroy_func_t destroy = request->destroy;
+	void *user_data = request->user_data;
+	unsigned int id = request->id;
+
+	request_free(request);
+
+	if (!batch) {
+		if (callback)
+			callback(status, length, param, user_data);
+
+		if (destroy)
+			destroy(user_data);
+
+		return;
+	}
+
+	/* The remaining commands of a failed batch are dropped */
+	if (status != MGMT_STATUS_SUCCESS)
+		queue_remove_all(mgmt->request_queue, match_request_id,
+					UINT_TO_PTR(id), destroy_request);
+
+	if (batch->ref_count == 1 && batch->callback)
+		batch->callback(status, length, param, batch->user_data);
+
+	batch_unref(batch);
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct mgmt *mgmt = user_data;
 	struct mgmt_request *request;
 	ssize_t bytes_written;
 
-	request = queue_pop_head(mgmt->reply_queue);
-	if (!request) {
-		/* only reply commands can jump the queue */
-		if (!queue_isempty(mgmt->pending_list))
-			return false;
+	request = next_request(mgmt);
+	if (!request)
+		return false;
 
-		request = queue_pop_head(mgmt->request_queue);
-		if (!request)
-			return false;
-	}
+	if (!queue_remove(mgmt->reply_queue, request))
+		queue_remove(mgmt->request_queue, request);
 
 	bytes_written = write(mgmt->fd, request->buf, request->len);
 	if (bytes_written < 0) {
 		util_debug(mgmt->debug_callback, mgmt->debug_data,
 				"write failed: %s", strerror(errno));
-		if (request->callback)
-			request->callback(MGMT_STATUS_FAILED, 0, NULL,
-							request->user_data);
-		destroy_request(request);
+		request_finish(mgmt, request, MGMT_STATUS_FAILED, 0, NULL);
 		return true;
 	}
 
@@ -193,22 +332,22 @@ static bool can_write_data(struct io *io, void *user_data)
 	util_hexdump('<', request->buf, bytes_written,
 				mgmt->debug_callback, mgmt->debug_data);
 
-	queue_push_tail(mgmt->pending_list, request);
+	BT_TRACE3(mgmt_command, request->index, request->opcode,
+							request->len);
 
-	return false;
+	idmap_insert(mgmt->pending_list, request->id, request);
+
+	return next_request(mgmt) != NULL;
 }
 
 static void wakeup_writer(struct mgmt *mgmt)
 {
-	if (!queue_isempty(mgmt->pending_list)) {
-		/* only queued reply commands trigger wakeup */
-		if (queue_isempty(mgmt->reply_queue))
-			return;
-	}
-
 	if (mgmt->writer_active)
 		return;
 
+	if (!next_request(mgmt))
+		return;
+
 	io_set_write_handler(mgmt->io, can_write_data, mgmt,
 						write_watch_destroy);
 }
@@ -234,14 +373,13 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 	struct opcode_index match = { .opcode = opcode, .index = index };
 	struct mgmt_request *request;
 
-	request = queue_remove_if(mgmt->pending_list,
-					match_request_opcode_index, &match);
-	if (request) {
-		if (request->callback)
-			request->callback(status, length, param,
-							request->user_data);
+	BT_TRACE3(mgmt_reply, index, opcode, status);
 
-		destroy_request(request);
+	request = idmap_find(mgmt->pending_list, match_request_opcode_index,
+								&match);
+	if (request) {
+		idmap_remove(mgmt->pending_list, request->id);
+		request_finish(mgmt, request, status, length, param);
 	}
 
 	if (mgmt->destroyed)
@@ -282,14 +420,16 @@ static void process_notify(struct mgmt *mgmt, uint16_t event, uint16_t index,
 	struct event_index match = { .event = event, .index = index,
 					.length = length, .param = param };
 
+	BT_TRACE3(mgmt_event, index, event, length);
+
 	mgmt->in_notify = true;
 
-	queue_foreach(mgmt->notify_list, notify_handler, &match);
+	idmap_foreach(mgmt->notify_list, notify_handler, &match);
 
 	mgmt->in_notify = false;
 
 	if (mgmt->need_notify_cleanup) {
-		queue_remove_all(mgmt->notify_list, match_notify_removed,
+		idmap_remove_all(mgmt->notify_list, match_notify_removed,
 							NULL, destroy_notify);
 		mgmt->need_notify_cleanup = false;
 	}
@@ -300,42 +440,36 @@ static void read_watch_destroy(void *user_data)
 	struct mgmt *mgmt = user_data;
 
 	if (mgmt->destroyed) {
-		queue_destroy(mgmt->notify_list, NULL);
-		queue_destroy(mgmt->pending_list, NULL);
+		idmap_destroy(mgmt->notify_list, NULL);
+		idmap_destroy(mgmt->pending_list, NULL);
+		pool_free(mgmt);
 		free(mgmt);
 	}
 }
 
-static bool can_read_data(struct io *io, void *user_data)
+static void process_msg(struct mgmt *mgmt, const void *buf, ssize_t len)
 {
-	struct mgmt *mgmt = user_data;
-	struct mgmt_hdr *hdr;
-	struct mgmt_ev_cmd_complete *cc;
-	struct mgmt_ev_cmd_status *cs;
-	ssize_t bytes_read;
+	const struct mgmt_hdr *hdr;
+	const struct mgmt_ev_cmd_complete *cc;
+	const struct mgmt_ev_cmd_status *cs;
 	uint16_t opcode, event, index, length;
 
-	bytes_read = read(mgmt->fd, mgmt->buf, mgmt->len);
-	if (bytes_read < 0)
-		return false;
-
-	util_hexdump('>', mgmt->buf, bytes_read,
-				mgmt->debug_callback, mgmt->debug_data);
+	util_hexdump('>', buf, len, mgmt->debug_callback, mgmt->debug_data);
 
-	if (bytes_read < MGMT_HDR_SIZE)
-		return true;
+	if (len < MGMT_HDR_SIZE)
+		return;
 
-	hdr = mgmt->buf;
+	hdr = buf;
 	event = btohs(hdr->opcode);
 	index = btohs(hdr->index);
 	length = btohs(hdr->len);
 
-	if (bytes_read < length + MGMT_HDR_SIZE)
-		return true;
+	if (len < length + MGMT_HDR_SIZE)
+		return;
 
 	switch (event) {
 	case MGMT_EV_CMD_COMPLETE:
-		cc = mgmt->buf + MGMT_HDR_SIZE;
+		cc = buf + MGMT_HDR_SIZE;
 		opcode = btohs(cc->opcode);
 
 		util_debug(mgmt->debug_callback, mgmt->debug_data,
@@ -343,10 +477,10 @@ static bool can_read_data(struct io *io, void *user_data)
 						index, opcode, cc->status);
 
 		request_complete(mgmt, cc->status, opcode, index, length - 3,
-						mgmt->buf + MGMT_HDR_SIZE + 3);
+						buf + MGMT_HDR_SIZE + 3);
 		break;
 	case MGMT_EV_CMD_STATUS:
-		cs = mgmt->buf + MGMT_HDR_SIZE;
+		cs = buf + MGMT_HDR_SIZE;
 		opcode = btohs(cs->opcode);
 
 		util_debug(mgmt->debug_callback, mgmt->debug_data,
@@ -360,12 +494,23 @@ static bool can_read_data(struct io *io, void *user_data)
 				"[0x%04x] event 0x%04x", index, event);
 
 		process_notify(mgmt, event, index, length,
-						mgmt->buf + MGMT_HDR_SIZE);
+						buf + MGMT_HDR_SIZE);
 		break;
 	}
+}
 
-	if (mgmt->destroyed)
-		return false;
+static bool can_read_data(struct io *io, const struct iovec *msgs,
+					unsigned int count, void *user_data)
+{
+	struct mgmt *mgmt = user_data;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		process_msg(mgmt, msgs[i].iov_base, msgs[i].iov_len);
+
+		if (mgmt->destroyed)
+			return false;
+	}
 
 	return true;
 }
@@ -384,16 +529,8 @@ struct mgmt *mgmt_new(int fd)
 	mgmt->fd = fd;
 	mgmt->close_on_unref = false;
 
-	mgmt->len = 512;
-	mgmt->buf = malloc(mgmt->len);
-	if (!mgmt->buf) {
-		free(mgmt);
-		return NULL;
-	}
-
 	mgmt->io = io_new(fd);
 	if (!mgmt->io) {
-		free(mgmt->buf);
 		free(mgmt);
 		return NULL;
 	}
@@ -401,7 +538,6 @@ struct mgmt *mgmt_new(int fd)
 	mgmt->request_queue = queue_new();
 	if (!mgmt->request_queue) {
 		io_destroy(mgmt->io);
-		free(mgmt->buf);
 		free(mgmt);
 		return NULL;
 	}
@@ -410,40 +546,37 @@ struct mgmt *mgmt_new(int fd)
 	if (!mgmt->reply_queue) {
 		queue_destroy(mgmt->request_queue, NULL);
 		io_destroy(mgmt->io);
-		free(mgmt->buf);
 		free(mgmt);
 		return NULL;
 	}
 
-	mgmt->pending_list = queue_new();
+	mgmt->pending_list = idmap_new();
 	if (!mgmt->pending_list) {
 		queue_destroy(mgmt->reply_queue, NULL);
 		queue_destroy(mgmt->request_queue, NULL);
 		io_destroy(mgmt->io);
-		free(mgmt->buf);
 		free(mgmt);
 		return NULL;
 	}
 
-	mgmt->notify_list = queue_new();
+	mgmt->notify_list = idmap_new();
 	if (!mgmt->notify_list) {
-		queue_destroy(mgmt->pending_list, NULL);
+		idmap_destroy(mgmt->pending_list, NULL);
 		queue_destroy(mgmt->reply_queue, NULL);
 		queue_destroy(mgmt->request_queue, NULL);
 		io_destroy(mgmt->io);
-		free(mgmt->buf);
 		free(mgmt);
 		return NULL;
 	}
 
-	if (!io_set_read_handler(mgmt->io, can_read_data, mgmt,
+	if (!io_set_recv_handler(mgmt->io, MGMT_RECV_BATCH, MGMT_RECV_SIZE,
+						can_read_data, mgmt,
 						read_watch_destroy)) {
-		queue_destroy(mgmt->notify_list, NULL);
-		queue_destroy(mgmt->pending_list, NULL);
+		idmap_destroy(mgmt->notify_list, NULL);
+		idmap_destroy(mgmt->pending_list, NULL);
 		queue_destroy(mgmt->reply_queue, NULL);
 		queue_destroy(mgmt->request_queue, NULL);
 		io_destroy(mgmt->io);
-		free(mgmt->buf);
 		free(mgmt);
 		return NULL;
 	}
@@ -524,12 +657,10 @@ void mgmt_unref(struct mgmt *mgmt)
 	if (mgmt->debug_destroy)
 		mgmt->debug_destroy(mgmt->debug_data);
 
-	free(mgmt->buf);
-	mgmt->buf = NULL;
-
 	if (!mgmt->in_notify) {
-		queue_destroy(mgmt->notify_list, NULL);
-		queue_destroy(mgmt->pending_list, NULL);
+		idmap_destroy(mgmt->notify_list, NULL);
+		idmap_destroy(mgmt->pending_list, NULL);
+		pool_free(mgmt);
 		free(mgmt);
 		return;
 	}
@@ -563,7 +694,8 @@ bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 	return true;
 }
 
-static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
+static struct mgmt_request *create_request(struct mgmt *mgmt,
+				uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy)
@@ -577,17 +709,10 @@ static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 	if (length > 0 && !param)
 		return NULL;
 
-	request = new0(struct mgmt_request, 1);
+	request = request_alloc(mgmt, length + MGMT_HDR_SIZE);
 	if (!request)
 		return NULL;
 
-	request->len = length + MGMT_HDR_SIZE;
-	request->buf = malloc(request->len);
-	if (!request->buf) {
-		free(request);
-		return NULL;
-	}
-
 	if (length > 0)
 		memcpy(request->buf + MGMT_HDR_SIZE, param, length);
 
@@ -616,7 +741,7 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	if (!mgmt)
 		return 0;
 
-	request = create_request(opcode, index, length, param,
+	request = create_request(mgmt, opcode, index, length, param,
 					callback, user_data, destroy);
 	if (!request)
 		return 0;
@@ -627,8 +752,7 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	request->id = mgmt->next_request_id++;
 
 	if (!queue_push_tail(mgmt->request_queue, request)) {
-		free(request->buf);
-		free(request);
+		request_free(request);
 		return 0;
 	}
 
@@ -647,7 +771,7 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	if (!mgmt)
 		return 0;
 
-	request = create_request(opcode, index, length, param,
+	request = create_request(mgmt, opcode, index, length, param,
 					callback, user_data, destroy);
 	if (!request)
 		return 0;
@@ -658,8 +782,7 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	request->id = mgmt->next_request_id++;
 
 	if (!queue_push_tail(mgmt->reply_queue, request)) {
-		free(request->buf);
-		free(request);
+		request_free(request);
 		return 0;
 	}
 
@@ -668,31 +791,90 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	return request->id;
 }
 
+unsigned int mgmt_send_batch(struct mgmt *mgmt, uint16_t index,
+				const struct mgmt_batch_cmd *cmds,
+				unsigned int count,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	struct mgmt_request *request;
+	struct mgmt_batch *batch;
+	unsigned int i, id;
+
+	if (!mgmt || !cmds || !count)
+		return 0;
+
+	batch = new0(struct mgmt_batch, 1);
+	if (!batch)
+		return 0;
+
+	if (mgmt->next_request_id < 1)
+		mgmt->next_request_id = 1;
+
+	id = mgmt->next_request_id++;
+
+	/*
+	 * All commands share the batch id and are queued back to back.
+	 * Since only one command per index is pending at a time, they are
+	 * sent in order and nothing queued later can get in between.
+	 */
+	for (i = 0; i < count; i++) {
+		request = create_request(mgmt, cmds[i].opcode, index,
+						cmds[i].length, cmds[i].param,
+						NULL, NULL, NULL);
+		if (!request)
+			goto fail;
+
+		request->id = id;
+		request->batch = batch;
+
+		if (!queue_push_tail(mgmt->request_queue, request)) {
+			request_free(request);
+			goto fail;
+		}
+
+		batch->ref_count++;
+	}
+
+	batch->callback = callback;
+	batch->destroy = destroy;
+	batch->user_data = user_data;
+
+	wakeup_writer(mgmt);
+
+	return id;
+
+fail:
+	if (batch->ref_count)
+		queue_remove_all(mgmt->request_queue, match_request_id,
+					UINT_TO_PTR(id), destroy_request);
+	else
+		free(batch);
+
+	return 0;
+}
+
 bool mgmt_cancel(struct mgmt *mgmt, unsigned int id)
 {
 	struct mgmt_request *request;
+	unsigned int count;
 
 	if (!mgmt || !id)
 		return false;
 
-	request = queue_remove_if(mgmt->request_queue, match_request_id,
-							UINT_TO_PTR(id));
+	request = idmap_remove(mgmt->pending_list, id);
 	if (request)
-		goto done;
+		destroy_request(request);
 
-	request = queue_remove_if(mgmt->reply_queue, match_request_id,
-							UINT_TO_PTR(id));
-	if (request)
-		goto done;
+	/* Requests of a batch share the same id */
+	count = queue_remove_all(mgmt->request_queue, match_request_id,
+					UINT_TO_PTR(id), destroy_request);
+	count += queue_remove_all(mgmt->reply_queue, match_request_id,
+					UINT_TO_PTR(id), destroy_request);
 
-	request = queue_remove_if(mgmt->pending_list, match_request_id,
-							UINT_TO_PTR(id));
-	if (!request)
+	if (!request && !count)
 		return false;
 
-done:
-	destroy_request(request);
-
 	wakeup_writer(mgmt);
 
 	return true;
@@ -707,7 +889,7 @@ bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index)
 					UINT_TO_PTR(index), destroy_request);
 	queue_remove_all(mgmt->reply_queue, match_request_index,
 					UINT_TO_PTR(index), destroy_request);
-	queue_remove_all(mgmt->pending_list, match_request_index,
+	idmap_remove_all(mgmt->pending_list, match_request_index,
 					UINT_TO_PTR(index), destroy_request);
 
 	return true;
@@ -718,7 +900,7 @@ bool mgmt_cancel_all(struct mgmt *mgmt)
 	if (!mgmt)
 		return false;
 
-	queue_remove_all(mgmt->pending_list, NULL, NULL, destroy_request);
+	idmap_remove_all(mgmt->pending_list, NULL, NULL, destroy_request);
 	queue_remove_all(mgmt->reply_queue, NULL, NULL, destroy_request);
 	queue_remove_all(mgmt->request_queue, NULL, NULL, destroy_request);
 
@@ -750,7 +932,7 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 
 	notify->id = mgmt->next_notify_id++;
 
-	if (!queue_push_tail(mgmt->notify_list, notify)) {
+	if (!idmap_insert(mgmt->notify_list, notify->id, notify)) {
 		free(notify);
 		return 0;
 	}
@@ -765,12 +947,12 @@ bool mgmt_unregister(struct mgmt *mgmt, unsigned int id)
 	if (!mgmt || !id)
 		return false;
 
-	notify = queue_remove_if(mgmt->notify_list, match_notify_id,
-							UINT_TO_PTR(id));
+	notify = idmap_lookup(mgmt->notify_list, id);
 	if (!notify)
 		return false;
 
 	if (!mgmt->in_notify) {
+		idmap_remove(mgmt->notify_list, id);
 		destroy_notify(notify);
 		return true;
 	}
@@ -787,11 +969,11 @@ bool mgmt_unregister_index(struct mgmt *mgmt, uint16_t index)
 		return false;
 
 	if (mgmt->in_notify) {
-		queue_foreach(mgmt->notify_list, mark_notify_removed,
+		idmap_foreach(mgmt->notify_list, mark_notify_removed,
 							UINT_TO_PTR(index));
 		mgmt->need_notify_cleanup = true;
 	} else
-		queue_remove_all(mgmt->notify_list, match_notify_index,
+		idmap_remove_all(mgmt->notify_list, match_notify_index,
 					UINT_TO_PTR(index), destroy_notify);
 
 	return true;
@@ -803,11 +985,11 @@ bool mgmt_unregister_all(struct mgmt *mgmt)
 		return false;
 
 	if (mgmt->in_notify) {
-		queue_foreach(mgmt->notify_list, mark_notify_removed,
+		idmap_foreach(mgmt->notify_list, mark_notify_removed,
 						UINT_TO_PTR(MGMT_INDEX_NONE));
 		mgmt->need_notify_cleanup = true;
 	} else
-		queue_remove_all(mgmt->notify_list, NULL, NULL, destroy_notify);
+		idmap_remove_all(mgmt->notify_list, NULL, NULL, destroy_notify);
 
 	return true;
 }
@@ -54,6 +54,18 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
+
+struct mgmt_batch_cmd {
+	uint16_t opcode;
+	uint16_t length;
+	const void *param;
+};
+
+unsigned int mgmt_send_batch(struct mgmt *mgmt, uint16_t index,
+				const struct mgmt_batch_cmd *cmds,
+				unsigned int count,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy);
 bool mgmt_cancel(struct mgmt *mgmt, unsigned int id);
 bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index);
 bool mgmt_cancel_all(struct mgmt *mgmt);
@@ -27,9 +27,13 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
 #include "src/shared/pcap.h"
 
 struct pcap_hdr {
@@ -59,11 +63,32 @@ struct pcap_ppi {
 } __attribute__ ((packed));
 #define PCAP_PPI_SIZE (sizeof(struct pcap_ppi))
 
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_MAGIC		0x1a2b3c4d
+
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_NAME		2
+#define PCAPNG_OPT_DESCRIPTION	3
+#define PCAPNG_OPT_TSRESOL	9
+
+#define PCAPNG_BUFFER_SIZE	(64 * 1024)
+#define PCAPNG_FLUSH_INTERVAL	1
+#define PCAPNG_MAX_BLOCK	(BTSNOOP_MAX_PACKET_SIZE + 128)
+
+#define PCAPNG_SNAPLEN		(BTSNOOP_MAX_PACKET_SIZE + 5)
+
 struct pcap {
 	int ref_count;
 	int fd;
 	uint32_t type;
 	uint32_t snaplen;
+	uint8_t *buf;
+	uint32_t buf_len;
+	time_t last_flush;
+	uint16_t *ifaces;
+	uint32_t num_ifaces;
 };
 
 struct pcap *pcap_open(const char *path)
@@ -104,6 +129,269 @@ failed:
 	return NULL;
 }
 
+static bool write_all(int fd, const void *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+
+		if (written < 0)
+			return false;
+
+		data += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+bool pcap_flush(struct pcap *pcap)
+{
+	bool result;
+
+	if (!pcap || !pcap->buf)
+		return false;
+
+	result = write_all(pcap->fd, pcap->buf, pcap->buf_len);
+	pcap->buf_len = 0;
+
+	return result;
+}
+
+/* Reserve room for a block in the output buffer */
+static uint8_t *block_start(struct pcap *pcap, uint32_t type)
+{
+	uint8_t *block;
+
+	if (pcap->buf_len + PCAPNG_MAX_BLOCK > PCAPNG_BUFFER_SIZE &&
+							!pcap_flush(pcap))
+		return NULL;
+
+	block = pcap->buf + pcap->buf_len;
+	put_le32(type, block);
+
+	return block;
+}
+
+static void block_end(struct pcap *pcap, uint8_t *block, uint32_t len)
+{
+	/* Block total length is repeated at the end of every block */
+	len += 4;
+
+	put_le32(len, block + 4);
+	put_le32(len, block + len - 4);
+
+	pcap->buf_len += len;
+}
+
+static uint32_t put_option(uint8_t *ptr, uint16_t code, const void *data,
+								uint16_t len)
+{
+	uint32_t padded = (len + 3) & ~3;
+
+	put_le16(code, ptr);
+	put_le16(len, ptr + 2);
+	memcpy(ptr + 4, data, len);
+	memset(ptr + 4 + len, 0, padded - len);
+
+	return 4 + padded;
+}
+
+struct pcap *pcap_create_ng(const char *path)
+{
+	struct pcap *pcap;
+	uint8_t *block;
+
+	pcap = calloc(1, sizeof(*pcap));
+	if (!pcap)
+		return NULL;
+
+	pcap->buf = malloc(PCAPNG_BUFFER_SIZE);
+	if (!pcap->buf) {
+		free(pcap);
+		return NULL;
+	}
+
+	pcap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (pcap->fd < 0) {
+		free(pcap->buf);
+		free(pcap);
+		return NULL;
+	}
+
+	pcap->type = PCAP_TYPE_BLUETOOTH_HCI_H4_PHDR;
+	pcap->snaplen = PCAPNG_SNAPLEN;
+
+	/* Section header with version 1.0 and unspecified length */
+	block = block_start(pcap, PCAPNG_SHB);
+	put_le32(PCAPNG_MAGIC, block + 8);
+	put_le16(1, block + 12);
+	put_le16(0, block + 14);
+	put_le64(UINT64_MAX, block + 16);
+	block_end(pcap, block, 24);
+
+	if (!pcap_flush(pcap)) {
+		close(pcap->fd);
+		free(pcap->buf);
+		free(pcap);
+		return NULL;
+	}
+
+	return pcap_ref(pcap);
+}
+
+static int find_interface(struct pcap *pcap, uint16_t index)
+{
+	uint32_t i;
+
+	for (i = 0; i < pcap->num_ifaces; i++) {
+		if (pcap->ifaces[i] == index)
+			return i;
+	}
+
+	return -1;
+}
+
+static int add_interface(struct pcap *pcap, uint16_t index,
+				const struct btsnoop_opcode_new_index *ni)
+{
+	uint8_t tsresol = 9;
+	uint16_t *ifaces;
+	uint8_t *block;
+	char str[40];
+	uint32_t len;
+	int n;
+
+	ifaces = realloc(pcap->ifaces, (pcap->num_ifaces + 1) *
+							sizeof(*ifaces));
+	if (!ifaces)
+		return -1;
+
+	pcap->ifaces = ifaces;
+
+	block = block_start(pcap, PCAPNG_IDB);
+	if (!block)
+		return -1;
+
+	put_le16(pcap->type, block + 8);
+	put_le16(0, block + 10);
+	put_le32(pcap->snaplen, block + 12);
+	len = 16;
+
+	n = snprintf(str, sizeof(str), "hci%u", index);
+	len += put_option(block + len, PCAPNG_OPT_NAME, str, n);
+
+	if (ni) {
+		n = snprintf(str, sizeof(str),
+				"%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X%s%.8s",
+				ni->bdaddr[5], ni->bdaddr[4], ni->bdaddr[3],
+				ni->bdaddr[2], ni->bdaddr[1], ni->bdaddr[0],
+				ni->name[0] ? " " : "", ni->name);
+		len += put_option(block + len, PCAPNG_OPT_DESCRIPTION,
+								str, n);
+	}
+
+	/* Timestamps are in nanoseconds */
+	len += put_option(block + len, PCAPNG_OPT_TSRESOL, &tsresol, 1);
+	len += put_option(block + len, PCAPNG_OPT_END, NULL, 0);
+
+	block_end(pcap, block, len);
+
+	pcap->ifaces[pcap->num_ifaces] = index;
+
+	return pcap->num_ifaces++;
+}
+
+bool pcap_write_hci(struct pcap *pcap, struct timeval *tv, uint16_t index,
+			uint16_t opcode, const void *data, uint16_t size)
+{
+	uint8_t *block, pkt_type;
+	uint32_t in, padded;
+	uint64_t ts;
+	int iface;
+
+	if (!pcap || !pcap->buf)
+		return false;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		if (find_interface(pcap, index) >= 0)
+			return true;
+
+		if (size < sizeof(struct btsnoop_opcode_new_index))
+			data = NULL;
+
+		return add_interface(pcap, index, data) >= 0;
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		pkt_type = 0x01;
+		in = 0;
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		pkt_type = 0x04;
+		in = 1;
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		pkt_type = 0x02;
+		in = 0;
+		break;
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		pkt_type = 0x02;
+		in = 1;
+		break;
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+		pkt_type = 0x03;
+		in = 0;
+		break;
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		pkt_type = 0x03;
+		in = 1;
+		break;
+	default:
+		return true;
+	}
+
+	if (size > BTSNOOP_MAX_PACKET_SIZE)
+		return false;
+
+	iface = find_interface(pcap, index);
+	if (iface < 0)
+		iface = add_interface(pcap, index, NULL);
+	if (iface < 0)
+		return false;
+
+	if (tv)
+		ts = tv->tv_sec * 1000000000ull + tv->tv_usec * 1000ull;
+	else
+		ts = 0;
+
+	block = block_start(pcap, PCAPNG_EPB);
+	if (!block)
+		return false;
+
+	put_le32(iface, block + 8);
+	put_le32(ts >> 32, block + 12);
+	put_le32(ts, block + 16);
+	put_le32(size + 5, block + 20);
+	put_le32(size + 5, block + 24);
+
+	/* Direction pseudo header is big endian, followed by H:4 type */
+	put_be32(in, block + 28);
+	block[32] = pkt_type;
+	memcpy(block + 33, data, size);
+
+	padded = (size + 5 + 3) & ~3;
+	memset(block + 28 + size + 5, 0, padded - (size + 5));
+
+	block_end(pcap, block, 28 + padded);
+
+	if (tv && tv->tv_sec - pcap->last_flush >= PCAPNG_FLUSH_INTERVAL) {
+		pcap->last_flush = tv->tv_sec;
+		return pcap_flush(pcap);
+	}
+
+	return true;
+}
+
 struct pcap *pcap_ref(struct pcap *pcap)
 {
 	if (!pcap)
@@ -122,9 +410,14 @@ void pcap_unref(struct pcap *pcap)
 	if (__sync_sub_and_fetch(&pcap->ref_count, 1))
 		return;
 
+	if (pcap->buf)
+		pcap_flush(pcap);
+
 	if (pcap->fd >= 0)
 		close(pcap->fd);
 
+	free(pcap->ifaces);
+	free(pcap->buf);
 	free(pcap);
 }
 
@@ -28,11 +28,13 @@
 #define PCAP_TYPE_INVALID		0
 #define PCAP_TYPE_USER0			147
 #define PCAP_TYPE_PPI			192
+#define PCAP_TYPE_BLUETOOTH_HCI_H4_PHDR	201
 #define PCAP_TYPE_BLUETOOTH_LE_LL	251
 
 struct pcap;
 
 struct pcap *pcap_open(const char *path);
+struct pcap *pcap_create_ng(const char *path);
 
 struct pcap *pcap_ref(struct pcap *pcap);
 void pcap_unref(struct pcap *pcap);
@@ -45,3 +47,7 @@ bool pcap_read(struct pcap *pcap, struct timeval *tv,
 bool pcap_read_ppi(struct pcap *pcap, struct timeval *tv, uint32_t *type,
 					void *data, uint32_t size,
 					uint32_t *offset, uint32_t *len);
+
+bool pcap_write_hci(struct pcap *pcap, struct timeval *tv, uint16_t index,
+			uint16_t opcode, const void *data, uint16_t size);
+bool pcap_flush(struct pcap *pcap);
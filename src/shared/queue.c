@@ -28,6 +28,9 @@
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
+/* Removed entries a queue keeps around for reuse, at most */
+#define QUEUE_FREE_ENTRIES_MAX 32
+
 struct queue_entry {
 	void *data;
 	struct queue_entry *next;
@@ -38,8 +41,42 @@ struct queue {
 	struct queue_entry *head;
 	struct queue_entry *tail;
 	unsigned int entries;
+	struct queue_entry *free_entries;
+	unsigned int num_free;
 };
 
+static struct queue_entry *queue_entry_new(struct queue *queue, void *data)
+{
+	struct queue_entry *entry = queue->free_entries;
+
+	if (entry) {
+		queue->free_entries = entry->next;
+		queue->num_free--;
+	} else {
+		entry = new0(struct queue_entry, 1);
+		if (!entry)
+			return NULL;
+	}
+
+	entry->data = data;
+	entry->next = NULL;
+
+	return entry;
+}
+
+static void queue_entry_free(struct queue *queue, struct queue_entry *entry)
+{
+	if (queue->num_free >= QUEUE_FREE_ENTRIES_MAX) {
+		free(entry);
+		return;
+	}
+
+	entry->data = NULL;
+	entry->next = queue->free_entries;
+	queue->free_entries = entry;
+	queue->num_free++;
+}
+
 static struct queue *queue_ref(struct queue *queue)
 {
 	if (!queue)
@@ -52,9 +89,16 @@ static struct queue *queue_ref(struct queue *queue)
 
 static void queue_unref(struct queue *queue)
 {
+	struct queue_entry *entry;
+
 	if (__sync_sub_and_fetch(&queue->ref_count, 1))
 		return;
 
+	while ((entry = queue->free_entries)) {
+		queue->free_entries = entry->next;
+		free(entry);
+	}
+
 	free(queue);
 }
 
@@ -90,13 +134,10 @@ bool queue_push_tail(struct queue *queue, void *data)
 	if (!queue)
 		return false;
 
-	entry = new0(struct queue_entry, 1);
+	entry = queue_entry_new(queue, data);
 	if (!entry)
 		return false;
 
-	entry->data = data;
-	entry->next = NULL;
-
 	if (queue->tail)
 		queue->tail->next = entry;
 
@@ -117,11 +158,10 @@ bool queue_push_head(struct queue *queue, void *data)
 	if (!queue)
 		return false;
 
-	entry = new0(struct queue_entry, 1);
+	entry = queue_entry_new(queue, data);
 	if (!entry)
 		return false;
 
-	entry->data = data;
 	entry->next = queue->head;
 
 	queue->head = entry;
@@ -152,7 +192,7 @@ void *queue_pop_head(struct queue *queue)
 
 	data = entry->data;
 
-	free(entry);
+	queue_entry_free(queue, entry);
 	queue->entries--;
 
 	return data;
@@ -254,7 +294,7 @@ bool queue_remove(struct queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		free(entry);
+		queue_entry_free(queue, entry);
 		queue->entries--;
 
 		return true;
@@ -287,7 +327,7 @@ void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 
 			data = entry->data;
 
-			free(entry);
+			queue_entry_free(queue, entry);
 			queue->entries--;
 
 			return data;
@@ -331,7 +371,7 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 				if (destroy)
 					destroy(tmp->data);
 
-				free(tmp);
+				queue_entry_free(queue, tmp);
 				count++;
 			} else {
 				prev = entry;
@@ -349,7 +389,7 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 			if (destroy)
 				destroy(tmp->data);
 
-			free(tmp);
+			queue_entry_free(queue, tmp);
 			count++;
 		}
 
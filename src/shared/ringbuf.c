@@ -220,10 +220,28 @@ int ringbuf_printf(struct ringbuf *ringbuf, const char *format, ...)
 	return len;
 }
 
+static void ringbuf_trace_in(struct ringbuf *ringbuf, size_t offset,
+								size_t len)
+{
+	size_t end;
+
+	if (!ringbuf->in_tracing || !len)
+		return;
+
+	end = MIN(len, ringbuf->size - offset);
+	ringbuf->in_tracing(ringbuf->buffer + offset, end, ringbuf->in_data);
+
+	if (len - end > 0)
+		ringbuf->in_tracing(ringbuf->buffer, len - end,
+							ringbuf->in_data);
+}
+
 int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 {
 	size_t avail, offset, end;
+	char stack_buf[256];
 	char *str;
+	va_list aq;
 	int len;
 
 	if (!ringbuf || !format)
@@ -234,34 +252,65 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 	if (!avail)
 		return -1;
 
-	len = vasprintf(&str, format, ap);
-	if (len < 0)
-		return -1;
+	/* Format straight into the free space up to the wrap point */
+	offset = ringbuf->in & (ringbuf->size - 1);
+	end = MIN(avail, ringbuf->size - offset);
 
-	if ((size_t) len > avail) {
-		free(str);
+	va_copy(aq, ap);
+	len = vsnprintf(ringbuf->buffer + offset, end, format, aq);
+	va_end(aq);
+
+	if (len < 0 || (size_t) len > avail)
 		return -1;
+
+	/* The string and its terminating NUL fit before the wrap point */
+	if ((size_t) len < end)
+		goto done;
+
+	/* Otherwise format again into a scratch buffer and split it */
+	if ((size_t) len < sizeof(stack_buf))
+		str = stack_buf;
+	else {
+		str = malloc(len + 1);
+		if (!str)
+			return -1;
 	}
 
-	/* Determine possible length of string before wrapping */
-	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN((size_t) len, ringbuf->size - offset);
+	vsnprintf(str, len + 1, format, ap);
+
 	memcpy(ringbuf->buffer + offset, str, end);
+	memcpy(ringbuf->buffer, str + end, len - end);
 
-	if (ringbuf->in_tracing)
-		ringbuf->in_tracing(ringbuf->buffer + offset, end,
-							ringbuf->in_data);
+	if (str != stack_buf)
+		free(str);
 
-	if (len - end > 0) {
-		/* Put the remainder of string at the beginning */
-		memcpy(ringbuf->buffer, str + end, len - end);
+done:
+	ringbuf_trace_in(ringbuf, offset, len);
 
-		if (ringbuf->in_tracing)
-			ringbuf->in_tracing(ringbuf->buffer, len - end,
-							ringbuf->in_data);
-	}
+	ringbuf->in += len;
+
+	return len;
+}
+
+ssize_t ringbuf_append(struct ringbuf *ringbuf, const void *data, size_t len)
+{
+	size_t avail, offset, end;
+
+	if (!ringbuf || !data)
+		return -1;
 
-	free(str);
+	/* Data that does not fit is rejected as a whole */
+	avail = ringbuf->size - ringbuf->in + ringbuf->out;
+	if (len > avail)
+		return -1;
+
+	offset = ringbuf->in & (ringbuf->size - 1);
+	end = MIN(len, ringbuf->size - offset);
+
+	memcpy(ringbuf->buffer + offset, data, end);
+	memcpy(ringbuf->buffer, (const uint8_t *) data + end, len - end);
+
+	ringbuf_trace_in(ringbuf, offset, len);
 
 	ringbuf->in += len;
 
@@ -297,14 +346,7 @@ ssize_t ringbuf_read(struct ringbuf *ringbuf, int fd)
 	if (consumed < 0)
 		return -1;
 
-	if (ringbuf->in_tracing) {
-		size_t len = MIN((size_t) consumed, end);
-		ringbuf->in_tracing(ringbuf->buffer + offset, len,
-							ringbuf->in_data);
-		if (consumed - len > 0)
-			ringbuf->in_tracing(ringbuf->buffer, consumed - len,
-							ringbuf->in_data);
-	}
+	ringbuf_trace_in(ringbuf, offset, consumed);
 
 	ringbuf->in += consumed;
 
@@ -31,7 +31,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <inttypes.h>
+#include <time.h>
 #include <sys/signalfd.h>
+#include <sys/utsname.h>
 
 #include <glib.h>
 
@@ -92,6 +95,25 @@ struct test_case {
 	unsigned int timeout_id;
 	tester_destroy_func_t destroy;
 	void *user_data;
+	bool bench;
+	bool bench_timing;
+	unsigned int warmup;
+	unsigned int iterations;
+	unsigned int run_count;
+	unsigned int sample_count;
+	uint64_t wall_start;
+	uint64_t cpu_start;
+	uint64_t *wall_samples;
+	uint64_t *cpu_samples;
+};
+
+struct bench_stats {
+	uint64_t min;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t max;
+	uint64_t mean;
 };
 
 static GMainLoop *main_loop;
@@ -105,6 +127,8 @@ static gboolean option_quiet = FALSE;
 static gboolean option_debug = FALSE;
 static gboolean option_list = FALSE;
 static const char *option_prefix = NULL;
+static gint option_iterations = 0;
+static const char *option_json = NULL;
 
 static void test_destroy(gpointer data)
 {
@@ -116,6 +140,8 @@ static void test_destroy(gpointer data)
 	if (test->destroy)
 		test->destroy(test->user_data);
 
+	free(test->wall_samples);
+	free(test->cpu_samples);
 	free(test->name);
 	free(test);
 }
@@ -179,7 +205,7 @@ static void default_post_teardown(const void *test_data)
 	tester_post_teardown_complete();
 }
 
-void tester_add_full(const char *name, const void *test_data,
+static struct test_case *test_add(const char *name, const void *test_data,
 				tester_data_func_t pre_setup_func,
 				tester_data_func_t setup_func,
 				tester_data_func_t test_func,
@@ -191,26 +217,26 @@ void tester_add_full(const char *name, const void *test_data,
 	struct test_case *test;
 
 	if (!test_func)
-		return;
+		return NULL;
 
 	if (option_prefix && !g_str_has_prefix(name, option_prefix)) {
 		if (destroy)
 			destroy(user_data);
-		return;
+		return NULL;
 	}
 
 	if (option_list) {
 		printf("%s\n", name);
 		if (destroy)
 			destroy(user_data);
-		return;
+		return NULL;
 	}
 
 	test = new0(struct test_case, 1);
 	if (!test) {
 		if (destroy)
 			destroy(user_data);
-		return;
+		return NULL;
 	}
 
 	test->name = strdup(name);
@@ -247,6 +273,22 @@ void tester_add_full(const char *name, const void *test_data,
 	test->user_data = user_data;
 
 	test_list = g_list_append(test_list, test);
+
+	return test;
+}
+
+void tester_add_full(const char *name, const void *test_data,
+				tester_data_func_t pre_setup_func,
+				tester_data_func_t setup_func,
+				tester_data_func_t test_func,
+				tester_data_func_t teardown_func,
+				tester_data_func_t post_teardown_func,
+				unsigned int timeout,
+				void *user_data, tester_destroy_func_t destroy)
+{
+	test_add(name, test_data, pre_setup_func, setup_func, test_func,
+				teardown_func, post_teardown_func, timeout,
+				user_data, destroy);
 }
 
 void tester_add(const char *name, const void *test_data,
@@ -258,6 +300,54 @@ void tester_add(const char *name, const void *test_data,
 					teardown_func, NULL, 0, NULL, NULL);
 }
 
+void tester_bench_add_full(const char *name, const void *test_data,
+				tester_data_func_t pre_setup_func,
+				tester_data_func_t setup_func,
+				tester_data_func_t test_func,
+				tester_data_func_t teardown_func,
+				tester_data_func_t post_teardown_func,
+				unsigned int timeout,
+				unsigned int warmup, unsigned int iterations,
+				void *user_data, tester_destroy_func_t destroy)
+{
+	struct test_case *test;
+
+	if (option_iterations > 0)
+		iterations = option_iterations;
+
+	if (!iterations)
+		iterations = 1;
+
+	test = test_add(name, test_data, pre_setup_func, setup_func, test_func,
+				teardown_func, post_teardown_func, timeout,
+				user_data, destroy);
+	if (!test)
+		return;
+
+	test->wall_samples = new0(uint64_t, iterations);
+	test->cpu_samples = new0(uint64_t, iterations);
+	if (!test->wall_samples || !test->cpu_samples) {
+		test_list = g_list_remove(test_list, test);
+		test_destroy(test);
+		return;
+	}
+
+	test->bench = true;
+	test->warmup = warmup;
+	test->iterations = iterations;
+}
+
+void tester_bench_add(const char *name, const void *test_data,
+					tester_data_func_t setup_func,
+					tester_data_func_t test_func,
+					tester_data_func_t teardown_func,
+					unsigned int warmup, unsigned int iterations)
+{
+	tester_bench_add_full(name, test_data, NULL, setup_func, test_func,
+					teardown_func, NULL, 0, warmup, iterations,
+					NULL, NULL);
+}
+
 void *tester_get_data(void)
 {
 	struct test_case *test;
@@ -270,6 +360,164 @@ void *tester_get_data(void)
 	return test->user_data;
 }
 
+static uint64_t get_usec(clockid_t clock_id)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock_id, &ts) < 0)
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int sample_cmp(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a;
+	uint64_t vb = *(const uint64_t *) b;
+
+	return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+static void bench_calc_stats(uint64_t *samples, unsigned int count,
+						struct bench_stats *stats)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (!count)
+		return;
+
+	qsort(samples, count, sizeof(*samples), sample_cmp);
+
+	for (i = 0; i < count; i++)
+		sum += samples[i];
+
+	stats->min = samples[0];
+	stats->p50 = samples[(count - 1) * 50 / 100];
+	stats->p90 = samples[(count - 1) * 90 / 100];
+	stats->p99 = samples[(count - 1) * 99 / 100];
+	stats->max = samples[count - 1];
+	stats->mean = sum / count;
+}
+
+static void print_bench_stats(const char *label,
+					const struct bench_stats *stats)
+{
+	printf("    %-8s min %8" PRIu64 " p50 %8" PRIu64 " p90 %8" PRIu64
+			" p99 %8" PRIu64 " max %8" PRIu64 " mean %8" PRIu64
+			" usec\n", label, stats->min, stats->p50, stats->p90,
+			stats->p99, stats->max, stats->mean);
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', fp);
+		fputc(*str, fp);
+	}
+
+	fputc('"', fp);
+}
+
+static void write_json_stats(FILE *fp, const char *label,
+					const struct bench_stats *stats)
+{
+	fprintf(fp, "\"%s\": { \"min\": %" PRIu64 ", \"p50\": %" PRIu64
+			", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64
+			", \"max\": %" PRIu64 ", \"mean\": %" PRIu64 " }",
+			label, stats->min, stats->p50, stats->p90,
+			stats->p99, stats->max, stats->mean);
+}
+
+static const char *result_str(enum test_result result)
+{
+	switch (result) {
+	case TEST_RESULT_NOT_RUN:
+		return "not-run";
+	case TEST_RESULT_PASSED:
+		return "passed";
+	case TEST_RESULT_FAILED:
+		return "failed";
+	case TEST_RESULT_TIMED_OUT:
+		return "timed-out";
+	}
+
+	return "unknown";
+}
+
+static void bench_summarize(void)
+{
+	struct utsname uts;
+	FILE *fp = NULL;
+	bool first = true;
+	GList *list;
+
+	if (option_json) {
+		fp = fopen(option_json, "w");
+		if (!fp)
+			perror("Failed to open benchmark output");
+	}
+
+	if (fp) {
+		if (uname(&uts) < 0)
+			memset(&uts, 0, sizeof(uts));
+
+		fprintf(fp, "{\n  \"version\": \"%s\",\n", VERSION);
+		fprintf(fp, "  \"kernel\": ");
+		write_json_string(fp, uts.release);
+		fprintf(fp, ",\n  \"benchmarks\": [");
+	}
+
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+		struct bench_stats wall, cpu;
+
+		if (!test->bench)
+			continue;
+
+		bench_calc_stats(test->wall_samples, test->sample_count, &wall);
+		bench_calc_stats(test->cpu_samples, test->sample_count, &cpu);
+
+		if (first) {
+			printf("\n");
+			print_text(COLOR_HIGHLIGHT, "Benchmark Summary");
+			print_text(COLOR_HIGHLIGHT, "-----------------");
+		}
+
+		printf("%s (%u/%u samples, %u warm-up)\n", test->name,
+					test->sample_count, test->iterations,
+					test->warmup);
+		print_bench_stats("wall", &wall);
+		print_bench_stats("cpu", &cpu);
+
+		if (fp) {
+			fprintf(fp, "%s\n    { \"name\": ", first ? "" : ",");
+			write_json_string(fp, test->name);
+			fprintf(fp, ", \"result\": \"%s\", \"warmup\": %u, "
+					"\"iterations\": %u, \"samples\": %u,"
+					"\n      ", result_str(test->result),
+					test->warmup, test->iterations,
+					test->sample_count);
+			write_json_stats(fp, "wall_usec", &wall);
+			fprintf(fp, ",\n      ");
+			write_json_stats(fp, "cpu_usec", &cpu);
+			fprintf(fp, " }");
+		}
+
+		first = false;
+	}
+
+	if (fp) {
+		fprintf(fp, "\n  ]\n}\n");
+		fclose(fp);
+	}
+}
+
 static void tester_summarize(void)
 {
 	unsigned int not_run = 0, passed = 0, failed = 0;
@@ -321,6 +569,7 @@ static void tester_summarize(void)
 	execution_time = g_timer_elapsed(test_timer, NULL);
 	printf("Overall execution time: %.3g seconds\n", execution_time);
 
+	bench_summarize();
 }
 
 static gboolean teardown_callback(gpointer user_data)
@@ -345,6 +594,7 @@ static gboolean test_timeout(gpointer user_data)
 		return FALSE;
 
 	test->result = TEST_RESULT_TIMED_OUT;
+	test->bench_timing = false;
 	print_progress(test->name, COLOR_RED, "test timed out");
 
 	g_idle_add(teardown_callback, test);
@@ -352,6 +602,17 @@ static gboolean test_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static void start_test_case(struct test_case *test)
+{
+	if (test->timeout > 0)
+		test->timeout_id = g_timeout_add_seconds(test->timeout,
+							test_timeout, test);
+
+	test->stage = TEST_STAGE_PRE_SETUP;
+
+	test->pre_setup_func(test->test_data);
+}
+
 static void next_test_case(void)
 {
 	struct test_case *test;
@@ -375,13 +636,7 @@ static void next_test_case(void)
 
 	test->start_time = g_timer_elapsed(test_timer, NULL);
 
-	if (test->timeout > 0)
-		test->timeout_id = g_timeout_add_seconds(test->timeout,
-							test_timeout, test);
-
-	test->stage = TEST_STAGE_PRE_SETUP;
-
-	test->pre_setup_func(test->test_data);
+	start_test_case(test);
 }
 
 static gboolean setup_callback(gpointer user_data)
@@ -403,6 +658,10 @@ static gboolean run_callback(gpointer user_data)
 	test->stage = TEST_STAGE_RUN;
 
 	print_progress(test->name, COLOR_BLACK, "run");
+
+	if (test->bench)
+		tester_bench_start();
+
 	test->test_func(test->test_data);
 
 	return FALSE;
@@ -414,6 +673,16 @@ static gboolean done_callback(gpointer user_data)
 
 	test->end_time = g_timer_elapsed(test_timer, NULL);
 
+	if (test->bench && test->result == TEST_RESULT_PASSED &&
+			++test->run_count < test->warmup + test->iterations) {
+		print_progress(test->name, COLOR_BLACK, "iteration %u of %u",
+					test->run_count + 1,
+					test->warmup + test->iterations);
+		test->result = TEST_RESULT_NOT_RUN;
+		start_test_case(test);
+		return FALSE;
+	}
+
 	print_progress(test->name, COLOR_BLACK, "done");
 	next_test_case();
 
@@ -511,6 +780,8 @@ void tester_test_passed(void)
 		test->timeout_id = 0;
 	}
 
+	tester_bench_stop();
+
 	test->result = TEST_RESULT_PASSED;
 	print_progress(test->name, COLOR_GREEN, "test passed");
 
@@ -534,12 +805,59 @@ void tester_test_failed(void)
 		test->timeout_id = 0;
 	}
 
+	test->bench_timing = false;
+
 	test->result = TEST_RESULT_FAILED;
 	print_progress(test->name, COLOR_RED, "test failed");
 
 	g_idle_add(teardown_callback, test);
 }
 
+void tester_bench_start(void)
+{
+	struct test_case *test;
+
+	if (!test_current)
+		return;
+
+	test = test_current->data;
+
+	if (!test->bench || test->stage != TEST_STAGE_RUN)
+		return;
+
+	test->bench_timing = true;
+	test->wall_start = get_usec(CLOCK_MONOTONIC);
+	test->cpu_start = get_usec(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void tester_bench_stop(void)
+{
+	struct test_case *test;
+	uint64_t wall, cpu;
+
+	if (!test_current)
+		return;
+
+	test = test_current->data;
+
+	if (!test->bench || !test->bench_timing)
+		return;
+
+	wall = get_usec(CLOCK_MONOTONIC);
+	cpu = get_usec(CLOCK_PROCESS_CPUTIME_ID);
+
+	test->bench_timing = false;
+
+	/* Warm-up iterations are run in full but never recorded */
+	if (test->run_count < test->warmup ||
+				test->sample_count >= test->iterations)
+		return;
+
+	test->wall_samples[test->sample_count] = wall - test->wall_start;
+	test->cpu_samples[test->sample_count] = cpu - test->cpu_start;
+	test->sample_count++;
+}
+
 void tester_teardown_complete(void)
 {
 	struct test_case *test;
@@ -764,6 +1082,10 @@ static GOptionEntry options[] = {
 				"Only list the tests to be run" },
 	{ "prefix", 'p', 0, G_OPTION_ARG_STRING, &option_prefix,
 				"Run tests matching provided prefix" },
+	{ "iterations", 'i', 0, G_OPTION_ARG_INT, &option_iterations,
+				"Override iterations of benchmarks" },
+	{ "json", 'j', 0, G_OPTION_ARG_STRING, &option_json,
+				"Write benchmark results as JSON to file" },
 	{ NULL },
 };
 
@@ -53,6 +53,25 @@ void tester_add(const char *name, const void *test_data,
 					tester_data_func_t test_func,
 					tester_data_func_t teardown_func);
 
+void tester_bench_add_full(const char *name, const void *test_data,
+				tester_data_func_t pre_setup_func,
+				tester_data_func_t setup_func,
+				tester_data_func_t test_func,
+				tester_data_func_t teardown_func,
+				tester_data_func_t post_teardown_func,
+				unsigned int timeout,
+				unsigned int warmup, unsigned int iterations,
+				void *user_data, tester_destroy_func_t destroy);
+
+void tester_bench_add(const char *name, const void *test_data,
+					tester_data_func_t setup_func,
+					tester_data_func_t test_func,
+					tester_data_func_t teardown_func,
+					unsigned int warmup, unsigned int iterations);
+
+void tester_bench_start(void);
+void tester_bench_stop(void);
+
 void *tester_get_data(void);
 
 void tester_pre_setup_complete(void);
@@ -0,0 +1,46 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ */
+
+/*
+ * Static tracepoints of the "bluez" provider, see --enable-tracing. Each
+ * one compiles to a single nop until a tracer like bpftrace or perf
+ * attaches to it, and to nothing at all without tracing support:
+ *
+ *	bpftrace -e 'usdt:/usr/libexec/bluetooth/bluetoothd:bluez:att_recv
+ *					{ @[arg1] = count(); }'
+ *
+ * Arguments are only evaluated when built with tracing, so they must not
+ * have side effects.
+ */
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define BT_TRACE(name)			DTRACE_PROBE(bluez, name)
+#define BT_TRACE1(name, a)		DTRACE_PROBE1(bluez, name, a)
+#define BT_TRACE2(name, a, b)		DTRACE_PROBE2(bluez, name, a, b)
+#define BT_TRACE3(name, a, b, c)	DTRACE_PROBE3(bluez, name, a, b, c)
+#define BT_TRACE4(name, a, b, c, d)	DTRACE_PROBE4(bluez, name, a, b, c, d)
+#else
+#define BT_TRACE(name)			do { } while (0)
+#define BT_TRACE1(name, a)		do { } while (0)
+#define BT_TRACE2(name, a, b)		do { } while (0)
+#define BT_TRACE3(name, a, b, c)	do { } while (0)
+#define BT_TRACE4(name, a, b, c, d)	do { } while (0)
+#endif
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 
 #include "src/shared/io.h"
 #include "src/shared/util.h"
@@ -38,11 +39,15 @@
 
 #define UHID_DEVICE_FILE "/dev/uhid"
 
+/* Maximum number of events submitted by a single writev() */
+#define UHID_BATCH_MAX 16
+
 struct bt_uhid {
 	int ref_count;
 	struct io *io;
 	unsigned int notify_id;
 	struct queue *notify_list;
+	struct bt_uhid_stats stats;
 };
 
 struct uhid_notify {
@@ -237,9 +242,88 @@ int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
 	fd = io_get_fd(uhid->io);
 
 	len = write(fd, ev, sizeof(*ev));
-	if (len < 0)
+	uhid->stats.writes++;
+
+	if (len < 0) {
+		uhid->stats.errors++;
 		return -errno;
+	}
 
 	/* uHID kernel driver does not handle partial writes */
-	return len != sizeof(*ev) ? -EIO : 0;
+	if (len != sizeof(*ev)) {
+		uhid->stats.errors++;
+		return -EIO;
+	}
+
+	uhid->stats.events++;
+
+	return 0;
+}
+
+/*
+ * Submit several events with one system call. The uhid character device
+ * has no write_iter, so the kernel hands each iovec to its write handler
+ * in turn and every event is still parsed on its own. Returns the number
+ * of events written or a negative error if none was.
+ */
+int bt_uhid_send_batch(struct bt_uhid *uhid, const struct uhid_event **ev,
+							unsigned int count)
+{
+	struct iovec iov[UHID_BATCH_MAX];
+	unsigned int i, sent = 0;
+	int fd;
+	ssize_t len;
+
+	if (!uhid->io)
+		return -ENOTCONN;
+
+	if (count == 1) {
+		int err = bt_uhid_send(uhid, ev[0]);
+
+		return err < 0 ? err : 1;
+	}
+
+	fd = io_get_fd(uhid->io);
+
+	while (sent < count) {
+		unsigned int n = count - sent;
+
+		if (n > UHID_BATCH_MAX)
+			n = UHID_BATCH_MAX;
+
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = (void *) ev[sent + i];
+			iov[i].iov_len = sizeof(*ev[0]);
+		}
+
+		len = writev(fd, iov, n);
+		uhid->stats.writes++;
+
+		if (len < 0) {
+			uhid->stats.errors++;
+			return sent ? (int) sent : -errno;
+		}
+
+		len /= sizeof(*ev[0]);
+		sent += len;
+		uhid->stats.events += len;
+
+		/* A rejected event stops the kernel loop, report it */
+		if ((unsigned int) len < n) {
+			uhid->stats.errors++;
+			return sent ? (int) sent : -EIO;
+		}
+	}
+
+	return sent;
+}
+
+bool bt_uhid_get_stats(struct bt_uhid *uhid, struct bt_uhid_stats *stats)
+{
+	if (!uhid || !stats)
+		return false;
+
+	*stats = uhid->stats;
+
+	return true;
 }
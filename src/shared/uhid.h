@@ -42,3 +42,13 @@ unsigned int bt_uhid_register(struct bt_uhid *uhid, uint32_t event,
 bool bt_uhid_unregister(struct bt_uhid *uhid, unsigned int id);
 
 int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev);
+int bt_uhid_send_batch(struct bt_uhid *uhid, const struct uhid_event **ev,
+							unsigned int count);
+
+struct bt_uhid_stats {
+	uint64_t events;	/* events accepted by the kernel */
+	uint64_t writes;	/* write()/writev() calls */
+	uint64_t errors;	/* failed or short writes */
+};
+
+bool bt_uhid_get_stats(struct bt_uhid *uhid, struct bt_uhid_stats *stats);
@@ -27,11 +27,11 @@
 
 #include <stdio.h>
 #include <errno.h>
-#include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -93,44 +93,6 @@ int create_name(char *buf, size_t size, const char *path, const char *address, c
 	return snprintf(buf, size, "%s/%s/%s", path, address, name);
 }
 
-static inline char *find_key(char *map, size_t size, const char *key, size_t len, int icase)
-{
-	char *ptr = map;
-	size_t ptrlen = size;
-
-	while (ptrlen > len + 1) {
-		int cmp = (icase) ? strncasecmp(ptr, key, len) : strncmp(ptr, key, len);
-		if (cmp == 0) {
-			if (ptr == map && *(ptr + len) == ' ')
-				return ptr;
-
-			if ((*(ptr - 1) == '\r' || *(ptr - 1) == '\n') &&
-							*(ptr + len) == ' ')
-				return ptr;
-		}
-
-		if (icase) {
-			char *p1 = memchr(ptr + 1, tolower(*key), ptrlen - 1);
-			char *p2 = memchr(ptr + 1, toupper(*key), ptrlen - 1);
-
-			if (!p1)
-				ptr = p2;
-			else if (!p2)
-				ptr = p1;
-			else
-				ptr = (p1 < p2) ? p1 : p2;
-		} else
-			ptr = memchr(ptr + 1, *key, ptrlen - 1);
-
-		if (!ptr)
-			return NULL;
-
-		ptrlen = size - (ptr - map);
-	}
-
-	return NULL;
-}
-
 static inline int write_key_value(int fd, const char *key, const char *value)
 {
 	char *str;
@@ -175,13 +137,297 @@ static char *strnpbrk(const char *s, ssize_t len, const char *accept)
 	return NULL;
 }
 
-static int write_key(const char *pathname, const char *key, const char *value, int icase)
+/*
+ * The most recently used file is kept in memory together with a hash
+ * index of its keys, so that repeated lookups and updates do not have
+ * to scan the whole file again. The copy is checked against the file
+ * attributes while holding the lock and reloaded if anything changed.
+ */
+struct textfile_entry {
+	size_t key;
+	size_t key_len;
+	size_t value;
+	ssize_t value_len;
+	int next;
+};
+
+static struct textfile_cache {
+	char *pathname;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	char *data;
+	size_t data_alloc;
+	struct textfile_entry *entries;
+	int count;
+	int max;
+	int *buckets;
+	unsigned int mask;
+} cache;
+
+static void cache_clear(void)
+{
+	free(cache.pathname);
+	free(cache.data);
+	free(cache.entries);
+	free(cache.buckets);
+
+	memset(&cache, 0, sizeof(cache));
+}
+
+static unsigned int key_hash(const char *key, size_t len)
+{
+	unsigned int hash = 5381;
+
+	while (len--)
+		hash = ((hash << 5) + hash) + (unsigned char) *key++;
+
+	return hash;
+}
+
+static int cache_lookup(const char *key, size_t len)
+{
+	int i;
+
+	if (!cache.buckets)
+		return -1;
+
+	i = cache.buckets[key_hash(key, len) & cache.mask];
+
+	while (i >= 0) {
+		struct textfile_entry *entry = &cache.entries[i];
+
+		if (entry->key_len == len &&
+				!memcmp(cache.data + entry->key, key, len))
+			return i;
+
+		i = entry->next;
+	}
+
+	return -1;
+}
+
+static int cache_rehash(unsigned int size)
+{
+	int *buckets;
+	int i;
+
+	buckets = malloc(size * sizeof(*buckets));
+	if (!buckets)
+		return -ENOMEM;
+
+	memset(buckets, 0xff, size * sizeof(*buckets));
+
+	free(cache.buckets);
+	cache.buckets = buckets;
+	cache.mask = size - 1;
+
+	for (i = 0; i < cache.count; i++) {
+		struct textfile_entry *entry = &cache.entries[i];
+		unsigned int h;
+
+		h = key_hash(cache.data + entry->key, entry->key_len);
+		entry->next = buckets[h & cache.mask];
+		buckets[h & cache.mask] = i;
+	}
+
+	return 0;
+}
+
+static int cache_add(size_t key, size_t key_len, size_t value,
+							ssize_t value_len)
+{
+	struct textfile_entry *entry;
+	unsigned int h;
+
+	/* Only the first occurrence of a key is ever looked up */
+	if (cache_lookup(cache.data + key, key_len) >= 0)
+		return 0;
+
+	if (cache.count == cache.max) {
+		int max = cache.max ? cache.max * 2 : 16;
+
+		entry = realloc(cache.entries, max * sizeof(*entry));
+		if (!entry)
+			return -ENOMEM;
+
+		cache.entries = entry;
+		cache.max = max;
+
+		if (cache_rehash(max) < 0)
+			return -ENOMEM;
+	}
+
+	entry = &cache.entries[cache.count];
+	entry->key = key;
+	entry->key_len = key_len;
+	entry->value = value;
+	entry->value_len = value_len;
+
+	h = key_hash(cache.data + key, key_len) & cache.mask;
+	entry->next = cache.buckets[h];
+	cache.buckets[h] = cache.count++;
+
+	return 0;
+}
+
+static char *find_eol(char *str, size_t len)
+{
+	char *nl, *cr;
+
+	nl = memchr(str, '\n', len);
+	cr = memchr(str, '\r', nl ? (size_t) (nl - str) : len);
+
+	return cr ? cr : nl;
+}
+
+static int cache_parse(size_t off)
+{
+	size_t size = cache.size;
+
+	while (off < size) {
+		char *line = cache.data + off;
+		char *key_end, *end;
+		size_t key_len;
+		ssize_t value_len;
+		int err;
+
+		end = find_eol(line, size - off);
+		key_end = memchr(line, ' ', end ? (size_t) (end - line) :
+								size - off);
+
+		if (key_end && key_end > line) {
+			key_len = key_end - line;
+			value_len = end ? end - key_end - 1 : -1;
+
+			err = cache_add(off, key_len, off + key_len + 1,
+								value_len);
+			if (err < 0)
+				return err;
+		}
+
+		if (!end)
+			break;
+
+		off = end - cache.data + 1;
+	}
+
+	return 0;
+}
+
+static void cache_stamp(const struct stat *st)
+{
+	cache.dev = st->st_dev;
+	cache.ino = st->st_ino;
+	cache.size = st->st_size;
+	cache.mtime = st->st_mtim;
+}
+
+static bool cache_valid(const char *pathname, const struct stat *st)
+{
+	if (!cache.pathname || strcmp(cache.pathname, pathname))
+		return false;
+
+	return cache.dev == st->st_dev && cache.ino == st->st_ino &&
+			cache.size == st->st_size &&
+			cache.mtime.tv_sec == st->st_mtim.tv_sec &&
+			cache.mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static int cache_load(int fd, const char *pathname, const struct stat *st)
+{
+	size_t off = 0;
+	int err;
+
+	if (cache_valid(pathname, st))
+		return 0;
+
+	cache_clear();
+
+	cache.pathname = strdup(pathname);
+	cache.data_alloc = st->st_size + 1;
+	cache.data = malloc(cache.data_alloc);
+	if (!cache.pathname || !cache.data) {
+		err = -ENOMEM;
+		goto failed;
+	}
+
+	while (off < (size_t) st->st_size) {
+		ssize_t len;
+
+		len = pread(fd, cache.data + off, st->st_size - off, off);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			goto failed;
+		}
+
+		if (!len)
+			break;
+
+		off += len;
+	}
+
+	cache_stamp(st);
+	cache.size = off;
+	cache.data[off] = '\0';
+
+	err = cache_parse(0);
+	if (err < 0)
+		goto failed;
+
+	return 0;
+
+failed:
+	cache_clear();
+	return err;
+}
+
+static void cache_append(int fd, const char *key, const char *value)
+{
+	size_t key_len = strlen(key);
+	size_t len = key_len + strlen(value) + 2;
+	size_t off = cache.size;
+	struct stat st;
+
+	if (off + len + 1 > cache.data_alloc) {
+		size_t alloc = MAX(cache.data_alloc * 2, off + len + 1);
+		char *data;
+
+		data = realloc(cache.data, alloc);
+		if (!data)
+			goto failed;
+
+		cache.data = data;
+		cache.data_alloc = alloc;
+	}
+
+	sprintf(cache.data + off, "%s %s\n", key, value);
+
+	if (fstat(fd, &st) < 0 || st.st_size != (off_t) (off + len))
+		goto failed;
+
+	cache_stamp(&st);
+
+	if (cache_add(off, key_len, off + key_len + 1, len - key_len - 2) < 0)
+		goto failed;
+
+	return;
+
+failed:
+	cache_clear();
+}
+
+static int write_key(const char *pathname, const char *key, const char *value)
 {
+	struct textfile_entry *entry;
 	struct stat st;
-	char *map, *off, *end, *str;
+	char *end;
 	off_t size;
-	size_t base;
-	int fd, len, err = 0;
+	size_t base, len;
+	int fd, i, err = 0;
 
 	fd = open(pathname, O_RDWR);
 	if (fd < 0)
@@ -197,95 +443,78 @@ static int write_key(const char *pathname, const char *key, const char *value, i
 		goto unlock;
 	}
 
-	size = st.st_size;
-
-	if (!size) {
-		if (value) {
-			lseek(fd, size, SEEK_SET);
-			err = write_key_value(fd, key, value);
-		}
+	err = cache_load(fd, pathname, &st);
+	if (err < 0)
 		goto unlock;
-	}
 
-	map = mmap(NULL, size, PROT_READ | PROT_WRITE,
-					MAP_PRIVATE | MAP_LOCKED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
-		goto unlock;
-	}
+	size = cache.size;
 
-	len = strlen(key);
-	off = find_key(map, size, key, len, icase);
-	if (!off) {
-		munmap(map, size);
+	i = cache_lookup(key, strlen(key));
+	if (i < 0) {
 		if (value) {
 			lseek(fd, size, SEEK_SET);
 			err = write_key_value(fd, key, value);
+			if (!err)
+				cache_append(fd, key, value);
+			else
+				cache_clear();
 		}
 		goto unlock;
 	}
 
-	base = off - map;
+	entry = &cache.entries[i];
 
-	end = strnpbrk(off, size, "\r\n");
-	if (!end) {
+	if (entry->value_len < 0) {
 		err = -EILSEQ;
-		goto unmap;
+		goto unlock;
 	}
 
-	if (value && ((ssize_t) strlen(value) == end - off - len - 1) &&
-			!strncmp(off + len + 1, value, end - off - len - 1))
-		goto unmap;
-
-	len = strspn(end, "\r\n");
-	end += len;
+	/* Values of unchanged length are overwritten in place */
+	if (value && (ssize_t) strlen(value) == entry->value_len) {
+		if (!memcmp(cache.data + entry->value, value,
+							entry->value_len))
+			goto unlock;
 
-	len = size - (end - map);
-	if (!len) {
-		munmap(map, size);
-		if (ftruncate(fd, base) < 0) {
+		if (pwrite(fd, value, entry->value_len, entry->value) < 0) {
 			err = -errno;
+			cache_clear();
 			goto unlock;
 		}
-		lseek(fd, base, SEEK_SET);
-		if (value)
-			err = write_key_value(fd, key, value);
 
-		goto unlock;
-	}
+		memcpy(cache.data + entry->value, value, entry->value_len);
 
-	if (len < 0 || len > size) {
-		err = -EILSEQ;
-		goto unmap;
-	}
+		if (fstat(fd, &st) < 0)
+			cache_clear();
+		else
+			cache_stamp(&st);
 
-	str = malloc(len);
-	if (!str) {
-		err = -errno;
-		goto unmap;
+		goto unlock;
 	}
 
-	memcpy(str, end, len);
+	base = entry->key;
 
-	munmap(map, size);
+	end = cache.data + entry->value + entry->value_len;
+	end += strspn(end, "\r\n");
+	len = size - (end - cache.data);
+
+	/*
+	 * Anything else needs the rest of the file moved. The cached copy
+	 * is still intact at this point and gets dropped afterwards.
+	 */
 	if (ftruncate(fd, base) < 0) {
 		err = -errno;
-		free(str);
-		goto unlock;
+		goto drop;
 	}
+
 	lseek(fd, base, SEEK_SET);
 	if (value)
 		err = write_key_value(fd, key, value);
 
-	if (write(fd, str, len) < 0)
+	if (len && write(fd, end, len) < 0)
 		err = -errno;
 
-	free(str);
-
-	goto unlock;
-
-unmap:
-	munmap(map, size);
+drop:
+	cache_clear();
 
 unlock:
 	flock(fd, LOCK_UN);
@@ -299,12 +528,12 @@ close:
 	return err;
 }
 
-static char *read_key(const char *pathname, const char *key, int icase)
+static char *read_key(const char *pathname, const char *key)
 {
+	struct textfile_entry *entry;
 	struct stat st;
-	char *map, *off, *end, *str = NULL;
-	off_t size; size_t len;
-	int fd, err = 0;
+	char *str = NULL;
+	int fd, i, err = 0;
 
 	fd = open(pathname, O_RDONLY);
 	if (fd < 0)
@@ -320,38 +549,25 @@ static char *read_key(const char *pathname, const char *key, int icase)
 		goto unlock;
 	}
 
-	size = st.st_size;
-
-	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
+	err = cache_load(fd, pathname, &st);
+	if (err < 0)
 		goto unlock;
-	}
-
-	len = strlen(key);
-	off = find_key(map, size, key, len, icase);
-	if (!off) {
-		err = -EILSEQ;
-		goto unmap;
-	}
 
-	end = strnpbrk(off, size - (off - map), "\r\n");
-	if (!end) {
+	i = cache_lookup(key, strlen(key));
+	if (i < 0) {
 		err = -EILSEQ;
-		goto unmap;
+		goto unlock;
 	}
 
-	str = malloc(end - off - len);
-	if (!str) {
+	entry = &cache.entries[i];
+	if (entry->value_len < 0) {
 		err = -EILSEQ;
-		goto unmap;
+		goto unlock;
 	}
 
-	memset(str, 0, end - off - len);
-	strncpy(str, off + len + 1, end - off - len - 1);
-
-unmap:
-	munmap(map, size);
+	str = strndup(cache.data + entry->value, entry->value_len);
+	if (!str)
+		err = -ENOMEM;
 
 unlock:
 	flock(fd, LOCK_UN);
@@ -365,17 +581,17 @@ close:
 
 int textfile_put(const char *pathname, const char *key, const char *value)
 {
-	return write_key(pathname, key, value, 0);
+	return write_key(pathname, key, value);
 }
 
 int textfile_del(const char *pathname, const char *key)
 {
-	return write_key(pathname, key, NULL, 0);
+	return write_key(pathname, key, NULL);
 }
 
 char *textfile_get(const char *pathname, const char *key)
 {
-	return read_key(pathname, key, 0);
+	return read_key(pathname, key);
 }
 
 int textfile_foreach(const char *pathname, textfile_cb func, void *data)
@@ -0,0 +1,394 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "log.h"
+#include "textfile.h"
+#include "worker.h"
+
+struct worker_job {
+	btd_worker_func_t func;
+	btd_worker_func_t done;
+	void *user_data;
+};
+
+struct stored_file {
+	int ref_count;
+	char *filename;
+	char *data;
+	gsize length;
+	bool failed;
+};
+
+/*
+ * Latest queued contents of every file with a write in flight. Only ever
+ * touched from the main loop, the worker gets its own reference.
+ */
+static GHashTable *pending_files = NULL;
+
+static bool initialized = false;
+
+#ifdef NEED_THREADS
+/*
+ * A single thread keeps jobs in order, which the storage helpers rely on:
+ * a later write or remove of the same file must land after an earlier one.
+ */
+static GThreadPool *pool = NULL;
+static GAsyncQueue *done_queue = NULL;
+#else
+static GQueue *job_queue = NULL;
+static guint job_id = 0;
+#endif
+
+static void job_complete(struct worker_job *job)
+{
+	if (job->done)
+		job->done(job->user_data);
+
+	g_free(job);
+}
+
+#ifdef NEED_THREADS
+static gboolean job_done_cb(gpointer user_data)
+{
+	struct worker_job *job;
+
+	job = g_async_queue_try_pop(done_queue);
+	if (job)
+		job_complete(job);
+
+	return FALSE;
+}
+
+static void worker_thread(gpointer data, gpointer user_data)
+{
+	struct worker_job *job = data;
+
+	job->func(job->user_data);
+
+	g_async_queue_push(done_queue, job);
+	g_idle_add(job_done_cb, NULL);
+}
+
+static bool queue_job(struct worker_job *job)
+{
+	GError *err = NULL;
+
+	g_thread_pool_push(pool, job, &err);
+	if (err) {
+		error("Unable to queue job: %s", err->message);
+		g_error_free(err);
+		return false;
+	}
+
+	return true;
+}
+
+static void flush_jobs(void)
+{
+	struct worker_job *job;
+
+	/* Waits for every queued job to run */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	pool = NULL;
+
+	while ((job = g_async_queue_try_pop(done_queue)))
+		job_complete(job);
+
+	g_async_queue_unref(done_queue);
+	done_queue = NULL;
+}
+#else
+/*
+ * Without thread support jobs still run outside of event processing: one
+ * per low priority idle dispatch, after any pending HCI, mgmt or ATT
+ * traffic has been handled.
+ */
+static gboolean run_job_cb(gpointer user_data)
+{
+	struct worker_job *job;
+
+	job = g_queue_pop_head(job_queue);
+	if (job) {
+		job->func(job->user_data);
+		job_complete(job);
+	}
+
+	if (!g_queue_is_empty(job_queue))
+		return TRUE;
+
+	job_id = 0;
+
+	return FALSE;
+}
+
+static bool queue_job(struct worker_job *job)
+{
+	g_queue_push_tail(job_queue, job);
+
+	if (!job_id)
+		job_id = g_idle_add_full(G_PRIORITY_LOW, run_job_cb, NULL,
+									NULL);
+
+	return true;
+}
+
+static void flush_jobs(void)
+{
+	struct worker_job *job;
+
+	if (job_id > 0) {
+		g_source_remove(job_id);
+		job_id = 0;
+	}
+
+	while ((job = g_queue_pop_head(job_queue))) {
+		job->func(job->user_data);
+		job_complete(job);
+	}
+
+	g_queue_free(job_queue);
+	job_queue = NULL;
+}
+#endif
+
+bool btd_worker_run(btd_worker_func_t func, btd_worker_func_t done,
+							void *user_data)
+{
+	struct worker_job *job;
+
+	if (!func)
+		return false;
+
+	job = g_new0(struct worker_job, 1);
+	job->func = func;
+	job->done = done;
+	job->user_data = user_data;
+
+	/* Before init and after cleanup there is nothing to defer to */
+	if (!initialized) {
+		func(user_data);
+		job_complete(job);
+		return true;
+	}
+
+	if (!queue_job(job)) {
+		g_free(job);
+		return false;
+	}
+
+	return true;
+}
+
+static struct stored_file *stored_file_ref(struct stored_file *file)
+{
+	file->ref_count++;
+
+	return file;
+}
+
+static void stored_file_unref(gpointer data)
+{
+	struct stored_file *file = data;
+
+	if (--file->ref_count > 0)
+		return;
+
+	g_free(file->filename);
+	g_free(file->data);
+	g_free(file);
+}
+
+static void store_file(void *user_data)
+{
+	struct stored_file *file = user_data;
+	char *old;
+	gsize old_length;
+	bool same;
+
+	/* Skip the rewrite, and its fsync, if nothing actually changed */
+	if (g_file_get_contents(file->filename, &old, &old_length, NULL)) {
+		same = old_length == file->length &&
+				!memcmp(old, file->data, old_length);
+		g_free(old);
+
+		if (same)
+			return;
+	}
+
+	create_file(file->filename, S_IRUSR | S_IWUSR);
+
+	if (!g_file_set_contents(file->filename, file->data, file->length,
+									NULL))
+		file->failed = true;
+}
+
+static void store_file_done(void *user_data)
+{
+	struct stored_file *file = user_data;
+
+	if (file->failed)
+		error("Failed to write %s", file->filename);
+
+	if (pending_files && g_hash_table_lookup(pending_files,
+						file->filename) == file)
+		g_hash_table_remove(pending_files, file->filename);
+
+	stored_file_unref(file);
+}
+
+gboolean btd_worker_load_key_file(GKeyFile *key_file, const char *filename)
+{
+	struct stored_file *file = NULL;
+
+	if (pending_files)
+		file = g_hash_table_lookup(pending_files, filename);
+
+	if (file)
+		return g_key_file_load_from_data(key_file, file->data,
+						file->length, 0, NULL);
+
+	return g_key_file_load_from_file(key_file, filename, 0, NULL);
+}
+
+void btd_worker_store_file(const char *filename, char *data, gsize length)
+{
+	struct stored_file *file;
+
+	file = g_new0(struct stored_file, 1);
+	file->ref_count = 1;
+	file->filename = g_strdup(filename);
+	file->data = data;
+	file->length = length;
+
+	if (pending_files)
+		g_hash_table_replace(pending_files, file->filename,
+						stored_file_ref(file));
+
+	btd_worker_run(store_file, store_file_done, file);
+}
+
+static void remove_tree(const char *dirname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char filename[PATH_MAX];
+
+	dir = opendir(dirname);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (g_str_equal(entry->d_name, ".") ||
+				g_str_equal(entry->d_name, ".."))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
+
+		if (entry->d_type == DT_DIR)
+			remove_tree(filename);
+		else
+			unlink(filename);
+	}
+	closedir(dir);
+
+	rmdir(dirname);
+}
+
+static void remove_tree_job(void *user_data)
+{
+	remove_tree(user_data);
+}
+
+static gboolean match_prefix(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	return g_str_has_prefix(key, user_data);
+}
+
+void btd_worker_remove_tree(const char *dirname)
+{
+	char *prefix;
+
+	/* Queued writes below it still run first, but nobody may load them */
+	if (pending_files) {
+		prefix = g_strconcat(dirname, "/", NULL);
+		g_hash_table_foreach_remove(pending_files, match_prefix, prefix);
+		g_free(prefix);
+	}
+
+	btd_worker_run(remove_tree_job, g_free, g_strdup(dirname));
+}
+
+void btd_worker_init(void)
+{
+	DBG("");
+
+	pending_files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+							stored_file_unref);
+
+#ifdef NEED_THREADS
+	if (g_thread_supported() == FALSE)
+		g_thread_init(NULL);
+
+	done_queue = g_async_queue_new();
+	pool = g_thread_pool_new(worker_thread, NULL, 1, FALSE, NULL);
+#else
+	job_queue = g_queue_new();
+#endif
+
+	initialized = true;
+}
+
+void btd_worker_cleanup(void)
+{
+	if (!initialized)
+		return;
+
+	DBG("");
+
+	flush_jobs();
+
+	initialized = false;
+
+	g_hash_table_destroy(pending_files);
+	pending_files = NULL;
+}
@@ -0,0 +1,45 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+typedef void (*btd_worker_func_t) (void *user_data);
+
+/*
+ * Runs "func" away from the main loop, then "done" back on it. Jobs run
+ * one at a time in the order they were queued. "func" must not touch any
+ * state owned by the main loop, including logging.
+ */
+bool btd_worker_run(btd_worker_func_t func, btd_worker_func_t done,
+							void *user_data);
+
+/*
+ * Storage files written through the worker. The store takes ownership of
+ * "data" and replaces the file atomically, creating missing directories.
+ * Loads see queued contents before they hit the disk, so a load right
+ * after a store never reads stale data.
+ */
+gboolean btd_worker_load_key_file(GKeyFile *key_file, const char *filename);
+void btd_worker_store_file(const char *filename, char *data, gsize length);
+void btd_worker_remove_tree(const char *dirname);
+
+void btd_worker_init(void);
+void btd_worker_cleanup(void);
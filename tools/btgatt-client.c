@@ -27,7 +27,10 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <limits.h>
@@ -60,9 +63,12 @@
 
 static bool verbose = false;
 
+struct bench;
+
 struct client {
 	int fd;
 	struct bt_gatt_client *gatt;
+	struct bench *bench;
 };
 
 static void print_prompt(void)
@@ -92,9 +98,29 @@ static void gatt_debug_cb(const char *str, void *user_data)
 	PRLOG(COLOR_GREEN "%s%s\n" COLOR_OFF, prefix, str);
 }
 
+static void link_cb(uint8_t state, uint16_t mtu, void *user_data)
+{
+	const char *str;
+
+	switch (state) {
+	case BT_GATT_CLIENT_LINK_DISCOVERY:
+		str = "discovery";
+		break;
+	case BT_GATT_CLIENT_LINK_BULK:
+		str = "bulk transfer";
+		break;
+	default:
+		str = "idle";
+		break;
+	}
+
+	PRLOG(COLOR_GREEN "gatt: Link %s, MTU %u\n" COLOR_OFF, str, mtu);
+}
+
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data);
 
-static struct client *client_create(int fd, uint16_t mtu)
+static struct client *client_create(int fd, uint16_t mtu,
+						const char *cache_path)
 {
 	struct client *cli;
 	struct bt_att *att;
@@ -128,7 +154,10 @@ static struct client *client_create(int fd, uint16_t mtu)
 	}
 
 	cli->fd = fd;
-	cli->gatt = bt_gatt_client_new(att, mtu);
+	if (cache_path)
+		cli->gatt = bt_gatt_client_new_with_cache(att, mtu, cache_path);
+	else
+		cli->gatt = bt_gatt_client_new(att, mtu);
 	if (!cli->gatt) {
 		fprintf(stderr, "Failed to create GATT client\n");
 		bt_att_unref(att);
@@ -140,6 +169,8 @@ static struct client *client_create(int fd, uint16_t mtu)
 		bt_att_set_debug(att, att_debug_cb, "att: ", NULL);
 		bt_gatt_client_set_debug(cli->gatt, gatt_debug_cb, "gatt: ",
 									NULL);
+		bt_gatt_client_set_link_handler(cli->gatt, link_cb, NULL,
+									NULL);
 	}
 
 	bt_gatt_client_set_ready_handler(cli->gatt, ready_cb, cli, NULL);
@@ -253,10 +284,423 @@ static void print_services_by_handle(struct client *cli, uint16_t handle)
 		print_service(service);
 }
 
+#define BENCH_COUNT		100
+#define BENCH_WRITE_LEN		1
+#define BENCH_WRITE_LONG_LEN	512
+#define BENCH_NOTIFY_SECS	10
+
+enum bench_type {
+	BENCH_READ,
+	BENCH_WRITE,
+	BENCH_READ_LONG,
+	BENCH_WRITE_LONG,
+	BENCH_NOTIFY,
+};
+
+static const char *bench_names[] = {
+	[BENCH_READ]		= "read",
+	[BENCH_WRITE]		= "write",
+	[BENCH_READ_LONG]	= "read-long",
+	[BENCH_WRITE_LONG]	= "write-long",
+	[BENCH_NOTIFY]		= "notify",
+};
+
+struct bench_workload {
+	enum bench_type type;
+	uint16_t handle;
+	unsigned int arg;	/* Value length, or duration for notify */
+};
+
+struct bench {
+	struct client *cli;
+	struct bench_workload *workloads;
+	unsigned int num_workloads;
+	unsigned int cur;
+	unsigned int count;
+	unsigned int iter;
+	unsigned int errors;
+	uint64_t *samples;
+	uint64_t start;
+	uint64_t op_start;
+	uint64_t bytes;
+	uint8_t *value;
+	unsigned int notify_id;
+	int timer;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool bench_parse_workload(char *str, struct bench_workload *w)
+{
+	char *name, *handle, *arg, *endptr = NULL;
+	unsigned int i;
+
+	name = strsep(&str, ":");
+	handle = strsep(&str, ":");
+	arg = strsep(&str, ":");
+
+	if (!name || !handle || str)
+		return false;
+
+	for (i = 0; i < sizeof(bench_names) / sizeof(bench_names[0]); i++) {
+		if (!strcmp(name, bench_names[i]))
+			break;
+	}
+
+	if (i == sizeof(bench_names) / sizeof(bench_names[0]))
+		return false;
+
+	w->type = i;
+
+	w->handle = strtol(handle, &endptr, 16);
+	if (!endptr || *endptr != '\0' || !w->handle)
+		return false;
+
+	switch (w->type) {
+	case BENCH_WRITE:
+		w->arg = BENCH_WRITE_LEN;
+		break;
+	case BENCH_WRITE_LONG:
+		w->arg = BENCH_WRITE_LONG_LEN;
+		break;
+	case BENCH_NOTIFY:
+		w->arg = BENCH_NOTIFY_SECS;
+		break;
+	default:
+		/* Reads take no argument */
+		return !arg;
+	}
+
+	if (!arg)
+		return true;
+
+	endptr = NULL;
+	w->arg = strtol(arg, &endptr, 10);
+	if (!endptr || *endptr != '\0' || !w->arg || w->arg > UINT16_MAX)
+		return false;
+
+	return true;
+}
+
+static struct bench *bench_new(const char *spec, unsigned int count)
+{
+	struct bench *bench;
+	char *str, *cur, *tok;
+	unsigned int max_len = 0;
+	unsigned int i;
+
+	bench = new0(struct bench, 1);
+	if (!bench)
+		return NULL;
+
+	str = strdup(spec);
+	if (!str)
+		goto fail;
+
+	for (i = 1, cur = str; *cur; cur++) {
+		if (*cur == ',')
+			i++;
+	}
+
+	bench->workloads = new0(struct bench_workload, i);
+	bench->samples = new0(uint64_t, count);
+	if (!bench->workloads || !bench->samples)
+		goto fail;
+
+	cur = str;
+	while ((tok = strsep(&cur, ","))) {
+		struct bench_workload *w;
+
+		w = &bench->workloads[bench->num_workloads++];
+
+		if (!bench_parse_workload(tok, w)) {
+			fprintf(stderr, "Invalid workload: %s\n", tok);
+			goto fail;
+		}
+
+		if (w->type == BENCH_WRITE || w->type == BENCH_WRITE_LONG)
+			max_len = w->arg > max_len ? w->arg : max_len;
+	}
+
+	bench->value = malloc(max_len ? max_len : 1);
+	if (!bench->value)
+		goto fail;
+
+	for (i = 0; i < max_len; i++)
+		bench->value[i] = i;
+
+	bench->count = count;
+	bench->timer = -1;
+	free(str);
+
+	return bench;
+
+fail:
+	free(str);
+	free(bench->workloads);
+	free(bench->samples);
+	free(bench);
+
+	return NULL;
+}
+
+static void bench_free(struct bench *bench)
+{
+	if (!bench)
+		return;
+
+	if (bench->timer >= 0)
+		mainloop_remove_timeout(bench->timer);
+
+	free(bench->value);
+	free(bench->workloads);
+	free(bench->samples);
+	free(bench);
+}
+
+static int bench_sample_cmp(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static uint64_t bench_percentile(struct bench *bench, unsigned int pct)
+{
+	return bench->samples[(bench->iter - 1) * pct / 100];
+}
+
+static void bench_report(struct bench *bench)
+{
+	struct bench_workload *w = &bench->workloads[bench->cur];
+	uint64_t elapsed = bench_now() - bench->start;
+	uint64_t total = 0;
+	unsigned int i;
+
+	printf("bench=%s handle=0x%04x mtu=%u count=%u errors=%u",
+				bench_names[w->type], w->handle,
+				bt_gatt_client_get_mtu(bench->cli->gatt),
+				bench->iter, bench->errors);
+
+	if (w->type != BENCH_NOTIFY && bench->iter) {
+		qsort(bench->samples, bench->iter, sizeof(uint64_t),
+							bench_sample_cmp);
+
+		for (i = 0; i < bench->iter; i++)
+			total += bench->samples[i];
+
+		printf(" min_us=%" PRIu64 " p50_us=%" PRIu64
+			" p90_us=%" PRIu64 " p99_us=%" PRIu64
+			" max_us=%" PRIu64 " mean_us=%" PRIu64,
+			bench->samples[0], bench_percentile(bench, 50),
+			bench_percentile(bench, 90),
+			bench_percentile(bench, 99),
+			bench->samples[bench->iter - 1], total / bench->iter);
+	}
+
+	printf(" bytes=%" PRIu64 " elapsed_us=%" PRIu64
+				" bytes_per_sec=%" PRIu64 "\n",
+				bench->bytes, elapsed,
+				elapsed ? bench->bytes * 1000000 / elapsed : 0);
+	fflush(stdout);
+}
+
+static void bench_next(struct bench *bench);
+static void bench_iter(struct bench *bench);
+
+static void bench_sample(struct bench *bench, bool success, uint16_t length)
+{
+	bench->samples[bench->iter++] = bench_now() - bench->op_start;
+
+	if (success)
+		bench->bytes += length;
+	else
+		bench->errors++;
+
+	bench_iter(bench);
+}
+
+static void bench_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	bench_sample(user_data, success, length);
+}
+
+static void bench_write_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	struct bench *bench = user_data;
+
+	bench_sample(bench, success, bench->workloads[bench->cur].arg);
+}
+
+static void bench_write_long_cb(bool success, bool reliable_error,
+					uint8_t att_ecode, void *user_data)
+{
+	struct bench *bench = user_data;
+
+	bench_sample(bench, success, bench->workloads[bench->cur].arg);
+}
+
+static void bench_iter(struct bench *bench)
+{
+	struct bench_workload *w = &bench->workloads[bench->cur];
+	struct bt_gatt_client *gatt = bench->cli->gatt;
+	bool sent = false;
+
+	if (bench->iter == bench->count)
+		goto done;
+
+	bench->op_start = bench_now();
+
+	switch (w->type) {
+	case BENCH_READ:
+		sent = bt_gatt_client_read_value(gatt, w->handle,
+						bench_read_cb, bench, NULL);
+		break;
+	case BENCH_WRITE:
+		sent = bt_gatt_client_write_value(gatt, w->handle,
+						bench->value, w->arg,
+						bench_write_cb, bench, NULL);
+		break;
+	case BENCH_READ_LONG:
+		sent = bt_gatt_client_read_long_value(gatt, w->handle, 0,
+						bench_read_cb, bench, NULL);
+		break;
+	case BENCH_WRITE_LONG:
+		sent = bt_gatt_client_write_long_value(gatt, false, w->handle,
+						0, bench->value, w->arg,
+						bench_write_long_cb, bench,
+						NULL);
+		break;
+	case BENCH_NOTIFY:
+		break;
+	}
+
+	if (sent)
+		return;
+
+	bench->errors++;
+
+done:
+	bench_report(bench);
+	bench->cur++;
+	bench_next(bench);
+}
+
+static void bench_notify_cb(uint16_t value_handle, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct bench *bench = user_data;
+
+	bench->iter++;
+	bench->bytes += length;
+}
+
+static void bench_notify_timeout(int id, void *user_data)
+{
+	struct bench *bench = user_data;
+
+	mainloop_remove_timeout(id);
+	bench->timer = -1;
+
+	bt_gatt_client_unregister_notify(bench->cli->gatt, bench->notify_id);
+
+	bench_report(bench);
+	bench->cur++;
+	bench_next(bench);
+}
+
+static void bench_register_cb(unsigned int id, uint16_t att_ecode,
+							void *user_data)
+{
+	struct bench *bench = user_data;
+	struct bench_workload *w = &bench->workloads[bench->cur];
+
+	if (!id) {
+		bench->errors++;
+		bench_report(bench);
+		bench->cur++;
+		bench_next(bench);
+		return;
+	}
+
+	bench->notify_id = id;
+	bench->iter = 0;
+	bench->bytes = 0;
+	bench->start = bench_now();
+	bench->timer = mainloop_add_timeout(w->arg * 1000,
+						bench_notify_timeout, bench,
+						NULL);
+}
+
+static void bench_next(struct bench *bench)
+{
+	struct bench_workload *w;
+
+	if (bench->cur == bench->num_workloads) {
+		mainloop_quit();
+		return;
+	}
+
+	w = &bench->workloads[bench->cur];
+
+	bench->iter = 0;
+	bench->errors = 0;
+	bench->bytes = 0;
+	bench->start = bench_now();
+
+	if (w->type != BENCH_NOTIFY) {
+		bench_iter(bench);
+		return;
+	}
+
+	if (bt_gatt_client_register_notify(bench->cli->gatt, w->handle,
+						bench_register_cb,
+						bench_notify_cb, bench, NULL))
+		return;
+
+	bench->errors++;
+	bench_report(bench);
+	bench->cur++;
+	bench_next(bench);
+}
+
+static void bench_ready(struct bench *bench, bool success,
+							uint8_t att_ecode)
+{
+	uint64_t elapsed = bench_now() - bench->start;
+
+	printf("bench=discovery mtu=%u errors=%u att_ecode=0x%02x"
+				" elapsed_us=%" PRIu64 "\n",
+				bt_gatt_client_get_mtu(bench->cli->gatt),
+				!success, att_ecode, elapsed);
+	fflush(stdout);
+
+	if (!success) {
+		mainloop_quit();
+		return;
+	}
+
+	bench_next(bench);
+}
+
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct client *cli = user_data;
 
+	if (cli->bench) {
+		bench_ready(cli->bench, success, att_ecode);
+		return;
+	}
+
 	if (!success) {
 		PRLOG("GATT discovery procedures failed - error code: 0x%02x\n",
 								att_ecode);
@@ -980,10 +1424,23 @@ static void usage(void)
 		"\t-d, --dest <addr>\t\tSpecify the destination address\n"
 		"\t-t, --type [random|public] \tSpecify the LE address type\n"
 		"\t-m, --mtu <mtu> \t\tThe ATT MTU to use\n"
+		"\t-c, --cache <file> \t\tLoad and store the attribute "
+								"cache\n"
 		"\t-s, --security-level <sec> \tSet security level (low|"
 								"medium|high)\n"
+		"\t-b, --bench <workloads>\t\tRun the comma separated "
+						"workloads and exit\n"
+		"\t-n, --count <count>\t\tIterations per workload "
+						"(default %u)\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
-		"\t-h, --help\t\t\tDisplay help\n");
+		"\t-h, --help\t\t\tDisplay help\n", BENCH_COUNT);
+
+	printf("Workloads:\n"
+		"\tread:<handle>\n"
+		"\twrite:<handle>[:<length>]\n"
+		"\tread-long:<handle>\n"
+		"\twrite-long:<handle>[:<length>]\n"
+		"\tnotify:<handle>[:<seconds>]\n");
 }
 
 static struct option main_options[] = {
@@ -991,7 +1448,10 @@ static struct option main_options[] = {
 	{ "dest",		1, 0, 'd' },
 	{ "type",		1, 0, 't' },
 	{ "mtu",		1, 0, 'm' },
+	{ "cache",		1, 0, 'c' },
 	{ "security-level",	1, 0, 's' },
+	{ "bench",		1, 0, 'b' },
+	{ "count",		1, 0, 'n' },
 	{ "verbose",		0, 0, 'v' },
 	{ "help",		0, 0, 'h' },
 	{ }
@@ -1009,8 +1469,12 @@ int main(int argc, char *argv[])
 	int fd;
 	sigset_t mask;
 	struct client *cli;
+	const char *cache_path = NULL;
+	const char *bench_spec = NULL;
+	unsigned int bench_count = BENCH_COUNT;
+	struct bench *bench = NULL;
 
-	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:",
+	while ((opt = getopt_long(argc, argv, "+hvs:m:c:b:n:t:d:i:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1048,6 +1512,24 @@ int main(int argc, char *argv[])
 			mtu = (uint16_t)arg;
 			break;
 		}
+		case 'c':
+			cache_path = optarg;
+			break;
+		case 'b':
+			bench_spec = optarg;
+			break;
+		case 'n': {
+			int arg;
+
+			arg = atoi(optarg);
+			if (arg <= 0) {
+				fprintf(stderr, "Invalid count: %d\n", arg);
+				return EXIT_FAILURE;
+			}
+
+			bench_count = arg;
+			break;
+		}
 		case 't':
 			if (strcmp(optarg, "random") == 0)
 				dst_type = BDADDR_LE_RANDOM;
@@ -1109,19 +1591,35 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (bench_spec) {
+		bench = bench_new(bench_spec, bench_count);
+		if (!bench)
+			return EXIT_FAILURE;
+	}
+
 	mainloop_init();
 
 	fd = l2cap_le_att_connect(&src_addr, &dst_addr, dst_type, sec);
-	if (fd < 0)
+	if (fd < 0) {
+		bench_free(bench);
 		return EXIT_FAILURE;
+	}
+
+	if (bench)
+		bench->start = bench_now();
 
-	cli = client_create(fd, mtu);
+	cli = client_create(fd, mtu, cache_path);
 	if (!cli) {
 		close(fd);
+		bench_free(bench);
 		return EXIT_FAILURE;
 	}
 
-	if (mainloop_add_fd(fileno(stdin),
+	/* Benchmarks run unattended, so there is no console */
+	if (bench) {
+		bench->cli = cli;
+		cli->bench = bench;
+	} else if (mainloop_add_fd(fileno(stdin),
 				EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
 				prompt_read_cb, cli, NULL) < 0) {
 		fprintf(stderr, "Failed to initialize console\n");
@@ -1134,13 +1632,15 @@ int main(int argc, char *argv[])
 
 	mainloop_set_signal(&mask, signal_cb, NULL, NULL);
 
-	print_prompt();
+	if (!bench)
+		print_prompt();
 
 	mainloop_run();
 
 	printf("\n\nShutting down...\n");
 
 	client_destroy(cli);
+	bench_free(bench);
 
 	return EXIT_SUCCESS;
 }
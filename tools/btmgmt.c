@@ -52,9 +52,12 @@
 static bool monitor = false;
 static bool discovery = false;
 static bool resolve_names = true;
+static bool scanning = false;
 
 static int pending = 0;
 
+static void scan_start(void);
+
 static void controller_error(uint16_t index, uint16_t len,
 				const void *param, void *user_data)
 {
@@ -191,6 +194,12 @@ static void discovering(uint16_t index, uint16_t len, const void *param,
 		return;
 	}
 
+	/* The kernel ends discovery after a while so keep restarting it */
+	if (ev->discovering == 0 && scanning) {
+		scan_start();
+		return;
+	}
+
 	if (monitor)
 		printf("hci%u type %u discovering %s\n", index,
 				ev->type, ev->discovering ? "on" : "off");
@@ -417,6 +426,180 @@ static unsigned int eir_get_flags(const uint8_t *eir, uint16_t eir_len)
 	return 0;
 }
 
+#define SCAN_HASH_SIZE 1024
+
+struct scan_dev {
+	struct mgmt_addr_info addr;
+	char *name;
+	uint32_t count;
+	uint32_t period_count;
+	uint32_t changes;
+	uint32_t eir_hash;
+	int64_t rssi_sum;
+	int8_t rssi_min;
+	int8_t rssi_max;
+	struct scan_dev *next;
+};
+
+static struct scan_dev *scan_table[SCAN_HASH_SIZE];
+static struct mgmt *scan_mgmt = NULL;
+static uint16_t scan_index;
+static uint8_t scan_type;
+static unsigned int scan_period = 5;
+static unsigned int scan_top = 10;
+static unsigned int scan_devices;
+static unsigned int scan_new_devices;
+static unsigned long scan_reports;
+static unsigned long scan_period_reports;
+
+static unsigned int scan_hash(const struct mgmt_addr_info *addr)
+{
+	const uint8_t *b = addr->bdaddr.b;
+
+	return (b[0] | b[1] << 8 | b[2] << 16) % SCAN_HASH_SIZE;
+}
+
+static uint32_t eir_hash(const uint8_t *eir, uint16_t eir_len)
+{
+	uint32_t hash = 2166136261u;
+	uint16_t i;
+
+	for (i = 0; i < eir_len; i++) {
+		hash ^= eir[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static void scan_report(const struct mgmt_ev_device_found *ev,
+							uint16_t eir_len)
+{
+	unsigned int h = scan_hash(&ev->addr);
+	struct scan_dev *dev;
+	uint32_t hash;
+
+	scan_reports++;
+	scan_period_reports++;
+
+	for (dev = scan_table[h]; dev; dev = dev->next) {
+		if (dev->addr.type == ev->addr.type &&
+				!bacmp(&dev->addr.bdaddr, &ev->addr.bdaddr))
+			break;
+	}
+
+	hash = eir_hash(ev->eir, eir_len);
+
+	if (!dev) {
+		dev = new0(struct scan_dev, 1);
+		if (!dev)
+			return;
+
+		memcpy(&dev->addr, &ev->addr, sizeof(dev->addr));
+		dev->rssi_min = ev->rssi;
+		dev->rssi_max = ev->rssi;
+		dev->eir_hash = hash;
+		dev->next = scan_table[h];
+		scan_table[h] = dev;
+
+		scan_devices++;
+		scan_new_devices++;
+	} else if (dev->eir_hash != hash) {
+		dev->eir_hash = hash;
+		dev->changes++;
+	}
+
+	if (!dev->name)
+		dev->name = eir_get_name(ev->eir, eir_len);
+
+	dev->count++;
+	dev->period_count++;
+	dev->rssi_sum += ev->rssi;
+
+	if (ev->rssi < dev->rssi_min)
+		dev->rssi_min = ev->rssi;
+
+	if (ev->rssi > dev->rssi_max)
+		dev->rssi_max = ev->rssi;
+}
+
+static int scan_dev_cmp(const void *a, const void *b)
+{
+	const struct scan_dev *da = *(const struct scan_dev **) a;
+	const struct scan_dev *db = *(const struct scan_dev **) b;
+
+	if (da->period_count != db->period_count)
+		return da->period_count < db->period_count ? 1 : -1;
+
+	return da->count < db->count ? 1 : da->count > db->count ? -1 : 0;
+}
+
+static void scan_summary(unsigned int seconds)
+{
+	struct scan_dev **list;
+	unsigned int i, n = 0;
+
+	printf("%lu reports (%lu/s), %u devices (%u new)\n",
+				scan_period_reports,
+				seconds ? scan_period_reports / seconds : 0,
+				scan_devices, scan_new_devices);
+
+	list = new0(struct scan_dev *, scan_devices);
+	if (!list)
+		goto done;
+
+	for (i = 0; i < SCAN_HASH_SIZE; i++) {
+		struct scan_dev *dev;
+
+		for (dev = scan_table[i]; dev; dev = dev->next)
+			list[n++] = dev;
+	}
+
+	qsort(list, n, sizeof(*list), scan_dev_cmp);
+
+	for (i = 0; i < n && i < scan_top; i++) {
+		struct scan_dev *dev = list[i];
+		char addr[18];
+
+		ba2str(&dev->addr.bdaddr, addr);
+		printf("  %s type %-10s %6u (%6u total) rssi %4d/%4d/%4d "
+			"changes %u %s\n", addr, typestr(dev->addr.type),
+			dev->period_count, dev->count, dev->rssi_min,
+			(int) (dev->rssi_sum / dev->count), dev->rssi_max,
+			dev->changes, dev->name ? dev->name : "");
+	}
+
+	free(list);
+
+done:
+	for (i = 0; i < SCAN_HASH_SIZE; i++) {
+		struct scan_dev *dev;
+
+		for (dev = scan_table[i]; dev; dev = dev->next)
+			dev->period_count = 0;
+	}
+
+	scan_period_reports = 0;
+	scan_new_devices = 0;
+}
+
+static void scan_cleanup(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < SCAN_HASH_SIZE; i++) {
+		while (scan_table[i]) {
+			struct scan_dev *dev = scan_table[i];
+
+			scan_table[i] = dev->next;
+			free(dev->name);
+			free(dev);
+		}
+	}
+
+	scan_devices = 0;
+}
+
 static void device_found(uint16_t index, uint16_t len, const void *param,
 							void *user_data)
 {
@@ -440,6 +623,11 @@ static void device_found(uint16_t index, uint16_t len, const void *param,
 		return;
 	}
 
+	if (scanning) {
+		scan_report(ev, eir_len);
+		return;
+	}
+
 	if (monitor || discovery) {
 		char addr[18], *name;
 
@@ -1621,6 +1809,134 @@ static void cmd_find(struct mgmt *mgmt, uint16_t index, int argc, char **argv)
 	}
 }
 
+static void scan_rsp(uint8_t status, uint16_t len, const void *param,
+							void *user_data)
+{
+	if (status == 0 || !scanning)
+		return;
+
+	fprintf(stderr, "Unable to start scanning. status 0x%02x (%s)\n",
+						status, mgmt_errstr(status));
+	mainloop_quit();
+}
+
+static void scan_start(void)
+{
+	struct mgmt_cp_start_discovery cp;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.type = scan_type;
+
+	if (mgmt_send(scan_mgmt, MGMT_OP_START_DISCOVERY, scan_index,
+				sizeof(cp), &cp, scan_rsp, NULL, NULL) == 0) {
+		fprintf(stderr, "Unable to send start_discovery cmd\n");
+		mainloop_quit();
+	}
+}
+
+static void scan_stop_rsp(uint8_t status, uint16_t len, const void *param,
+							void *user_data)
+{
+	mainloop_quit();
+}
+
+static void scan_period_timeout(int id, void *user_data)
+{
+	scan_summary(scan_period);
+
+	mainloop_modify_timeout(id, scan_period * 1000);
+}
+
+static void scan_end_timeout(int id, void *user_data)
+{
+	struct mgmt_cp_stop_discovery cp;
+
+	mainloop_remove_timeout(id);
+
+	scanning = false;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.type = scan_type;
+
+	if (mgmt_send(scan_mgmt, MGMT_OP_STOP_DISCOVERY, scan_index,
+				sizeof(cp), &cp, scan_stop_rsp, NULL, NULL) == 0)
+		mainloop_quit();
+}
+
+static void scan_usage(void)
+{
+	printf("Usage: btmgmt scan [-l|-b] [-p seconds] [-n count] "
+							"[-t seconds]\n");
+}
+
+static struct option scan_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "le-only",	0, 0, 'l' },
+	{ "bredr-only",	0, 0, 'b' },
+	{ "period",	1, 0, 'p' },
+	{ "top",	1, 0, 'n' },
+	{ "timeout",	1, 0, 't' },
+	{ 0, 0, 0, 0 }
+};
+
+static void cmd_scan(struct mgmt *mgmt, uint16_t index, int argc, char **argv)
+{
+	unsigned int timeout = 0;
+	int opt;
+
+	if (index == MGMT_INDEX_NONE)
+		index = 0;
+
+	scan_type = 0;
+	hci_set_bit(BDADDR_LE_PUBLIC, &scan_type);
+	hci_set_bit(BDADDR_LE_RANDOM, &scan_type);
+
+	while ((opt = getopt_long(argc, argv, "+lbp:n:t:h", scan_options,
+								NULL)) != -1) {
+		switch (opt) {
+		case 'l':
+			break;
+		case 'b':
+			scan_type = 0;
+			hci_set_bit(BDADDR_BREDR, &scan_type);
+			break;
+		case 'p':
+			scan_period = atoi(optarg);
+			break;
+		case 'n':
+			scan_top = atoi(optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			scan_usage();
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+	optind = 0;
+
+	if (!scan_period)
+		scan_period = 1;
+
+	scan_mgmt = mgmt;
+	scan_index = index;
+	scanning = true;
+
+	scan_start();
+
+	mainloop_add_timeout(scan_period * 1000, scan_period_timeout,
+								NULL, NULL);
+
+	if (timeout)
+		mainloop_add_timeout(timeout * 1000, scan_end_timeout,
+								NULL, NULL);
+}
+
 static void name_rsp(uint8_t status, uint16_t len, const void *param,
 							void *user_data)
 {
@@ -2866,6 +3182,7 @@ static struct {
 	{ "disconnect", cmd_disconnect, "Disconnect device"		},
 	{ "con",	cmd_con,	"List connections"		},
 	{ "find",	cmd_find,	"Discover nearby devices"	},
+	{ "scan",	cmd_scan,	"Aggregate nearby device reports" },
 	{ "name",	cmd_name,	"Set local name"		},
 	{ "pair",	cmd_pair,	"Pair with a remote device"	},
 	{ "cancelpair",	cmd_cancel_pair,"Cancel pairing"		},
@@ -3022,6 +3339,11 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run();
 
+	if (scan_mgmt) {
+		scan_summary(0);
+		scan_cleanup();
+	}
+
 	mgmt_cancel_all(mgmt);
 	mgmt_unregister_all(mgmt);
 	mgmt_unref(mgmt);
@@ -35,13 +35,17 @@
 #include <string.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <termios.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "src/shared/util.h"
 #include "monitor/mainloop.h"
@@ -64,18 +68,29 @@ static void hexdump_print(const char *str, void *user_data)
 	printf("%s%s\n", (char *) user_data, str);
 }
 
+/* Largest frame a packet based descriptor hands out in one read */
+#define MAX_FRAME_SIZE	(1 + 4 + 1024)
+
 struct proxy {
 	/* Receive commands, ACL and SCO data */
 	int host_fd;
-	uint8_t host_buf[4096];
+	uint8_t host_buf[16384];
 	uint16_t host_len;
 	bool host_shutdown;
+	bool host_stream;
+	uint64_t host_packets;
+	uint64_t host_bytes;
 
 	/* Receive events, ACL and SCO data */
 	int dev_fd;
-	uint8_t dev_buf[4096];
+	uint8_t dev_buf[16384];
 	uint16_t dev_len;
 	bool dev_shutdown;
+	bool dev_stream;
+	uint64_t dev_packets;
+	uint64_t dev_bytes;
+
+	struct timespec start;
 };
 
 static bool write_packet(int fd, const void *data, size_t size,
@@ -102,6 +117,86 @@ static bool write_packet(int fd, const void *data, size_t size,
 	return true;
 }
 
+/*
+ * Read everything that is pending. Stream sockets return it with one
+ * read, while packet based descriptors (user channel and vhci) return
+ * one packet per read, so those are drained until they run dry or the
+ * buffer can no longer hold a whole packet.
+ */
+static ssize_t read_packets(int fd, bool stream, uint8_t *buf, size_t size)
+{
+	ssize_t len, total = 0;
+
+	do {
+		len = read(fd, buf + total, size - total);
+		if (len < 0) {
+			if (total > 0 && (errno == EAGAIN || errno == EINTR))
+				break;
+			return total > 0 ? total : -1;
+		}
+
+		if (len == 0)
+			break;
+
+		total += len;
+	} while (!stream && size - total >= MAX_FRAME_SIZE);
+
+	return total;
+}
+
+/*
+ * Forward the complete frames at the start of buf. Stream destinations
+ * get them all with a single write, packet based ones one frame per
+ * write as they expect. Returns the number of bytes consumed.
+ */
+static ssize_t forward_packets(int fd, bool stream, const uint8_t *buf,
+					const uint16_t *frames, unsigned int count,
+					const char *prefix)
+{
+	unsigned int i;
+	size_t offset = 0;
+
+	if (stream) {
+		for (i = 0; i < count; i++)
+			offset += frames[i];
+
+		if (offset && !write_packet(fd, buf, offset, (void *) prefix))
+			return -1;
+
+		return offset;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!write_packet(fd, buf + offset, frames[i],
+							(void *) prefix))
+			return -1;
+
+		offset += frames[i];
+	}
+
+	return offset;
+}
+
+static void print_throughput(struct proxy *proxy)
+{
+	struct timespec now;
+	uint64_t msec;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	msec = (now.tv_sec - proxy->start.tv_sec) * 1000 +
+			(now.tv_nsec - proxy->start.tv_nsec) / 1000000;
+	if (!msec)
+		msec = 1;
+
+	printf("Host to device: %" PRIu64 " packets, %" PRIu64 " bytes "
+				"(%" PRIu64 " kB/s)\n", proxy->host_packets,
+				proxy->host_bytes, proxy->host_bytes / msec);
+	printf("Device to host: %" PRIu64 " packets, %" PRIu64 " bytes "
+				"(%" PRIu64 " kB/s)\n", proxy->dev_packets,
+				proxy->dev_bytes, proxy->dev_bytes / msec);
+}
+
 static void host_read_destroy(void *user_data)
 {
 	struct proxy *proxy = user_data;
@@ -115,6 +210,7 @@ static void host_read_destroy(void *user_data)
 	proxy->host_fd = -1;
 
 	if (proxy->dev_fd < 0) {
+		print_throughput(proxy);
 		client_active = false;
 		free(proxy);
 	} else
@@ -127,6 +223,9 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 	struct bt_hci_cmd_hdr *cmd_hdr;
 	struct bt_hci_acl_hdr *acl_hdr;
 	struct bt_hci_sco_hdr *sco_hdr;
+	uint16_t frames[sizeof(proxy->host_buf) / 4];
+	unsigned int count = 0;
+	uint16_t offset = 0;
 	ssize_t len;
 	uint16_t pktlen;
 
@@ -142,7 +241,8 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	len = read(proxy->host_fd, proxy->host_buf + proxy->host_len,
+	len = read_packets(proxy->host_fd, proxy->host_stream,
+				proxy->host_buf + proxy->host_len,
 				sizeof(proxy->host_buf) - proxy->host_len);
 	if (len < 0) {
 		if (errno == EAGAIN || errno == EINTR)
@@ -158,61 +258,68 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 						hexdump_print, "H: ");
 
 	proxy->host_len += len;
+	proxy->host_bytes += len;
 
-process_packet:
-	if (proxy->host_len < 1)
-		return;
+	while (offset < proxy->host_len) {
+		const uint8_t *pkt = proxy->host_buf + offset;
+		uint16_t avail = proxy->host_len - offset;
 
-	switch (proxy->host_buf[0]) {
-	case BT_H4_CMD_PKT:
-		if (proxy->host_len < 1 + sizeof(*cmd_hdr))
-			return;
+		switch (pkt[0]) {
+		case BT_H4_CMD_PKT:
+			if (avail < 1 + sizeof(*cmd_hdr))
+				goto done;
 
-		cmd_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->host_len < 1 + sizeof(*acl_hdr))
-			return;
+			cmd_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
+			break;
+		case BT_H4_ACL_PKT:
+			if (avail < 1 + sizeof(*acl_hdr))
+				goto done;
 
-		acl_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->host_len < 1 + sizeof(*sco_hdr))
+			acl_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*acl_hdr) +
+						cpu_to_le16(acl_hdr->dlen);
+			break;
+		case BT_H4_SCO_PKT:
+			if (avail < 1 + sizeof(*sco_hdr))
+				goto done;
+
+			sco_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
+			break;
+		case 0xff:
+			/* Notification packet from /dev/vhci - ignore */
+			proxy->host_len = offset;
+			goto done;
+		default:
+			fprintf(stderr, "Received unknown host packet type "
+						"0x%02x\n", pkt[0]);
+			mainloop_remove_fd(proxy->host_fd);
 			return;
+		}
 
-		sco_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	case 0xff:
-		/* Notification packet from /dev/vhci - ignore */
-		proxy->host_len = 0;
-		return;
-	default:
-		fprintf(stderr, "Received unknown host packet type 0x%02x\n",
-							proxy->host_buf[0]);
-		mainloop_remove_fd(proxy->host_fd);
-		return;
-	}
+		if (avail < pktlen)
+			break;
 
-	if (proxy->host_len < pktlen)
-		return;
+		frames[count++] = pktlen;
+		offset += pktlen;
+	}
 
-	if (!write_packet(proxy->dev_fd, proxy->host_buf, pktlen, "D: ")) {
+done:
+	if (forward_packets(proxy->dev_fd, proxy->dev_stream, proxy->host_buf,
+						frames, count, "D: ") < 0) {
 		fprintf(stderr, "Write to device descriptor failed\n");
 		mainloop_remove_fd(proxy->dev_fd);
 		return;
 	}
 
-	if (proxy->host_len > pktlen) {
-		memmove(proxy->host_buf, proxy->host_buf + pktlen,
-						proxy->host_len - pktlen);
-		proxy->host_len -= pktlen;
-		goto process_packet;
-	}
+	proxy->host_packets += count;
 
-	proxy->host_len = 0;
+	if (proxy->host_len > offset)
+		memmove(proxy->host_buf, proxy->host_buf + offset,
+						proxy->host_len - offset);
+
+	proxy->host_len -= offset;
 }
 
 static void dev_read_destroy(void *user_data)
@@ -228,6 +335,7 @@ static void dev_read_destroy(void *user_data)
 	proxy->dev_fd = -1;
 
 	if (proxy->host_fd < 0) {
+		print_throughput(proxy);
 		client_active = false;
 		free(proxy);
 	} else
@@ -240,6 +348,9 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 	struct bt_hci_evt_hdr *evt_hdr;
 	struct bt_hci_acl_hdr *acl_hdr;
 	struct bt_hci_sco_hdr *sco_hdr;
+	uint16_t frames[sizeof(proxy->dev_buf) / 3];
+	unsigned int count = 0;
+	uint16_t offset = 0;
 	ssize_t len;
 	uint16_t pktlen;
 
@@ -255,7 +366,8 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	len = read(proxy->dev_fd, proxy->dev_buf + proxy->dev_len,
+	len = read_packets(proxy->dev_fd, proxy->dev_stream,
+				proxy->dev_buf + proxy->dev_len,
 				sizeof(proxy->dev_buf) - proxy->dev_len);
 	if (len < 0) {
 		if (errno == EAGAIN || errno == EINTR)
@@ -271,57 +383,72 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 						hexdump_print, "D: ");
 
 	proxy->dev_len += len;
+	proxy->dev_bytes += len;
 
-process_packet:
-	if (proxy->dev_len < 1)
-		return;
+	while (offset < proxy->dev_len) {
+		const uint8_t *pkt = proxy->dev_buf + offset;
+		uint16_t avail = proxy->dev_len - offset;
 
-	switch (proxy->dev_buf[0]) {
-	case BT_H4_EVT_PKT:
-		if (proxy->dev_len < 1 + sizeof(*evt_hdr))
-			return;
+		switch (pkt[0]) {
+		case BT_H4_EVT_PKT:
+			if (avail < 1 + sizeof(*evt_hdr))
+				goto done;
 
-		evt_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*evt_hdr) + evt_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->dev_len < 1 + sizeof(*acl_hdr))
-			return;
+			evt_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*evt_hdr) + evt_hdr->plen;
+			break;
+		case BT_H4_ACL_PKT:
+			if (avail < 1 + sizeof(*acl_hdr))
+				goto done;
 
-		acl_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->dev_len < 1 + sizeof(*sco_hdr))
+			acl_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*acl_hdr) +
+						cpu_to_le16(acl_hdr->dlen);
+			break;
+		case BT_H4_SCO_PKT:
+			if (avail < 1 + sizeof(*sco_hdr))
+				goto done;
+
+			sco_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
+			break;
+		default:
+			fprintf(stderr, "Received unknown device packet type "
+						"0x%02x\n", pkt[0]);
+			mainloop_remove_fd(proxy->dev_fd);
 			return;
+		}
 
-		sco_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	default:
-		fprintf(stderr, "Received unknown device packet type 0x%02x\n",
-							proxy->dev_buf[0]);
-		mainloop_remove_fd(proxy->dev_fd);
-		return;
-	}
+		if (avail < pktlen)
+			break;
 
-	if (proxy->dev_len < pktlen)
-		return;
+		frames[count++] = pktlen;
+		offset += pktlen;
+	}
 
-	if (!write_packet(proxy->host_fd, proxy->dev_buf, pktlen, "H: ")) {
+done:
+	if (forward_packets(proxy->host_fd, proxy->host_stream, proxy->dev_buf,
+						frames, count, "H: ") < 0) {
 		fprintf(stderr, "Write to host descriptor failed\n");
 		mainloop_remove_fd(proxy->host_fd);
 		return;
 	}
 
-	if (proxy->dev_len > pktlen) {
-		memmove(proxy->dev_buf, proxy->dev_buf + pktlen,
-						proxy->dev_len - pktlen);
-		proxy->dev_len -= pktlen;
-		goto process_packet;
-	}
+	proxy->dev_packets += count;
+
+	if (proxy->dev_len > offset)
+		memmove(proxy->dev_buf, proxy->dev_buf + offset,
+						proxy->dev_len - offset);
 
-	proxy->dev_len = 0;
+	proxy->dev_len -= offset;
+}
+
+static void set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags >= 0)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
 static bool setup_proxy(int host_fd, bool host_shutdown,
@@ -333,11 +460,23 @@ static bool setup_proxy(int host_fd, bool host_shutdown,
 	if (!proxy)
 		return NULL;
 
+	/* The side that gets shut down is always the socket stream */
 	proxy->host_fd = host_fd;
 	proxy->host_shutdown = host_shutdown;
+	proxy->host_stream = host_shutdown;
 
 	proxy->dev_fd = dev_fd;
 	proxy->dev_shutdown = dev_shutdown;
+	proxy->dev_stream = dev_shutdown;
+
+	/* Packet descriptors are drained until they would block */
+	if (!proxy->host_stream)
+		set_nonblock(proxy->host_fd);
+
+	if (!proxy->dev_stream)
+		set_nonblock(proxy->dev_fd);
+
+	clock_gettime(CLOCK_MONOTONIC, &proxy->start);
 
 	mainloop_add_fd(proxy->host_fd, EPOLLIN | EPOLLRDHUP,
 				host_read_callback, proxy, host_read_destroy);
@@ -348,6 +487,18 @@ static bool setup_proxy(int host_fd, bool host_shutdown,
 	return true;
 }
 
+/*
+ * Every read wakeup already leaves as a single write, so waiting for
+ * more data in Nagle's algorithm only adds latency to HCI traffic.
+ */
+static void set_nodelay(int fd)
+{
+	int opt = 1;
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0)
+		perror("Failed to disable Nagle algorithm");
+}
+
 static int open_channel(uint16_t index)
 {
 	struct sockaddr_hci addr;
@@ -410,6 +561,9 @@ static void server_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
+	if (addr.common.sa_family == AF_INET)
+		set_nodelay(host_fd);
+
 	dev_fd = open_channel(hci_index);
 	if (dev_fd < 0) {
 		close(host_fd);
@@ -517,6 +671,8 @@ static int connect_tcp(const char *address, unsigned int port)
 		return -1;
 	}
 
+	set_nodelay(fd);
+
 	return fd;
 }
 
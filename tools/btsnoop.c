@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 
 #include "src/shared/btsnoop.h"
+#include "src/shared/pcap.h"
 
 struct btsnoop_hdr {
 	uint8_t		id[8];		/* Identification Pattern */
@@ -271,6 +272,62 @@ close_input:
 		close(input_fd[i]);
 }
 
+static void command_pcapng(const char *output, const char *input)
+{
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct btsnoop *btsnoop;
+	struct pcap *pcap;
+	struct timeval tv;
+	uint16_t index, opcode, pktlen;
+	unsigned long count = 0;
+
+	btsnoop = btsnoop_open(input, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop) {
+		fprintf(stderr, "failed to open input file\n");
+		return;
+	}
+
+	switch (btsnoop_get_type(btsnoop)) {
+	case BTSNOOP_TYPE_HCI:
+	case BTSNOOP_TYPE_UART:
+	case BTSNOOP_TYPE_MONITOR:
+		break;
+	default:
+		fprintf(stderr, "unsupported link data type %u\n",
+						btsnoop_get_type(btsnoop));
+		goto close_input;
+	}
+
+	pcap = pcap_create_ng(output);
+	if (!pcap) {
+		perror("failed to create output file");
+		goto close_input;
+	}
+
+	while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode,
+							buf, &pktlen)) {
+		if (opcode == 0xffff)
+			continue;
+
+		if (!pcap_write_hci(pcap, &tv, index, opcode, buf, pktlen)) {
+			fprintf(stderr, "write of packet failed\n");
+			break;
+		}
+
+		count++;
+	}
+
+	if (!pcap_flush(pcap))
+		fprintf(stderr, "write of output file failed\n");
+
+	printf("Converted %lu packets\n", count);
+
+	pcap_unref(pcap);
+
+close_input:
+	btsnoop_unref(btsnoop);
+}
+
 static void command_extract_eir(const char *input)
 {
 	struct btsnoop_pkt pkt;
@@ -517,19 +574,21 @@ static void usage(void)
 	printf("commands:\n"
 		"\t-m, --merge <output>   Merge multiple btsnoop files\n"
 		"\t-e, --extract <input>  Extract data from btsnoop file\n"
+		"\t-p, --pcapng <output>  Convert btsnoop file to pcapng\n"
 		"\t-h, --help             Show help options\n");
 }
 
 static const struct option main_options[] = {
 	{ "merge",   required_argument, NULL, 'm' },
 	{ "extract", required_argument, NULL, 'e' },
+	{ "pcapng",  required_argument, NULL, 'p' },
 	{ "type",    required_argument, NULL, 't' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
 };
 
-enum { INVALID, MERGE, EXTRACT };
+enum { INVALID, MERGE, EXTRACT, PCAPNG };
 
 int main(int argc, char *argv[])
 {
@@ -541,7 +600,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "m:e:t:vh", main_options, NULL);
+		opt = getopt_long(argc, argv, "m:e:p:t:vh", main_options, NULL);
 		if (opt < 0)
 			break;
 
@@ -554,6 +613,10 @@ int main(int argc, char *argv[])
 			command = EXTRACT;
 			input_path = optarg;
 			break;
+		case 'p':
+			command = PCAPNG;
+			output_path = optarg;
+			break;
 		case 't':
 			type = optarg;
 			break;
@@ -599,6 +662,15 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "extract type not supported\n");
 		break;
 
+	case PCAPNG:
+		if (argc - optind != 1) {
+			fprintf(stderr, "one input file required\n");
+			return EXIT_FAILURE;
+		}
+
+		command_pcapng(output_path, argv[optind]);
+		break;
+
 	default:
 		usage();
 		return EXIT_FAILURE;
@@ -0,0 +1,1357 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+
+#include "monitor/mainloop.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/att-types.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-client.h"
+#include "src/shared/gatt-server.h"
+
+#define ATT_CID			4
+#define ATT_DEFAULT_MTU		23
+
+#define REPLAY_COUNT		10
+#define REPLAY_TIMEOUT		5000
+#define REPLAY_BATCH		32
+
+/*
+ * Allocation accounting. The stack under test uses plain malloc and
+ * friends, so wrapping them is enough to count every allocation made
+ * while a replay iteration is being measured. Sanitizer builds bring
+ * their own allocator and report zero allocations.
+ */
+static bool alloc_counting;
+static uint64_t alloc_count;
+static uint64_t alloc_bytes;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	if (alloc_counting) {
+		alloc_count++;
+		alloc_bytes += size;
+	}
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (alloc_counting) {
+		alloc_count++;
+		alloc_bytes += nmemb * size;
+	}
+
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (alloc_counting) {
+		alloc_count++;
+		alloc_bytes += size;
+	}
+
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static bool verbose = false;
+
+struct pdu {
+	bool rx;		/* Sent by the remote device */
+	uint16_t len;
+	uint8_t data[0];
+};
+
+struct reassembly {
+	uint8_t *buf;
+	uint32_t len;
+	uint32_t expect;
+};
+
+struct conn {
+	uint16_t index;
+	uint16_t handle;
+	bool open;
+	struct reassembly reasm[2];
+	struct pdu **pdus;
+	unsigned int num_pdus;
+	unsigned int max_pdus;
+};
+
+struct exchange {
+	const struct pdu *req;
+	const struct pdu *rsp;
+};
+
+struct attr {
+	uint8_t type;
+	bt_uuid_t uuid;
+	uint16_t end_handle;
+	uint8_t props;
+	uint8_t *value;
+	uint16_t value_len;
+};
+
+#define ATTR_DESC	0
+#define ATTR_SERVICE	1
+#define ATTR_SECONDARY	2
+#define ATTR_CHRC	3
+
+struct replay {
+	struct conn *conn;
+	unsigned int id;
+
+	/* The traced device was the GATT client, the peer plays the server */
+	bool client;
+	uint16_t mtu;
+
+	/* Client scenarios: recorded request/response pairs */
+	struct exchange *exchanges;
+	unsigned int num_exchanges;
+	unsigned int cursor;
+
+	/* Client: notifications and indications, server: requests */
+	const struct pdu **stream;
+	unsigned int num_stream;
+
+	/* Server scenarios: recorded response to each request in stream */
+	const struct pdu **expect;
+
+	/* Server scenarios: database rebuilt from the trace */
+	struct attr **attrs;
+	struct gatt_db *db;
+
+	/* Per iteration state */
+	int fd[2];
+	struct bt_att *att;
+	struct bt_gatt_client *gatt;
+	struct bt_gatt_server *server;
+	unsigned int sent;
+	unsigned int delivered;
+	bool ready;
+	bool waiting;
+	const struct pdu *expected;
+	bool finished;
+	int watchdog;
+	uint64_t wall_start;
+	uint64_t cpu_start;
+	uint64_t allocs_start;
+	uint64_t bytes_start;
+
+	/* Totals */
+	unsigned int count;
+	unsigned int iter;
+	unsigned int errors;
+	unsigned int unmatched;
+	uint64_t wall_total;
+	uint64_t wall_min;
+	uint64_t cpu_total;
+	uint64_t allocs_total;
+	uint64_t bytes_total;
+};
+
+static struct queue *conn_list;
+static struct queue *replay_list;
+static struct replay *current;
+
+static unsigned int replay_count = REPLAY_COUNT;
+static int replay_handle = -1;
+static int replay_role = -1;
+static unsigned int replay_id;
+
+static uint64_t clock_us(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void att_debug(const char *str, void *user_data)
+{
+	const char *prefix = user_data;
+
+	printf("%s%s\n", prefix, str);
+}
+
+static bool match_open_conn(const void *data, const void *match_data)
+{
+	const struct conn *conn = data;
+	const uint32_t *key = match_data;
+
+	return conn->open && ((uint32_t) conn->index << 16 | conn->handle) ==
+									*key;
+}
+
+static struct conn *get_conn(uint16_t index, uint16_t handle, bool create)
+{
+	struct conn *conn;
+	uint32_t key = (uint32_t) index << 16 | handle;
+
+	conn = queue_find(conn_list, match_open_conn, &key);
+	if (conn || !create)
+		return conn;
+
+	conn = new0(struct conn, 1);
+	if (!conn)
+		return NULL;
+
+	conn->index = index;
+	conn->handle = handle;
+	conn->open = true;
+
+	queue_push_tail(conn_list, conn);
+
+	return conn;
+}
+
+static void conn_free(void *data)
+{
+	struct conn *conn = data;
+
+	free(conn->reasm[0].buf);
+	free(conn->reasm[1].buf);
+
+	while (conn->num_pdus)
+		free(conn->pdus[--conn->num_pdus]);
+
+	free(conn->pdus);
+	free(conn);
+}
+
+static void add_pdu(struct conn *conn, bool rx, const uint8_t *data,
+								uint16_t len)
+{
+	struct pdu *pdu;
+
+	if (conn->num_pdus == conn->max_pdus) {
+		unsigned int max = conn->max_pdus ? conn->max_pdus * 2 : 64;
+		struct pdu **pdus;
+
+		pdus = realloc(conn->pdus, max * sizeof(*pdus));
+		if (!pdus)
+			return;
+
+		conn->pdus = pdus;
+		conn->max_pdus = max;
+	}
+
+	pdu = malloc(sizeof(*pdu) + len);
+	if (!pdu)
+		return;
+
+	pdu->rx = rx;
+	pdu->len = len;
+	memcpy(pdu->data, data, len);
+
+	conn->pdus[conn->num_pdus++] = pdu;
+}
+
+static void process_acl(uint16_t index, bool rx, const uint8_t *data,
+								uint16_t size)
+{
+	struct reassembly *r;
+	struct conn *conn;
+	uint16_t handle, dlen;
+	uint8_t flags;
+
+	if (size < 4)
+		return;
+
+	handle = get_le16(data);
+	flags = (handle >> 12) & 0x03;
+	handle &= 0x0fff;
+	dlen = get_le16(data + 2);
+
+	data += 4;
+	size -= 4;
+
+	if (dlen > size)
+		return;
+
+	conn = get_conn(index, handle, true);
+	if (!conn)
+		return;
+
+	r = &conn->reasm[rx];
+
+	switch (flags) {
+	case 0x00:
+	case 0x02:
+		r->len = 0;
+		r->expect = 0;
+
+		if (dlen < 4)
+			return;
+
+		r->expect = get_le16(data) + 4;
+
+		if (!r->buf) {
+			r->buf = malloc(UINT16_MAX + 4);
+			if (!r->buf) {
+				r->expect = 0;
+				return;
+			}
+		}
+		break;
+	case 0x01:
+		if (!r->expect)
+			return;
+		break;
+	default:
+		return;
+	}
+
+	if (r->len + dlen > r->expect) {
+		r->expect = 0;
+		return;
+	}
+
+	memcpy(r->buf + r->len, data, dlen);
+	r->len += dlen;
+
+	if (r->len < r->expect)
+		return;
+
+	r->expect = 0;
+
+	if (get_le16(r->buf + 2) != ATT_CID || r->len < 5)
+		return;
+
+	add_pdu(conn, rx, r->buf + 4, r->len - 4);
+}
+
+static void process_event(uint16_t index, const uint8_t *data, uint16_t size)
+{
+	struct conn *conn;
+
+	/* Only Disconnection Complete matters, handles get reused */
+	if (size < 6 || data[0] != 0x05 || data[2] != 0x00)
+		return;
+
+	conn = get_conn(index, get_le16(data + 3) & 0x0fff, false);
+	if (conn)
+		conn->open = false;
+}
+
+static bool load_trace(const char *path)
+{
+	struct btsnoop *btsnoop;
+	struct timeval tv;
+	uint16_t index, opcode, size;
+	uint8_t *buf;
+	unsigned int packets = 0;
+
+	btsnoop = btsnoop_open(path, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return false;
+	}
+
+	buf = malloc(BTSNOOP_MAX_PACKET_SIZE);
+	if (!buf) {
+		btsnoop_unref(btsnoop);
+		return false;
+	}
+
+	while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size)) {
+		packets++;
+
+		switch (opcode) {
+		case BTSNOOP_OPCODE_ACL_TX_PKT:
+			process_acl(index, false, buf, size);
+			break;
+		case BTSNOOP_OPCODE_ACL_RX_PKT:
+			process_acl(index, true, buf, size);
+			break;
+		case BTSNOOP_OPCODE_EVENT_PKT:
+			process_event(index, buf, size);
+			break;
+		}
+	}
+
+	free(buf);
+	btsnoop_unref(btsnoop);
+
+	if (verbose)
+		printf("Read %u packets, %u connections\n", packets,
+						queue_length(conn_list));
+
+	return true;
+}
+
+static uint8_t op_type(const struct pdu *pdu)
+{
+	return bt_att_opcode_info[pdu->data[0]].type;
+}
+
+static uint16_t mtu_from_trace(struct conn *conn, uint8_t opcode, bool rx)
+{
+	unsigned int i;
+
+	for (i = 0; i < conn->num_pdus; i++) {
+		const struct pdu *pdu = conn->pdus[i];
+
+		if (pdu->rx != rx || pdu->data[0] != opcode || pdu->len < 3)
+			continue;
+
+		if (get_le16(pdu->data + 1) > ATT_DEFAULT_MTU)
+			return get_le16(pdu->data + 1);
+
+		break;
+	}
+
+	return ATT_DEFAULT_MTU;
+}
+
+static void build_client(struct replay *replay)
+{
+	struct conn *conn = replay->conn;
+	const struct pdu *pending = NULL;
+	unsigned int i;
+
+	replay->exchanges = new0(struct exchange, conn->num_pdus);
+	replay->stream = new0(const struct pdu *, conn->num_pdus);
+
+	for (i = 0; i < conn->num_pdus; i++) {
+		const struct pdu *pdu = conn->pdus[i];
+
+		switch (op_type(pdu)) {
+		case BT_ATT_OP_TYPE_REQ:
+			if (!pdu->rx)
+				pending = pdu;
+			break;
+		case BT_ATT_OP_TYPE_RSP:
+			if (!pdu->rx || !pending)
+				break;
+
+			replay->exchanges[replay->num_exchanges].req = pending;
+			replay->exchanges[replay->num_exchanges].rsp = pdu;
+			replay->num_exchanges++;
+			pending = NULL;
+			break;
+		case BT_ATT_OP_TYPE_NOT:
+		case BT_ATT_OP_TYPE_IND:
+			if (pdu->rx)
+				replay->stream[replay->num_stream++] = pdu;
+			break;
+		}
+	}
+
+	replay->mtu = mtu_from_trace(replay->conn, BT_ATT_OP_MTU_REQ, false);
+}
+
+static struct attr *get_attr(struct replay *replay, uint16_t handle)
+{
+	if (!handle)
+		return NULL;
+
+	if (!replay->attrs[handle])
+		replay->attrs[handle] = new0(struct attr, 1);
+
+	return replay->attrs[handle];
+}
+
+static bool get_uuid(bt_uuid_t *uuid, const uint8_t *data, uint16_t len)
+{
+	uint128_t u128;
+
+	switch (len) {
+	case 2:
+		bt_uuid16_create(uuid, get_le16(data));
+		return true;
+	case 16:
+		bswap_128(data, &u128);
+		bt_uuid128_create(uuid, u128);
+		return true;
+	}
+
+	return false;
+}
+
+static void parse_services(struct replay *replay, const struct pdu *req,
+							const struct pdu *rsp)
+{
+	uint8_t type = ATTR_SERVICE;
+	const uint8_t *ptr;
+	uint16_t len;
+	uint8_t elen;
+
+	if (req->len == 7 && get_le16(req->data + 5) == GATT_SND_SVC_UUID)
+		type = ATTR_SECONDARY;
+
+	if (rsp->len < 2)
+		return;
+
+	elen = rsp->data[1];
+	if (elen != 6 && elen != 20)
+		return;
+
+	for (ptr = rsp->data + 2, len = rsp->len - 2; len >= elen;
+						ptr += elen, len -= elen) {
+		struct attr *attr = get_attr(replay, get_le16(ptr));
+
+		if (!attr)
+			continue;
+
+		attr->type = type;
+		attr->end_handle = get_le16(ptr + 2);
+		get_uuid(&attr->uuid, ptr + 4, elen - 4);
+	}
+}
+
+static void parse_chrcs(struct replay *replay, const struct pdu *req,
+							const struct pdu *rsp)
+{
+	const uint8_t *ptr;
+	uint16_t len;
+	uint8_t elen;
+
+	if (req->len != 7 || get_le16(req->data + 5) != GATT_CHARAC_UUID)
+		return;
+
+	if (rsp->len < 2)
+		return;
+
+	elen = rsp->data[1];
+	if (elen != 7 && elen != 21)
+		return;
+
+	for (ptr = rsp->data + 2, len = rsp->len - 2; len >= elen;
+						ptr += elen, len -= elen) {
+		struct attr *attr = get_attr(replay, get_le16(ptr));
+
+		if (!attr)
+			continue;
+
+		attr->type = ATTR_CHRC;
+		attr->props = ptr[2];
+		get_uuid(&attr->uuid, ptr + 5, elen - 5);
+	}
+}
+
+static void parse_descs(struct replay *replay, const struct pdu *rsp)
+{
+	const uint8_t *ptr;
+	uint16_t len;
+	uint8_t elen;
+
+	if (rsp->len < 2)
+		return;
+
+	elen = rsp->data[1] == 0x01 ? 4 : 18;
+
+	for (ptr = rsp->data + 2, len = rsp->len - 2; len >= elen;
+						ptr += elen, len -= elen) {
+		struct attr *attr = get_attr(replay, get_le16(ptr));
+
+		/* Declarations are known better from the discovery PDUs */
+		if (!attr || attr->type != ATTR_DESC)
+			continue;
+
+		get_uuid(&attr->uuid, ptr + 2, elen - 2);
+	}
+}
+
+static void parse_value(struct replay *replay, const struct pdu *req,
+							const struct pdu *rsp)
+{
+	struct attr *attr;
+
+	if (req->len != 3)
+		return;
+
+	attr = get_attr(replay, get_le16(req->data + 1));
+	if (!attr || attr->value)
+		return;
+
+	attr->value_len = rsp->len - 1;
+	attr->value = malloc(attr->value_len + 1);
+	if (attr->value)
+		memcpy(attr->value, rsp->data + 1, attr->value_len);
+}
+
+static void db_read(struct gatt_db *db, unsigned int id, uint16_t handle,
+					uint16_t offset, uint8_t att_opcode,
+					bdaddr_t *bdaddr, void *user_data)
+{
+	struct replay *replay = user_data;
+	struct attr *attr = replay->attrs[handle];
+
+	if (!attr || offset > attr->value_len) {
+		gatt_db_complete(db, id, BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+		return;
+	}
+
+	gatt_db_complete(db, id, 0, attr->value + offset,
+						attr->value_len - offset);
+}
+
+static void db_write(struct gatt_db *db, unsigned int id, uint16_t handle,
+					uint16_t offset, const uint8_t *value,
+					size_t len, uint8_t att_opcode,
+					bdaddr_t *bdaddr, void *user_data)
+{
+	gatt_db_complete(db, id, 0, NULL, 0);
+}
+
+static void add_service(struct replay *replay, uint16_t handle)
+{
+	struct attr *svc = replay->attrs[handle];
+	uint16_t end = svc->end_handle > handle ? svc->end_handle : handle;
+	uint16_t h, id;
+	bt_uuid_t filler;
+
+	bt_uuid16_create(&filler, GATT_CHARAC_USER_DESC_UUID);
+
+	id = gatt_db_add_service(replay->db, &svc->uuid,
+						svc->type == ATTR_SERVICE,
+						end - handle + 1);
+	if (id != handle) {
+		fprintf(stderr, "Service 0x%04x could not be rebuilt\n",
+								handle);
+		if (id)
+			gatt_db_remove_service(replay->db, id);
+		return;
+	}
+
+	/*
+	 * Anything not seen during discovery, included services among them,
+	 * becomes a filler descriptor so the following handles still line up.
+	 */
+	for (h = handle + 1; h && h <= end; h++) {
+		struct attr *attr = replay->attrs[h];
+		const bt_uuid_t *uuid = &filler;
+
+		if (attr && attr->type == ATTR_CHRC && h < end) {
+			id = gatt_db_add_characteristic(replay->db, handle,
+						&attr->uuid, 0, attr->props,
+						NULL, NULL, NULL);
+			h++;
+		} else {
+			if (attr && attr->type == ATTR_DESC &&
+					attr->uuid.type != BT_UUID_UNSPEC)
+				uuid = &attr->uuid;
+
+			id = gatt_db_add_char_descriptor(replay->db, handle,
+						uuid, 0, NULL, NULL, NULL);
+		}
+
+		if (!id)
+			break;
+
+		gatt_db_set_async(replay->db, id, db_read, db_write, replay);
+	}
+
+	gatt_db_service_set_active(replay->db, handle, true);
+}
+
+static void build_server(struct replay *replay)
+{
+	struct conn *conn = replay->conn;
+	const struct pdu *pending = NULL;
+	struct queue *fillers;
+	uint16_t next = 1;
+	unsigned int i, h;
+	bt_uuid_t filler;
+
+	replay->stream = new0(const struct pdu *, conn->num_pdus);
+	replay->expect = new0(const struct pdu *, conn->num_pdus);
+	replay->attrs = new0(struct attr *, UINT16_MAX + 1);
+
+	for (i = 0; i < conn->num_pdus; i++) {
+		const struct pdu *pdu = conn->pdus[i];
+
+		switch (op_type(pdu)) {
+		case BT_ATT_OP_TYPE_REQ:
+		case BT_ATT_OP_TYPE_CMD:
+			if (!pdu->rx)
+				break;
+
+			replay->stream[replay->num_stream++] = pdu;
+			pending = op_type(pdu) == BT_ATT_OP_TYPE_REQ ?
+								pdu : NULL;
+			break;
+		case BT_ATT_OP_TYPE_RSP:
+			if (pdu->rx || !pending)
+				break;
+
+			replay->expect[replay->num_stream - 1] = pdu;
+
+			switch (pdu->data[0]) {
+			case BT_ATT_OP_READ_BY_GRP_TYPE_RSP:
+				parse_services(replay, pending, pdu);
+				break;
+			case BT_ATT_OP_READ_BY_TYPE_RSP:
+				parse_chrcs(replay, pending, pdu);
+				break;
+			case BT_ATT_OP_FIND_INFO_RSP:
+				parse_descs(replay, pdu);
+				break;
+			case BT_ATT_OP_READ_RSP:
+				parse_value(replay, pending, pdu);
+				break;
+			}
+
+			pending = NULL;
+			break;
+		}
+	}
+
+	replay->mtu = mtu_from_trace(replay->conn, BT_ATT_OP_MTU_RSP, false);
+
+	/*
+	 * Services are added in handle order. Gaps are plugged with filler
+	 * services so that gatt_db hands out the recorded handles, and the
+	 * fillers are removed again once everything is in place.
+	 */
+	replay->db = gatt_db_new();
+	fillers = queue_new();
+	bt_uuid16_create(&filler, 0xffff);
+
+	for (h = 1; h <= UINT16_MAX; h++) {
+		struct attr *attr = replay->attrs[h];
+		uint16_t id;
+
+		if (!attr || (attr->type != ATTR_SERVICE &&
+					attr->type != ATTR_SECONDARY))
+			continue;
+
+		if (h < next)
+			continue;
+
+		if (h > next) {
+			id = gatt_db_add_service(replay->db, &filler, true,
+								h - next);
+			if (id)
+				queue_push_tail(fillers, UINT_TO_PTR(id));
+		}
+
+		add_service(replay, h);
+
+		if (attr->end_handle >= UINT16_MAX)
+			break;
+
+		next = (attr->end_handle > h ? attr->end_handle : h) + 1;
+	}
+
+	while (!queue_isempty(fillers))
+		gatt_db_remove_service(replay->db,
+					PTR_TO_UINT(queue_pop_head(fillers)));
+
+	queue_destroy(fillers, NULL);
+}
+
+static void replay_free(void *data)
+{
+	struct replay *replay = data;
+	unsigned int h;
+
+	if (replay->attrs) {
+		for (h = 0; h <= UINT16_MAX; h++) {
+			if (!replay->attrs[h])
+				continue;
+
+			free(replay->attrs[h]->value);
+			free(replay->attrs[h]);
+		}
+
+		free(replay->attrs);
+	}
+
+	if (replay->db)
+		gatt_db_destroy(replay->db);
+
+	free(replay->exchanges);
+	free(replay->stream);
+	free(replay->expect);
+	free(replay);
+}
+
+static bool peer_send(struct replay *replay, const uint8_t *data,
+								uint16_t len)
+{
+	if (send(replay->fd[1], data, len, 0) == len)
+		return true;
+
+	/*
+	 * The stack did not keep up with the trace, stop writing until it
+	 * drained the socket.
+	 */
+	if (errno == EAGAIN)
+		mainloop_modify_fd(replay->fd[1], EPOLLIN | EPOLLOUT);
+	else
+		replay->errors++;
+
+	return false;
+}
+
+static void peer_error(struct replay *replay, const uint8_t *req,
+							uint8_t ecode)
+{
+	uint8_t pdu[5];
+
+	if (req[0] == BT_ATT_OP_MTU_REQ) {
+		pdu[0] = BT_ATT_OP_MTU_RSP;
+		put_le16(replay->mtu, pdu + 1);
+		peer_send(replay, pdu, 3);
+		return;
+	}
+
+	pdu[0] = BT_ATT_OP_ERROR_RSP;
+	pdu[1] = req[0];
+	put_le16(get_le16(req + 1), pdu + 2);
+	pdu[4] = ecode;
+	peer_send(replay, pdu, sizeof(pdu));
+}
+
+static const struct pdu *find_response(struct replay *replay,
+					const uint8_t *req, uint16_t len)
+{
+	unsigned int i, n;
+
+	/*
+	 * The stack mostly repeats the recorded requests in order, so the
+	 * search starts right after the previous match.
+	 */
+	for (n = 0; n < replay->num_exchanges; n++) {
+		const struct exchange *e;
+
+		i = (replay->cursor + n) % replay->num_exchanges;
+		e = &replay->exchanges[i];
+
+		if (e->req->len == len && !memcmp(e->req->data, req, len)) {
+			replay->cursor = i + 1;
+			return e->rsp;
+		}
+	}
+
+	return NULL;
+}
+
+static void replay_finish(struct replay *replay, bool success);
+
+static void client_check_done(struct replay *replay)
+{
+	if (replay->ready && replay->delivered >= replay->num_stream)
+		replay_finish(replay, true);
+}
+
+static void client_stream(struct replay *replay)
+{
+	unsigned int n;
+
+	if (!replay->ready)
+		return;
+
+	for (n = 0; n < REPLAY_BATCH && replay->sent < replay->num_stream;
+								n++) {
+		const struct pdu *pdu = replay->stream[replay->sent];
+
+		if (!peer_send(replay, pdu->data, pdu->len))
+			return;
+
+		replay->sent++;
+	}
+
+	if (replay->sent < replay->num_stream)
+		mainloop_modify_fd(replay->fd[1], EPOLLIN | EPOLLOUT);
+	else
+		mainloop_modify_fd(replay->fd[1], EPOLLIN);
+}
+
+static void server_stream(struct replay *replay)
+{
+	while (!replay->waiting && replay->sent < replay->num_stream) {
+		const struct pdu *pdu = replay->stream[replay->sent];
+
+		if (!peer_send(replay, pdu->data, pdu->len))
+			return;
+
+		replay->sent++;
+
+		if (op_type(pdu) == BT_ATT_OP_TYPE_REQ) {
+			replay->expected = replay->expect[replay->sent - 1];
+			replay->waiting = true;
+		}
+	}
+
+	mainloop_modify_fd(replay->fd[1], EPOLLIN);
+
+	if (!replay->waiting && replay->sent == replay->num_stream)
+		replay_finish(replay, true);
+}
+
+static void peer_receive(struct replay *replay, const uint8_t *buf,
+								uint16_t len)
+{
+	const struct pdu *rsp;
+	uint8_t conf = BT_ATT_OP_HANDLE_VAL_CONF;
+
+	switch (bt_att_opcode_info[buf[0]].type) {
+	case BT_ATT_OP_TYPE_REQ:
+		if (!replay->client || len < 3) {
+			replay->errors++;
+			break;
+		}
+
+		rsp = find_response(replay, buf, len);
+		if (rsp) {
+			peer_send(replay, rsp->data, rsp->len);
+			break;
+		}
+
+		replay->unmatched++;
+		peer_error(replay, buf, BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+		break;
+	case BT_ATT_OP_TYPE_RSP:
+		if (replay->client || !replay->waiting) {
+			replay->errors++;
+			break;
+		}
+
+		/* Differences point at an incomplete database rebuild */
+		rsp = replay->expected;
+		if (rsp && (rsp->len != len || memcmp(rsp->data, buf, len)))
+			replay->unmatched++;
+
+		replay->waiting = false;
+		server_stream(replay);
+		break;
+	case BT_ATT_OP_TYPE_IND:
+		peer_send(replay, &conf, 1);
+		break;
+	}
+}
+
+static void peer_callback(int fd, uint32_t events, void *user_data)
+{
+	struct replay *replay = user_data;
+	uint8_t buf[UINT16_MAX];
+	ssize_t len;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		replay_finish(replay, false);
+		return;
+	}
+
+	if (events & EPOLLOUT) {
+		if (replay->client)
+			client_stream(replay);
+		else
+			server_stream(replay);
+	}
+
+	if (!(events & EPOLLIN))
+		return;
+
+	while (!replay->finished) {
+		len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len <= 0)
+			break;
+
+		peer_receive(replay, buf, len);
+	}
+}
+
+static void notify_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct replay *replay = user_data;
+
+	replay->delivered++;
+	client_check_done(replay);
+}
+
+static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	struct replay *replay = user_data;
+
+	if (!success) {
+		replay_finish(replay, false);
+		return;
+	}
+
+	replay->ready = true;
+	client_stream(replay);
+	client_check_done(replay);
+}
+
+static void watchdog_cb(int id, void *user_data)
+{
+	struct replay *replay = user_data;
+
+	fprintf(stderr, "Scenario %u timed out (sent %u/%u)\n", replay->id,
+					replay->sent, replay->num_stream);
+
+	replay_finish(replay, false);
+}
+
+static void replay_next(void);
+
+static void teardown_cb(int id, void *user_data)
+{
+	struct replay *replay = user_data;
+
+	mainloop_remove_timeout(id);
+
+	bt_gatt_client_unref(replay->gatt);
+	bt_gatt_server_unref(replay->server);
+	bt_att_unref(replay->att);
+	replay->gatt = NULL;
+	replay->server = NULL;
+	replay->att = NULL;
+
+	mainloop_remove_fd(replay->fd[1]);
+	close(replay->fd[1]);
+
+	replay_next();
+}
+
+static void replay_finish(struct replay *replay, bool success)
+{
+	uint64_t wall, cpu;
+
+	if (replay->finished)
+		return;
+
+	wall = clock_us(CLOCK_MONOTONIC) - replay->wall_start;
+	cpu = clock_us(CLOCK_PROCESS_CPUTIME_ID) - replay->cpu_start;
+	alloc_counting = false;
+
+	replay->finished = true;
+
+	mainloop_remove_timeout(replay->watchdog);
+
+	if (success) {
+		replay->wall_total += wall;
+		replay->cpu_total += cpu;
+		replay->allocs_total += alloc_count - replay->allocs_start;
+		replay->bytes_total += alloc_bytes - replay->bytes_start;
+
+		if (!replay->wall_min || wall < replay->wall_min)
+			replay->wall_min = wall;
+
+		replay->iter++;
+	} else
+		replay->errors++;
+
+	/* Never tear the stack down from within its own callbacks */
+	mainloop_add_timeout(1, teardown_cb, replay, NULL);
+}
+
+static bool replay_start(struct replay *replay)
+{
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+					SOCK_NONBLOCK, 0, replay->fd) < 0) {
+		perror("Failed to create socket pair");
+		return false;
+	}
+
+	replay->sent = 0;
+	replay->delivered = 0;
+	replay->ready = false;
+	replay->waiting = false;
+	replay->finished = false;
+	replay->cursor = 0;
+
+	replay->wall_start = clock_us(CLOCK_MONOTONIC);
+	replay->cpu_start = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+	replay->allocs_start = alloc_count;
+	replay->bytes_start = alloc_bytes;
+	alloc_counting = true;
+
+	replay->att = bt_att_new(replay->fd[0]);
+	if (!replay->att) {
+		close(replay->fd[0]);
+		goto fail;
+	}
+
+	bt_att_set_close_on_unref(replay->att, true);
+
+	if (verbose)
+		bt_att_set_debug(replay->att, att_debug, "att: ", NULL);
+
+	mainloop_add_fd(replay->fd[1], EPOLLIN, peer_callback, replay, NULL);
+
+	replay->watchdog = mainloop_add_timeout(REPLAY_TIMEOUT, watchdog_cb,
+								replay, NULL);
+
+	if (replay->client) {
+		bt_att_register(replay->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					notify_cb, replay, NULL);
+		bt_att_register(replay->att, BT_ATT_OP_HANDLE_VAL_IND,
+					notify_cb, replay, NULL);
+
+		replay->gatt = bt_gatt_client_new(replay->att, replay->mtu);
+		if (!replay->gatt)
+			goto fail;
+
+		bt_gatt_client_set_ready_handler(replay->gatt, ready_cb,
+								replay, NULL);
+		return true;
+	}
+
+	replay->server = bt_gatt_server_new(replay->db, replay->att,
+								replay->mtu);
+	if (!replay->server)
+		goto fail;
+
+	server_stream(replay);
+
+	return true;
+
+fail:
+	alloc_counting = false;
+	fprintf(stderr, "Failed to set up scenario %u\n", replay->id);
+	replay->errors++;
+	replay->finished = true;
+	mainloop_add_timeout(1, teardown_cb, replay, NULL);
+
+	return true;
+}
+
+static void replay_report(struct replay *replay)
+{
+	unsigned int iter = replay->iter ? replay->iter : 1;
+
+	printf("scenario=%u index=%u handle=0x%04x role=%s mtu=%u pdus=%u "
+					"count=%u errors=%u unmatched=%u",
+					replay->id, replay->conn->index,
+					replay->conn->handle,
+					replay->client ? "client" : "server",
+					replay->mtu,
+					replay->conn->num_pdus,
+					replay->iter, replay->errors,
+					replay->unmatched / iter);
+
+	printf(" wall_min_us=%" PRIu64 " wall_mean_us=%" PRIu64
+		" cpu_mean_us=%" PRIu64 " allocs=%" PRIu64
+		" alloc_bytes=%" PRIu64 "\n",
+		replay->wall_min, replay->wall_total / iter,
+		replay->cpu_total / iter, replay->allocs_total / iter,
+		replay->bytes_total / iter);
+}
+
+static void replay_next(void)
+{
+	while (current) {
+		if (current->iter + current->errors < current->count) {
+			if (replay_start(current))
+				return;
+
+			current->errors++;
+			continue;
+		}
+
+		replay_report(current);
+		replay_free(current);
+		current = queue_pop_head(replay_list);
+	}
+
+	mainloop_quit();
+}
+
+static void start_cb(int id, void *user_data)
+{
+	mainloop_remove_timeout(id);
+	replay_next();
+}
+
+static void usage(void)
+{
+	printf("gatt-replay - ATT trace replay benchmark\n"
+		"Usage:\n");
+	printf("\tgatt-replay [options] <btsnoop file>\n");
+	printf("options:\n"
+		"\t-n, --count <count>    Iterations per scenario "
+							"(default %u)\n"
+		"\t-c, --conn <handle>    Only replay the given connection\n"
+		"\t-r, --role <role>      Force the traced role "
+						"(client|server)\n"
+		"\t-v, --verbose          Enable extra logging\n"
+		"\t-h, --help             Show help options\n", REPLAY_COUNT);
+}
+
+static const struct option main_options[] = {
+	{ "count",   required_argument, NULL, 'n' },
+	{ "conn",    required_argument, NULL, 'c' },
+	{ "role",    required_argument, NULL, 'r' },
+	{ "verbose", no_argument,       NULL, 'v' },
+	{ "version", no_argument,       NULL, 'V' },
+	{ "help",    no_argument,       NULL, 'h' },
+	{ }
+};
+
+static void create_replay(void *data, void *user_data)
+{
+	struct conn *conn = data;
+	unsigned int tx_req = 0, rx_req = 0;
+	struct replay *replay;
+	unsigned int i;
+
+	replay_id++;
+
+	if (!conn->num_pdus)
+		return;
+
+	if (replay_handle >= 0 && conn->handle != replay_handle)
+		return;
+
+	for (i = 0; i < conn->num_pdus; i++) {
+		const struct pdu *pdu = conn->pdus[i];
+
+		if (op_type(pdu) != BT_ATT_OP_TYPE_REQ)
+			continue;
+
+		if (pdu->rx)
+			rx_req++;
+		else
+			tx_req++;
+	}
+
+	replay = new0(struct replay, 1);
+	replay->conn = conn;
+	replay->id = replay_id;
+	replay->count = replay_count;
+
+	if (replay_role < 0)
+		replay->client = tx_req >= rx_req;
+	else
+		replay->client = replay_role;
+
+	if (replay->client)
+		build_client(replay);
+	else
+		build_server(replay);
+
+	queue_push_tail(replay_list, replay);
+}
+
+int main(int argc, char *argv[])
+{
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:c:r:vVh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			if (atoi(optarg) <= 0) {
+				fprintf(stderr, "Invalid count: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			replay_count = atoi(optarg);
+			break;
+		case 'c':
+			replay_handle = strtol(optarg, NULL, 0) & 0x0fff;
+			break;
+		case 'r':
+			if (!strcmp(optarg, "client"))
+				replay_role = 1;
+			else if (!strcmp(optarg, "server"))
+				replay_role = 0;
+			else {
+				fprintf(stderr, "Invalid role: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'V':
+			printf("%s\n", VERSION);
+			return EXIT_SUCCESS;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	conn_list = queue_new();
+	replay_list = queue_new();
+
+	if (!load_trace(argv[optind]))
+		return EXIT_FAILURE;
+
+	queue_foreach(conn_list, create_replay, NULL);
+
+	if (queue_isempty(replay_list)) {
+		fprintf(stderr, "No ATT traffic found\n");
+		return EXIT_FAILURE;
+	}
+
+	current = queue_pop_head(replay_list);
+
+	mainloop_init();
+
+	mainloop_add_timeout(1, start_cb, NULL, NULL);
+
+	mainloop_run();
+
+	queue_destroy(replay_list, replay_free);
+	queue_destroy(conn_list, conn_free);
+
+	return EXIT_SUCCESS;
+}
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/signalfd.h>
 
@@ -49,9 +50,19 @@
 /* Random UUID for testing purpose */
 #define READ_WRITE_DESCRIPTOR_UUID	"8260c653-1a54-426b-9e36-e84c238bc669"
 
+/* Stress services and characteristics, the first field is the index */
+#define STRESS_SERVICE_UUID_FMT		"%08x-5b1d-4c52-8e37-1f6f0c2a9e10"
+#define STRESS_CHR_UUID_FMT		"%08x-5b1d-4c52-8e37-1f6f0c2a9e11"
+
 static GMainLoop *main_loop;
 static GSList *services;
 static DBusConnection *connection;
+static GSList *stress_chrs;
+
+static gint option_services = 0;
+static gint option_chrs = 4;
+static gint option_notify = 0;
+static gboolean option_quiet = FALSE;
 
 struct characteristic {
 	char *uuid;
@@ -77,6 +88,9 @@ static const char const *ias_alert_level_props[] = {
 						"write-without-response",
 						NULL };
 
+static const char const *stress_props[] = { "read", "write", "notify",
+						NULL };
+
 static gboolean desc_get_uuid(const GDBusPropertyTable *property,
 					DBusMessageIter *iter, void *user_data)
 {
@@ -154,7 +168,8 @@ static gboolean chr_get_value(const GDBusPropertyTable *property,
 	struct characteristic *chr = user_data;
 	DBusMessageIter array;
 
-	printf("Characteristic(%s): Get(\"Value\")\n", chr->uuid);
+	if (!option_quiet)
+		printf("Characteristic(%s): Get(\"Value\")\n", chr->uuid);
 
 	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
 					DBUS_TYPE_BYTE_AS_STRING, &array);
@@ -195,7 +210,8 @@ static void chr_set_value(const GDBusPropertyTable *property,
 	uint8_t *value;
 	int len;
 
-	printf("Characteristic(%s): Set('Value', ...)\n", chr->uuid);
+	if (!option_quiet)
+		printf("Characteristic(%s): Set('Value', ...)\n", chr->uuid);
 
 	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY) {
 		printf("Invalid value for Set('Value'...)\n");
@@ -229,7 +245,8 @@ static gboolean service_get_uuid(const GDBusPropertyTable *property,
 {
 	const char *uuid = user_data;
 
-	printf("Get UUID: %s\n", uuid);
+	if (!option_quiet)
+		printf("Get UUID: %s\n", uuid);
 
 	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &uuid);
 
@@ -283,7 +300,7 @@ static void desc_iface_destroy(gpointer user_data)
 	g_free(desc);
 }
 
-static gboolean register_characteristic(const char *chr_uuid,
+static struct characteristic *register_characteristic(const char *chr_uuid,
 						const uint8_t *value, int vlen,
 						const char **props,
 						const char *desc_uuid,
@@ -305,11 +322,11 @@ static gboolean register_characteristic(const char *chr_uuid,
 					chr, chr_iface_destroy)) {
 		printf("Couldn't register characteristic interface\n");
 		chr_iface_destroy(chr);
-		return FALSE;
+		return NULL;
 	}
 
 	if (!desc_uuid)
-		return TRUE;
+		return chr;
 
 	desc = g_new0(struct descriptor, 1);
 	desc->uuid = g_strdup(desc_uuid);
@@ -324,10 +341,10 @@ static gboolean register_characteristic(const char *chr_uuid,
 							GATT_CHR_IFACE);
 
 		desc_iface_destroy(desc);
-		return FALSE;
+		return NULL;
 	}
 
-	return TRUE;
+	return chr;
 }
 
 static char *register_service(const char *uuid)
@@ -373,6 +390,64 @@ static void create_services()
 	printf("Registered service: %s\n", service_path);
 }
 
+static void create_stress_services(void)
+{
+	int i, j;
+
+	for (i = 0; i < option_services; i++) {
+		char uuid[37], *service_path;
+
+		snprintf(uuid, sizeof(uuid), STRESS_SERVICE_UUID_FMT, i);
+
+		service_path = register_service(uuid);
+		if (!service_path)
+			return;
+
+		for (j = 0; j < option_chrs; j++) {
+			struct characteristic *chr;
+			uint8_t value[4] = { i, j, 0, 0 };
+
+			snprintf(uuid, sizeof(uuid), STRESS_CHR_UUID_FMT,
+							i * option_chrs + j);
+
+			chr = register_characteristic(uuid, value,
+							sizeof(value),
+							stress_props, NULL,
+							service_path);
+			if (!chr) {
+				printf("Couldn't register stress characteristic"
+							" %d/%d\n", i, j);
+				break;
+			}
+
+			stress_chrs = g_slist_prepend(stress_chrs, chr);
+		}
+
+		services = g_slist_prepend(services, service_path);
+	}
+
+	printf("Registered %d stress services with %d characteristics each\n",
+						option_services, option_chrs);
+}
+
+static gboolean notify_stress_chrs(gpointer user_data)
+{
+	GSList *l;
+
+	for (l = stress_chrs; l; l = l->next) {
+		struct characteristic *chr = l->data;
+
+		/* Last two bytes count the updates of each characteristic */
+		if (++chr->value[2] == 0)
+			chr->value[3]++;
+
+		g_dbus_emit_property_changed(connection, chr->path,
+						GATT_CHR_IFACE, "Value");
+	}
+
+	return TRUE;
+}
+
 static void register_external_service_reply(DBusPendingCall *call,
 							void *user_data)
 {
@@ -501,10 +576,38 @@ static guint setup_signalfd(void)
 	return source;
 }
 
+static GOptionEntry options[] = {
+	{ "services", 's', 0, G_OPTION_ARG_INT, &option_services,
+				"Number of stress services to register" },
+	{ "characteristics", 'c', 0, G_OPTION_ARG_INT, &option_chrs,
+				"Characteristics per stress service" },
+	{ "notify", 'n', 0, G_OPTION_ARG_INT, &option_notify,
+				"Update stress values every N milliseconds" },
+	{ "quiet", 'q', 0, G_OPTION_ARG_NONE, &option_quiet,
+				"Don't log property accesses" },
+	{ NULL },
+};
+
 int main(int argc, char *argv[])
 {
+	GOptionContext *context;
+	GError *error = NULL;
 	GDBusClient *client;
-	guint signal;
+	guint signal, notify = 0;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
 
 	signal = setup_signalfd();
 	if (signal == 0)
@@ -520,6 +623,10 @@ int main(int argc, char *argv[])
 				dbus_bus_get_unique_name(connection));
 
 	create_services();
+	create_stress_services();
+
+	if (option_notify > 0 && stress_chrs)
+		notify = g_timeout_add(option_notify, notify_stress_chrs, NULL);
 
 	client = g_dbus_client_new(connection, "org.bluez", "/org/bluez");
 
@@ -527,10 +634,14 @@ int main(int argc, char *argv[])
 
 	g_main_loop_run(main_loop);
 
+	if (notify > 0)
+		g_source_remove(notify);
+
 	g_dbus_client_unref(client);
 
 	g_source_remove(signal);
 
+	g_slist_free(stress_chrs);
 	g_slist_free_full(services, g_free);
 	dbus_connection_unref(connection);
 
@@ -33,7 +33,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <stdbool.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -276,6 +278,7 @@ static int process_frames(int dev, int sock, int fd, unsigned long flags)
 		default:
 			/* Parse and print */
 			parse(&frm);
+			fflush(stdout);
 			break;
 		}
 	}
@@ -283,13 +286,148 @@ static int process_frames(int dev, int sock, int fd, unsigned long flags)
 	return 0;
 }
 
+/*
+ * Capture files are read through a single mapping when possible and
+ * through a large buffer otherwise, instead of two read() calls for
+ * every record.
+ */
+struct dump_reader {
+	int fd;
+	uint8_t *buf;
+	size_t len;
+	size_t pos;
+	bool mapped;
+};
+
+#define READER_BUF_SIZE	(64 * 1024)
+
+static void reader_init(struct dump_reader *rd, int fd)
+{
+	struct stat st;
+	off_t pos;
+	void *map;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->fd = fd;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+
+	if (pos >= 0 && !fstat(fd, &st) && S_ISREG(st.st_mode) &&
+							st.st_size > pos) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			rd->buf = map;
+			rd->len = st.st_size;
+			rd->pos = pos;
+			rd->mapped = true;
+			return;
+		}
+	}
+
+	rd->buf = malloc(READER_BUF_SIZE);
+	if (!rd->buf) {
+		perror("Can't allocate read buffer");
+		exit(1);
+	}
+}
+
+static void reader_cleanup(struct dump_reader *rd)
+{
+	if (rd->mapped)
+		munmap(rd->buf, rd->len);
+	else
+		free(rd->buf);
+}
+
+/* Makes len bytes available at rd->pos, returns 0 at the end of file */
+static int reader_fill(struct dump_reader *rd, size_t len)
+{
+	ssize_t n;
+
+	if (rd->len - rd->pos >= len)
+		return 1;
+
+	if (rd->mapped || len > READER_BUF_SIZE)
+		return 0;
+
+	memmove(rd->buf, rd->buf + rd->pos, rd->len - rd->pos);
+	rd->len -= rd->pos;
+	rd->pos = 0;
+
+	while (rd->len < len) {
+		n = read(rd->fd, rd->buf + rd->len, READER_BUF_SIZE - rd->len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		if (!n)
+			return 0;
+		rd->len += n;
+	}
+
+	return 1;
+}
+
+static int reader_read(struct dump_reader *rd, void *buf, size_t len)
+{
+	int err;
+
+	err = reader_fill(rd, len);
+	if (err <= 0)
+		return err;
+
+	memcpy(buf, rd->buf + rd->pos, len);
+	rd->pos += len;
+
+	return len;
+}
+
+static void reader_skip(struct dump_reader *rd, size_t len)
+{
+	size_t avail = rd->len - rd->pos;
+
+	if (len <= avail) {
+		rd->pos += len;
+		return;
+	}
+
+	rd->pos = rd->len;
+
+	if (!rd->mapped)
+		lseek(rd->fd, len - avail, SEEK_CUR);
+}
+
+/* Frames the protocol filter leaves nothing of to print */
+static bool frame_filtered(struct frame *frm)
+{
+	if (parser.flags & DUMP_RAW)
+		return false;
+
+	switch (((uint8_t *) frm->data)[0]) {
+	case HCI_ACLDATA_PKT:
+		return !(parser.filter & ~FILT_SCO) &&
+					frm->pppdump_fd <= fileno(stderr);
+	case HCI_SCODATA_PKT:
+		return p_filter(FILT_SCO) && frm->audio_fd <= fileno(stderr);
+	default:
+		return p_filter(FILT_HCI);
+	}
+}
+
 static void read_dump(int fd)
 {
+	struct dump_reader rd;
 	struct hcidump_hdr dh;
 	struct btsnoop_pkt dp;
 	struct pktlog_hdr ph;
 	struct frame frm;
-	int err;
+	int err, off;
+
+	memset(&frm, 0, sizeof(frm));
+	frm.pppdump_fd = parser.pppdump_fd;
+	frm.audio_fd = parser.audio_fd;
 
 	frm.data = malloc(HCI_MAX_FRAME_SIZE);
 	if (!frm.data) {
@@ -297,19 +435,24 @@ static void read_dump(int fd)
 		exit(1);
 	}
 
+	reader_init(&rd, fd);
+
 	while (1) {
 		if (parser.flags & DUMP_PKTLOG)
-			err = read_n(fd, (void *) &ph, PKTLOG_HDR_SIZE);
+			err = reader_read(&rd, &ph, PKTLOG_HDR_SIZE);
 		else if (parser.flags & DUMP_BTSNOOP)
-			err = read_n(fd, (void *) &dp, BTSNOOP_PKT_SIZE);
+			err = reader_read(&rd, &dp, BTSNOOP_PKT_SIZE);
 		else
-			err = read_n(fd, (void *) &dh, HCIDUMP_HDR_SIZE);
+			err = reader_read(&rd, &dh, HCIDUMP_HDR_SIZE);
 
 		if (err < 0)
 			goto failed;
 		if (!err)
 			goto done;
 
+		/* Payload goes after the packet type for formats lacking it */
+		off = 1;
+
 		if (parser.flags & DUMP_PKTLOG) {
 			switch (ph.type) {
 			case 0x00:
@@ -329,12 +472,11 @@ static void read_dump(int fd)
 				frm.in = 1;
 				break;
 			default:
-				lseek(fd, be32toh(ph.len) - 9, SEEK_CUR);
+				reader_skip(&rd, be32toh(ph.len) - 9);
 				continue;
 			}
 
 			frm.data_len = be32toh(ph.len) - 8;
-			err = read_n(fd, frm.data + 1, frm.data_len - 1);
 		} else if (parser.flags & DUMP_BTSNOOP) {
 			uint32_t opcode;
 			uint8_t pkt_type;
@@ -352,12 +494,11 @@ static void read_dump(int fd)
 				((uint8_t *) frm.data)[0] = pkt_type;
 
 				frm.data_len = be32toh(dp.len) + 1;
-				err = read_n(fd, frm.data + 1, frm.data_len - 1);
 				break;
 
 			case 1002:
 				frm.data_len = be32toh(dp.len);
-				err = read_n(fd, frm.data, frm.data_len);
+				off = 0;
 				break;
 
 			case 2001:
@@ -396,18 +537,29 @@ static void read_dump(int fd)
 				((uint8_t *) frm.data)[0] = pkt_type;
 
 				frm.data_len = be32toh(dp.len) + 1;
-				err = read_n(fd, frm.data + 1, frm.data_len - 1);
+				break;
 			}
 		} else {
 			frm.data_len = btohs(dh.len);
-			err = read_n(fd, frm.data, frm.data_len);
+			off = 0;
 		}
 
+		if (frm.data_len <= (uint32_t) off ||
+					frm.data_len > HCI_MAX_FRAME_SIZE) {
+			fprintf(stderr, "Invalid frame length %u\n",
+							frm.data_len);
+			goto done;
+		}
+
+		err = reader_read(&rd, frm.data + off, frm.data_len - off);
 		if (err < 0)
 			goto failed;
 		if (!err)
 			goto done;
 
+		if (frame_filtered(&frm))
+			continue;
+
 		frm.ptr = frm.data;
 		frm.len = frm.data_len;
 
@@ -432,11 +584,13 @@ static void read_dump(int fd)
 	}
 
 done:
+	reader_cleanup(&rd);
 	free(frm.data);
 	return;
 
 failed:
 	perror("Read failed");
+	reader_cleanup(&rd);
 	free(frm.data);
 	exit(1);
 }
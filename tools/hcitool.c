@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
 #include <sys/param.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -529,8 +530,241 @@ static void cmd_inq(int dev_id, int argc, char **argv)
 	bt_free(info);
 }
 
+static int eir_parse_name(uint8_t *eir, size_t eir_len,
+						char *buf, size_t buf_len)
+{
+	size_t offset;
+
+	offset = 0;
+	while (offset < eir_len) {
+		uint8_t field_len = eir[0];
+		size_t name_len;
+
+		/* Check for the end of EIR */
+		if (field_len == 0)
+			break;
+
+		if (offset + field_len > eir_len)
+			goto failed;
+
+		switch (eir[1]) {
+		case EIR_NAME_SHORT:
+		case EIR_NAME_COMPLETE:
+			name_len = field_len - 1;
+			if (name_len > buf_len)
+				goto failed;
+
+			memcpy(buf, &eir[2], name_len);
+			return 0;
+		}
+
+		offset += field_len + 1;
+		eir += field_len + 1;
+	}
+
+failed:
+	snprintf(buf, buf_len, "(unknown)");
+	return -1;
+}
+
 /* Device scanning */
 
+struct scan_name {
+	char name[249];
+	int valid;
+};
+
+static void scan_sanitize_name(char *name)
+{
+	int n;
+
+	name[248] = '\0';
+
+	for (n = 0; n < 248 && name[n]; n++) {
+		if ((unsigned char) name[n] < 32 || name[n] == 127)
+			name[n] = '.';
+	}
+}
+
+static int scan_find(inquiry_info *info, int num_rsp, const bdaddr_t *bdaddr)
+{
+	int i;
+
+	for (i = 0; i < num_rsp; i++) {
+		if (!bacmp(&(info+i)->bdaddr, bdaddr))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * The inquiry ioctl only hands back the basic inquiry data, but the
+ * extended inquiry result events are also delivered to any raw socket
+ * that asked for them. Drain what was queued during the inquiry and
+ * take the names from there, so those devices need no name request.
+ */
+static void scan_read_eir(int dd, inquiry_info *info, int num_rsp,
+						struct scan_name *names)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE];
+	hci_event_hdr *hdr;
+	int len;
+
+	while ((len = recv(dd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		extended_inquiry_info *eir;
+		uint8_t num, *ptr;
+		int i;
+
+		hdr = (void *) (buf + 1);
+		if (hdr->evt != EVT_EXTENDED_INQUIRY_RESULT)
+			continue;
+
+		ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
+		len -= (1 + HCI_EVENT_HDR_SIZE);
+
+		num = *ptr++;
+		len--;
+
+		for (; num > 0 && len >= EXTENDED_INQUIRY_INFO_SIZE; num--) {
+			eir = (void *) ptr;
+
+			ptr += EXTENDED_INQUIRY_INFO_SIZE;
+			len -= EXTENDED_INQUIRY_INFO_SIZE;
+
+			i = scan_find(info, num_rsp, &eir->bdaddr);
+			if (i < 0 || names[i].valid)
+				continue;
+
+			memset(names[i].name, 0, sizeof(names[i].name));
+			if (eir_parse_name(eir->data, HCI_MAX_EIR_LENGTH,
+					names[i].name,
+					sizeof(names[i].name) - 1) < 0)
+				continue;
+
+			scan_sanitize_name(names[i].name);
+			names[i].valid = 1;
+		}
+	}
+}
+
+static int scan_read_cache(const bdaddr_t *local, const bdaddr_t *peer,
+							char *name, size_t len)
+{
+	char filename[PATH_MAX], line[300];
+	char local_addr[18], peer_addr[18];
+	int general = 0, found = -1;
+	long long expires = 0;
+	FILE *f;
+
+	ba2str(local, local_addr);
+	ba2str(peer, peer_addr);
+
+	snprintf(filename, sizeof(filename), STORAGEDIR "/%s/cache/%s",
+						local_addr, peer_addr);
+
+	f = fopen(filename, "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (line[0] == '[') {
+			general = !strcmp(line, "[General]");
+			continue;
+		}
+
+		if (!general)
+			continue;
+
+		if (!strncmp(line, "NameExpires=", 12)) {
+			expires = strtoll(line + 12, NULL, 10);
+			continue;
+		}
+
+		if (strncmp(line, "Name=", 5) || !line[5])
+			continue;
+
+		snprintf(name, len, "%s", line + 5);
+		found = 0;
+	}
+
+	fclose(f);
+
+	/* bluetoothd stores the expiry time of the cached name */
+	if (expires > 0 && expires < (long long) time(NULL))
+		return -1;
+
+	return found;
+}
+
+/*
+ * Resolve the names still missing, keeping up to parallel remote name
+ * requests outstanding at a time instead of waiting on each in turn.
+ */
+static void scan_resolve_names(int dd, inquiry_info *info, int num_rsp,
+					struct scan_name *names, int parallel)
+{
+	struct hci_request *rq;
+	remote_name_req_cp *cp;
+	evt_remote_name_req_complete *rp;
+	int *idx;
+	int i, n;
+
+	rq = calloc(parallel, sizeof(*rq));
+	cp = calloc(parallel, sizeof(*cp));
+	rp = calloc(parallel, sizeof(*rp));
+	idx = calloc(parallel, sizeof(*idx));
+	if (!rq || !cp || !rp || !idx)
+		goto done;
+
+	for (i = 0; i < num_rsp;) {
+		for (n = 0; n < parallel && i < num_rsp; i++) {
+			if (names[i].valid)
+				continue;
+
+			memset(&cp[n], 0, sizeof(cp[n]));
+			bacpy(&cp[n].bdaddr, &(info+i)->bdaddr);
+			cp[n].pscan_rep_mode = (info+i)->pscan_rep_mode;
+			cp[n].clock_offset = (info+i)->clock_offset | 0x8000;
+
+			memset(&rq[n], 0, sizeof(rq[n]));
+			rq[n].ogf = OGF_LINK_CTL;
+			rq[n].ocf = OCF_REMOTE_NAME_REQ;
+			rq[n].cparam = &cp[n];
+			rq[n].clen = REMOTE_NAME_REQ_CP_SIZE;
+			rq[n].event = EVT_REMOTE_NAME_REQ_COMPLETE;
+			rq[n].rparam = &rp[n];
+			rq[n].rlen = EVT_REMOTE_NAME_REQ_COMPLETE_SIZE;
+
+			idx[n++] = i;
+		}
+
+		if (!n)
+			break;
+
+		hci_send_req_batch(dd, rq, n, 100000);
+
+		while (n--) {
+			struct scan_name *sn = &names[idx[n]];
+
+			if (!rq[n].rlen || rp[n].status)
+				continue;
+
+			memcpy(sn->name, rp[n].name, sizeof(sn->name) - 1);
+			scan_sanitize_name(sn->name);
+			sn->valid = 1;
+		}
+	}
+
+done:
+	free(idx);
+	free(rp);
+	free(cp);
+	free(rq);
+}
+
 static struct option scan_options[] = {
 	{ "help",	0, 0, 'h' },
 	{ "length",	1, 0, 'l' },
@@ -542,12 +776,14 @@ static struct option scan_options[] = {
 	{ "oui",	0, 0, 'O' },
 	{ "all",	0, 0, 'A' },
 	{ "ext",	0, 0, 'A' },
+	{ "refresh",	0, 0, 'r' },
+	{ "parallel",	1, 0, 'p' },
 	{ 0, 0, 0, 0 }
 };
 
 static const char *scan_help =
 	"Usage:\n"
-	"\tscan [--length=N] [--numrsp=N] [--iac=lap] [--flush] [--class] [--info] [--oui] [--refresh]\n";
+	"\tscan [--length=N] [--numrsp=N] [--iac=lap] [--flush] [--class] [--info] [--oui] [--refresh] [--parallel=N]\n";
 
 static void cmd_scan(int dev_id, int argc, char **argv)
 {
@@ -555,12 +791,15 @@ static void cmd_scan(int dev_id, int argc, char **argv)
 	uint8_t lap[3] = { 0x33, 0x8b, 0x9e };
 	int num_rsp, length, flags;
 	uint8_t cls[3], features[8];
-	char addr[18], name[249], *comp;
+	char addr[18], *name, *comp;
 	struct hci_version version;
 	struct hci_dev_info di;
 	struct hci_conn_info_req *cr;
-	int extcls = 0, extinf = 0, extoui = 0;
-	int i, n, l, opt, dd, cc;
+	struct hci_filter nf, of;
+	struct scan_name *names;
+	socklen_t olen;
+	int extcls = 0, extinf = 0, extoui = 0, refresh = 0, parallel = 4;
+	int i, l, opt, dd, cc;
 
 	length  = 8;	/* ~10 seconds */
 	num_rsp = 0;
@@ -613,6 +852,16 @@ static void cmd_scan(int dev_id, int argc, char **argv)
 			extoui = 1;
 			break;
 
+		case 'r':
+			refresh = 1;
+			break;
+
+		case 'p':
+			parallel = atoi(optarg);
+			if (parallel < 1)
+				parallel = 1;
+			break;
+
 		default:
 			printf("%s", scan_help);
 			return;
@@ -633,6 +882,27 @@ static void cmd_scan(int dev_id, int argc, char **argv)
 		exit(1);
 	}
 
+	dd = hci_open_dev(dev_id);
+	if (dd < 0) {
+		perror("HCI device open failed");
+		exit(1);
+	}
+
+	/* Capture extended inquiry results while the inquiry runs */
+	olen = sizeof(of);
+	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &of, &olen) < 0) {
+		perror("Can't get socket options");
+		exit(1);
+	}
+
+	hci_filter_clear(&nf);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+	hci_filter_set_event(EVT_EXTENDED_INQUIRY_RESULT, &nf);
+	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0) {
+		perror("Can't set socket options");
+		exit(1);
+	}
+
 	printf("Scanning ...\n");
 	num_rsp = hci_inquiry(dev_id, length, num_rsp, lap, &info, flags);
 	if (num_rsp < 0) {
@@ -640,37 +910,41 @@ static void cmd_scan(int dev_id, int argc, char **argv)
 		exit(1);
 	}
 
-	dd = hci_open_dev(dev_id);
-	if (dd < 0) {
-		perror("HCI device open failed");
-		free(info);
+	names = calloc(num_rsp + 1, sizeof(*names));
+	if (!names) {
+		perror("Can't allocate memory");
 		exit(1);
 	}
 
+	scan_read_eir(dd, info, num_rsp, names);
+
+	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+
+	for (i = 0; i < num_rsp && !refresh; i++) {
+		if (names[i].valid)
+			continue;
+
+		if (scan_read_cache(&di.bdaddr, &(info+i)->bdaddr,
+				names[i].name, sizeof(names[i].name)) < 0)
+			continue;
+
+		scan_sanitize_name(names[i].name);
+		names[i].valid = 1;
+	}
+
+	scan_resolve_names(dd, info, num_rsp, names, parallel);
+
 	if (extcls || extinf || extoui)
 		printf("\n");
 
 	for (i = 0; i < num_rsp; i++) {
 		uint16_t handle = 0;
 
+		name = names[i].valid ? names[i].name : NULL;
+
 		if (!extcls && !extinf && !extoui) {
 			ba2str(&(info+i)->bdaddr, addr);
-
-			if (hci_read_remote_name_with_clock_offset(dd,
-					&(info+i)->bdaddr,
-					(info+i)->pscan_rep_mode,
-					(info+i)->clock_offset | 0x8000,
-					sizeof(name), name, 100000) < 0)
-				strcpy(name, "n/a");
-
-			for (n = 0; n < 248 && name[n]; n++) {
-				if ((unsigned char) name[i] < 32 || name[i] == 127)
-					name[i] = '.';
-			}
-
-			name[248] = '\0';
-
-			printf("\t%s\t%s\n", addr, name);
+			printf("\t%s\t%s\n", addr, name ? name : "n/a");
 			continue;
 		}
 
@@ -716,21 +990,7 @@ static void cmd_scan(int dev_id, int argc, char **argv)
 			}
 		}
 
-		if (hci_read_remote_name_with_clock_offset(dd,
-					&(info+i)->bdaddr,
-					(info+i)->pscan_rep_mode,
-					(info+i)->clock_offset | 0x8000,
-					sizeof(name), name, 100000) < 0) {
-		} else {
-			for (n = 0; n < 248 && name[n]; n++) {
-				if ((unsigned char) name[i] < 32 || name[i] == 127)
-					name[i] = '.';
-			}
-
-			name[248] = '\0';
-		}
-
-		if (strlen(name) > 0)
+		if (name && strlen(name) > 0)
 			printf("Device name:\t%s\n", name);
 
 		if (extcls) {
@@ -778,6 +1038,7 @@ static void cmd_scan(int dev_id, int argc, char **argv)
 		printf("\n");
 	}
 
+	free(names);
 	bt_free(info);
 
 	hci_close_dev(dd);
@@ -848,7 +1109,13 @@ static void cmd_info(int dev_id, int argc, char **argv)
 	uint16_t handle;
 	uint8_t features[8], max_page = 0;
 	char name[249], *comp, *tmp;
-	struct hci_version version;
+	struct hci_request rq[3];
+	remote_name_req_cp name_cp;
+	evt_remote_name_req_complete name_rp;
+	read_remote_version_cp version_cp;
+	evt_read_remote_version_complete version_rp;
+	read_remote_features_cp features_cp;
+	evt_read_remote_features_complete features_rp;
 	struct hci_dev_info di;
 	struct hci_conn_info_req *cr;
 	int i, opt, dd, cc = 0;
@@ -923,24 +1190,63 @@ static void cmd_info(int dev_id, int argc, char **argv)
 		free(comp);
 	}
 
-	if (hci_read_remote_name(dd, &bdaddr, sizeof(name), name, 25000) == 0)
+	/* Name, version and features are independent of each other, so
+	 * keep all three requests outstanding at the same time */
+	memset(&rq, 0, sizeof(rq));
+
+	memset(&name_cp, 0, sizeof(name_cp));
+	bacpy(&name_cp.bdaddr, &bdaddr);
+	name_cp.pscan_rep_mode = 0x02;
+	rq[0].ogf = OGF_LINK_CTL;
+	rq[0].ocf = OCF_REMOTE_NAME_REQ;
+	rq[0].cparam = &name_cp;
+	rq[0].clen = REMOTE_NAME_REQ_CP_SIZE;
+	rq[0].event = EVT_REMOTE_NAME_REQ_COMPLETE;
+	rq[0].rparam = &name_rp;
+	rq[0].rlen = EVT_REMOTE_NAME_REQ_COMPLETE_SIZE;
+
+	version_cp.handle = handle;
+	rq[1].ogf = OGF_LINK_CTL;
+	rq[1].ocf = OCF_READ_REMOTE_VERSION;
+	rq[1].cparam = &version_cp;
+	rq[1].clen = READ_REMOTE_VERSION_CP_SIZE;
+	rq[1].event = EVT_READ_REMOTE_VERSION_COMPLETE;
+	rq[1].rparam = &version_rp;
+	rq[1].rlen = EVT_READ_REMOTE_VERSION_COMPLETE_SIZE;
+
+	features_cp.handle = handle;
+	rq[2].ogf = OGF_LINK_CTL;
+	rq[2].ocf = OCF_READ_REMOTE_FEATURES;
+	rq[2].cparam = &features_cp;
+	rq[2].clen = READ_REMOTE_FEATURES_CP_SIZE;
+	rq[2].event = EVT_READ_REMOTE_FEATURES_COMPLETE;
+	rq[2].rparam = &features_rp;
+	rq[2].rlen = EVT_READ_REMOTE_FEATURES_COMPLETE_SIZE;
+
+	hci_send_req_batch(dd, rq, 3, 25000);
+
+	if (rq[0].rlen && !name_rp.status) {
+		memcpy(name, name_rp.name, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
 		printf("\tDevice Name: %s\n", name);
+	}
 
-	if (hci_read_remote_version(dd, handle, &version, 20000) == 0) {
-		char *ver = lmp_vertostr(version.lmp_ver);
+	if (rq[1].rlen && !version_rp.status) {
+		char *ver = lmp_vertostr(version_rp.lmp_ver);
 		printf("\tLMP Version: %s (0x%x) LMP Subversion: 0x%x\n"
 			"\tManufacturer: %s (%d)\n",
 			ver ? ver : "n/a",
-			version.lmp_ver,
-			version.lmp_subver,
-			bt_compidtostr(version.manufacturer),
-			version.manufacturer);
+			version_rp.lmp_ver,
+			btohs(version_rp.lmp_subver),
+			bt_compidtostr(btohs(version_rp.manufacturer)),
+			btohs(version_rp.manufacturer));
 		if (ver)
 			bt_free(ver);
 	}
 
 	memset(features, 0, sizeof(features));
-	hci_read_remote_features(dd, handle, features, 20000);
+	if (rq[2].rlen && !features_rp.status)
+		memcpy(features, features_rp.features, 8);
 
 	if ((di.features[7] & LMP_EXT_FEAT) && (features[7] & LMP_EXT_FEAT))
 		hci_read_remote_ext_features(dd, handle, 0, &max_page,
@@ -2345,42 +2651,6 @@ static void sigint_handler(int sig)
 	signal_received = sig;
 }
 
-static void eir_parse_name(uint8_t *eir, size_t eir_len,
-						char *buf, size_t buf_len)
-{
-	size_t offset;
-
-	offset = 0;
-	while (offset < eir_len) {
-		uint8_t field_len = eir[0];
-		size_t name_len;
-
-		/* Check for the end of EIR */
-		if (field_len == 0)
-			break;
-
-		if (offset + field_len > eir_len)
-			goto failed;
-
-		switch (eir[1]) {
-		case EIR_NAME_SHORT:
-		case EIR_NAME_COMPLETE:
-			name_len = field_len - 1;
-			if (name_len > buf_len)
-				goto failed;
-
-			memcpy(buf, &eir[2], name_len);
-			return;
-		}
-
-		offset += field_len + 1;
-		eir += field_len + 1;
-	}
-
-failed:
-	snprintf(buf, buf_len, "(unknown)");
-}
-
 static int print_advertising_devices(int dd, uint8_t filter_type)
 {
 	unsigned char buf[HCI_MAX_EVENT_SIZE], *ptr;
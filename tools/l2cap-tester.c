@@ -258,6 +258,21 @@ static void test_data_free(void *test_data)
 				test_post_teardown, 2, user, test_data_free); \
 	} while (0)
 
+#define bench_l2cap(name, type, data, setup, func) \
+	do { \
+		struct test_data *user; \
+		user = malloc(sizeof(struct test_data)); \
+		if (!user) \
+			break; \
+		user->hciemu_type = type; \
+		user->io_id = 0; \
+		user->test_data = data; \
+		tester_bench_add_full(name, data, \
+				test_pre_setup, setup, func, NULL, \
+				test_post_teardown, 2, 2, 20, \
+				user, test_data_free); \
+	} while (0)
+
 static uint8_t pair_device_pin[] = { 0x30, 0x30, 0x30, 0x30 }; /* "0000" */
 
 static const struct l2cap_data client_connect_success_test = {
@@ -1410,5 +1425,16 @@ int main(int argc, char *argv[])
 				&le_att_server_success_test_1,
 				setup_powered_server, test_server);
 
+	bench_l2cap("L2CAP BR/EDR Client - Connect Latency",
+				HCIEMU_TYPE_BREDR, &client_connect_success_test,
+				setup_powered_client, test_connect);
+	bench_l2cap("L2CAP BR/EDR Client SSP - Pairing Time",
+				HCIEMU_TYPE_BREDR,
+				&client_connect_ssp_success_test_1,
+				setup_powered_client, test_connect);
+	bench_l2cap("L2CAP LE Client - Connect Latency",
+				HCIEMU_TYPE_LE, &le_client_connect_success_test_1,
+				setup_powered_client, test_connect);
+
 	return tester_run();
 }
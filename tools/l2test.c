@@ -37,10 +37,12 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -54,6 +56,10 @@
 #define BREDR_DEFAULT_PSM	0x1011
 #define LE_DEFAULT_PSM		0x0080
 
+#define BENCH_MAX_CONN		16
+#define BENCH_MAX_LIST		16
+#define BENCH_INTERVAL		250	/* msec */
+
 /* Test modes */
 enum {
 	SEND,
@@ -70,6 +76,7 @@ enum {
 	CSENDRECV,
 	INFOREQ,
 	PAIRING,
+	BENCH,
 };
 
 static unsigned char *buf;
@@ -122,9 +129,21 @@ static int timestamp = 0;
 static int defer_setup = 0;
 static int priority = -1;
 static int rcvbuf = 0;
+static int sndbuf = 0;
 static int chan_policy = -1;
 static int bdaddr_type = 0;
 
+/* Benchmark duration in seconds, or total bytes when non-zero */
+static int bench_duration = 10;
+static long bench_bytes = 0;
+static int bench_conns = 1;
+
+/* Modes and MTUs to sweep in benchmark mode */
+static int bench_modes[BENCH_MAX_LIST];
+static int bench_mode_count = 0;
+static int bench_omtu[BENCH_MAX_LIST];
+static int bench_omtu_count = 0;
+
 struct lookup_table {
 	const char *name;
 	int flag;
@@ -177,6 +196,36 @@ static const char *get_lookup_str(struct lookup_table *table, int flag)
 	return NULL;
 }
 
+static int parse_list(const char *str, struct lookup_table *table,
+								int *list)
+{
+	char *dup, *tok, *saveptr;
+	int num = 0;
+
+	dup = strdup(str);
+	if (!dup)
+		return -1;
+
+	for (tok = strtok_r(dup, ",", &saveptr); tok && num < BENCH_MAX_LIST;
+				tok = strtok_r(NULL, ",", &saveptr)) {
+		if (table)
+			list[num] = get_lookup_flag(table, tok);
+		else
+			list[num] = atoi(tok);
+
+		if (list[num] < 0) {
+			free(dup);
+			return -1;
+		}
+
+		num++;
+	}
+
+	free(dup);
+
+	return num;
+}
+
 static void print_lookup_values(struct lookup_table *table, char *header)
 {
 	int i;
@@ -415,6 +464,14 @@ static int do_connect(char *svr)
 		goto error;
 	}
 
+	/* Set send buffer size */
+	if (sndbuf && setsockopt(sk, SOL_SOCKET, SO_SNDBUF,
+						&sndbuf, sizeof(sndbuf)) < 0) {
+		syslog(LOG_ERR, "Can't set socket snd buf size: %s (%d)",
+							strerror(errno), errno);
+		goto error;
+	}
+
 	/* Connect to remote device */
 	memset(&addr, 0, sizeof(addr));
 	addr.l2_family = AF_BLUETOOTH;
@@ -1036,6 +1093,241 @@ static void send_and_recv_mode(int sk)
 	return;
 }
 
+struct bench_conn {
+	int sk;
+	int frame;
+	int offset;
+	uint32_t seq;
+	unsigned char *data;
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double rusage_cpu(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return tv2fl(ru.ru_utime) + tv2fl(ru.ru_stime);
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double da = *(const double *) a;
+	double db = *(const double *) b;
+
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static double bench_percentile(const double *samples, int num, int pct)
+{
+	if (!num)
+		return 0;
+
+	return samples[(num - 1) * pct / 100];
+}
+
+static int bench_send(struct bench_conn *c)
+{
+	int len;
+
+	if (!c->offset) {
+		put_le32(c->seq, c->data);
+		put_le16(c->frame, c->data + 4);
+	}
+
+	len = send(c->sk, c->data + c->offset, c->frame - c->offset,
+								MSG_DONTWAIT);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	c->offset += len;
+	if (c->offset < c->frame)
+		return 0;
+
+	c->offset = 0;
+	c->seq++;
+
+	return c->frame;
+}
+
+static bool bench_run(char *svr, bool first)
+{
+	struct bench_conn conns[BENCH_MAX_CONN];
+	struct pollfd p[BENCH_MAX_CONN];
+	struct l2cap_options opts;
+	double start, end, last, now, cpu, *samples = NULL;
+	unsigned long long total = 0, interval = 0;
+	int i, n, num = 0, max = 0;
+	bool ok = false;
+
+	memset(conns, 0, sizeof(conns));
+
+	for (n = 0; n < bench_conns; n++) {
+		struct bench_conn *c = &conns[n];
+
+		c->sk = do_connect(svr);
+		if (c->sk < 0)
+			goto done;
+
+		if (getopts(c->sk, &opts, true) < 0 || !opts.omtu)
+			opts.omtu = omtu ? omtu : imtu;
+
+		c->frame = data_size > 0 ? data_size : opts.omtu;
+		if (socktype != SOCK_STREAM && c->frame > opts.omtu)
+			c->frame = opts.omtu;
+		if (c->frame < 6)
+			c->frame = 6;
+
+		c->data = malloc(c->frame);
+		if (!c->data) {
+			close(c->sk);
+			goto done;
+		}
+
+		memset(c->data + 6, 0x7f, c->frame - 6);
+
+		p[n].fd = c->sk;
+		p[n].events = POLLOUT | POLLERR | POLLHUP;
+	}
+
+	syslog(LOG_INFO, "Benchmark: mode %s, omtu %d, frame %d, "
+			"%d connection(s) ...",
+			get_lookup_str(l2cap_modes, rfcmode), omtu,
+			conns[0].frame, bench_conns);
+
+	cpu = rusage_cpu();
+	start = last = now = bench_now();
+	end = start + bench_duration;
+
+	while (bench_bytes ? total < (unsigned long long) bench_bytes :
+								now < end) {
+		if (poll(p, n, BENCH_INTERVAL) < 0 && errno != EINTR)
+			goto done;
+
+		for (i = 0; i < n; i++) {
+			int len;
+
+			if (p[i].revents & (POLLERR | POLLHUP)) {
+				syslog(LOG_ERR, "Connection %d lost", i);
+				goto done;
+			}
+
+			if (!(p[i].revents & POLLOUT))
+				continue;
+
+			while ((len = bench_send(&conns[i])) > 0) {
+				total += len;
+				interval += len;
+			}
+
+			if (len < 0) {
+				syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+				goto done;
+			}
+		}
+
+		now = bench_now();
+		if (now - last < BENCH_INTERVAL / 1000.0)
+			continue;
+
+		if (num == max) {
+			double *tmp;
+
+			max = max ? max * 2 : 64;
+			tmp = realloc(samples, max * sizeof(*samples));
+			if (!tmp)
+				goto done;
+
+			samples = tmp;
+		}
+
+		samples[num++] = interval / (now - last) / 1024.0;
+		interval = 0;
+		last = now;
+	}
+
+	now = bench_now();
+	cpu = rusage_cpu() - cpu;
+
+	qsort(samples, num, sizeof(*samples), bench_cmp);
+
+	syslog(LOG_INFO, "%llu bytes in %.2f sec, %.2f kB/s, "
+			"p10 %.2f p50 %.2f p90 %.2f kB/s, cpu %.1f%%",
+			total, now - start, total / (now - start) / 1024.0,
+			bench_percentile(samples, num, 10),
+			bench_percentile(samples, num, 50),
+			bench_percentile(samples, num, 90),
+			cpu * 100 / (now - start));
+
+	printf("%s  { \"mode\": \"%s\", \"omtu\": %d, \"frame\": %d, "
+		"\"connections\": %d, \"sndbuf\": %d, \"bytes\": %llu, "
+		"\"seconds\": %.3f, \"cpu\": %.3f, \"kBps\": { "
+		"\"mean\": %.2f, \"min\": %.2f, \"p10\": %.2f, "
+		"\"p50\": %.2f, \"p90\": %.2f, \"max\": %.2f } }",
+		first ? "" : ",\n",
+		get_lookup_str(l2cap_modes, rfcmode), omtu, conns[0].frame,
+		bench_conns, sndbuf, total, now - start, cpu,
+		total / (now - start) / 1024.0,
+		bench_percentile(samples, num, 0),
+		bench_percentile(samples, num, 10),
+		bench_percentile(samples, num, 50),
+		bench_percentile(samples, num, 90),
+		bench_percentile(samples, num, 100));
+	fflush(stdout);
+
+	ok = true;
+
+done:
+	for (i = 0; i < n; i++) {
+		shutdown(conns[i].sk, SHUT_RDWR);
+		close(conns[i].sk);
+		free(conns[i].data);
+	}
+
+	free(samples);
+
+	return ok;
+}
+
+static void bench_mode(char *svr)
+{
+	int i, j, modes, mtus;
+	bool first = true;
+
+	modes = bench_mode_count ? bench_mode_count : 1;
+	mtus = bench_omtu_count ? bench_omtu_count : 1;
+
+	printf("[\n");
+
+	for (i = 0; i < modes; i++) {
+		if (bench_mode_count)
+			rfcmode = bench_modes[i];
+
+		for (j = 0; j < mtus; j++) {
+			if (bench_omtu_count)
+				omtu = bench_omtu[j];
+
+			if (!bench_run(svr, first))
+				exit(1);
+
+			first = false;
+		}
+	}
+
+	printf("\n]\n");
+}
+
 static void reconnect_mode(char *svr)
 {
 	while (1) {
@@ -1298,7 +1590,8 @@ static void usage(void)
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
 		"\t-p trigger dedicated bonding\n"
-		"\t-z information request\n");
+		"\t-z information request\n"
+		"\t-e connect and run send benchmark\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P psm] [-J cid]\n"
@@ -1317,6 +1610,11 @@ static void usage(void)
 		"\t[-Z size] Transmission Window size (default = 63)\n"
 		"\t[-Y priority] socket priority\n"
 		"\t[-H size] Maximum receive buffer size\n"
+		"\t[-h size] Maximum send buffer size\n"
+		"\t[-l seconds] benchmark duration (default = 10)\n"
+		"\t[-g bytes] benchmark until bytes are sent\n"
+		"\t[-o num] benchmark connections (default = 1)\n"
+		"\t[-X mode,...] [-O omtu,...] benchmark sweep\n"
 		"\t[-R] reliable mode\n"
 		"\t[-G] use connectionless channel (datagram)\n"
 		"\t[-U] use sock stream\n"
@@ -1335,8 +1633,8 @@ int main(int argc, char *argv[])
 
 	bacpy(&bdaddr, BDADDR_ANY);
 
-	while ((opt = getopt(argc, argv, "rdscuwmntqxyzpb:a:"
-		"i:P:I:O:J:B:N:L:W:C:D:X:F:Q:Z:Y:H:K:V:RUGAESMT")) != EOF) {
+	while ((opt = getopt(argc, argv, "rdscuwmntqxyzpeb:a:"
+		"i:P:I:O:J:B:N:L:W:C:D:X:F:Q:Z:Y:H:K:V:h:l:g:o:RUGAESMT")) != EOF) {
 		switch (opt) {
 		case 'r':
 			mode = RECV;
@@ -1402,6 +1700,11 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'e':
+			mode = BENCH;
+			need_addr = 1;
+			break;
+
 		case 'b':
 			data_size = atoi(optarg);
 			break;
@@ -1422,7 +1725,13 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'O':
-			omtu = atoi(optarg);
+			bench_omtu_count = parse_list(optarg, NULL, bench_omtu);
+			if (bench_omtu_count < 1) {
+				usage();
+				exit(1);
+			}
+
+			omtu = bench_omtu[0];
 			break;
 
 		case 'L':
@@ -1454,14 +1763,16 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'X':
-			rfcmode = get_lookup_flag(l2cap_modes, optarg);
+			bench_mode_count = parse_list(optarg, l2cap_modes,
+								bench_modes);
 
-			if (rfcmode == -1) {
+			if (bench_mode_count < 1) {
 				print_lookup_values(l2cap_modes,
 						"List L2CAP modes:");
 				exit(1);
 			}
 
+			rfcmode = bench_modes[0];
 			break;
 
 		case 'a':
@@ -1531,6 +1842,26 @@ int main(int argc, char *argv[])
 			rcvbuf = atoi(optarg);
 			break;
 
+		case 'h':
+			sndbuf = atoi(optarg);
+			break;
+
+		case 'l':
+			bench_duration = atoi(optarg);
+			break;
+
+		case 'g':
+			bench_bytes = atol(optarg);
+			break;
+
+		case 'o':
+			bench_conns = atoi(optarg);
+			if (bench_conns < 1 || bench_conns > BENCH_MAX_CONN) {
+				usage();
+				exit(1);
+			}
+			break;
+
 		case 'V':
 			bdaddr_type = get_lookup_flag(bdaddr_types, optarg);
 
@@ -1646,6 +1977,10 @@ int main(int argc, char *argv[])
 		case PAIRING:
 			do_pairing(argv[optind]);
 			exit(0);
+
+		case BENCH:
+			bench_mode(argv[optind]);
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
@@ -258,7 +258,6 @@ static inline void parse(struct frame *frm)
 		raw_dump(0, frm);
 	else
 		hci_dump(0, frm);
-	fflush(stdout);
 }
 
 #endif /* __PARSER_H */
@@ -35,10 +35,14 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -49,6 +53,9 @@
 
 #include "src/shared/util.h"
 
+#define BENCH_MAX_CONN		16
+#define BENCH_INTERVAL		250	/* msec */
+
 /* Test modes */
 enum {
 	SEND,
@@ -60,6 +67,7 @@ enum {
 	CRECV,
 	LSEND,
 	AUTO,
+	BENCH,
 };
 
 static unsigned char *buf;
@@ -93,6 +101,12 @@ static int linger = 0;
 static int timestamp = 0;
 static int defer_setup = 0;
 static int priority = -1;
+static int sndbuf = 0;
+
+/* Benchmark duration in seconds, or total bytes when non-zero */
+static int bench_duration = 10;
+static long bench_bytes = 0;
+static int bench_conns = 1;
 
 static float tv2fl(struct timeval tv)
 {
@@ -222,6 +236,14 @@ static int do_connect(const char *svr)
 		goto error;
 	}
 
+	/* Set send buffer size */
+	if (sndbuf && setsockopt(sk, SOL_SOCKET, SO_SNDBUF,
+						&sndbuf, sizeof(sndbuf)) < 0) {
+		syslog(LOG_ERR, "Can't set socket snd buf size: %s (%d)",
+							strerror(errno), errno);
+		goto error;
+	}
+
 	/* Connect to remote device */
 	memset(&addr, 0, sizeof(addr));
 	addr.rc_family = AF_BLUETOOTH;
@@ -594,6 +616,206 @@ static void send_mode(int sk)
 		syslog(LOG_INFO, "Done");
 }
 
+struct bench_conn {
+	int sk;
+	int frame;
+	int offset;
+	uint32_t seq;
+	unsigned char *data;
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double rusage_cpu(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return tv2fl(ru.ru_utime) + tv2fl(ru.ru_stime);
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double da = *(const double *) a;
+	double db = *(const double *) b;
+
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static double bench_percentile(const double *samples, int num, int pct)
+{
+	if (!num)
+		return 0;
+
+	return samples[(num - 1) * pct / 100];
+}
+
+static int bench_send(struct bench_conn *c)
+{
+	int len;
+
+	if (!c->offset) {
+		put_le32(c->seq, c->data);
+		put_le16(c->frame, c->data + 4);
+	}
+
+	len = send(c->sk, c->data + c->offset, c->frame - c->offset,
+								MSG_DONTWAIT);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	c->offset += len;
+	if (c->offset < c->frame)
+		return 0;
+
+	c->offset = 0;
+	c->seq++;
+
+	return c->frame;
+}
+
+static bool bench_run(char *svr)
+{
+	struct bench_conn conns[BENCH_MAX_CONN];
+	struct pollfd p[BENCH_MAX_CONN];
+	double start, end, last, now, cpu, *samples = NULL;
+	unsigned long long total = 0, interval = 0;
+	int i, n, num = 0, max = 0;
+	bool ok = false;
+
+	memset(conns, 0, sizeof(conns));
+
+	for (n = 0; n < bench_conns; n++) {
+		struct bench_conn *c = &conns[n];
+
+		c->sk = do_connect(svr);
+		if (c->sk < 0)
+			goto done;
+
+		c->frame = data_size < 6 ? 6 : data_size;
+
+		c->data = malloc(c->frame);
+		if (!c->data) {
+			close(c->sk);
+			goto done;
+		}
+
+		memset(c->data + 6, 0x7f, c->frame - 6);
+
+		p[n].fd = c->sk;
+		p[n].events = POLLOUT | POLLERR | POLLHUP;
+	}
+
+	syslog(LOG_INFO, "Benchmark: frame %d, %d connection(s) ...",
+						conns[0].frame, bench_conns);
+
+	cpu = rusage_cpu();
+	start = last = now = bench_now();
+	end = start + bench_duration;
+
+	while (bench_bytes ? total < (unsigned long long) bench_bytes :
+								now < end) {
+		if (poll(p, n, BENCH_INTERVAL) < 0 && errno != EINTR)
+			goto done;
+
+		for (i = 0; i < n; i++) {
+			int len;
+
+			if (p[i].revents & (POLLERR | POLLHUP)) {
+				syslog(LOG_ERR, "Connection %d lost", i);
+				goto done;
+			}
+
+			if (!(p[i].revents & POLLOUT))
+				continue;
+
+			while ((len = bench_send(&conns[i])) > 0) {
+				total += len;
+				interval += len;
+			}
+
+			if (len < 0) {
+				syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+				goto done;
+			}
+		}
+
+		now = bench_now();
+		if (now - last < BENCH_INTERVAL / 1000.0)
+			continue;
+
+		if (num == max) {
+			double *tmp;
+
+			max = max ? max * 2 : 64;
+			tmp = realloc(samples, max * sizeof(*samples));
+			if (!tmp)
+				goto done;
+
+			samples = tmp;
+		}
+
+		samples[num++] = interval / (now - last) / 1024.0;
+		interval = 0;
+		last = now;
+	}
+
+	now = bench_now();
+	cpu = rusage_cpu() - cpu;
+
+	qsort(samples, num, sizeof(*samples), bench_cmp);
+
+	syslog(LOG_INFO, "%llu bytes in %.2f sec, %.2f kB/s, "
+			"p10 %.2f p50 %.2f p90 %.2f kB/s, cpu %.1f%%",
+			total, now - start, total / (now - start) / 1024.0,
+			bench_percentile(samples, num, 10),
+			bench_percentile(samples, num, 50),
+			bench_percentile(samples, num, 90),
+			cpu * 100 / (now - start));
+
+	printf("{ \"frame\": %d, \"connections\": %d, \"sndbuf\": %d, "
+		"\"bytes\": %llu, \"seconds\": %.3f, \"cpu\": %.3f, "
+		"\"kBps\": { \"mean\": %.2f, \"min\": %.2f, "
+		"\"p10\": %.2f, \"p50\": %.2f, \"p90\": %.2f, "
+		"\"max\": %.2f } }\n",
+		conns[0].frame, bench_conns, sndbuf, total, now - start, cpu,
+		total / (now - start) / 1024.0,
+		bench_percentile(samples, num, 0),
+		bench_percentile(samples, num, 10),
+		bench_percentile(samples, num, 50),
+		bench_percentile(samples, num, 90),
+		bench_percentile(samples, num, 100));
+
+	ok = true;
+
+done:
+	for (i = 0; i < n; i++) {
+		shutdown(conns[i].sk, SHUT_RDWR);
+		close(conns[i].sk);
+		free(conns[i].data);
+	}
+
+	free(samples);
+
+	return ok;
+}
+
+static void bench_mode(char *svr)
+{
+	if (!bench_run(svr))
+		exit(1);
+}
+
 static void reconnect_mode(char *svr)
 {
 	while(1) {
@@ -674,7 +896,8 @@ static void usage(void)
 		"\t-n connect and be silent\n"
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
-		"\t-a automated test (receive hcix as parameter)\n");
+		"\t-a automated test (receive hcix as parameter)\n"
+		"\t-e connect and run send benchmark\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P channel] [-U uuid]\n"
@@ -686,6 +909,10 @@ static void usage(void)
 		"\t[-C num] send num frames before delay (default = 1)\n"
 		"\t[-D milliseconds] delay after sending num frames (default = 0)\n"
 		"\t[-Y priority] socket priority\n"
+		"\t[-h size] Maximum send buffer size\n"
+		"\t[-l seconds] benchmark duration (default = 10)\n"
+		"\t[-g bytes] benchmark until bytes are sent\n"
+		"\t[-o num] benchmark connections (default = 1)\n"
 		"\t[-A] request authentication\n"
 		"\t[-E] request encryption\n"
 		"\t[-S] secure connection\n"
@@ -701,7 +928,7 @@ int main(int argc, char *argv[])
 	bacpy(&bdaddr, BDADDR_ANY);
 	bacpy(&auto_bdaddr, BDADDR_ANY);
 
-	while ((opt=getopt(argc,argv,"rdscuwmna:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T")) != EOF) {
+	while ((opt=getopt(argc,argv,"rdscuwmnea:b:i:P:U:B:O:N:MAESL:W:C:D:Y:h:l:g:o:T")) != EOF) {
 		switch (opt) {
 		case 'r':
 			mode = RECV;
@@ -740,6 +967,11 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'e':
+			mode = BENCH;
+			need_addr = 1;
+			break;
+
 		case 'a':
 			mode = AUTO;
 
@@ -825,6 +1057,26 @@ int main(int argc, char *argv[])
 			timestamp = 1;
 			break;
 
+		case 'h':
+			sndbuf = atoi(optarg);
+			break;
+
+		case 'l':
+			bench_duration = atoi(optarg);
+			break;
+
+		case 'g':
+			bench_bytes = atol(optarg);
+			break;
+
+		case 'o':
+			bench_conns = atoi(optarg);
+			if (bench_conns < 1 || bench_conns > BENCH_MAX_CONN) {
+				usage();
+				exit(1);
+			}
+			break;
+
 		default:
 			usage();
 			exit(1);
@@ -896,6 +1148,10 @@ int main(int argc, char *argv[])
 		case AUTO:
 			automated_send_recv();
 			break;
+
+		case BENCH:
+			bench_mode(argv[optind]);
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
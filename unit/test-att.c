@@ -0,0 +1,451 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/att.h"
+
+#define MAX_BEARERS	2
+
+struct context {
+	struct bt_att *att;
+	int fd[MAX_BEARERS];		/* Peer end of each bearer */
+	unsigned int completed;
+	unsigned int notified;
+	uint16_t notify_len;
+};
+
+#define data(args...) ((const unsigned char[]) { args })
+
+#define send_pdu(context, bearer, args...) \
+	pdu_send(context, bearer, data(args), sizeof(data(args)))
+
+#define expect_pdu(context, bearer, args...) \
+	pdu_expect(context, bearer, data(args), sizeof(data(args)))
+
+static struct context *create_context(unsigned int bearers)
+{
+	struct context *context = g_new0(struct context, 1);
+	unsigned int i;
+	int sv[2];
+
+	for (i = 0; i < bearers; i++) {
+		g_assert(!socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC,
+								0, sv));
+
+		if (!i) {
+			context->att = bt_att_new(sv[0]);
+			g_assert(context->att);
+			bt_att_set_close_on_unref(context->att, true);
+		} else {
+			g_assert(bt_att_attach_fd(context->att, sv[0]));
+		}
+
+		context->fd[i] = sv[1];
+	}
+
+	for (; i < MAX_BEARERS; i++)
+		context->fd[i] = -1;
+
+	g_assert_cmpuint(bt_att_get_channels(context->att), ==, bearers);
+
+	return context;
+}
+
+static void destroy_context(struct context *context)
+{
+	unsigned int i;
+
+	bt_att_unref(context->att);
+
+	for (i = 0; i < MAX_BEARERS; i++) {
+		if (context->fd[i] >= 0)
+			close(context->fd[i]);
+	}
+
+	g_free(context);
+}
+
+/* Dispatch everything that is ready without blocking */
+static void run_pending(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static bool pdu_wait(struct context *context, unsigned int bearer)
+{
+	struct pollfd p;
+	int i;
+
+	p.fd = context->fd[bearer];
+	p.events = POLLIN;
+
+	for (i = 0; i < 100; i++) {
+		run_pending();
+
+		if (poll(&p, 1, 10) > 0)
+			return true;
+	}
+
+	return false;
+}
+
+static ssize_t pdu_recv(struct context *context, unsigned int bearer,
+						uint8_t *buf, size_t size)
+{
+	g_assert(pdu_wait(context, bearer));
+
+	return recv(context->fd[bearer], buf, size, MSG_DONTWAIT);
+}
+
+static void pdu_expect(struct context *context, unsigned int bearer,
+					const uint8_t *pdu, size_t size)
+{
+	uint8_t buf[512];
+	ssize_t len;
+
+	len = pdu_recv(context, bearer, buf, sizeof(buf));
+
+	g_assert_cmpint(len, ==, size);
+	g_assert(!memcmp(buf, pdu, size));
+}
+
+static void pdu_none(struct context *context, unsigned int bearer)
+{
+	struct pollfd p;
+
+	run_pending();
+
+	p.fd = context->fd[bearer];
+	p.events = POLLIN;
+
+	g_assert_cmpint(poll(&p, 1, 0), ==, 0);
+}
+
+static void pdu_send(struct context *context, unsigned int bearer,
+					const uint8_t *pdu, size_t size)
+{
+	ssize_t len;
+
+	len = write(context->fd[bearer], pdu, size);
+	g_assert_cmpint(len, ==, size);
+
+	run_pending();
+}
+
+static void read_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct context *context = user_data;
+
+	g_assert_cmpint(opcode, ==, BT_ATT_OP_READ_RSP);
+
+	context->completed++;
+}
+
+/* Queues a Read Request whose response carries the handle it asked for */
+static unsigned int send_read(struct context *context, uint16_t handle)
+{
+	uint8_t pdu[2];
+	unsigned int id;
+
+	put_le16(handle, pdu);
+
+	id = bt_att_send(context->att, BT_ATT_OP_READ_REQ, pdu, sizeof(pdu),
+						read_cb, context, NULL);
+	g_assert(id);
+
+	return id;
+}
+
+static unsigned int send_notify(struct context *context, uint16_t handle,
+							uint8_t priority)
+{
+	uint8_t pdu[3];
+	unsigned int id;
+
+	put_le16(handle, pdu);
+	pdu[2] = priority;
+
+	id = bt_att_send(context->att, BT_ATT_OP_HANDLE_VAL_NOT, pdu,
+						sizeof(pdu), NULL, NULL, NULL);
+	g_assert(id);
+
+	if (priority != BT_ATT_PRIORITY_NORMAL)
+		g_assert(bt_att_set_priority(context->att, id, priority));
+
+	return id;
+}
+
+static void expect_notify(struct context *context, uint16_t handle,
+							uint8_t priority)
+{
+	uint8_t pdu[4];
+
+	pdu[0] = BT_ATT_OP_HANDLE_VAL_NOT;
+	put_le16(handle, pdu + 1);
+	pdu[3] = priority;
+
+	pdu_expect(context, 0, pdu, sizeof(pdu));
+}
+
+static void notify_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct context *context = user_data;
+
+	context->notified++;
+	context->notify_len = length;
+}
+
+static void test_mtu(gconstpointer data)
+{
+	struct context *context = create_context(2);
+	uint8_t pdu[64];
+	unsigned int i;
+
+	g_assert_cmpint(bt_att_get_mtu(context->att), ==,
+						BT_ATT_DEFAULT_LE_MTU);
+	g_assert(!bt_att_set_mtu(context->att, BT_ATT_DEFAULT_LE_MTU - 1));
+	g_assert(bt_att_set_mtu(context->att, sizeof(pdu)));
+	g_assert_cmpint(bt_att_get_mtu(context->att), ==, sizeof(pdu));
+
+	g_assert(bt_att_register(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					notify_cb, context, NULL));
+
+	/* Every bearer must take a PDU of the full MTU */
+	memset(pdu, 0, sizeof(pdu));
+	pdu[0] = BT_ATT_OP_HANDLE_VAL_NOT;
+	put_le16(0x0003, pdu + 1);
+
+	for (i = 0; i < MAX_BEARERS; i++) {
+		pdu_send(context, i, pdu, sizeof(pdu));
+
+		g_assert_cmpuint(context->notified, ==, i + 1);
+		g_assert_cmpint(context->notify_len, ==, sizeof(pdu) - 1);
+	}
+
+	g_assert(bt_att_set_mtu(context->att, BT_ATT_DEFAULT_LE_MTU));
+	g_assert_cmpint(bt_att_get_mtu(context->att), ==,
+						BT_ATT_DEFAULT_LE_MTU);
+
+	destroy_context(context);
+}
+
+/* Outstanding requests are spread over the bearers, one per bearer */
+static void test_bearers_parallel(gconstpointer data)
+{
+	struct context *context = create_context(2);
+	uint8_t buf[512];
+	uint16_t handles = 0;
+	unsigned int i;
+
+	send_read(context, 0x0001);
+	send_read(context, 0x0002);
+	send_read(context, 0x0003);
+
+	for (i = 0; i < MAX_BEARERS; i++) {
+		g_assert_cmpint(pdu_recv(context, i, buf, sizeof(buf)), ==, 3);
+		g_assert_cmpint(buf[0], ==, BT_ATT_OP_READ_REQ);
+		handles |= get_le16(buf + 1);
+		pdu_none(context, i);
+	}
+
+	g_assert_cmpint(handles, ==, 0x0003);
+
+	/* The third request goes to whichever bearer frees up first */
+	send_pdu(context, 1, 0x0b);
+	g_assert_cmpuint(context->completed, ==, 1);
+
+	expect_pdu(context, 1, 0x0a, 0x03, 0x00);
+	pdu_none(context, 0);
+
+	send_pdu(context, 0, 0x0b);
+	send_pdu(context, 1, 0x0b);
+	g_assert_cmpuint(context->completed, ==, 3);
+
+	destroy_context(context);
+}
+
+/* A request outstanding on a lost bearer is retried on another one */
+static void test_bearers_requeue(gconstpointer data)
+{
+	struct context *context = create_context(2);
+	uint8_t buf[512];
+
+	send_read(context, 0x0001);
+	send_read(context, 0x0002);
+
+	g_assert_cmpint(pdu_recv(context, 0, buf, sizeof(buf)), ==, 3);
+	g_assert_cmpint(pdu_recv(context, 1, buf + 3, sizeof(buf) - 3), ==, 3);
+
+	close(context->fd[1]);
+	context->fd[1] = -1;
+
+	run_pending();
+	g_assert_cmpuint(bt_att_get_channels(context->att), ==, 1);
+	pdu_none(context, 0);
+
+	send_pdu(context, 0, 0x0b);
+	g_assert_cmpuint(context->completed, ==, 1);
+
+	pdu_expect(context, 0, buf + 3, 3);
+
+	send_pdu(context, 0, 0x0b);
+	g_assert_cmpuint(context->completed, ==, 2);
+
+	destroy_context(context);
+}
+
+/* Only requests use the additional bearers */
+static void test_bearers_primary(gconstpointer data)
+{
+	struct context *context = create_context(2);
+
+	send_notify(context, 0x0001, BT_ATT_PRIORITY_NORMAL);
+
+	expect_notify(context, 0x0001, BT_ATT_PRIORITY_NORMAL);
+	pdu_none(context, 1);
+
+	destroy_context(context);
+}
+
+static void test_priority_order(gconstpointer data)
+{
+	struct context *context = create_context(1);
+	unsigned int id;
+
+	g_assert(!bt_att_set_priority(context->att, 0xffff,
+						BT_ATT_PRIORITY_HIGH));
+
+	id = send_notify(context, 0x0001, BT_ATT_PRIORITY_LOW);
+	send_notify(context, 0x0002, BT_ATT_PRIORITY_LOW);
+	send_notify(context, 0x0003, BT_ATT_PRIORITY_NORMAL);
+	send_notify(context, 0x0004, BT_ATT_PRIORITY_HIGH);
+
+	g_assert(!bt_att_set_priority(context->att, id,
+						BT_ATT_PRIORITY_HIGH + 1));
+
+	expect_notify(context, 0x0004, BT_ATT_PRIORITY_HIGH);
+	expect_notify(context, 0x0003, BT_ATT_PRIORITY_NORMAL);
+	expect_notify(context, 0x0001, BT_ATT_PRIORITY_LOW);
+	expect_notify(context, 0x0002, BT_ATT_PRIORITY_LOW);
+	pdu_none(context, 0);
+
+	/* Sent operations can't be rescheduled */
+	g_assert(!bt_att_set_priority(context->att, id,
+						BT_ATT_PRIORITY_HIGH));
+
+	destroy_context(context);
+}
+
+/*
+ * A batch takes up to eight high and one low priority PDU per round, so
+ * the low priority queue keeps moving while high priority traffic waits.
+ */
+static void test_priority_weights(gconstpointer data)
+{
+	struct context *context = create_context(1);
+	unsigned int i;
+
+	for (i = 0; i < 10; i++)
+		send_notify(context, 0x0010 + i, BT_ATT_PRIORITY_LOW);
+
+	for (i = 0; i < 10; i++)
+		send_notify(context, 0x0020 + i, BT_ATT_PRIORITY_HIGH);
+
+	for (i = 0; i < 8; i++)
+		expect_notify(context, 0x0020 + i, BT_ATT_PRIORITY_HIGH);
+
+	expect_notify(context, 0x0010, BT_ATT_PRIORITY_LOW);
+	expect_notify(context, 0x0028, BT_ATT_PRIORITY_HIGH);
+	expect_notify(context, 0x0029, BT_ATT_PRIORITY_HIGH);
+
+	for (i = 1; i < 10; i++)
+		expect_notify(context, 0x0010 + i, BT_ATT_PRIORITY_LOW);
+
+	pdu_none(context, 0);
+
+	destroy_context(context);
+}
+
+/* A request is only held back by more urgent PDUs */
+static void test_priority_request(gconstpointer data)
+{
+	struct context *context = create_context(1);
+
+	send_notify(context, 0x0001, BT_ATT_PRIORITY_LOW);
+	send_notify(context, 0x0002, BT_ATT_PRIORITY_LOW);
+	send_read(context, 0x0003);
+
+	expect_pdu(context, 0, 0x0a, 0x03, 0x00);
+	expect_notify(context, 0x0001, BT_ATT_PRIORITY_LOW);
+	expect_notify(context, 0x0002, BT_ATT_PRIORITY_LOW);
+
+	send_pdu(context, 0, 0x0b);
+	g_assert_cmpuint(context->completed, ==, 1);
+
+	send_notify(context, 0x0004, BT_ATT_PRIORITY_HIGH);
+	send_read(context, 0x0005);
+
+	expect_notify(context, 0x0004, BT_ATT_PRIORITY_HIGH);
+	expect_pdu(context, 0, 0x0a, 0x05, 0x00);
+
+	send_pdu(context, 0, 0x0b);
+	g_assert_cmpuint(context->completed, ==, 2);
+
+	destroy_context(context);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_data_func("/att/mtu", NULL, test_mtu);
+	g_test_add_data_func("/att/bearers/parallel", NULL,
+						test_bearers_parallel);
+	g_test_add_data_func("/att/bearers/requeue", NULL,
+						test_bearers_requeue);
+	g_test_add_data_func("/att/bearers/primary", NULL,
+						test_bearers_primary);
+	g_test_add_data_func("/att/priority/order", NULL, test_priority_order);
+	g_test_add_data_func("/att/priority/weights", NULL,
+						test_priority_weights);
+	g_test_add_data_func("/att/priority/request", NULL,
+						test_priority_request);
+
+	return g_test_run();
+}
@@ -146,6 +146,201 @@ static void test_sign(gconstpointer data)
 	g_assert(result_compare(d->t, t));
 }
 
+/* Core Specification 4.1 Vol 3 Part H Appendix D.7 */
+static const uint8_t irk[] = {
+	0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34, 0x05, 0xad, 0xc8, 0x57,
+	0xa3, 0x34, 0x02, 0xec
+};
+
+static const uint8_t prand[] = { 0x94, 0x81, 0x70 };
+static const uint8_t hash[] = { 0xaa, 0xfb, 0x0d };
+
+static void test_ah(gconstpointer data)
+{
+	uint8_t res[3];
+
+	g_assert(bt_crypto_ah(crypto, irk, prand, res));
+	g_assert(memcmp(res, hash, 3) == 0);
+}
+
+static void test_ah_batch(gconstpointer data)
+{
+	uint8_t r[100][3], res[100][3], exp[3];
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		r[i][0] = i;
+		r[i][1] = i * 7;
+		r[i][2] = 0x40 | (i & 0x3f);
+	}
+
+	memcpy(r[70], prand, 3);
+
+	g_assert(bt_crypto_ah_batch(crypto, irk,
+				(const uint8_t (*)[3]) r, res, 100));
+
+	for (i = 0; i < 100; i++) {
+		g_assert(bt_crypto_ah(crypto, irk, r[i], exp));
+		g_assert(memcmp(res[i], exp, 3) == 0);
+	}
+
+	g_assert(memcmp(res[70], hash, 3) == 0);
+}
+
+static void test_sign_keys(gconstpointer data)
+{
+	uint8_t keys[12][16], exp[12][12], t[12];
+	int i, j;
+
+	/* More keys than the socket cache holds, in alternating order */
+	for (i = 0; i < 12; i++) {
+		memcpy(keys[i], key, 16);
+		keys[i][0] ^= i;
+
+		g_assert(bt_crypto_sign_att(crypto, keys[i], msg_2, 16, 0,
+								exp[i]));
+	}
+
+	g_assert(result_compare(t_msg_2, exp[0]));
+
+	for (j = 0; j < 3; j++) {
+		for (i = 0; i < 12; i++) {
+			int k = (i * 5 + j) % 12;
+
+			g_assert(bt_crypto_sign_att(crypto, keys[k], msg_2,
+							16, 0, t));
+			g_assert(result_compare(exp[k], t));
+
+			g_assert(bt_crypto_sign_att(crypto, keys[0], msg_2,
+							16, 0, t));
+			g_assert(result_compare(t_msg_2, t));
+		}
+	}
+}
+
+#define BENCH_OPS 10000
+
+static void bench_result(const char *name, unsigned int ops, double elapsed)
+{
+	g_test_maximized_result(ops / elapsed,
+				"%s: %u ops in %.3f s, %.0f ops/s, %.2f us/op",
+				name, ops, elapsed, ops / elapsed,
+				elapsed * 1000000 / ops);
+}
+
+static void test_benchmark_e(void)
+{
+	uint8_t buf[16];
+	unsigned int n;
+
+	memset(buf, 0, sizeof(buf));
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n++)
+		g_assert(bt_crypto_e(crypto, irk, buf, buf));
+
+	bench_result("e", n, g_test_timer_elapsed());
+}
+
+static void test_benchmark_ah(void)
+{
+	uint8_t res[3];
+	unsigned int n;
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n++)
+		g_assert(bt_crypto_ah(crypto, irk, prand, res));
+
+	bench_result("ah", n, g_test_timer_elapsed());
+}
+
+static void test_benchmark_ah_batch(void)
+{
+	uint8_t r[256][3], res[256][3];
+	unsigned int n;
+
+	memset(r, 0, sizeof(r));
+
+	for (n = 0; n < 256; n++)
+		r[n][0] = n;
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n += 256)
+		g_assert(bt_crypto_ah_batch(crypto, irk,
+					(const uint8_t (*)[3]) r, res, 256));
+
+	bench_result("ah batch", n, g_test_timer_elapsed());
+}
+
+static void test_benchmark_c1(void)
+{
+	static const uint8_t pres[7], preq[7], ia[6], ra[6];
+	uint8_t r[16], res[16];
+	unsigned int n;
+
+	memset(r, 0, sizeof(r));
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n++)
+		g_assert(bt_crypto_c1(crypto, irk, r, pres, preq, 0, ia, 1,
+								ra, res));
+
+	bench_result("c1", n, g_test_timer_elapsed());
+}
+
+static void test_benchmark_s1(void)
+{
+	uint8_t r1[16], r2[16], res[16];
+	unsigned int n;
+
+	memset(r1, 0, sizeof(r1));
+	memset(r2, 0, sizeof(r2));
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n++)
+		g_assert(bt_crypto_s1(crypto, irk, r1, r2, res));
+
+	bench_result("s1", n, g_test_timer_elapsed());
+}
+
+static void test_benchmark_sign(void)
+{
+	uint8_t t[12];
+	unsigned int n;
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n++)
+		g_assert(bt_crypto_sign_att(crypto, key, msg_4, 64, n, t));
+
+	bench_result("sign_att", n, g_test_timer_elapsed());
+}
+
+/* Cycles through more keys than are cached to measure the rekey cost */
+static void test_benchmark_sign_keys(void)
+{
+	uint8_t keys[16][16], t[12];
+	unsigned int n;
+
+	for (n = 0; n < 16; n++) {
+		memcpy(keys[n], key, 16);
+		keys[n][0] ^= n;
+	}
+
+	g_test_timer_start();
+
+	for (n = 0; n < BENCH_OPS; n++)
+		g_assert(bt_crypto_sign_att(crypto, keys[n % 16], msg_4, 64,
+								n, t));
+
+	bench_result("sign_att rekey", n, g_test_timer_elapsed());
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
@@ -160,6 +355,22 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/crypto/sign_att_2", &test_data_2, test_sign);
 	g_test_add_data_func("/crypto/sign_att_3", &test_data_3, test_sign);
 	g_test_add_data_func("/crypto/sign_att_4", &test_data_4, test_sign);
+	g_test_add_data_func("/crypto/sign_att_keys", NULL, test_sign_keys);
+	g_test_add_data_func("/crypto/ah", NULL, test_ah);
+	g_test_add_data_func("/crypto/ah_batch", NULL, test_ah_batch);
+
+	if (g_test_perf()) {
+		g_test_add_func("/crypto/benchmark/e", test_benchmark_e);
+		g_test_add_func("/crypto/benchmark/ah", test_benchmark_ah);
+		g_test_add_func("/crypto/benchmark/ah_batch",
+						test_benchmark_ah_batch);
+		g_test_add_func("/crypto/benchmark/c1", test_benchmark_c1);
+		g_test_add_func("/crypto/benchmark/s1", test_benchmark_s1);
+		g_test_add_func("/crypto/benchmark/sign_att",
+						test_benchmark_sign);
+		g_test_add_func("/crypto/benchmark/sign_att_rekey",
+						test_benchmark_sign_keys);
+	}
 
 	exit_status = g_test_run();
 
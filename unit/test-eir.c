@@ -33,6 +33,7 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/sdp.h>
 
+#include "lib/uuid.h"
 #include "src/eir.h"
 
 struct test_data {
@@ -0,0 +1,483 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att-types.h"
+#include "src/shared/gatt-db.h"
+
+/* Backend that completes reads and writes only when told to */
+struct backend {
+	unsigned int id;
+	unsigned int calls;
+	bool immediate;
+	uint8_t value[16];
+	size_t len;
+};
+
+struct result {
+	unsigned int calls;
+	uint8_t ecode;
+	uint8_t value[16];
+	size_t len;
+};
+
+static void backend_read(struct gatt_db *db, unsigned int id,
+					uint16_t handle, uint16_t offset,
+					uint8_t att_opcode, bdaddr_t *bdaddr,
+					void *user_data)
+{
+	struct backend *backend = user_data;
+
+	backend->id = id;
+	backend->calls++;
+
+	if (backend->immediate)
+		g_assert(gatt_db_complete(db, id, 0, backend->value,
+							backend->len));
+}
+
+static void backend_write(struct gatt_db *db, unsigned int id,
+					uint16_t handle, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t att_opcode, bdaddr_t *bdaddr,
+					void *user_data)
+{
+	struct backend *backend = user_data;
+
+	backend->id = id;
+	backend->calls++;
+
+	memcpy(backend->value, value, len);
+	backend->len = len;
+
+	if (backend->immediate)
+		g_assert(gatt_db_complete(db, id, 0, NULL, 0));
+}
+
+static void complete_cb(uint16_t handle, uint8_t ecode,
+					const uint8_t *value, size_t len,
+					void *user_data)
+{
+	struct result *result = user_data;
+
+	result->calls++;
+	result->ecode = ecode;
+	result->len = len;
+
+	if (len)
+		memcpy(result->value, value, len);
+}
+
+/*
+ * 0x0001-0x0005  Primary service 0x180f with one characteristic, value
+ *                handle 0x0003, and a descriptor
+ */
+static uint16_t add_service(struct gatt_db *db, struct backend *value,
+						struct backend *desc)
+{
+	bt_uuid_t uuid;
+	uint16_t handle, attr;
+
+	bt_uuid16_create(&uuid, 0x180f);
+	handle = gatt_db_add_service(db, &uuid, true, 5);
+	g_assert(handle);
+
+	bt_uuid16_create(&uuid, 0x2a19);
+	attr = gatt_db_add_characteristic(db, handle, &uuid, 0, 0x0a,
+							NULL, NULL, NULL);
+	g_assert_cmpint(attr, ==, handle + 2);
+
+	if (value)
+		g_assert(gatt_db_set_async(db, attr, backend_read,
+						backend_write, value));
+
+	bt_uuid16_create(&uuid, 0x2901);
+	attr = gatt_db_add_char_descriptor(db, handle, &uuid, 0, NULL, NULL,
+									NULL);
+	g_assert_cmpint(attr, ==, handle + 3);
+
+	if (desc)
+		g_assert(gatt_db_set_async(db, attr, backend_read, NULL,
+									desc));
+
+	return handle;
+}
+
+static void test_async_read(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct backend backend;
+	struct result result;
+	unsigned int id;
+
+	memset(&backend, 0, sizeof(backend));
+	memset(&result, 0, sizeof(result));
+
+	add_service(db, &backend, NULL);
+
+	id = gatt_db_read_async(db, 0x0003, 0, BT_ATT_OP_READ_REQ, NULL,
+						complete_cb, &result);
+	g_assert(id);
+	g_assert_cmpuint(backend.calls, ==, 1);
+	g_assert_cmpuint(backend.id, ==, id);
+	g_assert_cmpuint(result.calls, ==, 0);
+
+	/* Synchronous access is refused for asynchronous attributes */
+	g_assert(!gatt_db_write(db, 0x0003, 0, NULL, 0, BT_ATT_OP_WRITE_REQ,
+									NULL));
+
+	g_assert(gatt_db_complete(db, id, 0, (const uint8_t *) "abc", 3));
+	g_assert_cmpuint(result.calls, ==, 1);
+	g_assert_cmpint(result.ecode, ==, 0);
+	g_assert_cmpuint(result.len, ==, 3);
+	g_assert(!memcmp(result.value, "abc", 3));
+
+	/* An operation is only completed once */
+	g_assert(!gatt_db_complete(db, id, 0, NULL, 0));
+	g_assert_cmpuint(result.calls, ==, 1);
+
+	gatt_db_destroy(db);
+}
+
+static void test_async_write(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct backend backend;
+	struct result result;
+	unsigned int id;
+
+	memset(&backend, 0, sizeof(backend));
+	memset(&result, 0, sizeof(result));
+	backend.immediate = true;
+
+	add_service(db, &backend, NULL);
+
+	/* Completed from within the backend, before the id is returned */
+	id = gatt_db_write_async(db, 0x0003, 0, (const uint8_t *) "xy", 2,
+					BT_ATT_OP_WRITE_REQ, NULL,
+					complete_cb, &result);
+	g_assert(id);
+	g_assert_cmpuint(backend.id, ==, id);
+	g_assert_cmpuint(backend.len, ==, 2);
+	g_assert(!memcmp(backend.value, "xy", 2));
+	g_assert_cmpuint(result.calls, ==, 1);
+	g_assert_cmpint(result.ecode, ==, 0);
+
+	/* The descriptor has no write backend */
+	memset(&result, 0, sizeof(result));
+	g_assert(gatt_db_write_async(db, 0x0004, 0, (const uint8_t *) "z", 1,
+					BT_ATT_OP_WRITE_REQ, NULL,
+					complete_cb, &result));
+	g_assert_cmpuint(result.calls, ==, 1);
+	g_assert_cmpint(result.ecode, ==, BT_ATT_ERROR_WRITE_NOT_PERMITTED);
+
+	gatt_db_destroy(db);
+}
+
+static void test_async_static(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct result result;
+
+	memset(&result, 0, sizeof(result));
+
+	add_service(db, NULL, NULL);
+
+	/* Stored values are returned right away */
+	g_assert(gatt_db_read_async(db, 0x0001, 1, BT_ATT_OP_READ_BLOB_REQ,
+					NULL, complete_cb, &result));
+	g_assert_cmpuint(result.calls, ==, 1);
+	g_assert_cmpint(result.ecode, ==, 0);
+	g_assert_cmpuint(result.len, ==, 1);
+	g_assert_cmpint(result.value[0], ==, 0x18);
+
+	g_assert(gatt_db_read_async(db, 0x0001, 3, BT_ATT_OP_READ_BLOB_REQ,
+					NULL, complete_cb, &result));
+	g_assert_cmpuint(result.calls, ==, 2);
+	g_assert_cmpint(result.ecode, ==, BT_ATT_ERROR_INVALID_OFFSET);
+
+	g_assert(gatt_db_read_async(db, 0x0020, 0, BT_ATT_OP_READ_REQ,
+					NULL, complete_cb, &result));
+	g_assert_cmpuint(result.calls, ==, 3);
+	g_assert_cmpint(result.ecode, ==, BT_ATT_ERROR_INVALID_HANDLE);
+
+	gatt_db_destroy(db);
+}
+
+struct batch {
+	unsigned int calls;
+	unsigned int num;
+	struct gatt_db_result results[4];
+	uint8_t values[4][16];
+};
+
+static void batch_cb(const struct gatt_db_result *results, unsigned int num,
+							void *user_data)
+{
+	struct batch *batch = user_data;
+	unsigned int i;
+
+	batch->calls++;
+	batch->num = num;
+
+	for (i = 0; i < num; i++) {
+		batch->results[i] = results[i];
+		batch->results[i].value = batch->values[i];
+
+		if (results[i].len)
+			memcpy(batch->values[i], results[i].value,
+							results[i].len);
+	}
+}
+
+/* The batch is reported once, in request order, after its slowest read */
+static void test_batch(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct backend slow, fast;
+	struct batch batch;
+	const uint16_t handles[] = { 0x0003, 0x0004, 0x0001, 0x0020 };
+
+	memset(&slow, 0, sizeof(slow));
+	memset(&fast, 0, sizeof(fast));
+	memset(&batch, 0, sizeof(batch));
+
+	fast.immediate = true;
+	fast.value[0] = 0x42;
+	fast.len = 1;
+
+	add_service(db, &slow, &fast);
+
+	g_assert(!gatt_db_read_batch(db, handles, 0, BT_ATT_OP_READ_MULT_REQ,
+						NULL, batch_cb, &batch));
+
+	g_assert(gatt_db_read_batch(db, handles, G_N_ELEMENTS(handles),
+					BT_ATT_OP_READ_MULT_REQ, NULL,
+					batch_cb, &batch));
+	g_assert_cmpuint(slow.calls, ==, 1);
+	g_assert_cmpuint(fast.calls, ==, 1);
+	g_assert_cmpuint(batch.calls, ==, 0);
+
+	g_assert(gatt_db_complete(db, slow.id, 0, (const uint8_t *) "ab", 2));
+	g_assert_cmpuint(batch.calls, ==, 1);
+	g_assert_cmpuint(batch.num, ==, G_N_ELEMENTS(handles));
+
+	g_assert_cmpint(batch.results[0].handle, ==, 0x0003);
+	g_assert_cmpint(batch.results[0].ecode, ==, 0);
+	g_assert_cmpuint(batch.results[0].len, ==, 2);
+	g_assert(!memcmp(batch.results[0].value, "ab", 2));
+
+	g_assert_cmpint(batch.results[1].handle, ==, 0x0004);
+	g_assert_cmpuint(batch.results[1].len, ==, 1);
+	g_assert_cmpint(batch.results[1].value[0], ==, 0x42);
+
+	g_assert_cmpint(batch.results[2].handle, ==, 0x0001);
+	g_assert_cmpuint(batch.results[2].len, ==, 2);
+	g_assert_cmpint(get_le16(batch.results[2].value), ==, 0x180f);
+
+	g_assert_cmpint(batch.results[3].handle, ==, 0x0020);
+	g_assert_cmpint(batch.results[3].ecode, ==,
+						BT_ATT_ERROR_INVALID_HANDLE);
+
+	gatt_db_destroy(db);
+}
+
+/* Operations still pending when the database goes away are dropped */
+static void test_batch_destroy(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct backend slow;
+	struct batch batch;
+	const uint16_t handles[] = { 0x0001, 0x0003 };
+
+	memset(&slow, 0, sizeof(slow));
+	memset(&batch, 0, sizeof(batch));
+
+	add_service(db, &slow, NULL);
+
+	g_assert(gatt_db_read_batch(db, handles, G_N_ELEMENTS(handles),
+					BT_ATT_OP_READ_MULT_REQ, NULL,
+					batch_cb, &batch));
+	g_assert_cmpuint(slow.calls, ==, 1);
+
+	gatt_db_destroy(db);
+
+	g_assert_cmpuint(batch.calls, ==, 0);
+}
+
+/* Handles freed by a removed service are handed out again */
+static void test_handles_reuse(void)
+{
+	struct gatt_db *db = gatt_db_new();
+
+	g_assert_cmpint(add_service(db, NULL, NULL), ==, 0x0001);
+	g_assert_cmpint(add_service(db, NULL, NULL), ==, 0x0006);
+	g_assert_cmpint(add_service(db, NULL, NULL), ==, 0x000b);
+
+	g_assert(gatt_db_remove_service(db, 0x0006));
+	g_assert_cmpint(gatt_db_get_end_handle(db, 0x0006), ==, 0);
+
+	g_assert_cmpint(add_service(db, NULL, NULL), ==, 0x0006);
+	g_assert_cmpint(gatt_db_get_end_handle(db, 0x0006), ==, 0x000a);
+	g_assert_cmpint(add_service(db, NULL, NULL), ==, 0x0010);
+
+	gatt_db_destroy(db);
+}
+
+/*
+ * 0x0001-0x0005  Active primary service, see add_service()
+ * 0x0006-0x0007  Inactive secondary service with a 128 bit UUID, the last
+ *                handle left unused
+ */
+static struct gatt_db *create_snapshot_db(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	uint128_t u128;
+	bt_uuid_t uuid;
+	uint16_t handle;
+	int i;
+
+	handle = add_service(db, NULL, NULL);
+	g_assert(gatt_db_service_set_active(db, handle, true));
+
+	for (i = 0; i < 16; i++)
+		u128.data[i] = i;
+
+	bt_uuid128_create(&uuid, u128);
+	g_assert_cmpint(gatt_db_add_service(db, &uuid, false, 2), ==, 0x0006);
+
+	return db;
+}
+
+static bool count_entry(const struct gatt_db_entry *entry, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+
+	return true;
+}
+
+static void test_snapshot(void)
+{
+	struct gatt_db *db, *copy;
+	uint8_t *data, *data2;
+	size_t len, len2;
+	unsigned int count = 0;
+	bt_uuid_t uuid;
+
+	db = create_snapshot_db();
+	g_assert(gatt_db_export(db, &data, &len));
+
+	copy = gatt_db_new();
+	g_assert(gatt_db_import(copy, data, len));
+
+	/* A round trip gives back the same snapshot */
+	g_assert(gatt_db_export(copy, &data2, &len2));
+	g_assert_cmpuint(len2, ==, len);
+	g_assert(!memcmp(data, data2, len));
+	free(data2);
+
+	g_assert_cmpint(gatt_db_get_end_handle(copy, 0x0001), ==, 0x0005);
+	g_assert_cmpint(gatt_db_get_end_handle(copy, 0x0006), ==, 0x0007);
+	g_assert(gatt_db_get_service_uuid(copy, 0x0006, &uuid));
+	g_assert_cmpint(uuid.type, ==, BT_UUID128);
+
+	/* Only the active service is visible */
+	gatt_db_foreach_in_range(copy, 0x0001, 0xffff, NULL, count_entry,
+								&count);
+	g_assert_cmpuint(count, ==, 4);
+
+	/* Overlapping services are refused as a whole */
+	g_assert(!gatt_db_import(copy, data, len));
+	g_assert(gatt_db_export(copy, &data2, &len2));
+	g_assert_cmpuint(len2, ==, len);
+	free(data2);
+
+	/* The remaining handles are still allocated after the import */
+	g_assert_cmpint(add_service(copy, NULL, NULL), ==, 0x0008);
+
+	gatt_db_destroy(copy);
+	gatt_db_destroy(db);
+	free(data);
+}
+
+static void test_snapshot_invalid(void)
+{
+	struct gatt_db *db, *copy;
+	uint8_t *data, *data2;
+	size_t len, len2, i;
+
+	db = create_snapshot_db();
+	g_assert(gatt_db_export(db, &data, &len));
+
+	copy = gatt_db_new();
+
+	/* Every truncation is rejected without touching the database */
+	for (i = 0; i < len; i++)
+		g_assert(!gatt_db_import(copy, data, i));
+
+	data[0] ^= 0xff;
+	g_assert(!gatt_db_import(copy, data, len));
+	data[0] ^= 0xff;
+
+	g_assert(gatt_db_export(copy, &data2, &len2));
+	g_assert_cmpuint(len2, ==, 8);
+	free(data2);
+
+	g_assert(gatt_db_import(copy, data, len));
+
+	gatt_db_destroy(copy);
+	gatt_db_destroy(db);
+	free(data);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/gatt-db/async/read", test_async_read);
+	g_test_add_func("/gatt-db/async/write", test_async_write);
+	g_test_add_func("/gatt-db/async/static", test_async_static);
+	g_test_add_func("/gatt-db/batch", test_batch);
+	g_test_add_func("/gatt-db/batch/destroy", test_batch_destroy);
+	g_test_add_func("/gatt-db/handles/reuse", test_handles_reuse);
+	g_test_add_func("/gatt-db/snapshot", test_snapshot);
+	g_test_add_func("/gatt-db/snapshot/invalid", test_snapshot_invalid);
+
+	return g_test_run();
+}
@@ -0,0 +1,523 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-server.h"
+
+enum pdu_type {
+	PDU_SEND,		/* Written by the test to the server */
+	PDU_RECV,		/* Expected from the server */
+	PDU_NOTIFY,		/* Expected after bt_gatt_server_notify_all() */
+};
+
+struct test_pdu {
+	bool valid;
+	enum pdu_type type;
+	uint8_t *data;
+	size_t size;
+};
+
+struct test_data {
+	char *test_name;
+	struct test_pdu *pdu_list;
+};
+
+/* Backend of the characteristic values, see setup_db() for the layout */
+struct value {
+	uint8_t data[512];
+	size_t len;
+};
+
+struct context {
+	GMainLoop *main_loop;
+	guint watch_id;
+	int fd;
+	struct gatt_db *db;
+	struct bt_att *att;
+	struct bt_gatt_server *server;
+	struct queue *servers;
+	struct value name;
+	struct value level;
+	struct value control;
+	const struct test_data *data;
+	unsigned int pdu_offset;
+};
+
+#define data(args...) ((const unsigned char[]) { args })
+
+#define typed_pdu(pdu_type, args...)				\
+	{							\
+		.valid = true,					\
+		.type = pdu_type,				\
+		.data = (uint8_t *) data(args),			\
+		.size = sizeof(data(args)),			\
+	}
+
+#define raw_pdu(args...) typed_pdu(PDU_SEND, args)
+#define rsp_pdu(args...) typed_pdu(PDU_RECV, args)
+#define ntf_pdu(args...) typed_pdu(PDU_NOTIFY, args)
+
+/* The PDU data only lives as long as the block, so keep a copy of it */
+#define define_test(name, function, args...)				\
+	do {								\
+		const struct test_pdu pdus[] = {			\
+			args, { }					\
+		};							\
+		static struct test_data data;				\
+		unsigned int i;						\
+		data.test_name = g_strdup(name);			\
+		data.pdu_list = g_memdup(pdus, sizeof(pdus));		\
+		for (i = 0; data.pdu_list[i].valid; i++)		\
+			data.pdu_list[i].data = g_memdup(pdus[i].data,	\
+							pdus[i].size);	\
+		g_test_add_data_func(name, &data, function);		\
+	} while (0)
+
+#define SERVER_MTU	64
+
+#define AUTH_HANDLE	0x0009
+
+static void test_free(gconstpointer user_data)
+{
+	const struct test_data *data = user_data;
+	unsigned int i;
+
+	for (i = 0; data->pdu_list[i].valid; i++)
+		g_free(data->pdu_list[i].data);
+
+	g_free(data->test_name);
+	g_free(data->pdu_list);
+}
+
+static void context_quit(struct context *context)
+{
+	g_main_loop_quit(context->main_loop);
+}
+
+/*
+ * Writes PDUs up to the next one expected from the server, triggering
+ * notifications when the server is expected to send one.
+ */
+static void process_pdus(struct context *context)
+{
+	const struct test_pdu *pdu;
+	unsigned int count;
+	ssize_t len;
+
+	while (1) {
+		pdu = &context->data->pdu_list[context->pdu_offset];
+
+		if (!pdu->valid) {
+			context_quit(context);
+			return;
+		}
+
+		switch (pdu->type) {
+		case PDU_SEND:
+			len = write(context->fd, pdu->data, pdu->size);
+			g_assert_cmpint(len, ==, pdu->size);
+			context->pdu_offset++;
+			break;
+		case PDU_NOTIFY:
+			count = bt_gatt_server_notify_all(context->servers,
+							get_le16(pdu->data + 1),
+							pdu->data + 3,
+							pdu->size - 3);
+			g_assert_cmpuint(count, ==, 1);
+			return;
+		case PDU_RECV:
+			return;
+		}
+	}
+}
+
+static gboolean test_handler(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct context *context = user_data;
+	const struct test_pdu *pdu;
+	unsigned char buf[512];
+	ssize_t len;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		context->watch_id = 0;
+		return FALSE;
+	}
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	len = read(context->fd, buf, sizeof(buf));
+
+	g_assert(pdu->valid);
+	g_assert(pdu->type != PDU_SEND);
+	g_assert_cmpint(len, ==, pdu->size);
+	g_assert(!memcmp(buf, pdu->data, len));
+
+	process_pdus(context);
+
+	return TRUE;
+}
+
+static void value_read(struct gatt_db *db, unsigned int id, uint16_t handle,
+					uint16_t offset, uint8_t att_opcode,
+					bdaddr_t *bdaddr, void *user_data)
+{
+	struct value *value = user_data;
+
+	if (offset > value->len) {
+		gatt_db_complete(db, id, BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+		return;
+	}
+
+	gatt_db_complete(db, id, 0, value->data + offset,
+						value->len - offset);
+}
+
+static void value_write(struct gatt_db *db, unsigned int id, uint16_t handle,
+					uint16_t offset, const uint8_t *data,
+					size_t len, uint8_t att_opcode,
+					bdaddr_t *bdaddr, void *user_data)
+{
+	struct value *value = user_data;
+
+	/* Long values must have been merged back into a single write */
+	if (offset) {
+		gatt_db_complete(db, id, BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+		return;
+	}
+
+	memcpy(value->data, data, len);
+	value->len = len;
+
+	gatt_db_complete(db, id, 0, NULL, 0);
+}
+
+static void value_set(struct value *value, const char *str)
+{
+	value->len = strlen(str);
+	memcpy(value->data, str, value->len);
+}
+
+/*
+ * 0x0001-0x0003  GAP service, Device Name read through a callback
+ * 0x0004-0x0009  Battery service, Battery Level with a CCC kept by the
+ *                server, then a writable characteristic
+ */
+static void setup_db(struct context *context)
+{
+	bt_uuid_t uuid;
+	uint16_t handle, value;
+
+	context->db = gatt_db_new();
+	g_assert(context->db);
+
+	bt_uuid16_create(&uuid, 0x1800);
+	handle = gatt_db_add_service(context->db, &uuid, true, 3);
+	g_assert_cmpint(handle, ==, 0x0001);
+
+	bt_uuid16_create(&uuid, 0x2a00);
+	value = gatt_db_add_characteristic(context->db, handle, &uuid, 0,
+						0x02, NULL, NULL, NULL);
+	g_assert_cmpint(value, ==, 0x0003);
+	gatt_db_set_async(context->db, value, value_read, NULL,
+							&context->name);
+	value_set(&context->name, "BlueZ");
+
+	gatt_db_service_set_active(context->db, handle, true);
+
+	bt_uuid16_create(&uuid, 0x180f);
+	handle = gatt_db_add_service(context->db, &uuid, true, 6);
+	g_assert_cmpint(handle, ==, 0x0004);
+
+	bt_uuid16_create(&uuid, 0x2a19);
+	value = gatt_db_add_characteristic(context->db, handle, &uuid, 0,
+						0x12, NULL, NULL, NULL);
+	g_assert_cmpint(value, ==, 0x0006);
+	gatt_db_set_async(context->db, value, value_read, NULL,
+							&context->level);
+	value_set(&context->level, "d");
+
+	bt_uuid16_create(&uuid, 0x2902);
+	value = gatt_db_add_char_descriptor(context->db, handle, &uuid, 0,
+							NULL, NULL, NULL);
+	g_assert_cmpint(value, ==, 0x0007);
+
+	bt_uuid16_create(&uuid, 0xfff1);
+	value = gatt_db_add_characteristic(context->db, handle, &uuid, 0,
+						0x0a, NULL, NULL, NULL);
+	g_assert_cmpint(value, ==, 0x0009);
+	gatt_db_set_async(context->db, value, value_read, value_write,
+							&context->control);
+
+	gatt_db_service_set_active(context->db, handle, true);
+}
+
+static struct context *create_context(gconstpointer data)
+{
+	struct context *context = g_new0(struct context, 1);
+	GIOChannel *channel;
+	int err, sv[2];
+
+	context->main_loop = g_main_loop_new(NULL, FALSE);
+	g_assert(context->main_loop);
+
+	err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+	g_assert(err == 0);
+
+	context->att = bt_att_new(sv[0]);
+	g_assert(context->att);
+	bt_att_set_close_on_unref(context->att, true);
+
+	setup_db(context);
+
+	context->server = bt_gatt_server_new(context->db, context->att,
+								SERVER_MTU);
+	g_assert(context->server);
+
+	context->servers = queue_new();
+	queue_push_tail(context->servers, context->server);
+
+	channel = g_io_channel_unix_new(sv[1]);
+
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	context->watch_id = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				test_handler, context);
+	g_assert(context->watch_id > 0);
+
+	g_io_channel_unref(channel);
+
+	context->fd = sv[1];
+	context->data = data;
+
+	return context;
+}
+
+static void execute_context(struct context *context)
+{
+	process_pdus(context);
+
+	g_main_loop_run(context->main_loop);
+
+	if (context->watch_id)
+		g_source_remove(context->watch_id);
+
+	g_main_loop_unref(context->main_loop);
+
+	test_free(context->data);
+
+	queue_destroy(context->servers, NULL);
+	bt_gatt_server_unref(context->server);
+	bt_att_unref(context->att);
+	gatt_db_destroy(context->db);
+
+	g_free(context);
+}
+
+static void test_server(gconstpointer data)
+{
+	struct context *context = create_context(data);
+
+	execute_context(context);
+}
+
+static uint8_t authorize(uint16_t handle, uint8_t att_opcode,
+				uint32_t permissions, void *user_data)
+{
+	if (handle == AUTH_HANDLE && att_opcode != BT_ATT_OP_READ_REQ)
+		return BT_ATT_ERROR_AUTHORIZATION;
+
+	return 0;
+}
+
+static void test_authorize(gconstpointer data)
+{
+	struct context *context = create_context(data);
+
+	bt_gatt_server_set_authorize(context->server, authorize, NULL, NULL);
+
+	execute_context(context);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	define_test("/gatt-server/mtu", test_server,
+			raw_pdu(0x02, 0x00, 0x02),
+			rsp_pdu(0x03, 0x40, 0x00),
+			raw_pdu(0x0a, 0x03, 0x00),
+			rsp_pdu(0x0b, 0x42, 0x6c, 0x75, 0x65, 0x5a));
+
+	define_test("/gatt-server/mtu/invalid", test_server,
+			raw_pdu(0x02, 0x00),
+			rsp_pdu(0x01, 0x02, 0x00, 0x00, 0x04));
+
+	define_test("/gatt-server/discover/primary", test_server,
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+			rsp_pdu(0x11, 0x06, 0x01, 0x00, 0x03, 0x00, 0x00, 0x18,
+					0x04, 0x00, 0x09, 0x00, 0x0f, 0x18),
+			raw_pdu(0x10, 0x0a, 0x00, 0xff, 0xff, 0x00, 0x28),
+			rsp_pdu(0x01, 0x10, 0x0a, 0x00, 0x0a));
+
+	define_test("/gatt-server/discover/primary/unsupported", test_server,
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),
+			rsp_pdu(0x01, 0x10, 0x01, 0x00, 0x10));
+
+	define_test("/gatt-server/discover/by-uuid", test_server,
+			raw_pdu(0x06, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28,
+								0x0f, 0x18),
+			rsp_pdu(0x07, 0x04, 0x00, 0x09, 0x00));
+
+	define_test("/gatt-server/discover/characteristics", test_server,
+			raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),
+			rsp_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,
+					0x2a, 0x05, 0x00, 0x12, 0x06, 0x00,
+					0x19, 0x2a, 0x08, 0x00, 0x0a, 0x09,
+					0x00, 0xf1, 0xff),
+			raw_pdu(0x08, 0x09, 0x00, 0xff, 0xff, 0x03, 0x28),
+			rsp_pdu(0x01, 0x08, 0x09, 0x00, 0x0a));
+
+	define_test("/gatt-server/discover/descriptors", test_server,
+			raw_pdu(0x04, 0x07, 0x00, 0x07, 0x00),
+			rsp_pdu(0x05, 0x01, 0x07, 0x00, 0x02, 0x29),
+			raw_pdu(0x04, 0x07, 0x00, 0x06, 0x00),
+			rsp_pdu(0x01, 0x04, 0x07, 0x00, 0x01));
+
+	define_test("/gatt-server/read", test_server,
+			raw_pdu(0x0a, 0x03, 0x00),
+			rsp_pdu(0x0b, 0x42, 0x6c, 0x75, 0x65, 0x5a),
+			raw_pdu(0x0a, 0x20, 0x00),
+			rsp_pdu(0x01, 0x0a, 0x20, 0x00, 0x01));
+
+	define_test("/gatt-server/read/blob", test_server,
+			raw_pdu(0x0c, 0x03, 0x00, 0x02, 0x00),
+			rsp_pdu(0x0d, 0x75, 0x65, 0x5a),
+			raw_pdu(0x0c, 0x03, 0x00, 0x06, 0x00),
+			rsp_pdu(0x01, 0x0c, 0x03, 0x00, 0x07));
+
+	define_test("/gatt-server/read/by-type", test_server,
+			raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x19, 0x2a),
+			rsp_pdu(0x09, 0x03, 0x06, 0x00, 0x64));
+
+	define_test("/gatt-server/read/multiple", test_server,
+			raw_pdu(0x0e, 0x03, 0x00, 0x06, 0x00),
+			rsp_pdu(0x0f, 0x42, 0x6c, 0x75, 0x65, 0x5a, 0x64),
+			raw_pdu(0x0e, 0x03, 0x00, 0x20, 0x00),
+			rsp_pdu(0x01, 0x0e, 0x20, 0x00, 0x01));
+
+	define_test("/gatt-server/write", test_server,
+			raw_pdu(0x12, 0x09, 0x00, 0x01, 0x02, 0x03),
+			rsp_pdu(0x13),
+			raw_pdu(0x0a, 0x09, 0x00),
+			rsp_pdu(0x0b, 0x01, 0x02, 0x03),
+			raw_pdu(0x12, 0x03, 0x00, 0x01),
+			rsp_pdu(0x01, 0x12, 0x03, 0x00, 0x03));
+
+	define_test("/gatt-server/write/command", test_server,
+			raw_pdu(0x52, 0x09, 0x00, 0x05),
+			raw_pdu(0x52, 0x20, 0x00, 0x06),
+			raw_pdu(0x0a, 0x09, 0x00),
+			rsp_pdu(0x0b, 0x05));
+
+	define_test("/gatt-server/write/long", test_server,
+			raw_pdu(0x16, 0x09, 0x00, 0x00, 0x00, 0x01, 0x02),
+			rsp_pdu(0x17, 0x09, 0x00, 0x00, 0x00, 0x01, 0x02),
+			raw_pdu(0x16, 0x09, 0x00, 0x02, 0x00, 0x03, 0x04),
+			rsp_pdu(0x17, 0x09, 0x00, 0x02, 0x00, 0x03, 0x04),
+			raw_pdu(0x18, 0x01),
+			rsp_pdu(0x19),
+			raw_pdu(0x0a, 0x09, 0x00),
+			rsp_pdu(0x0b, 0x01, 0x02, 0x03, 0x04));
+
+	define_test("/gatt-server/write/long/cancel", test_server,
+			raw_pdu(0x12, 0x09, 0x00, 0x01),
+			rsp_pdu(0x13),
+			raw_pdu(0x16, 0x09, 0x00, 0x00, 0x00, 0xaa),
+			rsp_pdu(0x17, 0x09, 0x00, 0x00, 0x00, 0xaa),
+			raw_pdu(0x18, 0x00),
+			rsp_pdu(0x19),
+			raw_pdu(0x0a, 0x09, 0x00),
+			rsp_pdu(0x0b, 0x01));
+
+	define_test("/gatt-server/write/long/invalid-offset", test_server,
+			raw_pdu(0x16, 0x09, 0x00, 0x04, 0x00, 0xaa),
+			rsp_pdu(0x17, 0x09, 0x00, 0x04, 0x00, 0xaa),
+			raw_pdu(0x18, 0x01),
+			rsp_pdu(0x01, 0x18, 0x09, 0x00, 0x07),
+			raw_pdu(0x18, 0x01),
+			rsp_pdu(0x19));
+
+	define_test("/gatt-server/authorize", test_authorize,
+			raw_pdu(0x12, 0x09, 0x00, 0x01),
+			rsp_pdu(0x01, 0x12, 0x09, 0x00, 0x08),
+			raw_pdu(0x16, 0x09, 0x00, 0x00, 0x00, 0x01),
+			rsp_pdu(0x01, 0x16, 0x09, 0x00, 0x08),
+			raw_pdu(0x0a, 0x09, 0x00),
+			rsp_pdu(0x0b));
+
+	define_test("/gatt-server/ccc/read", test_server,
+			raw_pdu(0x0a, 0x07, 0x00),
+			rsp_pdu(0x0b, 0x00, 0x00),
+			raw_pdu(0x12, 0x07, 0x00, 0x01),
+			rsp_pdu(0x01, 0x12, 0x07, 0x00, 0x0d),
+			raw_pdu(0x12, 0x07, 0x00, 0x01, 0x00),
+			rsp_pdu(0x13),
+			raw_pdu(0x08, 0x07, 0x00, 0x07, 0x00, 0x02, 0x29),
+			rsp_pdu(0x09, 0x04, 0x07, 0x00, 0x01, 0x00));
+
+	define_test("/gatt-server/ccc/notify", test_server,
+			raw_pdu(0x12, 0x07, 0x00, 0x01, 0x00),
+			rsp_pdu(0x13),
+			ntf_pdu(0x1b, 0x06, 0x00, 0x63));
+
+	define_test("/gatt-server/ccc/indicate", test_server,
+			raw_pdu(0x12, 0x07, 0x00, 0x02, 0x00),
+			rsp_pdu(0x13),
+			ntf_pdu(0x1d, 0x06, 0x00, 0x62),
+			raw_pdu(0x1e),
+			raw_pdu(0x0a, 0x07, 0x00),
+			rsp_pdu(0x0b, 0x02, 0x00));
+
+	return g_test_run();
+}
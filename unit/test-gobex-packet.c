@@ -125,6 +125,39 @@ static void test_decode_connect(void)
 	g_obex_packet_free(pkt);
 }
 
+static void test_decode_body_bytes(void)
+{
+	GObexPacket *pkt;
+	GObexHeader *header;
+	GError *err = NULL;
+	const guint8 *buf;
+	const char *str;
+	gboolean ret;
+	gsize len;
+
+	pkt = g_obex_packet_decode(pkt_put_long, sizeof(pkt_put_long), 0,
+						G_OBEX_DATA_REF, &err);
+	g_assert_no_error(err);
+	g_assert(pkt != NULL);
+
+	/* Body is handed out straight from the decoded buffer */
+	ret = g_obex_packet_get_body_bytes(pkt, &buf, &len);
+	g_assert(ret == TRUE);
+	g_assert(buf == pkt_put_long + sizeof(pkt_put_long) - 5);
+	g_assert(len == 5);
+
+	header = g_obex_packet_get_header(pkt, G_OBEX_HDR_NAME);
+	g_assert(header != NULL);
+
+	ret = g_obex_header_get_unicode(header, &str);
+	g_assert(ret == TRUE);
+	g_assert_cmpstr(str, ==, "file.txt");
+
+	g_assert(g_obex_packet_get_header(pkt, G_OBEX_HDR_DESCRIPTION) == NULL);
+
+	g_obex_packet_free(pkt);
+}
+
 static void test_decode_nval(void)
 {
 	GObexPacket *pkt;
@@ -210,6 +243,44 @@ static void test_encode_on_demand_fail(void)
 	g_obex_packet_free(pkt);
 }
 
+static gssize get_body_fd(gsize len, int *fd, off_t *offset,
+							gpointer user_data)
+{
+	*fd = 42;
+	*offset = 7;
+
+	return 4;
+}
+
+static void test_encode_fd(void)
+{
+	GObexPacket *pkt;
+	uint8_t buf[255];
+	gssize len;
+	gsize body_len;
+	off_t offset;
+	int fd;
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_fd(pkt, get_body_fd, NULL);
+
+	len = g_obex_packet_encode(pkt, buf, sizeof(buf));
+	if (len < 0) {
+		g_printerr("Encoding failed: %s\n", g_strerror(-len));
+		g_assert_not_reached();
+	}
+
+	/* Only the headers are encoded, the body stays in the fd */
+	assert_memequal(pkt_put_body, sizeof(pkt_put_body) - 4, buf, len);
+
+	body_len = g_obex_packet_get_body_fd(pkt, &fd, &offset);
+	g_assert_cmpuint(body_len, ==, 4);
+	g_assert_cmpint(fd, ==, 42);
+	g_assert_cmpint(offset, ==, 7);
+
+	g_obex_packet_free(pkt);
+}
+
 static void test_create_args(void)
 {
 	GObexPacket *pkt;
@@ -244,6 +315,8 @@ int main(int argc, char *argv[])
 						test_decode_pkt_header);
 	g_test_add_func("/gobex/test_decode_connect",
 						test_decode_connect);
+	g_test_add_func("/gobex/test_decode_body_bytes",
+						test_decode_body_bytes);
 
 	g_test_add_func("/gobex/test_decode_nval", test_decode_nval);
 
@@ -253,6 +326,8 @@ int main(int argc, char *argv[])
 	g_test_add_func("/gobex/test_encode_on_demand_fail",
 						test_encode_on_demand_fail);
 
+	g_test_add_func("/gobex/test_encode_fd", test_encode_fd);
+
 	g_test_add_func("/gobex/test_create_args", test_create_args);
 
 	return g_test_run();
@@ -2334,6 +2334,139 @@ static void test_conn_put_req_seq_srm(void)
 	g_assert_no_error(d.err);
 }
 
+#define THROUGHPUT_SIZE (4 * 1024 * 1024)
+
+struct throughput_data {
+	struct test_data d;
+	GObex *server;
+	gsize received;
+};
+
+static gssize provide_throughput(void *buf, gsize len, gpointer user_data)
+{
+	struct throughput_data *t = user_data;
+	gsize remaining = THROUGHPUT_SIZE - t->d.total;
+
+	if (len > remaining)
+		len = remaining;
+
+	memset(buf, t->d.total & 0xff, len);
+	t->d.total += len;
+
+	return len;
+}
+
+static gboolean rcv_throughput(const void *buf, gsize len, gpointer user_data)
+{
+	struct throughput_data *t = user_data;
+
+	t->received += len;
+
+	return TRUE;
+}
+
+static void throughput_complete(GObex *obex, GError *err, gpointer user_data)
+{
+	struct throughput_data *t = user_data;
+
+	if (err != NULL && t->d.err == NULL)
+		t->d.err = g_error_copy(err);
+
+	/* Both the client request and the server response have to finish */
+	if (++t->d.count == 2 || err != NULL)
+		g_main_loop_quit(t->d.mainloop);
+}
+
+static void handle_put_throughput(GObex *obex, GObexPacket *req,
+							gpointer user_data)
+{
+	struct throughput_data *t = user_data;
+	guint id;
+
+	id = g_obex_put_rsp(obex, req, rcv_throughput, throughput_complete, t,
+					&t->d.err, G_OBEX_HDR_INVALID);
+	if (id == 0)
+		g_main_loop_quit(t->d.mainloop);
+}
+
+static void conn_complete_put_throughput(GObex *obex, GError *err,
+					GObexPacket *rsp, gpointer user_data)
+{
+	struct throughput_data *t = user_data;
+
+	if (err != NULL) {
+		t->d.err = g_error_copy(err);
+		g_main_loop_quit(t->d.mainloop);
+		return;
+	}
+
+	g_obex_put_req(obex, provide_throughput, throughput_complete, t,
+					&t->d.err,
+					G_OBEX_HDR_NAME, "throughput.bin",
+					G_OBEX_HDR_INVALID);
+	if (t->d.err != NULL)
+		g_main_loop_quit(t->d.mainloop);
+}
+
+static void test_packet_put_throughput(gconstpointer data)
+{
+	gssize mtu = GPOINTER_TO_UINT(data);
+	struct throughput_data t;
+	GIOChannel *io[2];
+	guint timer_id;
+	double elapsed;
+	int sv[2], i;
+
+	memset(&t, 0, sizeof(t));
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0,
+								sv) == 0);
+
+	for (i = 0; i < 2; i++) {
+		io[i] = g_io_channel_unix_new(sv[i]);
+		g_io_channel_set_close_on_unref(io[i], TRUE);
+	}
+
+	t.d.obex = g_obex_new(io[0], G_OBEX_TRANSPORT_PACKET, mtu, mtu);
+	t.server = g_obex_new(io[1], G_OBEX_TRANSPORT_PACKET, mtu, mtu);
+	g_assert(t.d.obex != NULL && t.server != NULL);
+
+	g_io_channel_unref(io[0]);
+	g_io_channel_unref(io[1]);
+
+	g_obex_add_request_function(t.server, G_OBEX_OP_CONNECT,
+						handle_conn_rsp, &t.d);
+	g_obex_add_request_function(t.server, G_OBEX_OP_PUT,
+						handle_put_throughput, &t);
+
+	t.d.mainloop = g_main_loop_new(NULL, FALSE);
+
+	timer_id = g_timeout_add_seconds(10, test_timeout, &t.d);
+
+	g_test_timer_start();
+
+	g_obex_connect(t.d.obex, conn_complete_put_throughput, &t, &t.d.err,
+							G_OBEX_HDR_INVALID);
+	g_assert_no_error(t.d.err);
+
+	g_main_loop_run(t.d.mainloop);
+
+	elapsed = g_test_timer_elapsed();
+
+	g_main_loop_unref(t.d.mainloop);
+
+	g_source_remove(timer_id);
+	g_obex_unref(t.d.obex);
+	g_obex_unref(t.server);
+
+	g_assert_no_error(t.d.err);
+	g_assert_cmpuint(t.received, ==, THROUGHPUT_SIZE);
+
+	g_test_maximized_result(THROUGHPUT_SIZE / 1024 / elapsed,
+				"%zd byte MTU: %.0f KiB/s", mtu,
+				THROUGHPUT_SIZE / 1024 / elapsed);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -2407,5 +2540,12 @@ int main(int argc, char *argv[])
 	g_test_add_func("/gobex/test_conn_put_req_seq_srm",
 						test_conn_put_req_seq_srm);
 
+	g_test_add_data_func("/gobex/test_packet_put_throughput_4k",
+					GUINT_TO_POINTER(4096),
+					test_packet_put_throughput);
+	g_test_add_data_func("/gobex/test_packet_put_throughput_64k",
+					GUINT_TO_POINTER(65535),
+					test_packet_put_throughput);
+
 	return g_test_run();
 }
@@ -0,0 +1,180 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/handle-alloc.h"
+
+static void test_basic(void)
+{
+	struct handle_alloc *alloc;
+	unsigned int i;
+
+	g_assert(handle_alloc_new(0x0000, 0x0010) == NULL);
+	g_assert(handle_alloc_new(0x0010, 0x0001) == NULL);
+
+	alloc = handle_alloc_new(0x0001, 0x0010);
+	g_assert(alloc != NULL);
+
+	g_assert(handle_alloc_get(alloc, 0) == 0);
+	g_assert(handle_alloc_get(alloc, 0x0011) == 0);
+
+	for (i = 0; i < 4; i++)
+		g_assert(handle_alloc_get(alloc, 4) == 0x0001 + i * 4);
+
+	g_assert(handle_alloc_get(alloc, 1) == 0);
+
+	handle_alloc_destroy(alloc);
+}
+
+static void test_reuse(void)
+{
+	struct handle_alloc *alloc;
+
+	alloc = handle_alloc_new(0x0001, 0xfffe);
+	g_assert(alloc != NULL);
+
+	g_assert(handle_alloc_get(alloc, 10) == 0x0001);
+	g_assert(handle_alloc_get(alloc, 10) == 0x000b);
+	g_assert(handle_alloc_get(alloc, 10) == 0x0015);
+
+	/* A hole is reused by the first range fitting in it */
+	handle_alloc_put(alloc, 0x000b, 10);
+	g_assert(handle_alloc_get(alloc, 11) == 0x001f);
+	g_assert(handle_alloc_get(alloc, 4) == 0x000b);
+	g_assert(handle_alloc_get(alloc, 6) == 0x000f);
+	g_assert(handle_alloc_get(alloc, 1) == 0x002a);
+
+	/* Neighbouring holes merge */
+	handle_alloc_put(alloc, 0x0001, 10);
+	handle_alloc_put(alloc, 0x0015, 10);
+	handle_alloc_put(alloc, 0x000b, 4);
+	handle_alloc_put(alloc, 0x000f, 6);
+	g_assert(handle_alloc_get(alloc, 30) == 0x0001);
+
+	handle_alloc_destroy(alloc);
+}
+
+static void test_reserve(void)
+{
+	struct handle_alloc *alloc;
+
+	alloc = handle_alloc_new(0x0001, 0xffff);
+	g_assert(alloc != NULL);
+
+	g_assert(handle_alloc_reserve(alloc, 0x0000, 1) == false);
+	g_assert(handle_alloc_reserve(alloc, 0xffff, 2) == false);
+
+	g_assert(handle_alloc_reserve(alloc, 0x0010, 16) == true);
+	g_assert(handle_alloc_reserve(alloc, 0x0018, 1) == false);
+	g_assert(handle_alloc_reserve(alloc, 0x000f, 2) == false);
+	g_assert(handle_alloc_reserve(alloc, 0xffff, 1) == true);
+
+	g_assert(handle_alloc_get(alloc, 15) == 0x0001);
+	g_assert(handle_alloc_get(alloc, 1) == 0x0020);
+
+	/* Releasing handles already free does nothing */
+	handle_alloc_put(alloc, 0x0021, 4);
+	g_assert(handle_alloc_get(alloc, 1) == 0x0021);
+
+	handle_alloc_destroy(alloc);
+}
+
+struct walk_data {
+	unsigned int ranges;
+	uint16_t last;
+	bool reverse;
+};
+
+static bool walk_range(uint16_t start, uint16_t end, void *user_data)
+{
+	struct walk_data *data = user_data;
+
+	g_assert(start <= end);
+
+	if (data->ranges) {
+		if (data->reverse)
+			g_assert(end < data->last);
+		else
+			g_assert(start > data->last);
+	}
+
+	data->last = data->reverse ? start : end;
+	data->ranges++;
+
+	return false;
+}
+
+static void test_foreach(void)
+{
+	struct handle_alloc *alloc;
+	struct walk_data data;
+	unsigned int i;
+
+	alloc = handle_alloc_new(0x0001, 0x00ff);
+	g_assert(alloc != NULL);
+
+	g_assert(handle_alloc_get(alloc, 0xff) == 0x0001);
+
+	for (i = 0x0001; i <= 0x00ff; i += 2)
+		handle_alloc_put(alloc, i, 1);
+
+	memset(&data, 0, sizeof(data));
+	handle_alloc_foreach(alloc, false, walk_range, &data);
+	g_assert(data.ranges == 128);
+	g_assert(data.last == 0x00ff);
+
+	memset(&data, 0, sizeof(data));
+	data.reverse = true;
+	handle_alloc_foreach(alloc, true, walk_range, &data);
+	g_assert(data.ranges == 128);
+	g_assert(data.last == 0x0001);
+
+	/* Filling the gaps leaves a single range again */
+	for (i = 0x0002; i < 0x00ff; i += 2)
+		handle_alloc_put(alloc, i, 1);
+
+	memset(&data, 0, sizeof(data));
+	handle_alloc_foreach(alloc, false, walk_range, &data);
+	g_assert(data.ranges == 1);
+
+	handle_alloc_destroy(alloc);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/handle-alloc/basic", test_basic);
+	g_test_add_func("/handle-alloc/reuse", test_reuse);
+	g_test_add_func("/handle-alloc/reserve", test_reserve);
+	g_test_add_func("/handle-alloc/foreach", test_foreach);
+
+	return g_test_run();
+}
@@ -271,6 +271,58 @@ static void test_register(gconstpointer data)
 	execute_context(context);
 }
 
+static void unexpected_handler(struct hfp_gw_result *result,
+				enum hfp_gw_cmd_type type, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+static void test_register_overlap(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_pdu *pdu;
+	ssize_t len;
+	bool ret;
+
+	context->hfp = hfp_gw_new(context->fd_client);
+	g_assert(context->hfp);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	ret = hfp_gw_set_close_on_unref(context->hfp, true);
+	g_assert(ret);
+
+	/* Prefixes sharing a stem with the tested one must not match it */
+	ret = hfp_gw_register(context->hfp, unexpected_handler, "+BRS",
+								context, NULL);
+	g_assert(ret);
+
+	ret = hfp_gw_register(context->hfp, unexpected_handler, "+BRSFX",
+								context, NULL);
+	g_assert(ret);
+
+	ret = hfp_gw_register(context->hfp, context->data->result_func,
+					(char *)pdu->data, context, NULL);
+	g_assert(ret);
+
+	ret = hfp_gw_register(context->hfp, unexpected_handler,
+					(char *)pdu->data, context, NULL);
+	g_assert(!ret);
+
+	ret = hfp_gw_unregister(context->hfp, "+BRS");
+	g_assert(ret);
+
+	ret = hfp_gw_unregister(context->hfp, "+BRS");
+	g_assert(!ret);
+
+	pdu = &context->data->pdu_list[context->pdu_offset++];
+
+	len = write(context->fd_server, pdu->data, pdu->size);
+	g_assert_cmpint(len, ==, pdu->size);
+
+	execute_context(context);
+}
+
 static gboolean send_pdu(gpointer user_data)
 {
 	struct context *context = user_data;
@@ -439,6 +491,12 @@ int main(int argc, char *argv[])
 			raw_pdu('A', 'T', 'D', '1', '2', '3', '4', '5', '\r'),
 			type_pdu(HFP_GW_CMD_TYPE_SET, 0),
 			data_end());
+	define_test("/hfp/test_register_6", test_register_overlap,
+			prefix_handler,
+			raw_pdu('+', 'B', 'R', 'S', 'F', '\0'),
+			raw_pdu('A', 'T', '+', 'B', 'R', 'S', 'F', '\r'),
+			type_pdu(HFP_GW_CMD_TYPE_COMMAND, 0),
+			data_end());
 	define_test("/hfp/test_fragmented_1", test_fragmented, NULL,
 			frg_pdu('A'), frg_pdu('T'), frg_pdu('+'), frg_pdu('B'),
 			frg_pdu('R'), frg_pdu('S'), frg_pdu('F'), frg_pdu('\r'),
@@ -0,0 +1,208 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/idmap.h"
+
+static void test_basic(void)
+{
+	struct idmap *map;
+	unsigned int i;
+
+	map = idmap_new();
+	g_assert(map != NULL);
+
+	g_assert(idmap_isempty(map) == true);
+	g_assert(idmap_insert(map, 0, UINT_TO_PTR(1)) == false);
+
+	for (i = 1; i <= 1024; i++)
+		g_assert(idmap_insert(map, i, UINT_TO_PTR(i)) == true);
+
+	g_assert(idmap_size(map) == 1024);
+	g_assert(idmap_insert(map, 512, UINT_TO_PTR(512)) == false);
+
+	for (i = 1; i <= 1024; i++)
+		g_assert(PTR_TO_UINT(idmap_lookup(map, i)) == i);
+
+	g_assert(idmap_lookup(map, 1025) == NULL);
+
+	for (i = 1; i <= 1024; i += 2)
+		g_assert(PTR_TO_UINT(idmap_remove(map, i)) == i);
+
+	g_assert(idmap_size(map) == 512);
+
+	for (i = 1; i <= 1024; i++) {
+		if (i % 2)
+			g_assert(idmap_lookup(map, i) == NULL);
+		else
+			g_assert(PTR_TO_UINT(idmap_lookup(map, i)) == i);
+	}
+
+	idmap_destroy(map, NULL);
+}
+
+static void check_order(void *data, void *user_data)
+{
+	unsigned int *last = user_data;
+
+	g_assert(PTR_TO_UINT(data) > *last);
+	*last = PTR_TO_UINT(data);
+}
+
+static void test_order(void)
+{
+	struct idmap *map;
+	unsigned int i, last = 0;
+
+	map = idmap_new();
+	g_assert(map != NULL);
+
+	/* Iteration follows insertion order, not id order */
+	for (i = 1; i <= 100; i++)
+		idmap_insert(map, 1000 - i * 7, UINT_TO_PTR(i));
+
+	idmap_foreach(map, check_order, &last);
+	g_assert(last == 100);
+
+	idmap_destroy(map, NULL);
+}
+
+struct remove_data {
+	struct idmap *map;
+	unsigned int calls;
+};
+
+static void foreach_remove(void *data, void *user_data)
+{
+	struct remove_data *rd = user_data;
+	unsigned int id = PTR_TO_UINT(data);
+
+	rd->calls++;
+
+	/* Drop ourselves and the next entry */
+	g_assert(idmap_remove(rd->map, id) == data);
+	idmap_remove(rd->map, id + 1);
+
+	g_assert(idmap_lookup(rd->map, id) == NULL);
+	g_assert(idmap_lookup(rd->map, id + 1) == NULL);
+
+	/* Reusing an id during iteration must be possible */
+	if (rd->calls == 1)
+		g_assert(idmap_insert(rd->map, id, data) == true);
+}
+
+static void test_foreach_remove(void)
+{
+	struct remove_data rd;
+	unsigned int i;
+
+	rd.map = idmap_new();
+	rd.calls = 0;
+	g_assert(rd.map != NULL);
+
+	for (i = 1; i <= 10; i++)
+		idmap_insert(rd.map, i, UINT_TO_PTR(i));
+
+	idmap_foreach(rd.map, foreach_remove, &rd);
+
+	/* 1, 3, 5, 7, 9 and the re-inserted entry */
+	g_assert(rd.calls == 6);
+	g_assert(idmap_size(rd.map) == 0);
+
+	idmap_destroy(rd.map, NULL);
+}
+
+static void foreach_destroy(void *data, void *user_data)
+{
+	struct remove_data *rd = user_data;
+
+	rd->calls++;
+
+	idmap_destroy(rd->map, NULL);
+}
+
+static void test_foreach_destroy(void)
+{
+	struct remove_data rd;
+
+	rd.map = idmap_new();
+	rd.calls = 0;
+	g_assert(rd.map != NULL);
+
+	idmap_insert(rd.map, 1, UINT_TO_PTR(1));
+	idmap_insert(rd.map, 2, UINT_TO_PTR(2));
+
+	idmap_foreach(rd.map, foreach_destroy, &rd);
+
+	g_assert(rd.calls == 1);
+}
+
+static struct idmap *static_map;
+
+static void destroy_remove(void *data)
+{
+	idmap_remove(static_map, PTR_TO_UINT(data) + 1);
+}
+
+static bool match_odd(const void *a, const void *b)
+{
+	return PTR_TO_UINT(a) % 2;
+}
+
+static void test_remove_all(void)
+{
+	unsigned int i;
+
+	static_map = idmap_new();
+	g_assert(static_map != NULL);
+
+	for (i = 1; i <= 10; i++)
+		idmap_insert(static_map, i, UINT_TO_PTR(i));
+
+	/* Destroying an odd entry takes the following even one along */
+	g_assert(idmap_remove_all(static_map, match_odd, NULL,
+						destroy_remove) == 5);
+	g_assert(idmap_isempty(static_map) == true);
+
+	idmap_destroy(static_map, NULL);
+	static_map = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/idmap/basic", test_basic);
+	g_test_add_func("/idmap/order", test_order);
+	g_test_add_func("/idmap/foreach_remove", test_foreach_remove);
+	g_test_add_func("/idmap/foreach_destroy", test_foreach_destroy);
+	g_test_add_func("/idmap/remove_all", test_remove_all);
+
+	return g_test_run();
+}
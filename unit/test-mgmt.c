@@ -232,6 +232,32 @@ static void test_command(gconstpointer data)
 	execute_context(context);
 }
 
+static const unsigned char read_info_index_0[] =
+				{ 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static const unsigned char read_info_index_1[] =
+				{ 0x04, 0x00, 0x01, 0x00, 0x00, 0x00 };
+
+static void test_pipeline(void)
+{
+	struct context *context = create_context();
+
+	/*
+	 * The first command is never answered, the second one is for a
+	 * different index and must be sent anyway.
+	 */
+	add_action(context, read_info_index_0, sizeof(read_info_index_0),
+						false, ACTION_IGNORE);
+	add_action(context, read_info_index_1, sizeof(read_info_index_1),
+						false, ACTION_PASSED);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 0, 0, NULL,
+							NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 1, 0, NULL,
+							NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -239,5 +265,7 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/mgmt/command/1", &command_test_1, test_command);
 	g_test_add_data_func("/mgmt/command/2", &command_test_2, test_command);
 
+	g_test_add_func("/mgmt/pipeline", test_pipeline);
+
 	return g_test_run();
 }
@@ -58,6 +58,68 @@ static void test_basic(void)
 	queue_destroy(queue, NULL);
 }
 
+static void test_reuse(void)
+{
+	struct queue *queue;
+	unsigned int n, i;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	/* Recycled entries must not carry anything over */
+	for (n = 0; n < 256; n++) {
+		for (i = 1; i < n + 2; i++) {
+			if (i % 2)
+				queue_push_tail(queue, UINT_TO_PTR(i));
+			else
+				queue_push_head(queue, UINT_TO_PTR(i));
+		}
+
+		g_assert(queue_length(queue) == n + 1);
+
+		for (i = 1; i < n + 2; i += 2)
+			g_assert(queue_remove(queue, UINT_TO_PTR(i)));
+
+		g_assert(queue_length(queue) == (n + 1) / 2);
+
+		for (i = n + 1 - (n + 1) % 2; i > 1; i -= 2)
+			g_assert(PTR_TO_UINT(queue_pop_head(queue)) == i);
+
+		g_assert(queue_isempty(queue) == true);
+		g_assert(queue_peek_head(queue) == NULL);
+		g_assert(queue_peek_tail(queue) == NULL);
+	}
+
+	queue_destroy(queue, NULL);
+}
+
+static void test_benchmark(void)
+{
+	struct queue *queue;
+	unsigned int n, i;
+	double elapsed;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	g_test_timer_start();
+
+	for (n = 0; n < 100000; n++) {
+		for (i = 0; i < 16; i++)
+			queue_push_tail(queue, UINT_TO_PTR(i));
+
+		for (i = 0; i < 16; i++)
+			queue_pop_head(queue);
+	}
+
+	elapsed = g_test_timer_elapsed();
+
+	g_test_minimized_result(elapsed, "%u push/pop pairs in %.3f s",
+							n * 16, elapsed);
+
+	queue_destroy(queue, NULL);
+}
+
 static void foreach_destroy(void *data, void *user_data)
 {
 	struct queue *queue = user_data;
@@ -104,8 +166,12 @@ int main(int argc, char *argv[])
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add_func("/queue/basic", test_basic);
+	g_test_add_func("/queue/reuse", test_reuse);
 	g_test_add_func("/queue/foreach_destroy", test_foreach_destroy);
 	g_test_add_func("/queue/foreach_remove_all", test_foreach_remove_all);
 
+	if (g_test_perf())
+		g_test_add_func("/queue/benchmark", test_benchmark);
+
 	return g_test_run();
 }
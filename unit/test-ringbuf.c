@@ -142,6 +142,116 @@ static void test_printf(void)
 	ringbuf_free(rb);
 }
 
+static void test_printf_wrap(void)
+{
+	static size_t rb_capa = 512;
+	char pattern[1024];
+	struct ringbuf *rb;
+	int i;
+
+	for (i = 0; i < (int) sizeof(pattern); i++)
+		pattern[i] = 'a' + i % 26;
+
+	rb = ringbuf_new(rb_capa);
+	g_assert(rb != NULL);
+
+	/* Keep one byte queued so that the write position keeps moving */
+	g_assert(ringbuf_printf(rb, "-") == 1);
+
+	for (i = 1; i < 10000; i++) {
+		size_t len, count = i % (rb_capa - 1);
+		char *str, *ptr;
+
+		if (!count)
+			continue;
+
+		if (g_test_verbose())
+			g_print("Iteration %i\n", i);
+
+		len = asprintf(&str, "%.*s", (int) count, pattern + i % 26);
+		g_assert(len == count);
+
+		len = ringbuf_printf(rb, "%.*s", (int) count, pattern + i % 26);
+		g_assert(len == count);
+		g_assert(ringbuf_len(rb) == count + 1);
+
+		/* Strings that do not fit are rejected as a whole */
+		g_assert(ringbuf_printf(rb, "%*c",
+				(int) ringbuf_avail(rb) + 1, 'x') == -1);
+		g_assert(ringbuf_len(rb) == count + 1);
+
+		g_assert(ringbuf_drain(rb, 1) == 1);
+
+		ptr = ringbuf_peek(rb, 0, &len);
+		g_assert(ptr != NULL);
+		g_assert(strncmp(str, ptr, len) == 0);
+
+		if (len < count) {
+			ptr = ringbuf_peek(rb, len, NULL);
+			g_assert(strncmp(str + len, ptr, count - len) == 0);
+		}
+
+		g_assert(ringbuf_drain(rb, count - 1) == count - 1);
+		g_assert(ringbuf_len(rb) == 1);
+
+		free(str);
+	}
+
+	ringbuf_free(rb);
+}
+
+static void test_append_wrap(void)
+{
+	static size_t rb_capa = 512;
+	uint8_t pattern[1024], out[512];
+	struct ringbuf *rb;
+	int i;
+
+	for (i = 0; i < (int) sizeof(pattern); i++)
+		pattern[i] = i & 0xff;
+
+	rb = ringbuf_new(rb_capa);
+	g_assert(rb != NULL);
+
+	/* Keep one byte queued so that the write position keeps moving */
+	g_assert(ringbuf_append(rb, pattern, 1) == 1);
+
+	for (i = 1; i < 10000; i++) {
+		size_t len, count = i % (rb_capa - 1);
+		uint8_t *ptr;
+
+		if (!count)
+			continue;
+
+		len = ringbuf_append(rb, pattern + i % 256, count);
+		g_assert(len == count);
+		g_assert(ringbuf_len(rb) == count + 1);
+
+		/* Data that does not fit is rejected as a whole */
+		g_assert(ringbuf_append(rb, pattern,
+					ringbuf_avail(rb) + 1) == -1);
+		g_assert(ringbuf_len(rb) == count + 1);
+
+		g_assert(ringbuf_drain(rb, 1) == 1);
+
+		ptr = ringbuf_peek(rb, 0, &len);
+		g_assert(ptr != NULL);
+		memcpy(out, ptr, len);
+
+		if (len < count) {
+			ptr = ringbuf_peek(rb, len, NULL);
+			memcpy(out + len, ptr, count - len);
+		}
+
+		g_assert(memcmp(out, pattern + i % 256, count) == 0);
+
+		g_assert(ringbuf_drain(rb, count - 1) == count - 1);
+		g_assert(ringbuf_len(rb) == 1);
+	}
+
+	ringbuf_free(rb);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -149,6 +259,8 @@ int main(int argc, char *argv[])
 	g_test_add_func("/ringbuf/power2", test_power2);
 	g_test_add_func("/ringbuf/alloc", test_alloc);
 	g_test_add_func("/ringbuf/printf", test_printf);
+	g_test_add_func("/ringbuf/printf_wrap", test_printf_wrap);
+	g_test_add_func("/ringbuf/append_wrap", test_append_wrap);
 
 	return g_test_run();
 }
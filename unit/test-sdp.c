@@ -788,6 +788,53 @@ static void test_sdp_de_attr(gconstpointer data)
 	sdp_data_free(d);
 }
 
+/*
+ * OPP-like record: handle, L2CAP + RFCOMM channel 12, profile 0x1105
+ * version 1.2 and GOEP L2CAP PSM 0x1005
+ */
+static const uint8_t pdu_record[] = {
+	0x35, 0x2c,
+	0x09, 0x00, 0x00, 0x0a, 0x00, 0x01, 0x00, 0x01,
+	0x09, 0x00, 0x04, 0x35, 0x0c, 0x35, 0x03, 0x19, 0x01, 0x00,
+	0x35, 0x05, 0x19, 0x00, 0x03, 0x08, 0x0c,
+	0x09, 0x00, 0x09, 0x35, 0x08, 0x35, 0x06, 0x19, 0x11, 0x05,
+	0x09, 0x01, 0x02,
+	0x09, 0x02, 0x00, 0x09, 0x10, 0x05,
+};
+
+static void test_sdp_pdu_lookup(void)
+{
+	const uint8_t *p;
+	int size = 0, i;
+
+	p = sdp_pdu_get_attr(pdu_record, sizeof(pdu_record), 0x0200, &size);
+	g_assert(p != NULL);
+	g_assert_cmpint(size, ==, 3);
+	g_assert_cmpuint(p[0], ==, SDP_UINT16);
+	g_assert_cmpuint(get_be16(p + 1), ==, 0x1005);
+
+	p = sdp_pdu_get_attr(pdu_record, sizeof(pdu_record), 0x0100, &size);
+	g_assert(p == NULL);
+
+	g_assert_cmpint(sdp_pdu_get_proto_port(pdu_record, sizeof(pdu_record),
+						RFCOMM_UUID), ==, 12);
+	g_assert_cmpint(sdp_pdu_get_proto_port(pdu_record, sizeof(pdu_record),
+						L2CAP_UUID), ==, 0);
+
+	g_assert_cmpint(sdp_pdu_get_profile_version(pdu_record,
+				sizeof(pdu_record), 0x1105), ==, 0x0102);
+	g_assert_cmpint(sdp_pdu_get_profile_version(pdu_record,
+				sizeof(pdu_record), 0x1106), ==, -1);
+
+	/* Truncated records must never be read past their end */
+	for (i = 0; i < (int) sizeof(pdu_record); i++) {
+		g_assert_cmpint(sdp_pdu_get_proto_port(pdu_record, i,
+							RFCOMM_UUID), ==, 0);
+		g_assert(sdp_pdu_get_attr(pdu_record, i, 0x0200,
+							&size) == NULL);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -2822,5 +2869,7 @@ int main(int argc, char *argv[])
 						0x00, 0x00, 0x00, 0x00, 0x00,
 						0x00, 0x00, 0x00, 0x00, 0x00)));
 
+	g_test_add_func("/sdp/PDU/lookup", test_sdp_pdu_lookup);
+
 	return g_test_run();
 }
@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <glib.h>
 
@@ -264,6 +265,66 @@ static void test_multiple(void)
 	textfile_foreach(test_pathname, check_entry, GUINT_TO_POINTER(max));
 }
 
+static void util_create_file(const char *str)
+{
+	char pathname[PATH_MAX];
+	int fd;
+
+	snprintf(pathname, sizeof(pathname), "%s.new", test_pathname);
+
+	fd = creat(pathname, 0644);
+	if (fd < 0)
+		return;
+
+	if (write(fd, str, strlen(str)) < 0)
+		goto done;
+
+	if (rename(pathname, test_pathname) < 0)
+		goto done;
+
+done:
+	close(fd);
+}
+
+static void test_reload(void)
+{
+	char *str;
+
+	util_create_file("00:00:00:00:00:01 first\n"
+				"00:00:00:00:00:01 second\n");
+
+	str = textfile_get(test_pathname, "00:00:00:00:00:01");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "first") == 0);
+	free(str);
+
+	util_create_file("00:00:00:00:00:02 other\r\n"
+				"00:00:00:00:00:01 replaced\r\n");
+
+	str = textfile_get(test_pathname, "00:00:00:00:00:01");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "replaced") == 0);
+	free(str);
+
+	g_assert(textfile_put(test_pathname, "00:00:00:00:00:02",
+							"again") == 0);
+
+	str = textfile_get(test_pathname, "00:00:00:00:00:02");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "again") == 0);
+	free(str);
+
+	g_assert(textfile_del(test_pathname, "00:00:00:00:00:02") == 0);
+
+	str = textfile_get(test_pathname, "00:00:00:00:00:02");
+	g_assert(str == NULL);
+
+	str = textfile_get(test_pathname, "00:00:00:00:00:01");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "replaced") == 0);
+	free(str);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -272,6 +333,7 @@ int main(int argc, char *argv[])
 	g_test_add_func("/textfile/delete", test_delete);
 	g_test_add_func("/textfile/overwrite", test_overwrite);
 	g_test_add_func("/textfile/multiple", test_multiple);
+	g_test_add_func("/textfile/reload", test_reload);
 
 	return g_test_run();
 }
@@ -163,6 +163,43 @@ static void test_cmp(gconstpointer data)
 	g_assert(bt_uuid_cmp(&uuid1, &uuid2) == 0);
 }
 
+static void test_hash(gconstpointer data)
+{
+	const struct uuid_test_data *test_data = data;
+	bt_uuid_t uuid1, uuid2;
+
+	g_assert(bt_string_to_uuid(&uuid1, test_data->str) == 0);
+	g_assert(bt_string_to_uuid(&uuid2, test_data->str128) == 0);
+
+	g_assert(bt_uuid_hash(&uuid1) == bt_uuid_hash(&uuid2));
+}
+
+static void test_order(void)
+{
+	bt_uuid_t u16_low, u16_high, u32, u128_low, u128_high, u128_other;
+
+	bt_uuid16_create(&u16_low, 0x1800);
+	bt_uuid16_create(&u16_high, 0x2a00);
+	bt_uuid32_create(&u32, 0x12345678);
+	g_assert(bt_string_to_uuid(&u128_low,
+				"00001800-0000-1000-8000-00805f9b34fb") == 0);
+	g_assert(bt_string_to_uuid(&u128_high,
+				"00002a00-0000-1000-8000-00805f9b34fb") == 0);
+	g_assert(bt_string_to_uuid(&u128_other,
+				"00001800-0000-1000-8000-00805f9b34fc") == 0);
+
+	g_assert(bt_uuid_cmp(&u16_low, &u16_high) < 0);
+	g_assert(bt_uuid_cmp(&u16_high, &u16_low) > 0);
+	g_assert(bt_uuid_cmp(&u16_high, &u32) < 0);
+	g_assert(bt_uuid_cmp(&u16_low, &u128_high) < 0);
+	g_assert(bt_uuid_cmp(&u128_high, &u16_low) > 0);
+	g_assert(bt_uuid_cmp(&u16_low, &u128_low) == 0);
+	g_assert(bt_uuid_cmp(&u16_low, &u128_other) < 0);
+	g_assert(bt_uuid_cmp(&u128_other, &u16_low) > 0);
+
+	g_assert(bt_uuid_hash(&u16_low) != bt_uuid_hash(&u128_other));
+}
+
 static const char *malformed[] = {
 	"0",
 	"01",
@@ -199,22 +236,29 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/uuid/base", &uuid_base, test_uuid);
 	g_test_add_data_func("/uuid/base/str", &uuid_base, test_str);
 	g_test_add_data_func("/uuid/base/cmp", &uuid_base, test_cmp);
+	g_test_add_data_func("/uuid/base/hash", &uuid_base, test_hash);
 
 	g_test_add_data_func("/uuid/sixteen1", &uuid_sixteen1, test_uuid);
 	g_test_add_data_func("/uuid/sixteen1/str", &uuid_sixteen1, test_str);
 	g_test_add_data_func("/uuid/sixteen1/cmp", &uuid_sixteen1, test_cmp);
+	g_test_add_data_func("/uuid/sixteen1/hash", &uuid_sixteen1, test_hash);
 
 	g_test_add_data_func("/uuid/sixteen2", &uuid_sixteen2, test_uuid);
 	g_test_add_data_func("/uuid/sixteen2/str", &uuid_sixteen2, test_str);
 	g_test_add_data_func("/uuid/sixteen2/cmp", &uuid_sixteen2, test_cmp);
+	g_test_add_data_func("/uuid/sixteen2/hash", &uuid_sixteen2, test_hash);
 
 	g_test_add_data_func("/uuid/thirtytwo1", &uuid_32_1, test_uuid);
 	g_test_add_data_func("/uuid/thirtytwo1/str", &uuid_32_1, test_str);
 	g_test_add_data_func("/uuid/thirtytwo1/cmp", &uuid_32_1, test_cmp);
+	g_test_add_data_func("/uuid/thirtytwo1/hash", &uuid_32_1, test_hash);
 
 	g_test_add_data_func("/uuid/thirtytwo2", &uuid_32_2, test_uuid);
 	g_test_add_data_func("/uuid/thritytwo2/str", &uuid_32_2, test_str);
 	g_test_add_data_func("/uuid/thirtytwo2/cmp", &uuid_32_2, test_cmp);
+	g_test_add_data_func("/uuid/thirtytwo2/hash", &uuid_32_2, test_hash);
+
+	g_test_add_func("/uuid/order", test_order);
 
 	for (i = 0; malformed[i]; i++) {
 		char *testpath;